@@ -1,685 +1,1013 @@
-//////////////////////////////////////////////////////////////////////////
-//
-// ThumbnailGenerator: Creates thumbnail images from video files.
-//
-// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
-// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
-// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
-// PARTICULAR PURPOSE.
-//
-// Copyright (c) Microsoft Corporation. All rights reserved.
-//
-//////////////////////////////////////////////////////////////////////////
-
-#include "videothumbnail.h"
-#include "Thumbnail.h"
-
-#pragma warning(disable:4127)  // Disable warning C4127: conditional expression is constant
-
-RECT    CorrectAspectRatio(const RECT& src, const MFRatio& srcPAR);
-HRESULT GetVideoDisplayArea(IMFMediaType *pType, MFVideoArea *pArea);
-RECT    RectFromArea(const MFVideoArea& area);
-void    GetPixelAspectRatio(IMFMediaType *pType, MFRatio *pPar);
-
-const LONGLONG SEEK_TOLERANCE = 10000000;
-const LONGLONG MAX_FRAMES_TO_SKIP = 10;
-
-//-------------------------------------------------------------------
-// ThumbnailGenerator constructor
-//-------------------------------------------------------------------
-
-ThumbnailGenerator::ThumbnailGenerator()
-    : m_pReader(NULL)
-{
-    ZeroMemory(&m_format, sizeof(m_format));
-}
-
-
-
-//-------------------------------------------------------------------
-// ThumbnailGenerator destructor
-//-------------------------------------------------------------------
-
-ThumbnailGenerator::~ThumbnailGenerator()
-{
-    SafeRelease(&m_pReader);
-}
-
-
-
-//-------------------------------------------------------------------
-// OpenFile: Opens a video file.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::OpenFile(const WCHAR* wszFileName)
-{
-    HRESULT hr = S_OK;
-
-    IMFAttributes *pAttributes = NULL;
-
-    SafeRelease(&m_pReader);
-
-    // Configure the source reader to perform video processing.
-    //
-    // This includes:
-    //   - YUV to RGB-32
-    //   - Software deinterlace
-
-    hr = MFCreateAttributes(&pAttributes, 1);
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pAttributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
-    }
-
-    // Create the source reader from the URL.
-
-    if (SUCCEEDED(hr))
-    {
-        hr = MFCreateSourceReaderFromURL(wszFileName, pAttributes, &m_pReader);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // Attempt to find a video stream.
-        hr = SelectVideoStream();
-    }
-
-    return hr;
-}
-
-
-
-//-------------------------------------------------------------------
-// GetDuration: Finds the duration of the current video file.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::GetDuration(LONGLONG *phnsDuration)
-{
-    PROPVARIANT var;
-    PropVariantInit(&var);
-
-    HRESULT hr = S_OK;
-
-    if (m_pReader == NULL)
-    {
-        return MF_E_NOT_INITIALIZED;
-    }
-
-    hr = m_pReader->GetPresentationAttribute(
-        (DWORD)MF_SOURCE_READER_MEDIASOURCE,
-        MF_PD_DURATION,
-        &var
-        );
-
-    if (SUCCEEDED(hr))
-    {
-        assert(var.vt == VT_UI8);
-        *phnsDuration = var.hVal.QuadPart;
-    }
-
-    PropVariantClear(&var);
-
-    return hr;
-}
-
-
-
-//-------------------------------------------------------------------
-// CanSeek: Queries whether the current video file is seekable.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::CanSeek(BOOL *pbCanSeek)
-{
-    HRESULT hr = S_OK;
-
-    ULONG flags = 0;
-
-    PROPVARIANT var;
-    PropVariantInit(&var);
-
-    if (m_pReader == NULL)
-    {
-        return MF_E_NOT_INITIALIZED;
-    }
-
-    *pbCanSeek = FALSE;
-
-    hr = m_pReader->GetPresentationAttribute(
-        (DWORD)MF_SOURCE_READER_MEDIASOURCE,
-        MF_SOURCE_READER_MEDIASOURCE_CHARACTERISTICS,
-        &var
-        );
-
-    if (SUCCEEDED(hr))
-    {
-        hr = PropVariantToUInt32(var, &flags);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        // If the source has slow seeking, we will treat it as
-        // not supporting seeking.
-
-        if ((flags & MFMEDIASOURCE_CAN_SEEK) &&
-            !(flags & MFMEDIASOURCE_HAS_SLOW_SEEK))
-        {
-            *pbCanSeek = TRUE;
-        }
-    }
-
-    return hr;
-}
-
-
-//-------------------------------------------------------------------
-// CreateBitmaps
-//
-// Creates an array of thumbnails from the video file.
-//
-// pRT:      Direct2D render target. Used to create the bitmaps.
-// count:    Number of thumbnails to create.
-// pSprites: An array of Sprite objects to hold the bitmaps.
-//
-// Note: The caller allocates the sprite objects.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::CreateBitmaps(
-    ID2D1RenderTarget *pRT,
-    DWORD count,
-    Sprite pSprites[]
-    )
-{
-    HRESULT hr = S_OK;
-    BOOL bCanSeek = 0;
-
-    LONGLONG hnsDuration = 0;
-    LONGLONG hnsRangeStart = 0;
-    LONGLONG hnsRangeEnd = 0;
-    LONGLONG hnsIncrement = 0;
-
-    hr = CanSeek(&bCanSeek);
-
-    if (FAILED(hr)) { return hr; }
-
-    if (bCanSeek)
-    {
-        hr = GetDuration(&hnsDuration);
-
-        if (FAILED(hr)) { return hr; }
-
-        hnsRangeStart = 0;
-        hnsRangeEnd = hnsDuration;
-
-        // We have the file duration , so we'll take bitmaps from
-        // several positions in the file. Occasionally, the first frame
-        // in a video is black, so we don't start at time 0.
-
-        hnsIncrement = (hnsRangeEnd - hnsRangeStart) / (count + 1);
-
-    }
-
-    // Generate the bitmaps and invalidate the button controls so
-    // they will be redrawn.
-    for (DWORD i = 0; i < count; i++)
-    {
-        LONGLONG hPos = hnsIncrement * (i + 1);
-
-        hr = CreateBitmap(
-            pRT,
-            hPos,
-            &pSprites[i]
-        );
-    }
-
-    return hr;
-}
-
-
-//
-/// Private methods
-//
-
-//-------------------------------------------------------------------
-// CreateBitmap
-//
-// Creates one video thumbnail.
-//
-// pRT:      Direct2D render target. Used to create the bitmap.
-// hnsPos:   The seek position.
-// pSprite:  A Sprite object to hold the bitmap.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::CreateBitmap(
-    ID2D1RenderTarget *pRT,
-    LONGLONG& hnsPos,
-    Sprite *pSprite
-    )
-{
-    HRESULT     hr = S_OK;
-    DWORD       dwFlags = 0;
-
-    BYTE        *pBitmapData = NULL;    // Bitmap data
-    DWORD       cbBitmapData = 0;       // Size of data, in bytes
-    LONGLONG    hnsTimeStamp = 0;
-    BOOL        bCanSeek = FALSE;       // Can the source seek?
-    DWORD       cSkipped = 0;           // Number of skipped frames
-
-    IMFMediaBuffer *pBuffer = 0;
-    IMFSample *pSample = NULL;
-    ID2D1Bitmap *pBitmap = NULL;
-
-    hr = CanSeek(&bCanSeek);
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    if (bCanSeek && (hnsPos > 0))
-    {
-        PROPVARIANT var;
-        PropVariantInit(&var);
-
-        var.vt = VT_I8;
-        var.hVal.QuadPart = hnsPos;
-
-        hr = m_pReader->SetCurrentPosition(GUID_NULL, var);
-
-        if (FAILED(hr)) { goto done; }
-
-    }
-
-
-    // Pulls video frames from the source reader.
-
-    // NOTE: Seeking might be inaccurate, depending on the container
-    //       format and how the file was indexed. Therefore, the first
-    //       frame that we get might be earlier than the desired time.
-    //       If so, we skip up to MAX_FRAMES_TO_SKIP frames.
-
-    while (1)
-    {
-        IMFSample *pSampleTmp = NULL;
-
-        hr = m_pReader->ReadSample(
-            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-            0,
-            NULL,
-            &dwFlags,
-            NULL,
-            &pSampleTmp
-            );
-
-        if (FAILED(hr)) { goto done; }
-
-        if (dwFlags & MF_SOURCE_READERF_ENDOFSTREAM)
-        {
-            break;
-        }
-
-        if (dwFlags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
-        {
-            // Type change. Get the new format.
-            hr = GetVideoFormat(&m_format);
-
-            if (FAILED(hr)) { goto done; }
-        }
-
-        if (pSampleTmp == NULL)
-        {
-            continue;
-        }
-
-        // We got a sample. Hold onto it.
-
-        SafeRelease(&pSample);
-
-        pSample = pSampleTmp;
-        pSample->AddRef();
-
-        if (SUCCEEDED( pSample->GetSampleTime(&hnsTimeStamp) ))
-        {
-            // Keep going until we get a frame that is within tolerance of the
-            // desired seek position, or until we skip MAX_FRAMES_TO_SKIP frames.
-
-            // During this process, we might reach the end of the file, so we
-            // always cache the last sample that we got (pSample).
-
-            if ( (cSkipped < MAX_FRAMES_TO_SKIP) &&
-                 (hnsTimeStamp + SEEK_TOLERANCE < hnsPos) )
-            {
-                SafeRelease(&pSampleTmp);
-
-                ++cSkipped;
-                continue;
-            }
-        }
-
-        SafeRelease(&pSampleTmp);
-
-        hnsPos = hnsTimeStamp;
-        break;
-    }
-
-    if (pSample)
-    {
-        UINT32 pitch = 4 * m_format.imageWidthPels;
-
-        // Get the bitmap data from the sample, and use it to create a
-        // Direct2D bitmap object. Then use the Direct2D bitmap to
-        // initialize the sprite.
-
-        hr = pSample->ConvertToContiguousBuffer(&pBuffer);
-
-        if (FAILED(hr)) { goto done; }
-
-        hr = pBuffer->Lock(&pBitmapData, NULL, &cbBitmapData);
-
-        if (FAILED(hr)) { goto done; }
-
-        assert(cbBitmapData == (pitch * m_format.imageHeightPels));
-
-        hr = pRT->CreateBitmap(
-            D2D1::SizeU(m_format.imageWidthPels, m_format.imageHeightPels),
-            pBitmapData,
-            pitch,
-            D2D1::BitmapProperties(
-                // Format = RGB32
-                D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE)
-                ),
-            &pBitmap
-            );
-
-        if (FAILED(hr)) { goto done; }
-
-        pSprite->SetBitmap(pBitmap, m_format);
-    }
-    else
-    {
-        hr = MF_E_END_OF_STREAM;
-    }
-
-done:
-
-    if (pBitmapData)
-    {
-        pBuffer->Unlock();
-    }
-    SafeRelease(&pBuffer);
-    SafeRelease(&pSample);
-    SafeRelease(&pBitmap);
-
-    return hr;
-}
-
-//-------------------------------------------------------------------
-// SelectVideoStream
-//
-// Finds the first video stream and sets the format to RGB32.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::SelectVideoStream()
-{
-    HRESULT hr = S_OK;
-
-    IMFMediaType *pType = NULL;
-
-    // Configure the source reader to give us progressive RGB32 frames.
-    // The source reader will load the decoder if needed.
-
-    hr = MFCreateMediaType(&pType);
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = m_pReader->SetCurrentMediaType(
-            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-            NULL, pType);
-    }
-
-    // Ensure the stream is selected.
-    if (SUCCEEDED(hr))
-    {
-        hr = m_pReader->SetStreamSelection(
-            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = GetVideoFormat(&m_format);
-    }
-
-    SafeRelease(&pType);
-    return hr;
-}
-
-
-//-------------------------------------------------------------------
-// GetVideoFormat
-//
-// Gets format information for the video stream.
-//
-// iStream: Stream index.
-// pFormat: Receives the format information.
-//-------------------------------------------------------------------
-
-HRESULT ThumbnailGenerator::GetVideoFormat(FormatInfo *pFormat)
-{
-    UINT32  width = 0, height = 0;
-    LONG lStride = 0;
-    MFVideoArea area;
-    RECT rcSrc;
-	UINT rotation = 0;
-
-    GUID subtype = { 0 };
-
-    IMFMediaType *pType = NULL;
-
-    // Get the media type from the stream.
-    HRESULT hr = m_pReader->GetCurrentMediaType(
-        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, &pType );
-
-    if (FAILED(hr)) 
-    { 
-        goto done; 
-    }
-
-    // Make sure it is a video format.
-    hr = pType->GetGUID(MF_MT_SUBTYPE, &subtype);
-    if (subtype != MFVideoFormat_RGB32)
-    {
-        hr = E_UNEXPECTED;
-        goto done;
-    }
-
-    // Get the width and height
-    hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height);
-    if (FAILED(hr)) 
-    { 
-        goto done; 
-    }
-
-	//Get rotation if possible
-	hr = MFGetAttributeUINT32(pType, MF_MT_VIDEO_ROTATION, rotation);
-	if (FAILED(hr))
-	{
-		rotation = MFVideoRotationFormat_0;		
-	}
-
-    // Get the stride to find out if the bitmap is top-down or bottom-up.
-    lStride = (LONG)MFGetAttributeUINT32(pType, MF_MT_DEFAULT_STRIDE, 1);
-
-    pFormat->bTopDown = (lStride > 0);
-
-    hr = GetVideoDisplayArea(pType, &area);
-    if (FAILED(hr))
-    {
-        goto done;
-    }
-    rcSrc = RectFromArea(area);
-
-
-    // Get the pixel aspect ratio. 
-    MFRatio par;
-    GetPixelAspectRatio(pType, &par);
-
-    pFormat->rcPicture = CorrectAspectRatio(rcSrc, par);
-    pFormat->imageWidthPels = width;
-    pFormat->imageHeightPels = height;
-
-done:
-    SafeRelease(&pType);
-    return hr;
-}
-
-
-
-//-----------------------------------------------------------------------------
-// CorrectAspectRatio
-//
-// Converts a rectangle from the source's pixel aspect ratio (PAR) to 1:1 PAR.
-// Returns the corrected rectangle.
-//
-// For example, a 720 x 486 rect with a PAR of 9:10, when converted to 1x1 PAR,
-// is stretched to 720 x 540.
-//-----------------------------------------------------------------------------
-
-RECT CorrectAspectRatio(const RECT& src, const MFRatio& srcPAR)
-{
-    // Start with a rectangle the same size as src, but offset to the origin (0,0).
-    RECT rc = {0, 0, src.right - src.left, src.bottom - src.top};
-
-    if ((srcPAR.Numerator != 1) || (srcPAR.Denominator != 1))
-    {
-        // Correct for the source's PAR.
-
-        if (srcPAR.Numerator > srcPAR.Denominator)
-        {
-            // The source has "wide" pixels, so stretch the width.
-            rc.right = MulDiv(rc.right, srcPAR.Numerator, srcPAR.Denominator);
-        }
-        else if (srcPAR.Numerator < srcPAR.Denominator)
-        {
-            // The source has "tall" pixels, so stretch the height.
-            rc.bottom = MulDiv(rc.bottom, srcPAR.Denominator, srcPAR.Numerator);
-        }
-        // else: PAR is 1:1, which is a no-op.
-    }
-    return rc;
-}
-
-
-MFOffset MakeOffset(float v)
-{
-    MFOffset offset;
-    offset.value = short(v);
-    offset.fract = WORD(65536 * (v-offset.value));
-    return offset;
-}
-
-MFVideoArea MakeArea(float x, float y, DWORD width, DWORD height)
-{
-    MFVideoArea area;
-    area.OffsetX = MakeOffset(x);
-    area.OffsetY = MakeOffset(y);
-    area.Area.cx = width;
-    area.Area.cy = height;
-    return area;
-}
-
-HRESULT GetVideoDisplayArea(IMFMediaType *pType, MFVideoArea *pArea)
-{
-    HRESULT hr = S_OK;
-    BOOL bPanScan = FALSE;
-    UINT32 width = 0, height = 0;
-
-    bPanScan = MFGetAttributeUINT32(pType, MF_MT_PAN_SCAN_ENABLED, FALSE);
-
-    // In pan-and-scan mode, try to get the pan-and-scan region.
-    if (bPanScan)
-    {
-        hr = pType->GetBlob(
-            MF_MT_PAN_SCAN_APERTURE, 
-            (UINT8*)pArea, 
-            sizeof(MFVideoArea), 
-            NULL
-            );
-    }
-
-    // If not in pan-and-scan mode, or the pan-and-scan region is not set, 
-    // get the minimimum display aperture.
-
-    if (!bPanScan || hr == MF_E_ATTRIBUTENOTFOUND)
-    {
-        hr = pType->GetBlob(
-            MF_MT_MINIMUM_DISPLAY_APERTURE, 
-            (UINT8*)pArea, 
-            sizeof(MFVideoArea), 
-            NULL
-            );
-
-        if (hr == MF_E_ATTRIBUTENOTFOUND)
-        {
-            // Minimum display aperture is not set.
-
-            // For backward compatibility with some components, 
-            // check for a geometric aperture. 
-
-            hr = pType->GetBlob(
-                MF_MT_GEOMETRIC_APERTURE, 
-                (UINT8*)pArea, 
-                sizeof(MFVideoArea), 
-                NULL
-                );
-        }
-
-        // Default: Use the entire video area.
-
-        if (hr == MF_E_ATTRIBUTENOTFOUND)
-        {
-            hr = MFGetAttributeSize(
-                pType, MF_MT_FRAME_SIZE, &width, &height
-                );
-
-            if (SUCCEEDED(hr))
-            {
-                *pArea = MakeArea(0.0, 0.0, width, height);
-            }
-        }
-    }
-
-    return hr;
-}
-
-
-RECT RectFromArea(const MFVideoArea& area)
-{
-    RECT rc;
-    rc.left = static_cast<LONG>(OffsetToFloat(area.OffsetX));
-    rc.top = static_cast<LONG>(OffsetToFloat(area.OffsetY));
-    rc.right = rc.left + area.Area.cx;
-    rc.bottom = rc.top + area.Area.cy;
-    return rc;
-}
-
-
-void GetPixelAspectRatio(IMFMediaType *pType, MFRatio *pPar)
-{
-    HRESULT hr = MFGetAttributeRatio(pType, 
-        MF_MT_PIXEL_ASPECT_RATIO, 
-        (UINT32*)&pPar->Numerator, 
-        (UINT32*)&pPar->Denominator);
-    if (FAILED(hr))
-    {
-        pPar->Numerator = pPar->Denominator = 1;
-    }
-}
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailGenerator: Creates thumbnail images from video files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "Thumbnail.h"
+#include "bytestream.h"
+#include "videoindex.h"
+#include "taskpool.h"
+
+#pragma warning(disable:4127)  // Disable warning C4127: conditional expression is constant
+
+const LONGLONG MAX_FRAMES_TO_SKIP = 10;
+
+static void    FormatFromFrame(const FrameFormat& frame, FormatInfo *pFormat);
+
+//-------------------------------------------------------------------
+// ThumbnailGenerator constructor
+//-------------------------------------------------------------------
+
+ThumbnailGenerator::ThumbnailGenerator()
+    : m_pSource(NULL),
+      m_cbFrameBudget(DEFAULT_FRAME_MEMORY),
+      m_cbPeakFrame(0),
+      m_cbBitmaps(0),
+      m_targetWidth(0),
+      m_targetHeight(0),
+      m_pPool(NULL),
+      m_cFramesDecoded(0),
+      m_cFramesConverted(0),
+      m_cSnappedSeeks(0),
+      m_pIndex(NULL),
+      m_cTimeouts(0),
+      m_pControl(NULL),
+      m_bKeyframeSeek(FALSE),
+      m_hnsDuration(0),
+      m_bCanSeek(FALSE),
+      m_bHaveDuration(FALSE),
+      m_bHaveCanSeek(FALSE)
+{
+    ZeroMemory(&m_format, sizeof(m_format));
+}
+
+
+
+//-------------------------------------------------------------------
+// ThumbnailGenerator destructor
+//-------------------------------------------------------------------
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+    Close();
+}
+
+
+
+//-------------------------------------------------------------------
+// OpenFile: Opens a video file.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::OpenFile(const WCHAR* wszFileName)
+{
+    Close();
+
+    HRESULT hr = m_mfSource.OpenURL(wszFileName);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = UseSource(&m_mfSource);
+    }
+
+    return hr;
+}
+
+
+
+//-------------------------------------------------------------------
+// OpenByteStream: Opens a video from a byte stream.
+//
+// Use this for sources that are not files, such as memory buffers.
+// Set MF_BYTESTREAM_CONTENT_TYPE or MF_BYTESTREAM_ORIGIN_NAME on the
+// byte stream so that the source resolver can find the container
+// format.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::OpenByteStream(IMFByteStream *pByteStream)
+{
+    Close();
+
+    HRESULT hr = m_mfSource.OpenByteStream(pByteStream);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = UseSource(&m_mfSource);
+    }
+
+    return hr;
+}
+
+
+
+//-------------------------------------------------------------------
+// OpenFrameSource
+//
+// Reads frames from another frame source. The source must stay valid
+// until the generator is closed or opens another source.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::OpenFrameSource(FrameSource *pSource)
+{
+    Close();
+
+    if (pSource == NULL)
+    {
+        return E_POINTER;
+    }
+
+    return UseSource(pSource);
+}
+
+
+
+//-------------------------------------------------------------------
+// Close
+//
+// Closes the Media Foundation source, and stops using any other one.
+//-------------------------------------------------------------------
+
+void ThumbnailGenerator::Close()
+{
+    m_mfSource.Close();
+
+    m_pSource = NULL;
+    m_pIndex = NULL;
+    m_bHaveDuration = FALSE;
+    m_bHaveCanSeek = FALSE;
+}
+
+
+
+//-------------------------------------------------------------------
+// AttachReader
+//
+// Takes over a reader that was opened and configured earlier, such as
+// one from a ReaderCache, instead of opening the source again. The
+// reader is rewound to the start.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::AttachReader(ReaderState *pState)
+{
+    if (pState->pReader == NULL || !pState->bCanSeek)
+    {
+        return E_INVALIDARG;
+    }
+
+    Close();
+
+    m_mfSource.Attach(pState->pReader, pState->format, pState->pByteStream);
+    pState->pReader = NULL;
+
+    m_pSource = &m_mfSource;
+    m_format = pState->format;
+    m_hnsDuration = pState->hnsDuration;
+    m_bCanSeek = pState->bCanSeek;
+    m_bHaveDuration = TRUE;
+    m_bHaveCanSeek = TRUE;
+
+    m_budget.StartFile();
+
+    // The last user left the reader at an arbitrary position, and
+    // CreateBitmap does not seek for position zero.
+
+    FRAME_STATUS status = m_mfSource.Seek(0);
+
+    if (status != FRAME_OK)
+    {
+        HRESULT hr = FrameStatusToHResult(status, &m_mfSource);
+        Close();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------
+// DetachReader
+//
+// Gives up the open reader, together with its format, duration and
+// seekability, so that it can be reused later with AttachReader.
+// Fails if the source is not the Media Foundation one.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::DetachReader(ReaderState *pState)
+{
+    HRESULT hr = S_OK;
+
+    if (m_pSource == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (m_pSource != &m_mfSource)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+
+    hr = GetDuration(&pState->hnsDuration);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CanSeek(&pState->bCanSeek);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_mfSource.Detach(&pState->pReader, &pState->format);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetDuration: Finds the duration of the current video file.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::GetDuration(LONGLONG *phnsDuration)
+{
+    int64_t hnsDuration = 0;
+
+    if (m_pSource == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (m_bHaveDuration)
+    {
+        *phnsDuration = m_hnsDuration;
+        return S_OK;
+    }
+
+    FRAME_STATUS status = m_pSource->GetDuration(&hnsDuration);
+
+    if (status != FRAME_OK)
+    {
+        return FrameStatusToHResult(status, m_pSource);
+    }
+
+    *phnsDuration = hnsDuration;
+
+    m_hnsDuration = hnsDuration;
+    m_bHaveDuration = TRUE;
+
+    return S_OK;
+}
+
+
+
+//-------------------------------------------------------------------
+// CanSeek: Queries whether the current video file is seekable.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::CanSeek(BOOL *pbCanSeek)
+{
+    bool bCanSeek = false;
+
+    if (m_pSource == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (m_bHaveCanSeek)
+    {
+        *pbCanSeek = m_bCanSeek;
+        return S_OK;
+    }
+
+    *pbCanSeek = FALSE;
+
+    FRAME_STATUS status = m_pSource->CanSeek(&bCanSeek);
+
+    if (status != FRAME_OK)
+    {
+        return FrameStatusToHResult(status, m_pSource);
+    }
+
+    *pbCanSeek = bCanSeek ? TRUE : FALSE;
+
+    m_bCanSeek = *pbCanSeek;
+    m_bHaveCanSeek = TRUE;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// SetIndex
+//
+// Uses a persistent index for the open source (see videoindex.h). If
+// the index already has the source's properties, they are used instead
+// of querying the source; otherwise they are recorded in it. Keyframes
+// that are found while decoding are added to the index.
+//
+// The index must stay valid until the source is closed or SetIndex is
+// called again. Pass NULL to stop using it.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::SetIndex(VideoIndex *pIndex)
+{
+    HRESULT hr = S_OK;
+
+    LONGLONG hnsDuration = 0;
+    BOOL bCanSeek = FALSE;
+
+    m_pIndex = NULL;
+
+    if (pIndex == NULL)
+    {
+        return S_OK;
+    }
+
+    if (m_pSource == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (pIndex->bHaveProperties)
+    {
+        m_hnsDuration = pIndex->hnsDuration;
+        m_bCanSeek = pIndex->bCanSeek;
+        m_bHaveDuration = TRUE;
+        m_bHaveCanSeek = TRUE;
+    }
+
+    hr = GetDuration(&hnsDuration);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CanSeek(&bCanSeek);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pIndex->SetProperties(hnsDuration, bCanSeek, m_format);
+        m_pIndex = pIndex;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetThumbnailPositions
+//
+// Computes evenly spaced thumbnail positions for the video file.
+//
+// count:         Number of positions.
+// phnsPositions: Receives the positions, in 100-ns units.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::GetThumbnailPositions(
+    DWORD count,
+    LONGLONG phnsPositions[]
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL bCanSeek = 0;
+
+    LONGLONG hnsDuration = 0;
+    LONGLONG hnsRangeStart = 0;
+    LONGLONG hnsRangeEnd = 0;
+    LONGLONG hnsIncrement = 0;
+
+    hr = CanSeek(&bCanSeek);
+
+    if (FAILED(hr)) { return hr; }
+
+    if (bCanSeek)
+    {
+        hr = GetDuration(&hnsDuration);
+
+        if (FAILED(hr)) { return hr; }
+
+        hnsRangeStart = 0;
+        hnsRangeEnd = hnsDuration;
+
+        // We have the file duration , so we'll take bitmaps from
+        // several positions in the file. Occasionally, the first frame
+        // in a video is black, so we don't start at time 0.
+
+        hnsIncrement = (hnsRangeEnd - hnsRangeStart) / (count + 1);
+
+    }
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        phnsPositions[i] = hnsIncrement * (i + 1);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CreateBitmaps
+//
+// Creates an array of thumbnails from the video file.
+//
+// pRT:      Direct2D render target. Used to create the bitmaps.
+// count:    Number of thumbnails to create.
+// pSprites: An array of Sprite objects to hold the bitmaps.
+//
+// Note: The caller allocates the sprite objects.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::CreateBitmaps(
+    ID2D1RenderTarget *pRT,
+    DWORD count,
+    Sprite pSprites[]
+    )
+{
+    HRESULT hr = S_OK;
+
+    LONGLONG *phnsPositions = new (std::nothrow) LONGLONG[count];
+    if (phnsPositions == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = GetThumbnailPositions(count, phnsPositions);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CreateBitmapsAt(pRT, count, phnsPositions, pSprites);
+    }
+
+    delete [] phnsPositions;
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CreateBitmapsAt
+//
+// Creates thumbnails at the requested positions.
+//
+// pRT:           Direct2D render target. Used to create the bitmaps.
+// count:         Number of thumbnails to create.
+// phnsPositions: On input, the seek positions. On output, the time
+//                stamps of the frames that were used.
+// pSprites:      An array of Sprite objects to hold the bitmaps.
+// phrStatus:     Optional. Receives the result for each thumbnail.
+//
+// Returns S_OK if every thumbnail was created, and otherwise the first
+// failure. The thumbnails that were created are kept either way.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::CreateBitmapsAt(
+    ID2D1RenderTarget *pRT,
+    DWORD count,
+    LONGLONG phnsPositions[],
+    Sprite pSprites[],
+    HRESULT phrStatus[]
+    )
+{
+    HRESULT hr = S_OK;
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        HRESULT hrThumb = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+
+        if (m_pControl && m_pControl->IsCancelled())
+        {
+            hrThumb = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        else if (m_budget.Begin(m_pSource))
+        {
+            hrThumb = CreateBitmap(
+                pRT,
+                phnsPositions[i],
+                &pSprites[i]
+            );
+
+            // A frame that arrived just before the watchdog fired is
+            // still good.
+            if (m_budget.End() && FAILED(hrThumb))
+            {
+                hrThumb = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+        }
+
+        if (hrThumb == HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+        {
+            ++m_cTimeouts;
+        }
+
+        if (phrStatus)
+        {
+            phrStatus[i] = hrThumb;
+        }
+
+        if (SUCCEEDED(hr) && FAILED(hrThumb))
+        {
+            hr = hrThumb;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+/// Private methods
+//
+
+//-------------------------------------------------------------------
+// UseSource
+//
+// Makes pSource the open source and gets its format.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::UseSource(FrameSource *pSource)
+{
+    m_pSource = pSource;
+    m_pSource->SetTaskPool(m_pPool);
+    m_pIndex = NULL;
+    m_bHaveDuration = FALSE;
+    m_bHaveCanSeek = FALSE;
+
+    m_budget.StartFile();
+
+    HRESULT hr = UpdateFormat();
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// UpdateFormat
+//
+// Gets the current format from the source.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::UpdateFormat()
+{
+    FrameFormat format;
+
+    FRAME_STATUS status = m_pSource->GetFormat(&format);
+
+    if (status != FRAME_OK)
+    {
+        return FrameStatusToHResult(status, m_pSource);
+    }
+
+    FormatFromFrame(format, &m_format);
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// CreateBitmap
+//
+// Creates one video thumbnail.
+//
+// pRT:      Direct2D render target. Used to create the bitmap.
+// hnsPos:   The seek position.
+// pSprite:  A Sprite object to hold the bitmap.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::CreateBitmap(
+    ID2D1RenderTarget *pRT,
+    LONGLONG& hnsPos,
+    Sprite *pSprite
+    )
+{
+    HRESULT     hr = S_OK;
+    FRAME_STATUS status = FRAME_OK;
+
+    FrameView   view = { 0 };           // The last frame that we got
+    BOOL        bHaveFrame = FALSE;
+    LONGLONG    hnsTimeStamp = 0;
+    BOOL        bCanSeek = FALSE;       // Can the source seek?
+    BOOL        bSeeked = FALSE;        // Did we seek?
+    DWORD       cSkipped = 0;           // Number of skipped frames
+    LONGLONG    hnsSeekPos = hnsPos;
+    DWORD       cFramesAtSeek = 0;
+
+    ID2D1Bitmap *pBitmap = NULL;
+
+    hr = CanSeek(&bCanSeek);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Seek straight to a known keyframe near the position, if there is
+    // one, so that the first frame is the one we use.
+
+    if (bCanSeek && (hnsPos > 0) && m_pIndex && m_pIndex->FindKeyframe(hnsPos, &hnsSeekPos))
+    {
+        ++m_cSnappedSeeks;
+    }
+
+    if (bCanSeek && (hnsPos > 0))
+    {
+        status = m_pSource->Seek(hnsSeekPos);
+
+        if (status != FRAME_OK)
+        {
+            hr = FrameStatusToHResult(status, m_pSource);
+            goto done;
+        }
+
+        bSeeked = TRUE;
+    }
+
+    cFramesAtSeek = m_cFramesDecoded;
+
+    // Frames more than SEEK_TOLERANCE early are only decoded to get past.
+    m_pSource->SetSkipThreshold(hnsPos - SEEK_TOLERANCE);
+
+
+    // Pulls video frames from the source.
+
+    // NOTE: Seeking might be inaccurate, depending on the container
+    //       format and how the file was indexed. Therefore, the first
+    //       frame that we get might be earlier than the desired time.
+    //       If so, we skip up to MAX_FRAMES_TO_SKIP frames, unless
+    //       SetKeyframeSeek says to take the first frame after a seek.
+
+    while (1)
+    {
+        bool bFormatChanged = false;
+
+        if (m_pControl && m_pControl->IsCancelled())
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            goto done;
+        }
+
+        status = m_pSource->ReadFrame(&view, &bFormatChanged);
+
+        if (bFormatChanged)
+        {
+            // Type change. Get the new format.
+            hr = UpdateFormat();
+
+            if (FAILED(hr)) { goto done; }
+
+            if (m_pIndex)
+            {
+                m_pIndex->SetProperties(m_pIndex->hnsDuration, m_pIndex->bCanSeek, m_format);
+            }
+        }
+
+        if (status == FRAME_END_OF_STREAM)
+        {
+            break;
+        }
+
+        if (status != FRAME_OK)
+        {
+            hr = FrameStatusToHResult(status, m_pSource);
+            goto done;
+        }
+
+        // We got a frame. The source holds onto it, still in the decoder's
+        // format.
+
+        ++m_cFramesDecoded;
+
+        bHaveFrame = TRUE;
+
+        if (view.timestamp != FRAME_TIME_UNKNOWN)
+        {
+            hnsTimeStamp = view.timestamp;
+
+            // The source resumes at a keyframe after a seek.
+            if (m_pIndex && ((bSeeked && m_cFramesDecoded == cFramesAtSeek + 1) || view.bKeyframe))
+            {
+                m_pIndex->AddKeyframe(hnsTimeStamp);
+            }
+
+            // Keep going until we get a frame that is within tolerance of the
+            // desired seek position, or until we skip MAX_FRAMES_TO_SKIP frames.
+
+            // During this process, we might reach the end of the file, so we
+            // always keep the last frame that we got (view).
+
+            if ( !(m_bKeyframeSeek && bSeeked) &&
+                 (cSkipped < MAX_FRAMES_TO_SKIP) &&
+                 (hnsTimeStamp + SEEK_TOLERANCE < hnsPos) )
+            {
+                ++cSkipped;
+                continue;
+            }
+        }
+
+        hnsPos = hnsTimeStamp;
+        break;
+    }
+
+    if (bHaveFrame)
+    {
+        // Only the frame that we use is converted to RGB32. Use it to
+        // create a Direct2D bitmap object. Then use the Direct2D bitmap
+        // to initialize the sprite.
+
+        FormatInfo format;
+
+        hr = CreateFrameBitmap(pRT, &view, &pBitmap, &format);
+
+        if (FAILED(hr)) { goto done; }
+
+        ++m_cFramesConverted;
+
+        pSprite->SetBitmap(pBitmap, format);
+    }
+    else
+    {
+        hr = MF_E_END_OF_STREAM;
+    }
+
+done:
+
+    SafeRelease(&pBitmap);
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CreateFrameBitmap
+//
+// Converts the current frame and creates a Direct2D bitmap from it.
+// Frames that would take more than the frame memory budget are reduced
+// as they are converted; pFormat receives the format of the bitmap.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::CreateFrameBitmap(
+    ID2D1RenderTarget *pRT,
+    FrameView *pView,
+    ID2D1Bitmap **ppBitmap,
+    FormatInfo *pFormat
+    )
+{
+    HRESULT hr = S_OK;
+
+    const ULONGLONG cbFrame = 4ull * m_format.imageWidthPels * m_format.imageHeightPels;
+
+    const BYTE *pData = NULL;
+    UINT32 stride = 0;
+    ULONGLONG cbUsed = 0;
+
+    *pFormat = m_format;
+
+    if (m_cbFrameBudget == 0 || 3 * cbFrame <= m_cbFrameBudget)
+    {
+        FRAME_STATUS status = m_pSource->ConvertFrame(pView);
+
+        if (status != FRAME_OK)
+        {
+            return FrameStatusToHResult(status, m_pSource);
+        }
+
+        pData = pView->pData;
+        stride = (UINT32)pView->stride;
+        cbUsed = 3 * cbFrame;
+    }
+    else
+    {
+        hr = ReduceFrame(pView, pFormat, &cbUsed);
+
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        pData = m_scaler.Data();
+        stride = (UINT32)m_scaler.Stride();
+    }
+
+    if (cbUsed > m_cbPeakFrame)
+    {
+        m_cbPeakFrame = cbUsed;
+    }
+
+    hr = pRT->CreateBitmap(
+        D2D1::SizeU(pFormat->imageWidthPels, pFormat->imageHeightPels),
+        pData,
+        stride,
+        D2D1::BitmapProperties(
+            // Format = RGB32
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE)
+            ),
+        ppBitmap
+        );
+
+    if (SUCCEEDED(hr))
+    {
+        m_cbBitmaps += 4ull * pFormat->imageWidthPels * pFormat->imageHeightPels;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ReduceFrame
+//
+// Converts the current frame in bands into m_scaler, reduced so that
+// it keeps the target size and fits in the frame memory budget.
+//
+// pcbUsed: Receives the memory used for the frame, counting the two
+//          copies of the reduced image that the bitmaps will take.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::ReduceFrame(FrameView *pView, FormatInfo *pFormat, ULONGLONG *pcbUsed)
+{
+    FRAME_STATUS status = FRAME_OK;
+
+    const UINT32 width = m_format.imageWidthPels;
+    const UINT32 height = m_format.imageHeightPels;
+    const BOOL bBands = m_pSource->CanConvertRows();
+    const UINT32 cBandRows = BAND_ROWS * (m_pPool ? m_pPool->ThreadCount() : 1);
+
+    // Sources that cannot convert rows hold a whole converted frame.
+    const ULONGLONG cbRows = bBands ? 4ull * width * cBandRows : 4ull * width * height;
+    const UINT32 cMaxFactor = (width < height) ? width : height;
+
+    UINT32 factor = BandScaler::ChooseFactor(width, height, m_targetWidth, m_targetHeight);
+    ULONGLONG cbUsed = 0;
+
+    while (1)
+    {
+        ULONGLONG cbImage = 4ull * (width / factor) * (height / factor);
+
+        cbUsed = cbRows + BandScaler::WorkingBytes(width, height, factor) + 2 * cbImage;
+
+        if (factor >= cMaxFactor || cbUsed - (bBands ? 0 : cbRows) <= m_cbFrameBudget)
+        {
+            break;
+        }
+        ++factor;
+    }
+
+    if (bBands && cbUsed > m_cbFrameBudget)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    status = m_scaler.Initialize(width, height, factor);
+
+    if (status == FRAME_OK && bBands)
+    {
+        try
+        {
+            m_band.resize((size_t)cbRows);
+        }
+        catch (std::bad_alloc&)
+        {
+            status = FRAME_E_OUT_OF_MEMORY;
+        }
+
+        for (UINT32 y = 0; status == FRAME_OK && !m_scaler.IsComplete(); y += cBandRows)
+        {
+            status = m_pSource->ConvertRows(y, cBandRows, &m_band[0], (int32_t)(4 * width));
+
+            if (status == FRAME_OK)
+            {
+                m_scaler.AddRows(&m_band[0], (int32_t)(4 * width), cBandRows, m_pPool);
+            }
+        }
+    }
+    else if (status == FRAME_OK)
+    {
+        status = m_pSource->ConvertFrame(pView);
+
+        if (status == FRAME_OK)
+        {
+            m_scaler.AddRows(pView->pData, pView->stride, height, m_pPool);
+        }
+    }
+
+    if (status != FRAME_OK)
+    {
+        return FrameStatusToHResult(status, m_pSource);
+    }
+
+    // The picture rectangle is in the frame's pixels.
+    pFormat->imageWidthPels = m_scaler.Width();
+    pFormat->imageHeightPels = m_scaler.Height();
+
+    SetRect(&pFormat->rcPicture,
+        MulDiv(m_format.rcPicture.left, (int)m_scaler.Width(), (int)width),
+        MulDiv(m_format.rcPicture.top, (int)m_scaler.Height(), (int)height),
+        MulDiv(m_format.rcPicture.right, (int)m_scaler.Width(), (int)width),
+        MulDiv(m_format.rcPicture.bottom, (int)m_scaler.Height(), (int)height));
+
+    *pcbUsed = cbUsed;
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// SetTaskPool
+//-------------------------------------------------------------------
+
+void ThumbnailGenerator::SetTaskPool(TaskPool *pPool)
+{
+    m_pPool = pPool;
+    m_mfSource.SetTaskPool(pPool);
+
+    if (m_pSource)
+    {
+        m_pSource->SetTaskPool(pPool);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// SetTargetSize
+//
+// Sets the smallest size that thumbnails are scaled to. The Media
+// Foundation source uses it when it is next opened; the generator uses
+// it to choose how far to reduce large frames.
+//-------------------------------------------------------------------
+
+void ThumbnailGenerator::SetTargetSize(UINT32 cx, UINT32 cy)
+{
+    m_targetWidth = cx;
+    m_targetHeight = cy;
+    m_mfSource.SetTargetSize(cx, cy);
+}
+
+
+//-------------------------------------------------------------------
+// FrameStatusToHResult
+//
+// Converts a frame source status to an HRESULT.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailGenerator::FrameStatusToHResult(FRAME_STATUS status, const FrameSource *pSource)
+{
+    switch (status)
+    {
+    case FRAME_OK:
+        return S_OK;
+
+    case FRAME_END_OF_STREAM:
+        return MF_E_END_OF_STREAM;
+
+    case FRAME_E_READ:
+        return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+
+    case FRAME_E_FORMAT:
+        return MF_E_INVALIDMEDIATYPE;
+
+    case FRAME_E_NOT_SEEKABLE:
+        return MF_E_BYTESTREAM_NOT_SEEKABLE;
+
+    case FRAME_E_OUT_OF_MEMORY:
+        return E_OUTOFMEMORY;
+
+    case FRAME_E_CANCELLED:
+        return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+
+    case FRAME_E_PLATFORM:
+        if (FAILED((HRESULT)pSource->PlatformError()))
+        {
+            return (HRESULT)pSource->PlatformError();
+        }
+        break;
+    }
+
+    return E_FAIL;
+}
+
+
+//-------------------------------------------------------------------
+// FormatFromFrame
+//
+// Converts a frame source format to the format used by sprites.
+//-------------------------------------------------------------------
+
+static void FormatFromFrame(const FrameFormat& frame, FormatInfo *pFormat)
+{
+    pFormat->imageWidthPels = frame.width;
+    pFormat->imageHeightPels = frame.height;
+    pFormat->bTopDown = frame.bTopDown ? TRUE : FALSE;
+    pFormat->rotation = (MFVideoRotationFormat)frame.rotation;
+
+    SetRect(&pFormat->rcPicture, frame.pictureLeft, frame.pictureTop, frame.pictureRight, frame.pictureBottom);
+}
@@ -1,47 +1,205 @@
-//////////////////////////////////////////////////////////////////////////
-//
-// ThumbnailGenerator: Creates thumbnail images from video files.
-//
-// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
-// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
-// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
-// PARTICULAR PURPOSE.
-//
-// Copyright (c) Microsoft Corporation. All rights reserved.
-//
-//////////////////////////////////////////////////////////////////////////
-
-#pragma once
-
-#include "sprite.h"
-
-class ThumbnailGenerator
-{
-private:
-
-    IMFSourceReader *m_pReader;
-    FormatInfo      m_format;
-
-public:
-
-    ThumbnailGenerator();
-    ~ThumbnailGenerator();
-
-
-    HRESULT     OpenFile(const WCHAR* wszFileName);
-    HRESULT     GetDuration(LONGLONG *phnsDuration);
-    HRESULT     CanSeek(BOOL *pbCanSeek);
-
-    HRESULT     CreateBitmaps(ID2D1RenderTarget *pRT, DWORD count, Sprite pSprites[]);
-
-private:
-    HRESULT     CreateBitmap(ID2D1RenderTarget *pRT, LONGLONG& hnsPos, Sprite *pSprite);
-    HRESULT     SelectVideoStream();
-    HRESULT     GetVideoFormat(FormatInfo *pFormat);
-};
-
-
-
-
-
-
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailGenerator: Creates thumbnail images from video files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "sprite.h"
+#include "mfsource.h"
+#include "bandscale.h"
+#include "watchdog.h"
+#include "workqueue.h"
+
+// A frame is used for a requested position if its time stamp is no more
+// than SEEK_TOLERANCE (100-ns units) before that position.
+const LONGLONG SEEK_TOLERANCE = 10000000;
+
+// Default limit on the memory that the generator uses to turn one frame
+// into a bitmap (see SetFrameMemoryBudget).
+const ULONGLONG DEFAULT_FRAME_MEMORY = 64 * 1024 * 1024;
+
+// Rows in each band when a frame is converted in bands.
+const UINT32 BAND_ROWS = 16;
+
+// ReaderState: An open, configured source reader and what is already
+// known about its source. The holder owns a reference on pReader.
+
+class CachedByteStream;
+
+struct ReaderState
+{
+    IMFSourceReader     *pReader;
+    CachedByteStream    *pByteStream;   // Optional; the stream that pReader reads from.
+    FormatInfo          format;
+    LONGLONG            hnsDuration;
+    BOOL                bCanSeek;
+
+    ReaderState() : pReader(NULL), pByteStream(NULL), hnsDuration(0), bCanSeek(FALSE)
+    {
+    }
+};
+
+
+class VideoIndex;
+
+
+// NOTE: Frame sources
+//
+// The generator reads frames from a FrameSource (see framesource.h).
+// OpenFile and OpenByteStream use the built-in Media Foundation source;
+// OpenFrameSource uses any other one, such as a Y4mFrameSource. Only the
+// Media Foundation source can be detached and reused.
+//
+// NOTE: Frame memory
+//
+// Turning a frame into a bitmap takes three BGRA copies of it: the
+// converted frame, the Direct2D bitmap, and the WIC bitmap that Sprite
+// renders into to scale it. When those would exceed the budget given to
+// SetFrameMemoryBudget, the generator reduces the frame while converting
+// it instead (see bandscale.h): by the largest factor that keeps the
+// target size, or more if the budget needs it. Sources that can convert
+// rows are converted BAND_ROWS at a time and stay within the budget; for
+// other sources, their own converted frame comes on top of it. A budget
+// of zero turns this off.
+//
+// PeakFrameBytes reports the most memory that any frame has used, and
+// BitmapBytes the size of the bitmaps created for the sprites.
+//
+// With a TaskPool, bands are BAND_ROWS rows for each of the pool's
+// threads, so that every thread has a share of each band.
+//
+// NOTE: Time budgets
+//
+// SetTimeBudget limits the time spent on each source, counted from when
+// it was opened or its reader attached, and on each position (see
+// watchdog.h). A read that is still running at its deadline is
+// cancelled by the watchdog. Its thumbnail, and those of the positions
+// that are left, fail with HRESULT_FROM_WIN32(ERROR_TIMEOUT); the
+// thumbnails created before then are kept. A cancelled Media
+// Foundation reader cannot be detached, so it never reaches a reader
+// cache. Opening the source is not covered: it cannot be interrupted.
+//
+// NOTE: Cancellation
+//
+// With SetPassControl, CreateBitmapsAt asks the control before each
+// position, and CreateBitmap before each frame it reads, whether the
+// pass was cancelled (see workqueue.h). The positions that are left then
+// fail with HRESULT_FROM_WIN32(ERROR_CANCELLED). Unlike a timeout, this
+// leaves the source usable.
+
+class ThumbnailGenerator
+{
+private:
+
+    MFFrameSource   m_mfSource;
+    FrameSource     *m_pSource;         // The open source: &m_mfSource, or not owned.
+    FormatInfo      m_format;
+    BandScaler      m_scaler;           // Reduces large frames.
+    std::vector<BYTE> m_band;           // Rows being converted, for m_scaler.
+    ULONGLONG       m_cbFrameBudget;
+    ULONGLONG       m_cbPeakFrame;      // Most memory used for one frame, for statistics.
+    ULONGLONG       m_cbBitmaps;        // Size of the bitmaps created, for statistics.
+    UINT32          m_targetWidth;
+    UINT32          m_targetHeight;
+    TaskPool        *m_pPool;           // Optional; see SetTaskPool.
+    DWORD           m_cFramesDecoded;   // Samples read from the decoder, for statistics.
+    DWORD           m_cFramesConverted; // Samples converted to RGB32, for statistics.
+    DWORD           m_cSnappedSeeks;    // Seeks moved to a known keyframe, for statistics.
+    VideoIndex      *m_pIndex;          // Optional; see SetIndex.
+    ReadBudget      m_budget;           // See SetTimeBudget.
+    DWORD           m_cTimeouts;        // Positions that ran out of time, for statistics.
+    PassControl     *m_pControl;        // Optional; see SetPassControl.
+    BOOL            m_bKeyframeSeek;    // See SetKeyframeSeek.
+
+    // Source properties, cached after the first query.
+    LONGLONG        m_hnsDuration;
+    BOOL            m_bCanSeek;
+    BOOL            m_bHaveDuration;
+    BOOL            m_bHaveCanSeek;
+
+public:
+
+    ThumbnailGenerator();
+    ~ThumbnailGenerator();
+
+
+    HRESULT     OpenFile(const WCHAR* wszFileName);
+    HRESULT     OpenByteStream(IMFByteStream *pByteStream);
+    HRESULT     OpenFrameSource(FrameSource *pSource);
+    void        Close();
+    HRESULT     AttachReader(ReaderState *pState);
+    HRESULT     DetachReader(ReaderState *pState);
+    HRESULT     GetDuration(LONGLONG *phnsDuration);
+    HRESULT     CanSeek(BOOL *pbCanSeek);
+    HRESULT     SetIndex(VideoIndex *pIndex);
+
+    // Format of the open source's frames.
+    const FormatInfo& Format() const { return m_format; }
+
+    // Options for the Media Foundation source (see mfsource.h). They take
+    // effect when a file, byte stream or reader is next opened.
+    void        SetFieldDrop(BOOL bFieldDrop) { m_mfSource.SetFieldDrop(bFieldDrop); }
+    void        SetTargetSize(UINT32 cx, UINT32 cy);
+    void        GetTargetSize(UINT32 *pcx, UINT32 *pcy) const { *pcx = m_targetWidth; *pcy = m_targetHeight; }
+
+    void        SetFrameMemoryBudget(ULONGLONG cbBudget) { m_cbFrameBudget = cbBudget; }
+
+    // Converts and reduces each frame on the threads of pPool, which can
+    // be shared with other generators. The pool must outlive the
+    // generator; NULL uses the calling thread only.
+    void        SetTaskPool(TaskPool *pPool);
+
+    // Limits the time for each source and position. The watchdog must
+    // outlive the generator; with NULL, a read is never interrupted, but
+    // no position is started after the source's time is up.
+    void        SetTimeBudget(Watchdog *pWatchdog, const TimeBudget& budget) { m_budget.Set(pWatchdog, budget); }
+    ReadBudget  *GetTimeBudget() { return &m_budget; }
+
+    // Stops reading when pControl says that the pass was cancelled. NULL
+    // turns this off.
+    void        SetPassControl(PassControl *pControl) { m_pControl = pControl; }
+
+    // Uses the first frame after each seek, which is a keyframe, instead
+    // of skipping to the frame within SEEK_TOLERANCE of the position. It
+    // can be up to a GOP early, but takes a single decode (see
+    // loadshed.h).
+    void        SetKeyframeSeek(BOOL bKeyframeSeek) { m_bKeyframeSeek = bKeyframeSeek; }
+
+    HRESULT     GetThumbnailPositions(DWORD count, LONGLONG phnsPositions[]);
+    HRESULT     CreateBitmaps(ID2D1RenderTarget *pRT, DWORD count, Sprite pSprites[]);
+    HRESULT     CreateBitmapsAt(ID2D1RenderTarget *pRT, DWORD count, LONGLONG phnsPositions[], Sprite pSprites[],
+                    HRESULT phrStatus[] = NULL);
+
+    DWORD       FramesDecoded() const { return m_cFramesDecoded; }
+    DWORD       FramesConverted() const { return m_cFramesConverted; }
+    DWORD       SnappedSeeks() const { return m_cSnappedSeeks; }
+    DWORD       Timeouts() const { return m_cTimeouts; }
+    ULONGLONG   PeakFrameBytes() const { return m_cbPeakFrame; }
+    ULONGLONG   BitmapBytes() const { return m_cbBitmaps; }
+    void        ResetMemoryStats() { m_cbPeakFrame = 0; m_cbBitmaps = 0; }
+
+    static HRESULT FrameStatusToHResult(FRAME_STATUS status, const FrameSource *pSource);
+
+private:
+    HRESULT     UseSource(FrameSource *pSource);
+    HRESULT     UpdateFormat();
+    HRESULT     CreateBitmap(ID2D1RenderTarget *pRT, LONGLONG& hnsPos, Sprite *pSprite);
+    HRESULT     CreateFrameBitmap(ID2D1RenderTarget *pRT, FrameView *pView, ID2D1Bitmap **ppBitmap,
+                    FormatInfo *pFormat);
+    HRESULT     ReduceFrame(FrameView *pView, FormatInfo *pFormat, ULONGLONG *pcbUsed);
+};
+
+
+
+
+
+
@@ -0,0 +1,279 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AsyncFrameReader: Reads frames without blocking the caller.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "asyncreader.h"
+
+#include <new>
+#include <system_error>
+
+
+//-------------------------------------------------------------------
+// StartRead
+//
+// Seeks to the position, as ThumbnailGenerator::CreateBitmap does, and
+// tells the source which frames are only read to get past.
+//-------------------------------------------------------------------
+
+FRAME_STATUS AsyncFrameReader::StartRead(FrameSource *pSource, int64_t hnsPosition)
+{
+    bool bCanSeek = false;
+
+    FRAME_STATUS status = pSource->CanSeek(&bCanSeek);
+
+    if (status == FRAME_OK && bCanSeek && hnsPosition > 0)
+    {
+        status = pSource->Seek(hnsPosition);
+    }
+
+    if (status == FRAME_OK)
+    {
+        pSource->SetSkipThreshold(hnsPosition - READ_SEEK_TOLERANCE);
+    }
+
+    return status;
+}
+
+
+//-------------------------------------------------------------------
+// IsFrameForPosition
+//
+// Seeks can land early, so frames more than READ_SEEK_TOLERANCE before
+// the position are skipped, up to READ_MAX_SKIPPED of them. A frame
+// without a time stamp is used as it is.
+//-------------------------------------------------------------------
+
+bool AsyncFrameReader::IsFrameForPosition(const FrameView& view, int64_t hnsPosition, uint32_t cSkipped)
+{
+    return (view.timestamp == FRAME_TIME_UNKNOWN) ||
+           (cSkipped >= READ_MAX_SKIPPED) ||
+           (view.timestamp + READ_SEEK_TOLERANCE >= hnsPosition);
+}
+
+
+//-------------------------------------------------------------------
+// ThreadFrameReader constructor
+//-------------------------------------------------------------------
+
+ThreadFrameReader::ThreadFrameReader() : m_pSource(NULL), m_bStopping(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// ThreadFrameReader destructor
+//-------------------------------------------------------------------
+
+ThreadFrameReader::~ThreadFrameReader()
+{
+    Stop();
+}
+
+
+//-------------------------------------------------------------------
+// Start
+//-------------------------------------------------------------------
+
+bool ThreadFrameReader::Start(FrameSource *pSource)
+{
+    Stop();
+
+    m_pSource = pSource;
+    m_bStopping = false;
+
+    try
+    {
+        m_thread = std::thread(&ThreadFrameReader::ReaderThread, this);
+    }
+    catch (std::system_error&)
+    {
+        m_pSource = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Stop
+//-------------------------------------------------------------------
+
+void ThreadFrameReader::Stop()
+{
+    if (!m_thread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+    }
+
+    m_cvWork.notify_all();
+    m_thread.join();
+
+    m_pSource = NULL;
+}
+
+
+//-------------------------------------------------------------------
+// ReadAt
+//
+// Returns FRAME_E_READ, without calling the callback, if the reader
+// has not been started.
+//-------------------------------------------------------------------
+
+FRAME_STATUS ThreadFrameReader::ReadAt(int64_t hnsPosition, FrameReadCallback callback, void *pContext)
+{
+    Request request = { hnsPosition, callback, pContext };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_pSource == NULL || m_bStopping)
+    {
+        return FRAME_E_READ;
+    }
+
+    try
+    {
+        m_requests.push_back(request);
+    }
+    catch (std::bad_alloc&)
+    {
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    m_cvWork.notify_one();
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Drain
+//-------------------------------------------------------------------
+
+void ThreadFrameReader::Drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_requests.empty())
+    {
+        m_cvIdle.wait(lock);
+    }
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// ReaderThread
+//
+// Completes the queued reads in order. When the reader stops, the
+// reads that are still queued are completed first.
+//-------------------------------------------------------------------
+
+void ThreadFrameReader::ReaderThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (1)
+    {
+        while (!m_bStopping && m_requests.empty())
+        {
+            m_cvWork.wait(lock);
+        }
+
+        if (m_requests.empty())
+        {
+            break;
+        }
+
+        // The request stays queued while it is read, so that Drain
+        // waits for it.
+        Request request = m_requests.front();
+
+        lock.unlock();
+
+        FrameRead read;
+
+        Read(request.hnsPosition, &read);
+
+        request.callback(request.pContext, &read);
+
+        lock.lock();
+
+        m_requests.pop_front();
+
+        if (m_requests.empty())
+        {
+            m_cvIdle.notify_all();
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Read
+//
+// Reads the frame for a position, as ThumbnailGenerator::CreateBitmap
+// does.
+//-------------------------------------------------------------------
+
+void ThreadFrameReader::Read(int64_t hnsPosition, FrameRead *pRead)
+{
+    FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+    bool bHaveFrame = false;
+    uint32_t cSkipped = 0;
+
+    pRead->hnsPosition = hnsPosition;
+    pRead->bFormatChanged = false;
+    pRead->cFramesDecoded = 0;
+    pRead->pSource = m_pSource;
+
+    FRAME_STATUS status = StartRead(m_pSource, hnsPosition);
+
+    while (status == FRAME_OK)
+    {
+        bool bFormatChanged = false;
+
+        status = m_pSource->ReadFrame(&view, &bFormatChanged);
+
+        if (bFormatChanged)
+        {
+            pRead->bFormatChanged = true;
+        }
+
+        if (status != FRAME_OK)
+        {
+            break;
+        }
+
+        ++pRead->cFramesDecoded;
+        bHaveFrame = true;
+
+        if (IsFrameForPosition(view, hnsPosition, cSkipped))
+        {
+            break;
+        }
+
+        ++cSkipped;
+    }
+
+    // At the end of the stream, use the last frame.
+    if (status == FRAME_END_OF_STREAM && bHaveFrame)
+    {
+        status = FRAME_OK;
+    }
+
+    pRead->status = status;
+    pRead->view = view;
+}
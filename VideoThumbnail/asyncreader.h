@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AsyncFrameReader: Reads frames without blocking the caller.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "framesource.h"
+
+// NOTE: Asynchronous reads
+//
+// ThumbnailGenerator reads frames synchronously: the calling thread is
+// blocked for the seek and for every frame decoded on the way to the
+// position. ReadAt on an AsyncFrameReader queues the read and returns
+// at once, and a callback reports the frame when it has been decoded.
+// One scheduling thread can then keep reads in flight on many inputs
+// and do other work while they decode.
+//
+// Each reader owns one source, and completes its reads one at a time in
+// the order they were queued. A read positions the source the way
+// ThumbnailGenerator::CreateBitmap does: it seeks to the position, if
+// the source can seek, and skips up to READ_MAX_SKIPPED frames that are
+// more than READ_SEEK_TOLERANCE early. At the end of the stream, the
+// last frame is used.
+//
+// The callback runs on a thread of the reader. FrameRead::view is the
+// frame as ReadFrame returned it, not yet converted. During the callback,
+// and only then, the callback can call ConvertFrame, ConvertRows,
+// GetFormat and PlatformError on FrameRead::pSource, so frames are
+// converted on the reader's thread and only if they are used. The
+// callback can queue more reads, but must not call Drain.
+//
+// The implementations are:
+//
+//   ThreadFrameReader (here)       Any FrameSource, on a thread of its
+//                                  own.
+//   MFAsyncFrameReader             The source reader's asynchronous
+//     (mfsource.h)                 mode. It has no thread of its own;
+//                                  reads complete on Media Foundation's
+//                                  work queue threads.
+//
+// Like framesource.h, this header depends only on the C++ standard
+// library.
+
+// As SEEK_TOLERANCE and MAX_FRAMES_TO_SKIP in Thumbnail.h and Thumbnail.cpp.
+const int64_t   READ_SEEK_TOLERANCE = 10000000;
+const uint32_t  READ_MAX_SKIPPED    = 10;
+
+struct FrameRead
+{
+    int64_t         hnsPosition;        // As queued.
+    FRAME_STATUS    status;             // FRAME_OK if view holds the frame.
+    FrameView       view;
+    bool            bFormatChanged;     // Since the previous read; call GetFormat.
+    uint32_t        cFramesDecoded;     // By this read, including view.
+    FrameSource     *pSource;
+};
+
+typedef void (*FrameReadCallback)(void *pContext, const FrameRead *pRead);
+
+
+class AsyncFrameReader
+{
+public:
+    virtual ~AsyncFrameReader() { }
+
+    // Queues a read of the frame for hnsPosition and returns at once.
+    // callback(pContext, ...) is called exactly once for each read that
+    // was queued, even if it fails.
+    virtual FRAME_STATUS    ReadAt(int64_t hnsPosition, FrameReadCallback callback, void *pContext) = 0;
+
+    // Waits until every queued read has completed.
+    virtual void            Drain() = 0;
+
+    // Positions pSource for a read of hnsPosition. The implementations
+    // call this, and then ReadFrame until IsFrameForPosition.
+    static FRAME_STATUS     StartRead(FrameSource *pSource, int64_t hnsPosition);
+
+    // True if a frame read on the way to hnsPosition, after cSkipped
+    // others, is the one to use.
+    static bool             IsFrameForPosition(const FrameView& view, int64_t hnsPosition, uint32_t cSkipped);
+};
+
+
+// ThreadFrameReader: Runs the reads of one source on a thread.
+
+class ThreadFrameReader : public AsyncFrameReader
+{
+    struct Request
+    {
+        int64_t             hnsPosition;
+        FrameReadCallback   callback;
+        void                *pContext;
+    };
+
+    FrameSource                 *m_pSource;
+    std::thread                 m_thread;
+    std::deque<Request>         m_requests;     // The first one is being read.
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cvWork;
+    std::condition_variable     m_cvIdle;
+    bool                        m_bStopping;
+
+public:
+
+    ThreadFrameReader();
+    ~ThreadFrameReader();
+
+    // Starts the thread. Until Stop, pSource must not be used except
+    // from the callbacks.
+    bool            Start(FrameSource *pSource);
+
+    // Completes the queued reads and stops the thread.
+    void            Stop();
+
+    // AsyncFrameReader
+    FRAME_STATUS    ReadAt(int64_t hnsPosition, FrameReadCallback callback, void *pContext);
+    void            Drain();
+
+private:
+    void            ReaderThread();
+    void            Read(int64_t hnsPosition, FrameRead *pRead);
+};
@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BandScaler: Reduces large frames a band of rows at a time.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "bandscale.h"
+
+#include "taskpool.h"
+
+#include <new>
+
+// Fewest source pixels for each task when AddRows is split.
+const uint64_t MIN_TASK_PIXELS = 64 * 1024;
+
+// AddRows split into bands of output columns, one for each task.
+struct BandScaler::ColumnTask
+{
+    BandScaler      *pThis;
+    const uint8_t   *pRows;
+    int32_t         stride;
+    uint32_t        cRows;
+    uint32_t        cTasks;
+};
+
+
+//-------------------------------------------------------------------
+// BandScaler constructor
+//-------------------------------------------------------------------
+
+BandScaler::BandScaler()
+    : m_factor(1),
+      m_width(0),
+      m_height(0),
+      m_cRowsAdded(0)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Allocates the row of sums and the reduced image. The buffers are
+// kept for the next frame of the same size.
+//-------------------------------------------------------------------
+
+FRAME_STATUS BandScaler::Initialize(uint32_t width, uint32_t height, uint32_t factor)
+{
+    if (factor == 0 || width < factor || height < factor)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+    m_factor = factor;
+    m_width = width / factor;
+    m_height = height / factor;
+    m_cRowsAdded = 0;
+
+    try
+    {
+        m_sums.assign((size_t)3 * m_width, 0);
+        m_image.resize((size_t)4 * m_width * m_height);
+    }
+    catch (std::bad_alloc&)
+    {
+        m_width = m_height = 0;
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// AddRows
+//
+// Adds source rows to the sums, and writes each output row when its
+// last source row arrives.
+//-------------------------------------------------------------------
+
+void BandScaler::AddRows(const uint8_t *pRows, int32_t stride, uint32_t cRows, TaskPool *pPool)
+{
+    const uint32_t cRowsLeft = m_height * m_factor - m_cRowsAdded;
+
+    if (cRows > cRowsLeft)
+    {
+        cRows = cRowsLeft;
+    }
+
+    ColumnTask task = { this, pRows, stride, cRows, 1 };
+
+    task.cTasks = TaskPool::TaskCount(pPool, (uint64_t)cRows * m_width * m_factor, MIN_TASK_PIXELS);
+
+    if (task.cTasks > 1)
+    {
+        pPool->Run(task.cTasks, RunColumnTask, &task);
+    }
+    else
+    {
+        AddColumns(pRows, stride, cRows, 0, m_width);
+    }
+
+    m_cRowsAdded += cRows;
+}
+
+
+//-------------------------------------------------------------------
+// ChooseFactor
+//-------------------------------------------------------------------
+
+uint32_t BandScaler::ChooseFactor(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight)
+{
+    if (targetWidth == 0 && targetHeight == 0)
+    {
+        return 1;
+    }
+
+    uint32_t cx = targetWidth ? width / targetWidth : height / targetHeight;
+    uint32_t cy = targetHeight ? height / targetHeight : cx;
+    uint32_t factor = (cx < cy) ? cx : cy;
+
+    return (factor > 1) ? factor : 1;
+}
+
+
+//-------------------------------------------------------------------
+// WorkingBytes
+//-------------------------------------------------------------------
+
+uint64_t BandScaler::WorkingBytes(uint32_t width, uint32_t height, uint32_t factor)
+{
+    uint64_t cx = width / factor;
+    uint64_t cy = height / factor;
+
+    return 3 * sizeof(uint32_t) * cx + 4 * cx * cy;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// AddColumns
+//
+// Adds source rows to the sums of output columns [xFirst, xLast).
+//-------------------------------------------------------------------
+
+void BandScaler::AddColumns(const uint8_t *pRows, int32_t stride, uint32_t cRows, uint32_t xFirst, uint32_t xLast)
+{
+    const uint32_t cBlockPixels = m_factor * m_factor;
+
+    for (uint32_t r = 0; r < cRows; r++)
+    {
+        const uint8_t *pIn = pRows + (ptrdiff_t)r * stride + (size_t)4 * m_factor * xFirst;
+        uint32_t *pSum = &m_sums[(size_t)3 * xFirst];
+
+        for (uint32_t x = xFirst; x < xLast; x++)
+        {
+            uint32_t b = 0;
+            uint32_t g = 0;
+            uint32_t red = 0;
+
+            for (uint32_t i = 0; i < m_factor; i++)
+            {
+                b += pIn[0];
+                g += pIn[1];
+                red += pIn[2];
+                pIn += 4;
+            }
+
+            pSum[0] += b;
+            pSum[1] += g;
+            pSum[2] += red;
+            pSum += 3;
+        }
+
+        const uint32_t cRowsAdded = m_cRowsAdded + r + 1;
+
+        if (cRowsAdded % m_factor == 0)
+        {
+            uint8_t *pOut = &m_image[(size_t)4 * (m_width * (cRowsAdded / m_factor - 1) + xFirst)];
+
+            pSum = &m_sums[(size_t)3 * xFirst];
+
+            for (uint32_t x = xFirst; x < xLast; x++)
+            {
+                pOut[0] = (uint8_t)((pSum[0] + cBlockPixels / 2) / cBlockPixels);
+                pOut[1] = (uint8_t)((pSum[1] + cBlockPixels / 2) / cBlockPixels);
+                pOut[2] = (uint8_t)((pSum[2] + cBlockPixels / 2) / cBlockPixels);
+                pOut[3] = 0xFF;
+                pOut += 4;
+
+                pSum[0] = pSum[1] = pSum[2] = 0;
+                pSum += 3;
+            }
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// RunColumnTask
+//
+// Runs one band of columns of AddRows.
+//-------------------------------------------------------------------
+
+void BandScaler::RunColumnTask(void *pContext, uint32_t iTask)
+{
+    const ColumnTask *pTask = (const ColumnTask*)pContext;
+    BandScaler *pThis = pTask->pThis;
+
+    uint32_t xFirst = (uint32_t)((uint64_t)pThis->m_width * iTask / pTask->cTasks);
+    uint32_t xLast = (uint32_t)((uint64_t)pThis->m_width * (iTask + 1) / pTask->cTasks);
+
+    pThis->AddColumns(pTask->pRows, pTask->stride, pTask->cRows, xFirst, xLast);
+}
@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BandScaler: Reduces large frames a band of rows at a time.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+#include "framesource.h"
+
+class TaskPool;
+
+// NOTE: Band streaming
+//
+// A full BGRA copy of an 8K frame is about 130 MB, and a thumbnail used
+// to take three of them: the converted frame, the Direct2D bitmap, and
+// the WIC bitmap that the sprite renders into before scaling. For large
+// frames, ThumbnailGenerator instead converts a band of rows at a time
+// (FrameSource::ConvertRows) and passes each band to a BandScaler, which
+// averages every factor x factor block of pixels into a small image as
+// the rows arrive. Only that image is copied into the bitmap, and the
+// WIC scaler and encoder then work from it as before.
+//
+// The working set is then one band, one row of sums and three copies of
+// the reduced image, whatever the size of the frame. ChooseFactor picks
+// the largest factor that still leaves at least the size the thumbnail
+// is scaled to, so the final scaler loses nothing.
+//
+// With a TaskPool, AddRows splits the output into bands of columns,
+// which have their own sums and are reduced in parallel.
+//
+// Like the frame sources, this depends only on the C++ standard library.
+
+class BandScaler
+{
+    uint32_t                m_factor;
+    uint32_t                m_width;            // Of the reduced image.
+    uint32_t                m_height;
+    uint32_t                m_cRowsAdded;       // Source rows so far.
+    std::vector<uint32_t>   m_sums;             // B, G, R sums of the output row in progress.
+    std::vector<uint8_t>    m_image;            // Reduced image, top row first.
+
+public:
+
+    BandScaler();
+
+    // Starts a width x height source, reduced by factor in both
+    // directions. Source rows and columns past the last whole block are
+    // dropped.
+    FRAME_STATUS    Initialize(uint32_t width, uint32_t height, uint32_t factor);
+
+    // Adds the next cRows source rows, in order.
+    void            AddRows(const uint8_t *pRows, int32_t stride, uint32_t cRows, TaskPool *pPool = NULL);
+
+    bool            IsComplete() const { return m_cRowsAdded >= m_height * m_factor; }
+
+    const uint8_t   *Data() const { return m_image.empty() ? NULL : &m_image[0]; }
+    int32_t         Stride() const { return (int32_t)(4 * m_width); }
+    uint32_t        Width() const { return m_width; }
+    uint32_t        Height() const { return m_height; }
+
+    // The largest factor at which a width x height image is still at
+    // least targetWidth x targetHeight. A target of 0 x 0 means 1.
+    static uint32_t ChooseFactor(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight);
+
+    // Memory that Initialize allocates for a source size and factor.
+    static uint64_t WorkingBytes(uint32_t width, uint32_t height, uint32_t factor);
+
+private:
+    struct ColumnTask;
+
+    void            AddColumns(const uint8_t *pRows, int32_t stride, uint32_t cRows, uint32_t xFirst, uint32_t xLast);
+    static void     RunColumnTask(void *pContext, uint32_t iTask);
+};
@@ -0,0 +1,657 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Batch mode: Creates thumbnails for a list of files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "clock.h"
+#include "batch.h"
+
+const UINT32 DEFAULT_BATCH_THUMBNAILS = 4;
+const UINT32 DEFAULT_BATCH_THUMB_SIZE = 160;
+const UINT32 MAX_BATCH_THUMBNAILS     = 256;
+const DWORD BATCH_READER_CACHE_ENTRIES = 64;
+const ULONGLONG BATCH_READER_CACHE_MEMORY = 512 * 1024 * 1024;
+const DWORD MAX_LIST_FILE_SIZE        = 64 * 1024 * 1024;
+
+HRESULT WriteBufferToFile(const WCHAR *wszFileName, const BYTE *pData, DWORD cbData);
+
+
+//-------------------------------------------------------------------
+// BatchRunner constructor
+//-------------------------------------------------------------------
+
+BatchRunner::BatchRunner() :
+    m_bFifo(FALSE),
+    m_iNextProbe(0),
+    m_cWorkers(0)
+{
+    ZeroMemory(&m_opts, sizeof(m_opts));
+
+    m_opts.cThumbnails = DEFAULT_BATCH_THUMBNAILS;
+    m_opts.cxThumbnail = DEFAULT_BATCH_THUMB_SIZE;
+    m_opts.cyThumbnail = DEFAULT_BATCH_THUMB_SIZE;
+    m_opts.format = VT_FORMAT_JPEG;
+
+    InitializeCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// BatchRunner destructor
+//-------------------------------------------------------------------
+
+BatchRunner::~BatchRunner()
+{
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//-------------------------------------------------------------------
+
+HRESULT BatchRunner::Initialize(DWORD cWorkers)
+{
+    m_cWorkers = cWorkers;
+    m_workerMs.assign(cWorkers, 0.0);
+
+    return m_readerCache.Initialize(BATCH_READER_CACHE_ENTRIES, BATCH_READER_CACHE_MEMORY);
+}
+
+
+//-------------------------------------------------------------------
+// LoadList
+//
+// Reads the list of inputs: one path per line, in UTF-8. Empty lines
+// are skipped.
+//-------------------------------------------------------------------
+
+HRESULT BatchRunner::LoadList(const WCHAR *wszListFile)
+{
+    HRESULT hr = S_OK;
+
+    LARGE_INTEGER cbFile = { 0 };
+    DWORD cbRead = 0;
+    std::string text;
+
+    HANDLE hFile = CreateFile(wszListFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileSizeEx(hFile, &cbFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    if (cbFile.QuadPart > MAX_LIST_FILE_SIZE)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        goto done;
+    }
+
+    text.resize((size_t)cbFile.QuadPart);
+
+    if (!text.empty() && !ReadFile(hFile, &text[0], (DWORD)text.size(), &cbRead, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    text.resize(cbRead);
+
+    for (size_t start = 0; start < text.size(); )
+    {
+        size_t end = text.find('\n', start);
+
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+
+        std::string line = text.substr(start, end - start);
+
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+
+        if (!line.empty())
+        {
+            m_inputs.push_back(Utf8ToWide(line));
+        }
+
+        start = end + 1;
+    }
+
+done:
+    CloseHandle(hFile);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Run
+//
+// Probes the inputs, plans the tasks, runs them and reports the result.
+//-------------------------------------------------------------------
+
+HRESULT BatchRunner::Run()
+{
+    HRESULT hr = S_OK;
+
+    std::vector<uint32_t> positionCounts(m_inputs.size(), m_opts.cThumbnails);
+    std::vector<BatchTask> tasks;
+    double predictedMs = 0;
+
+    Stopwatch watch;
+
+    if ((m_timeBudget.fileMs > 0 || m_timeBudget.positionMs > 0) && !m_watchdog.Start())
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    m_probes.assign(m_inputs.size(), BatchProbe());
+    m_iNextProbe = 0;
+
+    hr = RunWorkers(TRUE);
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    double probeMs = watch.ElapsedMs();
+
+    // The positions are the ones that GetThumbnailPositions would pick.
+    m_positions.assign(m_inputs.size() * m_opts.cThumbnails, 0);
+
+    for (size_t i = 0; i < m_inputs.size(); i++)
+    {
+        LONGLONG hnsIncrement = m_probes[i].bCanSeek ? m_probes[i].hnsDuration / (m_opts.cThumbnails + 1) : 0;
+
+        for (UINT32 k = 0; k < m_opts.cThumbnails; k++)
+        {
+            m_positions[i * m_opts.cThumbnails + k] = hnsIncrement * (k + 1);
+        }
+    }
+
+    if (m_bFifo)
+    {
+        for (uint32_t i = 0; i < (uint32_t)m_inputs.size(); i++)
+        {
+            BatchTask task = { i, 0, m_opts.cThumbnails, m_model.Predict(m_probes[i], m_opts.cThumbnails) };
+            tasks.push_back(task);
+        }
+
+        // Dealing the tasks in list order predicts what a shared queue
+        // does; the workers then all take from the first queue.
+        BatchQueues prediction;
+        predictedMs = prediction.Assign(tasks, m_cWorkers);
+
+        m_queues.Assign(tasks, 1);
+    }
+    else
+    {
+        PlanBatch(m_probes, positionCounts, m_model, m_cWorkers, &tasks);
+
+        predictedMs = m_queues.Assign(tasks, m_cWorkers);
+    }
+
+    watch.Restart();
+
+    hr = RunWorkers(FALSE);
+
+    m_watchdog.Stop();
+
+    if (SUCCEEDED(hr))
+    {
+        ReportSummary(probeMs, predictedMs, watch.ElapsedMs());
+    }
+
+    return hr;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// RunWorkers
+//
+// Runs one pass on m_cWorkers threads and waits for it to finish.
+//-------------------------------------------------------------------
+
+HRESULT BatchRunner::RunWorkers(BOOL bProbe)
+{
+    HRESULT hr = S_OK;
+
+    std::vector<WorkerParams> params(m_cWorkers);
+    std::vector<HANDLE> threads;
+
+    for (DWORD i = 0; i < m_cWorkers; i++)
+    {
+        params[i].pRunner = this;
+        params[i].iWorker = i;
+        params[i].bProbe = bProbe;
+
+        HANDLE hThread = CreateThread(NULL, 0, WorkerThreadProc, &params[i], 0, NULL);
+
+        if (hThread == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        threads.push_back(hThread);
+    }
+
+    // The threads that did start finish the pass on their own.
+    if (!threads.empty())
+    {
+        WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        CloseHandle(threads[i]);
+    }
+
+    return threads.empty() ? hr : S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// WorkerThreadProc
+//
+// Each worker has a context of its own and shares the reader cache.
+//-------------------------------------------------------------------
+
+DWORD WINAPI BatchRunner::WorkerThreadProc(LPVOID lpParameter)
+{
+    WorkerParams *pParams = (WorkerParams*)lpParameter;
+    BatchRunner *pThis = pParams->pRunner;
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    if (SUCCEEDED(hr))
+    {
+        ThumbnailContext context;
+
+        HRESULT hrInit = context.Initialize();
+
+        context.SetReaderCache(&pThis->m_readerCache);
+        context.SetTimeBudget(&pThis->m_watchdog, pThis->m_timeBudget);
+
+        // A worker that failed to initialize leaves its share to the
+        // others, which take its inputs and steal its tasks.
+        if (SUCCEEDED(hrInit) && pParams->bProbe)
+        {
+            pThis->ProbeInputs(&context);
+        }
+        else if (SUCCEEDED(hrInit))
+        {
+            pThis->RunTasks(&context, pParams->iWorker);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        CoUninitialize();
+    }
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// ProbeInputs
+//-------------------------------------------------------------------
+
+void BatchRunner::ProbeInputs(ThumbnailContext *pContext)
+{
+    while (1)
+    {
+        LONG i = InterlockedIncrement(&m_iNextProbe) - 1;
+
+        if (i >= (LONG)m_inputs.size())
+        {
+            break;
+        }
+
+        // A failed probe leaves the input with the cost of an open; the
+        // task reports the error.
+        (void)pContext->Probe(m_inputs[i].c_str(), m_opts, &m_probes[i]);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// RunTasks
+//-------------------------------------------------------------------
+
+void BatchRunner::RunTasks(ThumbnailContext *pContext, DWORD iWorker)
+{
+    BatchTaskResult result;
+    bool bStolen = false;
+
+    result.iWorker = iWorker;
+
+    while (m_queues.Next(m_bFifo ? 0 : iWorker, &result.task, &bStolen))
+    {
+        Stopwatch watch;
+
+        result.hr = RunTask(pContext, result.task);
+        result.actualMs = watch.ElapsedMs();
+        result.bStolen = bStolen ? TRUE : FALSE;
+
+        EnterCriticalSection(&m_lock);
+        m_results.push_back(result);
+        m_workerMs[iWorker] += result.actualMs;
+        ReportTask(result);
+        LeaveCriticalSection(&m_lock);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// RunTask
+//
+// Creates and writes the thumbnails of one task. Returns the first
+// thumbnail's error, if any failed.
+//-------------------------------------------------------------------
+
+HRESULT BatchRunner::RunTask(ThumbnailContext *pContext, const BatchTask& task)
+{
+    HRESULT hr = S_OK;
+
+    VT_OPTIONS opts = m_opts;
+    std::vector<VT_THUMBNAIL> results(task.cPositions);
+    WCHAR wszFileName[MAX_PATH];
+
+    opts.cThumbnails = task.cPositions;
+    opts.phnsPositions = &m_positions[task.iInput * m_opts.cThumbnails + task.iFirst];
+
+    ZeroMemory(&results[0], results.size() * sizeof(VT_THUMBNAIL));
+
+    hr = pContext->GenerateFromFile(m_inputs[task.iInput].c_str(), opts, NULL, &results[0]);
+
+    for (UINT32 i = 0; i < task.cPositions; i++)
+    {
+        HRESULT hrThumb = results[i].hrStatus;
+
+        if (SUCCEEDED(hrThumb) && results[i].pData)
+        {
+            hrThumb = StringCchPrintf(wszFileName, MAX_PATH, L"%s\\%05u_%u.%s", m_outputDir.c_str(),
+                task.iInput, task.iFirst + i, (m_opts.format == VT_FORMAT_PNG) ? L"png" : L"jpg");
+
+            if (SUCCEEDED(hrThumb))
+            {
+                hrThumb = WriteBufferToFile(wszFileName, results[i].pData, results[i].cbData);
+            }
+        }
+
+        if (SUCCEEDED(hr) && FAILED(hrThumb))
+        {
+            hr = hrThumb;
+        }
+    }
+
+    ThumbnailContext::FreeThumbnails(NULL, &results[0], task.cPositions);
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ReportTask
+//-------------------------------------------------------------------
+
+void BatchRunner::ReportTask(const BatchTaskResult& result)
+{
+    JsonWriter writer;
+
+    writer.BeginObject();
+    writer.Key("input");
+    writer.Integer(result.task.iInput);
+    writer.Key("first");
+    writer.Integer(result.task.iFirst);
+    writer.Key("count");
+    writer.Integer(result.task.cPositions);
+    writer.Key("worker");
+    writer.Integer(result.iWorker);
+    writer.Key("stolen");
+    writer.Bool(result.bStolen != FALSE);
+    writer.Key("hr");
+    writer.HResult(result.hr);
+    writer.Key("predicted_ms");
+    writer.Number(result.task.predictedMs);
+    writer.Key("actual_ms");
+    writer.Number(result.actualMs);
+    writer.EndObject();
+
+    WriteLine(writer.Text());
+}
+
+
+//-------------------------------------------------------------------
+// ReportSummary
+//
+// Also fits the cost model to the tasks that succeeded.
+//-------------------------------------------------------------------
+
+void BatchRunner::ReportSummary(double probeMs, double predictedMs, double makespanMs)
+{
+    std::vector<BatchCostModel::Sample> samples;
+    BatchCostModel fitted = m_model;
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        if (SUCCEEDED(m_results[i].hr))
+        {
+            BatchCostModel::Sample sample;
+
+            sample.probe = m_probes[m_results[i].task.iInput];
+            sample.cPositions = m_results[i].task.cPositions;
+            sample.ms = m_results[i].actualMs;
+
+            samples.push_back(sample);
+        }
+    }
+
+    bool bFitted = fitted.Fit(samples);
+
+    JsonWriter writer;
+
+    writer.BeginObject();
+    writer.Key("inputs");
+    writer.Integer((LONGLONG)m_inputs.size());
+    writer.Key("tasks");
+    writer.Integer((LONGLONG)m_results.size());
+    writer.Key("workers");
+    writer.Integer(m_cWorkers);
+    writer.Key("steals");
+    writer.Integer((LONGLONG)m_queues.Steals());
+    writer.Key("probe_ms");
+    writer.Number(probeMs);
+    writer.Key("predicted_makespan_ms");
+    writer.Number(predictedMs);
+    writer.Key("makespan_ms");
+    writer.Number(makespanMs);
+    writer.Key("worker_ms");
+    writer.BeginArray();
+    for (size_t i = 0; i < m_workerMs.size(); i++)
+    {
+        writer.Number(m_workerMs[i]);
+    }
+    writer.EndArray();
+    writer.Key("model");
+    writer.BeginArray();
+    writer.Number(m_model.openMs);
+    writer.Number(m_model.seekMs);
+    writer.Number(m_model.frameMs);
+    writer.EndArray();
+    writer.Key("fitted");
+    if (bFitted)
+    {
+        writer.BeginArray();
+        writer.Number(fitted.openMs);
+        writer.Number(fitted.seekMs);
+        writer.Number(fitted.frameMs);
+        writer.EndArray();
+    }
+    else
+    {
+        writer.Null();
+    }
+    writer.EndObject();
+
+    WriteLine(writer.Text());
+}
+
+
+//-------------------------------------------------------------------
+// WriteLine: Writes a line to standard output.
+//-------------------------------------------------------------------
+
+void BatchRunner::WriteLine(const std::string& line)
+{
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD cbWritten = 0;
+
+    if (hOut == NULL || hOut == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    std::string text = line + "\n";
+
+    WriteFile(hOut, text.c_str(), (DWORD)text.size(), &cbWritten, NULL);
+}
+
+
+//-------------------------------------------------------------------
+// RunBatch
+//
+// Entry point for the --batch command line (see batch.h).
+//-------------------------------------------------------------------
+
+INT RunBatch(int argc, LPWSTR *argv)
+{
+    HRESULT hr = S_OK;
+
+    const WCHAR *wszListFile = NULL;
+    const WCHAR *wszOutputDir = L".";
+    VT_OPTIONS opts = { DEFAULT_BATCH_THUMBNAILS, NULL, DEFAULT_BATCH_THUMB_SIZE, DEFAULT_BATCH_THUMB_SIZE,
+        VT_FORMAT_JPEG, 0.0f };
+    BatchCostModel model;
+    BOOL bFifo = FALSE;
+    TimeBudget timeBudget;
+    DWORD cWorkers = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (wcscmp(argv[i], L"--batch") == 0 && i + 1 < argc)
+        {
+            wszListFile = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--output") == 0 && i + 1 < argc)
+        {
+            wszOutputDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--count") == 0 && i + 1 < argc)
+        {
+            opts.cThumbnails = (UINT32)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--size") == 0 && i + 1 < argc)
+        {
+            if (swscanf_s(argv[++i], L"%ux%u", &opts.cxThumbnail, &opts.cyThumbnail) != 2)
+            {
+                return 1;
+            }
+        }
+        else if (wcscmp(argv[i], L"--format") == 0 && i + 1 < argc)
+        {
+            ++i;
+            opts.format = (wcscmp(argv[i], L"png") == 0) ? VT_FORMAT_PNG : VT_FORMAT_JPEG;
+        }
+        else if (wcscmp(argv[i], L"--workers") == 0 && i + 1 < argc)
+        {
+            cWorkers = (DWORD)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--model") == 0 && i + 1 < argc)
+        {
+            if (swscanf_s(argv[++i], L"%lf,%lf,%lf", &model.openMs, &model.seekMs, &model.frameMs) != 3)
+            {
+                return 1;
+            }
+        }
+        else if (wcscmp(argv[i], L"--fifo") == 0)
+        {
+            bFifo = TRUE;
+        }
+        else if (wcscmp(argv[i], L"--file-timeout") == 0 && i + 1 < argc)
+        {
+            timeBudget.fileMs = (uint32_t)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--position-timeout") == 0 && i + 1 < argc)
+        {
+            timeBudget.positionMs = (uint32_t)_wtoi(argv[++i]);
+        }
+        else
+        {
+            return 1;
+        }
+    }
+
+    if (wszListFile == NULL || opts.cThumbnails == 0 || opts.cThumbnails > MAX_BATCH_THUMBNAILS ||
+        opts.cxThumbnail == 0 || opts.cyThumbnail == 0)
+    {
+        return 1;
+    }
+
+    if (cWorkers == 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        cWorkers = si.dwNumberOfProcessors;
+    }
+
+    hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    if (SUCCEEDED(hr))
+    {
+        BatchRunner runner;
+
+        hr = runner.Initialize(cWorkers);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = runner.LoadList(wszListFile);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            runner.SetOutput(wszOutputDir);
+            runner.SetOptions(opts);
+            runner.SetModel(model);
+            runner.SetFifo(bFifo);
+            runner.SetTimeBudget(timeBudget);
+
+            hr = runner.Run();
+        }
+
+        CoUninitialize();
+    }
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Batch mode: Creates thumbnails for a list of files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "thumbcontext.h"
+#include "readercache.h"
+#include "batchplan.h"
+#include "json.h"
+
+// NOTE: Batch mode
+//
+//   VideoThumbnail.exe --batch <list-file> --output <directory> [options]
+//
+// The list file names one input per line (UTF-8). Each input gets
+// --count evenly spaced thumbnails, written to the output directory as
+// <input>_<position>.jpg (or .png), where <input> is the line number
+// from 0.
+//
+// The batch runs in two passes on the same workers. The first probes
+// every input (see ThumbnailContext::Probe); the second creates the
+// thumbnails, in the tasks and order that PlanBatch chose (see
+// batchplan.h). The workers share a reader cache, so the reader opened
+// by the probe is normally the one that the first task of the input
+// uses.
+//
+// Output on standard output is one JSON object per line: one per task,
+//
+//   { "input": 3, "first": 0, "count": 4, "worker": 1, "stolen": false,
+//     "hr": 0, "predicted_ms": 120.0, "actual_ms": 134.2 }
+//
+// and a summary at the end:
+//
+//   { "inputs": 20, "tasks": 23, "workers": 4, "steals": 2,
+//     "probe_ms": 310.5, "predicted_makespan_ms": 2210.0,
+//     "makespan_ms": 2305.7, "worker_ms": [ ... ],
+//     "model": [ 30.0, 15.0, 40.0 ], "fitted": [ 41.2, 12.9, 37.5 ] }
+//
+// "fitted" is the model that best explains this run's times, or null if
+// the run could not determine it. Passing it to --model calibrates the
+// next run.
+//
+// Options:
+//
+//   --count <n>                Thumbnails per input (default 4).
+//   --size <width>x<height>    Thumbnail size (default 160x160).
+//   --format jpeg|png          Image format (default jpeg).
+//   --workers <n>              Worker threads (default: one per CPU).
+//   --model <open>,<seek>,<frame>
+//                              Cost model coefficients, in ms.
+//   --fifo                     Processes the inputs whole, in list
+//                              order, from a single queue; for
+//                              comparison with the plan.
+//   --file-timeout <ms>        Time limit for each task's reads.
+//   --position-timeout <ms>    Time limit for reading each position.
+//
+// With a time limit (see watchdog.h), an input that hangs or reads too
+// slowly costs its worker no more than the limit: the thumbnails that
+// were not ready fail with HRESULT_FROM_WIN32(ERROR_TIMEOUT), and the
+// task reports the first failure.
+
+// A task, and what happened to it.
+struct BatchTaskResult
+{
+    BatchTask   task;
+    DWORD       iWorker;
+    BOOL        bStolen;
+    HRESULT     hr;
+    double      actualMs;
+};
+
+class BatchRunner
+{
+    std::vector<std::wstring>       m_inputs;
+    std::vector<BatchProbe>         m_probes;
+    std::vector<LONGLONG>           m_positions;        // --count per input.
+    std::wstring                    m_outputDir;
+    VT_OPTIONS                      m_opts;             // Without positions.
+    BatchCostModel                  m_model;
+    BOOL                            m_bFifo;
+    TimeBudget                      m_timeBudget;
+
+    Watchdog                        m_watchdog;         // If there is a time budget.
+    ReaderCache                     m_readerCache;
+    BatchQueues                     m_queues;
+    std::vector<BatchTaskResult>    m_results;
+    std::vector<double>             m_workerMs;         // Busy time of each worker.
+    CRITICAL_SECTION                m_lock;             // Guards m_results and the output.
+    volatile LONG                   m_iNextProbe;
+    DWORD                           m_cWorkers;
+
+public:
+
+    BatchRunner();
+    ~BatchRunner();
+
+    HRESULT     Initialize(DWORD cWorkers);
+    HRESULT     LoadList(const WCHAR *wszListFile);
+
+    void        SetOutput(const WCHAR *wszDirectory) { m_outputDir = wszDirectory; }
+    void        SetOptions(const VT_OPTIONS& opts) { m_opts = opts; }
+    void        SetModel(const BatchCostModel& model) { m_model = model; }
+    void        SetFifo(BOOL bFifo) { m_bFifo = bFifo; }
+    void        SetTimeBudget(const TimeBudget& budget) { m_timeBudget = budget; }
+
+    HRESULT     Run();
+
+private:
+    struct WorkerParams
+    {
+        BatchRunner     *pRunner;
+        DWORD           iWorker;
+        BOOL            bProbe;         // Otherwise the tasks.
+    };
+
+    static DWORD WINAPI WorkerThreadProc(LPVOID lpParameter);
+
+    HRESULT     RunWorkers(BOOL bProbe);
+    void        ProbeInputs(ThumbnailContext *pContext);
+    void        RunTasks(ThumbnailContext *pContext, DWORD iWorker);
+    HRESULT     RunTask(ThumbnailContext *pContext, const BatchTask& task);
+    void        ReportTask(const BatchTaskResult& result);
+    void        ReportSummary(double probeMs, double predictedMs, double makespanMs);
+    void        WriteLine(const std::string& line);
+};
+
+INT RunBatch(int argc, LPWSTR *argv);
@@ -0,0 +1,358 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BatchPlan: Orders and packs the inputs of a batch by predicted cost.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "batchplan.h"
+
+#include <math.h>
+#include <algorithm>
+
+static double Megapixels(const BatchProbe& probe)
+{
+    return (double)probe.width * (double)probe.height / 1e6;
+}
+
+static bool LongerFirst(const BatchTask& a, const BatchTask& b)
+{
+    return a.predictedMs > b.predictedMs;
+}
+
+// Solves the normal equations for the active coefficients by Gaussian
+// elimination; the others are zero. Fails if they are singular.
+static bool SolveNormal(const double ata[3][3], const double aty[3], const bool bActive[3], double coefficients[3])
+{
+    double a[3][4];         // [A^T A | A^T y] of the active terms.
+    int index[3];
+    int n = 0;
+
+    for (int r = 0; r < 3; r++)
+    {
+        coefficients[r] = 0;
+
+        if (bActive[r])
+        {
+            index[n++] = r;
+        }
+    }
+
+    for (int r = 0; r < n; r++)
+    {
+        for (int c = 0; c < n; c++)
+        {
+            a[r][c] = ata[index[r]][index[c]];
+        }
+        a[r][n] = aty[index[r]];
+    }
+
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+
+        for (int r = col + 1; r < n; r++)
+        {
+            if (fabs(a[r][col]) > fabs(a[pivot][col]))
+            {
+                pivot = r;
+            }
+        }
+
+        if (fabs(a[pivot][col]) < 1e-9)
+        {
+            return false;
+        }
+
+        for (int c = 0; c <= n; c++)
+        {
+            std::swap(a[col][c], a[pivot][c]);
+        }
+
+        for (int r = 0; r < n; r++)
+        {
+            if (r != col)
+            {
+                double f = a[r][col] / a[col][col];
+
+                for (int c = col; c <= n; c++)
+                {
+                    a[r][c] -= f * a[col][c];
+                }
+            }
+        }
+    }
+
+    for (int r = 0; r < n; r++)
+    {
+        coefficients[index[r]] = a[r][n] / a[r][r];
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Predict
+//-------------------------------------------------------------------
+
+double BatchCostModel::Predict(const BatchProbe& probe, uint32_t cPositions) const
+{
+    if (!probe.bOk)
+    {
+        return openMs;
+    }
+
+    double cSeeks = probe.bCanSeek ? (double)cPositions : 0.0;
+
+    return openMs + seekMs * cSeeks + frameMs * (double)cPositions * Megapixels(probe);
+}
+
+
+//-------------------------------------------------------------------
+// Fit
+//
+// Least squares, by the normal equations. A coefficient that comes out
+// negative, which noise can do to a small one, is set to zero and the
+// others are fitted again. The fit is rejected if the samples do not
+// vary enough to separate the terms.
+//-------------------------------------------------------------------
+
+bool BatchCostModel::Fit(const std::vector<Sample>& samples)
+{
+    double ata[3][3] = { { 0 } };
+    double aty[3] = { 0 };
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        const Sample& sample = samples[i];
+
+        if (!sample.probe.bOk)
+        {
+            continue;
+        }
+
+        double x[3] =
+        {
+            1.0,
+            sample.probe.bCanSeek ? (double)sample.cPositions : 0.0,
+            (double)sample.cPositions * Megapixels(sample.probe)
+        };
+
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                ata[r][c] += x[r] * x[c];
+            }
+            aty[r] += x[r] * sample.ms;
+        }
+    }
+
+    bool bActive[3] = { true, true, true };
+    double coefficients[3];
+
+    for (int cActive = 3; cActive > 0; cActive--)
+    {
+        if (!SolveNormal(ata, aty, bActive, coefficients))
+        {
+            return false;
+        }
+
+        int iNegative = -1;
+
+        for (int r = 0; r < 3; r++)
+        {
+            if (coefficients[r] < 0 && (iNegative < 0 || coefficients[r] < coefficients[iNegative]))
+            {
+                iNegative = r;
+            }
+        }
+
+        if (iNegative < 0)
+        {
+            openMs = coefficients[0];
+            seekMs = coefficients[1];
+            frameMs = coefficients[2];
+            return true;
+        }
+
+        bActive[iNegative] = false;
+    }
+
+    return false;
+}
+
+
+//-------------------------------------------------------------------
+// PlanBatch
+//-------------------------------------------------------------------
+
+void PlanBatch(
+    const std::vector<BatchProbe>& probes,
+    const std::vector<uint32_t>& positionCounts,
+    const BatchCostModel& model,
+    uint32_t cWorkers,
+    std::vector<BatchTask> *pTasks
+    )
+{
+    double totalMs = 0;
+
+    pTasks->clear();
+
+    for (size_t i = 0; i < probes.size(); i++)
+    {
+        totalMs += model.Predict(probes[i], positionCounts[i]);
+    }
+
+    // No task should take longer than a worker's fair share of the
+    // batch, or that worker finishes last.
+    double fairMs = totalMs / (cWorkers ? cWorkers : 1);
+
+    for (uint32_t i = 0; i < (uint32_t)probes.size(); i++)
+    {
+        const BatchProbe& probe = probes[i];
+        uint32_t cPositions = positionCounts[i];
+        double ms = model.Predict(probe, cPositions);
+        uint32_t cSplits = 1;
+
+        if (probe.bOk && probe.bCanSeek && cPositions > 1 && fairMs > 0 && ms > fairMs)
+        {
+            cSplits = (uint32_t)ceil(ms / fairMs);
+
+            if (cSplits > cPositions)
+            {
+                cSplits = cPositions;
+            }
+        }
+
+        for (uint32_t k = 0; k < cSplits; k++)
+        {
+            BatchTask task;
+
+            task.iInput = i;
+            task.iFirst = (uint32_t)((uint64_t)cPositions * k / cSplits);
+            task.cPositions = (uint32_t)((uint64_t)cPositions * (k + 1) / cSplits) - task.iFirst;
+            task.predictedMs = model.Predict(probe, task.cPositions);
+
+            pTasks->push_back(task);
+        }
+    }
+
+    std::stable_sort(pTasks->begin(), pTasks->end(), LongerFirst);
+}
+
+
+//-------------------------------------------------------------------
+// BatchQueues constructor
+//-------------------------------------------------------------------
+
+BatchQueues::BatchQueues() : m_cSteals(0)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Assign
+//-------------------------------------------------------------------
+
+double BatchQueues::Assign(const std::vector<BatchTask>& tasks, uint32_t cWorkers)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_queues.assign(cWorkers ? cWorkers : 1, Queue());
+    m_cSteals = 0;
+
+    for (size_t q = 0; q < m_queues.size(); q++)
+    {
+        m_queues[q].remainingMs = 0;
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        size_t best = 0;
+
+        for (size_t q = 1; q < m_queues.size(); q++)
+        {
+            if (m_queues[q].remainingMs < m_queues[best].remainingMs)
+            {
+                best = q;
+            }
+        }
+
+        m_queues[best].tasks.push_back(tasks[i]);
+        m_queues[best].remainingMs += tasks[i].predictedMs;
+    }
+
+    double makespanMs = 0;
+
+    for (size_t q = 0; q < m_queues.size(); q++)
+    {
+        if (m_queues[q].remainingMs > makespanMs)
+        {
+            makespanMs = m_queues[q].remainingMs;
+        }
+    }
+
+    return makespanMs;
+}
+
+
+//-------------------------------------------------------------------
+// Next
+//-------------------------------------------------------------------
+
+bool BatchQueues::Next(uint32_t iWorker, BatchTask *pTask, bool *pbStolen)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (pbStolen)
+    {
+        *pbStolen = false;
+    }
+
+    if (iWorker >= m_queues.size())
+    {
+        return false;
+    }
+
+    Queue *pOwn = &m_queues[iWorker];
+
+    if (!pOwn->tasks.empty())
+    {
+        *pTask = pOwn->tasks.front();
+        pOwn->tasks.pop_front();
+        pOwn->remainingMs -= pTask->predictedMs;
+        return true;
+    }
+
+    Queue *pVictim = NULL;
+
+    for (size_t q = 0; q < m_queues.size(); q++)
+    {
+        if (!m_queues[q].tasks.empty() && (pVictim == NULL || m_queues[q].remainingMs > pVictim->remainingMs))
+        {
+            pVictim = &m_queues[q];
+        }
+    }
+
+    if (pVictim == NULL)
+    {
+        return false;
+    }
+
+    *pTask = pVictim->tasks.back();
+    pVictim->tasks.pop_back();
+    pVictim->remainingMs -= pTask->predictedMs;
+    ++m_cSteals;
+
+    if (pbStolen)
+    {
+        *pbStolen = true;
+    }
+    return true;
+}
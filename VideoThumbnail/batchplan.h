@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BatchPlan: Orders and packs the inputs of a batch by predicted cost.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// NOTE: Scheduling
+//
+// When a batch is processed in the order it was listed, one long or
+// large input that comes last keeps a single worker busy long after the
+// others have finished. The batch runner (batch.h) therefore probes
+// every input first, which only opens it: its duration, frame size and
+// whether it can seek. BatchCostModel turns that into a predicted time,
+// and PlanBatch then:
+//
+//   - splits each seekable input whose predicted time is more than a
+//     worker's fair share into tasks of consecutive positions, which
+//     open the input separately and run on different workers;
+//   - sorts the tasks longest first, and deals each one to the worker
+//     with the least predicted work so far.
+//
+// Inputs that cannot seek are never split: every thumbnail of such an
+// input comes from the start of the stream, so a second task would only
+// decode the same frames again.
+//
+// BatchQueues holds the tasks that were dealt to each worker. A worker
+// takes the longest of its own tasks first; when it has none left, it
+// steals the shortest task of the worker with the most predicted work
+// remaining, so that mistakes in the predictions even out.
+//
+// After the batch, BatchCostModel::Fit finds the coefficients that best
+// explain the measured times (least squares), which can be passed to
+// the next run.
+//
+// Like framesource.h, this depends only on the C++ standard library.
+
+// What probing found out about an input.
+struct BatchProbe
+{
+    bool        bOk;            // Otherwise the input could not be opened.
+    int64_t     hnsDuration;
+    uint32_t    width;
+    uint32_t    height;
+    bool        bCanSeek;
+
+    BatchProbe() : bOk(false), hnsDuration(0), width(0), height(0), bCanSeek(false)
+    {
+    }
+};
+
+// Time of a task, in milliseconds:
+//
+//     openMs + seekMs * seeks + frameMs * positions * megapixels
+//
+// where seeks is the number of positions if the input can seek, and 0
+// otherwise. frameMs covers the frames decoded on the way to each
+// position as well as the one that is converted, scaled and encoded.
+struct BatchCostModel
+{
+    double      openMs;
+    double      seekMs;
+    double      frameMs;        // Per position and megapixel.
+
+    BatchCostModel() : openMs(30.0), seekMs(15.0), frameMs(40.0)
+    {
+    }
+
+    double      Predict(const BatchProbe& probe, uint32_t cPositions) const;
+
+    // Fits the coefficients to measured tasks; none comes out negative.
+    // Leaves the model as it is, and returns false, if the samples
+    // cannot determine them.
+    struct Sample
+    {
+        BatchProbe  probe;
+        uint32_t    cPositions;
+        double      ms;
+    };
+
+    bool        Fit(const std::vector<Sample>& samples);
+};
+
+// A run of consecutive positions of one input.
+struct BatchTask
+{
+    uint32_t    iInput;
+    uint32_t    iFirst;         // First position.
+    uint32_t    cPositions;
+    double      predictedMs;
+};
+
+// Splits and orders the inputs into tasks, longest first. probes and
+// positionCounts have one element per input; inputs that failed to
+// probe get one task, with the cost of an open.
+void PlanBatch(
+    const std::vector<BatchProbe>& probes,
+    const std::vector<uint32_t>& positionCounts,
+    const BatchCostModel& model,
+    uint32_t cWorkers,
+    std::vector<BatchTask> *pTasks
+    );
+
+
+class BatchQueues
+{
+    struct Queue
+    {
+        std::deque<BatchTask>   tasks;          // Longest first.
+        double                  remainingMs;    // Predicted.
+    };
+
+    std::vector<Queue>  m_queues;
+    std::mutex          m_mutex;
+    uint64_t            m_cSteals;
+
+public:
+
+    BatchQueues();
+
+    // Deals the tasks, which must be sorted longest first, to cWorkers
+    // workers. Returns the predicted makespan: the most work dealt to
+    // any worker.
+    double      Assign(const std::vector<BatchTask>& tasks, uint32_t cWorkers);
+
+    // Takes the next task for a worker: its own longest, or else the
+    // shortest of the busiest other worker, in which case *pbStolen is
+    // set. Returns false when no tasks are left.
+    bool        Next(uint32_t iWorker, BatchTask *pTask, bool *pbStolen = NULL);
+
+    uint64_t    Steals() const { return m_cSteals; }
+};
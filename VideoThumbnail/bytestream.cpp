@@ -0,0 +1,784 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CachedByteStream: Read-ahead byte stream for files on slow storage.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "bytestream.h"
+
+// ReadResult: Carries the byte count of an asynchronous read from
+// BeginRead to EndRead.
+
+class ReadResult : public IUnknown
+{
+    long    m_cRef;
+
+public:
+    ULONG   cbRead;
+
+    ReadResult() : m_cRef(1), cbRead(0)
+    {
+    }
+
+    STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+    {
+        if (ppv == NULL)
+        {
+            return E_POINTER;
+        }
+        if (riid != IID_IUnknown)
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        *ppv = static_cast<IUnknown*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    STDMETHODIMP_(ULONG) Release()
+    {
+        ULONG cRef = InterlockedDecrement(&m_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+};
+
+// Copies from a file mapping. A read error in a mapped file raises an
+// exception instead of failing a call.
+static BOOL CopyFromView(void *pDest, const BYTE *pSource, size_t cb)
+{
+    __try
+    {
+        CopyMemory(pDest, pSource, cb);
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Returns TRUE if the file is on a fixed local drive.
+static BOOL IsLocalFixedDrive(const WCHAR *wszPath)
+{
+    WCHAR wszVolume[MAX_PATH];
+
+    if (!GetVolumePathName(wszPath, wszVolume, MAX_PATH))
+    {
+        return FALSE;
+    }
+    return GetDriveType(wszVolume) == DRIVE_FIXED;
+}
+
+
+//-------------------------------------------------------------------
+// FileSource::ReadAt
+//-------------------------------------------------------------------
+
+bool CachedByteStream::FileSource::ReadAt(uint64_t offset, void *pBuffer, size_t cb)
+{
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD cbRead = 0;
+
+    return cb <= MAXDWORD && ReadFile(hFile, pBuffer, (DWORD)cb, &cbRead, &ov) && cbRead == cb;
+}
+
+
+//-------------------------------------------------------------------
+// CreateInstance
+//
+// Opens a file for reading through the range cache, or through a
+// mapping.
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::CreateInstance(const WCHAR *wszPath, const ByteStreamOptions& options, CachedByteStream **ppStream)
+{
+    if (wszPath == NULL || ppStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppStream = NULL;
+
+    CachedByteStream *pStream = new (std::nothrow) CachedByteStream();
+
+    if (pStream == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = pStream->Initialize(wszPath, options);
+
+    if (SUCCEEDED(hr))
+    {
+        *ppStream = pStream;
+    }
+    else
+    {
+        pStream->Release();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CreateForUrl
+//
+// Opens an HTTP or HTTPS URL for reading through the range cache.
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::CreateForUrl(const WCHAR *wszUrl, const ByteStreamOptions& options, CachedByteStream **ppStream)
+{
+    if (wszUrl == NULL || ppStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppStream = NULL;
+
+    CachedByteStream *pStream = new (std::nothrow) CachedByteStream();
+
+    if (pStream == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = pStream->InitializeUrl(wszUrl, options);
+
+    if (SUCCEEDED(hr))
+    {
+        *ppStream = pStream;
+    }
+    else
+    {
+        pStream->Release();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CreateForMemory
+//
+// Reads a buffer in memory in place.
+//
+// wszTypeHint: MIME type or file name of the content, or NULL.
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::CreateForMemory(const BYTE *pData, ULONGLONG cbData, const WCHAR *wszTypeHint, CachedByteStream **ppStream)
+{
+    if ((pData == NULL && cbData > 0) || ppStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppStream = NULL;
+
+    CachedByteStream *pStream = new (std::nothrow) CachedByteStream();
+
+    if (pStream == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = pStream->InitializeMemory(pData, cbData, wszTypeHint);
+
+    if (SUCCEEDED(hr))
+    {
+        *ppStream = pStream;
+    }
+    else
+    {
+        pStream->Release();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CachedByteStream constructor
+//-------------------------------------------------------------------
+
+CachedByteStream::CachedByteStream()
+    : m_cRef(1),
+      m_pAttributes(NULL),
+      m_pHttp(NULL),
+      m_hMapping(NULL),
+      m_pView(NULL),
+      m_cbFile(0),
+      m_position(0),
+      m_cbMapped(0),
+      m_bMapped(FALSE),
+      m_bCallerView(FALSE),
+      m_bClosed(FALSE)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// CachedByteStream destructor
+//-------------------------------------------------------------------
+
+CachedByteStream::~CachedByteStream()
+{
+    CloseFile();
+    delete m_pHttp;
+    SafeRelease(&m_pAttributes);
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// GetStats
+//-------------------------------------------------------------------
+
+void CachedByteStream::GetStats(ByteStreamStats *pStats)
+{
+    EnterCriticalSection(&m_lock);
+
+    const RangeCacheStats& stats = m_cache.Stats();
+
+    pStats->cbFile = m_cbFile;
+    pStats->bMapped = m_bMapped;
+
+    if (m_bMapped)
+    {
+        pStats->cbRequested = m_cbMapped;
+        pStats->cbRead = m_cbMapped;
+        pStats->cReads = 0;
+    }
+    else if (m_pHttp)
+    {
+        pStats->cbRequested = stats.cbRequested;
+        pStats->cbRead = m_pHttp->BytesTransferred();
+        pStats->cReads = m_pHttp->Requests();
+    }
+    else
+    {
+        pStats->cbRequested = stats.cbRequested;
+        pStats->cbRead = stats.cbFetched;
+        pStats->cReads = stats.cFetches;
+    }
+
+    LeaveCriticalSection(&m_lock);
+}
+
+
+// IUnknown methods
+
+STDMETHODIMP CachedByteStream::QueryInterface(REFIID riid, void **ppv)
+{
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown || riid == __uuidof(IMFByteStream))
+    {
+        *ppv = static_cast<IMFByteStream*>(this);
+    }
+    else if (riid == __uuidof(IMFAttributes))
+    {
+        *ppv = static_cast<IMFAttributes*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP_(ULONG) CachedByteStream::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+STDMETHODIMP_(ULONG) CachedByteStream::Release()
+{
+    ULONG cRef = InterlockedDecrement(&m_cRef);
+    if (cRef == 0)
+    {
+        delete this;
+    }
+    return cRef;
+}
+
+
+// IMFByteStream methods
+
+STDMETHODIMP CachedByteStream::GetCapabilities(DWORD *pdwCapabilities)
+{
+    if (pdwCapabilities == NULL)
+    {
+        return E_POINTER;
+    }
+    *pdwCapabilities = MFBYTESTREAM_IS_READABLE | MFBYTESTREAM_IS_SEEKABLE;
+
+    if (m_pHttp)
+    {
+        *pdwCapabilities |= MFBYTESTREAM_IS_REMOTE;
+    }
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::GetLength(QWORD *pqwLength)
+{
+    if (pqwLength == NULL)
+    {
+        return E_POINTER;
+    }
+    *pqwLength = m_cbFile;
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::SetLength(QWORD /*qwLength*/)
+{
+    return E_ACCESSDENIED;
+}
+
+STDMETHODIMP CachedByteStream::GetCurrentPosition(QWORD *pqwPosition)
+{
+    if (pqwPosition == NULL)
+    {
+        return E_POINTER;
+    }
+
+    EnterCriticalSection(&m_lock);
+    *pqwPosition = m_position;
+    LeaveCriticalSection(&m_lock);
+
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::SetCurrentPosition(QWORD qwPosition)
+{
+    EnterCriticalSection(&m_lock);
+    m_position = qwPosition;
+    LeaveCriticalSection(&m_lock);
+
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::IsEndOfStream(BOOL *pfEndOfStream)
+{
+    if (pfEndOfStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    EnterCriticalSection(&m_lock);
+    *pfEndOfStream = (m_position >= m_cbFile);
+    LeaveCriticalSection(&m_lock);
+
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::Read(BYTE *pb, ULONG cb, ULONG *pcbRead)
+{
+    if (pb == NULL || pcbRead == NULL)
+    {
+        return E_POINTER;
+    }
+
+    EnterCriticalSection(&m_lock);
+
+    HRESULT hr = ReadAt(m_position, pb, cb, pcbRead);
+
+    if (SUCCEEDED(hr))
+    {
+        m_position += *pcbRead;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return hr;
+}
+
+// The read is done before BeginRead returns. The reads that reach the
+// file are few and large, so doing them on the source's work queue
+// thread costs less than handing each one to another thread.
+
+STDMETHODIMP CachedByteStream::BeginRead(BYTE *pb, ULONG cb, IMFAsyncCallback *pCallback, IUnknown *punkState)
+{
+    HRESULT hr = S_OK;
+
+    IMFAsyncResult *pResult = NULL;
+
+    if (pCallback == NULL)
+    {
+        return E_POINTER;
+    }
+
+    ReadResult *pRead = new (std::nothrow) ReadResult();
+
+    if (pRead == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = MFCreateAsyncResult(pRead, pCallback, punkState, &pResult);
+
+    if (SUCCEEDED(hr))
+    {
+        pResult->SetStatus(Read(pb, cb, &pRead->cbRead));
+
+        hr = MFInvokeCallback(pResult);
+    }
+
+    SafeRelease(&pResult);
+    pRead->Release();
+    return hr;
+}
+
+STDMETHODIMP CachedByteStream::EndRead(IMFAsyncResult *pResult, ULONG *pcbRead)
+{
+    HRESULT hr = S_OK;
+
+    IUnknown *pUnk = NULL;
+
+    if (pResult == NULL || pcbRead == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbRead = 0;
+
+    hr = pResult->GetObject(&pUnk);
+
+    if (SUCCEEDED(hr))
+    {
+        *pcbRead = static_cast<ReadResult*>(pUnk)->cbRead;
+
+        hr = pResult->GetStatus();
+    }
+
+    SafeRelease(&pUnk);
+    return hr;
+}
+
+STDMETHODIMP CachedByteStream::Write(const BYTE * /*pb*/, ULONG /*cb*/, ULONG * /*pcbWritten*/)
+{
+    return E_ACCESSDENIED;
+}
+
+STDMETHODIMP CachedByteStream::BeginWrite(const BYTE * /*pb*/, ULONG /*cb*/, IMFAsyncCallback * /*pCallback*/, IUnknown * /*punkState*/)
+{
+    return E_ACCESSDENIED;
+}
+
+STDMETHODIMP CachedByteStream::EndWrite(IMFAsyncResult * /*pResult*/, ULONG * /*pcbWritten*/)
+{
+    return E_ACCESSDENIED;
+}
+
+STDMETHODIMP CachedByteStream::Seek(
+    MFBYTESTREAM_SEEK_ORIGIN SeekOrigin,
+    LONGLONG llSeekOffset,
+    DWORD /*dwSeekFlags*/,
+    QWORD *pqwCurrentPosition
+    )
+{
+    HRESULT hr = S_OK;
+
+    EnterCriticalSection(&m_lock);
+
+    LONGLONG llBase = (SeekOrigin == msoCurrent) ? (LONGLONG)m_position : 0;
+
+    if (SeekOrigin != msoBegin && SeekOrigin != msoCurrent)
+    {
+        hr = E_INVALIDARG;
+    }
+    else if (llBase + llSeekOffset < 0)
+    {
+        hr = E_INVALIDARG;
+    }
+    else
+    {
+        m_position = (ULONGLONG)(llBase + llSeekOffset);
+    }
+
+    if (pqwCurrentPosition)
+    {
+        *pqwCurrentPosition = m_position;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return hr;
+}
+
+STDMETHODIMP CachedByteStream::Flush()
+{
+    return S_OK;
+}
+
+STDMETHODIMP CachedByteStream::Close()
+{
+    // A read on another thread can hold the lock while it waits for a
+    // range request. Cancel fails that request first.
+    if (m_pHttp)
+    {
+        m_pHttp->Cancel();
+    }
+
+    EnterCriticalSection(&m_lock);
+    CloseFile();
+    LeaveCriticalSection(&m_lock);
+
+    return S_OK;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Initialize
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::Initialize(const WCHAR *wszPath, const ByteStreamOptions& options)
+{
+    HRESULT hr = S_OK;
+
+    LARGE_INTEGER cbFile;
+
+    hr = MFCreateAttributes(&m_pAttributes, 1);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pAttributes->SetString(MF_BYTESTREAM_ORIGIN_NAME, wszPath);
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_file.hFile = CreateFile(wszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (m_file.hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileSizeEx(m_file.hFile, &cbFile))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_cbFile = (ULONGLONG)cbFile.QuadPart;
+
+    // Map the whole file if asked to. If the address space is too small
+    // for it, read through the cache instead.
+
+    if (options.bMapLocalFiles && m_cbFile > 0 && m_cbFile <= (SIZE_T)-1 && IsLocalFixedDrive(wszPath))
+    {
+        m_hMapping = CreateFileMapping(m_file.hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (m_hMapping)
+        {
+            m_pView = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        }
+
+        if (m_pView == NULL && m_hMapping)
+        {
+            CloseHandle(m_hMapping);
+            m_hMapping = NULL;
+        }
+
+        m_bMapped = (m_pView != NULL);
+    }
+
+    if (m_pView == NULL && !m_cache.Initialize(&m_file, m_cbFile, options.cache))
+    {
+        return E_INVALIDARG;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// InitializeUrl
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::InitializeUrl(const WCHAR *wszUrl, const ByteStreamOptions& options)
+{
+    HRESULT hr = S_OK;
+
+    m_pHttp = new (std::nothrow) HttpRangeSource();
+
+    if (m_pHttp == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = m_pHttp->Open(wszUrl);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MFCreateAttributes(&m_pAttributes, 2);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pAttributes->SetString(MF_BYTESTREAM_ORIGIN_NAME, wszUrl);
+    }
+
+    // A generic type tells the resolver nothing that the URL does not.
+    if (SUCCEEDED(hr) && !m_pHttp->ContentType().empty() &&
+        _wcsicmp(m_pHttp->ContentType().c_str(), L"application/octet-stream") != 0)
+    {
+        hr = m_pAttributes->SetString(MF_BYTESTREAM_CONTENT_TYPE, m_pHttp->ContentType().c_str());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_cbFile = m_pHttp->Size();
+
+        if (!m_cache.Initialize(m_pHttp, m_cbFile, options.cache))
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// InitializeMemory
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::InitializeMemory(const BYTE *pData, ULONGLONG cbData, const WCHAR *wszTypeHint)
+{
+    HRESULT hr = MFCreateAttributes(&m_pAttributes, 1);
+
+    // Tell the source resolver what kind of content this is.
+
+    if (SUCCEEDED(hr) && wszTypeHint != NULL)
+    {
+        if (wcschr(wszTypeHint, L'/') != NULL)
+        {
+            hr = m_pAttributes->SetString(MF_BYTESTREAM_CONTENT_TYPE, wszTypeHint);
+        }
+        else
+        {
+            hr = m_pAttributes->SetString(MF_BYTESTREAM_ORIGIN_NAME, wszTypeHint);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_pView = pData;
+        m_cbFile = cbData;
+        m_bMapped = TRUE;
+        m_bCallerView = TRUE;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ReadAt
+//
+// Reads at an offset, from the mapping or through the cache. Call
+// with the lock held.
+//-------------------------------------------------------------------
+
+HRESULT CachedByteStream::ReadAt(ULONGLONG offset, BYTE *pb, ULONG cb, ULONG *pcbRead)
+{
+    *pcbRead = 0;
+
+    if (m_bClosed)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    if (m_pView)
+    {
+        if (offset < m_cbFile)
+        {
+            ULONG cbCopy = (cb < m_cbFile - offset) ? cb : (ULONG)(m_cbFile - offset);
+
+            if (!CopyFromView(pb, m_pView + offset, cbCopy))
+            {
+                return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+            }
+
+            *pcbRead = cbCopy;
+            m_cbMapped += cbCopy;
+        }
+        return S_OK;
+    }
+
+    size_t cbRead = 0;
+
+    if (!m_cache.Read(offset, pb, cb, &cbRead))
+    {
+        return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+    }
+
+    *pcbRead = (ULONG)cbRead;
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// CloseFile
+//
+// Releases the file, the mapping and the cached blocks. The statistics
+// are kept, and so is the HTTP source, which holds the HTTP counters.
+//-------------------------------------------------------------------
+
+void CachedByteStream::CloseFile()
+{
+    if (m_pView)
+    {
+        if (!m_bCallerView)
+        {
+            UnmapViewOfFile(m_pView);
+        }
+        m_pView = NULL;
+    }
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+    if (m_file.hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file.hFile);
+        m_file.hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_cache.Clear();
+    m_bClosed = TRUE;
+}
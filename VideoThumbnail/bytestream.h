@@ -0,0 +1,170 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CachedByteStream: Read-ahead byte stream for files on slow storage.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "rangecache.h"
+#include "httpsource.h"
+
+// NOTE: Usage
+//
+// Opening a file by URL lets the source read it through the default
+// file byte stream, which issues one read per request from the demuxer.
+// A CachedByteStream reads the file through a RangeCache instead (see
+// rangecache.h), so that adjacent reads and the reads that follow a seek
+// cost one round trip:
+//
+//     CachedByteStream *pStream = NULL;
+//     hr = CachedByteStream::CreateInstance(wszPath, options, &pStream);
+//     hr = generator.OpenByteStream(pStream);
+//
+// With bMapLocalFiles, files on local drives are mapped into memory
+// instead, and reads are copies from the mapping. Files on network
+// drives are never mapped, because an I/O error then becomes an access
+// violation in the middle of the demuxer.
+//
+// CreateForUrl reads an HTTP(S) URL the same way, with one range
+// request per fetch (see httpsource.h).
+//
+// CreateForMemory reads a buffer that the caller owns, the way a mapped
+// file is read, without copying it first. The buffer must stay valid
+// until the stream is closed (IMFByteStream::Close); reads after that
+// fail with MF_E_SHUTDOWN.
+//
+// The stream sets MF_BYTESTREAM_ORIGIN_NAME to the path or URL, so the
+// source resolver finds the container format from the file extension.
+//
+// GetStats reports how many bytes were read from storage (or
+// transferred over HTTP), and in how many reads or requests, compared
+// with the file size.
+
+struct ByteStreamOptions
+{
+    RangeCacheConfig    cache;
+    BOOL                bMapLocalFiles;
+
+    ByteStreamOptions() : bMapLocalFiles(FALSE)
+    {
+    }
+};
+
+struct ByteStreamStats
+{
+    ULONGLONG   cbFile;
+    ULONGLONG   cbRequested;        // Bytes read by the source.
+    ULONGLONG   cbRead;             // Bytes read from storage.
+    ULONGLONG   cReads;             // Reads from storage (round trips).
+    BOOL        bMapped;
+};
+
+
+class CachedByteStream : public IMFByteStream, public IMFAttributes
+{
+    // FileSource: Reads the file for the range cache.
+    class FileSource : public RangeSource
+    {
+    public:
+        HANDLE  hFile;
+
+        FileSource() : hFile(INVALID_HANDLE_VALUE) { }
+
+        bool    ReadAt(uint64_t offset, void *pBuffer, size_t cb);
+    };
+
+    long                m_cRef;
+    CRITICAL_SECTION    m_lock;
+    IMFAttributes       *m_pAttributes;
+
+    FileSource          m_file;
+    HttpRangeSource     *m_pHttp;       // Instead of m_file, for URLs.
+    HANDLE              m_hMapping;
+    const BYTE          *m_pView;       // Whole file, if mapped.
+    RangeCache          m_cache;        // Used if not mapped.
+
+    ULONGLONG           m_cbFile;
+    ULONGLONG           m_position;
+    ULONGLONG           m_cbMapped;     // Bytes copied from the mapping.
+    BOOL                m_bMapped;
+    BOOL                m_bCallerView;  // m_pView belongs to the caller.
+    BOOL                m_bClosed;
+
+    CachedByteStream();
+    ~CachedByteStream();
+
+    HRESULT     Initialize(const WCHAR *wszPath, const ByteStreamOptions& options);
+    HRESULT     InitializeUrl(const WCHAR *wszUrl, const ByteStreamOptions& options);
+    HRESULT     InitializeMemory(const BYTE *pData, ULONGLONG cbData, const WCHAR *wszTypeHint);
+    HRESULT     ReadAt(ULONGLONG offset, BYTE *pb, ULONG cb, ULONG *pcbRead);
+    void        CloseFile();
+
+public:
+
+    static HRESULT CreateInstance(const WCHAR *wszPath, const ByteStreamOptions& options, CachedByteStream **ppStream);
+    static HRESULT CreateForUrl(const WCHAR *wszUrl, const ByteStreamOptions& options, CachedByteStream **ppStream);
+    static HRESULT CreateForMemory(const BYTE *pData, ULONGLONG cbData, const WCHAR *wszTypeHint, CachedByteStream **ppStream);
+
+    void        GetStats(ByteStreamStats *pStats);
+    ULONGLONG   CacheMemory() const { return m_bMapped ? 0 : m_cache.Capacity(); }
+
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+    STDMETHODIMP_(ULONG) AddRef();
+    STDMETHODIMP_(ULONG) Release();
+
+    // IMFByteStream
+    STDMETHODIMP GetCapabilities(DWORD *pdwCapabilities);
+    STDMETHODIMP GetLength(QWORD *pqwLength);
+    STDMETHODIMP SetLength(QWORD qwLength);
+    STDMETHODIMP GetCurrentPosition(QWORD *pqwPosition);
+    STDMETHODIMP SetCurrentPosition(QWORD qwPosition);
+    STDMETHODIMP IsEndOfStream(BOOL *pfEndOfStream);
+    STDMETHODIMP Read(BYTE *pb, ULONG cb, ULONG *pcbRead);
+    STDMETHODIMP BeginRead(BYTE *pb, ULONG cb, IMFAsyncCallback *pCallback, IUnknown *punkState);
+    STDMETHODIMP EndRead(IMFAsyncResult *pResult, ULONG *pcbRead);
+    STDMETHODIMP Write(const BYTE *pb, ULONG cb, ULONG *pcbWritten);
+    STDMETHODIMP BeginWrite(const BYTE *pb, ULONG cb, IMFAsyncCallback *pCallback, IUnknown *punkState);
+    STDMETHODIMP EndWrite(IMFAsyncResult *pResult, ULONG *pcbWritten);
+    STDMETHODIMP Seek(MFBYTESTREAM_SEEK_ORIGIN SeekOrigin, LONGLONG llSeekOffset, DWORD dwSeekFlags, QWORD *pqwCurrentPosition);
+    STDMETHODIMP Flush();
+    STDMETHODIMP Close();
+
+    // IMFAttributes: Forwarded to m_pAttributes.
+    STDMETHODIMP GetItem(REFGUID guidKey, PROPVARIANT *pValue) { return m_pAttributes->GetItem(guidKey, pValue); }
+    STDMETHODIMP GetItemType(REFGUID guidKey, MF_ATTRIBUTE_TYPE *pType) { return m_pAttributes->GetItemType(guidKey, pType); }
+    STDMETHODIMP CompareItem(REFGUID guidKey, REFPROPVARIANT Value, BOOL *pbResult) { return m_pAttributes->CompareItem(guidKey, Value, pbResult); }
+    STDMETHODIMP Compare(IMFAttributes *pTheirs, MF_ATTRIBUTES_MATCH_TYPE MatchType, BOOL *pbResult) { return m_pAttributes->Compare(pTheirs, MatchType, pbResult); }
+    STDMETHODIMP GetUINT32(REFGUID guidKey, UINT32 *punValue) { return m_pAttributes->GetUINT32(guidKey, punValue); }
+    STDMETHODIMP GetUINT64(REFGUID guidKey, UINT64 *punValue) { return m_pAttributes->GetUINT64(guidKey, punValue); }
+    STDMETHODIMP GetDouble(REFGUID guidKey, double *pfValue) { return m_pAttributes->GetDouble(guidKey, pfValue); }
+    STDMETHODIMP GetGUID(REFGUID guidKey, GUID *pguidValue) { return m_pAttributes->GetGUID(guidKey, pguidValue); }
+    STDMETHODIMP GetStringLength(REFGUID guidKey, UINT32 *pcchLength) { return m_pAttributes->GetStringLength(guidKey, pcchLength); }
+    STDMETHODIMP GetString(REFGUID guidKey, LPWSTR pwszValue, UINT32 cchBufSize, UINT32 *pcchLength) { return m_pAttributes->GetString(guidKey, pwszValue, cchBufSize, pcchLength); }
+    STDMETHODIMP GetAllocatedString(REFGUID guidKey, LPWSTR *ppwszValue, UINT32 *pcchLength) { return m_pAttributes->GetAllocatedString(guidKey, ppwszValue, pcchLength); }
+    STDMETHODIMP GetBlobSize(REFGUID guidKey, UINT32 *pcbBlobSize) { return m_pAttributes->GetBlobSize(guidKey, pcbBlobSize); }
+    STDMETHODIMP GetBlob(REFGUID guidKey, UINT8 *pBuf, UINT32 cbBufSize, UINT32 *pcbBlobSize) { return m_pAttributes->GetBlob(guidKey, pBuf, cbBufSize, pcbBlobSize); }
+    STDMETHODIMP GetAllocatedBlob(REFGUID guidKey, UINT8 **ppBuf, UINT32 *pcbSize) { return m_pAttributes->GetAllocatedBlob(guidKey, ppBuf, pcbSize); }
+    STDMETHODIMP GetUnknown(REFGUID guidKey, REFIID riid, LPVOID *ppv) { return m_pAttributes->GetUnknown(guidKey, riid, ppv); }
+    STDMETHODIMP SetItem(REFGUID guidKey, REFPROPVARIANT Value) { return m_pAttributes->SetItem(guidKey, Value); }
+    STDMETHODIMP DeleteItem(REFGUID guidKey) { return m_pAttributes->DeleteItem(guidKey); }
+    STDMETHODIMP DeleteAllItems() { return m_pAttributes->DeleteAllItems(); }
+    STDMETHODIMP SetUINT32(REFGUID guidKey, UINT32 unValue) { return m_pAttributes->SetUINT32(guidKey, unValue); }
+    STDMETHODIMP SetUINT64(REFGUID guidKey, UINT64 unValue) { return m_pAttributes->SetUINT64(guidKey, unValue); }
+    STDMETHODIMP SetDouble(REFGUID guidKey, double fValue) { return m_pAttributes->SetDouble(guidKey, fValue); }
+    STDMETHODIMP SetGUID(REFGUID guidKey, REFGUID guidValue) { return m_pAttributes->SetGUID(guidKey, guidValue); }
+    STDMETHODIMP SetString(REFGUID guidKey, LPCWSTR wszValue) { return m_pAttributes->SetString(guidKey, wszValue); }
+    STDMETHODIMP SetBlob(REFGUID guidKey, const UINT8 *pBuf, UINT32 cbBufSize) { return m_pAttributes->SetBlob(guidKey, pBuf, cbBufSize); }
+    STDMETHODIMP SetUnknown(REFGUID guidKey, IUnknown *pUnknown) { return m_pAttributes->SetUnknown(guidKey, pUnknown); }
+    STDMETHODIMP LockStore() { return m_pAttributes->LockStore(); }
+    STDMETHODIMP UnlockStore() { return m_pAttributes->UnlockStore(); }
+    STDMETHODIMP GetCount(UINT32 *pcItems) { return m_pAttributes->GetCount(pcItems); }
+    STDMETHODIMP GetItemByIndex(UINT32 unIndex, GUID *pguidKey, PROPVARIANT *pValue) { return m_pAttributes->GetItemByIndex(unIndex, pguidKey, pValue); }
+    STDMETHODIMP CopyAllItems(IMFAttributes *pDest) { return m_pAttributes->CopyAllItems(pDest); }
+};
@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// The processor's vector instruction sets, detected once at startup.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "cpulevel.h"
+
+#include <stdint.h>
+
+#if defined(VT_CPU_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(VT_CPU_X86)
+
+// CPUID leaf, subleaf 0: EAX, EBX, ECX, EDX.
+static void CpuId(uint32_t leaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuidex(info, (int)leaf, 0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        regs[i] = (uint32_t)info[i];
+    }
+#else
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+
+    __cpuid_count(leaf, 0, a, b, c, d);
+
+    regs[0] = a;
+    regs[1] = b;
+    regs[2] = c;
+    regs[3] = d;
+#endif
+}
+
+// The register state that the operating system saves (XCR0).
+static uint64_t EnabledState()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax = 0, edx = 0;
+
+    __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static CPU_LEVEL QueryCpuLevel()
+{
+    const uint64_t XCR0_YMM = 0x06;     // SSE and AVX state.
+    const uint64_t XCR0_ZMM = 0xE6;     // And the opmask and ZMM state.
+
+    uint32_t regs[4];
+
+    CpuId(0, regs);
+
+    const uint32_t maxLeaf = regs[0];
+
+    CpuId(1, regs);
+
+    if ((regs[3] & (1u << 26)) == 0)    // SSE2
+    {
+        return CPU_LEVEL_SCALAR;
+    }
+
+    const bool bAvx = (regs[2] & (1u << 28)) != 0;
+    const bool bOsxsave = (regs[2] & (1u << 27)) != 0;
+
+    if (!bAvx || !bOsxsave || maxLeaf < 7)
+    {
+        return CPU_LEVEL_SSE2;
+    }
+
+    const uint64_t state = EnabledState();
+
+    if ((state & XCR0_YMM) != XCR0_YMM)
+    {
+        return CPU_LEVEL_SSE2;
+    }
+
+    CpuId(7, regs);
+
+    if ((regs[1] & (1u << 5)) == 0)     // AVX2
+    {
+        return CPU_LEVEL_SSE2;
+    }
+
+#if defined(VT_CPU_AVX512)
+    const uint32_t AVX512_F_BW = (1u << 16) | (1u << 30);
+
+    if ((regs[1] & AVX512_F_BW) == AVX512_F_BW && (state & XCR0_ZMM) == XCR0_ZMM)
+    {
+        return CPU_LEVEL_AVX512;
+    }
+#endif
+
+    return CPU_LEVEL_AVX2;
+}
+
+#else
+
+static CPU_LEVEL QueryCpuLevel()
+{
+    return CPU_LEVEL_SCALAR;
+}
+
+#endif
+
+
+//-------------------------------------------------------------------
+// DetectCpuLevel
+//
+// Returns the best instruction set that can be used.
+//-------------------------------------------------------------------
+
+CPU_LEVEL DetectCpuLevel()
+{
+    static const CPU_LEVEL level = QueryCpuLevel();
+
+    return level;
+}
+
+
+//-------------------------------------------------------------------
+// CpuLevelName
+//-------------------------------------------------------------------
+
+const char *CpuLevelName(CPU_LEVEL level)
+{
+    switch (level)
+    {
+    case CPU_LEVEL_SCALAR:
+        return "scalar";
+
+    case CPU_LEVEL_SSE2:
+        return "sse2";
+
+    case CPU_LEVEL_AVX2:
+        return "avx2";
+
+    case CPU_LEVEL_AVX512:
+        return "avx512";
+
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// The processor's vector instruction sets, detected once at startup.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// NOTE: Dispatch
+//
+// The build assumes no more than the platform's baseline (SSE2 on x64),
+// so kernels that use newer instructions are compiled for them function
+// by function, and chosen at run time from DetectCpuLevel. A level is
+// only reported if the operating system also saves the registers that it
+// uses (XGETBV), so AVX-512 is not reported on a system that has
+// disabled it.
+//
+// The levels are ordered: each one includes the ones below it. Other
+// processors report CPU_LEVEL_SCALAR.
+//
+// Like the frame sources, this depends only on the C++ standard library
+// and the compiler's intrinsics.
+
+enum CPU_LEVEL
+{
+    CPU_LEVEL_SCALAR = 0,
+    CPU_LEVEL_SSE2,
+    CPU_LEVEL_AVX2,             // AVX2 with AVX and the YMM state.
+    CPU_LEVEL_AVX512,           // AVX-512 F and BW with the ZMM state.
+    CPU_LEVEL_COUNT
+};
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define VT_CPU_X86
+#endif
+
+// Compilers that can build AVX-512 kernels: Visual C++ 2017 15.3 and later,
+// and GCC and Clang.
+#if defined(VT_CPU_X86) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define VT_CPU_AVX512
+#endif
+
+// Marks a function that uses the instructions of a level. Visual C++
+// allows any intrinsic in any function; GCC and Clang need the target.
+#if defined(VT_CPU_X86) && defined(__GNUC__)
+#define VT_TARGET_SSE2      __attribute__((target("sse2")))
+#define VT_TARGET_AVX2      __attribute__((target("avx2")))
+#define VT_TARGET_AVX512    __attribute__((target("avx512f,avx512bw")))
+#else
+#define VT_TARGET_SSE2
+#define VT_TARGET_AVX2
+#define VT_TARGET_AVX512
+#endif
+
+// The best level that the processor and the operating system support.
+// It is detected on the first call and remembered.
+CPU_LEVEL DetectCpuLevel();
+
+const char *CpuLevelName(CPU_LEVEL level);
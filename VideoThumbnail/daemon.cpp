@@ -0,0 +1,2036 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailDaemon: Long-running request server.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "thumbcontext.h"
+#include "shmring.h"
+#include "daemon.h"
+
+#include <algorithm>
+
+const WCHAR DEFAULT_PIPE_NAME[] = L"\\\\.\\pipe\\VideoThumbnail";
+
+const DWORD PIPE_BUFFER_SIZE     = 64 * 1024;
+const DWORD READ_BUFFER_SIZE     = 16 * 1024;
+const size_t MAX_REQUEST_LENGTH  = 1024 * 1024;
+const UINT32 DEFAULT_THUMBNAILS  = 4;
+const UINT32 DEFAULT_THUMB_SIZE  = 160;
+const UINT32 MAX_THUMBNAILS      = 256;
+const DWORD DEFAULT_RING_TIMEOUT = 5000;
+const DWORD MAX_COALESCED_REQUESTS = 16;
+const double COALESCE_WINDOW_MS  = 20.0;
+const DWORD READER_CACHE_ENTRIES = 32;
+const ULONGLONG READER_CACHE_MEMORY = 512 * 1024 * 1024;
+const ULONGLONG DEFAULT_RESULT_CACHE_SIZE = 1024ULL * 1024 * 1024;
+
+HRESULT WriteBufferToFile(const WCHAR *wszFileName, const BYTE *pData, DWORD cbData);
+
+static bool MatchInput(const WorkItem *pFirst, const WorkItem *pOther);
+
+struct ConnectionThreadParams
+{
+    ThumbnailDaemon     *pDaemon;
+    DaemonConnection    *pConnection;
+};
+
+
+// ShmDelivery: Delivers the thumbnails of one request through a
+// consumer's shared-memory ring. It is the allocator for the images, so
+// that they are written straight into ring slots, and the sink that
+// publishes each slot as soon as its image is complete.
+
+class ShmDelivery : public ThumbnailSink
+{
+    SharedFrameRing         m_ring;
+    const DaemonRequest     *m_pRequest;
+    HRESULT                 m_hrAlloc;      // Last allocation failure.
+
+public:
+    VT_ALLOCATOR            allocator;
+    std::vector<DWORD>      slots;          // Published slot of each thumbnail.
+
+    ShmDelivery(const DaemonRequest *pRequest)
+        : m_pRequest(pRequest), m_hrAlloc(S_OK), slots(pRequest->count, MAXDWORD)
+    {
+        allocator.pfnAlloc = Alloc;
+        allocator.pfnFree = Free;
+        allocator.pContext = this;
+    }
+
+    HRESULT Open()
+    {
+        return m_ring.Open(m_pRequest->ring.c_str());
+    }
+
+    // Maps the E_OUTOFMEMORY that a failed allocation turns into back to
+    // the reason the slot could not be acquired.
+    HRESULT TranslateError(HRESULT hr) const
+    {
+        return (hr == E_OUTOFMEMORY && FAILED(m_hrAlloc)) ? m_hrAlloc : hr;
+    }
+
+    HRESULT OnThumbnail(DWORD index, VT_THUMBNAIL *pResult);
+
+private:
+    static void* WINAPI Alloc(void *pContext, SIZE_T cb);
+    static void  WINAPI Free(void *pContext, void *pv);
+};
+
+
+void* WINAPI ShmDelivery::Alloc(void *pContext, SIZE_T cb)
+{
+    ShmDelivery *pThis = (ShmDelivery*)pContext;
+
+    DWORD slot = 0;
+    BYTE *pData = NULL;
+
+    if (cb > pThis->m_ring.SlotSize())
+    {
+        pThis->m_hrAlloc = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        return NULL;
+    }
+
+    // Blocks while the consumer holds every slot.
+    HRESULT hr = pThis->m_ring.AcquireSlot(pThis->m_pRequest->ringTimeoutMs, &slot, &pData);
+
+    if (FAILED(hr))
+    {
+        pThis->m_hrAlloc = hr;
+        return NULL;
+    }
+
+    return pData;
+}
+
+void WINAPI ShmDelivery::Free(void *pContext, void *pv)
+{
+    ShmDelivery *pThis = (ShmDelivery*)pContext;
+
+    DWORD slot = 0;
+
+    if (pThis->m_ring.FindSlot(pv, &slot))
+    {
+        pThis->m_ring.AbandonSlot(slot);
+    }
+}
+
+HRESULT ShmDelivery::OnThumbnail(DWORD index, VT_THUMBNAIL *pResult)
+{
+    HRESULT hr = S_OK;
+    DWORD slot = 0;
+
+    SHM_FRAME_DESCRIPTOR desc;
+    ZeroMemory(&desc, sizeof(desc));
+
+    if (!m_ring.FindSlot(pResult->pData, &slot))
+    {
+        return E_UNEXPECTED;
+    }
+
+    const VT_OPTIONS& opts = m_pRequest->options;
+
+    switch (opts.format)
+    {
+    case VT_FORMAT_BGRA:
+        desc.payload = SHM_PAYLOAD_BGRA;
+        desc.stride = 4 * opts.cxThumbnail;
+        break;
+
+    case VT_FORMAT_PNG:
+        desc.payload = SHM_PAYLOAD_PNG;
+        break;
+
+    default:
+        desc.payload = SHM_PAYLOAD_JPEG;
+        break;
+    }
+
+    desc.cbData = pResult->cbData;
+    desc.width = opts.cxThumbnail;
+    desc.height = opts.cyThumbnail;
+    desc.index = index;
+    desc.hnsTimestamp = pResult->hnsTimestamp;
+
+    StringCchCopyA(desc.requestId, SHM_MAX_REQUEST_ID, m_pRequest->id.c_str());
+
+    hr = m_ring.Publish(slot, desc);
+
+    if (SUCCEEDED(hr))
+    {
+        // The slot belongs to the consumer now.
+        pResult->pData = NULL;
+        slots[index] = slot;
+    }
+
+    return hr;
+}
+
+// PendingRequest: Per-request state while a batch is processed.
+
+struct PendingRequest
+{
+    DaemonRequest       *pRequest;
+    VT_THUMBNAIL        *pResults;
+    ShmDelivery         *pDelivery;
+    const VT_ALLOCATOR  *pAllocator;
+    double              queueMs;
+    HRESULT             hr;
+    BOOL                bFromCache;
+    DWORD               degradations;   // DEGRADE_* flags applied to the results.
+
+    PendingRequest()
+        : pRequest(NULL), pResults(NULL), pDelivery(NULL), pAllocator(NULL), queueMs(0), hr(S_OK), bFromCache(FALSE),
+          degradations(DEGRADE_NONE)
+    {
+    }
+
+    ~PendingRequest()
+    {
+        // Returns any ring slots that were not published.
+        if (pResults)
+        {
+            ThumbnailContext::FreeThumbnails(pAllocator, pResults, pRequest->count);
+        }
+
+        delete pDelivery;
+        delete [] pResults;
+    }
+};
+
+
+//-------------------------------------------------------------------
+// PrepareRequest
+//
+// Allocates the results of a request and opens its delivery ring.
+//-------------------------------------------------------------------
+
+static HRESULT PrepareRequest(PendingRequest *pPending)
+{
+    const DaemonRequest *pRequest = pPending->pRequest;
+
+    pPending->pResults = new (std::nothrow) VT_THUMBNAIL[pRequest->count];
+
+    if (pPending->pResults == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory(pPending->pResults, sizeof(VT_THUMBNAIL) * pRequest->count);
+
+    if (!pRequest->positions.empty())
+    {
+        pPending->pRequest->options.phnsPositions = &pRequest->positions[0];
+    }
+
+    // The consumer's ring is opened for each request, so that it can be
+    // recreated between requests.
+
+    if (!pRequest->ring.empty())
+    {
+        pPending->pDelivery = new (std::nothrow) ShmDelivery(pRequest);
+
+        if (pPending->pDelivery == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        pPending->pAllocator = &pPending->pDelivery->allocator;
+
+        return pPending->pDelivery->Open();
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// SendResponse
+//
+// Sends the response for one request of a batch.
+//
+// timings:     Timings of the batch's shared open/decode/encode.
+// cCoalesced:  Number of requests that shared the decode pass.
+//-------------------------------------------------------------------
+
+static void SendResponse(const PendingRequest& pending, const StageTimings& timings, DWORD cCoalesced, double processMs)
+{
+    const DaemonRequest *pRequest = pending.pRequest;
+    const ShmDelivery *pDelivery = pending.pDelivery;
+
+    double writeMs = 0;
+
+    JsonWriter writer;
+    writer.BeginObject();
+    writer.Key("id");
+    writer.String(pRequest->id);
+    writer.Key("hr");
+    writer.HResult(pending.hr);
+
+    if (SUCCEEDED(pending.hr))
+    {
+        Stopwatch write;
+
+        writer.Key("thumbnails");
+        writer.BeginArray();
+
+        for (UINT32 i = 0; i < pRequest->count; i++)
+        {
+            const VT_THUMBNAIL& thumb = pending.pResults[i];
+
+            writer.BeginObject();
+            writer.Key("index");
+            writer.Integer(i);
+            writer.Key("timestamp");
+            writer.Number(thumb.hnsTimestamp / 10000000.0);
+            writer.Key("bytes");
+            writer.Integer(thumb.cbData);
+
+            HRESULT hrThumb = thumb.hrStatus;
+
+            if (pDelivery)
+            {
+                hrThumb = pDelivery->TranslateError(hrThumb);
+
+                if (SUCCEEDED(hrThumb))
+                {
+                    writer.Key("slot");
+                    writer.Integer(pDelivery->slots[i]);
+                }
+            }
+            else if (SUCCEEDED(hrThumb) && !pRequest->output.empty())
+            {
+                WCHAR wszFileName[MAX_PATH];
+
+                hrThumb = StringCchPrintf(wszFileName, MAX_PATH, L"%s_%u", pRequest->output.c_str(), i);
+
+                if (SUCCEEDED(hrThumb))
+                {
+                    hrThumb = WriteBufferToFile(wszFileName, thumb.pData, thumb.cbData);
+                }
+                if (SUCCEEDED(hrThumb))
+                {
+                    writer.Key("file");
+                    writer.StringW(wszFileName);
+                }
+            }
+            else if (SUCCEEDED(hrThumb))
+            {
+                writer.Key("data");
+                writer.Base64(thumb.pData, thumb.cbData);
+            }
+
+            writer.Key("hr");
+            writer.HResult(hrThumb);
+            writer.EndObject();
+        }
+
+        writer.EndArray();
+
+        writeMs = write.ElapsedMs();
+    }
+
+    writer.Key("timings");
+    writer.BeginObject();
+    writer.Key("queue_ms");
+    writer.Number(pending.queueMs);
+    writer.Key("open_ms");
+    writer.Number(timings.openMs);
+    writer.Key("decode_ms");
+    writer.Number(timings.decodeMs);
+    writer.Key("encode_ms");
+    writer.Number(timings.encodeMs);
+    writer.Key("index_ms");
+    writer.Number(timings.indexMs);
+    writer.Key("write_ms");
+    writer.Number(writeMs);
+    writer.Key("total_ms");
+    writer.Number(pending.queueMs + processMs + writeMs);
+    writer.EndObject();
+
+    // The decode pass is shared by every request in the batch.
+    writer.Key("decode");
+    writer.BeginObject();
+    writer.Key("coalesced");
+    writer.Integer(cCoalesced);
+    writer.Key("positions");
+    writer.Integer(timings.positionsDecoded);
+    writer.Key("frames");
+    writer.Integer(timings.framesDecoded);
+    writer.Key("converted");
+    writer.Integer(timings.framesConverted);
+    writer.Key("snapped");
+    writer.Integer(timings.positionsSnapped);
+    writer.Key("timed_out");
+    writer.Integer(timings.positionsTimedOut);
+    writer.Key("frame_bytes");
+    writer.Integer((LONGLONG)timings.cbFramePeak);
+    writer.Key("bitmap_bytes");
+    writer.Integer((LONGLONG)timings.cbBitmaps);
+
+    if (timings.pipelined)
+    {
+        static const char *STAGE_NAMES[PIPELINE_STAGES] = { "decode", "process", "encode" };
+
+        writer.Key("pipeline");
+        writer.BeginObject();
+        writer.Key("ms");
+        writer.Number(timings.pipelineMs);
+
+        for (DWORD s = 0; s < PIPELINE_STAGES; s++)
+        {
+            const StageCounters& stage = timings.stages[s];
+
+            writer.Key(STAGE_NAMES[s]);
+            writer.BeginObject();
+            writer.Key("busy_ms");
+            writer.Number(stage.busyMs);
+            writer.Key("starved_ms");
+            writer.Number(stage.starvedMs);
+            writer.Key("blocked_ms");
+            writer.Number(stage.blockedMs);
+            writer.Key("utilization");
+            writer.Number(stage.Utilization(timings.pipelineMs));
+            writer.EndObject();
+        }
+
+        writer.EndObject();
+    }
+    writer.Key("reader_reused");
+    writer.Bool(timings.readerReused != FALSE);
+    writer.Key("cached");
+    writer.Bool(pending.bFromCache != FALSE);
+    writer.Key("degraded");
+    writer.BeginArray();
+
+    for (DWORD flag = DEGRADE_KEYFRAME_SEEK; flag <= DEGRADE_FAST_ENCODE; flag <<= 1)
+    {
+        if (pending.degradations & flag)
+        {
+            writer.String(DegradationName(flag));
+        }
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    if (timings.cbSourceFile > 0)
+    {
+        writer.Key("io");
+        writer.BeginObject();
+        writer.Key("file_bytes");
+        writer.Integer((LONGLONG)timings.cbSourceFile);
+        writer.Key("read_bytes");
+        writer.Integer((LONGLONG)timings.cbSourceRead);
+        writer.Key("reads");
+        writer.Integer(timings.sourceReads);
+        writer.EndObject();
+    }
+
+    writer.EndObject();
+
+    pRequest->pConnection->SendLine(writer.Text());
+}
+
+
+//-------------------------------------------------------------------
+// DaemonConnection
+//-------------------------------------------------------------------
+
+DaemonConnection::DaemonConnection(HANDLE hRead, HANDLE hWrite, BOOL bOwnsHandles)
+    : m_cRef(1),
+      m_hRead(hRead),
+      m_hWrite(hWrite),
+      m_bOwnsHandles(bOwnsHandles)
+{
+    InitializeCriticalSection(&m_writeLock);
+
+    m_hReadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_hWriteEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+DaemonConnection::~DaemonConnection()
+{
+    if (m_bOwnsHandles)
+    {
+        FlushFileBuffers(m_hWrite);
+        DisconnectNamedPipe(m_hWrite);
+        CloseHandle(m_hWrite);
+        if (m_hRead != m_hWrite)
+        {
+            CloseHandle(m_hRead);
+        }
+    }
+
+    if (m_hReadEvent)
+    {
+        CloseHandle(m_hReadEvent);
+    }
+    if (m_hWriteEvent)
+    {
+        CloseHandle(m_hWriteEvent);
+    }
+
+    DeleteCriticalSection(&m_writeLock);
+}
+
+ULONG DaemonConnection::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG DaemonConnection::Release()
+{
+    ULONG cRef = InterlockedDecrement(&m_cRef);
+    if (cRef == 0)
+    {
+        delete this;
+    }
+    return cRef;
+}
+
+//-------------------------------------------------------------------
+// Read
+//
+// Reads whatever is available from the client. Pipe handles are opened
+// for overlapped I/O, so that a pending read does not block the
+// responses that worker threads write on the same handle.
+//-------------------------------------------------------------------
+
+HRESULT DaemonConnection::Read(char *pBuffer, DWORD cbBuffer, DWORD *pcbRead)
+{
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.hEvent = m_hReadEvent;
+
+    *pcbRead = 0;
+
+    if (!ReadFile(m_hRead, pBuffer, cbBuffer, NULL, &ov))
+    {
+        DWORD err = GetLastError();
+        if (err != ERROR_IO_PENDING)
+        {
+            return HRESULT_FROM_WIN32(err);
+        }
+    }
+
+    if (!GetOverlappedResult(m_hRead, &ov, pcbRead, TRUE))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------
+// SendLine
+//
+// Writes one response line. Called from the worker threads.
+//-------------------------------------------------------------------
+
+HRESULT DaemonConnection::SendLine(const std::string& line)
+{
+    HRESULT hr = S_OK;
+
+    std::string text(line);
+    text.push_back('\n');
+
+    EnterCriticalSection(&m_writeLock);
+
+    size_t cbSent = 0;
+    while (cbSent < text.size())
+    {
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        ov.hEvent = m_hWriteEvent;
+
+        DWORD cbWritten = 0;
+
+        if (!WriteFile(m_hWrite, text.data() + cbSent, (DWORD)(text.size() - cbSent), NULL, &ov))
+        {
+            DWORD err = GetLastError();
+            if (err != ERROR_IO_PENDING)
+            {
+                hr = HRESULT_FROM_WIN32(err);
+                break;
+            }
+        }
+
+        if (!GetOverlappedResult(m_hWrite, &ov, &cbWritten, TRUE))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        cbSent += cbWritten;
+    }
+
+    LeaveCriticalSection(&m_writeLock);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// DaemonPassControl constructor
+//
+// pPreemptContext:  Optional. Context on which to run the interactive
+//                   requests that preempt a bulk pass.
+// pPreemptControl:  Control for pPreemptContext.
+//-------------------------------------------------------------------
+
+DaemonPassControl::DaemonPassControl(ThumbnailDaemon *pDaemon, ThumbnailContext *pPreemptContext,
+    DaemonPassControl *pPreemptControl)
+    : m_pDaemon(pDaemon),
+      m_pPreemptContext(pPreemptContext),
+      m_pPreemptControl(pPreemptControl),
+      m_ppBatch(NULL),
+      m_cRequests(0),
+      m_workClass(WORK_INTERACTIVE)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Begin
+//
+// Sets the requests of the pass that follows; NULL after it.
+//-------------------------------------------------------------------
+
+void DaemonPassControl::Begin(DaemonRequest *ppBatch[], DWORD cRequests)
+{
+    m_ppBatch = ppBatch;
+    m_cRequests = cRequests;
+    m_workClass = WORK_BULK;
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        if (ppBatch[i]->workClass < m_workClass)
+        {
+            m_workClass = ppBatch[i]->workClass;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// IsCancelled
+//
+// True once every request of the pass has been cancelled.
+//-------------------------------------------------------------------
+
+bool DaemonPassControl::IsCancelled()
+{
+    for (DWORD i = 0; i < m_cRequests; i++)
+    {
+        if (!m_ppBatch[i]->cancel.IsCancelled())
+        {
+            return false;
+        }
+    }
+
+    return m_cRequests > 0;
+}
+
+
+//-------------------------------------------------------------------
+// AtFrameBoundary
+//
+// In a bulk pass, runs the interactive requests that are waiting for a
+// worker, to the end, before the pass goes on. The pass's time budget
+// is paused meanwhile.
+//-------------------------------------------------------------------
+
+void DaemonPassControl::AtFrameBoundary(ReadBudget *pBudget)
+{
+    if (m_pPreemptContext == NULL || !m_pDaemon->m_queue.ShouldPreempt(m_workClass))
+    {
+        return;
+    }
+
+    DaemonRequest *batch[MAX_COALESCED_REQUESTS];
+    DWORD cRequests = 0;
+
+    if (pBudget)
+    {
+        pBudget->Pause();
+    }
+
+    while ((cRequests = m_pDaemon->DequeuePreempting(batch, MAX_COALESCED_REQUESTS)) > 0)
+    {
+        m_pDaemon->ServeBatch(m_pPreemptContext, m_pPreemptControl, S_OK, batch, cRequests);
+    }
+
+    if (pBudget)
+    {
+        pBudget->Resume();
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ThumbnailDaemon constructor
+//-------------------------------------------------------------------
+
+ThumbnailDaemon::ThumbnailDaemon()
+    : m_hStopEvent(NULL),
+      m_phWorkers(NULL),
+      m_cWorkers(0),
+      m_bResultCache(FALSE),
+      m_bIndexStore(FALSE),
+      m_bCachedStreams(FALSE),
+      m_bFieldDrop(FALSE),
+      m_cbFrameMemory(DEFAULT_FRAME_MEMORY),
+      m_cFrameThreads(0),
+      m_cPipelineDepth(0)
+{
+    InitializeCriticalSection(&m_lock);
+
+    m_queue.SetCoalescing(MatchInput, (uint32_t)COALESCE_WINDOW_MS);
+}
+
+//-------------------------------------------------------------------
+// ThumbnailDaemon destructor
+//-------------------------------------------------------------------
+
+ThumbnailDaemon::~ThumbnailDaemon()
+{
+    Shutdown();
+
+    if (m_hStopEvent)
+    {
+        CloseHandle(m_hStopEvent);
+    }
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// EnableResultCache
+//
+// Keeps encoded results in an on-disk cache. Call before Start.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::EnableResultCache(const WCHAR *wszDirectory, ULONGLONG cbMaxSize)
+{
+    if (m_phWorkers != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    HRESULT hr = m_resultCache.Initialize(wszDirectory, cbMaxSize);
+
+    if (SUCCEEDED(hr))
+    {
+        m_bResultCache = TRUE;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// EnableIndexStore
+//
+// Keeps a persistent index of each input. Call before Start.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::EnableIndexStore(const WCHAR *wszDirectory)
+{
+    if (m_phWorkers != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    HRESULT hr = m_indexStore.Initialize(wszDirectory);
+
+    if (SUCCEEDED(hr))
+    {
+        m_bIndexStore = TRUE;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// EnableCachedStreams
+//
+// Reads inputs through a CachedByteStream. Call before Start.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::EnableCachedStreams(const ByteStreamOptions& options)
+{
+    if (m_phWorkers != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    m_streamOptions = options;
+    m_bCachedStreams = TRUE;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Start
+//
+// Starts the worker threads. Each worker owns a ThumbnailContext, so
+// COM, Media Foundation and the Direct2D/WIC factories are initialized
+// once per worker rather than once per request.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::Start(DWORD cWorkers)
+{
+    if (m_phWorkers != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    if (cWorkers == 0 || cWorkers > MAXIMUM_WAIT_OBJECTS)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_readerCache.Initialize(READER_CACHE_ENTRIES, READER_CACHE_MEMORY);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_hStopEvent == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (m_cFrameThreads > 0 && !m_framePool.Start(m_cFrameThreads))
+    {
+        m_framePool.Stop();
+        return E_OUTOFMEMORY;
+    }
+
+    if ((m_timeBudget.fileMs > 0 || m_timeBudget.positionMs > 0) && !m_watchdog.Start())
+    {
+        m_framePool.Stop();
+        return E_OUTOFMEMORY;
+    }
+
+    m_phWorkers = new (std::nothrow) HANDLE[cWorkers];
+    if (m_phWorkers == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    for (m_cWorkers = 0; m_cWorkers < cWorkers; m_cWorkers++)
+    {
+        m_phWorkers[m_cWorkers] = CreateThread(NULL, 0, WorkerThreadProc, this, 0, NULL);
+        if (m_phWorkers[m_cWorkers] == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            Shutdown();
+            return hr;
+        }
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// RunPipeServer
+//
+// Accepts clients on a local named pipe until Stop is called. Each
+// client is served on its own thread.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::RunPipeServer(const WCHAR *wszPipeName)
+{
+    HRESULT hr = S_OK;
+
+    HANDLE hConnectEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hConnectEvent == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    while (WaitForSingleObject(m_hStopEvent, 0) != WAIT_OBJECT_0)
+    {
+        HANDLE hPipe = CreateNamedPipe(
+            wszPipeName,
+            PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES,
+            PIPE_BUFFER_SIZE,
+            PIPE_BUFFER_SIZE,
+            0,
+            NULL
+            );
+
+        if (hPipe == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        ov.hEvent = hConnectEvent;
+        ResetEvent(hConnectEvent);
+
+        BOOL bConnected = ConnectNamedPipe(hPipe, &ov);
+
+        if (!bConnected)
+        {
+            DWORD err = GetLastError();
+
+            if (err == ERROR_PIPE_CONNECTED)
+            {
+                bConnected = TRUE;
+            }
+            else if (err == ERROR_IO_PENDING)
+            {
+                HANDLE handles[] = { hConnectEvent, m_hStopEvent };
+                DWORD cbUnused = 0;
+
+                if (WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+                {
+                    bConnected = GetOverlappedResult(hPipe, &ov, &cbUnused, FALSE);
+                }
+                else
+                {
+                    CancelIo(hPipe);
+                    GetOverlappedResult(hPipe, &ov, &cbUnused, TRUE);
+                }
+            }
+        }
+
+        if (!bConnected)
+        {
+            CloseHandle(hPipe);
+            continue;
+        }
+
+        ConnectionThreadParams *pParams = new (std::nothrow) ConnectionThreadParams;
+        if (pParams == NULL)
+        {
+            CloseHandle(hPipe);
+            continue;
+        }
+
+        pParams->pDaemon = this;
+        pParams->pConnection = new (std::nothrow) DaemonConnection(hPipe, hPipe, TRUE);
+        if (pParams->pConnection == NULL)
+        {
+            CloseHandle(hPipe);
+            delete pParams;
+            continue;
+        }
+
+        // The connection thread takes over the parameters and our
+        // reference on the connection.
+        HANDLE hThread = CreateThread(NULL, 0, ConnectionThreadProc, pParams, 0, NULL);
+        if (hThread == NULL)
+        {
+            pParams->pConnection->Release();
+            delete pParams;
+            continue;
+        }
+
+        CloseHandle(hThread);
+    }
+
+    CloseHandle(hConnectEvent);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// RunStdio
+//
+// Serves a single client on standard input and output until the input
+// is closed or a shutdown command is received.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::RunStdio()
+{
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    if (hIn == NULL || hIn == INVALID_HANDLE_VALUE || hOut == NULL || hOut == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE);
+    }
+
+    DaemonConnection *pConnection = new (std::nothrow) DaemonConnection(hIn, hOut, FALSE);
+    if (pConnection == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    ServeConnection(pConnection);
+
+    pConnection->Release();
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Stop
+//
+// Stops accepting clients and requests. Queued requests are finished.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::Stop()
+{
+    m_queue.Stop();
+
+    if (m_hStopEvent)
+    {
+        SetEvent(m_hStopEvent);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Shutdown
+//
+// Stops the daemon and waits for the worker threads to exit.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::Shutdown()
+{
+    Stop();
+
+    if (m_phWorkers)
+    {
+        if (m_cWorkers > 0)
+        {
+            WaitForMultipleObjects(m_cWorkers, m_phWorkers, TRUE, INFINITE);
+        }
+
+        for (DWORD i = 0; i < m_cWorkers; i++)
+        {
+            CloseHandle(m_phWorkers[i]);
+        }
+
+        delete [] m_phWorkers;
+        m_phWorkers = NULL;
+        m_cWorkers = 0;
+    }
+
+    // The workers were their only users.
+    m_framePool.Stop();
+    m_watchdog.Stop();
+}
+
+
+//
+/// Private methods
+//
+
+//-------------------------------------------------------------------
+// WorkerThreadProc
+//
+// Processes requests with a warm ThumbnailContext.
+//-------------------------------------------------------------------
+
+DWORD WINAPI ThumbnailDaemon::WorkerThreadProc(LPVOID lpParameter)
+{
+    ThumbnailDaemon *pThis = (ThumbnailDaemon*)lpParameter;
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    if (SUCCEEDED(hr))
+    {
+        // The second context runs interactive requests that preempt a
+        // bulk pass on the first.
+        ThumbnailContext context;
+        ThumbnailContext preemptContext;
+
+        DaemonPassControl preemptControl(pThis, NULL, NULL);
+        DaemonPassControl control(pThis, &preemptContext, &preemptControl);
+
+        HRESULT hrInit = context.Initialize();
+
+        if (SUCCEEDED(hrInit))
+        {
+            hrInit = preemptContext.Initialize();
+        }
+
+        pThis->ConfigureContext(&context);
+        pThis->ConfigureContext(&preemptContext);
+
+        context.SetPassControl(&control);
+        preemptContext.SetPassControl(&preemptControl);
+
+        DaemonRequest *batch[MAX_COALESCED_REQUESTS];
+
+        while (1)
+        {
+            DWORD cRequests = pThis->Dequeue(batch, MAX_COALESCED_REQUESTS);
+            if (cRequests == 0)
+            {
+                break;  // Stopping.
+            }
+
+            pThis->ServeBatch(&context, &control, hrInit, batch, cRequests);
+        }
+    }
+
+    CoUninitialize();
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// ConfigureContext
+//
+// Gives a worker's context the daemon's caches and options.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::ConfigureContext(ThumbnailContext *pContext)
+{
+    pContext->SetReaderCache(&m_readerCache);
+
+    if (m_bResultCache)
+    {
+        pContext->SetResultCache(&m_resultCache);
+    }
+
+    if (m_bIndexStore)
+    {
+        pContext->SetIndexStore(&m_indexStore);
+    }
+
+    if (m_bCachedStreams)
+    {
+        pContext->SetByteStreamOptions(&m_streamOptions);
+    }
+
+    pContext->SetFrameSourceCost(m_frameCost);
+    pContext->SetFieldDrop(m_bFieldDrop);
+    pContext->SetFrameMemoryBudget(m_cbFrameMemory);
+    pContext->SetPipelineDepth(m_cPipelineDepth);
+    pContext->SetTimeBudget(&m_watchdog, m_timeBudget);
+
+    if (m_cFrameThreads > 0)
+    {
+        pContext->SetTaskPool(&m_framePool);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ServeBatch
+//
+// Processes a batch of requests, or answers them with hrInit if the
+// worker's context could not be initialized, and then retires them.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::ServeBatch(ThumbnailContext *pContext, DaemonPassControl *pControl, HRESULT hrInit,
+    DaemonRequest *ppBatch[], DWORD cRequests)
+{
+    if (SUCCEEDED(hrInit))
+    {
+        // The first request of a batch has waited the longest.
+        pContext->SetDegradations(m_shedder.StartPass(m_queue.Depth(), ppBatch[0]->queued.ElapsedMs()));
+
+        pControl->Begin(ppBatch, cRequests);
+
+        ProcessBatch(pContext, ppBatch, cRequests);
+
+        pControl->Begin(NULL, 0);
+    }
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        if (FAILED(hrInit))
+        {
+            JsonWriter writer;
+            writer.BeginObject();
+            writer.Key("id");
+            writer.String(ppBatch[i]->id);
+            writer.Key("hr");
+            writer.HResult(hrInit);
+            writer.EndObject();
+
+            ppBatch[i]->pConnection->SendLine(writer.Text());
+        }
+
+        m_queue.Completed(ppBatch[i], ppBatch[i]->queued.ElapsedMs());
+
+        EnterCriticalSection(&m_lock);
+        m_active.erase(std::find(m_active.begin(), m_active.end(), ppBatch[i]));
+        LeaveCriticalSection(&m_lock);
+
+        ppBatch[i]->pConnection->Release();
+        delete ppBatch[i];
+    }
+}
+
+//-------------------------------------------------------------------
+// ConnectionThreadProc
+//-------------------------------------------------------------------
+
+DWORD WINAPI ThumbnailDaemon::ConnectionThreadProc(LPVOID lpParameter)
+{
+    ConnectionThreadParams *pParams = (ConnectionThreadParams*)lpParameter;
+
+    pParams->pDaemon->ServeConnection(pParams->pConnection);
+
+    pParams->pConnection->Release();
+    delete pParams;
+    return 0;
+}
+
+//-------------------------------------------------------------------
+// ServeConnection
+//
+// Reads request lines from a client and queues them.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::ServeConnection(DaemonConnection *pConnection)
+{
+    std::string pending;
+    char buffer[READ_BUFFER_SIZE];
+
+    while (WaitForSingleObject(m_hStopEvent, 0) != WAIT_OBJECT_0)
+    {
+        DWORD cbRead = 0;
+
+        HRESULT hr = pConnection->Read(buffer, sizeof(buffer), &cbRead);
+        if (FAILED(hr) || cbRead == 0)
+        {
+            break;  // Client disconnected or input closed.
+        }
+
+        pending.append(buffer, cbRead);
+
+        size_t start = 0;
+        size_t newline = 0;
+
+        while ((newline = pending.find('\n', start)) != std::string::npos)
+        {
+            size_t cch = newline - start;
+            if (cch > 0 && pending[start + cch - 1] == '\r')
+            {
+                --cch;
+            }
+            if (cch > 0)
+            {
+                HandleLine(pConnection, pending.data() + start, cch);
+            }
+            start = newline + 1;
+        }
+
+        pending.erase(0, start);
+
+        if (pending.size() > MAX_REQUEST_LENGTH)
+        {
+            break;  // Not a well-behaved client.
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// HandleLine
+//
+// Parses one request line and either answers it directly (control
+// commands, errors) or queues it for a worker.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::HandleLine(DaemonConnection *pConnection, const char *pszLine, size_t cch)
+{
+    JsonValue json;
+    JsonWriter writer;
+
+    HRESULT hr = JsonParse(pszLine, cch, &json);
+
+    if (SUCCEEDED(hr) && json.type != JsonValue::JSON_OBJECT)
+    {
+        hr = E_INVALIDARG;
+    }
+
+    std::string id = json.GetString("id", "");
+    std::string command = json.GetString("command", "");
+
+    if (SUCCEEDED(hr) && !command.empty())
+    {
+        writer.BeginObject();
+        writer.Key("id");
+        writer.String(id);
+
+        if (command == "ping")
+        {
+            writer.Key("hr");
+            writer.HResult(S_OK);
+        }
+        else if (command == "stats")
+        {
+            EnterCriticalSection(&m_lock);
+            DaemonStats stats = m_stats;
+            LeaveCriticalSection(&m_lock);
+
+            writer.Key("hr");
+            writer.HResult(S_OK);
+            writer.Key("stats");
+            writer.BeginObject();
+            writer.Key("requests");
+            writer.Integer((LONGLONG)stats.cRequests);
+            writer.Key("batches");
+            writer.Integer((LONGLONG)stats.cBatches);
+            writer.Key("coalesced");
+            writer.Integer((LONGLONG)stats.cCoalesced);
+            writer.Key("frames_decoded");
+            writer.Integer((LONGLONG)stats.cFramesDecoded);
+            writer.Key("frames_converted");
+            writer.Integer((LONGLONG)stats.cFramesConverted);
+            writer.Key("frame_bytes_max");
+            writer.Integer((LONGLONG)stats.cbFramePeakMax);
+            writer.Key("positions_timed_out");
+            writer.Integer((LONGLONG)stats.cPositionsTimedOut);
+
+            if (stats.pipelineMs > 0)
+            {
+                writer.Key("pipeline_utilization");
+                writer.BeginObject();
+                writer.Key("decode");
+                writer.Number(stats.stageBusyMs[PIPELINE_DECODE] / stats.pipelineMs);
+                writer.Key("process");
+                writer.Number(stats.stageBusyMs[PIPELINE_PROCESS] / stats.pipelineMs);
+                writer.Key("encode");
+                writer.Number(stats.stageBusyMs[PIPELINE_ENCODE] / stats.pipelineMs);
+                writer.EndObject();
+            }
+            writer.Key("frames_per_request");
+            writer.Number(stats.cRequests ? (double)stats.cFramesDecoded / stats.cRequests : 0.0);
+
+            WriteQueueStats(writer);
+            WriteLoadStats(writer);
+
+            ReaderCacheStats readers;
+            m_readerCache.GetStats(&readers);
+
+            writer.Key("reader_cache");
+            writer.BeginObject();
+            writer.Key("hits");
+            writer.Integer((LONGLONG)readers.cHits);
+            writer.Key("misses");
+            writer.Integer((LONGLONG)readers.cMisses);
+            writer.Key("evictions");
+            writer.Integer((LONGLONG)readers.cEvictions);
+            writer.Key("entries");
+            writer.Integer(readers.cEntries);
+            writer.Key("estimated_bytes");
+            writer.Integer((LONGLONG)readers.cbEstimated);
+            writer.EndObject();
+
+            if (m_bResultCache)
+            {
+                ResultCacheStats results;
+                m_resultCache.GetStats(&results);
+
+                writer.Key("result_cache");
+                writer.BeginObject();
+                writer.Key("hits");
+                writer.Integer((LONGLONG)results.cHits);
+                writer.Key("misses");
+                writer.Integer((LONGLONG)results.cMisses);
+                writer.Key("stores");
+                writer.Integer((LONGLONG)results.cStores);
+                writer.Key("evictions");
+                writer.Integer((LONGLONG)results.cEvictions);
+                writer.Key("entries");
+                writer.Integer((LONGLONG)results.cEntries);
+                writer.Key("bytes");
+                writer.Integer((LONGLONG)results.cbSize);
+                writer.EndObject();
+            }
+
+            writer.EndObject();
+        }
+        else if (command == "cancel")
+        {
+            std::string target = json.GetString("target", "");
+
+            writer.Key("hr");
+            writer.HResult(target.empty() ? E_INVALIDARG : S_OK);
+            writer.Key("cancelled");
+            writer.Integer(target.empty() ? 0 : Cancel(pConnection, target));
+        }
+        else if (command == "shutdown")
+        {
+            writer.Key("hr");
+            writer.HResult(S_OK);
+            Stop();
+        }
+        else
+        {
+            writer.Key("hr");
+            writer.HResult(E_NOTIMPL);
+        }
+
+        writer.EndObject();
+        pConnection->SendLine(writer.Text());
+        return;
+    }
+
+    DaemonRequest *pRequest = NULL;
+
+    if (SUCCEEDED(hr))
+    {
+        pRequest = new (std::nothrow) DaemonRequest();
+        if (pRequest == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ParseRequest(json, pRequest);
+    }
+
+    if (FAILED(hr))
+    {
+        delete pRequest;
+
+        writer.BeginObject();
+        writer.Key("id");
+        writer.String(id);
+        writer.Key("hr");
+        writer.HResult(hr);
+        writer.Key("error");
+        writer.String("invalid request");
+        writer.EndObject();
+
+        pConnection->SendLine(writer.Text());
+        return;
+    }
+
+    pRequest->pConnection = pConnection;
+    pRequest->pConnection->AddRef();
+
+    Enqueue(pRequest);
+}
+
+//-------------------------------------------------------------------
+// ParseRequest
+//
+// Converts a JSON request into a DaemonRequest.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailDaemon::ParseRequest(const JsonValue& json, DaemonRequest *pRequest)
+{
+    pRequest->id = json.GetString("id", "");
+    pRequest->input = Utf8ToWide(json.GetString("input", ""));
+    pRequest->output = Utf8ToWide(json.GetString("output", ""));
+    pRequest->ring = Utf8ToWide(json.GetString("ring", ""));
+    pRequest->ringTimeoutMs = (DWORD)json.GetNumber("ring_timeout_ms", DEFAULT_RING_TIMEOUT);
+
+    if (pRequest->input.empty())
+    {
+        return E_INVALIDARG;
+    }
+
+    std::string priority = json.GetString("priority", WorkClassName(WORK_INTERACTIVE));
+
+    if (!ParseWorkClass(priority.c_str(), &pRequest->workClass))
+    {
+        return E_INVALIDARG;
+    }
+
+    std::string delivery = json.GetString("delivery", "");
+
+    if (delivery == "shm")
+    {
+        if (pRequest->ring.empty() || !pRequest->output.empty())
+        {
+            return E_INVALIDARG;
+        }
+    }
+    else if (!delivery.empty() && delivery != "inline" && delivery != "file")
+    {
+        return E_INVALIDARG;
+    }
+    else
+    {
+        pRequest->ring.clear();
+    }
+
+    const JsonValue *pPositions = json.Find("positions");
+
+    if (pPositions && pPositions->type == JsonValue::JSON_ARRAY)
+    {
+        for (size_t i = 0; i < pPositions->items.size(); i++)
+        {
+            if (pPositions->items[i].type != JsonValue::JSON_NUMBER || pPositions->items[i].number < 0)
+            {
+                return E_INVALIDARG;
+            }
+            pRequest->positions.push_back((LONGLONG)(pPositions->items[i].number * 10000000.0));
+        }
+        pRequest->count = (UINT32)pRequest->positions.size();
+    }
+    else
+    {
+        pRequest->count = (UINT32)json.GetNumber("count", DEFAULT_THUMBNAILS);
+    }
+
+    if (pRequest->count == 0 || pRequest->count > MAX_THUMBNAILS)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::string format = json.GetString("format", "jpeg");
+
+    if (format == "jpeg" || format == "jpg")
+    {
+        pRequest->options.format = VT_FORMAT_JPEG;
+    }
+    else if (format == "png")
+    {
+        pRequest->options.format = VT_FORMAT_PNG;
+    }
+    else if (format == "bgra")
+    {
+        pRequest->options.format = VT_FORMAT_BGRA;
+    }
+    else
+    {
+        return E_INVALIDARG;
+    }
+
+    pRequest->options.cThumbnails = pRequest->count;
+    pRequest->options.cxThumbnail = (UINT32)json.GetNumber("width", DEFAULT_THUMB_SIZE);
+    pRequest->options.cyThumbnail = (UINT32)json.GetNumber("height", DEFAULT_THUMB_SIZE);
+    pRequest->options.quality = (float)json.GetNumber("quality", 0.0);
+
+    if (pRequest->options.cxThumbnail == 0 || pRequest->options.cyThumbnail == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------
+// Enqueue
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::Enqueue(DaemonRequest *pRequest)
+{
+    EnterCriticalSection(&m_lock);
+    m_active.push_back(pRequest);
+    LeaveCriticalSection(&m_lock);
+
+    m_queue.Push(pRequest);
+}
+
+//-------------------------------------------------------------------
+// Dequeue
+//
+// Takes the oldest request of the most urgent class, together with
+// other requests for the same input, so that they can share one decode
+// pass. A fresh request waits up to COALESCE_WINDOW_MS for others to
+// arrive. Returns the number of requests, or zero when the daemon is
+// stopping and the queue is empty.
+//-------------------------------------------------------------------
+
+DWORD ThumbnailDaemon::Dequeue(DaemonRequest *ppBatch[], DWORD cMaxRequests)
+{
+    WorkItem *items[MAX_COALESCED_REQUESTS];
+
+    DWORD cRequests = (DWORD)m_queue.Pop(items, (cMaxRequests < MAX_COALESCED_REQUESTS) ? cMaxRequests : MAX_COALESCED_REQUESTS);
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        ppBatch[i] = static_cast<DaemonRequest*>(items[i]);
+    }
+
+    return cRequests;
+}
+
+//-------------------------------------------------------------------
+// DequeuePreempting
+//
+// Like Dequeue, for the interactive requests that a bulk pass makes way
+// for. Returns zero, without waiting, if there are none.
+//-------------------------------------------------------------------
+
+DWORD ThumbnailDaemon::DequeuePreempting(DaemonRequest *ppBatch[], DWORD cMaxRequests)
+{
+    WorkItem *items[MAX_COALESCED_REQUESTS];
+
+    DWORD cRequests = (DWORD)m_queue.PopPreempting(items,
+        (cMaxRequests < MAX_COALESCED_REQUESTS) ? cMaxRequests : MAX_COALESCED_REQUESTS);
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        ppBatch[i] = static_cast<DaemonRequest*>(items[i]);
+    }
+
+    return cRequests;
+}
+
+//-------------------------------------------------------------------
+// MatchInput
+//
+// True if two requests are for the same input (see WorkQueue::
+// SetCoalescing).
+//-------------------------------------------------------------------
+
+static bool MatchInput(const WorkItem *pFirst, const WorkItem *pOther)
+{
+    return _wcsicmp(static_cast<const DaemonRequest*>(pFirst)->input.c_str(),
+        static_cast<const DaemonRequest*>(pOther)->input.c_str()) == 0;
+}
+
+//-------------------------------------------------------------------
+// Cancel
+//
+// Cancels the queued and running requests of a connection with an id.
+// Returns the number of requests.
+//-------------------------------------------------------------------
+
+DWORD ThumbnailDaemon::Cancel(DaemonConnection *pConnection, const std::string& id)
+{
+    DWORD cCancelled = 0;
+
+    EnterCriticalSection(&m_lock);
+
+    for (size_t i = 0; i < m_active.size(); i++)
+    {
+        if (m_active[i]->pConnection == pConnection && m_active[i]->id == id && !m_active[i]->cancel.IsCancelled())
+        {
+            m_active[i]->cancel.Cancel();
+            ++cCancelled;
+        }
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return cCancelled;
+}
+
+//-------------------------------------------------------------------
+// ProcessBatch
+//
+// Generates the thumbnails for a batch of requests on the same input
+// with one decode pass, and sends a response for each request.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::ProcessBatch(ThumbnailContext *pContext, DaemonRequest *ppBatch[], DWORD cRequests)
+{
+    HRESULT hr = S_OK;
+
+    PendingRequest  pending[MAX_COALESCED_REQUESTS];
+    ThumbnailJob    jobs[MAX_COALESCED_REQUESTS];
+    HRESULT         hrJobs[MAX_COALESCED_REQUESTS];
+    DWORD           jobOwner[MAX_COALESCED_REQUESTS];
+    DWORD           cJobs = 0;
+
+    StageTimings    timings;
+
+    Stopwatch total;
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        pending[i].pRequest = ppBatch[i];
+        pending[i].queueMs = ppBatch[i]->queued.ElapsedMs();
+
+        // A request cancelled while it was queued is answered at once.
+        pending[i].hr = ppBatch[i]->cancel.IsCancelled() ? HRESULT_FROM_WIN32(ERROR_CANCELLED) :
+            PrepareRequest(&pending[i]);
+
+        if (SUCCEEDED(pending[i].hr))
+        {
+            jobs[cJobs].opts = ppBatch[i]->options;
+            jobs[cJobs].pAllocator = pending[i].pAllocator;
+            jobs[cJobs].pResults = pending[i].pResults;
+            jobs[cJobs].pSink = pending[i].pDelivery;
+            jobs[cJobs].pCancel = &ppBatch[i]->cancel;
+            jobOwner[cJobs] = i;
+            ++cJobs;
+        }
+    }
+
+    if (cJobs > 0)
+    {
+        hr = pContext->GenerateBatchFromFile(ppBatch[0]->input.c_str(), cJobs, jobs, hrJobs);
+
+        for (DWORD k = 0; k < cJobs; k++)
+        {
+            pending[jobOwner[k]].hr = FAILED(hr) ? hr : hrJobs[k];
+            pending[jobOwner[k]].bFromCache = jobs[k].bFromCache;
+            pending[jobOwner[k]].degradations = jobs[k].degradations;
+        }
+
+        timings = pContext->LastTimings();
+    }
+
+    double processMs = total.ElapsedMs();
+
+    // Count the batch before answering, so that a client's "stats" that
+    // follows a response includes it.
+    EnterCriticalSection(&m_lock);
+    m_stats.cRequests += cRequests;
+    m_stats.cBatches += 1;
+    m_stats.cCoalesced += cRequests - 1;
+    m_stats.cFramesDecoded += timings.framesDecoded;
+    m_stats.cFramesConverted += timings.framesConverted;
+    m_stats.cPositionsTimedOut += timings.positionsTimedOut;
+    if (timings.cbFramePeak > m_stats.cbFramePeakMax)
+    {
+        m_stats.cbFramePeakMax = timings.cbFramePeak;
+    }
+    if (timings.pipelined)
+    {
+        m_stats.pipelineMs += timings.pipelineMs;
+
+        for (DWORD s = 0; s < PIPELINE_STAGES; s++)
+        {
+            m_stats.stageBusyMs[s] += timings.stages[s].busyMs;
+        }
+    }
+    LeaveCriticalSection(&m_lock);
+
+    for (DWORD i = 0; i < cRequests; i++)
+    {
+        SendResponse(pending[i], timings, cRequests, processMs);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// WriteQueueStats
+//
+// Writes the "queues" member of the stats.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::WriteQueueStats(JsonWriter& writer)
+{
+    WorkClassStats stats[WORK_CLASSES];
+
+    m_queue.GetStats(stats);
+
+    writer.Key("queues");
+    writer.BeginObject();
+
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        writer.Key(WorkClassName((WORK_CLASS)c));
+        writer.BeginObject();
+        writer.Key("queued");
+        writer.Integer((LONGLONG)stats[c].cQueued);
+        writer.Key("started");
+        writer.Integer((LONGLONG)stats[c].cStarted);
+        writer.Key("preempting");
+        writer.Integer((LONGLONG)stats[c].cPreempting);
+        writer.Key("cancelled");
+        writer.Integer((LONGLONG)stats[c].cCancelled);
+        writer.Key("completed");
+        writer.Integer((LONGLONG)stats[c].cCompleted);
+        writer.Key("depth");
+        writer.Integer(stats[c].depth);
+        writer.Key("depth_max");
+        writer.Integer(stats[c].depthMax);
+        writer.Key("wait_ms_mean");
+        writer.Number(stats[c].cStarted ? stats[c].waitMs / stats[c].cStarted : 0.0);
+        writer.Key("wait_ms_max");
+        writer.Number(stats[c].waitMsMax);
+        writer.Key("latency_ms_p50");
+        writer.Number(stats[c].latencyP50Ms);
+        writer.Key("latency_ms_p99");
+        writer.Number(stats[c].latencyP99Ms);
+        writer.EndObject();
+    }
+
+    writer.EndObject();
+}
+
+
+//-------------------------------------------------------------------
+// WriteLoadStats
+//
+// Writes the "load_shedding" member of the stats response.
+//-------------------------------------------------------------------
+
+void ThumbnailDaemon::WriteLoadStats(JsonWriter& writer)
+{
+    LoadShedStats stats;
+    m_shedder.GetStats(&stats);
+
+    writer.Key("load_shedding");
+    writer.BeginObject();
+    writer.Key("enabled");
+    writer.Bool(m_shedder.IsEnabled());
+    writer.Key("level");
+    writer.Integer(stats.level);
+    writer.Key("level_max");
+    writer.Integer(stats.levelMax);
+    writer.Key("raised");
+    writer.Integer((LONGLONG)stats.cRaised);
+    writer.Key("lowered");
+    writer.Integer((LONGLONG)stats.cLowered);
+    writer.Key("passes");
+    writer.Integer((LONGLONG)stats.cPasses);
+    writer.Key("degraded_passes");
+    writer.Integer((LONGLONG)stats.cDegradedPasses);
+    writer.Key("wait_ms");
+    writer.Number(stats.waitMs);
+    writer.EndObject();
+}
+
+
+//-------------------------------------------------------------------
+// WriteBufferToFile: Writes a buffer to a new file.
+//-------------------------------------------------------------------
+
+HRESULT WriteBufferToFile(const WCHAR *wszFileName, const BYTE *pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    DWORD cbWritten = 0;
+
+    HANDLE hFile = CreateFile(wszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!WriteFile(hFile, pData, cbData, &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// RunDaemon
+//
+// Entry point for the daemon command lines:
+//
+//   VideoThumbnail.exe --daemon [pipe-name] [workers] [cache options]
+//   VideoThumbnail.exe --daemon-stdio [workers] [cache options]
+//
+// Cache options:
+//
+//   --cache-dir <directory>    Enables the on-disk result cache.
+//   --cache-size <megabytes>   Size cap of the result cache.
+//   --index-dir <directory>    Enables the persistent keyframe index.
+//
+// I/O options:
+//
+//   --read-ahead <kilobytes>   Reads inputs through a block cache.
+//   --map-files                Maps inputs on local drives into memory.
+//
+// Decode options:
+//
+//   --field-drop               Deinterlaces by dropping a field.
+//   --frame-memory <megabytes> Memory for turning each frame into a
+//                              bitmap; 0 for no limit.
+//   --frame-threads <n>        Threads that share the work of each frame.
+//   --pipeline <n>             Overlaps decoding, scaling and encoding,
+//                              with n frames queued between stages.
+//   --file-timeout <ms>        Time limit for reading each input.
+//   --position-timeout <ms>    Time limit for reading each position.
+//
+// Scheduling options:
+//
+//   --no-priority              Runs requests in arrival order, whatever
+//                              their "priority".
+//   --shed-queue <n>           Degrades passes while more than n
+//                              requests are queued.
+//   --shed-wait <ms>           Degrades passes while requests wait
+//                              longer than ms on average.
+//
+// Benchmark options:
+//
+//   --simulate-cost <seek-us>,<decode-us>,<gop>
+//                              Simulated costs for .y4m inputs.
+//-------------------------------------------------------------------
+
+INT RunDaemon(int argc, LPWSTR *argv)
+{
+    HRESULT hr = S_OK;
+
+    BOOL bStdio = (wcscmp(argv[1], L"--daemon-stdio") == 0);
+    const WCHAR *wszPipeName = DEFAULT_PIPE_NAME;
+    const WCHAR *wszCacheDir = NULL;
+    const WCHAR *wszIndexDir = NULL;
+    ULONGLONG cbCacheSize = DEFAULT_RESULT_CACHE_SIZE;
+    ByteStreamOptions streamOptions;
+    BOOL bCachedStreams = FALSE;
+    FrameSourceCost frameCost;
+    BOOL bFieldDrop = FALSE;
+    ULONGLONG cbFrameMemory = DEFAULT_FRAME_MEMORY;
+    DWORD cFrameThreads = 0;
+    DWORD cPipelineDepth = 0;
+    TimeBudget timeBudget;
+    BOOL bPriority = TRUE;
+    LoadTargets loadTargets;
+    DWORD cWorkers = 0;
+
+    std::vector<LPWSTR> args;   // Positional arguments.
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (wcscmp(argv[i], L"--cache-dir") == 0 && i + 1 < argc)
+        {
+            wszCacheDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--cache-size") == 0 && i + 1 < argc)
+        {
+            cbCacheSize = (ULONGLONG)_wtoi64(argv[++i]) * 1024 * 1024;
+        }
+        else if (wcscmp(argv[i], L"--index-dir") == 0 && i + 1 < argc)
+        {
+            wszIndexDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--read-ahead") == 0 && i + 1 < argc)
+        {
+            ULONGLONG cbReadAhead = (ULONGLONG)_wtoi64(argv[++i]) * 1024;
+            ULONGLONG cBlocks = (cbReadAhead + streamOptions.cache.cbBlock - 1) / streamOptions.cache.cbBlock;
+
+            // The cache limits read-ahead to its own size.
+            streamOptions.cache.cReadAheadBlocks =
+                (cBlocks < streamOptions.cache.cBlocks) ? (UINT32)cBlocks : streamOptions.cache.cBlocks;
+            bCachedStreams = TRUE;
+        }
+        else if (wcscmp(argv[i], L"--map-files") == 0)
+        {
+            streamOptions.bMapLocalFiles = TRUE;
+            bCachedStreams = TRUE;
+        }
+        else if (wcscmp(argv[i], L"--field-drop") == 0)
+        {
+            bFieldDrop = TRUE;
+        }
+        else if (wcscmp(argv[i], L"--frame-memory") == 0 && i + 1 < argc)
+        {
+            cbFrameMemory = (ULONGLONG)_wtoi64(argv[++i]) * 1024 * 1024;
+        }
+        else if (wcscmp(argv[i], L"--frame-threads") == 0 && i + 1 < argc)
+        {
+            cFrameThreads = (DWORD)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--pipeline") == 0 && i + 1 < argc)
+        {
+            cPipelineDepth = (DWORD)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--file-timeout") == 0 && i + 1 < argc)
+        {
+            timeBudget.fileMs = (uint32_t)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--position-timeout") == 0 && i + 1 < argc)
+        {
+            timeBudget.positionMs = (uint32_t)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--no-priority") == 0)
+        {
+            bPriority = FALSE;
+        }
+        else if (wcscmp(argv[i], L"--shed-queue") == 0 && i + 1 < argc)
+        {
+            loadTargets.queueDepth = (uint32_t)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--shed-wait") == 0 && i + 1 < argc)
+        {
+            loadTargets.waitMs = (uint32_t)_wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--simulate-cost") == 0 && i + 1 < argc)
+        {
+            if (swscanf_s(argv[++i], L"%u,%u,%u", &frameCost.seekMicroseconds,
+                &frameCost.decodeMicroseconds, &frameCost.gopLength) < 1)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+
+    if (bStdio)
+    {
+        if (args.size() > 0) { cWorkers = (DWORD)_wtoi(args[0]); }
+    }
+    else
+    {
+        if (args.size() > 0) { wszPipeName = args[0]; }
+        if (args.size() > 1) { cWorkers = (DWORD)_wtoi(args[1]); }
+    }
+
+    if (cWorkers == 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        cWorkers = si.dwNumberOfProcessors;
+    }
+
+    if (cWorkers > MAXIMUM_WAIT_OBJECTS)
+    {
+        cWorkers = MAXIMUM_WAIT_OBJECTS;
+    }
+
+    hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    if (SUCCEEDED(hr))
+    {
+        ThumbnailDaemon daemon;
+
+        if (wszCacheDir)
+        {
+            hr = daemon.EnableResultCache(wszCacheDir, cbCacheSize);
+        }
+
+        if (SUCCEEDED(hr) && wszIndexDir)
+        {
+            hr = daemon.EnableIndexStore(wszIndexDir);
+        }
+
+        if (SUCCEEDED(hr) && bCachedStreams)
+        {
+            hr = daemon.EnableCachedStreams(streamOptions);
+        }
+
+        daemon.SetFrameSourceCost(frameCost);
+        daemon.SetFieldDrop(bFieldDrop);
+        daemon.SetFrameMemoryBudget(cbFrameMemory);
+        daemon.SetFrameThreads(cFrameThreads);
+        daemon.SetPipelineDepth(cPipelineDepth);
+        daemon.SetTimeBudget(timeBudget);
+        daemon.SetPriority(bPriority);
+        daemon.SetLoadTargets(loadTargets);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = daemon.Start(cWorkers);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = bStdio ? daemon.RunStdio() : daemon.RunPipeServer(wszPipeName);
+        }
+
+        daemon.Shutdown();
+
+        CoUninitialize();
+    }
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailDaemon: Long-running request server.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "thumbapi.h"
+#include "thumbcontext.h"
+#include "readercache.h"
+#include "resultcache.h"
+#include "videoindex.h"
+#include "bytestream.h"
+#include "framesource.h"
+#include "taskpool.h"
+#include "watchdog.h"
+#include "workqueue.h"
+#include "loadshed.h"
+#include "json.h"
+#include "clock.h"
+
+// NOTE: Protocol
+//
+// Requests and responses are JSON objects, one per line (UTF-8). The
+// transport is a local named pipe (\\.\pipe\VideoThumbnail by default)
+// or the process's standard input and output.
+//
+// Request:
+//   { "id": "42", "input": "C:\\media\\clip.mp4",
+//     "positions": [ 1.5, 30.0 ],      // seconds; or "count": 4
+//     "width": 160, "height": 160,
+//     "format": "jpeg",                // or "png", "bgra" (raw pixels)
+//     "quality": 0.8,                  // optional, JPEG only
+//     "output": "C:\\thumbs\\clip" }   // optional: write <output>_<i>
+//
+// If "output" is missing, the images are returned inline as base64.
+//
+// Consumers on the same machine can instead ask for the images to be
+// placed in a shared-memory ring that they created (see shmring.h):
+//
+//     "delivery": "shm", "ring": "preproc0", "ring_timeout_ms": 5000
+//
+// Each image is written straight into a ring slot and published as soon
+// as it is ready; the response then reports the slot of each thumbnail
+// instead of its data. If the consumer holds every slot for longer than
+// ring_timeout_ms, the remaining thumbnails fail with ERROR_TIMEOUT.
+//
+// Response:
+//   { "id": "42", "hr": "0x00000000",
+//     "thumbnails": [ { "index": 0, "timestamp": 1.502, "hr": "0x00000000",
+//                       "bytes": 5321, "data": "..." } ],
+//     "timings": { "queue_ms": 0.1, "open_ms": 12.0, "decode_ms": 40.2,
+//                  "encode_ms": 3.1, "write_ms": 0.0, "total_ms": 55.4 } }
+//
+// Requests for the same input that are queued together, or arrive within
+// a few milliseconds of each other, are coalesced: their positions are
+// merged and decoded in one pass, and each request gets its own scaled
+// and encoded results. The "decode" member of a response reports how
+// many requests shared the pass, how many frames it decoded, and how
+// many of those were converted to RGB ("converted"); frames that are
+// skipped on the way to a position are not converted.
+//
+// When the daemon is started with --cache-dir, encoded results are kept
+// in an on-disk result cache (see resultcache.h). A request whose
+// results are cached is answered without opening the video, and its
+// "decode" member reports "cached": true.
+//
+// With --index-dir, the duration, format and keyframes of each input are
+// kept in a persistent index (see videoindex.h), and later requests seek
+// straight to known keyframes. "snapped" in the "decode" member counts
+// those seeks.
+//
+// --read-ahead <kilobytes> reads inputs through a block cache with that
+// much read-ahead after each miss (see bytestream.h), and --map-files
+// maps inputs on local drives instead. HTTP(S) inputs are then fetched
+// with range requests through the same cache. The "io" member of a
+// response reports the file size, the bytes read from storage or
+// transferred, and the number of reads or requests.
+//
+// --field-drop deinterlaces by keeping one field of each interlaced
+// frame and folding it into the downscale, instead of running the video
+// processor's deinterlacer (see mfsource.h).
+//
+// --frame-memory <megabytes> limits the memory used to turn each frame
+// into a bitmap (64 MB by default). Larger frames, such as 8K video, are
+// converted a band of rows at a time and reduced as they go (see
+// Thumbnail.h). "frame_bytes" in the "decode" member reports the most
+// that one frame used, and "bitmap_bytes" the size of the bitmaps held
+// until they were encoded; "frame_bytes_max" in the stats is the most
+// for any request.
+//
+// --frame-threads <n> starts a pool of n threads that the workers share
+// to convert and reduce each frame in tiles (see taskpool.h), which
+// cuts the latency of a single large frame when few requests are in
+// flight. The workers also work on their own frames, so the pool never
+// holds them up.
+//
+// --pipeline <n> runs each decode pass as a pipeline: decoding, scaling
+// and encoding overlap on three threads, with up to n frames queued
+// between them (see thumbcontext.h). The "decode" member of a response
+// then has a "pipeline" member with the wall time of the pass and, for
+// each stage, the time it was busy, starved of input and blocked by the
+// next stage, and its utilization. "pipeline_utilization" in the stats
+// gives each stage's busy share of all pipelined passes.
+//
+// --file-timeout <ms> and --position-timeout <ms> limit the time spent
+// reading each input and each position in it (see watchdog.h). A read
+// that runs past its limit is cancelled, the thumbnails that were not
+// ready get HRESULT_FROM_WIN32(ERROR_TIMEOUT), and the others are still
+// returned. "timed_out" in the "decode" member counts those positions,
+// and "positions_timed_out" in the stats counts them all.
+//
+// Inputs with a .y4m extension are read without a decoder (see
+// y4msource.h). --simulate-cost <seek-us>,<decode-us>,<gop> gives them
+// the seek and decode costs of a long-GOP codec, so that the pipeline
+// can be benchmarked with deterministic inputs.
+//
+// "priority": "bulk" marks a request as background work; the default is
+// "interactive". Interactive requests are taken from the queue first,
+// and when every worker is busy with a bulk request, one of them runs
+// the interactive request at the next frame boundary of its pass and
+// then resumes (see workqueue.h). --no-priority treats all requests
+// alike, in arrival order.
+//
+// { "command": "cancel", "target": "42" } cancels the requests with id
+// "42" on the same connection. A queued request is answered without
+// being run; a running one stops at its next frame. Either way it
+// responds with HRESULT_FROM_WIN32(ERROR_CANCELLED), or S_FALSE with
+// the thumbnails that were already done. The response to the command
+// gives the number of requests that were cancelled in "cancelled".
+//
+// "queues" in the stats reports, for each class, the requests queued,
+// started ("preempting": of those, started inside a bulk pass),
+// cancelled and completed, the queue depth now and at most, the mean
+// and longest time queued, and the 50th and 99th percentile of the
+// latency of the last 1024 requests, from arrival to response.
+//
+// --shed-queue <n> and --shed-wait <ms> turn on load shedding (see
+// loadshed.h): when more than n requests are queued, or requests have
+// been waiting longer than ms on average, passes switch to keyframe
+// seeking, then linear scaling, then lower encoder effort, one step at a
+// time, and back as the load falls. "degraded" in the "decode" member
+// of a response lists the ones applied to it, such as
+// [ "keyframe_seek", "fast_scale" ]; degraded results are not cached.
+// "load_shedding" in the stats reports the level now and at most, the
+// times it was raised and lowered, the passes that were degraded and
+// the smoothed wait.
+//
+// Control requests: { "command": "ping" }, { "command": "stats" },
+// { "command": "cancel", "target": <id> } and { "command": "shutdown" }.
+//
+// Requests from one connection are processed concurrently, so responses
+// can arrive out of order; match them by "id".
+
+
+// DaemonConnection: One client. Reference counted, because queued
+// requests keep the connection alive until they have responded.
+
+class DaemonConnection
+{
+    volatile LONG       m_cRef;
+    HANDLE              m_hRead;
+    HANDLE              m_hWrite;
+    BOOL                m_bOwnsHandles;
+    HANDLE              m_hReadEvent;
+    HANDLE              m_hWriteEvent;
+    CRITICAL_SECTION    m_writeLock;    // One response line at a time.
+
+public:
+    DaemonConnection(HANDLE hRead, HANDLE hWrite, BOOL bOwnsHandles);
+
+    ULONG   AddRef();
+    ULONG   Release();
+
+    HRESULT Read(char *pBuffer, DWORD cbBuffer, DWORD *pcbRead);
+    HRESULT SendLine(const std::string& line);
+
+private:
+    ~DaemonConnection();
+};
+
+
+struct DaemonRequest : public WorkItem
+{
+    DaemonConnection        *pConnection;
+    std::string             id;
+    std::wstring            input;
+    std::wstring            output;
+    std::wstring            ring;       // Shared-memory ring name, for "shm" delivery.
+    DWORD                   ringTimeoutMs;
+    std::vector<LONGLONG>   positions;  // 100-ns units; empty for evenly spaced positions.
+    UINT32                  count;
+    VT_OPTIONS              options;
+    Stopwatch               queued;     // Started when the request was received.
+
+    DaemonRequest() : pConnection(NULL), ringTimeoutMs(0), count(0)
+    {
+        ZeroMemory(&options, sizeof(options));
+    }
+};
+
+
+// Counters for requests that have been processed. Requests for the same
+// input that arrive close together share one decode pass, so
+// cFramesDecoded / cRequests falls as requests are coalesced.
+
+struct DaemonStats
+{
+    ULONGLONG   cRequests;
+    ULONGLONG   cBatches;
+    ULONGLONG   cCoalesced;     // Requests that joined another request's decode pass.
+    ULONGLONG   cFramesDecoded;
+    ULONGLONG   cFramesConverted;
+    ULONGLONG   cbFramePeakMax;     // Most memory used for one frame.
+    ULONGLONG   cPositionsTimedOut;
+    double      pipelineMs;         // Wall time of pipelined passes.
+    double      stageBusyMs[PIPELINE_STAGES];
+
+    DaemonStats() : cRequests(0), cBatches(0), cCoalesced(0), cFramesDecoded(0), cFramesConverted(0), cbFramePeakMax(0),
+        cPositionsTimedOut(0), pipelineMs(0)
+    {
+        ZeroMemory(stageBusyMs, sizeof(stageBusyMs));
+    }
+};
+
+
+class ThumbnailDaemon;
+
+// DaemonPassControl: Stops a worker's pass when all of its requests are
+// cancelled. With a context to run them on, it also runs interactive
+// requests at the frame boundaries of a bulk pass.
+
+class DaemonPassControl : public PassControl
+{
+    ThumbnailDaemon     *m_pDaemon;
+    ThumbnailContext    *m_pPreemptContext;     // Optional.
+    DaemonPassControl   *m_pPreemptControl;     // For m_pPreemptContext.
+    DaemonRequest       **m_ppBatch;
+    DWORD               m_cRequests;
+    WORK_CLASS          m_workClass;            // Of the most urgent request in the batch.
+
+public:
+    DaemonPassControl(ThumbnailDaemon *pDaemon, ThumbnailContext *pPreemptContext, DaemonPassControl *pPreemptControl);
+
+    void    Begin(DaemonRequest *ppBatch[], DWORD cRequests);
+
+    // PassControl
+    bool    IsCancelled();
+    void    AtFrameBoundary(ReadBudget *pBudget);
+};
+
+
+class ThumbnailDaemon
+{
+    friend class DaemonPassControl;
+
+    CRITICAL_SECTION        m_lock;         // Guards m_active and m_stats.
+    WorkQueue               m_queue;
+    std::vector<DaemonRequest*> m_active;   // Queued or running, for "cancel".
+    HANDLE                  m_hStopEvent;
+
+    HANDLE                  *m_phWorkers;
+    DWORD                   m_cWorkers;
+
+    DaemonStats             m_stats;
+    ReaderCache             m_readerCache;  // Shared by the workers.
+    ResultCache             m_resultCache;
+    BOOL                    m_bResultCache;
+    VideoIndexStore         m_indexStore;
+    BOOL                    m_bIndexStore;
+    ByteStreamOptions       m_streamOptions;
+    BOOL                    m_bCachedStreams;
+    FrameSourceCost         m_frameCost;
+    BOOL                    m_bFieldDrop;
+    ULONGLONG               m_cbFrameMemory;
+    TaskPool                m_framePool;    // Shared by the workers for large frames.
+    DWORD                   m_cFrameThreads;
+    DWORD                   m_cPipelineDepth;
+    Watchdog                m_watchdog;     // Shared by the workers, if there is a time budget.
+    TimeBudget              m_timeBudget;
+    LoadShedder             m_shedder;      // Picks the degradations for each pass.
+
+public:
+
+    ThumbnailDaemon();
+    ~ThumbnailDaemon();
+
+    HRESULT     EnableResultCache(const WCHAR *wszDirectory, ULONGLONG cbMaxSize);
+    HRESULT     EnableIndexStore(const WCHAR *wszDirectory);
+    HRESULT     EnableCachedStreams(const ByteStreamOptions& options);
+    void        SetFrameSourceCost(const FrameSourceCost& cost) { m_frameCost = cost; }
+    void        SetFieldDrop(BOOL bFieldDrop) { m_bFieldDrop = bFieldDrop; }
+    void        SetFrameMemoryBudget(ULONGLONG cbBudget) { m_cbFrameMemory = cbBudget; }
+    void        SetFrameThreads(DWORD cThreads) { m_cFrameThreads = cThreads; }
+    void        SetPipelineDepth(DWORD cFrames) { m_cPipelineDepth = cFrames; }
+    void        SetTimeBudget(const TimeBudget& budget) { m_timeBudget = budget; }
+    void        SetPriority(BOOL bPriority) { m_queue.SetPriority(bPriority != FALSE); }
+    void        SetLoadTargets(const LoadTargets& targets) { m_shedder.SetTargets(targets); }
+    HRESULT     Start(DWORD cWorkers);
+    HRESULT     RunPipeServer(const WCHAR *wszPipeName);
+    HRESULT     RunStdio();
+    void        Stop();
+    void        Shutdown();
+
+private:
+    static DWORD WINAPI WorkerThreadProc(LPVOID lpParameter);
+    static DWORD WINAPI ConnectionThreadProc(LPVOID lpParameter);
+
+    void        ServeConnection(DaemonConnection *pConnection);
+    void        HandleLine(DaemonConnection *pConnection, const char *pszLine, size_t cch);
+    HRESULT     ParseRequest(const JsonValue& json, DaemonRequest *pRequest);
+
+    void        Enqueue(DaemonRequest *pRequest);
+    DWORD       Dequeue(DaemonRequest *ppBatch[], DWORD cMaxRequests);
+    DWORD       DequeuePreempting(DaemonRequest *ppBatch[], DWORD cMaxRequests);
+    DWORD       Cancel(DaemonConnection *pConnection, const std::string& id);
+    void        ConfigureContext(ThumbnailContext *pContext);
+
+    void        ServeBatch(ThumbnailContext *pContext, DaemonPassControl *pControl, HRESULT hrInit,
+                    DaemonRequest *ppBatch[], DWORD cRequests);
+    void        ProcessBatch(ThumbnailContext *pContext, DaemonRequest *ppBatch[], DWORD cRequests);
+    void        WriteQueueStats(JsonWriter& writer);
+    void        WriteLoadStats(JsonWriter& writer);
+};
+
+INT RunDaemon(int argc, LPWSTR *argv);
@@ -0,0 +1,4314 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// framebench: Measures frame source throughput.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+// NOTE: framebench is a separate command-line program and is not part of
+// VideoThumbnail.vcxproj. It only uses the portable frame sources, so it
+// builds on Linux:
+//
+//   g++ -O2 -pthread -o framebench framebench.cpp y4msource.cpp yuvconvert.cpp
+//       bandscale.cpp taskpool.cpp cpulevel.cpp asyncreader.cpp synthsource.cpp
+//       batchplan.cpp watchdog.cpp workqueue.cpp loadshed.cpp mp4index.cpp
+//       rangecache.cpp
+//
+// Add -DVT_ENABLE_LIBJPEG jpegdecode.cpp mjpegsource.cpp -ljpeg for scaled
+// JPEG decoding.
+//
+// Usage:
+//
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              [--size <width>x<height>] <file>...
+//   framebench [--count <n>] [--size <width>x<height>]
+//              --interlaced <width>x<height>
+//   framebench [--count <n>] [--size <width>x<height>]
+//              --mjpeg <width>x<height>
+//   framebench [--count <n>] [--size <width>x<height>]
+//              --bands <width>x<height>
+//   framebench [--count <n>] [--size <width>x<height>] [--threads <n>]
+//              --tiles <width>x<height>
+//   framebench [--count <n>] --kernels <width>x<height>
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              [--jitter <us>] --async <sources>
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              [--threads <n>] --batch <inputs>
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              --faults <ms>
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              --priority <workers>
+//   framebench [--count <n>] [--cost <seek-us>,<decode-us>,<gop>]
+//              --shed <workers>
+//   framebench --mp4index
+//   framebench --rangecache <us>
+//
+// .y4m files are read with Y4mFrameSource. For each file, framebench
+// decodes and converts every frame in order, and then takes <n>
+// thumbnails (10 by default) the way
+// ThumbnailGenerator does: evenly spaced positions, a seek to each, and
+// up to MAX_FRAMES_TO_SKIP frames skipped to reach it. Only the frame
+// used for each thumbnail is converted, so the thumbnail pass reports
+// frames decoded and frames converted separately. --cost sets the
+// simulated costs of Y4M inputs.
+//
+// .jpg files are decoded <n> times with JpegDecoder, at full size and at
+// the reduction that --size allows (160x160 by default), to measure the
+// saving on single frames:
+//
+//   ffmpeg -f lavfi -i testsrc2=size=3840x2160 -frames:v 1 frame4k.jpg
+//   framebench --size 160x160 frame4k.jpg
+//
+// .mjpeg and .mjpg files are read with MjpegFrameSource, and run like
+// .y4m files twice: decoded at full size and at the reduction that
+// --size allows.
+//
+// --mjpeg writes a Motion JPEG stream of <n> synthetic frames (at least
+// 2) of moving bars, with padding between some frames and a JPEG inside
+// an APP1 segment of the second, and reads it back with
+// MjpegFrameSource at full size and at the reduction that --size allows
+// (160x160 by default). It fails unless both find every frame and no
+// other, at the expected size and time, and every reduced frame is
+// within 4 levels on average of the full one averaged over blocks of the
+// reduction. It reports the decoding time per frame and the time of <n>
+// thumbnails at each size.
+//
+// --interlaced synthesizes an NV12 frame whose two fields show a moving
+// pattern at different times, and converts it <n> times: in full, from
+// the top field with its lines doubled, and with the field drop folded
+// into the downscale (ConvertYuvToBgraReduced) at half size and at the
+// reduction that --size allows. It fails unless each conversion from the
+// top field is unchanged when every line of the bottom field is
+// overwritten, the doubled one repeats the top field converted on its
+// own line for line, and the reduced ones are within one level on
+// average of the top field converted on its own and then averaged over
+// the blocks of the reduction.
+//
+// --bands synthesizes an I420 frame and reduces it <n> times the way
+// ThumbnailGenerator reduces large frames (see bandscale.h), to the
+// size that --size allows (160x160 by default): once converted whole and
+// then reduced, and once converted and reduced a band of rows at a time.
+// It reports the time and the memory that each way needs.
+//
+// --tiles synthesizes an I420 frame and converts it to BGRA, and then
+// reduces it to the size that --size allows, <n> times each, on a
+// TaskPool of 1, 2, 4 ... threads up to --threads (the number of
+// processors by default). It reports the time and the speedup over one
+// thread for each count.
+//
+// --async reads <n> evenly spaced positions from each of <sources>
+// synthetic five-minute videos (see synthsource.h), whose seeks and
+// decodes sleep for the latencies of --cost (5000,2000,30 by default)
+// plus up to --jitter microseconds at random. It reads them once in
+// turn, synchronously, and once with a ThreadFrameReader per source and
+// every read queued at once from one thread (see asyncreader.h). It
+// checks that both got the same frames and reports the time of each.
+//
+// --batch runs a batch of <inputs> synthetic inputs, most of them small
+// and the last one 4K, with <n> positions each, on --threads workers (4
+// by default; see batchplan.h). Opening an input waits for one seek,
+// and decoding waits for the decode latency of --cost (2000,500,30 by
+// default) per megapixel. The batch runs three times: whole inputs in
+// list order from one queue, as PlanBatch plans it with the default
+// cost model, and as it plans it with the model fitted to the second
+// run. Each run reports its makespan and total work, next to what the
+// model predicted.
+//
+// --faults reads <n> positions (at least 5) from synthetic sources with
+// a time budget (see watchdog.h), the way ThumbnailGenerator does, and
+// fails unless:
+//
+//   - A decode error at the second position fails that position only.
+//   - A hang at the fourth position is cancelled after <ms>, and the
+//     positions after it time out without being read.
+//   - A file whose seeks take a quarter of <ms> each, with <ms> for the
+//     whole file, stops within <ms>, with the frames read by then kept.
+//   - A file with <ms> more than twice its reading time for all its
+//     positions, preempted for half that after each one, reads every
+//     position when the pass control pauses its budget, and runs out of
+//     time when it does not.
+//   - A read on another thread that takes one and a half times <ms>, of
+//     which <ms> is spent paused, is not cancelled, and a hang that
+//     starts before a pause of twice <ms> is cancelled <ms> after the
+//     read began, not counting the pause.
+//
+// The other positions must return the same frames as a source without
+// faults. --cost sets the latencies (5000,2000,30 by default).
+//
+// --priority runs 20 interactive requests, one every 50 ms, on
+// <workers> threads (see workqueue.h). Each reads <n> positions of a
+// synthetic source with the latencies of --cost (5000,2000,30 by
+// default). They run three times: alone, behind four bulk requests of
+// 4 * <n> positions per worker in one FIFO, and with priority classes,
+// where bulk passes make way for interactive work between positions.
+// Once the interactive requests are done, the bulk ones are cancelled.
+// Every file has a time budget of one and a half times what a bulk pass
+// takes alone (see watchdog.h). A fourth run has priority classes but
+// does not pause a preempted pass's budget, for comparison. It reports
+// each class's queue statistics and positions timed out, and fails
+// unless, with priority, the interactive 99th percentile latency stays
+// within two positions' reads of the one without load, no position
+// times out, and cancelled passes stop within two positions' reads.
+//
+// --shed times a request of <n> positions, read from a synthetic source
+// with the latencies of --cost (5000,2000,250 by default: with GOPs no
+// longer than SEEK_TOLERANCE, the first frame after a seek is already
+// close enough) and then scaled and encoded for twice the decode latency, at full quality and with
+// each level of degradation (see loadshed.h). It then sends <workers>
+// threads requests at half their full-quality capacity for 5 passes'
+// time, one and a half times it for 15, and half again for 15: once
+// without load shedding, and once with a LoadShedder whose targets are
+// 2 * <workers> requests queued and one pass of waiting. It reports the
+// latency of each phase and the degraded requests, and fails unless,
+// with shedding, nothing is degraded at first, the overload's 99th
+// percentile latency is less than half of what it is without, and the
+// last third of the recovery gets full quality.
+//
+// --mp4index builds small MP4 files in memory and checks what
+// Mp4SampleIndex reads from them (see mp4index.h):
+//
+//   - A progressive file with an audio track before the video track,
+//     stts, ctts, stss, stsc and an edit list with an empty edit, read
+//     with stsz and stco, and again with 4-bit stz2 sizes and co64
+//     offsets past 4 GB. Every sample's offset, size, times and sync
+//     flag must match, and FindSyncSample must find the right keyframe.
+//   - A fragmented file: trex defaults, tfhd, tfdt and trun with data
+//     offsets, first-sample flags, sizes and composition offsets, a
+//     track fragment of another track, and a second fragment that uses
+//     the defaults.
+//   - Malformed tables (counts larger than their box, chunks that stco
+//     does not have, samples that stsc does not map, 2^32 - 1 samples,
+//     a child larger than its parent, a 64-bit box size near 2^64, a
+//     trun count larger than its box), a file without video, a PNG, an
+//     empty file and a failed read, each with its status.
+//   - Every truncation of both files, and every byte of moov set to a
+//     few values in turn. A file cut inside moov must fail, and one cut
+//     in the last mdat must still be read in full.
+//
+// Build with -fsanitize=address to check that none of them reads out
+// of bounds.
+//
+// --rangecache reads through a RangeCache (see rangecache.h) of eight
+// 4 KB blocks with four blocks of read-ahead, from a source that counts
+// its reads, and fails unless:
+//
+//   - A cold read of three blocks is one round trip that also fetches
+//     the read-ahead, and the reads it covers need none.
+//   - A read from cached into missing blocks fetches the missing run
+//     in one round trip.
+//   - Small sequential reads take one round trip per five blocks.
+//   - Reads at and past the end are clipped, and the cache never reads
+//     past the end of the source.
+//   - The least recently used block is evicted first.
+//   - A read larger than the cache is one round trip and is not cached.
+//   - A failed fetch fails the read, and the read succeeds once the
+//     source recovers.
+//   - 5000 random reads return the source's bytes.
+//
+// It then makes 10 seeks with 40 reads of 400 bytes after each, with
+// <us> microseconds per round trip, straight from the source and
+// through the cache. It reports both, and fails unless the cache needs
+// less than a tenth of the round trips.
+//
+// --kernels checks and times the conversion kernels of each instruction
+// set that the processor supports (see yuvconvert.h). For monochrome,
+// 4:4:4, 4:2:2, 4:2:0 and NV12 images of pseudo-random samples, and
+// every width from 1 to 80 as well as <width>, it compares each level's
+// output with the scalar kernel's, byte for byte, at full size and
+// reduced by 2, 4 and 8 from the frame and from its top field, and fails
+// if any byte differs. It then converts a <width>x<height> frame of each layout <n>
+// times at each level, and reports the time per frame.
+//
+// Only .y4m clips are decoded here; other containers are read through
+// Media Foundation (see winbench --mfasync). A test clip can be made
+// with:
+//
+//   ffmpeg -f lavfi -i testsrc2=size=1280x720:rate=30 -t 60
+//          -pix_fmt yuv420p clip.y4m
+//   framebench clip.y4m
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "y4msource.h"
+#include "yuvconvert.h"
+#include "bandscale.h"
+#include "taskpool.h"
+#include "asyncreader.h"
+#include "synthsource.h"
+#include "batchplan.h"
+#include "watchdog.h"
+#include "workqueue.h"
+#include "loadshed.h"
+#include "mp4index.h"
+#include "rangecache.h"
+#include "jpegdecode.h"
+#include "mjpegsource.h"
+
+#ifdef VT_ENABLE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+// As in Thumbnail.h and Thumbnail.cpp.
+const int64_t SEEK_TOLERANCE = 10000000;
+const int     MAX_FRAMES_TO_SKIP = 10;
+const uint32_t BAND_ROWS = 16;
+
+struct BenchResult
+{
+    int64_t     cFrames;        // Decoded.
+    int64_t     cConverted;
+    double      ms;
+};
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool HasExtension(const char *szPath, const char *szExt)
+{
+    size_t cchPath = strlen(szPath);
+    size_t cchExt = strlen(szExt);
+
+    if (cchPath < cchExt)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < cchExt; i++)
+    {
+        if (tolower((unsigned char)szPath[cchPath - cchExt + i]) != szExt[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// DecodeAll
+//
+// Reads every frame from the start.
+//-------------------------------------------------------------------
+
+static FRAME_STATUS DecodeAll(FrameSource *pSource, BenchResult *pResult)
+{
+    FrameView view;
+    bool bFormatChanged = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    pResult->cFrames = 0;
+    pResult->cConverted = 0;
+
+    FRAME_STATUS status = pSource->Seek(0);
+
+    pSource->SetSkipThreshold(INT64_MIN);
+
+    while (status == FRAME_OK)
+    {
+        status = pSource->ReadFrame(&view, &bFormatChanged);
+
+        if (status == FRAME_OK)
+        {
+            ++pResult->cFrames;
+
+            status = pSource->ConvertFrame(&view);
+
+            if (status == FRAME_OK)
+            {
+                ++pResult->cConverted;
+            }
+        }
+    }
+
+    pResult->ms = ElapsedMs(start);
+
+    return (status == FRAME_END_OF_STREAM) ? FRAME_OK : status;
+}
+
+
+//-------------------------------------------------------------------
+// TakeThumbnails
+//
+// Seeks to count evenly spaced positions and reads the frame for each,
+// as ThumbnailGenerator::CreateBitmap does.
+//-------------------------------------------------------------------
+
+static FRAME_STATUS TakeThumbnails(FrameSource *pSource, int count, BenchResult *pResult)
+{
+    FrameView view;
+    bool bFormatChanged = false;
+    int64_t hnsDuration = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    pResult->cFrames = 0;
+    pResult->cConverted = 0;
+
+    FRAME_STATUS status = pSource->GetDuration(&hnsDuration);
+
+    for (int i = 0; i < count && status == FRAME_OK; i++)
+    {
+        int64_t hnsPos = hnsDuration / (count + 1) * (i + 1);
+        int cSkipped = 0;
+        bool bHaveFrame = false;
+
+        status = pSource->Seek(hnsPos);
+
+        pSource->SetSkipThreshold(hnsPos - SEEK_TOLERANCE);
+
+        while (status == FRAME_OK)
+        {
+            status = pSource->ReadFrame(&view, &bFormatChanged);
+
+            if (status != FRAME_OK)
+            {
+                break;
+            }
+
+            ++pResult->cFrames;
+            bHaveFrame = true;
+
+            if (cSkipped < MAX_FRAMES_TO_SKIP && view.timestamp != FRAME_TIME_UNKNOWN &&
+                view.timestamp + SEEK_TOLERANCE < hnsPos)
+            {
+                ++cSkipped;
+                continue;
+            }
+            break;
+        }
+
+        if (status == FRAME_END_OF_STREAM)
+        {
+            status = FRAME_OK;
+        }
+
+        // Convert only the frame that would be drawn.
+        if (status == FRAME_OK && bHaveFrame)
+        {
+            status = pSource->ConvertFrame(&view);
+
+            if (status == FRAME_OK)
+            {
+                ++pResult->cConverted;
+            }
+        }
+    }
+
+    pResult->ms = ElapsedMs(start);
+
+    return status;
+}
+
+
+//-------------------------------------------------------------------
+// RunJpegBenchmark
+//
+// Decodes a JPEG file count times at full size and at the reduction
+// for the target size.
+//-------------------------------------------------------------------
+
+static int RunJpegBenchmark(const char *szPath, int count, uint32_t targetWidth, uint32_t targetHeight)
+{
+#ifdef VT_ENABLE_LIBJPEG
+    std::vector<uint8_t> jpeg;
+    std::vector<uint8_t> bgra;
+    JpegDecoder decoder;
+    uint32_t width = 0, height = 0;
+    FILE *pFile = NULL;
+
+#ifdef _MSC_VER
+    fopen_s(&pFile, szPath, "rb");
+#else
+    pFile = fopen(szPath, "rb");
+#endif
+
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "%s: cannot open\n", szPath);
+        return 1;
+    }
+
+    uint8_t buffer[65536];
+    size_t cbRead = 0;
+
+    while ((cbRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+    {
+        jpeg.insert(jpeg.end(), buffer, buffer + cbRead);
+    }
+    fclose(pFile);
+
+    if (jpeg.empty() || decoder.ReadHeader(&jpeg[0], jpeg.size(), &width, &height) != FRAME_OK)
+    {
+        fprintf(stderr, "%s: not a JPEG image\n", szPath);
+        return 1;
+    }
+
+    printf("%s  %ux%u, %u bytes\n", szPath, width, height, (unsigned int)jpeg.size());
+
+    uint32_t scales[2] = { 1, JpegDecoder::ChooseScale(width, height, targetWidth, targetHeight) };
+
+    for (int i = 0; i < 2; i++)
+    {
+        uint32_t cxOut = 0, cyOut = 0;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int j = 0; j < count; j++)
+        {
+            if (decoder.Decode(&jpeg[0], jpeg.size(), scales[i], &bgra, &cxOut, &cyOut) != FRAME_OK)
+            {
+                fprintf(stderr, "%s: cannot decode at 1/%u\n", szPath, scales[i]);
+                return 1;
+            }
+        }
+
+        double ms = ElapsedMs(start);
+
+        printf("  1/%u: %ux%u, %.2f ms per frame\n", scales[i], cxOut, cyOut, ms / count);
+    }
+
+    return 0;
+#else
+    (void)count;
+    (void)targetWidth;
+    (void)targetHeight;
+    fprintf(stderr, "%s: JPEG support is not built in\n", szPath);
+    return 1;
+#endif
+}
+
+
+#ifdef VT_ENABLE_LIBJPEG
+
+//-------------------------------------------------------------------
+// EncodeJpeg
+//
+// Compresses a top-down BGRA image, with an APP1 segment if cbApp1 is
+// not 0.
+//-------------------------------------------------------------------
+
+static bool EncodeJpeg(const std::vector<uint8_t>& bgra, uint32_t width, uint32_t height,
+    const uint8_t *pApp1, size_t cbApp1, std::vector<uint8_t> *pJpeg)
+{
+    jpeg_compress_struct info;
+    jpeg_error_mgr error;
+    unsigned char *pOut = NULL;
+    unsigned long cbOut = 0;
+    std::vector<uint8_t> row(3 * width);
+
+    info.err = jpeg_std_error(&error);
+    jpeg_create_compress(&info);
+    jpeg_mem_dest(&info, &pOut, &cbOut);
+
+    info.image_width = width;
+    info.image_height = height;
+    info.input_components = 3;
+    info.in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, 85, TRUE);
+    jpeg_start_compress(&info, TRUE);
+
+    if (cbApp1 > 0)
+    {
+        jpeg_write_marker(&info, JPEG_APP0 + 1, pApp1, (unsigned int)cbApp1);
+    }
+
+    while (info.next_scanline < height)
+    {
+        const uint8_t *pSrc = &bgra[(size_t)info.next_scanline * 4 * width];
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            row[3 * x] = pSrc[4 * x + 2];
+            row[3 * x + 1] = pSrc[4 * x + 1];
+            row[3 * x + 2] = pSrc[4 * x];
+        }
+
+        JSAMPROW pRow = &row[0];
+        jpeg_write_scanlines(&info, &pRow, 1);
+    }
+
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+
+    pJpeg->assign(pOut, pOut + cbOut);
+    free(pOut);
+
+    return cbOut > 0;
+}
+
+
+//-------------------------------------------------------------------
+// MakeMjpegFrame
+//
+// Fills a BGRA frame with bars that move by an eighth of the width
+// from one frame to the next, over a gradient.
+//-------------------------------------------------------------------
+
+static void MakeMjpegFrame(uint32_t width, uint32_t height, int iFrame, std::vector<uint8_t> *pBgra)
+{
+    uint32_t shift = (uint32_t)iFrame * (width / 8);
+    uint32_t period = width / 4 + 1;
+
+    pBgra->resize((size_t)4 * width * height);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t *pRow = &(*pBgra)[(size_t)y * 4 * width];
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            bool bBar = ((x + y / 4 + shift) % period) < period / 2;
+
+            pRow[4 * x] = (uint8_t)(bBar ? 230 : 40);
+            pRow[4 * x + 1] = (uint8_t)(255 * y / height);
+            pRow[4 * x + 2] = (uint8_t)(255 * x / width);
+            pRow[4 * x + 3] = 0xFF;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// CompareReduced
+//
+// Returns the mean difference between a frame decoded at 1/scale and
+// the same frame decoded at full size and then averaged over blocks of
+// scale x scale pixels.
+//-------------------------------------------------------------------
+
+static double CompareReduced(const uint8_t *pFull, uint32_t width, uint32_t height,
+    const uint8_t *pReduced, uint32_t scale)
+{
+    uint32_t cxReduced = JpegDecoder::ScaledSize(width, scale);
+    uint32_t cyReduced = JpegDecoder::ScaledSize(height, scale);
+    uint64_t total = 0;
+    uint64_t cSamples = 0;
+
+    for (uint32_t y = 0; y < cyReduced; y++)
+    {
+        for (uint32_t x = 0; x < cxReduced; x++)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t sum = 0;
+                uint32_t n = 0;
+
+                for (uint32_t sy = y * scale; sy < (y + 1) * scale && sy < height; sy++)
+                {
+                    for (uint32_t sx = x * scale; sx < (x + 1) * scale && sx < width; sx++)
+                    {
+                        sum += pFull[((size_t)sy * width + sx) * 4 + c];
+                        ++n;
+                    }
+                }
+
+                int mean = (int)((sum + n / 2) / n);
+                int reduced = pReduced[((size_t)y * cxReduced + x) * 4 + c];
+
+                total += (uint64_t)(mean > reduced ? mean - reduced : reduced - mean);
+                ++cSamples;
+            }
+        }
+    }
+
+    return (double)total / cSamples;
+}
+
+
+//-------------------------------------------------------------------
+// RunMjpegTest
+//
+// Writes a Motion JPEG stream of count synthetic width x height frames
+// and reads it with MjpegFrameSource at full size and at the reduction
+// for the target size.
+//-------------------------------------------------------------------
+
+static int RunMjpegTest(uint32_t width, uint32_t height, int count, uint32_t targetWidth, uint32_t targetHeight)
+{
+    const char *szPath = "framebench.mjpeg";
+    const double MAX_MEAN_DIFFERENCE = 4.0;     // Per 8-bit sample.
+
+    std::vector<uint8_t> bgra;
+    std::vector<uint8_t> jpeg;
+    std::vector<uint8_t> exif;
+    std::vector<uint8_t> padding(1000, 0);
+    std::vector<std::vector<uint8_t> > full(count);
+    FILE *pFile = NULL;
+    size_t cbStream = 0;
+    bool bPassed = true;
+
+    if (width < 64 || height < 64)
+    {
+        fprintf(stderr, "--mjpeg: frames must be at least 64x64\n");
+        return 1;
+    }
+
+    // The second frame carries an EXIF-style APP1 segment with a small
+    // JPEG of its own in it, which must not be taken for a frame, and
+    // padding between frames must be skipped.
+    MakeMjpegFrame(64, 64, 0, &bgra);
+    EncodeJpeg(bgra, 64, 64, NULL, 0, &exif);
+
+    const char szExif[] = "Exif\0\0";
+    exif.insert(exif.begin(), szExif, szExif + 6);
+
+#ifdef _MSC_VER
+    fopen_s(&pFile, szPath, "wb");
+#else
+    pFile = fopen(szPath, "wb");
+#endif
+
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "%s: cannot create\n", szPath);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        MakeMjpegFrame(width, height, i, &bgra);
+        EncodeJpeg(bgra, width, height, (i == 1) ? &exif[0] : NULL, (i == 1) ? exif.size() : 0, &jpeg);
+
+        fwrite(&jpeg[0], 1, jpeg.size(), pFile);
+        fwrite(&padding[0], 1, (i % 2) ? padding.size() : 0, pFile);
+        cbStream += jpeg.size();
+    }
+    fclose(pFile);
+
+    printf("--mjpeg: %d frames of %ux%u, %u KB per frame\n", count, width, height,
+        (unsigned int)(cbStream / count / 1024));
+
+    uint32_t targets[2][2] = { { 0, 0 }, { targetWidth, targetHeight } };
+    double msPerFrame[2] = { 0, 0 };
+
+    for (int pass = 0; pass < 2 && bPassed; pass++)
+    {
+        MjpegFrameSource source;
+        FrameFormat format;
+        FrameView view;
+        bool bFormatChanged = false;
+        BenchResult thumbnails = { 0, 0, 0 };
+
+        source.SetTargetSize(targets[pass][0], targets[pass][1]);
+
+        if (source.Open(szPath) != FRAME_OK || source.GetFormat(&format) != FRAME_OK)
+        {
+            fprintf(stderr, "  FAILED: cannot open %s\n", szPath);
+            bPassed = false;
+            break;
+        }
+
+        uint32_t scale = source.Scale();
+        uint32_t cxExpected = JpegDecoder::ScaledSize(width, scale);
+        uint32_t cyExpected = JpegDecoder::ScaledSize(height, scale);
+
+        if (source.FrameCount() != count)
+        {
+            fprintf(stderr, "  FAILED: found %lld frames, wrote %d\n", (long long)source.FrameCount(), count);
+            bPassed = false;
+        }
+
+        if (format.width != cxExpected || format.height != cyExpected ||
+            scale != (pass == 0 ? 1 : JpegDecoder::ChooseScale(width, height, targetWidth, targetHeight)))
+        {
+            fprintf(stderr, "  FAILED: 1/%u decodes to %ux%u, expected %ux%u\n",
+                scale, format.width, format.height, cxExpected, cyExpected);
+            bPassed = false;
+        }
+
+        double msDecoding = 0;
+
+        for (int i = 0; i < count && bPassed; i++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            FRAME_STATUS status = source.ReadFrame(&view, &bFormatChanged);
+
+            if (status == FRAME_OK)
+            {
+                status = source.ConvertFrame(&view);
+            }
+
+            msDecoding += ElapsedMs(start);
+
+            if (status != FRAME_OK)
+            {
+                fprintf(stderr, "  FAILED: frame %d: status %d\n", i, (int)status);
+                bPassed = false;
+                break;
+            }
+
+            if (view.timestamp != (int64_t)i * 10000000 / 30 || bFormatChanged)
+            {
+                fprintf(stderr, "  FAILED: frame %d: time %lld%s\n", i, (long long)view.timestamp,
+                    bFormatChanged ? ", format changed" : "");
+                bPassed = false;
+            }
+
+            if (pass == 0)
+            {
+                full[i].assign(view.pData, view.pData + (size_t)4 * width * height);
+            }
+            else
+            {
+                double difference = CompareReduced(&full[i][0], width, height, view.pData, scale);
+
+                if (difference > MAX_MEAN_DIFFERENCE)
+                {
+                    fprintf(stderr, "  FAILED: frame %d at 1/%u differs from the reduced full frame by %.2f\n",
+                        i, scale, difference);
+                    bPassed = false;
+                }
+            }
+        }
+
+        msPerFrame[pass] = msDecoding / count;
+
+        if (bPassed && source.ReadFrame(&view, &bFormatChanged) != FRAME_END_OF_STREAM)
+        {
+            fprintf(stderr, "  FAILED: frames after the last one\n");
+            bPassed = false;
+        }
+
+        if (bPassed && TakeThumbnails(&source, count, &thumbnails) != FRAME_OK)
+        {
+            fprintf(stderr, "  FAILED: thumbnails\n");
+            bPassed = false;
+        }
+
+        if (bPassed)
+        {
+            printf("  1/%u: %ux%u, %.2f ms per frame, %d thumbnails in %.1f ms\n",
+                scale, format.width, format.height, msPerFrame[pass], count, thumbnails.ms);
+        }
+    }
+
+    remove(szPath);
+
+    if (bPassed)
+    {
+        printf("  reduced decoding is %.1fx faster\n", msPerFrame[1] > 0 ? msPerFrame[0] / msPerFrame[1] : 0.0);
+    }
+
+    printf("--mjpeg: %s\n", bPassed ? "passed" : "FAILED");
+
+    return bPassed ? 0 : 1;
+}
+
+#endif // VT_ENABLE_LIBJPEG
+
+
+//-------------------------------------------------------------------
+// CompareFieldReduced
+//
+// Compares a conversion from the top field with the top field converted
+// on its own and then averaged over blocks of cxBlock x cyBlock pixels.
+// Returns the mean difference per sample; the two differ only where
+// averaging luma before the conversion differs from averaging colors
+// after it, at clipped colors and by rounding.
+//-------------------------------------------------------------------
+
+static double CompareFieldReduced(const std::vector<uint8_t>& field, uint32_t width,
+    uint32_t cxBlock, uint32_t cyBlock, const std::vector<uint8_t>& actual, uint32_t cxOut, uint32_t cyOut)
+{
+    uint64_t total = 0;
+
+    for (uint32_t y = 0; y < cyOut; y++)
+    {
+        for (uint32_t x = 0; x < cxOut; x++)
+        {
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                uint32_t sum = 0;
+
+                for (uint32_t j = 0; j < cyBlock; j++)
+                {
+                    for (uint32_t i = 0; i < cxBlock; i++)
+                    {
+                        sum += field[(((size_t)y * cyBlock + j) * width + x * cxBlock + i) * 4 + c];
+                    }
+                }
+
+                int mean = (int)((sum + cxBlock * cyBlock / 2) / (cxBlock * cyBlock));
+                int value = actual[((size_t)y * cxOut + x) * 4 + c];
+
+                total += (uint64_t)(mean > value ? mean - value : value - mean);
+            }
+        }
+    }
+
+    return (double)total / ((uint64_t)cxOut * cyOut * 4);
+}
+
+
+//-------------------------------------------------------------------
+// RunFieldBenchmark
+//
+// Converts a synthetic interlaced NV12 frame count times in each of
+// the ways that MFFrameSource can, and checks that the conversions from
+// the top field depend on it alone and match it converted on its own.
+//-------------------------------------------------------------------
+
+static int RunFieldBenchmark(uint32_t width, uint32_t height, int count, uint32_t targetWidth, uint32_t targetHeight)
+{
+    const double MAX_MEAN_DIFFERENCE = 1.0;     // Per 8-bit sample.
+
+    width &= ~1u;
+    height &= ~3u;     // Whole chroma lines in each field.
+
+    if (width < 16 || height < 16)
+    {
+        fprintf(stderr, "--interlaced: bad size\n");
+        return 1;
+    }
+
+    // A bar that moves 16 pixels between the fields, over a gradient,
+    // and chroma that differs between the fields' lines.
+    std::vector<uint8_t> nv12((size_t)width * height * 3 / 2);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t xBar = (y & 1) ? width / 2 + 16 : width / 2;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            nv12[(size_t)y * width + x] = (x >= xBar && x < xBar + 64) ? 235 : (uint8_t)(16 + (x * 200) / width);
+        }
+    }
+
+    for (uint32_t y = 0; y < height / 2; y++)
+    {
+        uint8_t *pRow = &nv12[(size_t)width * height + (size_t)y * width];
+
+        for (uint32_t x = 0; x < width; x += 2)
+        {
+            pRow[x] = (uint8_t)(((y & 1) ? 160 : 96) + (x * 32) / width);
+            pRow[x + 1] = (uint8_t)(((y & 1) ? 96 : 160) - (x * 32) / width);
+        }
+    }
+
+    YuvImage image;
+
+    image.width = width;
+    image.height = height;
+    image.pY = &nv12[0];
+    image.strideY = (int32_t)width;
+    image.pU = &nv12[(size_t)width * height];
+    image.pV = image.pU + 1;
+    image.strideUV = (int32_t)width;
+    image.chromaStep = 2;
+    image.chromaShiftX = 1;
+    image.chromaShiftY = 1;
+    image.bTopFieldOnly = false;
+
+    // The top field on its own: every other line of luma and chroma.
+    YuvImage field = image;
+    std::vector<uint8_t> fieldBgra((size_t)4 * width * (height / 2));
+
+    field.height = height / 2;
+    field.strideY = 2 * image.strideY;
+    field.strideUV = 2 * image.strideUV;
+
+    ConvertYuvToBgra(field, YUV_MATRIX_BT709, &fieldBgra[0], (int32_t)(4 * width));
+
+    // The same frame with the bottom field's lines of luma and chroma
+    // replaced.
+    std::vector<uint8_t> corrupt(nv12);
+
+    for (uint32_t y = 1; y < height; y += 2)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            corrupt[(size_t)y * width + x] = (uint8_t)(x * 7 + y * 13);
+        }
+    }
+
+    for (uint32_t y = 1; y < height / 2; y += 2)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            corrupt[(size_t)width * height + (size_t)y * width + x] = (uint8_t)(x * 11 + y * 5);
+        }
+    }
+
+    // The reduction MFFrameSource would choose.
+    uint32_t shift = 1;
+
+    while (shift < 3 && (targetWidth > 0 || targetHeight > 0) &&
+           (width >> (shift + 1)) >= targetWidth && (height >> (shift + 1)) >= targetHeight)
+    {
+        ++shift;
+    }
+
+    struct { const char *szName; bool bTopFieldOnly; uint32_t shift; } passes[] =
+    {
+        { "full frame         ", false, 0 },
+        { "top field, doubled ", true, 0 },
+        { "field drop, 1/2    ", true, 1 },
+        { "field drop, reduced", true, shift },
+    };
+
+    std::vector<uint8_t> bgra((size_t)4 * width * height);
+    std::vector<uint8_t> check;
+    int result = 0;
+
+    printf("interlaced %ux%u NV12\n", width, height);
+
+    for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++)
+    {
+        image.bTopFieldOnly = passes[p].bTopFieldOnly;
+
+        uint32_t cxOut = width >> passes[p].shift;
+        uint32_t cyOut = height >> passes[p].shift;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int j = 0; j < count; j++)
+        {
+            ConvertYuvToBgraReduced(image, YUV_MATRIX_BT709, passes[p].shift, &bgra[0], (int32_t)(4 * cxOut));
+        }
+
+        double ms = ElapsedMs(start);
+
+        printf("  %s %4ux%-4u %.2f ms per frame", passes[p].szName, cxOut, cyOut, ms / count);
+
+        if (!passes[p].bTopFieldOnly)
+        {
+            printf("\n");
+            continue;
+        }
+
+        bool bPassed = true;
+
+        // Nothing of the bottom field may reach the output.
+        YuvImage corrupted = image;
+
+        corrupted.pY = &corrupt[0];
+        corrupted.pU = &corrupt[(size_t)width * height];
+        corrupted.pV = corrupted.pU + 1;
+
+        check.assign((size_t)4 * cxOut * cyOut, 0);
+        ConvertYuvToBgraReduced(corrupted, YUV_MATRIX_BT709, passes[p].shift, &check[0], (int32_t)(4 * cxOut));
+
+        if (memcmp(&check[0], &bgra[0], check.size()) != 0)
+        {
+            printf(", DEPENDS on the bottom field");
+            bPassed = false;
+        }
+
+        if (passes[p].shift == 0)
+        {
+            // Each line of the field, twice.
+            for (uint32_t y = 0; y < height && bPassed; y++)
+            {
+                if (memcmp(&bgra[(size_t)y * 4 * width], &fieldBgra[(size_t)(y / 2) * 4 * width], 4 * width) != 0)
+                {
+                    printf(", DIFFERS from the field at line %u", y);
+                    bPassed = false;
+                }
+            }
+        }
+        else
+        {
+            double difference = CompareFieldReduced(fieldBgra, width, 1u << passes[p].shift,
+                1u << (passes[p].shift - 1), bgra, cxOut, cyOut);
+
+            printf(", %.2f from the field reduced", difference);
+
+            if (difference > MAX_MEAN_DIFFERENCE)
+            {
+                printf(" (too far)");
+                bPassed = false;
+            }
+        }
+
+        printf(", %s\n", bPassed ? "passed" : "FAILED");
+
+        if (!bPassed)
+        {
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunKernelBenchmark
+//
+// Compares the conversion kernels of each instruction set with the
+// scalar ones, and times them.
+//-------------------------------------------------------------------
+
+struct KernelLayout
+{
+    const char  *szName;
+    uint32_t    chromaShiftX;
+    uint32_t    chromaShiftY;
+    uint32_t    chromaStep;     // 0 for monochrome.
+};
+
+// Describes planes of pseudo-random samples as a width x height image.
+static void MakeKernelImage(const KernelLayout& layout, uint32_t width, uint32_t height,
+    std::vector<uint8_t> *pSamples, YuvImage *pImage)
+{
+    const uint32_t cxChroma = (width + (1u << layout.chromaShiftX) - 1) >> layout.chromaShiftX;
+    const uint32_t cyChroma = (height + (1u << layout.chromaShiftY) - 1) >> layout.chromaShiftY;
+    const size_t cbLuma = (size_t)width * height;
+    const size_t cbChroma = (size_t)cxChroma * cyChroma;
+
+    pSamples->resize(cbLuma + 2 * cbChroma);
+
+    uint32_t seed = 0x12345678;
+
+    for (size_t i = 0; i < pSamples->size(); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        (*pSamples)[i] = (uint8_t)(seed >> 24);
+    }
+
+    pImage->width = width;
+    pImage->height = height;
+    pImage->pY = &(*pSamples)[0];
+    pImage->strideY = (int32_t)width;
+    pImage->chromaShiftX = layout.chromaShiftX;
+    pImage->chromaShiftY = layout.chromaShiftY;
+    pImage->bTopFieldOnly = false;
+
+    if (layout.chromaStep == 0)
+    {
+        pImage->pU = NULL;
+        pImage->pV = NULL;
+        pImage->strideUV = 0;
+        pImage->chromaStep = 1;
+    }
+    else if (layout.chromaStep == 2)
+    {
+        pImage->pU = pImage->pY + cbLuma;
+        pImage->pV = pImage->pU + 1;
+        pImage->strideUV = (int32_t)(2 * cxChroma);
+        pImage->chromaStep = 2;
+    }
+    else
+    {
+        pImage->pU = pImage->pY + cbLuma;
+        pImage->pV = pImage->pU + cbChroma;
+        pImage->strideUV = (int32_t)cxChroma;
+        pImage->chromaStep = 1;
+    }
+}
+
+static int RunKernelBenchmark(uint32_t width, uint32_t height, int count)
+{
+    static const KernelLayout LAYOUTS[] =
+    {
+        { "mono ", 0, 0, 0 },
+        { "4:4:4", 0, 0, 1 },
+        { "4:2:2", 1, 0, 1 },
+        { "4:2:0", 1, 1, 1 },
+        { "nv12 ", 1, 1, 2 },
+    };
+
+    const uint32_t MAX_SMALL_WIDTH = 80;
+    const uint32_t CHECK_ROWS = 8;         // Whole blocks at 1/8, of the frame and of the top field.
+
+    if (width == 0 || height == 0)
+    {
+        fprintf(stderr, "--kernels: bad size\n");
+        return 1;
+    }
+
+    const CPU_LEVEL best = DetectCpuLevel();
+    const CPU_LEVEL initial = YuvCpuLevel();
+    int result = 0;
+
+    std::vector<uint8_t> samples;
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+
+    printf("kernels: processor supports %s\n", CpuLevelName(best));
+
+    for (size_t l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); l++)
+    {
+        for (int level = CPU_LEVEL_SSE2; level <= best; level++)
+        {
+            size_t cBad = 0;
+
+            for (uint32_t cx = 1; cx <= MAX_SMALL_WIDTH + 1; cx++)
+            {
+                const uint32_t w = (cx <= MAX_SMALL_WIDTH) ? cx : width;
+                YuvImage image;
+
+                MakeKernelImage(LAYOUTS[l], w, CHECK_ROWS, &samples, &image);
+
+                // At full size, and then reduced by 2, 4 and 8, from the
+                // frame and from its top field.
+                for (uint32_t pass = 0; pass < 7; pass++)
+                {
+                    const uint32_t shift = (pass + 1) / 2;
+                    const uint32_t cxOut = w >> shift;
+
+                    image.bTopFieldOnly = (pass > 0 && (pass & 1) == 0);
+
+                    expected.assign((size_t)4 * cxOut * (CHECK_ROWS >> shift), 0);
+                    actual.assign(expected.size(), 1);
+
+                    SetYuvCpuLevel(CPU_LEVEL_SCALAR);
+                    ConvertYuvToBgraReduced(image, YUV_MATRIX_BT601, shift, expected.data(), (int32_t)(4 * cxOut));
+
+                    SetYuvCpuLevel((CPU_LEVEL)level);
+                    ConvertYuvToBgraReduced(image, YUV_MATRIX_BT601, shift, actual.data(), (int32_t)(4 * cxOut));
+
+                    for (size_t i = 0; i < expected.size(); i++)
+                    {
+                        cBad += (expected[i] != actual[i]) ? 1 : 0;
+                    }
+                }
+            }
+
+            printf("  %s %-6s %s\n", LAYOUTS[l].szName, CpuLevelName((CPU_LEVEL)level),
+                cBad ? "DIFFERS from scalar" : "matches scalar");
+
+            if (cBad)
+            {
+                result = 1;
+            }
+        }
+    }
+
+    std::vector<uint8_t> bgra((size_t)4 * width * height);
+
+    for (size_t l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); l++)
+    {
+        YuvImage image;
+
+        MakeKernelImage(LAYOUTS[l], width, height, &samples, &image);
+
+        printf("  %s %ux%u:", LAYOUTS[l].szName, width, height);
+
+        for (int level = CPU_LEVEL_SCALAR; level <= best; level++)
+        {
+            SetYuvCpuLevel((CPU_LEVEL)level);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            for (int j = 0; j < count; j++)
+            {
+                ConvertYuvToBgra(image, YUV_MATRIX_BT709, &bgra[0], (int32_t)(4 * width));
+            }
+
+            printf(" %s %.2f ms", CpuLevelName((CPU_LEVEL)level), ElapsedMs(start) / count);
+        }
+
+        printf("\n");
+    }
+
+    SetYuvCpuLevel(initial);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunBandBenchmark
+//
+// Reduces a synthetic I420 frame count times, converting it whole and
+// in bands.
+//-------------------------------------------------------------------
+
+static int RunBandBenchmark(uint32_t width, uint32_t height, int count, uint32_t targetWidth, uint32_t targetHeight)
+{
+    width &= ~1u;
+    height &= ~1u;
+
+    if (width == 0 || height == 0)
+    {
+        fprintf(stderr, "--bands: bad size\n");
+        return 1;
+    }
+
+    // A gradient with a grid, so that the output can be checked by eye.
+    const size_t cbLuma = (size_t)width * height;
+    std::vector<uint8_t> i420(cbLuma * 3 / 2);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            i420[(size_t)y * width + x] = ((x & 255) == 0 || (y & 255) == 0) ? 235 : (uint8_t)(16 + (x * 200) / width);
+        }
+    }
+
+    for (size_t i = cbLuma; i < i420.size(); i++)
+    {
+        i420[i] = (i < cbLuma * 5 / 4) ? 128 - 32 : 128 + 32;
+    }
+
+    YuvImage image;
+
+    image.width = width;
+    image.height = height;
+    image.pY = &i420[0];
+    image.strideY = (int32_t)width;
+    image.pU = &i420[cbLuma];
+    image.pV = &i420[cbLuma * 5 / 4];
+    image.strideUV = (int32_t)(width / 2);
+    image.chromaStep = 1;
+    image.chromaShiftX = 1;
+    image.chromaShiftY = 1;
+    image.bTopFieldOnly = false;
+
+    const uint32_t factor = BandScaler::ChooseFactor(width, height, targetWidth, targetHeight);
+    const int32_t stride = (int32_t)(4 * width);
+
+    BandScaler scaler;
+    std::vector<uint8_t> full;
+    std::vector<uint8_t> band((size_t)stride * BAND_ROWS);
+
+    printf("bands %ux%u I420, reduced by %u\n", width, height, factor);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t cbRows = 0;
+
+        for (int j = 0; j < count; j++)
+        {
+            if (scaler.Initialize(width, height, factor) != FRAME_OK)
+            {
+                fprintf(stderr, "--bands: out of memory\n");
+                return 1;
+            }
+
+            if (pass == 0)
+            {
+                full.resize((size_t)stride * height);
+                ConvertYuvToBgra(image, YUV_MATRIX_BT709, &full[0], stride);
+                scaler.AddRows(&full[0], stride, height);
+                cbRows = full.size();
+            }
+            else
+            {
+                for (uint32_t y = 0; !scaler.IsComplete(); y += BAND_ROWS)
+                {
+                    ConvertYuvRowsToBgra(image, YUV_MATRIX_BT709, 0, y, BAND_ROWS, &band[0], stride);
+                    scaler.AddRows(&band[0], stride, BAND_ROWS);
+                }
+                cbRows = band.size();
+            }
+        }
+
+        double ms = ElapsedMs(start);
+        uint64_t cbWorking = cbRows + BandScaler::WorkingBytes(width, height, factor);
+
+        printf("  %s %ux%u  %.2f ms per frame, %.2f MB working\n", pass == 0 ? "whole frame" : "bands      ",
+            scaler.Width(), scaler.Height(), ms / count, cbWorking / (1024.0 * 1024.0));
+    }
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunTileBenchmark
+//
+// Converts and reduces a synthetic I420 frame count times on task
+// pools of increasing size.
+//-------------------------------------------------------------------
+
+static int RunTileBenchmark(uint32_t width, uint32_t height, int count, uint32_t targetWidth, uint32_t targetHeight,
+    uint32_t cMaxThreads)
+{
+    width &= ~1u;
+    height &= ~1u;
+
+    if (width == 0 || height == 0)
+    {
+        fprintf(stderr, "--tiles: bad size\n");
+        return 1;
+    }
+
+    const size_t cbLuma = (size_t)width * height;
+    std::vector<uint8_t> i420(cbLuma * 3 / 2);
+
+    for (size_t i = 0; i < i420.size(); i++)
+    {
+        i420[i] = (i < cbLuma) ? (uint8_t)(16 + (i % width) * 200 / width) : (uint8_t)(96 + (i & 63));
+    }
+
+    YuvImage image;
+
+    image.width = width;
+    image.height = height;
+    image.pY = &i420[0];
+    image.strideY = (int32_t)width;
+    image.pU = &i420[cbLuma];
+    image.pV = &i420[cbLuma * 5 / 4];
+    image.strideUV = (int32_t)(width / 2);
+    image.chromaStep = 1;
+    image.chromaShiftX = 1;
+    image.chromaShiftY = 1;
+    image.bTopFieldOnly = false;
+
+    const uint32_t factor = BandScaler::ChooseFactor(width, height, targetWidth, targetHeight);
+    const int32_t stride = (int32_t)(4 * width);
+
+    std::vector<uint8_t> bgra((size_t)stride * height);
+    BandScaler scaler;
+
+    double msConvert1 = 0;
+    double msReduce1 = 0;
+
+    printf("tiles %ux%u I420, reduced by %u\n", width, height, factor);
+
+    for (uint32_t cThreads = 1; cThreads <= cMaxThreads; cThreads = (cThreads * 2 > cMaxThreads && cThreads < cMaxThreads) ? cMaxThreads : cThreads * 2)
+    {
+        TaskPool pool;
+
+        if (!pool.Start(cThreads - 1))
+        {
+            fprintf(stderr, "--tiles: cannot start %u threads\n", cThreads);
+            return 1;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int j = 0; j < count; j++)
+        {
+            ConvertYuvToBgra(image, YUV_MATRIX_BT709, &bgra[0], stride, &pool);
+        }
+
+        double msConvert = ElapsedMs(start) / count;
+
+        start = std::chrono::steady_clock::now();
+
+        for (int j = 0; j < count; j++)
+        {
+            scaler.Initialize(width, height, factor);
+            scaler.AddRows(&bgra[0], stride, height, &pool);
+        }
+
+        double msReduce = ElapsedMs(start) / count;
+
+        if (cThreads == 1)
+        {
+            msConvert1 = msConvert;
+            msReduce1 = msReduce;
+        }
+
+        printf("  %2u threads: convert %.2f ms (%.2fx), reduce to %ux%u %.2f ms (%.2fx)\n", cThreads,
+            msConvert, msConvert1 / msConvert, scaler.Width(), scaler.Height(), msReduce, msReduce1 / msReduce);
+    }
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunAsyncBenchmark
+//
+// Reads count positions from each of cSources synthetic sources, first
+// synchronously and then with all reads in flight at once.
+//-------------------------------------------------------------------
+
+struct AsyncBenchRead
+{
+    FRAME_STATUS    status;
+    int64_t         iFrame;         // Decoded from the converted pixels.
+    uint32_t        cFramesDecoded;
+};
+
+static void ConvertRead(FrameSource *pSource, FrameView *pView, AsyncBenchRead *pRead)
+{
+    if (pRead->status == FRAME_OK)
+    {
+        pRead->status = pSource->ConvertFrame(pView);
+    }
+
+    pRead->iFrame = (pRead->status == FRAME_OK) ? SyntheticFrameSource::FrameNumberOf(pView->pData) : -1;
+}
+
+static void OnAsyncBenchRead(void *pContext, const FrameRead *pRead)
+{
+    AsyncBenchRead *pResult = (AsyncBenchRead*)pContext;
+    FrameView view = pRead->view;
+
+    pResult->status = pRead->status;
+    pResult->cFramesDecoded = pRead->cFramesDecoded;
+
+    ConvertRead(pRead->pSource, &view, pResult);
+}
+
+static int RunAsyncBenchmark(uint32_t cSources, int count, const FrameSourceCost& cost, uint32_t jitterMicroseconds)
+{
+    const int64_t cFrames = 9000;           // Five minutes at 30 frames per second.
+
+    if (cSources == 0)
+    {
+        fprintf(stderr, "--async: no sources\n");
+        return 1;
+    }
+
+    std::vector<AsyncBenchRead> serial((size_t)cSources * count);
+    std::vector<AsyncBenchRead> async((size_t)cSources * count);
+    std::vector<int64_t> positions(count);
+    uint64_t cSerialDecoded = 0;
+    uint64_t cAsyncDecoded = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        positions[i] = cFrames * 10000000 / 30 / (count + 1) * (i + 1);
+    }
+
+    printf("async %u sources, %d reads each, seek %u us, decode %u us, gop %u, jitter %u us\n",
+        cSources, count, cost.seekMicroseconds, cost.decodeMicroseconds, cost.gopLength, jitterMicroseconds);
+
+    // One source at a time, one read at a time.
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t s = 0; s < cSources; s++)
+    {
+        SyntheticFrameSource source;
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(cost, jitterMicroseconds, s + 1);
+
+        for (int i = 0; i < count; i++)
+        {
+            AsyncBenchRead *pRead = &serial[(size_t)s * count + i];
+            FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+            bool bFormatChanged = false;
+            bool bHaveFrame = false;
+            uint32_t cSkipped = 0;
+
+            pRead->cFramesDecoded = 0;
+            pRead->status = AsyncFrameReader::StartRead(&source, positions[i]);
+
+            while (pRead->status == FRAME_OK)
+            {
+                pRead->status = source.ReadFrame(&view, &bFormatChanged);
+
+                if (pRead->status != FRAME_OK)
+                {
+                    break;
+                }
+
+                ++pRead->cFramesDecoded;
+                bHaveFrame = true;
+
+                if (AsyncFrameReader::IsFrameForPosition(view, positions[i], cSkipped))
+                {
+                    break;
+                }
+                ++cSkipped;
+            }
+
+            if (pRead->status == FRAME_END_OF_STREAM && bHaveFrame)
+            {
+                pRead->status = FRAME_OK;
+            }
+
+            ConvertRead(&source, &view, pRead);
+
+            cSerialDecoded += pRead->cFramesDecoded;
+        }
+    }
+
+    double msSerial = ElapsedMs(start);
+
+    // Every read queued at once from this thread. The sources get the
+    // same seeds, so they wait for the same latencies.
+    std::vector<SyntheticFrameSource> sources(cSources);
+    std::vector<ThreadFrameReader> readers(cSources);
+
+    start = std::chrono::steady_clock::now();
+
+    for (uint32_t s = 0; s < cSources; s++)
+    {
+        sources[s].Open(320, 180, 30, 1, cFrames);
+        sources[s].SetLatency(cost, jitterMicroseconds, s + 1);
+
+        if (!readers[s].Start(&sources[s]))
+        {
+            fprintf(stderr, "--async: cannot start reader %u\n", s);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        for (uint32_t s = 0; s < cSources; s++)
+        {
+            readers[s].ReadAt(positions[i], OnAsyncBenchRead, &async[(size_t)s * count + i]);
+        }
+    }
+
+    for (uint32_t s = 0; s < cSources; s++)
+    {
+        readers[s].Drain();
+    }
+
+    double msAsync = ElapsedMs(start);
+
+    for (uint32_t s = 0; s < cSources; s++)
+    {
+        readers[s].Stop();
+    }
+
+    for (size_t i = 0; i < async.size(); i++)
+    {
+        cAsyncDecoded += async[i].cFramesDecoded;
+
+        if (async[i].status != FRAME_OK || async[i].iFrame != serial[i].iFrame)
+        {
+            fprintf(stderr, "--async: source %u read %u: frame %lld (status %d), expected %lld\n",
+                (unsigned int)(i / count), (unsigned int)(i % count), (long long)async[i].iFrame,
+                (int)async[i].status, (long long)serial[i].iFrame);
+            return 1;
+        }
+    }
+
+    printf("  synchronous: %.1f ms, %llu frames decoded\n", msSerial, (unsigned long long)cSerialDecoded);
+    printf("  asynchronous: %.1f ms, %llu frames decoded, %.2fx\n", msAsync, (unsigned long long)cAsyncDecoded,
+        msSerial / msAsync);
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunFaultTest
+//
+// Reads count positions from synthetic sources with a ReadBudget, the
+// way ThumbnailGenerator::CreateBitmapsAt does, and checks what happens
+// to a frame that fails, a frame that never arrives and a file that
+// reads too slowly. Then checks that the time a pass spends preempted
+// (see workqueue.h) is not charged to its budget.
+//-------------------------------------------------------------------
+
+struct FaultRead
+{
+    FRAME_STATUS    status;
+    bool            bTimedOut;
+    int64_t         iFrame;         // Decoded from the converted pixels.
+    double          ms;
+};
+
+static void ReadWithBudget(SyntheticFrameSource *pSource, ReadBudget *pBudget, int64_t hnsPosition, FaultRead *pRead)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    AsyncBenchRead read = { FRAME_OK, -1, 0 };
+
+    pRead->bTimedOut = false;
+
+    if (!pBudget->Begin(pSource))
+    {
+        pRead->status = FRAME_E_CANCELLED;
+        pRead->bTimedOut = true;
+    }
+    else
+    {
+        FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+        bool bFormatChanged = false;
+        bool bHaveFrame = false;
+        uint32_t cSkipped = 0;
+
+        read.status = AsyncFrameReader::StartRead(pSource, hnsPosition);
+
+        while (read.status == FRAME_OK)
+        {
+            read.status = pSource->ReadFrame(&view, &bFormatChanged);
+
+            if (read.status != FRAME_OK)
+            {
+                break;
+            }
+
+            bHaveFrame = true;
+
+            if (AsyncFrameReader::IsFrameForPosition(view, hnsPosition, cSkipped))
+            {
+                break;
+            }
+            ++cSkipped;
+        }
+
+        if (read.status == FRAME_END_OF_STREAM && bHaveFrame)
+        {
+            read.status = FRAME_OK;
+        }
+
+        // A frame that arrived just before the deadline is kept.
+        if (pBudget->End() && read.status != FRAME_OK)
+        {
+            pRead->bTimedOut = true;
+        }
+
+        ConvertRead(pSource, &view, &read);
+
+        pRead->status = read.status;
+    }
+
+    pRead->iFrame = read.iFrame;
+    pRead->ms = ElapsedMs(start);
+}
+
+static void PrintFaultReads(const std::vector<FaultRead>& reads)
+{
+    for (size_t i = 0; i < reads.size(); i++)
+    {
+        if (reads[i].bTimedOut)
+        {
+            printf("    position %u: timed out after %.1f ms\n", (unsigned int)i, reads[i].ms);
+        }
+        else if (reads[i].status != FRAME_OK)
+        {
+            printf("    position %u: status %d after %.1f ms\n", (unsigned int)i, (int)reads[i].status, reads[i].ms);
+        }
+        else
+        {
+            printf("    position %u: frame %lld in %.1f ms\n", (unsigned int)i, (long long)reads[i].iFrame, reads[i].ms);
+        }
+    }
+}
+
+// FaultPassControl: Stands in for the work that preempts a pass, which
+// takes pauseMs at each frame boundary.
+class FaultPassControl : public PassControl
+{
+    uint32_t    m_pauseMs;
+    bool        m_bPauseBudget;
+
+public:
+    FaultPassControl(uint32_t pauseMs, bool bPauseBudget) : m_pauseMs(pauseMs), m_bPauseBudget(bPauseBudget)
+    {
+    }
+
+    bool IsCancelled()
+    {
+        return false;
+    }
+
+    void AtFrameBoundary(ReadBudget *pBudget)
+    {
+        if (!m_bPauseBudget)
+        {
+            pBudget = NULL;
+        }
+
+        if (pBudget)
+        {
+            pBudget->Pause();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_pauseMs));
+
+        if (pBudget)
+        {
+            pBudget->Resume();
+        }
+    }
+};
+
+// Reads one position on another thread, the way a pipelined pass's
+// decode stage does, and pauses the budget for pauseMs after
+// pauseAfterMs.
+static void ReadAcrossPause(SyntheticFrameSource *pSource, ReadBudget *pBudget, int64_t hnsPosition,
+    uint32_t pauseAfterMs, uint32_t pauseMs, FaultRead *pRead)
+{
+    std::thread reader(ReadWithBudget, pSource, pBudget, hnsPosition, pRead);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(pauseAfterMs));
+    pBudget->Pause();
+    std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+    pBudget->Resume();
+
+    reader.join();
+}
+
+static int RunFaultTest(uint32_t positionMs, int count, const FrameSourceCost& cost)
+{
+    const int64_t cFrames = 9000;           // Five minutes at 30 frames per second.
+    const double slackMs = 100;             // For the watchdog and the scheduler.
+    const int iError = 1;                   // Positions with faults.
+    const int iHang = 3;
+
+    if (positionMs == 0 || count < iHang + 2)
+    {
+        fprintf(stderr, "--faults: needs a time limit and at least %d positions\n", iHang + 2);
+        return 1;
+    }
+
+    std::vector<int64_t> positions(count);
+    std::vector<int64_t> expected(count);
+    double readMs = 0;                      // For all the positions, without faults.
+    Watchdog watchdog;
+    int result = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        positions[i] = cFrames * 10000000 / 30 / (count + 1) * (i + 1);
+    }
+
+    if (!watchdog.Start())
+    {
+        fprintf(stderr, "--faults: cannot start the watchdog\n");
+        return 1;
+    }
+
+    printf("faults %d positions, %u ms per position, seek %u us, decode %u us, gop %u\n",
+        count, positionMs, cost.seekMicroseconds, cost.decodeMicroseconds, cost.gopLength);
+
+    // The frames that a source without faults returns.
+    {
+        SyntheticFrameSource source;
+        ReadBudget budget;
+        FaultRead read;
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(cost, 0, 1);
+        budget.StartFile();
+
+        for (int i = 0; i < count; i++)
+        {
+            ReadWithBudget(&source, &budget, positions[i], &read);
+            expected[i] = read.iFrame;
+            readMs += read.ms;
+        }
+    }
+
+    // A decode error at one position, and a hang at a later one. The
+    // faults are on the keyframes that the seeks land on, so they are
+    // the first frames read.
+    {
+        SyntheticFrameSource source;
+        TimeBudget limits;
+        ReadBudget budget;
+        std::vector<FaultRead> reads(count);
+        uint32_t gop = (cost.gopLength > 1) ? cost.gopLength : 1;
+
+        limits.positionMs = positionMs;
+        budget.Set(&watchdog, limits);
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(cost, 0, 1);
+
+        int64_t iErrorFrame = positions[iError] * 30 / 10000000;
+        int64_t iHangFrame = positions[iHang] * 30 / 10000000;
+
+        source.SetFault(iErrorFrame - iErrorFrame % gop, SYNTH_FAULT_ERROR);
+        source.SetFault(iHangFrame - iHangFrame % gop, SYNTH_FAULT_HANG);
+
+        budget.StartFile();
+
+        for (int i = 0; i < count; i++)
+        {
+            ReadWithBudget(&source, &budget, positions[i], &reads[i]);
+        }
+
+        printf("  error at position %d, hang at position %d:\n", iError, iHang);
+        PrintFaultReads(reads);
+
+        for (int i = 0; i < count; i++)
+        {
+            bool bOk;
+
+            if (i == iError)
+            {
+                bOk = !reads[i].bTimedOut && reads[i].status == FRAME_E_FORMAT;
+            }
+            else if (i == iHang)
+            {
+                bOk = reads[i].bTimedOut && reads[i].ms >= positionMs && reads[i].ms < positionMs + slackMs;
+            }
+            else if (i > iHang)
+            {
+                // The source stays cancelled.
+                bOk = reads[i].bTimedOut && reads[i].ms < slackMs;
+            }
+            else
+            {
+                bOk = !reads[i].bTimedOut && reads[i].status == FRAME_OK && reads[i].iFrame == expected[i];
+            }
+
+            if (!bOk)
+            {
+                fprintf(stderr, "--faults: position %d is wrong\n", i);
+                result = 1;
+            }
+        }
+    }
+
+    // A file that reads too slowly: each position takes a quarter of the
+    // file's time, so the read that is in flight when the time is up is
+    // cancelled, and the positions after it are not read.
+    {
+        SyntheticFrameSource source;
+        FrameSourceCost slow;
+        TimeBudget limits;
+        ReadBudget budget;
+        std::vector<FaultRead> reads(count);
+        double ms;
+        int cRead = 0;
+        int cTimedOut = 0;
+
+        slow.seekMicroseconds = positionMs * 1000 / 4;
+        slow.decodeMicroseconds = 0;
+        slow.gopLength = 1;
+
+        limits.fileMs = positionMs;
+        limits.positionMs = positionMs;
+        budget.Set(&watchdog, limits);
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(slow, 0, 1);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        budget.StartFile();
+
+        for (int i = 0; i < count; i++)
+        {
+            ReadWithBudget(&source, &budget, positions[i], &reads[i]);
+        }
+
+        ms = ElapsedMs(start);
+
+        printf("  %u ms for the file, %u ms per seek: %.1f ms in all\n", positionMs, slow.seekMicroseconds / 1000, ms);
+        PrintFaultReads(reads);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (reads[i].bTimedOut)
+            {
+                ++cTimedOut;
+            }
+            else if (reads[i].status == FRAME_OK && reads[i].iFrame == positions[i] * 30 / 10000000)
+            {
+                ++cRead;
+            }
+            else
+            {
+                fprintf(stderr, "--faults: slow file: position %d is wrong\n", i);
+                result = 1;
+            }
+        }
+
+        if (cRead == 0 || cTimedOut == 0 || ms >= positionMs + slackMs)
+        {
+            fprintf(stderr, "--faults: slow file: %d read, %d timed out in %.1f ms\n", cRead, cTimedOut, ms);
+            result = 1;
+        }
+    }
+
+    // A preempted file, with <ms> more than twice the time its reads
+    // take: the pass runs other work for half the file's time after each
+    // position. Paused, that time is not the file's, and every position
+    // is read; not paused, the file runs out of time.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const bool bPause = (pass == 0);
+        const uint32_t fileMs = positionMs + (uint32_t)(2 * readMs);
+
+        SyntheticFrameSource source;
+        TimeBudget limits;
+        ReadBudget budget;
+        FaultPassControl control(fileMs / 2, bPause);
+        std::vector<FaultRead> reads(count);
+        int cTimedOut = 0;
+
+        limits.fileMs = fileMs;
+        limits.positionMs = positionMs;
+        budget.Set(&watchdog, limits);
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(cost, 0, 1);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        budget.StartFile();
+
+        for (int i = 0; i < count; i++)
+        {
+            ReadWithBudget(&source, &budget, positions[i], &reads[i]);
+            control.AtFrameBoundary(&budget);
+        }
+
+        printf("  %u ms for the file, preempted for %u ms after each position, %s: %.1f ms in all\n",
+            fileMs, fileMs / 2, bPause ? "paused" : "not paused", ElapsedMs(start));
+        PrintFaultReads(reads);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (reads[i].bTimedOut)
+            {
+                ++cTimedOut;
+            }
+            else if (reads[i].status != FRAME_OK || reads[i].iFrame != expected[i])
+            {
+                fprintf(stderr, "--faults: preempted file: position %d is wrong\n", i);
+                result = 1;
+            }
+        }
+
+        if (bPause ? (cTimedOut != 0) : (cTimedOut == 0 || reads[0].bTimedOut))
+        {
+            fprintf(stderr, "--faults: preempted file, %s: %d timed out\n", bPause ? "paused" : "not paused",
+                cTimedOut);
+            result = 1;
+        }
+    }
+
+    // A read in flight during a pause, on another thread: a slow seek
+    // whose time, less the pause, is within the limit, and a hang.
+    {
+        SyntheticFrameSource source;
+        FrameSourceCost slow;
+        TimeBudget limits;
+        ReadBudget budget;
+        FaultRead slowRead;
+        FaultRead hungRead;
+
+        slow.seekMicroseconds = positionMs * 1500;
+        slow.decodeMicroseconds = 0;
+        slow.gopLength = 1;
+
+        limits.positionMs = positionMs;
+        budget.Set(&watchdog, limits);
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(slow, 0, 1);
+        budget.StartFile();
+
+        ReadAcrossPause(&source, &budget, positions[0], positionMs / 4, positionMs, &slowRead);
+
+        printf("  %u ms seek, paused for %u ms:\n", positionMs * 3 / 2, positionMs);
+        PrintFaultReads(std::vector<FaultRead>(1, slowRead));
+
+        if (slowRead.bTimedOut || slowRead.status != FRAME_OK || slowRead.iFrame != positions[0] * 30 / 10000000)
+        {
+            fprintf(stderr, "--faults: a slow read was cancelled while paused\n");
+            result = 1;
+        }
+
+        uint32_t gop = (cost.gopLength > 1) ? cost.gopLength : 1;
+        int64_t iHangFrame = positions[1] * 30 / 10000000;
+
+        source.Open(320, 180, 30, 1, cFrames);
+        source.SetLatency(cost, 0, 1);
+        source.SetFault(iHangFrame - iHangFrame % gop, SYNTH_FAULT_HANG);
+        budget.StartFile();
+
+        ReadAcrossPause(&source, &budget, positions[1], positionMs / 4, 2 * positionMs, &hungRead);
+
+        printf("  hang, paused for %u ms:\n", 2 * positionMs);
+        PrintFaultReads(std::vector<FaultRead>(1, hungRead));
+
+        if (!hungRead.bTimedOut || hungRead.ms < 3 * positionMs || hungRead.ms >= 3 * positionMs + slackMs)
+        {
+            fprintf(stderr, "--faults: a hang across a pause was cancelled after %.1f ms\n", hungRead.ms);
+            result = 1;
+        }
+    }
+
+    printf("  watchdog fired %llu times\n", (unsigned long long)watchdog.Fired());
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunBatchBenchmark
+//
+// Runs a batch of synthetic inputs of mixed sizes on cWorkers threads:
+// in list order from one queue, as planned by PlanBatch with the
+// default cost model, and as planned with the model fitted to the
+// first plan's times.
+//-------------------------------------------------------------------
+
+struct BatchBenchInput
+{
+    uint32_t    width;
+    uint32_t    height;
+};
+
+struct BatchBenchPass
+{
+    std::vector<BatchTask>  tasks;
+    std::vector<double>     actualMs;       // In the order the tasks finished.
+    std::vector<BatchTask>  finished;
+    double                  predictedMs;    // Makespan.
+    double                  ms;
+    uint64_t                cSteals;
+};
+
+// Opens the input, which costs one seek, and reads its positions. The
+// decode latency grows with the frame size.
+static void RunBatchBenchTask(const BatchBenchInput& input, const BatchTask& task, const std::vector<int64_t>& positions,
+    const FrameSourceCost& cost, int64_t cFrames)
+{
+    SyntheticFrameSource source;
+    FrameSourceCost scaled = cost;
+
+    scaled.decodeMicroseconds = (uint32_t)((double)cost.decodeMicroseconds * input.width * input.height / 1e6);
+
+    std::this_thread::sleep_for(std::chrono::microseconds(cost.seekMicroseconds));
+
+    source.Open(input.width, input.height, 30, 1, cFrames);
+    source.SetLatency(scaled, 0, task.iInput + 1);
+
+    for (uint32_t k = task.iFirst; k < task.iFirst + task.cPositions; k++)
+    {
+        FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+        bool bFormatChanged = false;
+        uint32_t cSkipped = 0;
+
+        FRAME_STATUS status = AsyncFrameReader::StartRead(&source, positions[k]);
+
+        while (status == FRAME_OK)
+        {
+            status = source.ReadFrame(&view, &bFormatChanged);
+
+            if (status != FRAME_OK || AsyncFrameReader::IsFrameForPosition(view, positions[k], cSkipped))
+            {
+                break;
+            }
+            ++cSkipped;
+        }
+
+        if (status == FRAME_OK)
+        {
+            source.ConvertFrame(&view);
+        }
+    }
+}
+
+static void RunBatchBenchPass(const std::vector<BatchBenchInput>& inputs, const std::vector<int64_t>& positions,
+    const FrameSourceCost& cost, int64_t cFrames, uint32_t cWorkers, bool bShared, BatchBenchPass *pPass)
+{
+    BatchQueues queues;
+    std::mutex mutex;
+    std::vector<std::thread> workers;
+
+    pPass->predictedMs = queues.Assign(pPass->tasks, bShared ? 1 : cWorkers);
+
+    if (bShared)
+    {
+        // Dealing the tasks in list order predicts a shared queue.
+        BatchQueues prediction;
+        pPass->predictedMs = prediction.Assign(pPass->tasks, cWorkers);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t w = 0; w < cWorkers; w++)
+    {
+        workers.push_back(std::thread([&, w]()
+        {
+            BatchTask task;
+
+            while (queues.Next(bShared ? 0 : w, &task))
+            {
+                std::chrono::steady_clock::time_point taskStart = std::chrono::steady_clock::now();
+
+                RunBatchBenchTask(inputs[task.iInput], task, positions, cost, cFrames);
+
+                double ms = ElapsedMs(taskStart);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                pPass->finished.push_back(task);
+                pPass->actualMs.push_back(ms);
+            }
+        }));
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+
+    pPass->ms = ElapsedMs(start);
+    pPass->cSteals = queues.Steals();
+}
+
+static void PrintBatchBenchPass(const char *szName, const BatchBenchPass& pass)
+{
+    double predictedMs = 0;
+    double actualMs = 0;
+
+    for (size_t i = 0; i < pass.finished.size(); i++)
+    {
+        predictedMs += pass.finished[i].predictedMs;
+        actualMs += pass.actualMs[i];
+    }
+
+    printf("  %-10s %3u tasks, %2llu steals: makespan %.1f ms (predicted %.1f), work %.1f ms (predicted %.1f)\n",
+        szName, (unsigned int)pass.finished.size(), (unsigned long long)pass.cSteals, pass.ms, pass.predictedMs,
+        actualMs, predictedMs);
+}
+
+static int RunBatchBenchmark(uint32_t cInputs, int count, const FrameSourceCost& cost, uint32_t cWorkers)
+{
+    const int64_t cFrames = 9000;           // Five minutes at 30 frames per second.
+
+    if (cInputs == 0 || cWorkers == 0)
+    {
+        fprintf(stderr, "--batch: no inputs or workers\n");
+        return 1;
+    }
+
+    // Mostly small inputs, with a 4K one at the end of the list, where
+    // it does the most harm.
+    std::vector<BatchBenchInput> inputs(cInputs);
+    std::vector<BatchProbe> probes(cInputs);
+    std::vector<uint32_t> positionCounts(cInputs, (uint32_t)count);
+    std::vector<int64_t> positions(count);
+
+    for (uint32_t i = 0; i < cInputs; i++)
+    {
+        BatchBenchInput& input = inputs[i];
+
+        input.width = (i == cInputs - 1) ? 3840 : (i % 3 == 0) ? 1280 : 640;
+        input.height = (i == cInputs - 1) ? 2160 : (i % 3 == 0) ? 720 : 360;
+
+        probes[i].bOk = true;
+        probes[i].hnsDuration = cFrames * 10000000 / 30;
+        probes[i].width = input.width;
+        probes[i].height = input.height;
+        probes[i].bCanSeek = true;
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        positions[k] = cFrames * 10000000 / 30 / (count + 1) * (k + 1);
+    }
+
+    printf("batch %u inputs, %d positions each, %u workers, seek %u us, decode %u us per megapixel, gop %u\n",
+        cInputs, count, cWorkers, cost.seekMicroseconds, cost.decodeMicroseconds, cost.gopLength);
+
+    BatchCostModel model;
+    BatchBenchPass fifo, planned, calibrated;
+
+    for (uint32_t i = 0; i < cInputs; i++)
+    {
+        BatchTask task = { i, 0, (uint32_t)count, model.Predict(probes[i], (uint32_t)count) };
+        fifo.tasks.push_back(task);
+    }
+
+    RunBatchBenchPass(inputs, positions, cost, cFrames, cWorkers, true, &fifo);
+    PrintBatchBenchPass("list order", fifo);
+
+    PlanBatch(probes, positionCounts, model, cWorkers, &planned.tasks);
+    RunBatchBenchPass(inputs, positions, cost, cFrames, cWorkers, false, &planned);
+    PrintBatchBenchPass("planned", planned);
+
+    std::vector<BatchCostModel::Sample> samples;
+
+    for (size_t i = 0; i < planned.finished.size(); i++)
+    {
+        BatchCostModel::Sample sample;
+
+        sample.probe = probes[planned.finished[i].iInput];
+        sample.cPositions = planned.finished[i].cPositions;
+        sample.ms = planned.actualMs[i];
+
+        samples.push_back(sample);
+    }
+
+    if (!model.Fit(samples))
+    {
+        printf("  the times of the plan do not determine the model\n");
+        return 0;
+    }
+
+    printf("  fitted model: open %.2f ms, seek %.2f ms, frame %.2f ms per megapixel\n",
+        model.openMs, model.seekMs, model.frameMs);
+
+    PlanBatch(probes, positionCounts, model, cWorkers, &calibrated.tasks);
+    RunBatchBenchPass(inputs, positions, cost, cFrames, cWorkers, false, &calibrated);
+    PrintBatchBenchPass("calibrated", calibrated);
+
+    printf("  planned %.2fx, calibrated %.2fx faster than list order\n", fifo.ms / planned.ms, fifo.ms / calibrated.ms);
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunPriorityTest
+//
+// Runs interactive requests that arrive at a steady rate on cWorkers
+// threads, once alone, and then next to a flood of bulk requests from
+// one FIFO and with priority classes (see workqueue.h). Each request
+// reads its positions from a synthetic source within a file time
+// budget, and a bulk pass makes way for interactive work between
+// positions, with its budget paused, the way the daemon's passes do
+// between frames.
+//-------------------------------------------------------------------
+
+struct LoadItem : public WorkItem
+{
+    uint32_t    width;
+    uint32_t    height;
+    int         cPositions;
+    uint32_t    seed;
+    int         phase;              // For RunShedTest.
+    uint32_t    degradations;       // Applied to the pass.
+    double      latencyMs;
+
+    LoadItem() : width(0), height(0), cPositions(0), seed(0), phase(0), degradations(DEGRADE_NONE), latencyMs(0)
+    {
+    }
+};
+
+struct LoadRun
+{
+    WorkQueue               queue;
+    FrameSourceCost         cost;
+    uint32_t                finishMicroseconds; // Scaling and encoding each thumbnail.
+    LoadShedder             *pShedder;          // Optional.
+    Watchdog                *pWatchdog;         // Optional; for budget.
+    TimeBudget              budget;             // For each pass.
+    bool                    bPauseBudget;       // While a pass is preempted.
+    std::mutex              mutex;
+    double                  positionMsMax;      // Longest read of one position.
+    uint32_t                cTimedOut[WORK_CLASSES];    // Positions.
+    std::atomic<int>        cInteractiveDone;
+
+    LoadRun() : finishMicroseconds(0), pShedder(NULL), pWatchdog(NULL), bPauseBudget(true), positionMsMax(0),
+        cInteractiveDone(0)
+    {
+        for (int c = 0; c < WORK_CLASSES; c++)
+        {
+            cTimedOut[c] = 0;
+        }
+    }
+};
+
+static void ServeLoadItem(LoadRun *pRun, LoadItem *pItem);
+
+// LoadPassControl: As DaemonPassControl, for one request.
+class LoadPassControl : public PassControl
+{
+    LoadRun     *m_pRun;
+    LoadItem    *m_pItem;
+
+public:
+    LoadPassControl(LoadRun *pRun, LoadItem *pItem) : m_pRun(pRun), m_pItem(pItem)
+    {
+    }
+
+    bool IsCancelled()
+    {
+        return m_pItem->cancel.IsCancelled();
+    }
+
+    void AtFrameBoundary(ReadBudget *pBudget)
+    {
+        WorkItem *pPreempting = NULL;
+
+        if (!m_pRun->queue.ShouldPreempt(m_pItem->workClass))
+        {
+            return;
+        }
+
+        if (!m_pRun->bPauseBudget)
+        {
+            pBudget = NULL;
+        }
+
+        if (pBudget)
+        {
+            pBudget->Pause();
+        }
+
+        while (m_pRun->queue.PopPreempting(&pPreempting, 1) > 0)
+        {
+            ServeLoadItem(m_pRun, static_cast<LoadItem*>(pPreempting));
+        }
+
+        if (pBudget)
+        {
+            pBudget->Resume();
+        }
+    }
+};
+
+static void RunLoadPass(LoadRun *pRun, LoadItem *pItem, PassControl *pControl)
+{
+    const int64_t cFrames = 9000;           // Five minutes at 30 frames per second.
+
+    SyntheticFrameSource source;
+    ReadBudget budget;
+
+    budget.Set(pRun->pWatchdog, pRun->budget);
+
+    source.Open(pItem->width, pItem->height, 30, 1, cFrames);
+    source.SetLatency(pRun->cost, 0, pItem->seed);
+    budget.StartFile();
+
+    for (int k = 0; k < pItem->cPositions && !pControl->IsCancelled(); k++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // The middle of each of cPositions equal parts, so that seeks do
+        // not all land on keyframes.
+        int64_t hnsPosition = cFrames * 10000000 / 30 * (2 * k + 1) / (2 * pItem->cPositions);
+        FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+        bool bFormatChanged = false;
+        uint32_t cSkipped = 0;
+        bool bTimedOut = !budget.Begin(&source);
+
+        FRAME_STATUS status = bTimedOut ? FRAME_E_CANCELLED : AsyncFrameReader::StartRead(&source, hnsPosition);
+
+        while (status == FRAME_OK)
+        {
+            status = source.ReadFrame(&view, &bFormatChanged);
+
+            // With keyframe seeking, the first frame after the seek is used.
+            if (status != FRAME_OK || (pItem->degradations & DEGRADE_KEYFRAME_SEEK) ||
+                AsyncFrameReader::IsFrameForPosition(view, hnsPosition, cSkipped))
+            {
+                break;
+            }
+            ++cSkipped;
+        }
+
+        if (status == FRAME_OK)
+        {
+            source.ConvertFrame(&view);
+        }
+
+        // A frame that arrived just before the deadline is kept.
+        if (!bTimedOut && budget.End() && status != FRAME_OK)
+        {
+            bTimedOut = true;
+        }
+
+        // Scaling and encoding, each half the cost, and each half as
+        // costly again when degraded.
+        if (pRun->finishMicroseconds > 0 && !bTimedOut)
+        {
+            uint32_t scaleUs = pRun->finishMicroseconds / 2;
+            uint32_t encodeUs = pRun->finishMicroseconds / 2;
+
+            std::this_thread::sleep_for(std::chrono::microseconds(
+                ((pItem->degradations & DEGRADE_FAST_SCALE) ? scaleUs / 2 : scaleUs) +
+                ((pItem->degradations & DEGRADE_FAST_ENCODE) ? encodeUs / 2 : encodeUs)));
+        }
+
+        double ms = ElapsedMs(start);
+
+        {
+            std::lock_guard<std::mutex> lock(pRun->mutex);
+            if (ms > pRun->positionMsMax)
+            {
+                pRun->positionMsMax = ms;
+            }
+            if (bTimedOut)
+            {
+                ++pRun->cTimedOut[pItem->workClass];
+            }
+        }
+
+        pControl->AtFrameBoundary(&budget);
+    }
+}
+
+static void ServeLoadItem(LoadRun *pRun, LoadItem *pItem)
+{
+    if (pRun->pShedder)
+    {
+        pItem->degradations = pRun->pShedder->StartPass(pRun->queue.Depth(), ElapsedMs(pItem->queuedAt));
+    }
+
+    if (!pItem->cancel.IsCancelled())
+    {
+        LoadPassControl control(pRun, pItem);
+
+        RunLoadPass(pRun, pItem, &control);
+    }
+
+    pItem->latencyMs = ElapsedMs(pItem->queuedAt);
+
+    pRun->queue.Completed(pItem, pItem->latencyMs);
+
+    if (pItem->workClass == WORK_INTERACTIVE)
+    {
+        ++pRun->cInteractiveDone;
+    }
+}
+
+// Runs the requests, and when the interactive ones are done, cancels
+// the bulk ones that are left. Returns the time that took to stop.
+static double RunLoad(LoadRun *pRun, std::vector<LoadItem>& bulk, std::vector<LoadItem>& interactive,
+    uint32_t intervalMs, uint32_t cWorkers)
+{
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < bulk.size(); i++)
+    {
+        pRun->queue.Push(&bulk[i]);
+    }
+
+    for (uint32_t w = 0; w < cWorkers; w++)
+    {
+        workers.push_back(std::thread([pRun]()
+        {
+            WorkItem *pItem = NULL;
+
+            while (pRun->queue.Pop(&pItem, 1) > 0)
+            {
+                ServeLoadItem(pRun, static_cast<LoadItem*>(pItem));
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < interactive.size(); i++)
+    {
+        pRun->queue.Push(&interactive[i]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    }
+
+    while (pRun->cInteractiveDone < (int)interactive.size())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < bulk.size(); i++)
+    {
+        bulk[i].cancel.Cancel();
+    }
+
+    pRun->queue.Stop();
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+
+    return ElapsedMs(start);
+}
+
+static void PrintLoadStats(const char *szName, const WorkClassStats stats[WORK_CLASSES], double stopMs)
+{
+    printf("  %-9s", szName);
+
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        if (stats[c].cQueued == 0)
+        {
+            continue;
+        }
+
+        printf(" %s: %llu done, %llu cancelled, %llu preempting, depth max %u, wait %.1f ms mean, p50 %.1f ms, "
+            "p99 %.1f ms;", WorkClassName((WORK_CLASS)c), (unsigned long long)stats[c].cCompleted,
+            (unsigned long long)stats[c].cCancelled, (unsigned long long)stats[c].cPreempting, stats[c].depthMax,
+            stats[c].cStarted ? stats[c].waitMs / (double)stats[c].cStarted : 0, stats[c].latencyP50Ms,
+            stats[c].latencyP99Ms);
+    }
+
+    printf(" stopped in %.1f ms\n", stopMs);
+}
+
+static int RunPriorityTest(uint32_t cWorkers, int count, const FrameSourceCost& cost)
+{
+    const int cInteractive = 20;
+    const uint32_t intervalMs = 50;
+
+    if (cWorkers == 0)
+    {
+        fprintf(stderr, "--priority: no workers\n");
+        return 1;
+    }
+
+    Watchdog watchdog;
+
+    if (!watchdog.Start())
+    {
+        fprintf(stderr, "--priority: cannot start the watchdog\n");
+        return 1;
+    }
+
+    // Bulk requests are larger and read four times the positions. Each
+    // file may take half as long again as a bulk pass alone.
+    TimeBudget budget;
+    double bulkMs;
+
+    {
+        LoadRun load;
+        LoadItem item;
+
+        load.cost = cost;
+
+        item.workClass = WORK_BULK;
+        item.width = 1920;
+        item.height = 1080;
+        item.cPositions = count * 4;
+        item.seed = 1;
+
+        LoadPassControl control(&load, &item);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        RunLoadPass(&load, &item, &control);
+
+        bulkMs = ElapsedMs(start);
+    }
+
+    budget.fileMs = (uint32_t)(bulkMs * 3 / 2);
+
+    printf("priority %u workers, %d interactive requests every %u ms, %u bulk requests, %d positions each, "
+        "%u ms per file\n", cWorkers, cInteractive, intervalMs, cWorkers * 4, count, budget.fileMs);
+
+    const int cRuns = 4;
+    WorkClassStats stats[cRuns][WORK_CLASSES];
+    uint32_t cTimedOut[cRuns][WORK_CLASSES];
+    double stopMs[cRuns];
+    double positionMsMax = 0;
+    const char *names[cRuns] = { "idle", "fifo", "priority", "unpaused" };
+
+    for (int run = 0; run < cRuns; run++)
+    {
+        std::vector<LoadItem> bulk((run == 0) ? 0 : cWorkers * 4);
+        std::vector<LoadItem> interactive(cInteractive);
+        LoadRun load;
+
+        load.cost = cost;
+        load.pWatchdog = &watchdog;
+        load.budget = budget;
+        load.bPauseBudget = (run != 3);
+        load.queue.SetPriority(run >= 2);
+
+        for (size_t i = 0; i < bulk.size(); i++)
+        {
+            bulk[i].workClass = WORK_BULK;
+            bulk[i].width = 1920;
+            bulk[i].height = 1080;
+            bulk[i].cPositions = count * 4;
+            bulk[i].seed = (uint32_t)i + 1;
+        }
+
+        for (size_t i = 0; i < interactive.size(); i++)
+        {
+            interactive[i].workClass = WORK_INTERACTIVE;
+            interactive[i].width = 640;
+            interactive[i].height = 360;
+            interactive[i].cPositions = count;
+            interactive[i].seed = (uint32_t)i + 1000;
+        }
+
+        stopMs[run] = RunLoad(&load, bulk, interactive, intervalMs, cWorkers);
+
+        load.queue.GetStats(stats[run]);
+        PrintLoadStats(names[run], stats[run], stopMs[run]);
+
+        for (int c = 0; c < WORK_CLASSES; c++)
+        {
+            cTimedOut[run][c] = load.cTimedOut[c];
+        }
+
+        if (load.positionMsMax > positionMsMax)
+        {
+            positionMsMax = load.positionMsMax;
+        }
+    }
+
+    const double baselineMs = stats[0][WORK_INTERACTIVE].latencyP99Ms;
+    const double priorityMs = stats[2][WORK_INTERACTIVE].latencyP99Ms;
+
+    printf("  interactive p99: %.1f ms idle, %.1f ms fifo, %.1f ms priority; longest position %.1f ms\n",
+        baselineMs, stats[1][WORK_INTERACTIVE].latencyP99Ms, priorityMs, positionMsMax);
+    printf("  bulk positions timed out: %u fifo, %u priority, %u unpaused; bulk pass alone %.1f ms\n",
+        cTimedOut[1][WORK_BULK], cTimedOut[2][WORK_BULK], cTimedOut[3][WORK_BULK], bulkMs);
+
+    // With preemption, an interactive request waits for at most one
+    // position of a bulk pass before it starts.
+    if (priorityMs > baselineMs + 2 * positionMsMax)
+    {
+        fprintf(stderr, "--priority: interactive p99 grew from %.1f ms to %.1f ms under load\n", baselineMs, priorityMs);
+        return 1;
+    }
+
+    // The time a bulk pass spends preempted is not its file's.
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        if (cTimedOut[2][c] > 0)
+        {
+            fprintf(stderr, "--priority: %u %s positions timed out\n", cTimedOut[2][c], WorkClassName((WORK_CLASS)c));
+            return 1;
+        }
+    }
+
+    // A cancelled pass stops after the position it is reading.
+    for (int run = 1; run < cRuns; run++)
+    {
+        if (stopMs[run] > 2 * positionMsMax)
+        {
+            fprintf(stderr, "--priority: %s: cancelled passes took %.1f ms to stop\n", names[run], stopMs[run]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunShedTest
+//
+// Drives cWorkers threads with requests at half their capacity, then
+// at one and a half times it, then at half again, once as they are and
+// once with a LoadShedder, and checks that shedding keeps latency down
+// under overload and gives full quality back when it ends.
+//-------------------------------------------------------------------
+
+const int SHED_PHASES = 3;
+
+struct ShedPhase
+{
+    int         cRequests;
+    int         cDegraded;
+    double      p50Ms;
+    double      p99Ms;
+};
+
+// Nearest-rank percentile, or 0 without samples.
+static double Percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    size_t rank = (size_t)(p * (double)samples.size() + 0.999999);
+
+    return samples[(rank > 0) ? rank - 1 : 0];
+}
+
+// Times one pass on its own, at a level of degradation.
+static double TimeLoadPass(const FrameSourceCost& cost, uint32_t finishMicroseconds, int count, uint32_t degradations)
+{
+    LoadRun load;
+    LoadItem item;
+
+    load.cost = cost;
+    load.finishMicroseconds = finishMicroseconds;
+
+    item.width = 640;
+    item.height = 360;
+    item.cPositions = count;
+    item.seed = 1;
+    item.degradations = degradations;
+
+    LoadPassControl control(&load, &item);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    RunLoadPass(&load, &item, &control);
+
+    return ElapsedMs(start);
+}
+
+// Returns the number of requests that were made.
+static size_t RunShedLoad(LoadRun *pRun, std::vector<LoadItem>& items, const double phaseMs[SHED_PHASES],
+    const double intervalMs[SHED_PHASES], uint32_t cWorkers, ShedPhase phases[SHED_PHASES])
+{
+    std::vector<std::thread> workers;
+    size_t cItems = 0;
+
+    for (uint32_t w = 0; w < cWorkers; w++)
+    {
+        workers.push_back(std::thread([pRun]()
+        {
+            WorkItem *pItem = NULL;
+
+            while (pRun->queue.Pop(&pItem, 1) > 0)
+            {
+                ServeLoadItem(pRun, static_cast<LoadItem*>(pItem));
+            }
+        }));
+    }
+
+    // Requests arrive at fixed intervals within each phase.
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+    for (int phase = 0; phase < SHED_PHASES; phase++)
+    {
+        std::chrono::steady_clock::time_point end = next +
+            std::chrono::microseconds((int64_t)(phaseMs[phase] * 1000));
+
+        while (next < end && cItems < items.size())
+        {
+            std::this_thread::sleep_until(next);
+
+            items[cItems].phase = phase;
+            pRun->queue.Push(&items[cItems]);
+            ++cItems;
+
+            next += std::chrono::microseconds((int64_t)(intervalMs[phase] * 1000));
+        }
+    }
+
+    pRun->queue.Stop();
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+
+    for (int phase = 0; phase < SHED_PHASES; phase++)
+    {
+        std::vector<double> latencies;
+
+        phases[phase].cDegraded = 0;
+
+        for (size_t i = 0; i < cItems; i++)
+        {
+            if (items[i].phase == phase)
+            {
+                latencies.push_back(items[i].latencyMs);
+                phases[phase].cDegraded += (items[i].degradations != DEGRADE_NONE) ? 1 : 0;
+            }
+        }
+
+        phases[phase].cRequests = (int)latencies.size();
+        phases[phase].p50Ms = Percentile(latencies, 0.50);
+        phases[phase].p99Ms = Percentile(latencies, 0.99);
+    }
+
+    return cItems;
+}
+
+static int RunShedTest(uint32_t cWorkers, int count, const FrameSourceCost& cost)
+{
+    static const char *PHASE_NAMES[SHED_PHASES] = { "normal", "overload", "recovery" };
+
+    const uint32_t finishMicroseconds = 2 * cost.decodeMicroseconds;
+
+    if (cWorkers == 0)
+    {
+        fprintf(stderr, "--shed: no workers\n");
+        return 1;
+    }
+
+    double passMs = TimeLoadPass(cost, finishMicroseconds, count, DEGRADE_NONE);
+    double keyframeMs = TimeLoadPass(cost, finishMicroseconds, count, LoadShedder::DegradationsAt(1));
+    double fastMs = TimeLoadPass(cost, finishMicroseconds, count, LoadShedder::DegradationsAt(DEGRADE_LEVELS));
+
+    // Offered load, as a share of what the workers can serve at full
+    // quality, and length of each phase, in passes.
+    const double load[SHED_PHASES] = { 0.5, 1.5, 0.5 };
+    const double passes[SHED_PHASES] = { 5, 15, 15 };
+
+    double phaseMs[SHED_PHASES];
+    double intervalMs[SHED_PHASES];
+    size_t cMaxItems = 0;
+
+    for (int phase = 0; phase < SHED_PHASES; phase++)
+    {
+        phaseMs[phase] = passes[phase] * passMs;
+        intervalMs[phase] = passMs / cWorkers / load[phase];
+        cMaxItems += (size_t)(phaseMs[phase] / intervalMs[phase]) + 1;
+    }
+
+    printf("shed %u workers, %d positions per request; pass %.1f ms, %.1f ms with keyframe seeks, %.1f ms degraded "
+        "in full\n", cWorkers, count, passMs, keyframeMs, fastMs);
+
+    if (fastMs * load[1] >= passMs)
+    {
+        fprintf(stderr, "--shed: degraded passes are not cheap enough to absorb the overload\n");
+        return 1;
+    }
+
+    ShedPhase phases[2][SHED_PHASES];
+    LoadShedStats stats;
+
+    for (int run = 0; run < 2; run++)
+    {
+        LoadRun loadRun;
+        LoadShedder shedder;
+        LoadTargets targets;
+
+        targets.queueDepth = 2 * cWorkers;
+        targets.waitMs = (uint32_t)passMs;
+        targets.holdMs = (uint32_t)(passMs / 2);
+
+        shedder.SetTargets(targets);
+
+        loadRun.cost = cost;
+        loadRun.finishMicroseconds = finishMicroseconds;
+        loadRun.pShedder = (run == 1) ? &shedder : NULL;
+
+        std::vector<LoadItem> requests(cMaxItems);
+
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            requests[i].width = 640;
+            requests[i].height = 360;
+            requests[i].cPositions = count;
+            requests[i].seed = (uint32_t)i + 1;
+        }
+
+        size_t cRequests = RunShedLoad(&loadRun, requests, phaseMs, intervalMs, cWorkers, phases[run]);
+
+        printf("  %s\n", (run == 1) ? "shedding:" : "full quality:");
+
+        for (int phase = 0; phase < SHED_PHASES; phase++)
+        {
+            printf("    %-9s %3d requests, %3d degraded, latency p50 %.1f ms, p99 %.1f ms\n", PHASE_NAMES[phase],
+                phases[run][phase].cRequests, phases[run][phase].cDegraded, phases[run][phase].p50Ms,
+                phases[run][phase].p99Ms);
+        }
+
+        if (run == 1)
+        {
+            shedder.GetStats(&stats);
+
+            printf("    level %u at the end, %u at most; raised %llu times, lowered %llu; %llu of %llu passes "
+                "degraded\n", stats.level, stats.levelMax, (unsigned long long)stats.cRaised,
+                (unsigned long long)stats.cLowered, (unsigned long long)stats.cDegradedPasses,
+                (unsigned long long)stats.cPasses);
+
+            // Full quality is back for the last third of the recovery.
+            size_t cLate = (size_t)phases[run][2].cRequests / 3;
+            int cStillDegraded = 0;
+
+            for (size_t i = cRequests - cLate; i < cRequests; i++)
+            {
+                cStillDegraded += (requests[i].degradations != DEGRADE_NONE) ? 1 : 0;
+            }
+
+            if (cStillDegraded > 0)
+            {
+                fprintf(stderr, "--shed: %d of the last %u requests were still degraded\n", cStillDegraded,
+                    (unsigned int)cLate);
+                return 1;
+            }
+        }
+    }
+
+    if (phases[1][0].cDegraded > 0)
+    {
+        fprintf(stderr, "--shed: %d requests were degraded under normal load\n", phases[1][0].cDegraded);
+        return 1;
+    }
+
+    if (stats.levelMax == 0 || phases[1][1].cDegraded == 0)
+    {
+        fprintf(stderr, "--shed: nothing was degraded under overload\n");
+        return 1;
+    }
+
+    if (phases[1][1].p99Ms >= phases[0][1].p99Ms / 2)
+    {
+        fprintf(stderr, "--shed: overload p99 was %.1f ms with shedding and %.1f ms without\n", phases[1][1].p99Ms,
+            phases[0][1].p99Ms);
+        return 1;
+    }
+
+    printf("  overload p99 %.1f ms with shedding, %.1f ms without (%.1fx)\n", phases[1][1].p99Ms, phases[0][1].p99Ms,
+        phases[0][1].p99Ms / phases[1][1].p99Ms);
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunMp4IndexTest
+//
+// Builds small MP4 files in memory and checks what Mp4SampleIndex
+// makes of them.
+//-------------------------------------------------------------------
+
+// Mp4Builder: Writes boxes into a buffer.
+class Mp4Builder
+{
+    std::vector<uint8_t>    m_data;
+    std::vector<size_t>     m_open;     // Start of each box that is not ended.
+
+public:
+    void U8(uint32_t v) { m_data.push_back((uint8_t)v); }
+    void U16(uint32_t v) { U8(v >> 8); U8(v); }
+    void U32(uint32_t v) { U16(v >> 16); U16(v); }
+    void U64(uint64_t v) { U32((uint32_t)(v >> 32)); U32((uint32_t)v); }
+    void Zeros(size_t cb) { m_data.insert(m_data.end(), cb, 0); }
+
+    void Type(const char *szType)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            U8((uint8_t)szType[i]);
+        }
+    }
+
+    void Begin(const char *szType)
+    {
+        m_open.push_back(m_data.size());
+        U32(0);
+        Type(szType);
+    }
+
+    void BeginFull(const char *szType, uint32_t version, uint32_t flags)
+    {
+        Begin(szType);
+        U32((version << 24) | flags);
+    }
+
+    void End()
+    {
+        size_t start = m_open.back();
+        m_open.pop_back();
+        Patch32(start, (uint32_t)(m_data.size() - start));
+    }
+
+    void Patch32(size_t offset, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            m_data[offset + i] = (uint8_t)(v >> (24 - 8 * i));
+        }
+    }
+
+    size_t Size() const { return m_data.size(); }
+    const std::vector<uint8_t>& Data() const { return m_data; }
+};
+
+// MemoryMp4Source: The first cbData bytes of a buffer, or a source whose
+// reads fail.
+class MemoryMp4Source : public Mp4ByteSource
+{
+    const uint8_t   *m_pData;
+    size_t          m_cbData;
+    bool            m_bFail;
+
+public:
+    MemoryMp4Source(const std::vector<uint8_t>& data, size_t cbData, bool bFail = false)
+        : m_pData(data.empty() ? NULL : &data[0]), m_cbData(cbData), m_bFail(bFail)
+    {
+    }
+
+    bool ReadAt(uint64_t offset, void *pBuffer, size_t cb)
+    {
+        if (m_bFail || offset > m_cbData || cb > m_cbData - offset)
+        {
+            return false;
+        }
+        if (cb > 0)
+        {
+            memcpy(pBuffer, m_pData + offset, cb);
+        }
+        return true;
+    }
+
+    uint64_t Size()
+    {
+        return m_cbData;
+    }
+};
+
+enum MP4_VARIANT
+{
+    MP4_PLAIN,              // stsz and stco.
+    MP4_COMPACT,            // stz2 with 4-bit sizes, and co64 past 4 GB.
+    MP4_STTS_COUNT,         // stts claims more entries than it holds.
+    MP4_STSZ_COUNT,         // stsz claims more sizes than it holds.
+    MP4_STSC_CHUNK,         // stsc names a chunk that stco does not have.
+    MP4_STSC_SHORT,         // stsc maps fewer samples than stsz has.
+    MP4_SAMPLE_COUNT,       // A fixed sample size with 2^32 - 1 samples.
+    MP4_CHILD_SIZE,         // stbl is larger than the minf around it.
+    MP4_LARGE_SIZE,         // A 64-bit box size near 2^64.
+    MP4_NO_VIDEO            // The only track is audio.
+};
+
+// The progressive test file: an audio track, then a video track of
+// MP4_SAMPLES samples at 30 units per second, in chunks of 3, 3 and 2.
+const uint32_t MP4_SAMPLES = 8;
+const uint32_t MP4_TIMESCALE = 30;
+
+static uint32_t Mp4SampleSize(MP4_VARIANT variant, uint32_t i)
+{
+    return (variant == MP4_COMPACT) ? 1 + i : 100 + i;
+}
+
+static uint64_t Mp4ChunkOffset(MP4_VARIANT variant, uint32_t chunk)
+{
+    return ((variant == MP4_COMPACT) ? 0x100000000ULL : 0) + 1000 * (chunk + 1);
+}
+
+static void WriteMp4Track(Mp4Builder *pFile, MP4_VARIANT variant, bool bVideo)
+{
+    pFile->Begin("trak");
+    pFile->BeginFull("tkhd", 0, 7);
+    pFile->Zeros(8);
+    pFile->U32(bVideo ? 1 : 2);
+    pFile->Zeros(72);
+    pFile->End();
+
+    // One empty edit of a second (in movie units), then the media from
+    // time 2, which cancels the composition offset of ctts.
+    pFile->Begin("edts");
+    pFile->BeginFull("elst", 0, 0);
+    pFile->U32(2);
+    pFile->U32(1000);
+    pFile->U32((uint32_t)-1);
+    pFile->U32(0x00010000);
+    pFile->U32(8);
+    pFile->U32(2);
+    pFile->U32(0x00010000);
+    pFile->End();
+    pFile->End();
+
+    pFile->Begin("mdia");
+    pFile->BeginFull("mdhd", 0, 0);
+    pFile->Zeros(8);
+    pFile->U32(MP4_TIMESCALE);
+    pFile->U32(10);
+    pFile->U32(0);
+    pFile->End();
+    pFile->BeginFull("hdlr", 0, 0);
+    pFile->U32(0);
+    pFile->Type(bVideo && variant != MP4_NO_VIDEO ? "vide" : "soun");
+    pFile->Zeros(13);
+    pFile->End();
+
+    pFile->Begin("minf");
+
+    size_t stbl = pFile->Size();
+
+    pFile->Begin("stbl");
+
+    pFile->BeginFull("stsd", 0, 0);
+    pFile->U32(1);
+    pFile->Begin(bVideo ? "avc1" : "mp4a");
+    pFile->Zeros(6 + 2 + 16);
+    pFile->U16(320);
+    pFile->U16(240);
+    pFile->Zeros(50);
+    pFile->End();
+    pFile->End();
+
+    // Durations of 1, and of 2 for the last two samples.
+    pFile->BeginFull("stts", 0, 0);
+    pFile->U32((variant == MP4_STTS_COUNT) ? 0x10000000 : 2);
+    pFile->U32(6);
+    pFile->U32(1);
+    pFile->U32(2);
+    pFile->U32(2);
+    pFile->End();
+
+    pFile->BeginFull("ctts", 0, 0);
+    pFile->U32(1);
+    pFile->U32(MP4_SAMPLES);
+    pFile->U32(2);
+    pFile->End();
+
+    // Samples 1 and 6 are keyframes.
+    pFile->BeginFull("stss", 0, 0);
+    pFile->U32(2);
+    pFile->U32(1);
+    pFile->U32(6);
+    pFile->End();
+
+    pFile->BeginFull("stsc", 0, 0);
+    pFile->U32((variant == MP4_STSC_SHORT) ? 1 : 2);
+    pFile->U32(1);
+    pFile->U32((variant == MP4_STSC_SHORT) ? 2 : 3);
+    pFile->U32(1);
+    if (variant != MP4_STSC_SHORT)
+    {
+        pFile->U32((variant == MP4_STSC_CHUNK) ? 5 : 3);
+        pFile->U32(2);
+        pFile->U32(1);
+    }
+    pFile->End();
+
+    if (variant == MP4_COMPACT)
+    {
+        pFile->BeginFull("stz2", 0, 0);
+        pFile->U32(4);      // 24 reserved bits, then the field size.
+        pFile->U32(MP4_SAMPLES);
+        for (uint32_t i = 0; i < MP4_SAMPLES; i += 2)
+        {
+            pFile->U8((Mp4SampleSize(variant, i) << 4) | Mp4SampleSize(variant, i + 1));
+        }
+        pFile->End();
+
+        pFile->BeginFull("co64", 0, 0);
+        pFile->U32(3);
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            pFile->U64(Mp4ChunkOffset(variant, c));
+        }
+        pFile->End();
+    }
+    else
+    {
+        pFile->BeginFull("stsz", 0, 0);
+        if (variant == MP4_SAMPLE_COUNT)
+        {
+            pFile->U32(1);
+            pFile->U32(0xFFFFFFFF);
+        }
+        else
+        {
+            pFile->U32(0);
+            pFile->U32((variant == MP4_STSZ_COUNT) ? 1000 : MP4_SAMPLES);
+            for (uint32_t i = 0; i < MP4_SAMPLES; i++)
+            {
+                pFile->U32(Mp4SampleSize(variant, i));
+            }
+        }
+        pFile->End();
+
+        pFile->BeginFull("stco", 0, 0);
+        pFile->U32(3);
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            pFile->U32((uint32_t)Mp4ChunkOffset(variant, c));
+        }
+        pFile->End();
+    }
+
+    pFile->End();   // stbl
+
+    if (variant == MP4_CHILD_SIZE && bVideo)
+    {
+        pFile->Patch32(stbl, (uint32_t)(pFile->Size() - stbl) + 0x1000);
+    }
+
+    pFile->End();   // minf
+    pFile->End();   // mdia
+    pFile->End();   // trak
+}
+
+// Writes the progressive test file, and returns the end of moov.
+static size_t WriteMp4File(Mp4Builder *pFile, MP4_VARIANT variant)
+{
+    pFile->Begin("ftyp");
+    pFile->Type("isom");
+    pFile->U32(0);
+    pFile->Type("isom");
+    pFile->End();
+
+    pFile->Begin("moov");
+    pFile->BeginFull("mvhd", 0, 0);
+    pFile->Zeros(8);
+    pFile->U32(1000);
+    pFile->Zeros(84);
+    pFile->End();
+
+    if (variant == MP4_LARGE_SIZE)
+    {
+        pFile->U32(1);
+        pFile->Type("free");
+        pFile->U64(0xFFFFFFFFFFFFFFF0ULL);
+    }
+
+    if (variant != MP4_NO_VIDEO)
+    {
+        WriteMp4Track(pFile, variant, false);
+    }
+    WriteMp4Track(pFile, variant, true);
+    pFile->End();
+
+    size_t cbMoov = pFile->Size();
+
+    pFile->Begin("mdat");
+    pFile->Zeros(64);
+    pFile->End();
+
+    return cbMoov;
+}
+
+// Checks the index of the progressive test file.
+static bool CheckMp4Plain(const Mp4SampleIndex& index, MP4_VARIANT variant, const char *szName)
+{
+    if (index.trackId != 1 || index.timescale != MP4_TIMESCALE || index.codec != 0x61766331 /* avc1 */ ||
+        index.width != 320 || index.height != 240 || index.bFragmented || index.samples.size() != MP4_SAMPLES)
+    {
+        fprintf(stderr, "--mp4index: %s: wrong track (id %u, %u samples)\n", szName, index.trackId,
+            (unsigned int)index.samples.size());
+        return false;
+    }
+
+    uint64_t offset = 0;
+
+    for (uint32_t i = 0; i < MP4_SAMPLES; i++)
+    {
+        const Mp4Sample& sample = index.samples[i];
+
+        int64_t dts = (i <= 6) ? i : 6 + 2 * (i - 6);
+
+        offset = (i % 3 == 0) ? Mp4ChunkOffset(variant, i / 3) : offset + Mp4SampleSize(variant, i - 1);
+
+        // The empty edit delays presentation by one second.
+        if (sample.size != Mp4SampleSize(variant, i) || sample.offset != offset || sample.dts != dts ||
+            sample.pts != dts + MP4_TIMESCALE || sample.bSync != (i == 0 || i == 5))
+        {
+            fprintf(stderr, "--mp4index: %s: sample %u is wrong\n", szName, i);
+            return false;
+        }
+    }
+
+    size_t iSync = 0;
+
+    if (index.SyncSampleCount() != 2 || index.FindSyncSample(index.ToHns(MP4_TIMESCALE - 1), &iSync) ||
+        !index.FindSyncSample(index.ToHns(MP4_TIMESCALE + 4), &iSync) || iSync != 0 ||
+        !index.FindSyncSample(index.ToHns(MP4_TIMESCALE + 5), &iSync) || iSync != 5)
+    {
+        fprintf(stderr, "--mp4index: %s: wrong sync samples\n", szName);
+        return false;
+    }
+
+    return true;
+}
+
+// Fragmented test file: an empty sample table, trex defaults, and two
+// movie fragments.
+enum MP4_FRAGMENT_VARIANT
+{
+    MP4_FRAGMENTS,
+    MP4_TRUN_COUNT          // trun claims more samples than it holds.
+};
+
+struct Mp4FragmentLayout
+{
+    uint64_t    moof1;
+    uint64_t    data1;
+    uint64_t    moof2;
+};
+
+static void WriteMp4Fragments(Mp4Builder *pFile, MP4_FRAGMENT_VARIANT variant, Mp4FragmentLayout *pLayout)
+{
+    pFile->Begin("ftyp");
+    pFile->Type("iso6");
+    pFile->U32(0);
+    pFile->End();
+
+    pFile->Begin("moov");
+    pFile->BeginFull("mvhd", 0, 0);
+    pFile->Zeros(8);
+    pFile->U32(1000);
+    pFile->Zeros(84);
+    pFile->End();
+
+    pFile->Begin("trak");
+    pFile->BeginFull("tkhd", 0, 7);
+    pFile->Zeros(8);
+    pFile->U32(1);
+    pFile->Zeros(72);
+    pFile->End();
+    pFile->Begin("mdia");
+    pFile->BeginFull("mdhd", 0, 0);
+    pFile->Zeros(8);
+    pFile->U32(90000);
+    pFile->Zeros(8);
+    pFile->End();
+    pFile->BeginFull("hdlr", 0, 0);
+    pFile->U32(0);
+    pFile->Type("vide");
+    pFile->Zeros(13);
+    pFile->End();
+    pFile->Begin("minf");
+    pFile->Begin("stbl");
+    pFile->BeginFull("stsd", 0, 0);
+    pFile->U32(1);
+    pFile->Begin("hvc1");
+    pFile->Zeros(6 + 2 + 16);
+    pFile->U16(1280);
+    pFile->U16(720);
+    pFile->Zeros(50);
+    pFile->End();
+    pFile->End();
+    const char *szEmpty[] = { "stts", "stsc", "stco" };
+    for (int i = 0; i < 3; i++)
+    {
+        pFile->BeginFull(szEmpty[i], 0, 0);
+        pFile->U32(0);
+        pFile->End();
+    }
+    pFile->BeginFull("stsz", 0, 0);
+    pFile->U32(0);
+    pFile->U32(0);
+    pFile->End();
+    pFile->End();   // stbl
+    pFile->End();   // minf
+    pFile->End();   // mdia
+    pFile->End();   // trak
+
+    // Samples last 3000 units, are 500 bytes and are not keyframes,
+    // unless a fragment says otherwise.
+    pFile->Begin("mvex");
+    pFile->BeginFull("trex", 0, 0);
+    pFile->U32(1);
+    pFile->U32(1);
+    pFile->U32(3000);
+    pFile->U32(500);
+    pFile->U32(0x00010000);
+    pFile->End();
+    pFile->End();
+    pFile->End();   // moov
+
+    // First fragment: three samples of track 1 from 1 second, with their
+    // own sizes and composition offsets, and a keyframe first; then two
+    // samples of another track, which are skipped.
+    pLayout->moof1 = pFile->Size();
+
+    pFile->Begin("moof");
+    pFile->BeginFull("mfhd", 0, 0);
+    pFile->U32(1);
+    pFile->End();
+
+    pFile->Begin("traf");
+    pFile->BeginFull("tfhd", 0, 0x020000);
+    pFile->U32(1);
+    pFile->End();
+    pFile->BeginFull("tfdt", 1, 0);
+    pFile->U64(90000);
+    pFile->End();
+    pFile->BeginFull("trun", 0, 0x000001 | 0x000004 | 0x000200 | 0x000800);
+    pFile->U32((variant == MP4_TRUN_COUNT) ? 0x40000000 : 3);
+
+    size_t dataOffset = pFile->Size();
+
+    pFile->U32(0);
+    pFile->U32(0x02000000);     // sample_depends_on = 2: a keyframe.
+    pFile->U32(10);
+    pFile->U32(3000);
+    pFile->U32(20);
+    pFile->U32(0);
+    pFile->U32(30);
+    pFile->U32(6000);
+    pFile->End();
+    pFile->End();   // traf
+
+    pFile->Begin("traf");
+    pFile->BeginFull("tfhd", 0, 0x020000);
+    pFile->U32(2);
+    pFile->End();
+    pFile->BeginFull("trun", 0, 0x000200);
+    pFile->U32(2);
+    pFile->U32(7);
+    pFile->U32(7);
+    pFile->End();
+    pFile->End();   // traf
+    pFile->End();   // moof
+
+    pLayout->data1 = pFile->Size() + 8;
+    pFile->Patch32(dataOffset, (uint32_t)(pLayout->data1 - pLayout->moof1));
+
+    pFile->Begin("mdat");
+    pFile->Zeros(10 + 20 + 30 + 14);
+    pFile->End();
+
+    // Second fragment: two samples with the default size from trex, and
+    // a duration from tfhd. Without a data offset, the data starts at
+    // the moof.
+    pLayout->moof2 = pFile->Size();
+
+    pFile->Begin("moof");
+    pFile->BeginFull("mfhd", 0, 0);
+    pFile->U32(2);
+    pFile->End();
+    pFile->Begin("traf");
+    pFile->BeginFull("tfhd", 0, 0x000008);
+    pFile->U32(1);
+    pFile->U32(1500);
+    pFile->End();
+    pFile->BeginFull("trun", 0, 0);
+    pFile->U32(2);
+    pFile->End();
+    pFile->End();   // traf
+    pFile->End();   // moof
+
+    pFile->Begin("mdat");
+    pFile->Zeros(1000);
+    pFile->End();
+}
+
+static bool CheckMp4Fragments(const Mp4SampleIndex& index, const Mp4FragmentLayout& layout)
+{
+    struct Expected
+    {
+        uint64_t    offset;
+        uint32_t    size;
+        bool        bSync;
+        int64_t     dts;
+        int64_t     pts;
+    };
+
+    const Expected expected[] =
+    {
+        { layout.data1,         10,  true,  90000,  93000 },
+        { layout.data1 + 10,    20,  false, 93000,  93000 },
+        { layout.data1 + 30,    30,  false, 96000,  102000 },
+        { layout.moof2,         500, false, 99000,  99000 },
+        { layout.moof2 + 500,   500, false, 100500, 100500 },
+    };
+
+    const size_t cExpected = sizeof(expected) / sizeof(expected[0]);
+
+    if (index.trackId != 1 || index.timescale != 90000 || index.codec != 0x68766331 /* hvc1 */ ||
+        index.width != 1280 || index.height != 720 || !index.bFragmented || index.samples.size() != cExpected)
+    {
+        fprintf(stderr, "--mp4index: fragments: wrong track (id %u, %u samples)\n", index.trackId,
+            (unsigned int)index.samples.size());
+        return false;
+    }
+
+    for (size_t i = 0; i < cExpected; i++)
+    {
+        const Mp4Sample& sample = index.samples[i];
+
+        if (sample.offset != expected[i].offset || sample.size != expected[i].size ||
+            sample.bSync != expected[i].bSync || sample.dts != expected[i].dts || sample.pts != expected[i].pts)
+        {
+            fprintf(stderr, "--mp4index: fragments: sample %u is wrong\n", (unsigned int)i);
+            return false;
+        }
+    }
+
+    size_t iSync = 1;
+
+    if (index.ToHns(90000) != 10000000 || !index.FindSyncSample(index.ToHns(102000), &iSync) || iSync != 0)
+    {
+        fprintf(stderr, "--mp4index: fragments: wrong sync samples\n");
+        return false;
+    }
+
+    return true;
+}
+
+static int RunMp4IndexTest()
+{
+    static const struct
+    {
+        MP4_VARIANT     variant;
+        const char      *szName;
+        MP4_STATUS      expected;
+    } cases[] =
+    {
+        { MP4_PLAIN,        "stsz/stco",                MP4_OK },
+        { MP4_COMPACT,      "stz2/co64",                MP4_OK },
+        { MP4_STTS_COUNT,   "stts count",               MP4_E_FORMAT },
+        { MP4_STSZ_COUNT,   "stsz count",               MP4_E_FORMAT },
+        { MP4_STSC_CHUNK,   "stsc chunk",               MP4_E_FORMAT },
+        { MP4_STSC_SHORT,   "short stsc",               MP4_E_FORMAT },
+        { MP4_SAMPLE_COUNT, "sample count",             MP4_E_OUT_OF_MEMORY },
+        { MP4_CHILD_SIZE,   "child larger than parent", MP4_E_FORMAT },
+        { MP4_LARGE_SIZE,   "64-bit box size",          MP4_E_FORMAT },
+        { MP4_NO_VIDEO,     "no video track",           MP4_E_NO_VIDEO },
+    };
+
+    int result = 0;
+    int cChecks = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        Mp4Builder file;
+        Mp4SampleIndex index;
+
+        WriteMp4File(&file, cases[c].variant);
+
+        MemoryMp4Source source(file.Data(), file.Size());
+        MP4_STATUS status = index.Build(&source);
+
+        if (status != cases[c].expected)
+        {
+            fprintf(stderr, "--mp4index: %s: status %d, expected %d\n", cases[c].szName, (int)status,
+                (int)cases[c].expected);
+            result = 1;
+        }
+        else if (status == MP4_OK && !CheckMp4Plain(index, cases[c].variant, cases[c].szName))
+        {
+            result = 1;
+        }
+        ++cChecks;
+    }
+
+    // Fragments.
+    {
+        Mp4Builder file;
+        Mp4FragmentLayout layout;
+        Mp4SampleIndex index;
+
+        WriteMp4Fragments(&file, MP4_FRAGMENTS, &layout);
+
+        MemoryMp4Source source(file.Data(), file.Size());
+        MP4_STATUS status = index.Build(&source);
+
+        if (status != MP4_OK)
+        {
+            fprintf(stderr, "--mp4index: fragments: status %d\n", (int)status);
+            result = 1;
+        }
+        else if (!CheckMp4Fragments(index, layout))
+        {
+            result = 1;
+        }
+
+        Mp4Builder bad;
+
+        WriteMp4Fragments(&bad, MP4_TRUN_COUNT, &layout);
+
+        MemoryMp4Source badSource(bad.Data(), bad.Size());
+
+        if (index.Build(&badSource) != MP4_E_FORMAT)
+        {
+            fprintf(stderr, "--mp4index: trun count: not rejected\n");
+            result = 1;
+        }
+        cChecks += 2;
+    }
+
+    // Not MP4 at all, and a source that cannot be read.
+    {
+        const char szPng[] = "\x89PNG\r\n\x1a\n\0\0\0\x0dIHDR";
+        std::vector<uint8_t> png(szPng, szPng + sizeof(szPng) - 1);
+        std::vector<uint8_t> empty;
+        Mp4Builder file;
+        Mp4SampleIndex index;
+
+        WriteMp4File(&file, MP4_PLAIN);
+
+        MemoryMp4Source pngSource(png, png.size());
+        MemoryMp4Source emptySource(empty, 0);
+        MemoryMp4Source failSource(file.Data(), file.Size(), true);
+
+        if (index.Build(&pngSource) != MP4_E_FORMAT || index.Build(&emptySource) != MP4_E_FORMAT ||
+            index.Build(&failSource) != MP4_E_READ)
+        {
+            fprintf(stderr, "--mp4index: a PNG, an empty file or a failed read was not rejected\n");
+            result = 1;
+        }
+        cChecks += 3;
+    }
+
+    // Every truncation of each test file: one that cuts into moov fails
+    // with a status, and one that only cuts into the last mdat is
+    // tolerated. Then every byte of moov is corrupted in turn; whatever
+    // the status, Build must not read outside its buffers.
+    {
+        Mp4Builder file;
+        Mp4Builder fragments;
+        Mp4FragmentLayout layout;
+        Mp4SampleIndex index;
+
+        size_t cbMoov = WriteMp4File(&file, MP4_PLAIN);
+
+        WriteMp4Fragments(&fragments, MP4_FRAGMENTS, &layout);
+
+        for (size_t cb = 0; cb < file.Size(); cb++)
+        {
+            MemoryMp4Source source(file.Data(), cb);
+            MP4_STATUS status = index.Build(&source);
+
+            if ((cb < cbMoov) ? (status == MP4_OK) : (status != MP4_OK || !CheckMp4Plain(index, MP4_PLAIN, "truncated")))
+            {
+                fprintf(stderr, "--mp4index: truncated to %u bytes: status %d\n", (unsigned int)cb, (int)status);
+                result = 1;
+                break;
+            }
+            ++cChecks;
+        }
+
+        for (size_t cb = 0; cb < fragments.Size(); cb++)
+        {
+            MemoryMp4Source source(fragments.Data(), cb);
+
+            index.Build(&source);
+            ++cChecks;
+        }
+
+        std::vector<uint8_t> corrupt(file.Data());
+
+        for (size_t i = 0; i < cbMoov; i++)
+        {
+            static const uint8_t values[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+
+            for (size_t v = 0; v < sizeof(values); v++)
+            {
+                uint8_t saved = corrupt[i];
+
+                corrupt[i] = values[v];
+
+                MemoryMp4Source source(corrupt, corrupt.size());
+                index.Build(&source);
+
+                corrupt[i] = saved;
+                ++cChecks;
+            }
+        }
+    }
+
+    printf("mp4index: %d checks in %.1f ms: %s\n", cChecks, ElapsedMs(start), result ? "FAILED" : "passed");
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunRangeCacheTest
+//
+// Checks RangeCache against a slow source that counts its round trips.
+//-------------------------------------------------------------------
+
+// The byte at an offset of the test source.
+static uint8_t RangeByte(uint64_t offset)
+{
+    return (uint8_t)((offset * 2654435761ULL) >> 13);
+}
+
+// CountingRangeSource: Pseudo-random bytes that cost a round trip per
+// read. Reads past the end, or at failOffset, fail.
+class CountingRangeSource : public RangeSource
+{
+public:
+    uint64_t    cbSize;
+    uint32_t    latencyMicroseconds;
+    uint64_t    failOffset;         // UINT64_MAX: never fail.
+    uint64_t    cReads;
+    uint64_t    cbRead;
+    bool        bOutOfRange;        // A read went past the end.
+
+    CountingRangeSource(uint64_t cbFile, uint32_t latency)
+        : cbSize(cbFile), latencyMicroseconds(latency), failOffset(UINT64_MAX), cReads(0), cbRead(0),
+          bOutOfRange(false)
+    {
+    }
+
+    bool ReadAt(uint64_t offset, void *pBuffer, size_t cb)
+    {
+        ++cReads;
+        cbRead += cb;
+
+        if (latencyMicroseconds)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(latencyMicroseconds));
+        }
+
+        if (offset > cbSize || cb > cbSize - offset)
+        {
+            bOutOfRange = true;
+            return false;
+        }
+
+        if (failOffset >= offset && failOffset < offset + cb)
+        {
+            return false;
+        }
+
+        uint8_t *pOut = (uint8_t*)pBuffer;
+
+        for (size_t i = 0; i < cb; i++)
+        {
+            pOut[i] = RangeByte(offset + i);
+        }
+        return true;
+    }
+};
+
+// Reads through the cache and checks the bytes and the length.
+static bool CheckRangeRead(RangeCache *pCache, uint64_t offset, size_t cb, const char *szWhat)
+{
+    std::vector<uint8_t> buffer(cb + 1, 0xCC);
+    size_t cbRead = 0;
+
+    uint64_t cbExpected = (offset >= pCache->Size()) ? 0 : pCache->Size() - offset;
+
+    cbExpected = (cb < cbExpected) ? cb : cbExpected;
+
+    if (!pCache->Read(offset, &buffer[0], cb, &cbRead))
+    {
+        fprintf(stderr, "--rangecache: %s: read of %u bytes at %llu failed\n", szWhat, (unsigned int)cb,
+            (unsigned long long)offset);
+        return false;
+    }
+
+    if (cbRead != cbExpected || buffer[cb] != 0xCC)
+    {
+        fprintf(stderr, "--rangecache: %s: read of %u bytes at %llu returned %u bytes\n", szWhat, (unsigned int)cb,
+            (unsigned long long)offset, (unsigned int)cbRead);
+        return false;
+    }
+
+    for (size_t i = 0; i < cbRead; i++)
+    {
+        if (buffer[i] != RangeByte(offset + i))
+        {
+            fprintf(stderr, "--rangecache: %s: byte %llu is wrong\n", szWhat, (unsigned long long)(offset + i));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks the number of round trips since the last check.
+static bool CheckFetches(CountingRangeSource *pSource, uint64_t *pcLast, uint64_t cExpected, const char *szWhat)
+{
+    uint64_t cFetches = pSource->cReads - *pcLast;
+
+    *pcLast = pSource->cReads;
+
+    if (cFetches != cExpected)
+    {
+        fprintf(stderr, "--rangecache: %s: %llu round trips, expected %llu\n", szWhat, (unsigned long long)cFetches,
+            (unsigned long long)cExpected);
+        return false;
+    }
+    return true;
+}
+
+static int RunRangeCacheTest(uint32_t latencyMicroseconds)
+{
+    // 24 full blocks and a short last one.
+    const uint32_t cbBlock = 4096;
+    const uint64_t cbFile = 24 * cbBlock + 1696;
+    const uint64_t cBlocksInFile = 25;
+
+    RangeCacheConfig config;
+    config.cbBlock = cbBlock;
+    config.cBlocks = 8;
+    config.cReadAheadBlocks = 4;
+
+    int result = 0;
+    uint64_t cLast = 0;
+
+    // Configurations that Initialize refuses.
+    {
+        CountingRangeSource source(cbFile, 0);
+        RangeCache cache;
+        RangeCacheConfig bad = config;
+
+        bad.cbBlock = 1024;
+        bool bSmall = cache.Initialize(&source, cbFile, bad);
+        bad = config;
+        bad.cBlocks = 0;
+        bool bEmpty = cache.Initialize(&source, cbFile, bad);
+
+        if (bSmall || bEmpty || cache.Initialize(NULL, cbFile, config))
+        {
+            fprintf(stderr, "--rangecache: a bad configuration was accepted\n");
+            result = 1;
+        }
+    }
+
+    // Round trips for each access pattern, with no latency.
+    {
+        CountingRangeSource source(cbFile, 0);
+        RangeCache cache;
+
+        cache.Initialize(&source, cbFile, config);
+
+        // A cold read of three blocks is one round trip, with four
+        // blocks of read-ahead; the read-ahead then serves the next
+        // reads without any.
+        bool bOk = CheckRangeRead(&cache, 0, 3 * cbBlock, "cold read") &&
+            CheckFetches(&source, &cLast, 1, "cold read") && source.cbRead == 7 * cbBlock &&
+            CheckRangeRead(&cache, 3 * cbBlock + 100, 4 * cbBlock - 200, "read-ahead") &&
+            CheckFetches(&source, &cLast, 0, "read-ahead");
+
+        // A read that starts in cached blocks (5 and 6) and runs into
+        // missing ones (7 and 8) fetches the missing run, with its
+        // read-ahead, in one round trip.
+        bOk = bOk && CheckRangeRead(&cache, 5 * cbBlock, 3 * cbBlock + 10, "mixed read") &&
+            CheckFetches(&source, &cLast, 1, "mixed read");
+
+        // Small sequential reads, the way a demuxer reads headers and
+        // packets: one round trip per five blocks.
+        cache.Clear();
+
+        for (uint64_t pos = 0; bOk && pos < cbFile; pos += 1000)
+        {
+            bOk = CheckRangeRead(&cache, pos, 1000, "sequential");
+        }
+
+        bOk = bOk && CheckFetches(&source, &cLast, (cBlocksInFile + 4) / 5, "sequential");
+
+        // The last block is short, and reads at and past the end are
+        // clipped without touching the source.
+        bOk = bOk && CheckRangeRead(&cache, cbFile - 10, 100, "end") &&
+            CheckRangeRead(&cache, cbFile, 100, "past the end") &&
+            CheckRangeRead(&cache, cbFile + 12345, 1, "far past the end") &&
+            CheckRangeRead(&cache, 0, 0, "empty") &&
+            CheckFetches(&source, &cLast, 0, "end");
+
+        // Eight blocks are kept: after reading 16 more, the first block
+        // is gone and costs a round trip again.
+        cache.Clear();
+
+        for (uint64_t block = 0; bOk && block < 17; block++)
+        {
+            bOk = CheckRangeRead(&cache, block * cbBlock, 16, "eviction");
+        }
+        cLast = source.cReads;
+
+        bOk = bOk && CheckRangeRead(&cache, 16 * cbBlock + 8, 16, "most recent block") &&
+            CheckFetches(&source, &cLast, 0, "most recent block") &&
+            CheckRangeRead(&cache, 0, 16, "evicted block") &&
+            CheckFetches(&source, &cLast, 1, "evicted block");
+
+        // A read larger than the cache goes straight to the caller in
+        // one round trip, and is not cached.
+        cache.Clear();
+
+        bOk = bOk && CheckRangeRead(&cache, 10, 10 * cbBlock, "large read") &&
+            CheckFetches(&source, &cLast, 1, "large read") &&
+            CheckRangeRead(&cache, 20, 16, "after a large read") &&
+            CheckFetches(&source, &cLast, 1, "after a large read");
+
+        if (!bOk || source.bOutOfRange)
+        {
+            if (source.bOutOfRange)
+            {
+                fprintf(stderr, "--rangecache: the cache read past the end of the source\n");
+            }
+            result = 1;
+        }
+    }
+
+    // A failed fetch fails the read and caches nothing; the same read
+    // succeeds once the source recovers.
+    {
+        CountingRangeSource source(cbFile, 0);
+        RangeCache cache;
+        uint8_t buffer[64];
+        size_t cbRead = 1;
+
+        cache.Initialize(&source, cbFile, config);
+
+        source.failOffset = 5 * cbBlock + 1;
+
+        if (cache.Read(5 * cbBlock, buffer, sizeof(buffer), &cbRead))
+        {
+            fprintf(stderr, "--rangecache: a failed fetch was not reported\n");
+            result = 1;
+        }
+
+        source.failOffset = UINT64_MAX;
+
+        if (!CheckRangeRead(&cache, 5 * cbBlock, sizeof(buffer), "after a failure"))
+        {
+            result = 1;
+        }
+    }
+
+    // Random reads against the source's own bytes.
+    {
+        CountingRangeSource source(cbFile, 0);
+        RangeCache cache;
+        uint32_t seed = 12345;
+
+        cache.Initialize(&source, cbFile, config);
+
+        for (int i = 0; i < 5000 && result == 0; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint64_t offset = (seed >> 8) % (cbFile + 100);
+            seed = seed * 1103515245 + 12345;
+            size_t cb = (size_t)((seed >> 8) % ((i % 10 == 0) ? 12 * cbBlock : 3000));
+
+            if (!CheckRangeRead(&cache, offset, cb, "random"))
+            {
+                result = 1;
+            }
+        }
+
+        if (source.bOutOfRange)
+        {
+            fprintf(stderr, "--rangecache: the cache read past the end of the source\n");
+            result = 1;
+        }
+    }
+
+    // Time a demuxer-like pattern with a round-trip latency: a seek to
+    // each of 10 positions, then 40 reads of 400 bytes from there.
+    if (result == 0)
+    {
+        CountingRangeSource direct(cbFile, latencyMicroseconds);
+        CountingRangeSource cached(cbFile, latencyMicroseconds);
+        RangeCache cache;
+        std::vector<uint8_t> buffer(400);
+        int cReads = 0;
+
+        cache.Initialize(&cached, cbFile, config);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (uint64_t seek = 0; seek < 10; seek++)
+            {
+                for (uint64_t k = 0; k < 40; k++)
+                {
+                    uint64_t offset = seek * cbFile / 10 + k * 400;
+
+                    if (pass == 0)
+                    {
+                        direct.ReadAt(offset, &buffer[0], buffer.size());
+                        ++cReads;
+                    }
+                    else
+                    {
+                        size_t cbRead = 0;
+                        cache.Read(offset, &buffer[0], buffer.size(), &cbRead);
+                    }
+                }
+            }
+
+            if (pass == 0)
+            {
+                double directMs = ElapsedMs(start);
+
+                start = std::chrono::steady_clock::now();
+                printf("rangecache: %d reads of %u bytes, %u us per round trip: %llu round trips, %.1f ms direct\n",
+                    cReads, (unsigned int)buffer.size(), latencyMicroseconds, (unsigned long long)direct.cReads,
+                    directMs);
+            }
+        }
+
+        const RangeCacheStats& stats = cache.Stats();
+
+        printf("rangecache: %llu round trips, %.1f ms through the cache (%llu block hits, %.1f KB fetched)\n",
+            (unsigned long long)cached.cReads, ElapsedMs(start), (unsigned long long)stats.cBlockHits,
+            stats.cbFetched / 1024.0);
+
+        if (cached.cReads * 10 > direct.cReads || stats.cFetches != cached.cReads)
+        {
+            fprintf(stderr, "--rangecache: the cache saved too few round trips\n");
+            result = 1;
+        }
+    }
+
+    if (result == 0)
+    {
+        printf("rangecache: passed\n");
+    }
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunBenchmark
+//-------------------------------------------------------------------
+
+static int RunBenchmark(FrameSource *pSource, const char *szPath, int count)
+{
+    FrameFormat format;
+    BenchResult sequential = { 0, 0, 0 };
+    BenchResult thumbnails = { 0, 0, 0 };
+
+    FRAME_STATUS status = pSource->GetFormat(&format);
+
+    if (status == FRAME_OK)
+    {
+        status = DecodeAll(pSource, &sequential);
+    }
+
+    if (status == FRAME_OK)
+    {
+        status = TakeThumbnails(pSource, count, &thumbnails);
+    }
+
+    if (status != FRAME_OK)
+    {
+        fprintf(stderr, "%s: failed (status %d, error %d)\n", szPath, (int)status, (int)pSource->PlatformError());
+        return 1;
+    }
+
+    printf("%s  %ux%u\n", szPath, format.width, format.height);
+    printf("  sequential: %lld frames in %.1f ms, %.1f frames/s\n",
+        (long long)sequential.cFrames, sequential.ms,
+        sequential.ms > 0 ? 1000.0 * sequential.cFrames / sequential.ms : 0.0);
+    printf("  thumbnails: %d in %.1f ms, %.2f ms each, %lld frames decoded, %lld converted\n",
+        count, thumbnails.ms, thumbnails.ms / count, (long long)thumbnails.cFrames,
+        (long long)thumbnails.cConverted);
+
+    return 0;
+}
+
+#ifdef VT_ENABLE_LIBJPEG
+
+//-------------------------------------------------------------------
+// RunMjpegBenchmark
+//
+// Runs the benchmark on a Motion JPEG file twice: decoded at full size
+// and at the reduction for the target size.
+//-------------------------------------------------------------------
+
+static int RunMjpegBenchmark(const char *szPath, int count, uint32_t targetWidth, uint32_t targetHeight)
+{
+    uint32_t targets[2][2] = { { 0, 0 }, { targetWidth, targetHeight } };
+    int result = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        MjpegFrameSource source;
+
+        source.SetTargetSize(targets[i][0], targets[i][1]);
+
+        if (source.Open(szPath) != FRAME_OK)
+        {
+            fprintf(stderr, "%s: cannot open\n", szPath);
+            return 1;
+        }
+
+        printf("1/%u: ", source.Scale());
+        result |= RunBenchmark(&source, szPath, count);
+    }
+
+    return result;
+}
+
+#endif // VT_ENABLE_LIBJPEG
+
+
+int main(int argc, char *argv[])
+{
+    FrameSourceCost cost;
+    bool bCost = false;
+    unsigned int jitter = 0;
+    int count = 10;
+    int result = 0;
+    unsigned int targetWidth = 0, targetHeight = 0;
+    unsigned int cThreads = std::thread::hardware_concurrency();
+    bool bThreads = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cost") == 0 && i + 1 < argc)
+        {
+            unsigned int seek = 0, decode = 0, gop = 1;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%u,%u,%u", &seek, &decode, &gop);
+#else
+            sscanf(argv[++i], "%u,%u,%u", &seek, &decode, &gop);
+#endif
+            cost.seekMicroseconds = seek;
+            cost.decodeMicroseconds = decode;
+            cost.gopLength = gop;
+            bCost = true;
+        }
+        else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc)
+        {
+            jitter = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--async") == 0 && i + 1 < argc)
+        {
+            FrameSourceCost latency = cost;
+
+            if (!bCost)
+            {
+                latency.seekMicroseconds = 5000;
+                latency.decodeMicroseconds = 2000;
+                latency.gopLength = 30;
+            }
+
+            result |= RunAsyncBenchmark((uint32_t)atoi(argv[++i]), count < 1 ? 1 : count, latency, jitter);
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            FrameSourceCost latency = cost;
+
+            if (!bCost)
+            {
+                latency.seekMicroseconds = 2000;
+                latency.decodeMicroseconds = 500;
+                latency.gopLength = 30;
+            }
+
+            result |= RunBatchBenchmark((uint32_t)atoi(argv[++i]), count < 1 ? 1 : count, latency,
+                bThreads ? cThreads : 4);
+        }
+        else if (strcmp(argv[i], "--faults") == 0 && i + 1 < argc)
+        {
+            FrameSourceCost latency = cost;
+
+            if (!bCost)
+            {
+                latency.seekMicroseconds = 5000;
+                latency.decodeMicroseconds = 2000;
+                latency.gopLength = 30;
+            }
+
+            result |= RunFaultTest((uint32_t)atoi(argv[++i]), count, latency);
+        }
+        else if (strcmp(argv[i], "--priority") == 0 && i + 1 < argc)
+        {
+            FrameSourceCost latency = cost;
+
+            if (!bCost)
+            {
+                latency.seekMicroseconds = 5000;
+                latency.decodeMicroseconds = 2000;
+                latency.gopLength = 30;
+            }
+
+            result |= RunPriorityTest((uint32_t)atoi(argv[++i]), count < 1 ? 1 : count, latency);
+        }
+        else if (strcmp(argv[i], "--shed") == 0 && i + 1 < argc)
+        {
+            FrameSourceCost latency = cost;
+
+            if (!bCost)
+            {
+                latency.seekMicroseconds = 5000;
+                latency.decodeMicroseconds = 2000;
+                latency.gopLength = 250;
+            }
+
+            result |= RunShedTest((uint32_t)atoi(argv[++i]), count < 1 ? 1 : count, latency);
+        }
+        else if (strcmp(argv[i], "--rangecache") == 0 && i + 1 < argc)
+        {
+            result |= RunRangeCacheTest((uint32_t)atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--mp4index") == 0)
+        {
+            result |= RunMp4IndexTest();
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &targetWidth, &targetHeight);
+#else
+            sscanf(argv[++i], "%ux%u", &targetWidth, &targetHeight);
+#endif
+        }
+        else if (strcmp(argv[i], "--interlaced") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &width, &height);
+#else
+            sscanf(argv[++i], "%ux%u", &width, &height);
+#endif
+            result |= RunFieldBenchmark(width, height, count < 1 ? 1 : count, targetWidth, targetHeight);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            cThreads = (unsigned int)atoi(argv[++i]);
+            bThreads = true;
+        }
+        else if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &width, &height);
+#else
+            sscanf(argv[++i], "%ux%u", &width, &height);
+#endif
+            result |= RunTileBenchmark(width, height, count < 1 ? 1 : count,
+                targetWidth ? targetWidth : 160, targetHeight ? targetHeight : 160, cThreads ? cThreads : 1);
+        }
+        else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &width, &height);
+#else
+            sscanf(argv[++i], "%ux%u", &width, &height);
+#endif
+            result |= RunKernelBenchmark(width, height, count < 1 ? 1 : count);
+        }
+        else if (strcmp(argv[i], "--bands") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &width, &height);
+#else
+            sscanf(argv[++i], "%ux%u", &width, &height);
+#endif
+            result |= RunBandBenchmark(width, height, count < 1 ? 1 : count,
+                targetWidth ? targetWidth : 160, targetHeight ? targetHeight : 160);
+        }
+        else if (strcmp(argv[i], "--mjpeg") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+
+#ifdef _MSC_VER
+            sscanf_s(argv[++i], "%ux%u", &width, &height);
+#else
+            sscanf(argv[++i], "%ux%u", &width, &height);
+#endif
+#ifdef VT_ENABLE_LIBJPEG
+            result |= RunMjpegTest(width, height, count < 2 ? 2 : count,
+                targetWidth ? targetWidth : 160, targetHeight ? targetHeight : 160);
+#else
+            fprintf(stderr, "--mjpeg: JPEG support is not built in\n");
+            result = 1;
+#endif
+        }
+        else if (HasExtension(argv[i], ".mjpeg") || HasExtension(argv[i], ".mjpg"))
+        {
+#ifdef VT_ENABLE_LIBJPEG
+            result |= RunMjpegBenchmark(argv[i], count < 1 ? 1 : count,
+                targetWidth ? targetWidth : 160, targetHeight ? targetHeight : 160);
+#else
+            fprintf(stderr, "%s: JPEG support is not built in\n", argv[i]);
+            result = 1;
+#endif
+        }
+        else if (HasExtension(argv[i], ".jpg") || HasExtension(argv[i], ".jpeg"))
+        {
+            result |= RunJpegBenchmark(argv[i], count < 1 ? 1 : count,
+                targetWidth ? targetWidth : 160, targetHeight ? targetHeight : 160);
+        }
+        else if (HasExtension(argv[i], ".y4m"))
+        {
+            Y4mFrameSource source;
+
+            source.SetCost(cost);
+
+            if (source.Open(argv[i]) != FRAME_OK)
+            {
+                fprintf(stderr, "%s: cannot open\n", argv[i]);
+                result = 1;
+                continue;
+            }
+
+            result |= RunBenchmark(&source, argv[i], count < 1 ? 1 : count);
+        }
+        else
+        {
+            fprintf(stderr, "%s: not a .y4m, .mjpeg or .jpg file\n", argv[i]);
+            result = 1;
+        }
+    }
+
+    return result;
+}
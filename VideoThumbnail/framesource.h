@@ -0,0 +1,153 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// FrameSource: Decoded video frames for the thumbnail generator.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class TaskPool;
+
+// NOTE: Frame sources
+//
+// ThumbnailGenerator gets its frames from a FrameSource. The
+// implementations are:
+//
+//   MFFrameSource (mfsource.h)     Media Foundation source reader.
+//   Y4mFrameSource (y4msource.h)   YUV4MPEG2 and raw I420 files, with a
+//                                  configurable simulated seek and
+//                                  decode cost.
+//   MjpegFrameSource               Motion JPEG streams, decoded at a
+//     (mjpegsource.h)              reduced size (VT_ENABLE_LIBJPEG).
+//
+// Like mp4index.h, this header depends only on the C++ standard library,
+// so that sources and the seek logic can be built and benchmarked on any
+// platform.
+//
+// Times are in 100-ns units. Seek moves to the keyframe at or before
+// the position, as Media Foundation sources do, so the first frames
+// after a seek can be earlier than requested; the caller skips them.
+//
+// ReadFrame decodes the next frame and returns its time stamp, but does
+// not convert it: frames that the caller skips past never pay for color
+// conversion or copies. ConvertFrame then converts the last frame that
+// ReadFrame returned to 32-bit BGRA and sets pData and stride. The
+// pixels stay valid until the next successful ReadFrame, or until Seek
+// or the source is closed. After a ReadFrame that returns
+// FRAME_END_OF_STREAM, the last frame can still be converted.
+//
+// Sources that return true from CanConvertRows can also convert the
+// frame a band of rows at a time into the caller's buffer, with
+// ConvertRows, so that large frames never need a full-size BGRA copy
+// (see bandscale.h). Rows are counted in the size that GetFormat
+// reports.
+//
+// SetTaskPool lets a source convert each frame on several threads (see
+// taskpool.h).
+//
+// SetSkipThreshold tells the source that frames before a time will be
+// read only to get past them. A source may then drop frames that no
+// other frame depends on instead of returning them, as decoders that
+// support IMFQualityAdvise do. Keyframes and the frames at or after the threshold
+// are always returned.
+//
+// SetTargetSize tells the source, before it is opened, the smallest
+// size that the caller will scale frames down to. A source that can
+// decode at a reduced size for less work, as JPEG decoders can, may then
+// return frames that are smaller than the stream but at least that
+// size; GetFormat reports the size of the frames.
+//
+// Cancel can be called from any thread, such as a Watchdog's (see
+// watchdog.h), while another thread is in Seek or ReadFrame. The call in
+// progress returns FRAME_E_CANCELLED as soon as the source can stop, and
+// so does every Seek and ReadFrame after it until the source is opened
+// again. The default Cancel does nothing, so a read from a source
+// that does not override it ends only when the source returns.
+
+enum FRAME_STATUS
+{
+    FRAME_OK = 0,
+    FRAME_END_OF_STREAM,
+    FRAME_E_READ,               // The file could not be read.
+    FRAME_E_FORMAT,             // Unsupported or malformed file.
+    FRAME_E_NOT_SEEKABLE,
+    FRAME_E_OUT_OF_MEMORY,
+    FRAME_E_PLATFORM,           // See PlatformError.
+    FRAME_E_CANCELLED           // See Cancel.
+};
+
+struct FrameFormat
+{
+    uint32_t    width;
+    uint32_t    height;
+    bool        bTopDown;
+    int32_t     pictureLeft;    // Picture rectangle, corrected for the
+    int32_t     pictureTop;     // pixel aspect ratio.
+    int32_t     pictureRight;
+    int32_t     pictureBottom;
+    uint32_t    rotation;       // Degrees clockwise to rotate for display:
+                                // 0, 90, 180 or 270.
+};
+
+// FrameView::timestamp when the source does not know the time.
+const int64_t FRAME_TIME_UNKNOWN = INT64_MIN;
+
+struct FrameView
+{
+    const uint8_t   *pData;     // BGRA, top row first if bTopDown. Set by ConvertFrame.
+    int32_t         stride;     // Bytes per row. Set by ConvertFrame.
+    int64_t         timestamp;  // Or FRAME_TIME_UNKNOWN.
+    bool            bKeyframe;  // Decoding can start at this frame.
+};
+
+// FrameSourceCost: Simulated costs, for benchmarking. Each seek and each
+// decoded frame spins for the given time, and keyframes are gopLength
+// frames apart, so a seek lands up to gopLength - 1 frames early.
+struct FrameSourceCost
+{
+    uint32_t    seekMicroseconds;
+    uint32_t    decodeMicroseconds;
+    uint32_t    gopLength;      // 0 or 1: every frame is a keyframe.
+
+    FrameSourceCost() : seekMicroseconds(0), decodeMicroseconds(0), gopLength(1)
+    {
+    }
+};
+
+
+class FrameSource
+{
+public:
+    virtual ~FrameSource() { }
+
+    virtual FRAME_STATUS    GetFormat(FrameFormat *pFormat) = 0;
+    virtual FRAME_STATUS    GetDuration(int64_t *phnsDuration) = 0;
+    virtual FRAME_STATUS    CanSeek(bool *pbCanSeek) = 0;
+    virtual FRAME_STATUS    Seek(int64_t hnsPosition) = 0;
+    virtual FRAME_STATUS    ReadFrame(FrameView *pFrame, bool *pbFormatChanged) = 0;
+    virtual FRAME_STATUS    ConvertFrame(FrameView *pFrame) = 0;
+
+    virtual bool            CanConvertRows() const { return false; }
+    virtual FRAME_STATUS    ConvertRows(uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride)
+    {
+        (void)firstRow; (void)cRows; (void)pDest; (void)destStride;
+        return FRAME_E_FORMAT;
+    }
+
+    virtual void            SetSkipThreshold(int64_t hnsThreshold) { (void)hnsThreshold; }
+    virtual void            SetTargetSize(uint32_t width, uint32_t height) { (void)width; (void)height; }
+    virtual void            SetTaskPool(TaskPool *pPool) { (void)pPool; }
+    virtual void            Cancel() { }
+
+    // Platform error code (an HRESULT on Windows) of the last call that
+    // returned FRAME_E_PLATFORM.
+    virtual int32_t         PlatformError() const { return 0; }
+};
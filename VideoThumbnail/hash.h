@@ -0,0 +1,30 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// FNV-1a hashing for cache keys.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+
+const ULONGLONG FNV_OFFSET_BASIS    = 14695981039346656037ULL;
+const ULONGLONG FNV_OFFSET_BASIS_2  = 0x84222325CBF29CE4ULL;     // For a second, independent hash.
+const ULONGLONG FNV_PRIME           = 1099511628211ULL;
+
+inline ULONGLONG Fnv1a(ULONGLONG hash, const void *pv, size_t cb)
+{
+    const BYTE *pb = (const BYTE*)pv;
+
+    for (size_t i = 0; i < cb; i++)
+    {
+        hash ^= pb[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
@@ -0,0 +1,467 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// HttpRangeSource: Reads a file over HTTP with range requests.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "httpsource.h"
+
+const WCHAR USER_AGENT[] = L"VideoThumbnail/1.0";
+
+// Largest single request. Reads from the cache are a few blocks.
+const ULONGLONG MAX_RANGE_SIZE = 256 * 1024 * 1024;
+
+// WinHttpSetTimeouts: resolve, connect, send, and each receive. The
+// receive limit applies to every wait for data, not to the whole body.
+const int HTTP_TIMEOUTS_MS[4] = { 10000, 10000, 15000, 15000 };
+
+
+static BOOL IsDigit(WCHAR ch)
+{
+    return ch >= L'0' && ch <= L'9';
+}
+
+
+//-------------------------------------------------------------------
+// ParseContentRange
+//
+// Parses "bytes <first>-<last>/<total>". *pcbTotal is 0 if the total is
+// "*" (unknown).
+//-------------------------------------------------------------------
+
+static BOOL ParseContentRange(const WCHAR *wszRange, ULONGLONG *pFirst, ULONGLONG *pLast, ULONGLONG *pcbTotal)
+{
+    WCHAR *pwszEnd = NULL;
+
+    if (_wcsnicmp(wszRange, L"bytes ", 6) != 0 || !IsDigit(wszRange[6]))
+    {
+        return FALSE;
+    }
+
+    *pFirst = _wcstoui64(wszRange + 6, &pwszEnd, 10);
+
+    if (pwszEnd[0] != L'-' || !IsDigit(pwszEnd[1]))
+    {
+        return FALSE;
+    }
+
+    *pLast = _wcstoui64(pwszEnd + 1, &pwszEnd, 10);
+
+    if (pwszEnd[0] != L'/' || *pLast < *pFirst)
+    {
+        return FALSE;
+    }
+
+    if (pwszEnd[1] == L'*' && pwszEnd[2] == 0)
+    {
+        *pcbTotal = 0;
+        return TRUE;
+    }
+
+    if (!IsDigit(pwszEnd[1]))
+    {
+        return FALSE;
+    }
+
+    *pcbTotal = _wcstoui64(pwszEnd + 1, &pwszEnd, 10);
+
+    return pwszEnd[0] == 0 && *pLast < *pcbTotal;
+}
+
+
+//-------------------------------------------------------------------
+// HttpRangeSource constructor
+//-------------------------------------------------------------------
+
+HttpRangeSource::HttpRangeSource()
+    : m_hSession(NULL),
+      m_hConnect(NULL),
+      m_bSecure(FALSE),
+      m_cbSize(0),
+      m_cRequests(0),
+      m_cbTransferred(0),
+      m_hRequest(NULL),
+      m_bCancelled(FALSE)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// HttpRangeSource destructor
+//-------------------------------------------------------------------
+
+HttpRangeSource::~HttpRangeSource()
+{
+    if (m_hConnect)
+    {
+        WinHttpCloseHandle(m_hConnect);
+    }
+    if (m_hSession)
+    {
+        WinHttpCloseHandle(m_hSession);
+    }
+
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// Open
+//
+// Connects to the server and gets the size and content type of the
+// file. Returns HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) if the server
+// does not support range requests.
+//-------------------------------------------------------------------
+
+HRESULT HttpRangeSource::Open(const WCHAR *wszUrl)
+{
+    HRESULT hr = S_OK;
+
+    HINTERNET hRequest = NULL;
+    BYTE byte = 0;
+    ULONGLONG cbTotal = 0;
+
+    URL_COMPONENTS url;
+    ZeroMemory(&url, sizeof(url));
+    url.dwStructSize = sizeof(url);
+    url.dwHostNameLength = (DWORD)-1;
+    url.dwUrlPathLength = (DWORD)-1;
+    url.dwExtraInfoLength = (DWORD)-1;
+
+    if (m_hSession != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    if (!WinHttpCrackUrl(wszUrl, 0, 0, &url))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (url.nScheme != INTERNET_SCHEME_HTTP && url.nScheme != INTERNET_SCHEME_HTTPS)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::wstring host(url.lpszHostName, url.dwHostNameLength);
+
+    m_object.assign(url.lpszUrlPath, url.dwUrlPathLength);
+    m_object.append(url.lpszExtraInfo, url.dwExtraInfoLength);
+    m_bSecure = (url.nScheme == INTERNET_SCHEME_HTTPS);
+
+    m_hSession = WinHttpOpen(USER_AGENT, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+        WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+
+    if (m_hSession == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Requests inherit the session's time limits.
+    if (!WinHttpSetTimeouts(m_hSession, HTTP_TIMEOUTS_MS[0], HTTP_TIMEOUTS_MS[1], HTTP_TIMEOUTS_MS[2],
+        HTTP_TIMEOUTS_MS[3]))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_hConnect = WinHttpConnect(m_hSession, host.c_str(), url.nPort, 0);
+
+    if (m_hConnect == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Ask for the first byte. The size is in "Content-Range: bytes 0-0/size".
+
+    hr = SendRangeRequest(0, 0, &hRequest, &cbTotal);
+
+    if (SUCCEEDED(hr))
+    {
+        if (cbTotal == 0)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);   // Unknown size.
+        }
+        else
+        {
+            m_cbSize = cbTotal;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        WCHAR wszType[256];
+        DWORD cbType = sizeof(wszType);
+
+        if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_TYPE, WINHTTP_HEADER_NAME_BY_INDEX,
+            wszType, &cbType, WINHTTP_NO_HEADER_INDEX))
+        {
+            m_contentType = wszType;
+        }
+
+        // Read the body, so that the connection can be reused.
+        hr = ReadBody(hRequest, &byte, 1);
+    }
+
+    CloseRequest(hRequest);
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ReadAt
+//
+// Reads a range of the file with one request.
+//-------------------------------------------------------------------
+
+bool HttpRangeSource::ReadAt(uint64_t offset, void *pBuffer, size_t cb)
+{
+    HINTERNET hRequest = NULL;
+    ULONGLONG cbTotal = 0;
+
+    if (cb == 0)
+    {
+        return true;
+    }
+
+    if (cb > MAX_RANGE_SIZE || offset + cb > m_cbSize)
+    {
+        return false;
+    }
+
+    HRESULT hr = SendRangeRequest(offset, offset + cb - 1, &hRequest, &cbTotal);
+
+    // The file must not have changed since Open.
+    if (SUCCEEDED(hr) && cbTotal != m_cbSize)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ReadBody(hRequest, (BYTE*)pBuffer, (DWORD)cb);
+    }
+
+    CloseRequest(hRequest);
+
+    return SUCCEEDED(hr);
+}
+
+
+//-------------------------------------------------------------------
+// Cancel
+//
+// Called on another thread, such as a watchdog's. Closing the request
+// handle makes a WinHTTP call that is waiting on it fail with
+// ERROR_WINHTTP_OPERATION_CANCELLED. Later reads fail at once.
+//-------------------------------------------------------------------
+
+void HttpRangeSource::Cancel()
+{
+    EnterCriticalSection(&m_lock);
+
+    InterlockedExchange(&m_bCancelled, TRUE);
+
+    if (m_hRequest)
+    {
+        WinHttpCloseHandle(m_hRequest);
+        m_hRequest = NULL;
+    }
+
+    LeaveCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// IsHttpUrl
+//
+// Returns TRUE for http:// and https:// URLs.
+//-------------------------------------------------------------------
+
+BOOL HttpRangeSource::IsHttpUrl(const WCHAR *wszUrl)
+{
+    return _wcsnicmp(wszUrl, L"http://", 7) == 0 || _wcsnicmp(wszUrl, L"https://", 8) == 0;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// SendRangeRequest
+//
+// Sends a GET request for bytes first to last (inclusive) and waits
+// for the response headers. Fails unless the server returns 206 with
+// a Content-Range for exactly those bytes.
+//
+// pcbTotal:   Receives the size of the file from Content-Range, or 0 if
+//             the server does not know it.
+//-------------------------------------------------------------------
+
+HRESULT HttpRangeSource::SendRangeRequest(ULONGLONG first, ULONGLONG last, HINTERNET *phRequest, ULONGLONG *pcbTotal)
+{
+    HRESULT hr = S_OK;
+
+    WCHAR wszHeader[80];
+    DWORD dwStatus = 0;
+    DWORD cbStatus = sizeof(dwStatus);
+    WCHAR wszRange[128];
+    DWORD cbRange = sizeof(wszRange);
+    ULONGLONG rangeFirst = 0, rangeLast = 0;
+
+    *phRequest = NULL;
+    *pcbTotal = 0;
+
+    if (m_bCancelled)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED);
+    }
+
+    HINTERNET hRequest = WinHttpOpenRequest(m_hConnect, L"GET", m_object.c_str(), NULL,
+        WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, m_bSecure ? WINHTTP_FLAG_SECURE : 0);
+
+    if (hRequest == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Publish the handle for Cancel, unless it came first.
+
+    EnterCriticalSection(&m_lock);
+
+    if (m_bCancelled)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED);
+    }
+    else
+    {
+        m_hRequest = hRequest;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (FAILED(hr))
+    {
+        WinHttpCloseHandle(hRequest);
+        return hr;
+    }
+
+    ++m_cRequests;
+
+    hr = StringCchPrintf(wszHeader, ARRAYSIZE(wszHeader), L"Range: bytes=%I64u-%I64u", first, last);
+
+    if (SUCCEEDED(hr))
+    {
+        if (!WinHttpSendRequest(hRequest, wszHeader, (DWORD)-1, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) ||
+            !WinHttpReceiveResponse(hRequest, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX, &dwStatus, &cbStatus, WINHTTP_NO_HEADER_INDEX))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr) && dwStatus != 206)
+    {
+        // 200 means that the server ignored the range and is sending
+        // the whole file.
+        hr = (dwStatus == 200) ? HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) :
+            MAKE_HRESULT(SEVERITY_ERROR, FACILITY_HTTP, dwStatus);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_RANGE, WINHTTP_HEADER_NAME_BY_INDEX,
+            wszRange, &cbRange, WINHTTP_NO_HEADER_INDEX))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    // A server or proxy can answer 206 with other bytes than the ones
+    // that were asked for.
+    if (SUCCEEDED(hr))
+    {
+        if (!ParseContentRange(wszRange, &rangeFirst, &rangeLast, pcbTotal) ||
+            rangeFirst != first || rangeLast != last)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        *phRequest = hRequest;
+    }
+    else
+    {
+        CloseRequest(hRequest);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ReadBody
+//
+// Reads exactly cb bytes of the response body.
+//-------------------------------------------------------------------
+
+HRESULT HttpRangeSource::ReadBody(HINTERNET hRequest, BYTE *pBuffer, DWORD cb)
+{
+    DWORD cbTotal = 0;
+
+    while (cbTotal < cb)
+    {
+        DWORD cbRead = 0;
+
+        if (!WinHttpReadData(hRequest, pBuffer + cbTotal, cb - cbTotal, &cbRead))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (cbRead == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);  // The response was short.
+        }
+
+        cbTotal += cbRead;
+        m_cbTransferred += cbRead;
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// CloseRequest
+//
+// Closes a request from SendRangeRequest, unless Cancel closed it.
+//-------------------------------------------------------------------
+
+void HttpRangeSource::CloseRequest(HINTERNET hRequest)
+{
+    EnterCriticalSection(&m_lock);
+
+    if (hRequest != NULL && hRequest == m_hRequest)
+    {
+        WinHttpCloseHandle(hRequest);
+        m_hRequest = NULL;
+    }
+
+    LeaveCriticalSection(&m_lock);
+}
@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// HttpRangeSource: Reads a file over HTTP with range requests.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <winhttp.h>
+#include <string>
+
+#include "rangecache.h"
+
+// NOTE: Range requests
+//
+// When Media Foundation opens an HTTP URL itself, its network source
+// decides how much of the file to download. HttpRangeSource instead
+// makes one "Range: bytes=first-last" GET request for each read, and is
+// meant to sit under a RangeCache (see bytestream.h): the demuxer's
+// reads of the container index and of the samples it needs are merged
+// into block-aligned requests, and blocks that were fetched once are
+// not fetched again.
+//
+// Open makes a one-byte range request to learn the size and content
+// type of the file. Servers that do not answer with 206 Partial Content
+// are rejected, so that the caller can fall back to opening the URL
+// with Media Foundation.
+//
+// Every 206 response must carry a Content-Range for exactly the bytes
+// that were asked for, and for a file of the size that Open found. A
+// server or proxy that returns other bytes, or a file that changed on
+// the server, fails the read instead of handing the demuxer wrong data.
+// Resolving, connecting, sending and each wait for data have a time
+// limit (see HTTP_TIMEOUTS_MS in httpsource.cpp).
+//
+// Requests() and BytesTransferred() count every request, including the
+// one made by Open. Connections are kept alive between requests. Use an
+// HttpRangeSource from one thread at a time, except for Cancel, which
+// can be called from any thread: it closes the request in flight, so
+// that a read blocked on the network fails at once, and fails every
+// later read.
+
+class HttpRangeSource : public RangeSource
+{
+    HINTERNET       m_hSession;
+    HINTERNET       m_hConnect;
+    std::wstring    m_object;           // Path and query.
+    BOOL            m_bSecure;
+    ULONGLONG       m_cbSize;
+    std::wstring    m_contentType;
+
+    ULONGLONG       m_cRequests;
+    ULONGLONG       m_cbTransferred;
+
+    CRITICAL_SECTION m_lock;            // Guards m_hRequest, for Cancel.
+    HINTERNET       m_hRequest;         // Request in flight.
+    volatile LONG   m_bCancelled;
+
+public:
+
+    HttpRangeSource();
+    ~HttpRangeSource();
+
+    HRESULT     Open(const WCHAR *wszUrl);
+
+    bool        ReadAt(uint64_t offset, void *pBuffer, size_t cb);
+    void        Cancel();
+
+    ULONGLONG           Size() const { return m_cbSize; }
+    const std::wstring& ContentType() const { return m_contentType; }
+    ULONGLONG           Requests() const { return m_cRequests; }
+    ULONGLONG           BytesTransferred() const { return m_cbTransferred; }
+
+    static BOOL IsHttpUrl(const WCHAR *wszUrl);
+
+private:
+    HRESULT     SendRangeRequest(ULONGLONG first, ULONGLONG last, HINTERNET *phRequest, ULONGLONG *pcbTotal);
+    HRESULT     ReadBody(HINTERNET hRequest, BYTE *pBuffer, DWORD cb);
+    void        CloseRequest(HINTERNET hRequest);
+};
@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// JpegDecoder: Decodes JPEG images at reduced sizes with libjpeg-turbo.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "jpegdecode.h"
+
+#ifdef VT_ENABLE_LIBJPEG
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <new>
+
+#include <jpeglib.h>
+
+#ifndef JCS_EXTENSIONS
+#error JpegDecoder needs libjpeg-turbo for BGRA output.
+#endif
+
+#ifdef _MSC_VER
+#pragma comment(lib, "jpeg.lib")
+#pragma warning(disable: 4611)  // setjmp: no C++ objects are live across libjpeg calls.
+#endif
+
+// libjpeg reports errors through error_exit, which must not return.
+// It jumps back to the setjmp in the method that called into libjpeg;
+// client_data points to the jmp_buf.
+
+struct JpegDecoder::Context
+{
+    jpeg_decompress_struct  info;
+    jpeg_error_mgr          error;
+    jmp_buf                 jump;
+};
+
+static void OnJpegError(j_common_ptr pInfo)
+{
+    longjmp(*(jmp_buf*)pInfo->client_data, 1);
+}
+
+static void OnJpegMessage(j_common_ptr pInfo)
+{
+    (void)pInfo;    // Warnings about corrupt data are not fatal.
+}
+
+
+//-------------------------------------------------------------------
+// JpegDecoder constructor
+//-------------------------------------------------------------------
+
+JpegDecoder::JpegDecoder()
+    : m_pContext(NULL)
+{
+}
+
+
+//-------------------------------------------------------------------
+// JpegDecoder destructor
+//-------------------------------------------------------------------
+
+JpegDecoder::~JpegDecoder()
+{
+    if (m_pContext)
+    {
+        jpeg_destroy_decompress(&m_pContext->info);
+        delete m_pContext;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ReadHeader
+//-------------------------------------------------------------------
+
+FRAME_STATUS JpegDecoder::ReadHeader(const uint8_t *pData, size_t cbData, uint32_t *pWidth, uint32_t *pHeight)
+{
+    FRAME_STATUS status = Start(pData, cbData);
+
+    if (status != FRAME_OK)
+    {
+        return status;
+    }
+
+    *pWidth = m_pContext->info.image_width;
+    *pHeight = m_pContext->info.image_height;
+
+    jpeg_abort_decompress(&m_pContext->info);
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Decode
+//-------------------------------------------------------------------
+
+FRAME_STATUS JpegDecoder::Decode(const uint8_t *pData, size_t cbData, uint32_t scale,
+    std::vector<uint8_t> *pBgra, uint32_t *pWidth, uint32_t *pHeight)
+{
+    FRAME_STATUS status = Start(pData, cbData);
+
+    if (status != FRAME_OK)
+    {
+        return status;
+    }
+
+    jpeg_decompress_struct *pInfo = &m_pContext->info;
+
+    if (setjmp(m_pContext->jump))
+    {
+        jpeg_abort_decompress(pInfo);
+        return FRAME_E_FORMAT;
+    }
+
+    if (pInfo->jpeg_color_space == JCS_CMYK || pInfo->jpeg_color_space == JCS_YCCK)
+    {
+        jpeg_abort_decompress(pInfo);
+        return FRAME_E_FORMAT;
+    }
+
+    // The image is scaled down afterwards, so the faster chroma
+    // upsampling is good enough.
+    pInfo->out_color_space = JCS_EXT_BGRA;
+    pInfo->scale_num = 1;
+    pInfo->scale_denom = scale;
+    pInfo->do_fancy_upsampling = FALSE;
+
+    jpeg_start_decompress(pInfo);
+
+    const size_t cbRow = (size_t)4 * pInfo->output_width;
+
+    try
+    {
+        pBgra->resize(cbRow * pInfo->output_height);
+    }
+    catch (std::bad_alloc&)
+    {
+        jpeg_abort_decompress(pInfo);
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    while (pInfo->output_scanline < pInfo->output_height)
+    {
+        JSAMPROW pRow = &(*pBgra)[cbRow * pInfo->output_scanline];
+
+        jpeg_read_scanlines(pInfo, &pRow, 1);
+    }
+
+    *pWidth = pInfo->output_width;
+    *pHeight = pInfo->output_height;
+
+    jpeg_finish_decompress(pInfo);
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ChooseScale
+//-------------------------------------------------------------------
+
+uint32_t JpegDecoder::ChooseScale(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight)
+{
+    if (targetWidth == 0 && targetHeight == 0)
+    {
+        return 1;
+    }
+
+    for (uint32_t scale = 8; scale > 1; scale /= 2)
+    {
+        if (ScaledSize(width, scale) >= targetWidth && ScaledSize(height, scale) >= targetHeight)
+        {
+            return scale;
+        }
+    }
+    return 1;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Start
+//
+// Points libjpeg at an image and reads its headers. The caller aborts
+// or finishes the decompression.
+//-------------------------------------------------------------------
+
+FRAME_STATUS JpegDecoder::Start(const uint8_t *pData, size_t cbData)
+{
+    if (cbData == 0 || cbData > 0xFFFFFFFF)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+    if (m_pContext == NULL)
+    {
+        m_pContext = new (std::nothrow) Context;
+
+        if (m_pContext == NULL)
+        {
+            return FRAME_E_OUT_OF_MEMORY;
+        }
+
+        m_pContext->info.err = jpeg_std_error(&m_pContext->error);
+        m_pContext->error.error_exit = OnJpegError;
+        m_pContext->error.output_message = OnJpegMessage;
+
+        jpeg_create_decompress(&m_pContext->info);
+
+        m_pContext->info.client_data = &m_pContext->jump;
+    }
+
+    if (setjmp(m_pContext->jump))
+    {
+        jpeg_abort_decompress(&m_pContext->info);
+        return FRAME_E_FORMAT;
+    }
+
+    jpeg_mem_src(&m_pContext->info, const_cast<uint8_t*>(pData), (unsigned long)cbData);
+
+    if (jpeg_read_header(&m_pContext->info, TRUE) != JPEG_HEADER_OK)
+    {
+        jpeg_abort_decompress(&m_pContext->info);
+        return FRAME_E_FORMAT;
+    }
+
+    return FRAME_OK;
+}
+
+#endif // VT_ENABLE_LIBJPEG
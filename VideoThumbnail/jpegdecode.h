@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// JpegDecoder: Decodes JPEG images at reduced sizes with libjpeg-turbo.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+#include "framesource.h"
+
+// NOTE: Scaled decoding
+//
+// A JPEG image is stored as 8x8 blocks of DCT coefficients. libjpeg can
+// run a smaller inverse DCT on each block (4x4, 2x2 or 1x1), which gives
+// the image at 1/2, 1/4 or 1/8 of its size for a fraction of the cost of
+// a full decode followed by a downscale. ChooseScale picks the largest
+// such reduction that still leaves at least the size that the caller
+// will scale to, so the regular scaler finishes the job at no loss.
+//
+// The decoder is only compiled when VT_ENABLE_LIBJPEG is defined, and
+// needs libjpeg-turbo (for its BGRA output) and its jpeglib.h:
+//
+//   g++ -O2 -DVT_ENABLE_LIBJPEG -c jpegdecode.cpp -ljpeg
+//
+// Like the frame sources, it depends only on the C++ standard library
+// otherwise. Grayscale and YCbCr images are supported; CMYK images
+// return FRAME_E_FORMAT.
+
+#ifdef VT_ENABLE_LIBJPEG
+
+class JpegDecoder
+{
+    struct Context;
+
+    Context     *m_pContext;        // libjpeg state, reused for every image.
+
+public:
+
+    JpegDecoder();
+    ~JpegDecoder();
+
+    // Reads the size of the image from its headers, without decoding.
+    FRAME_STATUS    ReadHeader(const uint8_t *pData, size_t cbData, uint32_t *pWidth, uint32_t *pHeight);
+
+    // Decodes the image at 1/scale of its size (scale is 1, 2, 4 or 8) to
+    // top-down BGRA, with 4 * *pWidth bytes per row.
+    FRAME_STATUS    Decode(const uint8_t *pData, size_t cbData, uint32_t scale,
+                        std::vector<uint8_t> *pBgra, uint32_t *pWidth, uint32_t *pHeight);
+
+    // The largest scale at which a width x height image decodes to at
+    // least targetWidth x targetHeight. A target of 0 x 0 means full size.
+    static uint32_t ChooseScale(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight);
+
+    // The size of a dimension at a scale, as libjpeg rounds it.
+    static uint32_t ScaledSize(uint32_t size, uint32_t scale) { return (size + scale - 1) / scale; }
+
+private:
+    FRAME_STATUS    Start(const uint8_t *pData, size_t cbData);
+};
+
+#endif // VT_ENABLE_LIBJPEG
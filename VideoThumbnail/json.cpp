@@ -0,0 +1,655 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Minimal JSON reader and writer for the request protocol.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "json.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+const int MAX_JSON_DEPTH = 32;
+
+static const char BASE64_CHARS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+//-------------------------------------------------------------------
+// JsonParser: Recursive-descent parser used by JsonParse.
+//-------------------------------------------------------------------
+
+class JsonParser
+{
+    const char  *m_p;
+    const char  *m_pEnd;
+
+public:
+    JsonParser(const char *pszText, size_t cch) : m_p(pszText), m_pEnd(pszText + cch)
+    {
+    }
+
+    HRESULT ParseDocument(JsonValue *pValue)
+    {
+        HRESULT hr = ParseValue(pValue, 0);
+
+        if (SUCCEEDED(hr))
+        {
+            SkipWhitespace();
+            if (m_p != m_pEnd)
+            {
+                hr = E_INVALIDARG;  // Trailing garbage.
+            }
+        }
+        return hr;
+    }
+
+private:
+
+    void SkipWhitespace()
+    {
+        while (m_p < m_pEnd && (*m_p == ' ' || *m_p == '\t' || *m_p == '\r' || *m_p == '\n'))
+        {
+            ++m_p;
+        }
+    }
+
+    bool Match(const char *szLiteral)
+    {
+        size_t cch = strlen(szLiteral);
+        if ((size_t)(m_pEnd - m_p) >= cch && memcmp(m_p, szLiteral, cch) == 0)
+        {
+            m_p += cch;
+            return true;
+        }
+        return false;
+    }
+
+    HRESULT ParseValue(JsonValue *pValue, int depth)
+    {
+        if (depth > MAX_JSON_DEPTH)
+        {
+            return E_INVALIDARG;
+        }
+
+        SkipWhitespace();
+
+        if (m_p == m_pEnd)
+        {
+            return E_INVALIDARG;
+        }
+
+        switch (*m_p)
+        {
+        case '{':
+            return ParseObject(pValue, depth);
+
+        case '[':
+            return ParseArray(pValue, depth);
+
+        case '"':
+            pValue->type = JsonValue::JSON_STRING;
+            return ParseString(&pValue->str);
+
+        case 't':
+            if (!Match("true")) { return E_INVALIDARG; }
+            pValue->type = JsonValue::JSON_BOOL;
+            pValue->boolean = true;
+            return S_OK;
+
+        case 'f':
+            if (!Match("false")) { return E_INVALIDARG; }
+            pValue->type = JsonValue::JSON_BOOL;
+            pValue->boolean = false;
+            return S_OK;
+
+        case 'n':
+            if (!Match("null")) { return E_INVALIDARG; }
+            pValue->type = JsonValue::JSON_NULL;
+            return S_OK;
+
+        default:
+            return ParseNumber(pValue);
+        }
+    }
+
+    HRESULT ParseObject(JsonValue *pValue, int depth)
+    {
+        pValue->type = JsonValue::JSON_OBJECT;
+        ++m_p;  // '{'
+
+        SkipWhitespace();
+        if (m_p < m_pEnd && *m_p == '}')
+        {
+            ++m_p;
+            return S_OK;
+        }
+
+        while (1)
+        {
+            std::pair<std::string, JsonValue> member;
+
+            SkipWhitespace();
+            if (m_p == m_pEnd || *m_p != '"')
+            {
+                return E_INVALIDARG;
+            }
+
+            HRESULT hr = ParseString(&member.first);
+            if (FAILED(hr)) { return hr; }
+
+            SkipWhitespace();
+            if (m_p == m_pEnd || *m_p != ':')
+            {
+                return E_INVALIDARG;
+            }
+            ++m_p;
+
+            hr = ParseValue(&member.second, depth + 1);
+            if (FAILED(hr)) { return hr; }
+
+            pValue->members.push_back(member);
+
+            SkipWhitespace();
+            if (m_p == m_pEnd)
+            {
+                return E_INVALIDARG;
+            }
+            if (*m_p == ',')
+            {
+                ++m_p;
+                continue;
+            }
+            if (*m_p == '}')
+            {
+                ++m_p;
+                return S_OK;
+            }
+            return E_INVALIDARG;
+        }
+    }
+
+    HRESULT ParseArray(JsonValue *pValue, int depth)
+    {
+        pValue->type = JsonValue::JSON_ARRAY;
+        ++m_p;  // '['
+
+        SkipWhitespace();
+        if (m_p < m_pEnd && *m_p == ']')
+        {
+            ++m_p;
+            return S_OK;
+        }
+
+        while (1)
+        {
+            pValue->items.push_back(JsonValue());
+
+            HRESULT hr = ParseValue(&pValue->items.back(), depth + 1);
+            if (FAILED(hr)) { return hr; }
+
+            SkipWhitespace();
+            if (m_p == m_pEnd)
+            {
+                return E_INVALIDARG;
+            }
+            if (*m_p == ',')
+            {
+                ++m_p;
+                continue;
+            }
+            if (*m_p == ']')
+            {
+                ++m_p;
+                return S_OK;
+            }
+            return E_INVALIDARG;
+        }
+    }
+
+    HRESULT ParseNumber(JsonValue *pValue)
+    {
+        // strtod needs a terminated string; numbers are short.
+        char buffer[64];
+        size_t cch = 0;
+
+        while (m_p + cch < m_pEnd && cch < sizeof(buffer) - 1 &&
+               strchr("+-0123456789.eE", m_p[cch]) != NULL)
+        {
+            buffer[cch] = m_p[cch];
+            ++cch;
+        }
+        buffer[cch] = '\0';
+
+        if (cch == 0)
+        {
+            return E_INVALIDARG;
+        }
+
+        char *pEnd = NULL;
+        pValue->type = JsonValue::JSON_NUMBER;
+        pValue->number = strtod(buffer, &pEnd);
+
+        if (pEnd != buffer + cch)
+        {
+            return E_INVALIDARG;
+        }
+
+        m_p += cch;
+        return S_OK;
+    }
+
+    HRESULT ParseHex4(UINT32 *pValue)
+    {
+        UINT32 value = 0;
+
+        if (m_pEnd - m_p < 4)
+        {
+            return E_INVALIDARG;
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            char c = *m_p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9')      { value |= (UINT32)(c - '0'); }
+            else if (c >= 'a' && c <= 'f') { value |= (UINT32)(c - 'a' + 10); }
+            else if (c >= 'A' && c <= 'F') { value |= (UINT32)(c - 'A' + 10); }
+            else { return E_INVALIDARG; }
+        }
+
+        *pValue = value;
+        return S_OK;
+    }
+
+    static void AppendUtf8(std::string *pStr, UINT32 cp)
+    {
+        if (cp < 0x80)
+        {
+            pStr->push_back((char)cp);
+        }
+        else if (cp < 0x800)
+        {
+            pStr->push_back((char)(0xC0 | (cp >> 6)));
+            pStr->push_back((char)(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000)
+        {
+            pStr->push_back((char)(0xE0 | (cp >> 12)));
+            pStr->push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            pStr->push_back((char)(0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            pStr->push_back((char)(0xF0 | (cp >> 18)));
+            pStr->push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+            pStr->push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            pStr->push_back((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    HRESULT ParseString(std::string *pStr)
+    {
+        ++m_p;  // Opening quote.
+
+        while (m_p < m_pEnd)
+        {
+            char c = *m_p++;
+
+            if (c == '"')
+            {
+                return S_OK;
+            }
+
+            if (c != '\\')
+            {
+                pStr->push_back(c);
+                continue;
+            }
+
+            if (m_p == m_pEnd)
+            {
+                break;
+            }
+
+            c = *m_p++;
+            switch (c)
+            {
+            case '"':  pStr->push_back('"');  break;
+            case '\\': pStr->push_back('\\'); break;
+            case '/':  pStr->push_back('/');  break;
+            case 'b':  pStr->push_back('\b'); break;
+            case 'f':  pStr->push_back('\f'); break;
+            case 'n':  pStr->push_back('\n'); break;
+            case 'r':  pStr->push_back('\r'); break;
+            case 't':  pStr->push_back('\t'); break;
+
+            case 'u':
+                {
+                    UINT32 cp = 0;
+                    HRESULT hr = ParseHex4(&cp);
+                    if (FAILED(hr)) { return hr; }
+
+                    // Combine UTF-16 surrogate pairs. A surrogate without
+                    // its pair is not a character.
+                    if (cp >= 0xDC00 && cp <= 0xDFFF)
+                    {
+                        return E_INVALIDARG;
+                    }
+
+                    if (cp >= 0xD800 && cp <= 0xDBFF)
+                    {
+                        UINT32 low = 0;
+
+                        if (!Match("\\u"))
+                        {
+                            return E_INVALIDARG;
+                        }
+
+                        hr = ParseHex4(&low);
+                        if (FAILED(hr)) { return hr; }
+
+                        if (low < 0xDC00 || low > 0xDFFF)
+                        {
+                            return E_INVALIDARG;
+                        }
+
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    AppendUtf8(pStr, cp);
+                }
+                break;
+
+            default:
+                return E_INVALIDARG;
+            }
+        }
+
+        return E_INVALIDARG;    // Unterminated string.
+    }
+};
+
+
+//-------------------------------------------------------------------
+// JsonParse
+//
+// Parses one JSON document.
+//-------------------------------------------------------------------
+
+HRESULT JsonParse(const char *pszText, size_t cch, JsonValue *pValue)
+{
+    JsonParser parser(pszText, cch);
+
+    *pValue = JsonValue();
+
+    return parser.ParseDocument(pValue);
+}
+
+
+//-------------------------------------------------------------------
+// JsonValue lookups
+//-------------------------------------------------------------------
+
+const JsonValue* JsonValue::Find(const char *szKey) const
+{
+    if (type != JSON_OBJECT)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (members[i].first == szKey)
+        {
+            return &members[i].second;
+        }
+    }
+    return NULL;
+}
+
+double JsonValue::GetNumber(const char *szKey, double defaultValue) const
+{
+    const JsonValue *pValue = Find(szKey);
+    return (pValue && pValue->type == JSON_NUMBER) ? pValue->number : defaultValue;
+}
+
+bool JsonValue::GetBool(const char *szKey, bool defaultValue) const
+{
+    const JsonValue *pValue = Find(szKey);
+    return (pValue && pValue->type == JSON_BOOL) ? pValue->boolean : defaultValue;
+}
+
+std::string JsonValue::GetString(const char *szKey, const char *szDefault) const
+{
+    const JsonValue *pValue = Find(szKey);
+    return (pValue && pValue->type == JSON_STRING) ? pValue->str : std::string(szDefault);
+}
+
+
+//-------------------------------------------------------------------
+// JsonWriter
+//-------------------------------------------------------------------
+
+void JsonWriter::Separator()
+{
+    if (m_bAfterKey)
+    {
+        m_bAfterKey = false;
+        return;
+    }
+
+    if (!m_first.empty())
+    {
+        if (!m_first.back())
+        {
+            m_text.push_back(',');
+        }
+        m_first.back() = false;
+    }
+}
+
+void JsonWriter::BeginObject()
+{
+    Separator();
+    m_text.push_back('{');
+    m_first.push_back(true);
+}
+
+void JsonWriter::EndObject()
+{
+    m_text.push_back('}');
+    m_first.pop_back();
+}
+
+void JsonWriter::BeginArray()
+{
+    Separator();
+    m_text.push_back('[');
+    m_first.push_back(true);
+}
+
+void JsonWriter::EndArray()
+{
+    m_text.push_back(']');
+    m_first.pop_back();
+}
+
+void JsonWriter::Key(const char *szKey)
+{
+    Separator();
+    AppendEscaped(szKey);
+    m_text.push_back(':');
+    m_bAfterKey = true;
+}
+
+void JsonWriter::String(const char *psz)
+{
+    Separator();
+    AppendEscaped(psz);
+}
+
+void JsonWriter::StringW(const WCHAR *wsz)
+{
+    String(WideToUtf8(wsz));
+}
+
+void JsonWriter::Number(double value)
+{
+    char buffer[32];
+
+    // JSON has no NaN or infinity.
+    if (!_finite(value))
+    {
+        Null();
+        return;
+    }
+
+    Separator();
+    StringCchPrintfA(buffer, ARRAYSIZE(buffer), "%.3f", value);
+    m_text.append(buffer);
+}
+
+void JsonWriter::Integer(LONGLONG value)
+{
+    char buffer[32];
+
+    Separator();
+    StringCchPrintfA(buffer, ARRAYSIZE(buffer), "%I64d", value);
+    m_text.append(buffer);
+}
+
+void JsonWriter::Bool(bool value)
+{
+    Separator();
+    m_text.append(value ? "true" : "false");
+}
+
+void JsonWriter::Null()
+{
+    Separator();
+    m_text.append("null");
+}
+
+void JsonWriter::HResult(HRESULT hr)
+{
+    char buffer[16];
+
+    Separator();
+    StringCchPrintfA(buffer, ARRAYSIZE(buffer), "\"0x%08X\"", (UINT32)hr);
+    m_text.append(buffer);
+}
+
+void JsonWriter::Base64(const BYTE *pData, size_t cbData)
+{
+    Separator();
+
+    m_text.reserve(m_text.size() + ((cbData + 2) / 3) * 4 + 2);
+    m_text.push_back('"');
+
+    size_t i = 0;
+    for (; i + 2 < cbData; i += 3)
+    {
+        UINT32 v = (pData[i] << 16) | (pData[i + 1] << 8) | pData[i + 2];
+        m_text.push_back(BASE64_CHARS[(v >> 18) & 0x3F]);
+        m_text.push_back(BASE64_CHARS[(v >> 12) & 0x3F]);
+        m_text.push_back(BASE64_CHARS[(v >> 6) & 0x3F]);
+        m_text.push_back(BASE64_CHARS[v & 0x3F]);
+    }
+
+    if (i < cbData)
+    {
+        UINT32 v = pData[i] << 16;
+        if (i + 1 < cbData)
+        {
+            v |= pData[i + 1] << 8;
+        }
+
+        m_text.push_back(BASE64_CHARS[(v >> 18) & 0x3F]);
+        m_text.push_back(BASE64_CHARS[(v >> 12) & 0x3F]);
+        m_text.push_back((i + 1 < cbData) ? BASE64_CHARS[(v >> 6) & 0x3F] : '=');
+        m_text.push_back('=');
+    }
+
+    m_text.push_back('"');
+}
+
+void JsonWriter::AppendEscaped(const char *psz)
+{
+    m_text.push_back('"');
+
+    for (; *psz; ++psz)
+    {
+        unsigned char c = (unsigned char)*psz;
+        switch (c)
+        {
+        case '"':  m_text.append("\\\""); break;
+        case '\\': m_text.append("\\\\"); break;
+        case '\n': m_text.append("\\n");  break;
+        case '\r': m_text.append("\\r");  break;
+        case '\t': m_text.append("\\t");  break;
+        default:
+            if (c < 0x20)
+            {
+                char buffer[8];
+                StringCchPrintfA(buffer, ARRAYSIZE(buffer), "\\u%04x", c);
+                m_text.append(buffer);
+            }
+            else
+            {
+                m_text.push_back((char)c);
+            }
+            break;
+        }
+    }
+
+    m_text.push_back('"');
+}
+
+
+//-------------------------------------------------------------------
+// UTF-8 conversion helpers
+//-------------------------------------------------------------------
+
+std::wstring Utf8ToWide(const std::string& str)
+{
+    if (str.empty())
+    {
+        return std::wstring();
+    }
+
+    int cch = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), NULL, 0);
+    if (cch <= 0)
+    {
+        return std::wstring();
+    }
+
+    std::wstring wstr(cch, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &wstr[0], cch);
+    return wstr;
+}
+
+std::string WideToUtf8(const WCHAR *wsz)
+{
+    int cchWide = (int)wcslen(wsz);
+    if (cchWide == 0)
+    {
+        return std::string();
+    }
+
+    int cb = WideCharToMultiByte(CP_UTF8, 0, wsz, cchWide, NULL, 0, NULL, NULL);
+    if (cb <= 0)
+    {
+        return std::string();
+    }
+
+    std::string str(cb, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wsz, cchWide, &str[0], cb, NULL, NULL);
+    return str;
+}
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Minimal JSON reader and writer for the request protocol.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// NOTE: Scope
+//
+// This is not a general purpose JSON library. It handles one request or
+// response per line (UTF-8), which is all the daemon protocol needs.
+// Strings are kept as UTF-8; use Utf8ToWide for paths. A \u escape of
+// a UTF-16 surrogate must be one half of a pair. Numbers that are not
+// finite are written as null.
+
+class JsonValue
+{
+public:
+    enum Type
+    {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Type                    type;
+    bool                    boolean;
+    double                  number;
+    std::string             str;
+    std::vector<JsonValue>  items;                                  // JSON_ARRAY
+    std::vector< std::pair<std::string, JsonValue> > members;       // JSON_OBJECT
+
+    JsonValue() : type(JSON_NULL), boolean(false), number(0)
+    {
+    }
+
+    const JsonValue* Find(const char *szKey) const;
+
+    // Typed lookups for object members. They return the default value
+    // if the member is missing or has a different type.
+    double          GetNumber(const char *szKey, double defaultValue) const;
+    bool            GetBool(const char *szKey, bool defaultValue) const;
+    std::string     GetString(const char *szKey, const char *szDefault) const;
+};
+
+HRESULT JsonParse(const char *pszText, size_t cch, JsonValue *pValue);
+
+
+// JsonWriter: Builds a single-line JSON document.
+
+class JsonWriter
+{
+    std::string         m_text;
+    std::vector<bool>   m_first;    // One entry per open object/array.
+    bool                m_bAfterKey;
+
+public:
+    JsonWriter() : m_bAfterKey(false)
+    {
+    }
+
+    void    BeginObject();
+    void    EndObject();
+    void    BeginArray();
+    void    EndArray();
+    void    Key(const char *szKey);
+
+    void    String(const char *psz);
+    void    String(const std::string& str) { String(str.c_str()); }
+    void    StringW(const WCHAR *wsz);
+    void    Number(double value);
+    void    Integer(LONGLONG value);
+    void    Bool(bool value);
+    void    Null();
+    void    Base64(const BYTE *pData, size_t cbData);
+    void    HResult(HRESULT hr);
+
+    const std::string& Text() const { return m_text; }
+
+private:
+    void    Separator();
+    void    AppendEscaped(const char *psz);
+};
+
+std::wstring    Utf8ToWide(const std::string& str);
+std::string     WideToUtf8(const WCHAR *wsz);
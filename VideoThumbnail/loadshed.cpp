@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// LoadShedder: Trades thumbnail quality for latency under overload.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "loadshed.h"
+
+// Weight of the latest wait in the smoothed wait.
+static const double WAIT_SMOOTHING = 0.25;
+
+
+//-------------------------------------------------------------------
+// DegradationName
+//-------------------------------------------------------------------
+
+const char *DegradationName(uint32_t degradation)
+{
+    switch (degradation)
+    {
+    case DEGRADE_KEYFRAME_SEEK:
+        return "keyframe_seek";
+
+    case DEGRADE_FAST_SCALE:
+        return "fast_scale";
+
+    case DEGRADE_FAST_ENCODE:
+        return "fast_encode";
+
+    default:
+        return "";
+    }
+}
+
+
+//-------------------------------------------------------------------
+// LoadShedder constructor
+//-------------------------------------------------------------------
+
+LoadShedder::LoadShedder()
+    : m_lastChange(Clock::now()),
+      m_bHaveWait(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// SetTargets
+//-------------------------------------------------------------------
+
+void LoadShedder::SetTargets(const LoadTargets& targets)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_targets = targets;
+}
+
+
+//-------------------------------------------------------------------
+// StartPass
+//
+// Updates the level with the load that a pass sees as it starts.
+//-------------------------------------------------------------------
+
+uint32_t LoadShedder::StartPass(uint32_t queueDepth, double waitMs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!IsEnabled())
+    {
+        return DEGRADE_NONE;
+    }
+
+    m_stats.waitMs = m_bHaveWait ? m_stats.waitMs + WAIT_SMOOTHING * (waitMs - m_stats.waitMs) : waitMs;
+    m_bHaveWait = true;
+
+    const bool bOver =
+        (m_targets.queueDepth > 0 && queueDepth > m_targets.queueDepth) ||
+        (m_targets.waitMs > 0 && m_stats.waitMs > m_targets.waitMs);
+
+    const bool bUnder =
+        (m_targets.queueDepth == 0 || 2 * queueDepth <= m_targets.queueDepth) &&
+        (m_targets.waitMs == 0 || 2 * m_stats.waitMs <= m_targets.waitMs);
+
+    Clock::time_point now = Clock::now();
+
+    if (now - m_lastChange >= std::chrono::milliseconds(m_targets.holdMs))
+    {
+        if (bOver && m_stats.level < DEGRADE_LEVELS)
+        {
+            m_stats.level++;
+            m_stats.cRaised++;
+            m_lastChange = now;
+
+            if (m_stats.level > m_stats.levelMax)
+            {
+                m_stats.levelMax = m_stats.level;
+            }
+        }
+        else if (bUnder && m_stats.level > 0)
+        {
+            m_stats.level--;
+            m_stats.cLowered++;
+            m_lastChange = now;
+        }
+    }
+
+    m_stats.cPasses++;
+    if (m_stats.level > 0)
+    {
+        m_stats.cDegradedPasses++;
+    }
+
+    return DegradationsAt(m_stats.level);
+}
+
+
+//-------------------------------------------------------------------
+// GetStats
+//-------------------------------------------------------------------
+
+void LoadShedder::GetStats(LoadShedStats *pStats)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    *pStats = m_stats;
+}
+
+
+//-------------------------------------------------------------------
+// DegradationsAt
+//-------------------------------------------------------------------
+
+uint32_t LoadShedder::DegradationsAt(uint32_t level)
+{
+    static const uint32_t flags[DEGRADE_LEVELS + 1] =
+    {
+        DEGRADE_NONE,
+        DEGRADE_KEYFRAME_SEEK,
+        DEGRADE_KEYFRAME_SEEK | DEGRADE_FAST_SCALE,
+        DEGRADE_KEYFRAME_SEEK | DEGRADE_FAST_SCALE | DEGRADE_FAST_ENCODE
+    };
+
+    return flags[(level < DEGRADE_LEVELS) ? level : DEGRADE_LEVELS];
+}
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// LoadShedder: Trades thumbnail quality for latency under overload.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+
+// NOTE: Load shedding
+//
+// When requests arrive faster than the workers can serve them, a
+// thumbnail that is a little less accurate but on time is worth more
+// than an exact one that is late. A LoadShedder picks, for each pass,
+// which of these cheaper settings to use:
+//
+//   - DEGRADE_KEYFRAME_SEEK: use the first frame after each seek, which
+//     is a keyframe, instead of decoding on to the frame within
+//     SEEK_TOLERANCE of the position. The frame can be up to a GOP
+//     early.
+//   - DEGRADE_FAST_SCALE: scale with bilinear filtering instead of
+//     Fant, which averages every source pixel.
+//   - DEGRADE_FAST_ENCODE: encode JPEG at FAST_JPEG_QUALITY at most,
+//     and PNG without row filters.
+//
+// They are applied in that order, one level at a time: level 1 uses the
+// first, level 3 all three. At the start of each pass, StartPass is
+// given the number of queued requests and how long the pass's first
+// request waited. The wait is smoothed over recent passes, and the load
+// is over its targets (LoadTargets) when the queue is deeper than
+// queueDepth or the smoothed wait longer than waitMs. Then the level
+// goes up one step. It comes down one step when the load is under half
+// of both targets. To keep the level from flapping, it changes at most
+// once every holdMs. Full quality therefore comes back holdMs per level
+// after the load drops.
+//
+// The flags that StartPass returns are meant to be recorded with each
+// result, so that callers can tell a degraded thumbnail from a full one.
+//
+// Like framesource.h, this depends only on the C++ standard library.
+
+enum DEGRADATION
+{
+    DEGRADE_NONE            = 0,
+    DEGRADE_KEYFRAME_SEEK   = 0x1,
+    DEGRADE_FAST_SCALE      = 0x2,
+    DEGRADE_FAST_ENCODE     = 0x4
+};
+
+const uint32_t DEGRADE_LEVELS = 3;
+
+// JPEG quality [0 ... 1] with DEGRADE_FAST_ENCODE.
+const float FAST_JPEG_QUALITY = 0.6f;
+
+// Name of a DEGRADE_* flag in responses and statistics, such as
+// "keyframe_seek".
+const char *DegradationName(uint32_t degradation);
+
+struct LoadTargets
+{
+    uint32_t    queueDepth;     // Most requests queued; 0 for no limit.
+    uint32_t    waitMs;         // Longest smoothed wait in the queue; 0 for no limit.
+    uint32_t    holdMs;         // Least time between changes of level.
+
+    LoadTargets() : queueDepth(0), waitMs(0), holdMs(1000)
+    {
+    }
+};
+
+struct LoadShedStats
+{
+    uint32_t    level;
+    uint32_t    levelMax;
+    uint64_t    cRaised;
+    uint64_t    cLowered;
+    uint64_t    cPasses;
+    uint64_t    cDegradedPasses;
+    double      waitMs;         // Smoothed.
+
+    LoadShedStats() : level(0), levelMax(0), cRaised(0), cLowered(0), cPasses(0), cDegradedPasses(0), waitMs(0)
+    {
+    }
+};
+
+
+class LoadShedder
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::mutex          m_mutex;
+    LoadTargets         m_targets;
+    LoadShedStats       m_stats;
+    Clock::time_point   m_lastChange;
+    bool                m_bHaveWait;
+
+public:
+
+    LoadShedder();
+
+    // Call before the workers start. With no targets, StartPass always
+    // returns DEGRADE_NONE.
+    void        SetTargets(const LoadTargets& targets);
+    bool        IsEnabled() const { return m_targets.queueDepth > 0 || m_targets.waitMs > 0; }
+
+    // Returns the DEGRADE_* flags for a pass that starts now.
+    uint32_t    StartPass(uint32_t queueDepth, double waitMs);
+
+    void        GetStats(LoadShedStats *pStats);
+
+    // The flags used at a level.
+    static uint32_t DegradationsAt(uint32_t level);
+};
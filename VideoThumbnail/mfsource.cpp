@@ -0,0 +1,1669 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MFFrameSource: Frame source for the Media Foundation source reader.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "mfsource.h"
+
+RECT    CorrectAspectRatio(const RECT& src, const MFRatio& srcPAR);
+HRESULT GetVideoDisplayArea(IMFMediaType *pType, MFVideoArea *pArea);
+RECT    RectFromArea(const MFVideoArea& area);
+void    GetPixelAspectRatio(IMFMediaType *pType, MFRatio *pPar);
+
+
+//-------------------------------------------------------------------
+// MFFrameSource constructor
+//-------------------------------------------------------------------
+
+MFFrameSource::MFFrameSource()
+    : m_pReader(NULL),
+      m_pQuality(NULL),
+      m_pSample(NULL),
+      m_pBuffer(NULL),
+      m_p2DBuffer(NULL),
+      m_pData(NULL),
+      m_lPitch(0),
+      m_bConverted(FALSE),
+      m_bInterlacedFrame(FALSE),
+      m_bNV12(FALSE),
+      m_matrix(YUV_MATRIX_BT601),
+      m_lStride(0),
+      m_frameWidth(0),
+      m_frameHeight(0),
+      m_bInterlacedStream(FALSE),
+      m_bFieldDrop(FALSE),
+      m_reduceShift(0),
+      m_targetWidth(0),
+      m_targetHeight(0),
+      m_hnsSkipThreshold(INT64_MIN),
+      m_hnsLastFrame(FRAME_TIME_UNKNOWN),
+      m_dropMode(MF_DROP_MODE_NONE),
+      m_pPool(NULL),
+      m_pCallback(NULL),
+      m_pMediaSource(NULL),
+      m_pByteStream(NULL),
+      m_bCancelled(FALSE),
+      m_hrLast(S_OK)
+{
+}
+
+
+//-------------------------------------------------------------------
+// MFFrameSource destructor
+//-------------------------------------------------------------------
+
+MFFrameSource::~MFFrameSource()
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// OpenURL: Opens a video file or URL.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::OpenURL(const WCHAR *wszURL)
+{
+    HRESULT hr = S_OK;
+
+    IMFAttributes *pAttributes = NULL;
+
+    Close();
+
+    hr = CreateReaderAttributes(&pAttributes);
+
+    // Create the source reader from the URL.
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MFCreateSourceReaderFromURL(wszURL, pAttributes, &m_pReader);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Attempt to find a video stream.
+        hr = SelectVideoStream();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        GetMediaSource();
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    SafeRelease(&pAttributes);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// OpenByteStream: Opens a video from a byte stream.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::OpenByteStream(IMFByteStream *pByteStream)
+{
+    HRESULT hr = S_OK;
+
+    IMFAttributes *pAttributes = NULL;
+
+    Close();
+
+    hr = CreateReaderAttributes(&pAttributes);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MFCreateSourceReaderFromByteStream(pByteStream, pAttributes, &m_pReader);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Attempt to find a video stream.
+        hr = SelectVideoStream();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        GetMediaSource();
+
+        m_pByteStream = pByteStream;
+        m_pByteStream->AddRef();
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    SafeRelease(&pAttributes);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Attach
+//
+// Takes over a reader that was configured by an earlier MFFrameSource,
+// together with its format. Takes ownership of the caller's reference
+// to the reader.
+//
+// pByteStream:  Optional; the stream that the reader reads from, for
+//               Cancel. A reference is added.
+//-------------------------------------------------------------------
+
+void MFFrameSource::Attach(IMFSourceReader *pReader, const FormatInfo& format, IMFByteStream *pByteStream)
+{
+    Close();
+
+    m_pReader = pReader;
+    m_format = format;
+
+    if (pByteStream)
+    {
+        m_pByteStream = pByteStream;
+        m_pByteStream->AddRef();
+    }
+
+    // Read the output type again for the conversion settings.
+    FormatInfo current;
+
+    if (SUCCEEDED(GetVideoFormat(&current)))
+    {
+        m_format = current;
+    }
+
+    GetQualityAdvise();
+    GetMediaSource();
+}
+
+
+//-------------------------------------------------------------------
+// Detach
+//
+// Gives up the reader and its format. The caller owns the reference.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::Detach(IMFSourceReader **ppReader, FormatInfo *pFormat)
+{
+    if (m_pReader == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (m_bCancelled)
+    {
+        return MF_E_SHUTDOWN;   // Its media source is shut down.
+    }
+
+    ReleaseFrame();
+
+    // The decoder stays with the reader, so leave it decoding every frame.
+    SetSkipThreshold(INT64_MIN);
+    SafeRelease(&m_pQuality);
+    SafeRelease(&m_pMediaSource);
+    SafeRelease(&m_pByteStream);
+
+    *ppReader = m_pReader;
+    *pFormat = m_format;
+
+    m_pReader = NULL;
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Close
+//-------------------------------------------------------------------
+
+void MFFrameSource::Close()
+{
+    ReleaseFrame();
+    SafeRelease(&m_pQuality);
+    SafeRelease(&m_pMediaSource);
+    SafeRelease(&m_pByteStream);
+    SafeRelease(&m_pReader);
+
+    m_bCancelled = FALSE;
+    m_format = FormatInfo();
+    m_bNV12 = FALSE;
+    m_reduceShift = 0;
+    m_hnsSkipThreshold = INT64_MIN;
+    m_dropMode = MF_DROP_MODE_NONE;
+    m_hrLast = S_OK;
+}
+
+
+// FrameSource methods
+
+FRAME_STATUS MFFrameSource::GetFormat(FrameFormat *pFormat)
+{
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    pFormat->width = m_format.imageWidthPels;
+    pFormat->height = m_format.imageHeightPels;
+    pFormat->bTopDown = (m_format.bTopDown != FALSE);
+    pFormat->pictureLeft = m_format.rcPicture.left;
+    pFormat->pictureTop = m_format.rcPicture.top;
+    pFormat->pictureRight = m_format.rcPicture.right;
+    pFormat->pictureBottom = m_format.rcPicture.bottom;
+    pFormat->rotation = (uint32_t)m_format.rotation;   // MFVideoRotationFormat is in degrees.
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS MFFrameSource::GetDuration(int64_t *phnsDuration)
+{
+    PROPVARIANT var;
+    PropVariantInit(&var);
+
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    HRESULT hr = m_pReader->GetPresentationAttribute(
+        (DWORD)MF_SOURCE_READER_MEDIASOURCE,
+        MF_PD_DURATION,
+        &var
+        );
+
+    if (SUCCEEDED(hr))
+    {
+        assert(var.vt == VT_UI8);
+        *phnsDuration = (int64_t)var.uhVal.QuadPart;
+    }
+
+    PropVariantClear(&var);
+
+    return SUCCEEDED(hr) ? FRAME_OK : Fail(hr);
+}
+
+FRAME_STATUS MFFrameSource::CanSeek(bool *pbCanSeek)
+{
+    ULONG flags = 0;
+
+    PROPVARIANT var;
+    PropVariantInit(&var);
+
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    *pbCanSeek = false;
+
+    HRESULT hr = m_pReader->GetPresentationAttribute(
+        (DWORD)MF_SOURCE_READER_MEDIASOURCE,
+        MF_SOURCE_READER_MEDIASOURCE_CHARACTERISTICS,
+        &var
+        );
+
+    if (SUCCEEDED(hr))
+    {
+        hr = PropVariantToUInt32(var, &flags);
+    }
+
+    PropVariantClear(&var);
+
+    if (FAILED(hr))
+    {
+        return Fail(hr);
+    }
+
+    // If the source has slow seeking, we will treat it as
+    // not supporting seeking.
+
+    if ((flags & MFMEDIASOURCE_CAN_SEEK) &&
+        !(flags & MFMEDIASOURCE_HAS_SLOW_SEEK))
+    {
+        *pbCanSeek = true;
+    }
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS MFFrameSource::Seek(int64_t hnsPosition)
+{
+    PROPVARIANT var;
+    PropVariantInit(&var);
+
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    ReleaseFrame();
+
+    m_hnsLastFrame = FRAME_TIME_UNKNOWN;
+
+    var.vt = VT_I8;
+    var.hVal.QuadPart = hnsPosition;
+
+    HRESULT hr = m_pReader->SetCurrentPosition(GUID_NULL, var);
+
+    return SUCCEEDED(hr) ? FRAME_OK : Fail(hr);
+}
+
+FRAME_STATUS MFFrameSource::ReadFrame(FrameView *pFrame, bool *pbFormatChanged)
+{
+    HRESULT hr = S_OK;
+    FRAME_STATUS status = FRAME_OK;
+
+    DWORD dwFlags = 0;
+    bool bFrame = false;
+
+    IMFSample *pSample = NULL;
+
+    *pbFormatChanged = false;
+
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    if (m_pCallback)
+    {
+        return Fail(MF_E_INVALIDREQUEST);   // Asynchronous mode.
+    }
+
+    UpdateDropMode();
+
+    while (status == FRAME_OK && !bFrame)
+    {
+        if (m_bCancelled)
+        {
+            return FRAME_E_CANCELLED;
+        }
+
+        hr = m_pReader->ReadSample(
+            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+            0,
+            NULL,
+            &dwFlags,
+            NULL,
+            &pSample
+            );
+
+        status = AcceptFrame(hr, dwFlags, pSample, pFrame, pbFormatChanged, &bFrame);
+
+        SafeRelease(&pSample);
+    }
+
+    return status;
+}
+
+FRAME_STATUS MFFrameSource::ConvertFrame(FrameView *pFrame)
+{
+    HRESULT hr = LockFrame();
+
+    if (SUCCEEDED(hr) && m_bNV12 && !m_bConverted)
+    {
+        try
+        {
+            m_bgra.resize((size_t)4 * m_format.imageWidthPels * m_format.imageHeightPels);
+        }
+        catch (std::bad_alloc&)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            ConvertNV12Rows(0, m_format.imageHeightPels, &m_bgra[0], (LONG)(4 * m_format.imageWidthPels));
+            m_bConverted = TRUE;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        return Fail(hr);
+    }
+
+    // The video processor already converted RGB32 frames.
+    pFrame->pData = m_bNV12 ? &m_bgra[0] : m_pData;
+    pFrame->stride = (int32_t)(4 * m_format.imageWidthPels);
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS MFFrameSource::ConvertRows(uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride)
+{
+    HRESULT hr = LockFrame();
+
+    if (FAILED(hr))
+    {
+        return Fail(hr);
+    }
+
+    if (firstRow >= m_format.imageHeightPels)
+    {
+        return FRAME_OK;
+    }
+
+    if (cRows > m_format.imageHeightPels - firstRow)
+    {
+        cRows = m_format.imageHeightPels - firstRow;
+    }
+
+    if (m_bNV12)
+    {
+        ConvertNV12Rows(firstRow, cRows, pDest, destStride);
+    }
+    else
+    {
+        const size_t cbRow = (size_t)4 * m_format.imageWidthPels;
+
+        for (uint32_t i = 0; i < cRows; i++)
+        {
+            memcpy(pDest + (ptrdiff_t)i * destStride, m_pData + cbRow * (firstRow + i), cbRow);
+        }
+    }
+
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// SetSkipThreshold
+//
+// Frames before the threshold will be skipped. If the decoder supports
+// it, let it drop frames that nothing else depends on until the reader
+// gets there.
+//-------------------------------------------------------------------
+
+void MFFrameSource::SetSkipThreshold(int64_t hnsThreshold)
+{
+    m_hnsSkipThreshold = hnsThreshold;
+
+    UpdateDropMode();
+}
+
+
+//-------------------------------------------------------------------
+// Cancel
+//
+// Called on another thread, such as a watchdog's, while a read may be
+// blocked in the reader. Shutting down the media source fails the read
+// with MF_E_SHUTDOWN, and the reader cannot be used afterwards. The
+// source's own reads from the byte stream are not interrupted by the
+// shutdown, so the stream is closed as well.
+//-------------------------------------------------------------------
+
+void MFFrameSource::Cancel()
+{
+    InterlockedExchange(&m_bCancelled, TRUE);
+
+    if (m_pMediaSource)
+    {
+        (void)m_pMediaSource->Shutdown();
+    }
+
+    if (m_pByteStream)
+    {
+        (void)m_pByteStream->Close();
+    }
+}
+
+
+//-------------------------------------------------------------------
+// RequestFrame
+//
+// Asks a reader in asynchronous mode for the next frame. The result
+// arrives in the callback's OnReadSample.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MFFrameSource::RequestFrame()
+{
+    if (m_pReader == NULL)
+    {
+        return Fail(MF_E_NOT_INITIALIZED);
+    }
+
+    UpdateDropMode();
+
+    HRESULT hr = m_pReader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, NULL, NULL, NULL, NULL);
+
+    return SUCCEEDED(hr) ? FRAME_OK : Fail(hr);
+}
+
+
+//-------------------------------------------------------------------
+// AcceptFrame
+//
+// Takes the result of a ReadSample, as ReadFrame returns it. The frame,
+// if there is one, becomes the current frame; the caller keeps its own
+// reference to pSample.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MFFrameSource::AcceptFrame(
+    HRESULT hrStatus,
+    DWORD dwFlags,
+    IMFSample *pSample,
+    FrameView *pFrame,
+    bool *pbFormatChanged,
+    bool *pbFrame
+    )
+{
+    HRESULT hr = S_OK;
+
+    LONGLONG hnsTimeStamp = 0;
+
+    *pbFrame = false;
+
+    if (FAILED(hrStatus))
+    {
+        return Fail(hrStatus);
+    }
+
+    if (dwFlags & MF_SOURCE_READERF_ENDOFSTREAM)
+    {
+        return FRAME_END_OF_STREAM;     // Keep the last frame.
+    }
+
+    if (dwFlags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
+    {
+        // Type change. Get the new format.
+        hr = GetVideoFormat(&m_format);
+
+        if (FAILED(hr))
+        {
+            return Fail(hr);
+        }
+
+        *pbFormatChanged = true;
+    }
+
+    if (pSample == NULL)
+    {
+        return FRAME_OK;                // A stream tick; read again.
+    }
+
+    // Keep the sample as the decoder gave it. Frames that are skipped
+    // are never copied or converted.
+
+    ReleaseFrame();
+
+    m_pSample = pSample;
+    m_pSample->AddRef();
+
+    *pbFrame = true;
+
+    m_bInterlacedFrame = MFGetAttributeUINT32(pSample, MFSampleExtension_Interlaced, m_bInterlacedStream);
+
+    if (SUCCEEDED(pSample->GetSampleTime(&hnsTimeStamp)))
+    {
+        m_hnsLastFrame = hnsTimeStamp;
+    }
+    else
+    {
+        hnsTimeStamp = FRAME_TIME_UNKNOWN;
+    }
+
+    pFrame->pData = NULL;
+    pFrame->stride = 0;
+    pFrame->timestamp = hnsTimeStamp;
+    pFrame->bKeyframe = (MFGetAttributeUINT32(pSample, MFSampleExtension_CleanPoint, FALSE) != FALSE);
+
+    return FRAME_OK;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// CreateReaderAttributes
+//
+// Creates the attributes used to configure the source reader.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::CreateReaderAttributes(IMFAttributes **ppAttributes)
+{
+    HRESULT hr = S_OK;
+
+    IMFAttributes *pAttributes = NULL;
+
+    // Configure the source reader to perform video processing.
+    //
+    // This includes:
+    //   - YUV to RGB-32
+    //   - Software deinterlace
+    //
+    // It is only used when the decoder's NV12 output is not taken; see
+    // SelectVideoStream.
+
+    hr = MFCreateAttributes(&pAttributes, 2);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pAttributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+    }
+
+    if (SUCCEEDED(hr) && m_pCallback)
+    {
+        hr = pAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, m_pCallback);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        *ppAttributes = pAttributes;
+        (*ppAttributes)->AddRef();
+    }
+
+    SafeRelease(&pAttributes);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// SelectVideoStream
+//
+// Finds the first video stream and sets the format to NV12 from the
+// decoder, or else to RGB32 from the video processor.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::SelectVideoStream()
+{
+    HRESULT hr = S_OK;
+
+    IMFMediaType *pType = NULL;
+
+    // Prefer the decoder's own NV12 output, which needs no video processor
+    // and is only converted for the frames we draw. Unless fields are
+    // dropped, interlaced streams go through the processor so that they
+    // are deinterlaced; streams that mix progressive and interlaced
+    // frames flag each sample.
+
+    hr = SetOutputSubtype(MFVideoFormat_NV12);
+
+    if (SUCCEEDED(hr) && !m_bFieldDrop)
+    {
+        hr = m_pReader->GetCurrentMediaType(
+            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, &pType);
+    }
+
+    if (SUCCEEDED(hr) && pType)
+    {
+        UINT32 mode = MFGetAttributeUINT32(pType, MF_MT_INTERLACE_MODE, MFVideoInterlace_Unknown);
+
+        if (mode != MFVideoInterlace_Progressive &&
+            mode != MFVideoInterlace_MixedInterlaceOrProgressive &&
+            mode != MFVideoInterlace_Unknown)
+        {
+            hr = MF_E_INVALIDMEDIATYPE;
+        }
+    }
+
+    // Otherwise the source reader loads the video processor to convert
+    // and deinterlace.
+    if (FAILED(hr))
+    {
+        hr = SetOutputSubtype(MFVideoFormat_RGB32);
+    }
+
+    // Ensure the stream is selected.
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pReader->SetStreamSelection(
+            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = GetVideoFormat(&m_format);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        GetQualityAdvise();
+    }
+
+    SafeRelease(&pType);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// SetOutputSubtype
+//
+// Sets the output format of the video stream. The source reader will
+// load the decoder if needed.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::SetOutputSubtype(const GUID& subtype)
+{
+    HRESULT hr = S_OK;
+
+    IMFMediaType *pType = NULL;
+
+    hr = MFCreateMediaType(&pType);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pType->SetGUID(MF_MT_SUBTYPE, subtype);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pReader->SetCurrentMediaType(
+            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+            NULL, pType);
+    }
+
+    SafeRelease(&pType);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetVideoFormat
+//
+// Gets format information for the video stream.
+//
+// pFormat: Receives the format information.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::GetVideoFormat(FormatInfo *pFormat)
+{
+    UINT32  width = 0, height = 0;
+    LONG lStride = 0;
+    MFVideoArea area;
+    RECT rcSrc;
+    UINT rotation = 0;
+
+    GUID subtype = { 0 };
+
+    IMFMediaType *pType = NULL;
+
+    // Get the media type from the stream.
+    HRESULT hr = m_pReader->GetCurrentMediaType(
+        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, &pType );
+
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    // Make sure it is a video format.
+    hr = pType->GetGUID(MF_MT_SUBTYPE, &subtype);
+    if (subtype != MFVideoFormat_RGB32 && subtype != MFVideoFormat_NV12)
+    {
+        hr = E_UNEXPECTED;
+        goto done;
+    }
+
+    // Get the width and height
+    hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    m_bNV12 = (subtype == MFVideoFormat_NV12);
+    m_frameWidth = width;
+    m_frameHeight = height;
+    m_bInterlacedStream = FALSE;
+    m_reduceShift = 0;
+
+    //Get rotation if possible
+    rotation = MFGetAttributeUINT32(pType, MF_MT_VIDEO_ROTATION, MFVideoRotationFormat_0);
+
+    pFormat->rotation = (MFVideoRotationFormat)rotation;
+
+    if (m_bNV12)
+    {
+        // ConvertFrame writes top-down BGRA.
+        m_lStride = (LONG)MFGetAttributeUINT32(pType, MF_MT_DEFAULT_STRIDE, width);
+
+        switch (MFGetAttributeUINT32(pType, MF_MT_YUV_MATRIX, MFVideoTransferMatrix_Unknown))
+        {
+        case MFVideoTransferMatrix_BT709:
+            m_matrix = YUV_MATRIX_BT709;
+            break;
+
+        case MFVideoTransferMatrix_BT601:
+            m_matrix = YUV_MATRIX_BT601;
+            break;
+
+        default:
+            m_matrix = DefaultYuvMatrix(height);
+            break;
+        }
+
+        UINT32 mode = MFGetAttributeUINT32(pType, MF_MT_INTERLACE_MODE, MFVideoInterlace_Unknown);
+
+        m_bInterlacedStream = (mode == MFVideoInterlace_FieldInterleavedUpperFirst ||
+            mode == MFVideoInterlace_FieldInterleavedLowerFirst);
+
+        // Drop a field of the frames that are interlaced, as part of a
+        // downscale to half size, or further if a target size is set.
+        if (m_bFieldDrop && mode != MFVideoInterlace_Progressive)
+        {
+            m_reduceShift = 1;
+
+            while (m_reduceShift < 3 && (m_targetWidth > 0 || m_targetHeight > 0) &&
+                   (width >> (m_reduceShift + 1)) >= m_targetWidth &&
+                   (height >> (m_reduceShift + 1)) >= m_targetHeight)
+            {
+                ++m_reduceShift;
+            }
+        }
+
+        pFormat->bTopDown = TRUE;
+    }
+    else
+    {
+        // Get the stride to find out if the bitmap is top-down or bottom-up.
+        lStride = (LONG)MFGetAttributeUINT32(pType, MF_MT_DEFAULT_STRIDE, 1);
+
+        pFormat->bTopDown = (lStride > 0);
+    }
+
+    hr = GetVideoDisplayArea(pType, &area);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+    rcSrc = RectFromArea(area);
+
+
+    // Get the pixel aspect ratio.
+    MFRatio par;
+    GetPixelAspectRatio(pType, &par);
+
+    pFormat->rcPicture = CorrectAspectRatio(rcSrc, par);
+    pFormat->rcPicture.right >>= m_reduceShift;
+    pFormat->rcPicture.bottom >>= m_reduceShift;
+    pFormat->imageWidthPels = width >> m_reduceShift;
+    pFormat->imageHeightPels = height >> m_reduceShift;
+
+done:
+    SafeRelease(&pType);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetQualityAdvise
+//
+// Gets the decoder's IMFQualityAdvise, if the decoder has one.
+//-------------------------------------------------------------------
+
+void MFFrameSource::GetQualityAdvise()
+{
+    SafeRelease(&m_pQuality);
+
+    m_dropMode = MF_DROP_MODE_NONE;
+
+    // Asking the stream for a service with GUID_NULL asks the decoder.
+    // Failure only means that skipped frames are decoded in full.
+    (void)m_pReader->GetServiceForStream(
+        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+        GUID_NULL,
+        IID_PPV_ARGS(&m_pQuality)
+        );
+}
+
+
+//-------------------------------------------------------------------
+// GetMediaSource
+//
+// Gets the media source under the reader, for Cancel. It is taken when
+// the reader is opened, since the reader cannot be asked for it while
+// another thread is blocked in ReadSample. Without it, Cancel only
+// fails the next call.
+//-------------------------------------------------------------------
+
+void MFFrameSource::GetMediaSource()
+{
+    SafeRelease(&m_pMediaSource);
+
+    (void)m_pReader->GetServiceForStream(
+        (DWORD)MF_SOURCE_READER_MEDIASOURCE,
+        GUID_NULL,
+        IID_PPV_ARGS(&m_pMediaSource)
+        );
+}
+
+
+//-------------------------------------------------------------------
+// UpdateDropMode
+//
+// Lets the decoder drop frames while the reader is before the skip
+// threshold. Reference frames are still decoded, so the frame at the
+// threshold is correct.
+//-------------------------------------------------------------------
+
+void MFFrameSource::UpdateDropMode()
+{
+    if (m_pQuality == NULL)
+    {
+        return;
+    }
+
+    // Right after a seek the position is before the target, unless there
+    // is no target.
+    BOOL bBefore = (m_hnsSkipThreshold != INT64_MIN) &&
+        (m_hnsLastFrame == FRAME_TIME_UNKNOWN || m_hnsLastFrame < m_hnsSkipThreshold);
+
+    MF_QUALITY_DROP_MODE mode = bBefore ? MF_DROP_MODE_1 : MF_DROP_MODE_NONE;
+
+    if (mode != m_dropMode)
+    {
+        if (SUCCEEDED(m_pQuality->SetDropMode(mode)))
+        {
+            m_dropMode = mode;
+        }
+        else
+        {
+            // The decoder does not drop frames after all.
+            SafeRelease(&m_pQuality);
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// LockFrame
+//
+// Locks the buffer of the current sample, once for each sample. NV12
+// buffers are locked in place if they are 2-D buffers, to avoid a copy.
+//-------------------------------------------------------------------
+
+HRESULT MFFrameSource::LockFrame()
+{
+    HRESULT hr = S_OK;
+
+    IMFMediaBuffer *pBuffer = NULL;
+    IMF2DBuffer *p2DBuffer = NULL;
+    BYTE *pData = NULL;
+    LONG lPitch = 0;
+    DWORD cbData = 0;
+
+    if (m_pSample == NULL)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+
+    if (m_pData)
+    {
+        return S_OK;
+    }
+
+    if (m_bNV12)
+    {
+        hr = m_pSample->GetBufferByIndex(0, &pBuffer);
+
+        if (SUCCEEDED(hr) && SUCCEEDED(pBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer))))
+        {
+            hr = p2DBuffer->Lock2D(&pData, &lPitch);
+            goto done;
+        }
+
+        SafeRelease(&pBuffer);
+    }
+
+    hr = m_pSample->ConvertToContiguousBuffer(&pBuffer);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pBuffer->Lock(&pData, NULL, &cbData);
+    }
+
+    if (FAILED(hr)) { goto done; }
+
+    if (m_bNV12)
+    {
+        lPitch = (m_lStride != 0) ? m_lStride : (LONG)m_frameWidth;
+
+        if (cbData < (DWORD)lPitch * m_frameHeight * 3 / 2)
+        {
+            hr = E_UNEXPECTED;
+        }
+    }
+    else
+    {
+        lPitch = (LONG)(4 * m_format.imageWidthPels);
+
+        assert(cbData == (4 * m_format.imageWidthPels * m_format.imageHeightPels));
+    }
+
+    if (FAILED(hr))
+    {
+        pBuffer->Unlock();
+    }
+
+done:
+    if (SUCCEEDED(hr))
+    {
+        m_pBuffer = pBuffer;
+        m_pBuffer->AddRef();
+        m_p2DBuffer = p2DBuffer;
+        if (m_p2DBuffer)
+        {
+            m_p2DBuffer->AddRef();
+        }
+        m_pData = pData;
+        m_lPitch = lPitch;
+    }
+
+    SafeRelease(&p2DBuffer);
+    SafeRelease(&pBuffer);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// ConvertNV12Rows
+//
+// Converts rows of the locked NV12 frame to BGRA, reduced by
+// m_reduceShift.
+//-------------------------------------------------------------------
+
+void MFFrameSource::ConvertNV12Rows(UINT32 firstRow, UINT32 cRows, BYTE *pDest, LONG destStride)
+{
+    YuvImage image;
+
+    image.width = m_frameWidth;
+    image.height = m_frameHeight;
+    image.pY = m_pData;
+    image.strideY = m_lPitch;
+    image.pU = m_pData + (ptrdiff_t)m_lPitch * m_frameHeight;   // The UV plane follows the Y plane.
+    image.pV = image.pU + 1;
+    image.strideUV = m_lPitch;
+    image.chromaStep = 2;
+    image.chromaShiftX = 1;
+    image.chromaShiftY = 1;
+    image.bTopFieldOnly = (m_bInterlacedFrame != FALSE);
+
+    ConvertYuvRowsToBgra(image, m_matrix, m_reduceShift, firstRow, cRows, pDest, destStride, m_pPool);
+}
+
+
+//-------------------------------------------------------------------
+// ReleaseFrame
+//
+// Releases the current sample, and unlocks and releases the buffer of
+// its converted frame.
+//-------------------------------------------------------------------
+
+void MFFrameSource::ReleaseFrame()
+{
+    if (m_pData)
+    {
+        if (m_p2DBuffer)
+        {
+            m_p2DBuffer->Unlock2D();
+        }
+        else
+        {
+            m_pBuffer->Unlock();
+        }
+        m_pData = NULL;
+    }
+    SafeRelease(&m_p2DBuffer);
+    SafeRelease(&m_pBuffer);
+    SafeRelease(&m_pSample);
+
+    m_bConverted = FALSE;
+    m_bInterlacedFrame = FALSE;
+}
+
+
+//-------------------------------------------------------------------
+// Fail
+//
+// Records a failure for PlatformError.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MFFrameSource::Fail(HRESULT hr)
+{
+    m_hrLast = hr;
+
+    // After Cancel, the shutdown is the likely cause.
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    return (hr == E_OUTOFMEMORY) ? FRAME_E_OUT_OF_MEMORY : FRAME_E_PLATFORM;
+}
+
+
+//-------------------------------------------------------------------
+// MFAsyncFrameReader constructor
+//-------------------------------------------------------------------
+
+MFAsyncFrameReader::MFAsyncFrameReader()
+    : m_cRef(1),
+      m_hIdle(NULL),
+      m_cSkipped(0),
+      m_bHaveFrame(false)
+{
+    InitializeCriticalSection(&m_lock);
+    ZeroMemory(&m_read, sizeof(m_read));
+}
+
+
+//-------------------------------------------------------------------
+// MFAsyncFrameReader destructor
+//-------------------------------------------------------------------
+
+MFAsyncFrameReader::~MFAsyncFrameReader()
+{
+    m_source.Close();
+
+    if (m_hIdle)
+    {
+        CloseHandle(m_hIdle);
+    }
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// CreateInstance
+//-------------------------------------------------------------------
+
+HRESULT MFAsyncFrameReader::CreateInstance(MFAsyncFrameReader **ppReader)
+{
+    if (ppReader == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppReader = NULL;
+
+    MFAsyncFrameReader *pReader = new (std::nothrow) MFAsyncFrameReader();
+
+    if (pReader == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = pReader->Initialize();
+
+    if (SUCCEEDED(hr))
+    {
+        *ppReader = pReader;
+    }
+    else
+    {
+        pReader->Release();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//-------------------------------------------------------------------
+
+HRESULT MFAsyncFrameReader::Initialize()
+{
+    m_hIdle = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+    if (m_hIdle == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_source.SetReaderCallback(this);
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// OpenURL
+//-------------------------------------------------------------------
+
+HRESULT MFAsyncFrameReader::OpenURL(const WCHAR *wszURL)
+{
+    return m_source.OpenURL(wszURL);
+}
+
+
+//-------------------------------------------------------------------
+// OpenByteStream
+//-------------------------------------------------------------------
+
+HRESULT MFAsyncFrameReader::OpenByteStream(IMFByteStream *pByteStream)
+{
+    return m_source.OpenByteStream(pByteStream);
+}
+
+
+//-------------------------------------------------------------------
+// Shutdown
+//
+// Completes the queued reads and closes the source reader, which
+// releases its reference to this object.
+//-------------------------------------------------------------------
+
+void MFAsyncFrameReader::Shutdown()
+{
+    Drain();
+    m_source.Close();
+}
+
+
+//-------------------------------------------------------------------
+// ReadAt
+//
+// The thread that queues a read on an idle reader starts it.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MFAsyncFrameReader::ReadAt(int64_t hnsPosition, FrameReadCallback callback, void *pContext)
+{
+    Request request = { hnsPosition, callback, pContext };
+    bool bStart = false;
+
+    if (!m_source.IsOpen())
+    {
+        return FRAME_E_READ;
+    }
+
+    EnterCriticalSection(&m_lock);
+
+    try
+    {
+        m_requests.push_back(request);
+    }
+    catch (std::bad_alloc&)
+    {
+        LeaveCriticalSection(&m_lock);
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    if (m_requests.size() == 1)
+    {
+        ResetEvent(m_hIdle);
+        bStart = true;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (bStart)
+    {
+        StartReads();
+    }
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Drain
+//-------------------------------------------------------------------
+
+void MFAsyncFrameReader::Drain()
+{
+    WaitForSingleObject(m_hIdle, INFINITE);
+}
+
+
+// IUnknown methods
+
+STDMETHODIMP MFAsyncFrameReader::QueryInterface(REFIID riid, void **ppv)
+{
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown || riid == __uuidof(IMFSourceReaderCallback))
+    {
+        *ppv = static_cast<IMFSourceReaderCallback*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP_(ULONG) MFAsyncFrameReader::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+STDMETHODIMP_(ULONG) MFAsyncFrameReader::Release()
+{
+    ULONG cRef = InterlockedDecrement(&m_cRef);
+    if (cRef == 0)
+    {
+        delete this;
+    }
+    return cRef;
+}
+
+
+// IMFSourceReaderCallback methods
+
+//-------------------------------------------------------------------
+// OnReadSample
+//
+// Takes each sample of the read in flight, and asks for the next one
+// until the frame for the position has arrived.
+//-------------------------------------------------------------------
+
+STDMETHODIMP MFAsyncFrameReader::OnReadSample(
+    HRESULT hrStatus,
+    DWORD dwStreamIndex,
+    DWORD dwStreamFlags,
+    LONGLONG llTimestamp,
+    IMFSample *pSample
+    )
+{
+    UNREFERENCED_PARAMETER(dwStreamIndex);
+    UNREFERENCED_PARAMETER(llTimestamp);
+
+    FrameView view = { 0 };
+    bool bFormatChanged = false;
+    bool bFrame = false;
+
+    FRAME_STATUS status = m_source.AcceptFrame(hrStatus, dwStreamFlags, pSample, &view, &bFormatChanged, &bFrame);
+
+    if (bFormatChanged)
+    {
+        m_read.bFormatChanged = true;
+    }
+
+    if (status == FRAME_OK && bFrame)
+    {
+        ++m_read.cFramesDecoded;
+        m_read.view = view;
+        m_bHaveFrame = true;
+
+        if (IsFrameForPosition(view, m_read.hnsPosition, m_cSkipped))
+        {
+            goto done;
+        }
+
+        ++m_cSkipped;
+    }
+
+    if (status == FRAME_OK)
+    {
+        status = m_source.RequestFrame();
+
+        if (status == FRAME_OK)
+        {
+            return S_OK;                // This read goes on.
+        }
+    }
+
+done:
+
+    // At the end of the stream, use the last frame.
+    if (status == FRAME_END_OF_STREAM && m_bHaveFrame)
+    {
+        status = FRAME_OK;
+    }
+
+    if (CompleteRead(status))
+    {
+        StartReads();
+    }
+    return S_OK;
+}
+
+STDMETHODIMP MFAsyncFrameReader::OnFlush(DWORD dwStreamIndex)
+{
+    UNREFERENCED_PARAMETER(dwStreamIndex);
+    return S_OK;
+}
+
+STDMETHODIMP MFAsyncFrameReader::OnEvent(DWORD dwStreamIndex, IMFMediaEvent *pEvent)
+{
+    UNREFERENCED_PARAMETER(dwStreamIndex);
+    UNREFERENCED_PARAMETER(pEvent);
+    return S_OK;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// StartReads
+//
+// Starts the first queued read. Reads that fail to start are completed
+// here, and the next one is started, until one is in flight or none
+// are queued.
+//-------------------------------------------------------------------
+
+void MFAsyncFrameReader::StartReads()
+{
+    while (1)
+    {
+        EnterCriticalSection(&m_lock);
+        int64_t hnsPosition = m_requests.front().hnsPosition;
+        LeaveCriticalSection(&m_lock);
+
+        ZeroMemory(&m_read, sizeof(m_read));
+        m_read.hnsPosition = hnsPosition;
+        m_read.pSource = &m_source;
+        m_cSkipped = 0;
+        m_bHaveFrame = false;
+
+        FRAME_STATUS status = StartRead(&m_source, hnsPosition);
+
+        if (status == FRAME_OK)
+        {
+            status = m_source.RequestFrame();
+        }
+
+        if (status == FRAME_OK || !CompleteRead(status))
+        {
+            break;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// CompleteRead
+//
+// Calls the callback of the read in flight and removes it from the
+// queue. Returns true if another read is queued; the caller starts it.
+//-------------------------------------------------------------------
+
+bool MFAsyncFrameReader::CompleteRead(FRAME_STATUS status)
+{
+    bool bMore = false;
+
+    EnterCriticalSection(&m_lock);
+    Request request = m_requests.front();
+    LeaveCriticalSection(&m_lock);
+
+    m_read.status = status;
+
+    request.callback(request.pContext, &m_read);
+
+    EnterCriticalSection(&m_lock);
+
+    m_requests.pop_front();
+
+    if (m_requests.empty())
+    {
+        SetEvent(m_hIdle);
+    }
+    else
+    {
+        bMore = true;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return bMore;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// CorrectAspectRatio
+//
+// Converts a rectangle from the source's pixel aspect ratio (PAR) to 1:1 PAR.
+// Returns the corrected rectangle.
+//
+// For example, a 720 x 486 rect with a PAR of 9:10, when converted to 1x1 PAR,
+// is stretched to 720 x 540.
+//-----------------------------------------------------------------------------
+
+RECT CorrectAspectRatio(const RECT& src, const MFRatio& srcPAR)
+{
+    // Start with a rectangle the same size as src, but offset to the origin (0,0).
+    RECT rc = {0, 0, src.right - src.left, src.bottom - src.top};
+
+    if ((srcPAR.Numerator != 1) || (srcPAR.Denominator != 1))
+    {
+        // Correct for the source's PAR.
+
+        if (srcPAR.Numerator > srcPAR.Denominator)
+        {
+            // The source has "wide" pixels, so stretch the width.
+            rc.right = MulDiv(rc.right, srcPAR.Numerator, srcPAR.Denominator);
+        }
+        else if (srcPAR.Numerator < srcPAR.Denominator)
+        {
+            // The source has "tall" pixels, so stretch the height.
+            rc.bottom = MulDiv(rc.bottom, srcPAR.Denominator, srcPAR.Numerator);
+        }
+        // else: PAR is 1:1, which is a no-op.
+    }
+    return rc;
+}
+
+
+MFOffset MakeOffset(float v)
+{
+    MFOffset offset;
+    offset.value = short(v);
+    offset.fract = WORD(65536 * (v-offset.value));
+    return offset;
+}
+
+MFVideoArea MakeArea(float x, float y, DWORD width, DWORD height)
+{
+    MFVideoArea area;
+    area.OffsetX = MakeOffset(x);
+    area.OffsetY = MakeOffset(y);
+    area.Area.cx = width;
+    area.Area.cy = height;
+    return area;
+}
+
+HRESULT GetVideoDisplayArea(IMFMediaType *pType, MFVideoArea *pArea)
+{
+    HRESULT hr = S_OK;
+    BOOL bPanScan = FALSE;
+    UINT32 width = 0, height = 0;
+
+    bPanScan = MFGetAttributeUINT32(pType, MF_MT_PAN_SCAN_ENABLED, FALSE);
+
+    // In pan-and-scan mode, try to get the pan-and-scan region.
+    if (bPanScan)
+    {
+        hr = pType->GetBlob(
+            MF_MT_PAN_SCAN_APERTURE,
+            (UINT8*)pArea,
+            sizeof(MFVideoArea),
+            NULL
+            );
+    }
+
+    // If not in pan-and-scan mode, or the pan-and-scan region is not set,
+    // get the minimimum display aperture.
+
+    if (!bPanScan || hr == MF_E_ATTRIBUTENOTFOUND)
+    {
+        hr = pType->GetBlob(
+            MF_MT_MINIMUM_DISPLAY_APERTURE,
+            (UINT8*)pArea,
+            sizeof(MFVideoArea),
+            NULL
+            );
+
+        if (hr == MF_E_ATTRIBUTENOTFOUND)
+        {
+            // Minimum display aperture is not set.
+
+            // For backward compatibility with some components,
+            // check for a geometric aperture.
+
+            hr = pType->GetBlob(
+                MF_MT_GEOMETRIC_APERTURE,
+                (UINT8*)pArea,
+                sizeof(MFVideoArea),
+                NULL
+                );
+        }
+
+        // Default: Use the entire video area.
+
+        if (hr == MF_E_ATTRIBUTENOTFOUND)
+        {
+            hr = MFGetAttributeSize(
+                pType, MF_MT_FRAME_SIZE, &width, &height
+                );
+
+            if (SUCCEEDED(hr))
+            {
+                *pArea = MakeArea(0.0, 0.0, width, height);
+            }
+        }
+    }
+
+    return hr;
+}
+
+
+RECT RectFromArea(const MFVideoArea& area)
+{
+    RECT rc;
+    rc.left = static_cast<LONG>(OffsetToFloat(area.OffsetX));
+    rc.top = static_cast<LONG>(OffsetToFloat(area.OffsetY));
+    rc.right = rc.left + area.Area.cx;
+    rc.bottom = rc.top + area.Area.cy;
+    return rc;
+}
+
+
+void GetPixelAspectRatio(IMFMediaType *pType, MFRatio *pPar)
+{
+    HRESULT hr = MFGetAttributeRatio(pType,
+        MF_MT_PIXEL_ASPECT_RATIO,
+        (UINT32*)&pPar->Numerator,
+        (UINT32*)&pPar->Denominator);
+    if (FAILED(hr))
+    {
+        pPar->Numerator = pPar->Denominator = 1;
+    }
+}
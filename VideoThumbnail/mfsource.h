@@ -0,0 +1,209 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MFFrameSource: Frame source for the Media Foundation source reader.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "framesource.h"
+#include "asyncreader.h"
+#include "sprite.h"
+#include "yuvconvert.h"
+
+#include <deque>
+#include <vector>
+
+// MFFrameSource: Reads frames from a source reader.
+//
+// Where the decoder outputs progressive (or per-frame flagged) NV12, the
+// reader delivers that directly, and ConvertFrame converts only the frame
+// that is drawn. Otherwise the reader's video processor converts every
+// frame to RGB32 and deinterlaces it. If the decoder exposes
+// IMFQualityAdvise, SetSkipThreshold lets it drop frames before the
+// threshold.
+//
+// SetFieldDrop, before opening, takes NV12 from the decoder for
+// interlaced streams too, so the video processor's deinterlacer never
+// runs. Interlaced frames are then converted from their top field, and
+// the field drop is folded into a downscale to half size or less, as
+// far as the size given to SetTargetSize allows (see yuvconvert.h).
+// GetFormat reports the reduced size.
+//
+// ConvertRows converts a band of rows straight from the locked sample,
+// so a large frame can be reduced without a full-size BGRA copy.
+//
+// The current sample is held until the next ReadFrame, Seek or Close.
+// Failed calls return FRAME_E_PLATFORM, and PlatformError() returns the
+// HRESULT.
+//
+// Cancel shuts down the media source, which makes a ReadSample that is
+// waiting on it return, and closes the byte stream that the reader
+// reads from, if it is known (OpenByteStream, or Attach with a stream),
+// so that a read blocked on the network fails too. A cancelled reader
+// cannot be detached for reuse.
+//
+// SetReaderCallback, before opening, creates the reader in asynchronous
+// mode. ReadFrame cannot be used then; RequestFrame starts a read, and
+// the callback passes the result to AcceptFrame (see MFAsyncFrameReader).
+
+class MFFrameSource : public FrameSource
+{
+    IMFSourceReader     *m_pReader;
+    IMFQualityAdvise    *m_pQuality;        // The decoder's, if it has one.
+    IMFSample           *m_pSample;         // The current frame.
+    IMFMediaBuffer      *m_pBuffer;         // Locked buffer of the current frame.
+    IMF2DBuffer         *m_p2DBuffer;       // The same buffer, if it was locked with Lock2D.
+    BYTE                *m_pData;
+    LONG                m_lPitch;           // Of m_pData.
+    BOOL                m_bConverted;
+    BOOL                m_bInterlacedFrame;
+    FormatInfo          m_format;
+    BOOL                m_bNV12;            // Otherwise RGB32.
+    YUV_MATRIX          m_matrix;
+    LONG                m_lStride;          // Of the uncompressed buffer.
+    UINT32              m_frameWidth;       // Of the uncompressed buffer.
+    UINT32              m_frameHeight;
+    BOOL                m_bInterlacedStream;
+    BOOL                m_bFieldDrop;
+    UINT32              m_reduceShift;      // Frames are converted at 1/2^shift of their size.
+    UINT32              m_targetWidth;
+    UINT32              m_targetHeight;
+    int64_t             m_hnsSkipThreshold;
+    int64_t             m_hnsLastFrame;
+    MF_QUALITY_DROP_MODE m_dropMode;
+    std::vector<BYTE>   m_bgra;
+    TaskPool            *m_pPool;           // Optional; for the NV12 conversion.
+    IMFSourceReaderCallback *m_pCallback;   // For asynchronous mode. Not held.
+    IMFMediaSource      *m_pMediaSource;    // The reader's, for Cancel.
+    IMFByteStream       *m_pByteStream;     // Optional; the reader's, for Cancel.
+    volatile LONG       m_bCancelled;       // Until the next Open or Attach.
+    HRESULT             m_hrLast;
+
+public:
+
+    MFFrameSource();
+    ~MFFrameSource();
+
+    HRESULT     OpenURL(const WCHAR *wszURL);
+    HRESULT     OpenByteStream(IMFByteStream *pByteStream);
+    void        Attach(IMFSourceReader *pReader, const FormatInfo& format, IMFByteStream *pByteStream = NULL);
+    HRESULT     Detach(IMFSourceReader **ppReader, FormatInfo *pFormat);
+    void        Close();
+
+    BOOL        IsOpen() const { return m_pReader != NULL; }
+
+    void        SetFieldDrop(BOOL bFieldDrop) { m_bFieldDrop = bFieldDrop; }
+    void        SetReaderCallback(IMFSourceReaderCallback *pCallback) { m_pCallback = pCallback; }
+
+    // Asynchronous mode. AcceptFrame sets *pbFrame to false, and returns
+    // FRAME_OK, if the reader completed without a frame; read again.
+    FRAME_STATUS    RequestFrame();
+    FRAME_STATUS    AcceptFrame(HRESULT hrStatus, DWORD dwFlags, IMFSample *pSample, FrameView *pFrame,
+                        bool *pbFormatChanged, bool *pbFrame);
+
+    // FrameSource
+    FRAME_STATUS    GetFormat(FrameFormat *pFormat);
+    FRAME_STATUS    GetDuration(int64_t *phnsDuration);
+    FRAME_STATUS    CanSeek(bool *pbCanSeek);
+    FRAME_STATUS    Seek(int64_t hnsPosition);
+    FRAME_STATUS    ReadFrame(FrameView *pFrame, bool *pbFormatChanged);
+    FRAME_STATUS    ConvertFrame(FrameView *pFrame);
+    bool            CanConvertRows() const { return true; }
+    FRAME_STATUS    ConvertRows(uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride);
+    void            SetSkipThreshold(int64_t hnsThreshold);
+    void            SetTargetSize(uint32_t width, uint32_t height) { m_targetWidth = width; m_targetHeight = height; }
+    void            SetTaskPool(TaskPool *pPool) { m_pPool = pPool; }
+    int32_t         PlatformError() const { return m_hrLast; }
+    void            Cancel();
+
+private:
+    HRESULT         CreateReaderAttributes(IMFAttributes **ppAttributes);
+    void            GetMediaSource();
+    HRESULT         SelectVideoStream();
+    HRESULT         SetOutputSubtype(const GUID& subtype);
+    HRESULT         GetVideoFormat(FormatInfo *pFormat);
+    void            GetQualityAdvise();
+    void            UpdateDropMode();
+    HRESULT         LockFrame();
+    void            ConvertNV12Rows(UINT32 firstRow, UINT32 cRows, BYTE *pDest, LONG destStride);
+    void            ReleaseFrame();
+    FRAME_STATUS    Fail(HRESULT hr);
+};
+
+
+// MFAsyncFrameReader: Reads frames with the source reader in
+// asynchronous mode (see asyncreader.h).
+//
+// ReadAt seeks, if the reader is idle, and asks for a sample; each
+// sample arrives in OnReadSample on a Media Foundation work queue
+// thread, which asks for the next one until the frame for the position
+// has arrived, and then calls the read's callback. No thread is blocked
+// while the decoder works.
+//
+// The source reader holds a reference to this object, so call Shutdown
+// before the last Release.
+
+class MFAsyncFrameReader : public AsyncFrameReader, public IMFSourceReaderCallback
+{
+    struct Request
+    {
+        int64_t             hnsPosition;
+        FrameReadCallback   callback;
+        void                *pContext;
+    };
+
+    volatile LONG           m_cRef;
+    MFFrameSource           m_source;
+    CRITICAL_SECTION        m_lock;
+    std::deque<Request>     m_requests;     // The first one is being read.
+    HANDLE                  m_hIdle;        // Set while m_requests is empty.
+
+    // The read in flight. Only the thread that owns it uses these.
+    FrameRead               m_read;
+    uint32_t                m_cSkipped;
+    bool                    m_bHaveFrame;
+
+    MFAsyncFrameReader();
+    ~MFAsyncFrameReader();
+
+    HRESULT     Initialize();
+
+public:
+
+    static HRESULT CreateInstance(MFAsyncFrameReader **ppReader);
+
+    HRESULT     OpenURL(const WCHAR *wszURL);
+    HRESULT     OpenByteStream(IMFByteStream *pByteStream);
+    void        Shutdown();
+
+    // For settings such as SetFieldDrop and SetTargetSize, before
+    // opening, and for the format while no reads are queued.
+    MFFrameSource*  Source() { return &m_source; }
+
+    // AsyncFrameReader
+    FRAME_STATUS    ReadAt(int64_t hnsPosition, FrameReadCallback callback, void *pContext);
+    void            Drain();
+
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+    STDMETHODIMP_(ULONG) AddRef();
+    STDMETHODIMP_(ULONG) Release();
+
+    // IMFSourceReaderCallback
+    STDMETHODIMP OnReadSample(HRESULT hrStatus, DWORD dwStreamIndex, DWORD dwStreamFlags, LONGLONG llTimestamp,
+        IMFSample *pSample);
+    STDMETHODIMP OnFlush(DWORD dwStreamIndex);
+    STDMETHODIMP OnEvent(DWORD dwStreamIndex, IMFMediaEvent *pEvent);
+
+private:
+    void        StartReads();
+    bool        CompleteRead(FRAME_STATUS status);
+};
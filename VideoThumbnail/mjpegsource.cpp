@@ -0,0 +1,608 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MjpegFrameSource: Frame source for Motion JPEG streams.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "mjpegsource.h"
+
+#ifdef VT_ENABLE_LIBJPEG
+
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <new>
+
+const int64_t   HNS_PER_SECOND      = 10000000;
+const size_t    INDEX_CHUNK_SIZE    = 1024 * 1024;
+const uint64_t  MAX_IMAGE_SIZE      = 64 * 1024 * 1024;    // Larger images are skipped.
+
+static bool SeekFile(FILE *pFile, uint64_t offset)
+{
+#ifdef _MSC_VER
+    return _fseeki64(pFile, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(pFile, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool HasExtension(const wchar_t *wszPath, const wchar_t *wszExt)
+{
+    size_t cch = wcslen(wszPath);
+    size_t cchExt = wcslen(wszExt);
+
+    if (cch < cchExt)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < cchExt; i++)
+    {
+        if ((wchar_t)towlower(wszPath[cch - cchExt + i]) != wszExt[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// MjpegFrameSource constructor
+//-------------------------------------------------------------------
+
+MjpegFrameSource::MjpegFrameSource()
+    : m_pFile(NULL),
+      m_targetWidth(0),
+      m_targetHeight(0)
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// MjpegFrameSource destructor
+//-------------------------------------------------------------------
+
+MjpegFrameSource::~MjpegFrameSource()
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// Open
+//
+// Opens a Motion JPEG stream and finds its images.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MjpegFrameSource::Open(const char *szPath, uint32_t fpsNum, uint32_t fpsDen)
+{
+    Close();
+
+#ifdef _MSC_VER
+    if (fopen_s(&m_pFile, szPath, "rb") != 0)
+    {
+        m_pFile = NULL;
+    }
+#else
+    m_pFile = fopen(szPath, "rb");
+#endif
+
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    return Start(fpsNum, fpsDen);
+}
+
+#ifdef _WIN32
+FRAME_STATUS MjpegFrameSource::Open(const wchar_t *wszPath, uint32_t fpsNum, uint32_t fpsDen)
+{
+    Close();
+
+    if (_wfopen_s(&m_pFile, wszPath, L"rb") != 0)
+    {
+        m_pFile = NULL;
+        return FRAME_E_READ;
+    }
+
+    return Start(fpsNum, fpsDen);
+}
+#endif
+
+
+//-------------------------------------------------------------------
+// Close
+//-------------------------------------------------------------------
+
+void MjpegFrameSource::Close()
+{
+    if (m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+
+    m_images.clear();
+    m_fpsNum = 30;
+    m_fpsDen = 1;
+    m_width = 0;
+    m_height = 0;
+    m_scale = 1;
+    m_iNextFrame = 0;
+    m_bHaveFrame = false;
+    m_bDecoded = false;
+    m_bCancelled = false;
+}
+
+
+//-------------------------------------------------------------------
+// IsMjpegPath
+//
+// Returns true if the path has a .mjpeg or .mjpg extension.
+//-------------------------------------------------------------------
+
+bool MjpegFrameSource::IsMjpegPath(const wchar_t *wszPath)
+{
+    return HasExtension(wszPath, L".mjpeg") || HasExtension(wszPath, L".mjpg");
+}
+
+
+// FrameSource methods
+
+FRAME_STATUS MjpegFrameSource::GetFormat(FrameFormat *pFormat)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    pFormat->width = m_width;
+    pFormat->height = m_height;
+    pFormat->bTopDown = true;
+    pFormat->pictureLeft = 0;
+    pFormat->pictureTop = 0;
+    pFormat->pictureRight = (int32_t)m_width;
+    pFormat->pictureBottom = (int32_t)m_height;
+    pFormat->rotation = 0;
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS MjpegFrameSource::GetDuration(int64_t *phnsDuration)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    *phnsDuration = FrameTime((int64_t)m_images.size());
+    return FRAME_OK;
+}
+
+FRAME_STATUS MjpegFrameSource::CanSeek(bool *pbCanSeek)
+{
+    *pbCanSeek = (m_pFile != NULL);
+    return FRAME_OK;
+}
+
+FRAME_STATUS MjpegFrameSource::Seek(int64_t hnsPosition)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    if (hnsPosition < 0)
+    {
+        hnsPosition = 0;
+    }
+
+    // Every frame is a keyframe.
+    int64_t iFrame = hnsPosition * m_fpsNum / (HNS_PER_SECOND * m_fpsDen);
+
+    if (iFrame > (int64_t)m_images.size())
+    {
+        iFrame = (int64_t)m_images.size();
+    }
+
+    m_bHaveFrame = false;
+    m_iNextFrame = iFrame;
+    return FRAME_OK;
+}
+
+FRAME_STATUS MjpegFrameSource::ReadFrame(FrameView *pFrame, bool *pbFormatChanged)
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    *pbFormatChanged = false;
+
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    if (m_iNextFrame >= (int64_t)m_images.size())
+    {
+        return FRAME_END_OF_STREAM;
+    }
+
+    m_bHaveFrame = false;
+
+    FRAME_STATUS status = ReadImage(m_iNextFrame, &width, &height);
+
+    if (status != FRAME_OK)
+    {
+        return status;
+    }
+
+    m_scale = JpegDecoder::ChooseScale(width, height, m_targetWidth, m_targetHeight);
+
+    width = JpegDecoder::ScaledSize(width, m_scale);
+    height = JpegDecoder::ScaledSize(height, m_scale);
+
+    if (width != m_width || height != m_height)
+    {
+        m_width = width;
+        m_height = height;
+        *pbFormatChanged = true;
+    }
+
+    m_bHaveFrame = true;
+    m_bDecoded = false;
+
+    pFrame->pData = NULL;
+    pFrame->stride = 0;
+    pFrame->timestamp = FrameTime(m_iNextFrame);
+    pFrame->bKeyframe = true;
+
+    ++m_iNextFrame;
+    return FRAME_OK;
+}
+
+FRAME_STATUS MjpegFrameSource::ConvertFrame(FrameView *pFrame)
+{
+    if (!m_bHaveFrame)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (!m_bDecoded)
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+
+        FRAME_STATUS status = m_decoder.Decode(&m_jpeg[0], m_jpeg.size(), m_scale, &m_bgra, &width, &height);
+
+        if (status != FRAME_OK)
+        {
+            return status;
+        }
+
+        if (width != m_width || height != m_height)
+        {
+            return FRAME_E_FORMAT;
+        }
+
+        m_bDecoded = true;
+    }
+
+    pFrame->pData = &m_bgra[0];
+    pFrame->stride = (int32_t)(4 * m_width);
+
+    return FRAME_OK;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Start
+//
+// Finds the images of the open file and reads the size of the first.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MjpegFrameSource::Start(uint32_t fpsNum, uint32_t fpsDen)
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    FRAME_STATUS status = (fpsNum == 0 || fpsDen == 0) ? FRAME_E_FORMAT : FRAME_OK;
+
+    m_fpsNum = fpsNum;
+    m_fpsDen = fpsDen;
+
+    if (status == FRAME_OK)
+    {
+        status = IndexImages();
+    }
+
+    if (status == FRAME_OK && m_images.empty())
+    {
+        status = FRAME_E_FORMAT;
+    }
+
+    if (status == FRAME_OK)
+    {
+        status = ReadImage(0, &width, &height);
+    }
+
+    if (status == FRAME_OK)
+    {
+        m_scale = JpegDecoder::ChooseScale(width, height, m_targetWidth, m_targetHeight);
+        m_width = JpegDecoder::ScaledSize(width, m_scale);
+        m_height = JpegDecoder::ScaledSize(height, m_scale);
+    }
+
+    if (status != FRAME_OK)
+    {
+        Close();
+    }
+
+    return status;
+}
+
+
+//-------------------------------------------------------------------
+// IndexImages
+//
+// Reads the file from the start and records where each image starts
+// and ends. An image runs from its SOI marker to its EOI marker. In
+// between, marker segments are skipped by their lengths, and the
+// entropy-coded data after SOS is scanned for the next marker: in it,
+// 0xFF is followed by 0x00 (a stuffed byte), a restart marker or more
+// 0xFF fill bytes unless a marker starts there. A malformed image is
+// dropped, and the scan resumes at the next SOI.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MjpegFrameSource::IndexImages()
+{
+    enum SCAN_STATE
+    {
+        SCAN_SOI,               // Between images.
+        SCAN_MARKER,            // Between marker segments.
+        SCAN_LENGTH_HIGH,
+        SCAN_LENGTH_LOW,
+        SCAN_SEGMENT,           // In a segment's payload.
+        SCAN_ENTROPY            // In entropy-coded data.
+    };
+
+    std::vector<uint8_t> buffer;
+    SCAN_STATE state = SCAN_SOI;
+    uint64_t offset = 0;        // Of buffer[0] in the file.
+    uint64_t imageStart = 0;
+    uint32_t cbSkip = 0;
+    bool bFF = false;           // The byte before was 0xFF.
+    bool bScan = false;         // The segment is SOS; entropy-coded data follows it.
+
+    try
+    {
+        buffer.resize(INDEX_CHUNK_SIZE);
+    }
+    catch (std::bad_alloc&)
+    {
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    if (!SeekFile(m_pFile, 0))
+    {
+        return FRAME_E_READ;
+    }
+
+    for (;;)
+    {
+        if (m_bCancelled)
+        {
+            return FRAME_E_CANCELLED;
+        }
+
+        size_t cb = fread(&buffer[0], 1, buffer.size(), m_pFile);
+
+        if (cb == 0)
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < cb; i++)
+        {
+            uint8_t b = buffer[i];
+            bool bMarker = false;
+
+            switch (state)
+            {
+            case SCAN_SOI:
+                if (bFF && b == 0xD8)
+                {
+                    imageStart = offset + i - 1;
+                    state = SCAN_MARKER;
+                    bFF = false;
+                }
+                else
+                {
+                    bFF = (b == 0xFF);
+                }
+                break;
+
+            case SCAN_MARKER:
+                if (!bFF)
+                {
+                    bFF = (b == 0xFF);
+
+                    if (!bFF)
+                    {
+                        state = SCAN_SOI;   // Malformed.
+                    }
+                }
+                else if (b != 0xFF)         // Otherwise a fill byte.
+                {
+                    bFF = false;
+                    bMarker = true;
+                }
+                break;
+
+            case SCAN_LENGTH_HIGH:
+                cbSkip = (uint32_t)b << 8;
+                state = SCAN_LENGTH_LOW;
+                break;
+
+            case SCAN_LENGTH_LOW:
+                cbSkip |= b;
+
+                if (cbSkip < 2)
+                {
+                    state = SCAN_SOI;       // Malformed.
+                }
+                else if ((cbSkip -= 2) > 0)
+                {
+                    state = SCAN_SEGMENT;
+                }
+                else
+                {
+                    state = bScan ? SCAN_ENTROPY : SCAN_MARKER;
+                }
+                break;
+
+            case SCAN_SEGMENT:
+                {
+                    size_t cbHere = (cb - i < cbSkip) ? cb - i : cbSkip;
+
+                    i += cbHere - 1;
+                    cbSkip -= (uint32_t)cbHere;
+
+                    if (cbSkip == 0)
+                    {
+                        state = bScan ? SCAN_ENTROPY : SCAN_MARKER;
+                    }
+                }
+                break;
+
+            case SCAN_ENTROPY:
+                if (!bFF)
+                {
+                    const uint8_t *pFF = (const uint8_t*)memchr(&buffer[i], 0xFF, cb - i);
+
+                    if (pFF == NULL)
+                    {
+                        i = cb - 1;
+                    }
+                    else
+                    {
+                        i = (size_t)(pFF - &buffer[0]);
+                        bFF = true;
+                    }
+                }
+                else if (b == 0x00 || (b >= 0xD0 && b <= 0xD7))
+                {
+                    bFF = false;            // A stuffed byte or a restart marker.
+                }
+                else if (b != 0xFF)         // Otherwise a fill byte.
+                {
+                    bFF = false;
+                    bMarker = true;
+                }
+                break;
+            }
+
+            if (!bMarker)
+            {
+                continue;
+            }
+
+            if (b == 0xD9)                  // EOI
+            {
+                uint64_t cbImage = offset + i + 1 - imageStart;
+
+                if (cbImage <= MAX_IMAGE_SIZE)
+                {
+                    Image image = { imageStart, (uint32_t)cbImage };
+
+                    try
+                    {
+                        m_images.push_back(image);
+                    }
+                    catch (std::bad_alloc&)
+                    {
+                        return FRAME_E_OUT_OF_MEMORY;
+                    }
+                }
+                state = SCAN_SOI;
+            }
+            else if (b == 0xD8)             // SOI without an EOI before it.
+            {
+                imageStart = offset + i - 1;
+                state = SCAN_MARKER;
+            }
+            else if ((b >= 0xD0 && b <= 0xD7) || b == 0x01)
+            {
+                state = SCAN_MARKER;        // No length.
+            }
+            else
+            {
+                bScan = (b == 0xDA);
+                state = SCAN_LENGTH_HIGH;
+            }
+        }
+
+        offset += cb;
+    }
+
+    return ferror(m_pFile) ? FRAME_E_READ : FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ReadImage
+//
+// Reads an image into m_jpeg and returns its full size.
+//-------------------------------------------------------------------
+
+FRAME_STATUS MjpegFrameSource::ReadImage(int64_t iFrame, uint32_t *pWidth, uint32_t *pHeight)
+{
+    const Image& image = m_images[(size_t)iFrame];
+
+    try
+    {
+        m_jpeg.resize(image.cbImage);
+    }
+    catch (std::bad_alloc&)
+    {
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    if (!SeekFile(m_pFile, image.offset) || fread(&m_jpeg[0], 1, image.cbImage, m_pFile) != image.cbImage)
+    {
+        return FRAME_E_READ;
+    }
+
+    return m_decoder.ReadHeader(&m_jpeg[0], m_jpeg.size(), pWidth, pHeight);
+}
+
+
+//-------------------------------------------------------------------
+// FrameTime
+//-------------------------------------------------------------------
+
+int64_t MjpegFrameSource::FrameTime(int64_t iFrame) const
+{
+    return iFrame * HNS_PER_SECOND * m_fpsDen / m_fpsNum;
+}
+
+#endif // VT_ENABLE_LIBJPEG
@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MjpegFrameSource: Frame source for Motion JPEG streams.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+#include "framesource.h"
+#include "jpegdecode.h"
+
+// NOTE: Motion JPEG
+//
+// A raw Motion JPEG stream (.mjpeg or .mjpg, as cameras and
+// "ffmpeg -f mjpeg" write it) is a sequence of complete JPEG images
+// with no container. Every frame is a keyframe, so a seek lands on the
+// frame for the position, and the stream carries no time stamps: Open
+// takes the frame rate (30 frames per second by default).
+//
+// Open reads the whole file once to find where each image starts and
+// ends. It follows the marker segments, so the images that EXIF
+// segments embed are not taken for frames. Bytes between images are
+// skipped.
+//
+// Frames are decoded with JpegDecoder at the largest DCT reduction that
+// still leaves the size given to SetTargetSize (see jpegdecode.h), so a
+// 4K frame for a 160-pixel thumbnail is decoded at 1/8 size. GetFormat
+// reports the reduced size. ReadFrame only reads the compressed image;
+// ConvertFrame decodes it, so frames that are read past cost no
+// decoding. A frame whose size differs from the one before reports a
+// format change.
+//
+// Like jpegdecode.h, the source is only compiled when VT_ENABLE_LIBJPEG
+// is defined, and otherwise depends only on the C++ standard library.
+
+#ifdef VT_ENABLE_LIBJPEG
+
+class MjpegFrameSource : public FrameSource
+{
+    struct Image
+    {
+        uint64_t    offset;
+        uint32_t    cbImage;
+    };
+
+    FILE                    *m_pFile;
+    std::vector<Image>      m_images;
+    uint32_t                m_fpsNum;
+    uint32_t                m_fpsDen;
+    uint32_t                m_width;            // Of the last frame read, decoded.
+    uint32_t                m_height;
+    uint32_t                m_scale;            // 1, 2, 4 or 8.
+    uint32_t                m_targetWidth;
+    uint32_t                m_targetHeight;
+    int64_t                 m_iNextFrame;
+    bool                    m_bHaveFrame;       // m_jpeg holds a frame.
+    bool                    m_bDecoded;         // m_bgra holds it, decoded.
+    std::atomic<bool>       m_bCancelled;       // Until the next Open.
+    JpegDecoder             m_decoder;
+    std::vector<uint8_t>    m_jpeg;
+    std::vector<uint8_t>    m_bgra;
+
+public:
+
+    MjpegFrameSource();
+    ~MjpegFrameSource();
+
+    FRAME_STATUS    Open(const char *szPath, uint32_t fpsNum = 30, uint32_t fpsDen = 1);
+#ifdef _WIN32
+    FRAME_STATUS    Open(const wchar_t *wszPath, uint32_t fpsNum = 30, uint32_t fpsDen = 1);
+#endif
+    void            Close();
+
+    int64_t         FrameCount() const { return (int64_t)m_images.size(); }
+    uint32_t        Scale() const { return m_scale; }
+
+    static bool     IsMjpegPath(const wchar_t *wszPath);
+
+    // FrameSource
+    FRAME_STATUS    GetFormat(FrameFormat *pFormat);
+    FRAME_STATUS    GetDuration(int64_t *phnsDuration);
+    FRAME_STATUS    CanSeek(bool *pbCanSeek);
+    FRAME_STATUS    Seek(int64_t hnsPosition);
+    FRAME_STATUS    ReadFrame(FrameView *pFrame, bool *pbFormatChanged);
+    FRAME_STATUS    ConvertFrame(FrameView *pFrame);
+    void            SetTargetSize(uint32_t width, uint32_t height) { m_targetWidth = width; m_targetHeight = height; }
+    void            Cancel() { m_bCancelled = true; }
+
+private:
+    FRAME_STATUS    Start(uint32_t fpsNum, uint32_t fpsDen);
+    FRAME_STATUS    IndexImages();
+    FRAME_STATUS    ReadImage(int64_t iFrame, uint32_t *pWidth, uint32_t *pHeight);
+    int64_t         FrameTime(int64_t iFrame) const;
+};
+
+#endif // VT_ENABLE_LIBJPEG
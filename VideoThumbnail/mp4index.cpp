@@ -0,0 +1,1076 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Mp4SampleIndex: MP4/MOV sample table parser.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "mp4index.h"
+
+#include <string.h>
+
+// Limits that keep a malformed file from exhausting memory.
+const uint64_t MAX_MOOV_SIZE    = 256 * 1024 * 1024;
+const uint64_t MAX_MOOF_SIZE    = 64 * 1024 * 1024;
+const uint32_t MAX_SAMPLES      = 8 * 1024 * 1024;
+
+#define FOURCC(a, b, c, d) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+// Track fragment flags (tfhd).
+const uint32_t TFHD_BASE_DATA_OFFSET        = 0x000001;
+const uint32_t TFHD_SAMPLE_DESCRIPTION      = 0x000002;
+const uint32_t TFHD_DEFAULT_DURATION        = 0x000008;
+const uint32_t TFHD_DEFAULT_SIZE            = 0x000010;
+const uint32_t TFHD_DEFAULT_FLAGS           = 0x000020;
+const uint32_t TFHD_DEFAULT_BASE_IS_MOOF    = 0x020000;
+
+// Track run flags (trun).
+const uint32_t TRUN_DATA_OFFSET             = 0x000001;
+const uint32_t TRUN_FIRST_SAMPLE_FLAGS      = 0x000004;
+const uint32_t TRUN_SAMPLE_DURATION         = 0x000100;
+const uint32_t TRUN_SAMPLE_SIZE             = 0x000200;
+const uint32_t TRUN_SAMPLE_FLAGS            = 0x000400;
+const uint32_t TRUN_SAMPLE_CTS_OFFSET       = 0x000800;
+
+// Sample flags: sample_is_non_sync_sample.
+const uint32_t SAMPLE_FLAG_NON_SYNC         = 0x010000;
+
+
+// Reader: Bounds-checked big-endian reader over a box payload. Reads
+// past the end return zero and clear ok.
+
+struct Reader
+{
+    const uint8_t   *p;
+    size_t          cb;
+    size_t          pos;
+    bool            ok;
+
+    Reader(const uint8_t *pData, size_t cbData) : p(pData), cb(cbData), pos(0), ok(true)
+    {
+    }
+
+    size_t Remaining() const { return cb - pos; }
+
+    bool Skip(size_t n)
+    {
+        if (n > Remaining())
+        {
+            ok = false;
+            pos = cb;
+            return false;
+        }
+        pos += n;
+        return true;
+    }
+
+    uint64_t Bytes(size_t n)
+    {
+        uint64_t v = 0;
+
+        if (n > Remaining())
+        {
+            ok = false;
+            pos = cb;
+            return 0;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            v = (v << 8) | p[pos++];
+        }
+        return v;
+    }
+
+    uint8_t     U8()  { return (uint8_t)Bytes(1); }
+    uint16_t    U16() { return (uint16_t)Bytes(2); }
+    uint32_t    U32() { return (uint32_t)Bytes(4); }
+    uint64_t    U64() { return Bytes(8); }
+};
+
+// Box: One box inside a payload.
+
+struct Box
+{
+    uint32_t        type;
+    const uint8_t   *pPayload;
+    size_t          cbPayload;
+};
+
+// Reads the next box of a payload. Returns false at the end, and sets
+// bError if the box does not fit.
+static bool NextBox(Reader& r, Box *pBox, bool *pbError)
+{
+    if (r.Remaining() < 8)
+    {
+        return false;
+    }
+
+    size_t start = r.pos;
+    uint64_t size = r.U32();
+
+    pBox->type = r.U32();
+
+    if (size == 1)
+    {
+        size = r.U64();
+    }
+    else if (size == 0)
+    {
+        size = r.cb - start;
+    }
+
+    size_t cbHeader = r.pos - start;
+
+    if (!r.ok || size < cbHeader || size > r.cb - start)
+    {
+        *pbError = true;
+        return false;
+    }
+
+    pBox->pPayload = r.p + r.pos;
+    pBox->cbPayload = (size_t)size - cbHeader;
+
+    r.pos = start + (size_t)size;
+    return true;
+}
+
+// Top-level box types must be printable, which rejects other formats
+// after the first few bytes.
+static bool IsPrintableType(uint32_t type)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t c = (uint8_t)(type >> (8 * i));
+
+        if (c < 0x20 || c > 0x7E)
+        {
+            if (c != 0xA9)  // QuickTime user data boxes start with (c).
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// Tables of one track, as found in moov.
+
+struct SampleToChunk
+{
+    uint32_t    firstChunk;
+    uint32_t    samplesPerChunk;
+};
+
+struct TimeEntry
+{
+    uint32_t    count;
+    int32_t     value;      // Duration (stts) or composition offset (ctts).
+};
+
+struct TrackTables
+{
+    uint32_t                    trackId;
+    uint32_t                    handler;
+    uint32_t                    timescale;
+    uint32_t                    codec;
+    uint16_t                    width;
+    uint16_t                    height;
+
+    std::vector<TimeEntry>      stts;
+    std::vector<TimeEntry>      ctts;
+    std::vector<uint32_t>       stss;
+    bool                        bHaveStss;
+    std::vector<SampleToChunk>  stsc;
+    std::vector<uint32_t>       sizes;
+    uint32_t                    fixedSize;
+    uint32_t                    sampleCount;
+    std::vector<uint64_t>       chunkOffsets;
+
+    int64_t                     editOffset;     // Added to presentation times, in track units.
+    bool                        bHaveEdit;
+    uint64_t                    emptyEdit;      // Leading empty edits, in movie units.
+
+    // Fragment defaults (trex).
+    uint32_t                    defaultDuration;
+    uint32_t                    defaultSize;
+    uint32_t                    defaultFlags;
+
+    TrackTables()
+        : trackId(0), handler(0), timescale(0), codec(0), width(0), height(0), bHaveStss(false),
+          fixedSize(0), sampleCount(0), editOffset(0), bHaveEdit(false), emptyEdit(0),
+          defaultDuration(0), defaultSize(0), defaultFlags(0)
+    {
+    }
+};
+
+struct MovieInfo
+{
+    uint32_t                    timescale;
+    std::vector<TrackTables>    tracks;
+    std::vector<TrackTables>    trex;           // Fragment defaults, by trackId only.
+
+    MovieInfo() : timescale(0)
+    {
+    }
+};
+
+
+// Reads a table with an entry count followed by fixed-size entries,
+// after checking that the entries fit in the payload.
+static bool ReadCount(Reader& r, size_t cbEntry, uint32_t *pCount)
+{
+    *pCount = r.U32();
+    return r.ok && (uint64_t)*pCount * cbEntry <= r.Remaining();
+}
+
+static bool ParseStbl(const uint8_t *p, size_t cb, TrackTables *pTrack)
+{
+    Reader r(p, cb);
+    Box box;
+    bool bError = false;
+    uint32_t count = 0;
+
+    while (NextBox(r, &box, &bError))
+    {
+        Reader b(box.pPayload, box.cbPayload);
+        b.Skip(4);  // version and flags
+
+        switch (box.type)
+        {
+        case FOURCC('s','t','s','d'):
+            if (b.U32() > 0)
+            {
+                // First sample entry. For visual entries, the width and
+                // height follow 24 bytes of reserved and predefined fields.
+                b.U32();
+                pTrack->codec = b.U32();
+                b.Skip(6 + 2 + 16);
+                pTrack->width = b.U16();
+                pTrack->height = b.U16();
+            }
+            break;
+
+        case FOURCC('s','t','t','s'):
+        case FOURCC('c','t','t','s'):
+            if (!ReadCount(b, 8, &count))
+            {
+                return false;
+            }
+            {
+                std::vector<TimeEntry>& table = (box.type == FOURCC('s','t','t','s')) ? pTrack->stts : pTrack->ctts;
+                table.resize(count);
+
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    table[i].count = b.U32();
+                    table[i].value = (int32_t)b.U32();  // ctts version 0 offsets fit in 31 bits in practice.
+                }
+            }
+            break;
+
+        case FOURCC('s','t','s','s'):
+            if (!ReadCount(b, 4, &count))
+            {
+                return false;
+            }
+            pTrack->stss.resize(count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pTrack->stss[i] = b.U32();
+            }
+            pTrack->bHaveStss = true;
+            break;
+
+        case FOURCC('s','t','s','c'):
+            if (!ReadCount(b, 12, &count))
+            {
+                return false;
+            }
+            pTrack->stsc.resize(count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pTrack->stsc[i].firstChunk = b.U32();
+                pTrack->stsc[i].samplesPerChunk = b.U32();
+                b.U32();    // sample_description_index
+            }
+            break;
+
+        case FOURCC('s','t','s','z'):
+            pTrack->fixedSize = b.U32();
+            pTrack->sampleCount = b.U32();
+            if (pTrack->fixedSize == 0)
+            {
+                if ((uint64_t)pTrack->sampleCount * 4 > b.Remaining())
+                {
+                    return false;
+                }
+                pTrack->sizes.resize(pTrack->sampleCount);
+                for (uint32_t i = 0; i < pTrack->sampleCount; i++)
+                {
+                    pTrack->sizes[i] = b.U32();
+                }
+            }
+            break;
+
+        case FOURCC('s','t','z','2'):
+            {
+                b.Skip(3);
+                uint8_t fieldSize = b.U8();
+                pTrack->sampleCount = b.U32();
+
+                if ((fieldSize != 4 && fieldSize != 8 && fieldSize != 16) ||
+                    (uint64_t)pTrack->sampleCount * fieldSize > (uint64_t)b.Remaining() * 8)
+                {
+                    return false;
+                }
+
+                pTrack->sizes.resize(pTrack->sampleCount);
+
+                for (uint32_t i = 0; i < pTrack->sampleCount; i++)
+                {
+                    if (fieldSize == 4)
+                    {
+                        uint8_t v = b.p[b.pos + i / 2];
+                        pTrack->sizes[i] = (i & 1) ? (v & 0x0F) : (v >> 4);
+                    }
+                    else
+                    {
+                        pTrack->sizes[i] = (uint32_t)b.Bytes(fieldSize / 8);
+                    }
+                }
+            }
+            break;
+
+        case FOURCC('s','t','c','o'):
+        case FOURCC('c','o','6','4'):
+            {
+                size_t cbEntry = (box.type == FOURCC('s','t','c','o')) ? 4 : 8;
+
+                if (!ReadCount(b, cbEntry, &count))
+                {
+                    return false;
+                }
+                pTrack->chunkOffsets.resize(count);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    pTrack->chunkOffsets[i] = b.Bytes(cbEntry);
+                }
+            }
+            break;
+        }
+
+        if (!b.ok)
+        {
+            return false;
+        }
+    }
+
+    return !bError;
+}
+
+static bool ParseElst(const uint8_t *p, size_t cb, TrackTables *pTrack)
+{
+    Reader b(p, cb);
+    uint8_t version = b.U8();
+    b.Skip(3);
+
+    uint32_t count = b.U32();
+
+    // Leading empty edits delay the track; the first real edit says
+    // which media time is presented first.
+    for (uint32_t i = 0; i < count && b.ok; i++)
+    {
+        uint64_t segmentDuration = (version == 1) ? b.U64() : b.U32();
+        int64_t mediaTime = (version == 1) ? (int64_t)b.U64() : (int64_t)(int32_t)b.U32();
+        b.U32();    // media_rate
+
+        if (mediaTime == -1)
+        {
+            pTrack->emptyEdit += segmentDuration;
+        }
+        else
+        {
+            pTrack->editOffset = -mediaTime;
+            pTrack->bHaveEdit = true;
+            break;
+        }
+    }
+
+    return b.ok;
+}
+
+static bool ParseTrackBoxes(const uint8_t *p, size_t cb, TrackTables *pTrack)
+{
+    Reader r(p, cb);
+    Box box;
+    bool bError = false;
+
+    while (NextBox(r, &box, &bError))
+    {
+        Reader b(box.pPayload, box.cbPayload);
+
+        switch (box.type)
+        {
+        case FOURCC('m','d','i','a'):
+        case FOURCC('m','i','n','f'):
+        case FOURCC('e','d','t','s'):
+            if (!ParseTrackBoxes(box.pPayload, box.cbPayload, pTrack))
+            {
+                return false;
+            }
+            break;
+
+        case FOURCC('s','t','b','l'):
+            if (!ParseStbl(box.pPayload, box.cbPayload, pTrack))
+            {
+                return false;
+            }
+            break;
+
+        case FOURCC('e','l','s','t'):
+            if (!ParseElst(box.pPayload, box.cbPayload, pTrack))
+            {
+                return false;
+            }
+            break;
+
+        case FOURCC('t','k','h','d'):
+            {
+                uint8_t version = b.U8();
+                b.Skip(3 + ((version == 1) ? 16 : 8));
+                pTrack->trackId = b.U32();
+            }
+            break;
+
+        case FOURCC('m','d','h','d'):
+            {
+                uint8_t version = b.U8();
+                b.Skip(3 + ((version == 1) ? 16 : 8));
+                pTrack->timescale = b.U32();
+            }
+            break;
+
+        case FOURCC('h','d','l','r'):
+            // QuickTime also has a data handler in minf; keep the media
+            // handler from mdia, which comes first.
+            b.Skip(4 + 4);
+            if (pTrack->handler == 0)
+            {
+                pTrack->handler = b.U32();
+            }
+            break;
+        }
+
+        if (!b.ok)
+        {
+            return false;
+        }
+    }
+
+    return !bError;
+}
+
+static bool ParseMoov(const uint8_t *p, size_t cb, MovieInfo *pMovie)
+{
+    Reader r(p, cb);
+    Box box;
+    bool bError = false;
+
+    while (NextBox(r, &box, &bError))
+    {
+        Reader b(box.pPayload, box.cbPayload);
+
+        switch (box.type)
+        {
+        case FOURCC('m','v','h','d'):
+            {
+                uint8_t version = b.U8();
+                b.Skip(3 + ((version == 1) ? 16 : 8));
+                pMovie->timescale = b.U32();
+            }
+            break;
+
+        case FOURCC('t','r','a','k'):
+            pMovie->tracks.push_back(TrackTables());
+            if (!ParseTrackBoxes(box.pPayload, box.cbPayload, &pMovie->tracks.back()))
+            {
+                return false;
+            }
+            break;
+
+        case FOURCC('m','v','e','x'):
+            {
+                Reader m(box.pPayload, box.cbPayload);
+                Box child;
+
+                while (NextBox(m, &child, &bError))
+                {
+                    if (child.type == FOURCC('t','r','e','x'))
+                    {
+                        Reader t(child.pPayload, child.cbPayload);
+                        TrackTables defaults;
+
+                        t.Skip(4);
+                        defaults.trackId = t.U32();
+                        t.U32();    // default_sample_description_index
+                        defaults.defaultDuration = t.U32();
+                        defaults.defaultSize = t.U32();
+                        defaults.defaultFlags = t.U32();
+
+                        if (!t.ok)
+                        {
+                            return false;
+                        }
+                        pMovie->trex.push_back(defaults);
+                    }
+                }
+            }
+            break;
+        }
+
+        if (!b.ok || bError)
+        {
+            return false;
+        }
+    }
+
+    return !bError;
+}
+
+
+// Expands the moov sample tables into a list of samples.
+static MP4_STATUS ExpandSampleTables(const TrackTables& track, std::vector<Mp4Sample> *pSamples)
+{
+    uint32_t n = track.sampleCount;
+
+    if (n == 0)
+    {
+        return MP4_OK;  // Fragmented file; the samples are in moof boxes.
+    }
+
+    if (n > MAX_SAMPLES)
+    {
+        return MP4_E_OUT_OF_MEMORY;
+    }
+
+    pSamples->resize(n);
+
+    Mp4Sample *pOut = &(*pSamples)[0];
+
+    // Sizes.
+    for (uint32_t i = 0; i < n; i++)
+    {
+        pOut[i].size = track.fixedSize ? track.fixedSize : track.sizes[i];
+        pOut[i].bSync = !track.bHaveStss;
+        pOut[i].dts = 0;
+        pOut[i].pts = 0;
+        pOut[i].offset = 0;
+    }
+
+    // Decode times.
+    {
+        uint32_t i = 0;
+        int64_t dts = 0;
+
+        for (size_t e = 0; e < track.stts.size() && i < n; e++)
+        {
+            for (uint32_t k = 0; k < track.stts[e].count && i < n; k++)
+            {
+                pOut[i++].dts = dts;
+                dts += (uint32_t)track.stts[e].value;
+            }
+        }
+
+        // A short table repeats its last delta.
+        int64_t delta = track.stts.empty() ? 0 : (uint32_t)track.stts.back().value;
+
+        for (; i < n; i++)
+        {
+            pOut[i].dts = dts;
+            dts += delta;
+        }
+    }
+
+    // Presentation times.
+    {
+        uint32_t i = 0;
+
+        for (size_t e = 0; e < track.ctts.size() && i < n; e++)
+        {
+            for (uint32_t k = 0; k < track.ctts[e].count && i < n; k++)
+            {
+                pOut[i++].pts = track.ctts[e].value;
+            }
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            pOut[i].pts += pOut[i].dts + track.editOffset;
+        }
+    }
+
+    // Sync samples (1-based).
+    for (size_t e = 0; e < track.stss.size(); e++)
+    {
+        if (track.stss[e] >= 1 && track.stss[e] <= n)
+        {
+            pOut[track.stss[e] - 1].bSync = true;
+        }
+    }
+
+    // File offsets: walk the chunks, with the samples of each chunk
+    // stored back to back.
+    {
+        uint32_t i = 0;
+        uint32_t cChunks = (uint32_t)track.chunkOffsets.size();
+
+        for (size_t e = 0; e < track.stsc.size() && i < n; e++)
+        {
+            uint32_t firstChunk = track.stsc[e].firstChunk;
+            uint32_t lastChunk = (e + 1 < track.stsc.size()) ? track.stsc[e + 1].firstChunk - 1 : cChunks;
+
+            if (firstChunk == 0 || lastChunk > cChunks)
+            {
+                return MP4_E_FORMAT;
+            }
+
+            for (uint32_t c = firstChunk; c <= lastChunk && i < n; c++)
+            {
+                uint64_t offset = track.chunkOffsets[c - 1];
+
+                for (uint32_t k = 0; k < track.stsc[e].samplesPerChunk && i < n; k++)
+                {
+                    pOut[i].offset = offset;
+                    offset += pOut[i].size;
+                    ++i;
+                }
+            }
+        }
+
+        if (i < n)
+        {
+            return MP4_E_FORMAT;
+        }
+    }
+
+    return MP4_OK;
+}
+
+
+// State carried from one fragment to the next.
+struct FragmentState
+{
+    int64_t     nextDts;
+};
+
+// Appends the samples of one moof.
+static MP4_STATUS ParseMoof(const uint8_t *p, size_t cb, uint64_t moofOffset, const TrackTables& track,
+                            FragmentState *pState, std::vector<Mp4Sample> *pSamples)
+{
+    Reader r(p, cb);
+    Box traf;
+    bool bError = false;
+
+    uint64_t dataEnd = moofOffset;     // End of the previous track fragment's data.
+    bool bFirstTraf = true;
+
+    while (NextBox(r, &traf, &bError))
+    {
+        if (traf.type != FOURCC('t','r','a','f'))
+        {
+            continue;
+        }
+
+        Reader t(traf.pPayload, traf.cbPayload);
+        Box box;
+
+        bool bOurTrack = false;
+        uint64_t baseOffset = bFirstTraf ? moofOffset : dataEnd;
+        uint64_t dataPos = baseOffset;
+        bool bFirstTrun = true;
+
+        uint32_t defaultDuration = track.defaultDuration;
+        uint32_t defaultSize = track.defaultSize;
+        uint32_t defaultFlags = track.defaultFlags;
+
+        bFirstTraf = false;
+
+        while (NextBox(t, &box, &bError))
+        {
+            Reader b(box.pPayload, box.cbPayload);
+            uint8_t version = b.U8();
+            uint32_t flags = (uint32_t)b.Bytes(3);
+
+            if (box.type == FOURCC('t','f','h','d'))
+            {
+                bOurTrack = (b.U32() == track.trackId);
+
+                if (flags & TFHD_BASE_DATA_OFFSET)
+                {
+                    baseOffset = b.U64();
+                }
+                else if (flags & TFHD_DEFAULT_BASE_IS_MOOF)
+                {
+                    baseOffset = moofOffset;
+                }
+                if (flags & TFHD_SAMPLE_DESCRIPTION) { b.U32(); }
+                if (flags & TFHD_DEFAULT_DURATION) { defaultDuration = b.U32(); }
+                if (flags & TFHD_DEFAULT_SIZE) { defaultSize = b.U32(); }
+                if (flags & TFHD_DEFAULT_FLAGS) { defaultFlags = b.U32(); }
+
+                dataPos = baseOffset;
+            }
+            else if (box.type == FOURCC('t','f','d','t') && bOurTrack)
+            {
+                pState->nextDts = (int64_t)((version == 1) ? b.U64() : b.U32());
+            }
+            else if (box.type == FOURCC('t','r','u','n'))
+            {
+                uint32_t count = b.U32();
+
+                if (flags & TRUN_DATA_OFFSET)
+                {
+                    dataPos = baseOffset + (int64_t)(int32_t)b.U32();
+                }
+                else if (bFirstTrun)
+                {
+                    dataPos = baseOffset;
+                }
+
+                uint32_t firstFlags = (flags & TRUN_FIRST_SAMPLE_FLAGS) ? b.U32() : defaultFlags;
+
+                size_t cbEntry = 4 * (((flags & TRUN_SAMPLE_DURATION) ? 1 : 0) + ((flags & TRUN_SAMPLE_SIZE) ? 1 : 0) +
+                    ((flags & TRUN_SAMPLE_FLAGS) ? 1 : 0) + ((flags & TRUN_SAMPLE_CTS_OFFSET) ? 1 : 0));
+
+                if ((uint64_t)count * cbEntry > b.Remaining() || pSamples->size() + count > MAX_SAMPLES)
+                {
+                    return MP4_E_FORMAT;
+                }
+
+                bFirstTrun = false;
+
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    uint32_t duration = (flags & TRUN_SAMPLE_DURATION) ? b.U32() : defaultDuration;
+                    uint32_t size = (flags & TRUN_SAMPLE_SIZE) ? b.U32() : defaultSize;
+                    uint32_t sampleFlags = (flags & TRUN_SAMPLE_FLAGS) ? b.U32() : (i == 0 ? firstFlags : defaultFlags);
+                    int64_t cts = 0;
+
+                    if (flags & TRUN_SAMPLE_CTS_OFFSET)
+                    {
+                        uint32_t v = b.U32();
+                        cts = (version == 0) ? (int64_t)v : (int64_t)(int32_t)v;
+                    }
+
+                    if (bOurTrack)
+                    {
+                        Mp4Sample sample;
+                        sample.offset = dataPos;
+                        sample.size = size;
+                        sample.bSync = (sampleFlags & SAMPLE_FLAG_NON_SYNC) == 0;
+                        sample.dts = pState->nextDts;
+                        sample.pts = pState->nextDts + cts + track.editOffset;
+
+                        pSamples->push_back(sample);
+
+                        pState->nextDts += duration;
+                    }
+
+                    dataPos += size;
+                }
+            }
+
+            if (!b.ok)
+            {
+                return MP4_E_FORMAT;
+            }
+        }
+
+        dataEnd = dataPos;
+    }
+
+    return bError ? MP4_E_FORMAT : MP4_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Mp4SampleIndex constructor
+//-------------------------------------------------------------------
+
+Mp4SampleIndex::Mp4SampleIndex()
+    : trackId(0),
+      timescale(0),
+      codec(0),
+      width(0),
+      height(0),
+      bFragmented(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Build
+//
+// Reads the sample tables of the first video track of a file.
+//-------------------------------------------------------------------
+
+MP4_STATUS Mp4SampleIndex::Build(Mp4ByteSource *pSource)
+{
+    MP4_STATUS status = MP4_OK;
+
+    MovieInfo movie;
+    bool bHaveMoov = false;
+
+    struct Fragment
+    {
+        uint64_t    offset;
+        uint64_t    size;
+    };
+
+    std::vector<Fragment> fragments;
+    std::vector<uint8_t> buffer;
+
+    const TrackTables *pTrack = NULL;
+    FragmentState state = { 0 };
+
+    uint64_t cbFile = pSource->Size();
+    uint64_t offset = 0;
+
+    samples.clear();
+    bFragmented = false;
+
+    // Walk the top-level boxes, reading only moov and moof.
+
+    while (offset + 8 <= cbFile)
+    {
+        uint8_t header[16];
+        size_t cbHeader = 8;
+
+        if (!pSource->ReadAt(offset, header, (size_t)((cbFile - offset < 16) ? cbFile - offset : 16)))
+        {
+            return MP4_E_READ;
+        }
+
+        Reader r(header, sizeof(header));
+        uint64_t size = r.U32();
+        uint32_t type = r.U32();
+
+        if (size == 1)
+        {
+            size = r.U64();
+            cbHeader = 16;
+        }
+        else if (size == 0)
+        {
+            size = cbFile - offset;
+        }
+
+        if (!IsPrintableType(type) || size < cbHeader || size > cbFile - offset)
+        {
+            // Tolerate a truncated last box, as players do.
+            if (bHaveMoov && IsPrintableType(type) && size >= cbHeader)
+            {
+                break;
+            }
+            return MP4_E_FORMAT;
+        }
+
+        if (type == FOURCC('m','o','o','v'))
+        {
+            if (size > MAX_MOOV_SIZE)
+            {
+                return MP4_E_OUT_OF_MEMORY;
+            }
+
+            buffer.resize((size_t)(size - cbHeader));
+
+            if (!buffer.empty() && !pSource->ReadAt(offset + cbHeader, &buffer[0], buffer.size()))
+            {
+                return MP4_E_READ;
+            }
+
+            if (!ParseMoov(buffer.empty() ? NULL : &buffer[0], buffer.size(), &movie))
+            {
+                return MP4_E_FORMAT;
+            }
+
+            bHaveMoov = true;
+        }
+        else if (type == FOURCC('m','o','o','f'))
+        {
+            Fragment fragment = { offset, size };
+            fragments.push_back(fragment);
+        }
+
+        offset += size;
+    }
+
+    if (!bHaveMoov)
+    {
+        return MP4_E_FORMAT;
+    }
+
+    for (size_t i = 0; i < movie.tracks.size(); i++)
+    {
+        if (movie.tracks[i].handler == FOURCC('v','i','d','e') && movie.tracks[i].timescale != 0)
+        {
+            pTrack = &movie.tracks[i];
+            break;
+        }
+    }
+
+    if (pTrack == NULL)
+    {
+        return MP4_E_NO_VIDEO;
+    }
+
+    TrackTables track = *pTrack;
+
+    // Leading empty edits delay presentation; convert them from movie
+    // to track units.
+    if (track.emptyEdit && movie.timescale)
+    {
+        track.editOffset += (int64_t)(track.emptyEdit * track.timescale / movie.timescale);
+    }
+
+    for (size_t i = 0; i < movie.trex.size(); i++)
+    {
+        if (movie.trex[i].trackId == track.trackId)
+        {
+            track.defaultDuration = movie.trex[i].defaultDuration;
+            track.defaultSize = movie.trex[i].defaultSize;
+            track.defaultFlags = movie.trex[i].defaultFlags;
+        }
+    }
+
+    trackId = track.trackId;
+    timescale = track.timescale;
+    codec = track.codec;
+    width = track.width;
+    height = track.height;
+
+    status = ExpandSampleTables(track, &samples);
+
+    if (status != MP4_OK)
+    {
+        return status;
+    }
+
+    // Fragments continue where the moov samples end.
+    if (!samples.empty())
+    {
+        const Mp4Sample& last = samples.back();
+        state.nextDts = last.dts + (track.stts.empty() ? 0 : (uint32_t)track.stts.back().value);
+    }
+
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+        uint64_t cbHeader = 8;
+
+        if (fragments[i].size > MAX_MOOF_SIZE)
+        {
+            return MP4_E_OUT_OF_MEMORY;
+        }
+
+        // Re-read the header to find its length.
+        uint8_t header[8];
+        if (!pSource->ReadAt(fragments[i].offset, header, sizeof(header)))
+        {
+            return MP4_E_READ;
+        }
+        if (header[0] == 0 && header[1] == 0 && header[2] == 0 && header[3] == 1)
+        {
+            cbHeader = 16;
+        }
+
+        buffer.resize((size_t)(fragments[i].size - cbHeader));
+
+        if (!buffer.empty() && !pSource->ReadAt(fragments[i].offset + cbHeader, &buffer[0], buffer.size()))
+        {
+            return MP4_E_READ;
+        }
+
+        status = ParseMoof(buffer.empty() ? NULL : &buffer[0], buffer.size(), fragments[i].offset, track, &state, &samples);
+
+        if (status != MP4_OK)
+        {
+            return status;
+        }
+
+        bFragmented = true;
+    }
+
+    return MP4_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ToHns: Converts track time to 100-ns units.
+//-------------------------------------------------------------------
+
+int64_t Mp4SampleIndex::ToHns(int64_t t) const
+{
+    if (timescale == 0)
+    {
+        return 0;
+    }
+
+    // Split the multiplication so that long files do not overflow.
+    return (t / timescale) * 10000000 + (t % timescale) * 10000000 / timescale;
+}
+
+//-------------------------------------------------------------------
+// SyncSampleCount
+//-------------------------------------------------------------------
+
+size_t Mp4SampleIndex::SyncSampleCount() const
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        if (samples[i].bSync)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+//-------------------------------------------------------------------
+// FindSyncSample
+//
+// Finds the latest sync sample presented at or before a position, in
+// 100-ns units. Returns false if there is none.
+//-------------------------------------------------------------------
+
+bool Mp4SampleIndex::FindSyncSample(int64_t hnsPos, size_t *pIndex) const
+{
+    bool bFound = false;
+    int64_t hnsBest = 0;
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        if (!samples[i].bSync)
+        {
+            continue;
+        }
+
+        int64_t hnsTime = ToHns(samples[i].pts);
+
+        if (hnsTime <= hnsPos && (!bFound || hnsTime > hnsBest))
+        {
+            *pIndex = i;
+            hnsBest = hnsTime;
+            bFound = true;
+        }
+    }
+
+    return bFound;
+}
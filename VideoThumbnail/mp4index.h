@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Mp4SampleIndex: MP4/MOV sample table parser.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// NOTE: Portability
+//
+// This parser depends only on the C++ standard library, so that it can
+// be built and tested on any platform. The caller supplies the bytes
+// through Mp4ByteSource.
+//
+// It reads the sample tables of the first video track:
+//
+//   moov/trak/mdia/mdhd            Time scale.
+//   moov/trak/mdia/minf/stbl       stsd, stts, ctts, stss, stsc, stsz or
+//                                  stz2, stco or co64.
+//   moov/trak/edts/elst            Initial presentation offset.
+//   moov/mvex/trex, moof/traf      Fragmented files: tfhd, tfdt, trun.
+//
+// Only box headers are read outside moov and moof, so media data is
+// never touched. The result lists every sample in decode order with its
+// presentation time, sync flag, file offset and size.
+
+enum MP4_STATUS
+{
+    MP4_OK = 0,
+    MP4_E_READ,             // The byte source failed.
+    MP4_E_FORMAT,           // Not an MP4/MOV file, or a malformed box.
+    MP4_E_NO_VIDEO,         // No video track.
+    MP4_E_OUT_OF_MEMORY
+};
+
+// Mp4ByteSource: Random access to the file.
+class Mp4ByteSource
+{
+public:
+    virtual ~Mp4ByteSource() { }
+
+    virtual bool        ReadAt(uint64_t offset, void *pBuffer, size_t cb) = 0;
+    virtual uint64_t    Size() = 0;
+};
+
+struct Mp4Sample
+{
+    uint64_t    offset;         // File offset of the sample data.
+    uint32_t    size;           // Bytes.
+    bool        bSync;          // Keyframe.
+    int64_t     dts;            // Decode time, in track time-scale units.
+    int64_t     pts;            // Presentation time, after the edit list offset.
+};
+
+
+class Mp4SampleIndex
+{
+public:
+    uint32_t                trackId;
+    uint32_t                timescale;      // Units per second of dts and pts.
+    uint32_t                codec;          // Sample entry type, such as 'avc1'.
+    uint16_t                width;
+    uint16_t                height;
+    bool                    bFragmented;
+    std::vector<Mp4Sample>  samples;        // Decode order.
+
+    Mp4SampleIndex();
+
+    MP4_STATUS  Build(Mp4ByteSource *pSource);
+
+    int64_t     ToHns(int64_t t) const;
+    size_t      SyncSampleCount() const;
+    bool        FindSyncSample(int64_t hnsPos, size_t *pIndex) const;
+};
@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// RangeCache: Block cache with read-ahead for slow byte sources.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "rangecache.h"
+
+#include <string.h>
+
+// Limits on the configuration.
+const uint32_t MIN_BLOCK_SIZE   = 4 * 1024;
+const uint32_t MAX_BLOCK_SIZE   = 16 * 1024 * 1024;
+const uint32_t MAX_BLOCKS       = 4096;
+
+
+//-------------------------------------------------------------------
+// RangeCache constructor
+//-------------------------------------------------------------------
+
+RangeCache::RangeCache()
+    : m_pSource(NULL),
+      m_cbSize(0),
+      m_clock(0)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// pSource:    Source of the bytes. Must outlive the cache.
+// cbSize:     Size of the source. Reads are clipped to it.
+//-------------------------------------------------------------------
+
+bool RangeCache::Initialize(RangeSource *pSource, uint64_t cbSize, const RangeCacheConfig& config)
+{
+    if (pSource == NULL || config.cbBlock < MIN_BLOCK_SIZE || config.cbBlock > MAX_BLOCK_SIZE ||
+        config.cBlocks == 0 || config.cBlocks > MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    Clear();
+
+    m_pSource = pSource;
+    m_cbSize = cbSize;
+    m_config = config;
+    m_stats = RangeCacheStats();
+
+    // Read-ahead never evicts the blocks of the read that caused it.
+    if (m_config.cReadAheadBlocks >= m_config.cBlocks)
+    {
+        m_config.cReadAheadBlocks = m_config.cBlocks - 1;
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Read
+//
+// Reads cb bytes at offset, or fewer at the end of the source.
+// Returns false if the source failed.
+//-------------------------------------------------------------------
+
+bool RangeCache::Read(uint64_t offset, void *pBuffer, size_t cb, size_t *pcbRead)
+{
+    uint8_t *pOut = (uint8_t*)pBuffer;
+
+    *pcbRead = 0;
+
+    if (m_pSource == NULL)
+    {
+        return false;
+    }
+
+    if (offset >= m_cbSize || cb == 0)
+    {
+        return true;
+    }
+
+    const uint64_t cbBlock = m_config.cbBlock;
+    const uint64_t end = (cb < m_cbSize - offset) ? offset + cb : m_cbSize;
+    const uint64_t lastBlock = (end - 1) / cbBlock;
+    const uint64_t cBlocksInFile = (m_cbSize + cbBlock - 1) / cbBlock;
+
+    uint64_t pos = offset;
+
+    ++m_stats.cReads;
+
+    while (pos < end)
+    {
+        uint64_t block = pos / cbBlock;
+        uint64_t blockEnd = (block + 1) * cbBlock;
+
+        const Slot *pSlot = Find(block);
+
+        if (pSlot)
+        {
+            size_t cbCopy = (size_t)(((end < blockEnd) ? end : blockEnd) - pos);
+
+            memcpy(pOut, &pSlot->data[(size_t)(pos - block * cbBlock)], cbCopy);
+
+            pOut += cbCopy;
+            pos += cbCopy;
+            ++m_stats.cBlockHits;
+            continue;
+        }
+
+        // Coalesce the run of missing blocks that this read covers.
+
+        uint64_t runEnd = block + 1;
+
+        while (runEnd <= lastBlock && Find(runEnd) == NULL)
+        {
+            ++runEnd;
+        }
+
+        uint64_t runBytesEnd = (end < runEnd * cbBlock) ? end : runEnd * cbBlock;
+
+        if (runEnd - block > m_config.cBlocks)
+        {
+            // Larger than the cache: read it straight into the caller's
+            // buffer, without caching it.
+
+            size_t cbDirect = (size_t)(runBytesEnd - pos);
+
+            if (!m_pSource->ReadAt(pos, pOut, cbDirect))
+            {
+                return false;
+            }
+
+            ++m_stats.cFetches;
+            m_stats.cbFetched += cbDirect;
+
+            pOut += cbDirect;
+            pos += cbDirect;
+            continue;
+        }
+
+        // Read ahead past the end of the read, up to the first block
+        // that is already cached.
+
+        uint64_t fetchEnd = runEnd;
+
+        if (runEnd > lastBlock)
+        {
+            uint64_t fetchLimit = block + m_config.cBlocks;
+
+            if (fetchLimit > runEnd + m_config.cReadAheadBlocks)
+            {
+                fetchLimit = runEnd + m_config.cReadAheadBlocks;
+            }
+            if (fetchLimit > cBlocksInFile)
+            {
+                fetchLimit = cBlocksInFile;
+            }
+
+            while (fetchEnd < fetchLimit && Find(fetchEnd) == NULL)
+            {
+                ++fetchEnd;
+            }
+        }
+
+        uint64_t fetchStart = block * cbBlock;
+        uint64_t fetchBytesEnd = (fetchEnd * cbBlock < m_cbSize) ? fetchEnd * cbBlock : m_cbSize;
+        size_t cbFetch = (size_t)(fetchBytesEnd - fetchStart);
+
+        m_buffer.resize(cbFetch);
+
+        if (!m_pSource->ReadAt(fetchStart, &m_buffer[0], cbFetch))
+        {
+            return false;
+        }
+
+        ++m_stats.cFetches;
+        m_stats.cbFetched += cbFetch;
+
+        size_t cbCopy = (size_t)(runBytesEnd - pos);
+
+        memcpy(pOut, &m_buffer[(size_t)(pos - fetchStart)], cbCopy);
+
+        pOut += cbCopy;
+        pos += cbCopy;
+
+        for (uint64_t b = block; b < fetchEnd; b++)
+        {
+            size_t cbOffset = (size_t)((b - block) * cbBlock);
+            size_t cbData = (cbFetch - cbOffset < cbBlock) ? cbFetch - cbOffset : (size_t)cbBlock;
+
+            Insert(b, &m_buffer[cbOffset], cbData);
+        }
+    }
+
+    *pcbRead = (size_t)(end - offset);
+    m_stats.cbRequested += *pcbRead;
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Clear
+//
+// Drops every cached block. The statistics are kept.
+//-------------------------------------------------------------------
+
+void RangeCache::Clear()
+{
+    m_slots.clear();
+    m_lookup.clear();
+    m_buffer.clear();
+    m_clock = 0;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Find
+//
+// Returns the cached block, marked as the most recently used, or NULL.
+//-------------------------------------------------------------------
+
+const RangeCache::Slot* RangeCache::Find(uint64_t block)
+{
+    std::map<uint64_t, size_t>::iterator it = m_lookup.find(block);
+
+    if (it == m_lookup.end())
+    {
+        return NULL;
+    }
+
+    Slot& slot = m_slots[it->second];
+    slot.lastUse = ++m_clock;
+
+    return &slot;
+}
+
+
+//-------------------------------------------------------------------
+// Insert
+//
+// Caches a block, replacing the least recently used one if the cache
+// is full.
+//-------------------------------------------------------------------
+
+void RangeCache::Insert(uint64_t block, const uint8_t *pData, size_t cb)
+{
+    size_t iSlot = m_slots.size();
+
+    if (m_slots.size() < m_config.cBlocks)
+    {
+        m_slots.resize(m_slots.size() + 1);
+    }
+    else
+    {
+        iSlot = 0;
+
+        for (size_t i = 1; i < m_slots.size(); i++)
+        {
+            if (m_slots[i].lastUse < m_slots[iSlot].lastUse)
+            {
+                iSlot = i;
+            }
+        }
+
+        m_lookup.erase(m_slots[iSlot].block);
+    }
+
+    Slot& slot = m_slots[iSlot];
+
+    slot.block = block;
+    slot.lastUse = ++m_clock;
+    slot.data.assign(pData, pData + cb);
+
+    m_lookup[block] = iSlot;
+}
@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// RangeCache: Block cache with read-ahead for slow byte sources.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <vector>
+
+// NOTE: Round trips
+//
+// On network storage, the cost of a read is dominated by the round trip,
+// not by its size. Demuxers issue many small reads: box and packet
+// headers, then the packets themselves, and after each seek the reads
+// jump to another part of the file.
+//
+// RangeCache sits between the demuxer and the source. The file is
+// divided into fixed-size blocks, and the most recently used blocks are
+// kept in memory. When a read misses, all of the missing blocks that it
+// covers are fetched with one read from the source, together with up to
+// cReadAheadBlocks blocks that follow, so that the reads after a seek
+// are usually served from memory.
+//
+// Like mp4index.h, this depends only on the C++ standard library, so
+// that it can be built and tested on any platform.
+
+// RangeSource: Random access to the underlying bytes.
+class RangeSource
+{
+public:
+    virtual ~RangeSource() { }
+
+    virtual bool    ReadAt(uint64_t offset, void *pBuffer, size_t cb) = 0;
+};
+
+struct RangeCacheConfig
+{
+    uint32_t    cbBlock;            // Block size.
+    uint32_t    cBlocks;            // Blocks kept in memory.
+    uint32_t    cReadAheadBlocks;   // Blocks fetched after a miss.
+
+    RangeCacheConfig() : cbBlock(256 * 1024), cBlocks(64), cReadAheadBlocks(4)
+    {
+    }
+};
+
+struct RangeCacheStats
+{
+    uint64_t    cReads;             // Reads from the caller.
+    uint64_t    cbRequested;        // Bytes returned to the caller.
+    uint64_t    cFetches;           // Reads from the source (round trips).
+    uint64_t    cbFetched;          // Bytes read from the source.
+    uint64_t    cBlockHits;         // Blocks served from memory.
+
+    RangeCacheStats() : cReads(0), cbRequested(0), cFetches(0), cbFetched(0), cBlockHits(0)
+    {
+    }
+};
+
+
+class RangeCache
+{
+    struct Slot
+    {
+        uint64_t                block;
+        uint64_t                lastUse;
+        std::vector<uint8_t>    data;       // Shorter than cbBlock for the last block.
+    };
+
+    RangeSource                 *m_pSource;
+    uint64_t                    m_cbSize;
+    RangeCacheConfig            m_config;
+    std::vector<Slot>           m_slots;
+    std::map<uint64_t, size_t>  m_lookup;   // Block number to slot.
+    std::vector<uint8_t>        m_buffer;   // Fetch buffer.
+    uint64_t                    m_clock;
+    RangeCacheStats             m_stats;
+
+public:
+
+    RangeCache();
+
+    bool    Initialize(RangeSource *pSource, uint64_t cbSize, const RangeCacheConfig& config);
+    bool    Read(uint64_t offset, void *pBuffer, size_t cb, size_t *pcbRead);
+    void    Clear();
+
+    uint64_t                Size() const { return m_cbSize; }
+    uint64_t                Capacity() const { return (uint64_t)m_config.cbBlock * m_config.cBlocks; }
+    const RangeCacheStats&  Stats() const { return m_stats; }
+
+private:
+    const Slot* Find(uint64_t block);
+    void        Insert(uint64_t block, const uint8_t *pData, size_t cb);
+};
@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ReaderCache: LRU cache of open source readers.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "readercache.h"
+#include "bytestream.h"
+
+#include <vector>
+
+// Memory estimate for one reader: a fixed cost for the source, parser
+// and decoder, plus a few RGB32 surfaces of the output size for the
+// decoder and the video processor.
+const ULONGLONG READER_BASE_MEMORY  = 2 * 1024 * 1024;
+const DWORD READER_SURFACES         = 6;
+
+
+//-------------------------------------------------------------------
+// ReaderCache constructor
+//-------------------------------------------------------------------
+
+ReaderCache::ReaderCache()
+    : m_cMaxEntries(0),
+      m_cbMaxMemory(0),
+      m_cbEstimated(0),
+      m_bMFStarted(FALSE),
+      m_cHits(0),
+      m_cMisses(0),
+      m_cEvictions(0)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+//-------------------------------------------------------------------
+// ReaderCache destructor
+//-------------------------------------------------------------------
+
+ReaderCache::~ReaderCache()
+{
+    Clear();
+
+    // Readers must be released before Media Foundation shuts down.
+    if (m_bMFStarted)
+    {
+        MFShutdown();
+    }
+
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// cMaxEntries: Maximum number of cached readers.
+// cbMaxMemory: Maximum estimated memory held by cached readers.
+//-------------------------------------------------------------------
+
+HRESULT ReaderCache::Initialize(DWORD cMaxEntries, ULONGLONG cbMaxMemory)
+{
+    HRESULT hr = S_OK;
+
+    if (m_bMFStarted)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    // Keep Media Foundation running for as long as the cache holds
+    // readers, even after the threads that created them have shut down.
+    hr = MFStartup(MF_VERSION);
+
+    if (SUCCEEDED(hr))
+    {
+        m_bMFStarted = TRUE;
+        m_cMaxEntries = cMaxEntries;
+        m_cbMaxMemory = cbMaxMemory;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Checkout
+//
+// Takes a cached reader for a file out of the cache. Returns FALSE if
+// there is none. Entries for an older version of the file are dropped.
+//-------------------------------------------------------------------
+
+BOOL ReaderCache::Checkout(const WCHAR *wszPath, const FileIdentity& id, ReaderState *pState)
+{
+    BOOL bFound = FALSE;
+
+    std::vector<ReaderState> stale;
+
+    EnterCriticalSection(&m_lock);
+
+    std::list<Entry>::iterator it = m_entries.begin();
+
+    while (it != m_entries.end())
+    {
+        if (_wcsicmp(it->path.c_str(), wszPath) != 0)
+        {
+            ++it;
+            continue;
+        }
+
+        BOOL bSameFile = (it->id.cbFile == id.cbFile) &&
+            (CompareFileTime(&it->id.ftLastWrite, &id.ftLastWrite) == 0);
+
+        if (!bSameFile)
+        {
+            // The file has changed since this reader was opened.
+            stale.push_back(it->state);
+        }
+        else if (!bFound)
+        {
+            *pState = it->state;
+            bFound = TRUE;
+        }
+        else
+        {
+            ++it;   // Another reader for the same file; leave it cached.
+            continue;
+        }
+
+        m_cbEstimated -= it->cbEstimated;
+        it = m_entries.erase(it);
+    }
+
+    if (bFound)
+    {
+        ++m_cHits;
+    }
+    else
+    {
+        ++m_cMisses;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    // Releasing a reader shuts down its source; do it outside the lock.
+    for (size_t i = 0; i < stale.size(); i++)
+    {
+        ReleaseState(&stale[i]);
+    }
+
+    return bFound;
+}
+
+
+//-------------------------------------------------------------------
+// Checkin
+//
+// Puts a reader into the cache, as the most recently used entry, and
+// evicts the least recently used entries that exceed the limits. The
+// cache takes over the reference in pState.
+//-------------------------------------------------------------------
+
+void ReaderCache::Checkin(const WCHAR *wszPath, const FileIdentity& id, ReaderState *pState)
+{
+    std::vector<ReaderState> evicted;
+
+    if (pState->pReader == NULL)
+    {
+        return;
+    }
+
+    // A reader that cannot seek cannot be rewound for the next user.
+    if (!pState->bCanSeek || m_cMaxEntries == 0)
+    {
+        ReleaseState(pState);
+        return;
+    }
+
+    Entry entry;
+    entry.path = wszPath;
+    entry.id = id;
+    entry.state = *pState;
+    entry.cbEstimated = EstimateMemory(*pState);
+
+    pState->pReader = NULL;
+    pState->pByteStream = NULL;
+
+    EnterCriticalSection(&m_lock);
+
+    m_entries.push_front(entry);
+    m_cbEstimated += entry.cbEstimated;
+
+    while (m_entries.size() > m_cMaxEntries || (m_cbEstimated > m_cbMaxMemory && m_entries.size() > 1))
+    {
+        evicted.push_back(m_entries.back().state);
+        m_cbEstimated -= m_entries.back().cbEstimated;
+        m_entries.pop_back();
+        ++m_cEvictions;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    for (size_t i = 0; i < evicted.size(); i++)
+    {
+        ReleaseState(&evicted[i]);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Clear
+//
+// Releases every cached reader.
+//-------------------------------------------------------------------
+
+void ReaderCache::Clear()
+{
+    std::list<Entry> entries;
+
+    EnterCriticalSection(&m_lock);
+    entries.swap(m_entries);
+    m_cbEstimated = 0;
+    LeaveCriticalSection(&m_lock);
+
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        ReleaseState(&it->state);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// GetStats
+//-------------------------------------------------------------------
+
+void ReaderCache::GetStats(ReaderCacheStats *pStats)
+{
+    EnterCriticalSection(&m_lock);
+
+    pStats->cHits = m_cHits;
+    pStats->cMisses = m_cMisses;
+    pStats->cEvictions = m_cEvictions;
+    pStats->cEntries = (DWORD)m_entries.size();
+    pStats->cbEstimated = m_cbEstimated;
+
+    LeaveCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// GetFileIdentity
+//
+// Gets the size and last-write time of a local file. Returns FALSE for
+// anything that is not a local file, such as a URL.
+//-------------------------------------------------------------------
+
+BOOL ReaderCache::GetFileIdentity(const WCHAR *wszPath, FileIdentity *pId)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesEx(wszPath, GetFileExInfoStandard, &data))
+    {
+        return FALSE;
+    }
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        return FALSE;
+    }
+
+    pId->cbFile = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    pId->ftLastWrite = data.ftLastWriteTime;
+    return TRUE;
+}
+
+
+//-------------------------------------------------------------------
+// ReleaseState
+//
+// Releases the reader of a ReaderState and the stream under it.
+//-------------------------------------------------------------------
+
+void ReaderCache::ReleaseState(ReaderState *pState)
+{
+    SafeRelease(&pState->pReader);
+    SafeRelease(&pState->pByteStream);
+}
+
+
+//
+/// Private methods
+//
+
+ULONGLONG ReaderCache::EstimateMemory(const ReaderState& state)
+{
+    ULONGLONG cbSurface = 4ULL * state.format.imageWidthPels * state.format.imageHeightPels;
+    ULONGLONG cbStream = state.pByteStream ? state.pByteStream->CacheMemory() : 0;
+
+    return READER_BASE_MEMORY + READER_SURFACES * cbSurface + cbStream;
+}
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ReaderCache: LRU cache of open source readers.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <list>
+#include <string>
+
+#include "Thumbnail.h"
+
+// NOTE: Usage
+//
+// Opening a file creates the media source, negotiates the RGB32 output
+// type and loads the decoder. A ReaderCache keeps readers that are no
+// longer in use, so that the next request for the same file can skip
+// all of that:
+//
+//     FileIdentity id;
+//     if (ReaderCache::GetFileIdentity(wszPath, &id) && cache.Checkout(wszPath, id, &state))
+//         generator.AttachReader(&state);
+//     else
+//         generator.OpenFile(wszPath);
+//     ...
+//     generator.DetachReader(&state);
+//     cache.Checkin(wszPath, id, &state);
+//
+// A reader is used by one caller at a time: Checkout removes it from
+// the cache, and Checkin puts it back. Several readers can be cached for
+// the same file. An entry is only used if the file still has the same
+// size and last-write time.
+//
+// The cache is bounded by the number of readers and by an estimate of
+// the memory they hold (decoder and video processor surfaces).
+//
+// Only local files are cached; URLs and streams always open a new
+// reader. A cached reader keeps its file open for reading, so call
+// Clear before files are deleted or replaced in bulk.
+
+struct FileIdentity
+{
+    ULONGLONG   cbFile;
+    FILETIME    ftLastWrite;
+};
+
+struct ReaderCacheStats
+{
+    ULONGLONG   cHits;
+    ULONGLONG   cMisses;
+    ULONGLONG   cEvictions;
+    DWORD       cEntries;
+    ULONGLONG   cbEstimated;
+};
+
+
+class ReaderCache
+{
+    struct Entry
+    {
+        std::wstring    path;
+        FileIdentity    id;
+        ReaderState     state;
+        ULONGLONG       cbEstimated;
+    };
+
+    CRITICAL_SECTION    m_lock;
+    std::list<Entry>    m_entries;      // Most recently used first.
+    DWORD               m_cMaxEntries;
+    ULONGLONG           m_cbMaxMemory;
+    ULONGLONG           m_cbEstimated;
+    BOOL                m_bMFStarted;
+
+    ULONGLONG           m_cHits;
+    ULONGLONG           m_cMisses;
+    ULONGLONG           m_cEvictions;
+
+public:
+
+    ReaderCache();
+    ~ReaderCache();
+
+    HRESULT     Initialize(DWORD cMaxEntries, ULONGLONG cbMaxMemory);
+
+    BOOL        Checkout(const WCHAR *wszPath, const FileIdentity& id, ReaderState *pState);
+    void        Checkin(const WCHAR *wszPath, const FileIdentity& id, ReaderState *pState);
+    void        Clear();
+
+    void        GetStats(ReaderCacheStats *pStats);
+
+    static BOOL GetFileIdentity(const WCHAR *wszPath, FileIdentity *pId);
+    static void ReleaseState(ReaderState *pState);
+
+private:
+    static ULONGLONG EstimateMemory(const ReaderState& state);
+};
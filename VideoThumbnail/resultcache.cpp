@@ -0,0 +1,612 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ResultCache: On-disk cache of encoded thumbnails.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "resultcache.h"
+#include "hash.h"
+
+#include <algorithm>
+
+const DWORD RESULT_FILE_MAGIC   = 0x43525456;   // 'VTRC'
+const DWORD RESULT_FILE_VERSION = 1;
+
+// Changes whenever the way thumbnails are produced changes, so that old
+// entries stop matching.
+const DWORD RESULT_CACHE_GENERATION = 4;
+
+// The thumbnail is cropped to a square from the top left of the frame
+// and then scaled (see Sprite::Encode).
+const DWORD CROP_MODE_SQUARE = 1;
+
+const WCHAR RESULT_FILE_EXTENSION[] = L".vtc";
+
+struct RESULT_FILE_HEADER
+{
+    DWORD       magic;
+    DWORD       version;
+    ULONGLONG   key[2];
+    DWORD       count;
+    DWORD       reserved;
+};
+
+struct RESULT_FILE_ITEM
+{
+    LONGLONG    hnsTimestamp;
+    DWORD       cbData;
+    DWORD       reserved;
+};
+
+
+static HRESULT HashFileRange(HANDLE hFile, ULONGLONG offset, DWORD cb, BYTE *pBuffer, ULONGLONG *pHash)
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = (LONGLONG)offset;
+
+    DWORD cbRead = 0;
+
+    if (!SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) ||
+        !ReadFile(hFile, pBuffer, cb, &cbRead, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    *pHash = Fnv1a(FNV_OFFSET_BASIS, pBuffer, cbRead);
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ResultEntry::Add
+//-------------------------------------------------------------------
+
+void ResultEntry::Add(LONGLONG hnsTimestamp, const BYTE *pData, DWORD cbData)
+{
+    Item item = { hnsTimestamp, cbData };
+
+    items.push_back(item);
+    data.insert(data.end(), pData, pData + cbData);
+}
+
+
+//-------------------------------------------------------------------
+// ResultCache constructor
+//-------------------------------------------------------------------
+
+ResultCache::ResultCache()
+    : m_cbMaxSize(0),
+      m_cbSize(0),
+      m_cHits(0),
+      m_cMisses(0),
+      m_cStores(0),
+      m_cEvictions(0)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+//-------------------------------------------------------------------
+// ResultCache destructor
+//-------------------------------------------------------------------
+
+ResultCache::~ResultCache()
+{
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Opens (or creates) a cache directory and indexes the entries that are
+// already in it.
+//
+// cbMaxSize: Size cap for the entries in the directory, in bytes.
+//-------------------------------------------------------------------
+
+HRESULT ResultCache::Initialize(const WCHAR *wszDirectory, ULONGLONG cbMaxSize)
+{
+    struct Found
+    {
+        FILETIME        ftLastWrite;
+        std::wstring    name;
+        ULONGLONG       cbFile;
+
+        bool operator<(const Found& other) const
+        {
+            return CompareFileTime(&ftLastWrite, &other.ftLastWrite) < 0;
+        }
+    };
+
+    std::vector<Found> found;
+    WIN32_FIND_DATA data;
+
+    if (!CreateDirectory(wszDirectory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_directory = wszDirectory;
+    m_cbMaxSize = cbMaxSize;
+
+    if (!m_directory.empty() && m_directory[m_directory.size() - 1] != L'\\')
+    {
+        m_directory += L'\\';
+    }
+
+    HANDLE hFind = FindFirstFile((m_directory + L"*").c_str(), &data);
+
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                continue;
+            }
+
+            std::wstring name(data.cFileName);
+            size_t cchExt = wcslen(RESULT_FILE_EXTENSION);
+
+            if (name.size() > cchExt && _wcsicmp(name.c_str() + name.size() - cchExt, RESULT_FILE_EXTENSION) == 0)
+            {
+                Found entry;
+                entry.ftLastWrite = data.ftLastWriteTime;
+                entry.name = name.substr(0, name.size() - cchExt);
+                entry.cbFile = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+                found.push_back(entry);
+            }
+            else if (name.size() > 4 && _wcsicmp(name.c_str() + name.size() - 4, L".tmp") == 0)
+            {
+                // Left behind by an interrupted Store.
+                DeleteFile((m_directory + name).c_str());
+            }
+        }
+        while (FindNextFile(hFind, &data));
+
+        FindClose(hFind);
+    }
+
+    // Oldest first, so that the newest entry ends up at the front.
+    std::sort(found.begin(), found.end());
+
+    EnterCriticalSection(&m_lock);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        Insert(found[i].name, found[i].cbFile);
+    }
+
+    Evict();
+
+    LeaveCriticalSection(&m_lock);
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Lookup
+//
+// Reads the cached result for a key.
+//
+// count:  Number of thumbnails the caller expects.
+//
+// Returns S_OK on a hit and S_FALSE on a miss.
+//-------------------------------------------------------------------
+
+HRESULT ResultCache::Lookup(const ResultKey& key, UINT32 count, ResultEntry *pEntry)
+{
+    HRESULT hr = S_OK;
+
+    std::wstring name = KeyName(key);
+    std::vector<BYTE> buffer;
+
+    LARGE_INTEGER cbFile;
+    cbFile.QuadPart = 0;
+
+    DWORD cbRead = 0;
+
+    // Let eviction delete the file while we read it.
+    HANDLE hFile = CreateFile(EntryPath(name).c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        hr = S_FALSE;
+        goto done;
+    }
+
+    if (!GetFileSizeEx(hFile, &cbFile) || cbFile.QuadPart < sizeof(RESULT_FILE_HEADER) || cbFile.QuadPart > MAXDWORD)
+    {
+        hr = S_FALSE;
+        goto done;
+    }
+
+    buffer.resize((size_t)cbFile.QuadPart);
+
+    if (!ReadFile(hFile, &buffer[0], (DWORD)buffer.size(), &cbRead, NULL) || cbRead != buffer.size())
+    {
+        hr = S_FALSE;
+        goto done;
+    }
+
+    // Validate the entry against the key and its own size.
+    {
+        const RESULT_FILE_HEADER *pHeader = (const RESULT_FILE_HEADER*)&buffer[0];
+        const RESULT_FILE_ITEM *pItems = (const RESULT_FILE_ITEM*)(pHeader + 1);
+
+        ULONGLONG cbExpected = sizeof(RESULT_FILE_HEADER) + (ULONGLONG)count * sizeof(RESULT_FILE_ITEM);
+
+        if (pHeader->magic != RESULT_FILE_MAGIC || pHeader->version != RESULT_FILE_VERSION ||
+            pHeader->key[0] != key.hash[0] || pHeader->key[1] != key.hash[1] ||
+            pHeader->count != count || cbExpected > buffer.size())
+        {
+            hr = S_FALSE;
+            goto done;
+        }
+
+        for (UINT32 i = 0; i < count; i++)
+        {
+            cbExpected += pItems[i].cbData;
+        }
+
+        if (cbExpected != buffer.size())
+        {
+            hr = S_FALSE;
+            goto done;
+        }
+
+        const BYTE *pData = (const BYTE*)(pItems + count);
+
+        pEntry->items.clear();
+        pEntry->data.assign(pData, buffer.data() + buffer.size());
+
+        for (UINT32 i = 0; i < count; i++)
+        {
+            ResultEntry::Item item = { pItems[i].hnsTimestamp, pItems[i].cbData };
+            pEntry->items.push_back(item);
+        }
+    }
+
+    // Record the use on disk too, so that the LRU order survives a
+    // restart.
+    {
+        FILETIME ftNow;
+        GetSystemTimeAsFileTime(&ftNow);
+        SetFileTime(hFile, NULL, NULL, &ftNow);
+    }
+
+done:
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    EnterCriticalSection(&m_lock);
+
+    if (hr == S_OK)
+    {
+        ++m_cHits;
+        Touch(name);
+    }
+    else
+    {
+        ++m_cMisses;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Store
+//
+// Writes an entry. The file is written under a temporary name and then
+// renamed, so that readers never see a partial entry.
+//-------------------------------------------------------------------
+
+HRESULT ResultCache::Store(const ResultKey& key, const ResultEntry& entry)
+{
+    HRESULT hr = S_OK;
+
+    std::wstring name = KeyName(key);
+    std::wstring path = EntryPath(name);
+
+    WCHAR wszSuffix[32];
+    StringCchPrintf(wszSuffix, ARRAYSIZE(wszSuffix), L".%u.tmp", GetCurrentThreadId());
+
+    std::wstring tempPath = m_directory + name + wszSuffix;
+
+    RESULT_FILE_HEADER header;
+    ZeroMemory(&header, sizeof(header));
+
+    header.magic = RESULT_FILE_MAGIC;
+    header.version = RESULT_FILE_VERSION;
+    header.key[0] = key.hash[0];
+    header.key[1] = key.hash[1];
+    header.count = (DWORD)entry.items.size();
+
+    std::vector<BYTE> buffer;
+    buffer.reserve(sizeof(header) + entry.items.size() * sizeof(RESULT_FILE_ITEM) + entry.data.size());
+
+    buffer.insert(buffer.end(), (const BYTE*)&header, (const BYTE*)(&header + 1));
+
+    for (size_t i = 0; i < entry.items.size(); i++)
+    {
+        RESULT_FILE_ITEM item;
+        ZeroMemory(&item, sizeof(item));
+        item.hnsTimestamp = entry.items[i].hnsTimestamp;
+        item.cbData = entry.items[i].cbData;
+
+        buffer.insert(buffer.end(), (const BYTE*)&item, (const BYTE*)(&item + 1));
+    }
+
+    buffer.insert(buffer.end(), entry.data.begin(), entry.data.end());
+
+    if (buffer.size() > MAXDWORD)
+    {
+        return E_INVALIDARG;
+    }
+
+    DWORD cbWritten = 0;
+
+    HANDLE hFile = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!WriteFile(hFile, &buffer[0], (DWORD)buffer.size(), &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        if (!MoveFileEx(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        DeleteFile(tempPath.c_str());
+        return hr;
+    }
+
+    EnterCriticalSection(&m_lock);
+
+    ++m_cStores;
+    Insert(name, buffer.size());
+    Evict();
+
+    LeaveCriticalSection(&m_lock);
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetStats
+//-------------------------------------------------------------------
+
+void ResultCache::GetStats(ResultCacheStats *pStats)
+{
+    EnterCriticalSection(&m_lock);
+
+    pStats->cHits = m_cHits;
+    pStats->cMisses = m_cMisses;
+    pStats->cStores = m_cStores;
+    pStats->cEvictions = m_cEvictions;
+    pStats->cEntries = m_index.size();
+    pStats->cbSize = m_cbSize;
+
+    LeaveCriticalSection(&m_lock);
+}
+
+
+//-------------------------------------------------------------------
+// ComputeFingerprint
+//
+// Computes the fingerprint of a local file. Fails for anything that is
+// not a local file.
+//-------------------------------------------------------------------
+
+HRESULT ResultCache::ComputeFingerprint(const WCHAR *wszPath, SourceFingerprint *pFingerprint)
+{
+    HRESULT hr = S_OK;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    BYTE *pBuffer = NULL;
+
+    ZeroMemory(pFingerprint, sizeof(*pFingerprint));
+
+    HANDLE hFile = CreateFile(wszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileInformationByHandle(hFile, &info))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    pFingerprint->cbFile = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    pFingerprint->ftLastWrite = info.ftLastWriteTime;
+
+    pBuffer = new (std::nothrow) BYTE[FINGERPRINT_RANGE];
+
+    if (pBuffer == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    hr = HashFileRange(hFile, 0, FINGERPRINT_RANGE, pBuffer, &pFingerprint->headHash);
+
+    if (SUCCEEDED(hr))
+    {
+        ULONGLONG offset = 0;
+
+        if (pFingerprint->cbFile > FINGERPRINT_RANGE)
+        {
+            offset = pFingerprint->cbFile - FINGERPRINT_RANGE;
+        }
+
+        hr = HashFileRange(hFile, offset, FINGERPRINT_RANGE, pBuffer, &pFingerprint->tailHash);
+    }
+
+done:
+    delete [] pBuffer;
+    CloseHandle(hFile);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// MakeKey
+//
+// Computes the cache key for a source and a set of output options.
+// Returns FALSE if results with these options are not cached.
+//
+// bFieldDrop:    TRUE if interlaced frames are deinterlaced by dropping
+//                a field, which gives different pixels.
+// cbFrameMemory: The frame memory budget. It sets the reduction of
+//                large frames before they are scaled, so it changes the
+//                pixels too.
+//-------------------------------------------------------------------
+
+BOOL ResultCache::MakeKey(const SourceFingerprint& fingerprint, const VT_OPTIONS& opts, BOOL bFieldDrop,
+    ULONGLONG cbFrameMemory, ResultKey *pKey)
+{
+    if (opts.format == VT_FORMAT_BGRA || opts.cThumbnails == 0)
+    {
+        return FALSE;
+    }
+
+    const DWORD params[] =
+    {
+        RESULT_CACHE_GENERATION,
+        CROP_MODE_SQUARE,
+        opts.cThumbnails,
+        opts.cxThumbnail,
+        opts.cyThumbnail,
+        (DWORD)opts.format,
+        opts.phnsPositions ? 1UL : 0UL,
+        bFieldDrop ? 1UL : 0UL,
+        (DWORD)cbFrameMemory,
+        (DWORD)(cbFrameMemory >> 32)
+    };
+
+    float quality = opts.quality;
+
+    for (int i = 0; i < 2; i++)
+    {
+        ULONGLONG hash = (i == 0) ? FNV_OFFSET_BASIS : FNV_OFFSET_BASIS_2;
+
+        hash = Fnv1a(hash, &fingerprint.cbFile, sizeof(fingerprint.cbFile));
+        hash = Fnv1a(hash, &fingerprint.ftLastWrite, sizeof(fingerprint.ftLastWrite));
+        hash = Fnv1a(hash, &fingerprint.headHash, sizeof(fingerprint.headHash));
+        hash = Fnv1a(hash, &fingerprint.tailHash, sizeof(fingerprint.tailHash));
+        hash = Fnv1a(hash, params, sizeof(params));
+        hash = Fnv1a(hash, &quality, sizeof(quality));
+
+        if (opts.phnsPositions)
+        {
+            hash = Fnv1a(hash, opts.phnsPositions, sizeof(LONGLONG) * opts.cThumbnails);
+        }
+
+        pKey->hash[i] = hash;
+    }
+
+    return TRUE;
+}
+
+
+//
+/// Private methods
+//
+
+std::wstring ResultCache::KeyName(const ResultKey& key) const
+{
+    WCHAR wszName[40];
+
+    StringCchPrintf(wszName, ARRAYSIZE(wszName), L"%016I64x%016I64x", key.hash[0], key.hash[1]);
+
+    return wszName;
+}
+
+std::wstring ResultCache::EntryPath(const std::wstring& name) const
+{
+    return m_directory + name + RESULT_FILE_EXTENSION;
+}
+
+// The following methods are called with the lock held.
+
+void ResultCache::Touch(const std::wstring& name)
+{
+    std::map<std::wstring, IndexEntry>::iterator it = m_index.find(name);
+
+    if (it != m_index.end())
+    {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    }
+}
+
+void ResultCache::Insert(const std::wstring& name, ULONGLONG cbFile)
+{
+    Remove(name);
+
+    m_lru.push_front(name);
+
+    IndexEntry entry;
+    entry.lru = m_lru.begin();
+    entry.cbFile = cbFile;
+
+    m_index[name] = entry;
+    m_cbSize += cbFile;
+}
+
+void ResultCache::Remove(const std::wstring& name)
+{
+    std::map<std::wstring, IndexEntry>::iterator it = m_index.find(name);
+
+    if (it != m_index.end())
+    {
+        m_cbSize -= it->second.cbFile;
+        m_lru.erase(it->second.lru);
+        m_index.erase(it);
+    }
+}
+
+void ResultCache::Evict()
+{
+    while (m_cbSize > m_cbMaxSize && !m_lru.empty())
+    {
+        std::wstring name = m_lru.back();
+
+        DeleteFile(EntryPath(name).c_str());
+        Remove(name);
+
+        ++m_cEvictions;
+    }
+}
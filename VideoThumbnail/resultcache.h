@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ResultCache: On-disk cache of encoded thumbnails.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "thumbapi.h"
+
+// NOTE: Keys
+//
+// An entry is addressed by a 128-bit key computed from:
+//
+//   - A fingerprint of the source: its size, its last-write time and
+//     hashes of its first and last FINGERPRINT_RANGE bytes. Computing it
+//     reads at most two small ranges and does not open the video.
+//   - The output parameters: positions (or the number of evenly spaced
+//     positions), size, format, quality and the crop mode.
+//   - How interlaced frames are deinterlaced: by the video processor or
+//     by dropping a field (see ThumbnailContext::SetFieldDrop).
+//   - The frame memory budget, which sets how far large frames are
+//     reduced while they are converted (see SetFrameMemoryBudget in
+//     Thumbnail.h).
+//
+// Each entry is one file, <key>.vtc, in the cache directory. Entries are
+// evicted in least recently used order when the directory grows beyond
+// its size cap. The order survives restarts because a hit also updates
+// the file's last-write time.
+//
+// Only complete results are stored, and raw (VT_FORMAT_BGRA) results
+// are never cached.
+
+const DWORD FINGERPRINT_RANGE = 64 * 1024;
+
+struct SourceFingerprint
+{
+    ULONGLONG   cbFile;
+    FILETIME    ftLastWrite;
+    ULONGLONG   headHash;
+    ULONGLONG   tailHash;
+};
+
+struct ResultKey
+{
+    ULONGLONG   hash[2];
+};
+
+// ResultEntry: The thumbnails of one job, as stored in the cache.
+class ResultEntry
+{
+public:
+    struct Item
+    {
+        LONGLONG    hnsTimestamp;
+        DWORD       cbData;
+    };
+
+    std::vector<Item>   items;
+    std::vector<BYTE>   data;
+
+    void Add(LONGLONG hnsTimestamp, const BYTE *pData, DWORD cbData);
+};
+
+struct ResultCacheStats
+{
+    ULONGLONG   cHits;
+    ULONGLONG   cMisses;
+    ULONGLONG   cStores;
+    ULONGLONG   cEvictions;
+    ULONGLONG   cEntries;
+    ULONGLONG   cbSize;
+};
+
+
+class ResultCache
+{
+    struct IndexEntry
+    {
+        std::list<std::wstring>::iterator   lru;
+        ULONGLONG                           cbFile;
+    };
+
+    CRITICAL_SECTION                    m_lock;
+    std::wstring                        m_directory;
+    ULONGLONG                           m_cbMaxSize;
+    ULONGLONG                           m_cbSize;
+    std::list<std::wstring>             m_lru;      // Key names, most recently used first.
+    std::map<std::wstring, IndexEntry>  m_index;
+
+    ULONGLONG   m_cHits;
+    ULONGLONG   m_cMisses;
+    ULONGLONG   m_cStores;
+    ULONGLONG   m_cEvictions;
+
+public:
+
+    ResultCache();
+    ~ResultCache();
+
+    HRESULT     Initialize(const WCHAR *wszDirectory, ULONGLONG cbMaxSize);
+
+    HRESULT     Lookup(const ResultKey& key, UINT32 count, ResultEntry *pEntry);
+    HRESULT     Store(const ResultKey& key, const ResultEntry& entry);
+
+    void        GetStats(ResultCacheStats *pStats);
+
+    static HRESULT  ComputeFingerprint(const WCHAR *wszPath, SourceFingerprint *pFingerprint);
+    static BOOL     MakeKey(const SourceFingerprint& fingerprint, const VT_OPTIONS& opts, BOOL bFieldDrop,
+                        ULONGLONG cbFrameMemory, ResultKey *pKey);
+
+private:
+    std::wstring    KeyName(const ResultKey& key) const;
+    std::wstring    EntryPath(const std::wstring& name) const;
+
+    void            Touch(const std::wstring& name);
+    void            Insert(const std::wstring& name, ULONGLONG cbFile);
+    void            Remove(const std::wstring& name);
+    void            Evict();
+};
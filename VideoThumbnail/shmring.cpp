@@ -0,0 +1,607 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SharedFrameRing: Shared-memory ring for delivering thumbnails to a
+// consumer process on the same machine.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "shmring.h"
+
+const DWORD MAX_RING_SLOTS  = 1024;
+const DWORD SLOT_ALIGNMENT  = 64;
+
+static DWORD AlignUp(DWORD cb, DWORD alignment)
+{
+    return (cb + alignment - 1) & ~(alignment - 1);
+}
+
+static HRESULT GetObjectName(const WCHAR *wszName, const WCHAR *wszSuffix, WCHAR *wszObject, size_t cchObject)
+{
+    return StringCchPrintf(wszObject, cchObject, L"Local\\VideoThumbnail.%s%s", wszName, wszSuffix);
+}
+
+
+//-------------------------------------------------------------------
+// SharedFrameRing constructor
+//-------------------------------------------------------------------
+
+SharedFrameRing::SharedFrameRing()
+    : m_hMapping(NULL),
+      m_hFree(NULL),
+      m_hReady(NULL),
+      m_pView(NULL),
+      m_pHeader(NULL),
+      m_pDescriptors(NULL),
+      m_pSlotState(NULL),
+      m_pSlots(NULL),
+      m_cSlots(0),
+      m_cbSlot(0),
+      m_cbHeader(0)
+{
+}
+
+//-------------------------------------------------------------------
+// SharedFrameRing destructor
+//-------------------------------------------------------------------
+
+SharedFrameRing::~SharedFrameRing()
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// Create
+//
+// Creates a new ring. Called by the consumer.
+//
+// wszName: Ring name. Producers open the ring with the same name.
+// cSlots:  Number of slots. This is how many frames can be in flight.
+// cbSlot:  Size of each slot. Must hold the largest expected frame.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::Create(const WCHAR *wszName, DWORD cSlots, DWORD cbSlot)
+{
+    HRESULT hr = S_OK;
+    WCHAR   wszObject[MAX_PATH];
+
+    if (m_pView)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    if (cSlots == 0 || cSlots > MAX_RING_SLOTS || cbSlot == 0 || cbSlot > MAXDWORD - SLOT_ALIGNMENT)
+    {
+        return E_INVALIDARG;
+    }
+
+    cbSlot = AlignUp(cbSlot, SLOT_ALIGNMENT);
+
+    DWORD cbHeader = AlignUp(
+        (DWORD)(sizeof(SHM_RING_HEADER) + cSlots * (sizeof(SHM_FRAME_DESCRIPTOR) + sizeof(LONG))),
+        SLOT_ALIGNMENT
+        );
+
+    ULONGLONG cbView = cbHeader + (ULONGLONG)cSlots * cbSlot;
+
+    if (cbView > MAXDWORD)
+    {
+        return E_INVALIDARG;
+    }
+
+    hr = GetObjectName(wszName, L"", wszObject, MAX_PATH);
+
+    if (SUCCEEDED(hr))
+    {
+        m_hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            0, (DWORD)cbView, wszObject);
+
+        if (m_hMapping == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MapView((DWORD)cbView);
+    }
+
+    // The pages of a new mapping are zero, so the sequences and slot
+    // states start out at zero (SHM_SLOT_FREE).
+
+    if (SUCCEEDED(hr))
+    {
+        m_pHeader->version = SHM_RING_VERSION;
+        m_pHeader->cSlots = cSlots;
+        m_pHeader->cbSlot = cbSlot;
+        m_pHeader->cbHeader = cbHeader;
+
+        m_cSlots = cSlots;
+        m_cbSlot = cbSlot;
+        m_cbHeader = cbHeader;
+
+        m_pDescriptors = (SHM_FRAME_DESCRIPTOR*)(m_pView + sizeof(SHM_RING_HEADER));
+        m_pSlotState = (volatile LONG*)(m_pDescriptors + cSlots);
+        m_pSlots = m_pView + cbHeader;
+
+        hr = OpenSemaphores(wszName, TRUE, cSlots);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Producers check the magic number last.
+        MemoryBarrier();
+        m_pHeader->magic = SHM_RING_MAGIC;
+    }
+    else
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// WaitFrame
+//
+// Waits for the next frame. Called by the consumer.
+//
+// pDesc:   Receives the frame descriptor.
+// ppData:  Receives a pointer to the frame data in the slot. It is valid
+//          until the consumer calls ReleaseFrame(pDesc->slot).
+//
+// Returns HRESULT_FROM_WIN32(ERROR_TIMEOUT) if no frame arrives in time.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::WaitFrame(DWORD dwTimeoutMs, SHM_FRAME_DESCRIPTOR *pDesc, const BYTE **ppData)
+{
+    if (m_pHeader == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    DWORD dwResult = WaitForSingleObject(m_hReady, dwTimeoutMs);
+
+    if (dwResult == WAIT_TIMEOUT)
+    {
+        return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+    else if (dwResult != WAIT_OBJECT_0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LONG sequence = m_pHeader->readSequence;
+    LONG expected = (LONG)((ULONG)sequence + 1);
+
+    SHM_FRAME_DESCRIPTOR *pEntry = &m_pDescriptors[(ULONG)sequence % m_cSlots];
+
+    // Producers publish in any order, so the semaphore can be released
+    // by a later producer while the one that reserved this descriptor is
+    // still filling it in. That takes a few instructions; wait for it.
+
+    while (pEntry->sequence != expected)
+    {
+        SwitchToThread();
+    }
+
+    MemoryBarrier();
+
+    *pDesc = *pEntry;
+
+    InterlockedIncrement(&m_pHeader->readSequence);
+
+    if (pDesc->slot >= m_cSlots || pDesc->cbData > m_cbSlot)
+    {
+        return E_UNEXPECTED;
+    }
+
+    *ppData = m_pSlots + (SIZE_T)pDesc->slot * m_cbSlot;
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ReleaseFrame
+//
+// Returns a slot to the producers. Called by the consumer.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::ReleaseFrame(DWORD slot)
+{
+    if (m_pHeader == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (slot >= m_cSlots)
+    {
+        return E_INVALIDARG;
+    }
+
+    InterlockedExchange(&m_pSlotState[slot], SHM_SLOT_FREE);
+
+    if (!ReleaseSemaphore(m_hFree, 1, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Open
+//
+// Opens a ring that the consumer created. Called by a producer.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::Open(const WCHAR *wszName)
+{
+    HRESULT hr = S_OK;
+    WCHAR   wszObject[MAX_PATH];
+
+    MEMORY_BASIC_INFORMATION mbi;
+    ZeroMemory(&mbi, sizeof(mbi));
+
+    if (m_pView)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    hr = GetObjectName(wszName, L"", wszObject, MAX_PATH);
+
+    if (SUCCEEDED(hr))
+    {
+        m_hMapping = OpenFileMapping(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, wszObject);
+        if (m_hMapping == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MapView(0);
+    }
+
+    // Validate the header against the size of the mapping, so that a bad
+    // header cannot make us write outside of it. The header is shared and
+    // writable, so copy the geometry once, check the copy, and use only
+    // the copy from now on.
+
+    if (SUCCEEDED(hr))
+    {
+        if (VirtualQuery(m_pView, &mbi, sizeof(mbi)) == 0)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        const volatile SHM_RING_HEADER *pHeader = m_pHeader;
+
+        DWORD magic = pHeader->magic;
+        DWORD version = pHeader->version;
+
+        MemoryBarrier();    // The creator writes the magic number last.
+
+        DWORD cSlots = pHeader->cSlots;
+        DWORD cbSlot = pHeader->cbSlot;
+        DWORD cbHeader = pHeader->cbHeader;
+
+        if (magic != SHM_RING_MAGIC || version != SHM_RING_VERSION)
+        {
+            hr = MF_E_INVALIDREQUEST;
+        }
+        else if (cSlots == 0 || cSlots > MAX_RING_SLOTS || cbSlot == 0 ||
+                 cbHeader < sizeof(SHM_RING_HEADER) + cSlots * (sizeof(SHM_FRAME_DESCRIPTOR) + sizeof(LONG)) ||
+                 cbHeader + (ULONGLONG)cSlots * cbSlot > mbi.RegionSize)
+        {
+            hr = MF_E_INVALIDREQUEST;
+        }
+        else
+        {
+            m_cSlots = cSlots;
+            m_cbSlot = cbSlot;
+            m_cbHeader = cbHeader;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_pDescriptors = (SHM_FRAME_DESCRIPTOR*)(m_pView + sizeof(SHM_RING_HEADER));
+        m_pSlotState = (volatile LONG*)(m_pDescriptors + m_cSlots);
+        m_pSlots = m_pView + m_cbHeader;
+
+        hr = OpenSemaphores(wszName, FALSE, 0);
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// AcquireSlot
+//
+// Claims a free slot. Called by a producer. Blocks while the consumer
+// holds every slot.
+//
+// Returns HRESULT_FROM_WIN32(ERROR_TIMEOUT) if no slot becomes free in
+// time.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::AcquireSlot(DWORD dwTimeoutMs, DWORD *pSlot, BYTE **ppData)
+{
+    if (m_pHeader == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    DWORD dwResult = WaitForSingleObject(m_hFree, dwTimeoutMs);
+
+    if (dwResult == WAIT_TIMEOUT)
+    {
+        return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+    else if (dwResult != WAIT_OBJECT_0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // The semaphore guarantees that at least one slot is free for us.
+
+    for (DWORD i = 0; i < m_cSlots; i++)
+    {
+        if (InterlockedCompareExchange(&m_pSlotState[i], SHM_SLOT_WRITING, SHM_SLOT_FREE) == SHM_SLOT_FREE)
+        {
+            *pSlot = i;
+            *ppData = m_pSlots + (SIZE_T)i * m_cbSlot;
+            return S_OK;
+        }
+    }
+
+    // The consumer released a slot that it did not own.
+    ReleaseSemaphore(m_hFree, 1, NULL);
+    return E_UNEXPECTED;
+}
+
+
+//-------------------------------------------------------------------
+// Publish
+//
+// Hands a filled slot to the consumer. Called by a producer.
+//
+// desc:    Describes the frame. The sequence and slot members are
+//          ignored.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::Publish(DWORD slot, const SHM_FRAME_DESCRIPTOR& desc)
+{
+    if (m_pHeader == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (slot >= m_cSlots || desc.cbData > m_cbSlot)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Reserve the next descriptor. There are as many descriptors as
+    // slots, and every unread descriptor refers to a slot that is still
+    // held, so this never overwrites one that the consumer has not read.
+
+    LONG sequence = (LONG)((ULONG)InterlockedIncrement(&m_pHeader->writeSequence) - 1);
+
+    SHM_FRAME_DESCRIPTOR *pEntry = &m_pDescriptors[(ULONG)sequence % m_cSlots];
+
+    CopyMemory(
+        (BYTE*)pEntry + FIELD_OFFSET(SHM_FRAME_DESCRIPTOR, payload),
+        (const BYTE*)&desc + FIELD_OFFSET(SHM_FRAME_DESCRIPTOR, payload),
+        sizeof(SHM_FRAME_DESCRIPTOR) - FIELD_OFFSET(SHM_FRAME_DESCRIPTOR, payload)
+        );
+
+    pEntry->slot = slot;
+
+    InterlockedExchange(&m_pSlotState[slot], SHM_SLOT_READY);
+
+    // The interlocked write is a full barrier, so the consumer sees the
+    // descriptor contents before the sequence number.
+    InterlockedExchange(&pEntry->sequence, (LONG)((ULONG)sequence + 1));
+
+    if (!ReleaseSemaphore(m_hReady, 1, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// AbandonSlot
+//
+// Returns a slot that was acquired but not published.
+//-------------------------------------------------------------------
+
+void SharedFrameRing::AbandonSlot(DWORD slot)
+{
+    if (m_pHeader && slot < m_cSlots)
+    {
+        InterlockedExchange(&m_pSlotState[slot], SHM_SLOT_FREE);
+        ReleaseSemaphore(m_hFree, 1, NULL);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// FindSlot
+//
+// Finds the slot that contains a pointer returned by AcquireSlot.
+//-------------------------------------------------------------------
+
+BOOL SharedFrameRing::FindSlot(const void *pv, DWORD *pSlot) const
+{
+    if (m_pHeader == NULL)
+    {
+        return FALSE;
+    }
+
+    const BYTE *pb = (const BYTE*)pv;
+    const BYTE *pEnd = m_pSlots + (SIZE_T)m_cSlots * m_cbSlot;
+
+    if (pb < m_pSlots || pb >= pEnd)
+    {
+        return FALSE;
+    }
+
+    *pSlot = (DWORD)((pb - m_pSlots) / m_cbSlot);
+    return TRUE;
+}
+
+
+//-------------------------------------------------------------------
+// Close
+//-------------------------------------------------------------------
+
+void SharedFrameRing::Close()
+{
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+        m_pView = NULL;
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+    if (m_hFree)
+    {
+        CloseHandle(m_hFree);
+        m_hFree = NULL;
+    }
+    if (m_hReady)
+    {
+        CloseHandle(m_hReady);
+        m_hReady = NULL;
+    }
+
+    m_pHeader = NULL;
+    m_pDescriptors = NULL;
+    m_pSlotState = NULL;
+    m_pSlots = NULL;
+    m_cSlots = 0;
+    m_cbSlot = 0;
+    m_cbHeader = 0;
+}
+
+
+//
+/// Private methods
+//
+
+//-------------------------------------------------------------------
+// MapView
+//
+// Maps cbView bytes of the mapping, or all of it if cbView is zero.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::MapView(DWORD cbView)
+{
+    m_pView = (BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, cbView);
+
+    if (m_pView == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_pHeader = (SHM_RING_HEADER*)m_pView;
+    return S_OK;
+}
+
+//-------------------------------------------------------------------
+// OpenSemaphores
+//
+// Creates or opens the free and ready semaphores.
+//-------------------------------------------------------------------
+
+HRESULT SharedFrameRing::OpenSemaphores(const WCHAR *wszName, BOOL bCreate, DWORD cSlots)
+{
+    HRESULT hr = S_OK;
+    WCHAR   wszFree[MAX_PATH];
+    WCHAR   wszReady[MAX_PATH];
+
+    const DWORD dwAccess = SYNCHRONIZE | SEMAPHORE_MODIFY_STATE;
+
+    hr = GetObjectName(wszName, L".free", wszFree, MAX_PATH);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = GetObjectName(wszName, L".ready", wszReady, MAX_PATH);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (bCreate)
+        {
+            m_hFree = CreateSemaphore(NULL, cSlots, cSlots, wszFree);
+        }
+        else
+        {
+            m_hFree = OpenSemaphore(dwAccess, FALSE, wszFree);
+        }
+
+        if (m_hFree == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else if (bCreate && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (bCreate)
+        {
+            m_hReady = CreateSemaphore(NULL, 0, cSlots, wszReady);
+        }
+        else
+        {
+            m_hReady = OpenSemaphore(dwAccess, FALSE, wszReady);
+        }
+
+        if (m_hReady == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else if (bCreate && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+        }
+    }
+
+    return hr;
+}
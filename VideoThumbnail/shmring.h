@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SharedFrameRing: Shared-memory ring for delivering thumbnails to a
+// consumer process on the same machine.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+
+// NOTE: Layout
+//
+// The consumer creates the ring, which consists of three named kernel
+// objects in the session namespace:
+//
+//   Local\VideoThumbnail.<name>        File mapping (pagefile backed).
+//   Local\VideoThumbnail.<name>.free   Semaphore: number of free slots.
+//   Local\VideoThumbnail.<name>.ready  Semaphore: number of published frames.
+//
+// The mapping holds a SHM_RING_HEADER, then cSlots descriptors, then
+// cSlots slot states, then the slots themselves at cbHeader, each cbSlot
+// bytes long (rounded up to 64 bytes).
+//
+// Producers wait on the free semaphore, claim a free slot, write the
+// image straight into it and publish a descriptor. The consumer waits on
+// the ready semaphore, reads descriptors in publication order and uses
+// the slot contents in place. Once it is done with a frame it releases
+// the slot. If the consumer falls behind, producers block in AcquireSlot
+// until a slot is released or their timeout expires.
+//
+// There can be any number of producers, but only one consumer.
+//
+// Either side can write to the header, so a producer reads the ring's
+// geometry (cSlots, cbSlot, cbHeader) once, in Open, checks it against
+// the size of the mapping, and from then on uses only its own copy.
+
+const DWORD SHM_RING_MAGIC      = 0x52425456;   // 'VTBR'
+const DWORD SHM_RING_VERSION    = 1;
+const DWORD SHM_MAX_REQUEST_ID  = 64;
+
+enum SHM_PAYLOAD
+{
+    SHM_PAYLOAD_BGRA    = 1,    // 32bpp BGRA, top-down.
+    SHM_PAYLOAD_JPEG    = 2,
+    SHM_PAYLOAD_PNG     = 3
+};
+
+enum SHM_SLOT_STATE
+{
+    SHM_SLOT_FREE       = 0,
+    SHM_SLOT_WRITING    = 1,
+    SHM_SLOT_READY      = 2
+};
+
+struct SHM_RING_HEADER
+{
+    DWORD           magic;
+    DWORD           version;
+    DWORD           cSlots;
+    DWORD           cbSlot;
+    DWORD           cbHeader;           // Offset of the first slot.
+    volatile LONG   writeSequence;      // Descriptors reserved by producers.
+    volatile LONG   readSequence;       // Descriptors consumed.
+};
+
+struct SHM_FRAME_DESCRIPTOR
+{
+    volatile LONG   sequence;           // Publication number + 1, once the descriptor is complete.
+    DWORD           slot;
+    DWORD           payload;            // SHM_PAYLOAD
+    DWORD           cbData;
+    DWORD           width;
+    DWORD           height;
+    DWORD           stride;             // Bytes per row for SHM_PAYLOAD_BGRA, otherwise 0.
+    DWORD           index;              // Thumbnail index within the request.
+    LONGLONG        hnsTimestamp;
+    char            requestId[SHM_MAX_REQUEST_ID];
+};
+
+
+class SharedFrameRing
+{
+    HANDLE                  m_hMapping;
+    HANDLE                  m_hFree;
+    HANDLE                  m_hReady;
+    BYTE                    *m_pView;
+
+    SHM_RING_HEADER         *m_pHeader;
+    SHM_FRAME_DESCRIPTOR    *m_pDescriptors;
+    volatile LONG           *m_pSlotState;
+    BYTE                    *m_pSlots;
+
+    // Copied from the header when the ring is created or opened.
+    DWORD                   m_cSlots;
+    DWORD                   m_cbSlot;
+    DWORD                   m_cbHeader;
+
+public:
+
+    SharedFrameRing();
+    ~SharedFrameRing();
+
+    // Consumer side.
+    HRESULT     Create(const WCHAR *wszName, DWORD cSlots, DWORD cbSlot);
+    HRESULT     WaitFrame(DWORD dwTimeoutMs, SHM_FRAME_DESCRIPTOR *pDesc, const BYTE **ppData);
+    HRESULT     ReleaseFrame(DWORD slot);
+
+    // Producer side.
+    HRESULT     Open(const WCHAR *wszName);
+    HRESULT     AcquireSlot(DWORD dwTimeoutMs, DWORD *pSlot, BYTE **ppData);
+    HRESULT     Publish(DWORD slot, const SHM_FRAME_DESCRIPTOR& desc);
+    void        AbandonSlot(DWORD slot);
+    BOOL        FindSlot(const void *pv, DWORD *pSlot) const;
+
+    void        Close();
+
+    DWORD       SlotCount() const { return m_cSlots; }
+    DWORD       SlotSize() const { return m_cbSlot; }
+
+private:
+    HRESULT     MapView(DWORD cbView);
+    HRESULT     OpenSemaphores(const WCHAR *wszName, BOOL bCreate, DWORD cSlots);
+};
@@ -1,96 +1,130 @@
-//////////////////////////////////////////////////////////////////////////
-//
-// Sprite: Manages drawing the thumbnail bitmap.
-//
-// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
-// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
-// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
-// PARTICULAR PURPOSE.
-//
-// Copyright (c) Microsoft Corporation. All rights reserved.
-//
-//////////////////////////////////////////////////////////////////////////
-
-
-// NOTE: Normalized rectangles
-//
-// A normalized rectangle has (x,y) coordinates that range [0 ... 1],
-// and is defined relative to another rectangle.
-//
-// For example, the upper left quandrant of a rectangle is specified
-// using a normalized rectangle of { 0, 0, 0.5, 0.5 }.
-
-#pragma once
-#include <wincodec.h>
-
-struct FormatInfo
-{
-    UINT32          imageWidthPels;
-    UINT32          imageHeightPels;
-    BOOL            bTopDown;
-    RECT            rcPicture;    // Corrected for pixel aspect ratio
-	MFVideoRotationFormat			rotation;
-
-	FormatInfo() : imageWidthPels(0), imageHeightPels(0), bTopDown(FALSE), rotation(MFVideoRotationFormat_0)
-    {
-        SetRectEmpty(&rcPicture);
-    }
-};
-
-
-class Sprite
-{
-    enum State
-    {
-        CLEAR,
-        PENDING,
-        BITMAP
-    };
-
-    ID2D1Bitmap         *m_pBitmap;
-    D2D1::Matrix3x2F    m_mat;
-
-    BOOL            m_bTopDown;
-    D2D1_SIZE_F     m_AspectRatio;
-
-	MFVideoRotationFormat m_rotation;
-
-    D2D1_RECT_F     m_nrcBound;    // Bounding box, as a normalized rectangle.
-    D2D1_RECT_F     m_fill;        // Actual fill rectangle in pixels.
-    D2D1_RECT_F     m_sourceRect;
-
-    // Animation
-    BOOL            m_bAnimating;
-    float           m_timeStart;         // Start time for the animation
-    float           m_timeEnd;           // Ending time.
-    D2D1_RECT_F     m_nrcAnimDistance;   // Animation path.
-    D2D1_RECT_F     m_nrcStartPosition;  // Equal to m_nrcBound at m_timeStart.
-
-    // Animation path is defined as follows:
-    // Final bounding box = m_nrcBound + m_nrcAnimDistance
-
-    // Wobble parameters
-    float           m_fAngle;
-    float           m_theta;
-
-protected:
-
-    // State:
-    // Currently two states are defined, BITMAP and CLEAR, simply reflecting
-    // whether the sprite contains a bitmap or not.
-
-    State           GetState() const { return (m_pBitmap ? BITMAP : CLEAR); }
-
-public:
-    Sprite();
-    ~Sprite();
-
-    void    SetBitmap(ID2D1Bitmap *pBitmap, const FormatInfo& format);
-	void    Save(LPCWSTR filePath, ID2D1RenderTarget *pRT, ID2D1Factory* pD2DFactory, WICRect destSize);
-
-    void    AnimateBoundingBox(const D2D1_RECT_F& bound2, float time, float duration);
-    void    Update(ID2D1HwndRenderTarget *pRT, float time);
-    void    Draw(ID2D1HwndRenderTarget *pRT);
-    BOOL    HitTest(int x, int y);
-    void    Clear();
-};
+//////////////////////////////////////////////////////////////////////////
+//
+// Sprite: Manages drawing the thumbnail bitmap.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+// NOTE: Normalized rectangles
+//
+// A normalized rectangle has (x,y) coordinates that range [0 ... 1],
+// and is defined relative to another rectangle.
+//
+// For example, the upper left quandrant of a rectangle is specified
+// using a normalized rectangle of { 0, 0, 0.5, 0.5 }.
+
+#pragma once
+#include <wincodec.h>
+
+class AsyncFileWriter;
+
+struct FormatInfo
+{
+    UINT32          imageWidthPels;
+    UINT32          imageHeightPels;
+    BOOL            bTopDown;
+    RECT            rcPicture;    // Corrected for pixel aspect ratio
+	MFVideoRotationFormat			rotation;
+
+	FormatInfo() : imageWidthPels(0), imageHeightPels(0), bTopDown(FALSE), rotation(MFVideoRotationFormat_0)
+    {
+        SetRectEmpty(&rcPicture);
+    }
+};
+
+
+struct EncodeOptions
+{
+    GUID            containerFormat;    // GUID_ContainerFormatJpeg, GUID_ContainerFormatPng, ...
+    float           quality;            // JPEG quality [0 ... 1]. Zero selects the encoder default.
+    BOOL            bFast;              // Less effort: lower JPEG quality, no PNG filters (see loadshed.h).
+
+    EncodeOptions() : containerFormat(GUID_ContainerFormatJpeg), quality(0.0f), bFast(FALSE)
+    {
+    }
+};
+
+
+class Sprite
+{
+    enum State
+    {
+        CLEAR,
+        PENDING,
+        BITMAP
+    };
+
+    ID2D1Bitmap         *m_pBitmap;
+    D2D1::Matrix3x2F    m_mat;
+
+    BOOL            m_bTopDown;
+    D2D1_SIZE_F     m_AspectRatio;
+
+	MFVideoRotationFormat m_rotation;
+
+    D2D1_RECT_F     m_nrcBound;    // Bounding box, as a normalized rectangle.
+    D2D1_RECT_F     m_fill;        // Actual fill rectangle in pixels.
+    D2D1_RECT_F     m_sourceRect;
+
+    // Animation
+    BOOL            m_bAnimating;
+    float           m_timeStart;         // Start time for the animation
+    float           m_timeEnd;           // Ending time.
+    D2D1_RECT_F     m_nrcAnimDistance;   // Animation path.
+    D2D1_RECT_F     m_nrcStartPosition;  // Equal to m_nrcBound at m_timeStart.
+
+    // Animation path is defined as follows:
+    // Final bounding box = m_nrcBound + m_nrcAnimDistance
+
+    // Wobble parameters
+    float           m_fAngle;
+    float           m_theta;
+
+protected:
+
+    // State:
+    // Currently two states are defined, BITMAP and CLEAR, simply reflecting
+    // whether the sprite contains a bitmap or not.
+
+    State           GetState() const { return (m_pBitmap ? BITMAP : CLEAR); }
+
+public:
+    Sprite();
+    ~Sprite();
+
+    void    SetBitmap(ID2D1Bitmap *pBitmap, const FormatInfo& format);
+	HRESULT Save(LPCWSTR filePath, ID2D1RenderTarget *pRT, ID2D1Factory* pD2DFactory, WICRect destSize);
+	HRESULT SaveAsync(AsyncFileWriter *pWriter, LPCWSTR filePath, ID2D1Factory* pD2DFactory, WICRect destSize,
+					  const EncodeOptions& opts = EncodeOptions());
+	HRESULT Encode(IStream *pStream, IWICImagingFactory *pWICFactory, ID2D1Factory* pD2DFactory, WICRect destSize,
+				   const EncodeOptions& opts = EncodeOptions());
+	HRESULT CopyPixels(IWICImagingFactory *pWICFactory, ID2D1Factory* pD2DFactory, WICRect destSize,
+					   UINT cbStride, UINT cbBuffer, BYTE *pBuffer);
+
+	// The thumbnail as a source that scales when it is read, or as a
+	// bitmap that is scaled now, so that the sprite can be cleared and the
+	// bitmap encoded later or on another thread. Fant interpolation
+	// averages every source pixel; linear is cheaper and coarser.
+	HRESULT CreateThumbnailSource(IWICImagingFactory *pWICFactory, ID2D1Factory* pD2DFactory, WICRect destSize,
+								  IWICBitmapSource **ppSource,
+								  WICBitmapInterpolationMode mode = WICBitmapInterpolationModeFant);
+	HRESULT CreateThumbnail(IWICImagingFactory *pWICFactory, ID2D1Factory* pD2DFactory, WICRect destSize,
+							IWICBitmap **ppThumbnail,
+							WICBitmapInterpolationMode mode = WICBitmapInterpolationModeFant);
+
+	static HRESULT EncodeSource(IWICBitmapSource *pSource, IStream *pStream, IWICImagingFactory *pWICFactory,
+								WICRect destSize, const EncodeOptions& opts = EncodeOptions());
+
+    void    AnimateBoundingBox(const D2D1_RECT_F& bound2, float time, float duration);
+    void    Update(ID2D1HwndRenderTarget *pRT, float time);
+    void    Draw(ID2D1HwndRenderTarget *pRT);
+    BOOL    HitTest(int x, int y);
+    void    Clear();
+};
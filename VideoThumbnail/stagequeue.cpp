@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// StageQueue: Bounded queue between two stages of a pipeline.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "stagequeue.h"
+#include "clock.h"
+
+
+//-------------------------------------------------------------------
+// StageQueue constructor
+//-------------------------------------------------------------------
+
+StageQueue::StageQueue()
+    : m_ppSlots(NULL),
+      m_cSlots(0),
+      m_iRead(0),
+      m_iWrite(0),
+      m_hFree(NULL),
+      m_hFilled(NULL)
+{
+}
+
+
+//-------------------------------------------------------------------
+// StageQueue destructor
+//-------------------------------------------------------------------
+
+StageQueue::~StageQueue()
+{
+    if (m_hFree)
+    {
+        CloseHandle(m_hFree);
+    }
+    if (m_hFilled)
+    {
+        CloseHandle(m_hFilled);
+    }
+    delete [] m_ppSlots;
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Creates a queue that holds up to cSlots items.
+//-------------------------------------------------------------------
+
+HRESULT StageQueue::Initialize(DWORD cSlots)
+{
+    if (m_ppSlots != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    if (cSlots == 0 || cSlots > MAXLONG)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_ppSlots = new (std::nothrow) void*[cSlots];
+    if (m_ppSlots == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    m_cSlots = cSlots;
+
+    m_hFree = CreateSemaphore(NULL, (LONG)cSlots, (LONG)cSlots, NULL);
+    if (m_hFree == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_hFilled = CreateSemaphore(NULL, 0, (LONG)cSlots, NULL);
+    if (m_hFilled == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Push
+//
+// Adds an item, waiting for a free slot if the queue is full. Called
+// from the producer thread only.
+//-------------------------------------------------------------------
+
+void StageQueue::Push(void *pItem, StageCounters *pCounters)
+{
+    Stopwatch wait;
+
+    WaitForSingleObject(m_hFree, INFINITE);
+
+    pCounters->blockedMs += wait.ElapsedMs();
+
+    m_ppSlots[m_iWrite] = pItem;
+    m_iWrite = (m_iWrite + 1) % m_cSlots;
+
+    ReleaseSemaphore(m_hFilled, 1, NULL);
+}
+
+
+//-------------------------------------------------------------------
+// Pop
+//
+// Removes the oldest item, waiting for one if the queue is empty.
+// Called from the consumer thread only.
+//-------------------------------------------------------------------
+
+void* StageQueue::Pop(StageCounters *pCounters)
+{
+    Stopwatch wait;
+
+    WaitForSingleObject(m_hFilled, INFINITE);
+
+    pCounters->starvedMs += wait.ElapsedMs();
+
+    void *pItem = m_ppSlots[m_iRead];
+    m_iRead = (m_iRead + 1) % m_cSlots;
+
+    ReleaseSemaphore(m_hFree, 1, NULL);
+
+    return pItem;
+}
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// StageQueue: Bounded queue between two stages of a pipeline.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// NOTE: Backpressure
+//
+// A StageQueue is a ring of cSlots pointers with exactly one producer
+// thread and one consumer thread. Two semaphores count the free and the
+// filled slots: Push waits while the ring is full, so a stage that runs
+// ahead is held back by the next one instead of piling up frames, and
+// Pop waits while it is empty. With one producer and one consumer, each
+// index has a single writer, so the ring itself needs no lock; the
+// semaphores order the slot accesses.
+//
+// StageCounters records how a stage spent its time: working, waiting
+// for input (starved) or waiting for room downstream (blocked). In a
+// balanced pipeline the slowest stage is busy all the time and the
+// others are starved or blocked for the difference.
+
+struct StageCounters
+{
+    double  busyMs;
+    double  starvedMs;      // In Pop.
+    double  blockedMs;      // In Push.
+    DWORD   cItems;
+
+    StageCounters() : busyMs(0), starvedMs(0), blockedMs(0), cItems(0)
+    {
+    }
+
+    // Fraction of totalMs that the stage was busy.
+    double Utilization(double totalMs) const { return (totalMs > 0) ? busyMs / totalMs : 0; }
+};
+
+
+class StageQueue
+{
+    void        **m_ppSlots;
+    DWORD       m_cSlots;
+    DWORD       m_iRead;            // Next slot to pop; consumer only.
+    DWORD       m_iWrite;           // Next slot to push; producer only.
+    HANDLE      m_hFree;            // Semaphore: empty slots.
+    HANDLE      m_hFilled;          // Semaphore: slots to pop.
+
+public:
+
+    StageQueue();
+    ~StageQueue();
+
+    HRESULT     Initialize(DWORD cSlots);
+
+    // Both block; the time spent waiting is added to pCounters.
+    void        Push(void *pItem, StageCounters *pCounters);
+    void*       Pop(StageCounters *pCounters);
+};
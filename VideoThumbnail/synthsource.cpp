@@ -0,0 +1,291 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SyntheticFrameSource: Generated frames with simulated latency.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "synthsource.h"
+
+#include <string.h>
+#include <chrono>
+#include <new>
+
+const int64_t HNS_PER_SECOND = 10000000;
+
+
+//-------------------------------------------------------------------
+// SyntheticFrameSource constructor
+//-------------------------------------------------------------------
+
+SyntheticFrameSource::SyntheticFrameSource()
+    : m_width(0),
+      m_height(0),
+      m_fpsNum(1),
+      m_fpsDen(1),
+      m_cFrames(0),
+      m_iNextFrame(0),
+      m_iCurrent(-1),
+      m_jitterMicroseconds(0),
+      m_random(1),
+      m_bCancelled(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Open
+//
+// Sets the format. The frames are generated as they are read.
+//-------------------------------------------------------------------
+
+void SyntheticFrameSource::Open(uint32_t width, uint32_t height, uint32_t fpsNum, uint32_t fpsDen, int64_t cFrames)
+{
+    m_width = width;
+    m_height = height;
+    m_fpsNum = fpsNum ? fpsNum : 1;
+    m_fpsDen = fpsDen ? fpsDen : 1;
+    m_cFrames = cFrames;
+    m_iNextFrame = 0;
+    m_iCurrent = -1;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bCancelled = false;
+}
+
+
+//-------------------------------------------------------------------
+// SetLatency
+//-------------------------------------------------------------------
+
+void SyntheticFrameSource::SetLatency(const FrameSourceCost& cost, uint32_t jitterMicroseconds, uint32_t seed)
+{
+    m_cost = cost;
+    m_jitterMicroseconds = jitterMicroseconds;
+    m_random = seed ? seed : 1;
+}
+
+
+//-------------------------------------------------------------------
+// SetFault
+//
+// SYNTH_FAULT_NONE removes the fault of a frame.
+//-------------------------------------------------------------------
+
+void SyntheticFrameSource::SetFault(int64_t iFrame, SYNTH_FAULT fault)
+{
+    if (fault == SYNTH_FAULT_NONE)
+    {
+        m_faults.erase(iFrame);
+    }
+    else
+    {
+        m_faults[iFrame] = fault;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// FrameNumberOf
+//
+// ConvertFrame writes the low 24 bits of the frame number into the
+// blue, green and red bytes of every pixel.
+//-------------------------------------------------------------------
+
+int64_t SyntheticFrameSource::FrameNumberOf(const uint8_t *pPixel)
+{
+    return (int64_t)pPixel[0] | ((int64_t)pPixel[1] << 8) | ((int64_t)pPixel[2] << 16);
+}
+
+
+//-------------------------------------------------------------------
+// FrameTime
+//-------------------------------------------------------------------
+
+int64_t SyntheticFrameSource::FrameTime(int64_t iFrame) const
+{
+    return iFrame * HNS_PER_SECOND * m_fpsDen / m_fpsNum;
+}
+
+
+// FrameSource methods
+
+FRAME_STATUS SyntheticFrameSource::GetFormat(FrameFormat *pFormat)
+{
+    pFormat->width = m_width;
+    pFormat->height = m_height;
+    pFormat->bTopDown = true;
+    pFormat->pictureLeft = 0;
+    pFormat->pictureTop = 0;
+    pFormat->pictureRight = (int32_t)m_width;
+    pFormat->pictureBottom = (int32_t)m_height;
+    pFormat->rotation = 0;
+    return FRAME_OK;
+}
+
+FRAME_STATUS SyntheticFrameSource::GetDuration(int64_t *phnsDuration)
+{
+    *phnsDuration = FrameTime(m_cFrames);
+    return FRAME_OK;
+}
+
+FRAME_STATUS SyntheticFrameSource::CanSeek(bool *pbCanSeek)
+{
+    *pbCanSeek = true;
+    return FRAME_OK;
+}
+
+FRAME_STATUS SyntheticFrameSource::Seek(int64_t hnsPosition)
+{
+    if (hnsPosition < 0)
+    {
+        hnsPosition = 0;
+    }
+
+    int64_t iFrame = hnsPosition * m_fpsNum / (HNS_PER_SECOND * m_fpsDen);
+
+    if (iFrame > m_cFrames)
+    {
+        iFrame = m_cFrames;
+    }
+
+    // Land on the keyframe at or before the position.
+    if (m_cost.gopLength > 1)
+    {
+        iFrame -= iFrame % m_cost.gopLength;
+    }
+
+    m_iCurrent = -1;
+
+    if (!Wait(m_cost.seekMicroseconds))
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    m_iNextFrame = iFrame;
+    return FRAME_OK;
+}
+
+FRAME_STATUS SyntheticFrameSource::ReadFrame(FrameView *pFrame, bool *pbFormatChanged)
+{
+    *pbFormatChanged = false;
+
+    if (m_iNextFrame >= m_cFrames)
+    {
+        return FRAME_END_OF_STREAM;
+    }
+
+    if (!Wait(m_cost.decodeMicroseconds))
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    std::map<int64_t, SYNTH_FAULT>::const_iterator it = m_faults.find(m_iNextFrame);
+
+    if (it != m_faults.end())
+    {
+        if (it->second == SYNTH_FAULT_HANG)
+        {
+            WaitForCancel();
+            return FRAME_E_CANCELLED;
+        }
+
+        ++m_iNextFrame;
+        return FRAME_E_FORMAT;
+    }
+
+    m_iCurrent = m_iNextFrame++;
+
+    pFrame->pData = NULL;
+    pFrame->stride = 0;
+    pFrame->timestamp = FrameTime(m_iCurrent);
+    pFrame->bKeyframe = (m_cost.gopLength <= 1) || (m_iCurrent % m_cost.gopLength == 0);
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS SyntheticFrameSource::ConvertFrame(FrameView *pFrame)
+{
+    if (m_iCurrent < 0)
+    {
+        return FRAME_E_READ;
+    }
+
+    try
+    {
+        m_bgra.resize((size_t)4 * m_width * m_height);
+    }
+    catch (std::bad_alloc&)
+    {
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    uint8_t pixel[4] = { (uint8_t)m_iCurrent, (uint8_t)(m_iCurrent >> 8), (uint8_t)(m_iCurrent >> 16), 0xFF };
+
+    for (size_t i = 0; i < m_bgra.size(); i += 4)
+    {
+        memcpy(&m_bgra[i], pixel, 4);
+    }
+
+    pFrame->pData = m_bgra.empty() ? NULL : &m_bgra[0];
+    pFrame->stride = (int32_t)(4 * m_width);
+    return FRAME_OK;
+}
+
+void SyntheticFrameSource::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bCancelled = true;
+    }
+
+    m_cvCancel.notify_all();
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Wait
+//
+// Sleeps for a latency plus a random share of the jitter. Returns
+// false if the source was cancelled.
+//-------------------------------------------------------------------
+
+bool SyntheticFrameSource::Wait(uint32_t microseconds)
+{
+    if (m_jitterMicroseconds > 0)
+    {
+        // xorshift32
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+
+        microseconds += m_random % (m_jitterMicroseconds + 1);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (microseconds > 0)
+    {
+        m_cvCancel.wait_for(lock, std::chrono::microseconds(microseconds), [this] { return m_bCancelled; });
+    }
+
+    return !m_bCancelled;
+}
+
+
+//-------------------------------------------------------------------
+// WaitForCancel
+//-------------------------------------------------------------------
+
+void SyntheticFrameSource::WaitForCancel()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_cvCancel.wait(lock, [this] { return m_bCancelled; });
+}
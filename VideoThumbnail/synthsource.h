@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SyntheticFrameSource: Generated frames with simulated latency.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "framesource.h"
+
+// NOTE: Synthetic frames
+//
+// SyntheticFrameSource needs no file. Each frame is a solid color that
+// encodes the frame's number, so a test can tell from the pixels which
+// frame it got (FrameNumberOf).
+//
+// Unlike the Y4M source's costs, which spin, the latencies here sleep:
+// they stand for a decoder that waits on hardware, a disk or the
+// network, which is when asynchronous reads pay off. Each seek and each
+// decoded frame waits for its latency plus a random extra of up to
+// jitterMicroseconds. The random sequence depends only on the seed, so
+// a run can be repeated.
+//
+// SetFault makes decoding a chosen frame fail (FRAME_E_FORMAT, as for a
+// corrupt frame) or hang until the source is cancelled, to test time
+// budgets (see watchdog.h). A read of a position hits the fault if it
+// decodes that frame on the way. Cancel also cuts short the latencies.
+//
+// framebench uses this source; it is not part of the product.
+
+enum SYNTH_FAULT
+{
+    SYNTH_FAULT_NONE = 0,
+    SYNTH_FAULT_ERROR,          // Decoding the frame fails.
+    SYNTH_FAULT_HANG            // Decoding the frame waits for Cancel.
+};
+
+class SyntheticFrameSource : public FrameSource
+{
+    uint32_t                m_width;
+    uint32_t                m_height;
+    uint32_t                m_fpsNum;
+    uint32_t                m_fpsDen;
+    int64_t                 m_cFrames;
+    int64_t                 m_iNextFrame;
+    int64_t                 m_iCurrent;         // Last frame read, or -1.
+    FrameSourceCost         m_cost;
+    uint32_t                m_jitterMicroseconds;
+    uint32_t                m_random;
+    std::vector<uint8_t>    m_bgra;
+    std::map<int64_t, SYNTH_FAULT> m_faults;    // By frame number.
+    std::mutex              m_mutex;            // Guards m_bCancelled.
+    std::condition_variable m_cvCancel;
+    bool                    m_bCancelled;       // Until the next Open.
+
+public:
+
+    SyntheticFrameSource();
+
+    void            Open(uint32_t width, uint32_t height, uint32_t fpsNum, uint32_t fpsDen, int64_t cFrames);
+    void            SetLatency(const FrameSourceCost& cost, uint32_t jitterMicroseconds, uint32_t seed);
+    void            SetFault(int64_t iFrame, SYNTH_FAULT fault);
+
+    // The frame number that ConvertFrame encoded in a pixel.
+    static int64_t  FrameNumberOf(const uint8_t *pPixel);
+
+    int64_t         FrameTime(int64_t iFrame) const;
+
+    // FrameSource
+    FRAME_STATUS    GetFormat(FrameFormat *pFormat);
+    FRAME_STATUS    GetDuration(int64_t *phnsDuration);
+    FRAME_STATUS    CanSeek(bool *pbCanSeek);
+    FRAME_STATUS    Seek(int64_t hnsPosition);
+    FRAME_STATUS    ReadFrame(FrameView *pFrame, bool *pbFormatChanged);
+    FRAME_STATUS    ConvertFrame(FrameView *pFrame);
+    void            Cancel();
+
+private:
+    bool            Wait(uint32_t microseconds);
+    void            WaitForCancel();
+};
@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// TaskPool: Threads that share the work of converting one frame.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "taskpool.h"
+
+#include <algorithm>
+#include <system_error>
+
+// One call to Run. Lives on the caller's stack; guarded by m_mutex.
+struct TaskPool::Job
+{
+    TaskProc    proc;
+    void        *pContext;
+    uint32_t    cTasks;
+    uint32_t    iNext;          // Next task to start.
+    uint32_t    cDone;
+};
+
+
+//-------------------------------------------------------------------
+// TaskPool constructor
+//-------------------------------------------------------------------
+
+TaskPool::TaskPool() : m_bStopping(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// TaskPool destructor
+//-------------------------------------------------------------------
+
+TaskPool::~TaskPool()
+{
+    Stop();
+}
+
+
+//-------------------------------------------------------------------
+// Start
+//
+// Starts the threads. If a thread cannot be created, the pool keeps
+// the ones that started.
+//-------------------------------------------------------------------
+
+bool TaskPool::Start(uint32_t cThreads)
+{
+    m_bStopping = false;
+
+    try
+    {
+        for (uint32_t i = 0; i < cThreads; i++)
+        {
+            m_threads.push_back(std::thread(&TaskPool::WorkerThread, this));
+        }
+    }
+    catch (std::system_error&)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Stop
+//
+// Waits for the threads to exit. Calls to Run must have returned.
+//-------------------------------------------------------------------
+
+void TaskPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+    }
+
+    m_cvWork.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i].join();
+    }
+
+    m_threads.clear();
+}
+
+
+//-------------------------------------------------------------------
+// Run
+//-------------------------------------------------------------------
+
+void TaskPool::Run(uint32_t cTasks, TaskProc proc, void *pContext)
+{
+    if (cTasks <= 1 || m_threads.empty())
+    {
+        for (uint32_t i = 0; i < cTasks; i++)
+        {
+            proc(pContext, i);
+        }
+        return;
+    }
+
+    Job job = { proc, pContext, cTasks, 0, 0 };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_jobs.push_back(&job);
+    m_cvWork.notify_all();
+
+    // Take tasks of our own job until none are left to start.
+    while (job.iNext < job.cTasks)
+    {
+        uint32_t i = job.iNext++;
+
+        if (job.iNext == job.cTasks)
+        {
+            RemoveJob(&job);
+        }
+
+        lock.unlock();
+        proc(pContext, i);
+        lock.lock();
+
+        ++job.cDone;
+    }
+
+    // Then wait for the ones that the pool's threads took.
+    while (job.cDone < job.cTasks)
+    {
+        m_cvDone.wait(lock);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// TaskCount
+//-------------------------------------------------------------------
+
+uint32_t TaskPool::TaskCount(const TaskPool *pPool, uint64_t cItems, uint64_t cMinItems)
+{
+    if (pPool == NULL || cMinItems == 0)
+    {
+        return 1;
+    }
+
+    uint64_t cTasks = cItems / cMinItems;
+
+    // A few tasks per thread even out tasks that take longer.
+    uint64_t cMaxTasks = 4 * (uint64_t)pPool->ThreadCount();
+
+    if (cTasks > cMaxTasks)
+    {
+        cTasks = cMaxTasks;
+    }
+
+    return (cTasks > 1) ? (uint32_t)cTasks : 1;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// WorkerThread
+//
+// Runs tasks from the oldest job until the pool stops.
+//-------------------------------------------------------------------
+
+void TaskPool::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (1)
+    {
+        while (!m_bStopping && m_jobs.empty())
+        {
+            m_cvWork.wait(lock);
+        }
+
+        if (m_bStopping)
+        {
+            break;
+        }
+
+        Job *pJob = m_jobs.front();
+        uint32_t i = pJob->iNext++;
+
+        if (pJob->iNext == pJob->cTasks)
+        {
+            m_jobs.pop_front();
+        }
+
+        lock.unlock();
+        pJob->proc(pJob->pContext, i);
+        lock.lock();
+
+        if (++pJob->cDone == pJob->cTasks)
+        {
+            m_cvDone.notify_all();
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// RemoveJob
+//
+// Removes a job whose last task has started. m_mutex is held.
+//-------------------------------------------------------------------
+
+void TaskPool::RemoveJob(Job *pJob)
+{
+    std::deque<Job*>::iterator it = std::find(m_jobs.begin(), m_jobs.end(), pJob);
+
+    if (it != m_jobs.end())
+    {
+        m_jobs.erase(it);
+    }
+}
@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// TaskPool: Threads that share the work of converting one frame.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// NOTE: Tiles
+//
+// The conversion and scaling kernels (yuvconvert.h, bandscale.h) take
+// an optional TaskPool. With one, they split their output into bands of
+// rows or columns that do not overlap, and run them as tasks on the
+// pool. Each task writes straight into the destination buffer, so there
+// are no extra copies or merges.
+//
+// Run blocks until every task of the call has finished, and the calling
+// thread runs tasks too, so a pool can be shared by any number of
+// threads (the daemon's workers, for example) without deadlock: when the
+// pool's threads are busy, each caller just does its own work. Tasks of
+// concurrent calls are run in the order the calls were made.
+//
+// Like the frame sources, this depends only on the C++ standard library.
+
+class TaskPool
+{
+public:
+    typedef void (*TaskProc)(void *pContext, uint32_t iTask);
+
+    TaskPool();
+    ~TaskPool();
+
+    // Starts cThreads threads, which work alongside the callers of Run.
+    bool        Start(uint32_t cThreads);
+    void        Stop();
+
+    // Threads that run tasks for one call: the pool's and the caller.
+    uint32_t    ThreadCount() const { return (uint32_t)m_threads.size() + 1; }
+
+    // Calls proc(pContext, i) for each i in [0, cTasks), and returns
+    // when all of them have returned.
+    void        Run(uint32_t cTasks, TaskProc proc, void *pContext);
+
+    // The number of tasks to split cItems items of work into, so that
+    // each task has at least cMinItems of them. pPool can be NULL.
+    static uint32_t TaskCount(const TaskPool *pPool, uint64_t cItems, uint64_t cMinItems);
+
+private:
+    struct Job;
+
+    std::vector<std::thread>    m_threads;
+    std::deque<Job*>            m_jobs;         // Jobs with tasks that have not started.
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cvWork;
+    std::condition_variable     m_cvDone;
+    bool                        m_bStopping;
+
+    void        WorkerThread();
+    void        RemoveJob(Job *pJob);
+};
@@ -0,0 +1,165 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Thumbnail library API (plain C ABI).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "thumbcontext.h"
+
+inline ThumbnailContext* ContextFromHandle(HVTCONTEXT hContext)
+{
+    return reinterpret_cast<ThumbnailContext*>(hContext);
+}
+
+
+//-------------------------------------------------------------------
+// VtCreateContext: Creates a thumbnail context.
+//-------------------------------------------------------------------
+
+VTAPI HRESULT WINAPI VtCreateContext(HVTCONTEXT *phContext)
+{
+    HRESULT hr = S_OK;
+
+    if (phContext == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *phContext = NULL;
+
+    ThumbnailContext *pContext = new (std::nothrow) ThumbnailContext();
+    if (pContext == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = pContext->Initialize();
+
+    if (SUCCEEDED(hr))
+    {
+        *phContext = reinterpret_cast<HVTCONTEXT>(pContext);
+    }
+    else
+    {
+        delete pContext;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// VtDestroyContext: Destroys a thumbnail context.
+//-------------------------------------------------------------------
+
+VTAPI void WINAPI VtDestroyContext(HVTCONTEXT hContext)
+{
+    delete ContextFromHandle(hContext);
+}
+
+
+//-------------------------------------------------------------------
+// VtGenerateFromFile: Creates thumbnails from a file or URL.
+//-------------------------------------------------------------------
+
+VTAPI HRESULT WINAPI VtGenerateFromFile(
+    HVTCONTEXT          hContext,
+    const WCHAR         *wszPath,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults
+    )
+{
+    if (hContext == NULL || wszPath == NULL || pOptions == NULL || pResults == NULL)
+    {
+        return E_POINTER;
+    }
+
+    return ContextFromHandle(hContext)->GenerateFromFile(wszPath, *pOptions, pAllocator, pResults);
+}
+
+
+//-------------------------------------------------------------------
+// VtGenerateFromMemory: Creates thumbnails from a buffer in memory.
+//-------------------------------------------------------------------
+
+VTAPI HRESULT WINAPI VtGenerateFromMemory(
+    HVTCONTEXT          hContext,
+    const BYTE          *pData,
+    UINT32              cbData,
+    const WCHAR         *wszTypeHint,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults
+    )
+{
+    HRESULT hr = S_OK;
+
+    CachedByteStream *pStream = NULL;
+
+    if (hContext == NULL || pData == NULL || pOptions == NULL || pResults == NULL)
+    {
+        return E_POINTER;
+    }
+
+    // Read the caller's buffer in place, without a copy.
+
+    hr = CachedByteStream::CreateForMemory(pData, cbData, wszTypeHint, &pStream);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ContextFromHandle(hContext)->GenerateFromByteStream(pStream, *pOptions, pAllocator, pResults);
+
+        // The source stays open until the next request. Closing the
+        // stream keeps it from reading the buffer after we return.
+        pStream->Close();
+    }
+
+    SafeRelease(&pStream);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// VtGenerateFromStream: Creates thumbnails from a COM stream.
+//-------------------------------------------------------------------
+
+VTAPI HRESULT WINAPI VtGenerateFromStream(
+    HVTCONTEXT          hContext,
+    IStream             *pStream,
+    const WCHAR         *wszTypeHint,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults
+    )
+{
+    if (hContext == NULL || pStream == NULL || pOptions == NULL || pResults == NULL)
+    {
+        return E_POINTER;
+    }
+
+    return ContextFromHandle(hContext)->GenerateFromStream(pStream, wszTypeHint, *pOptions, pAllocator, pResults);
+}
+
+
+//-------------------------------------------------------------------
+// VtFreeThumbnails: Frees the buffers returned by VtGenerate*.
+//-------------------------------------------------------------------
+
+VTAPI void WINAPI VtFreeThumbnails(
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults,
+    UINT32              count
+    )
+{
+    if (pResults)
+    {
+        ThumbnailContext::FreeThumbnails(pAllocator, pResults, count);
+    }
+}
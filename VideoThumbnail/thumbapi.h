@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Thumbnail library API (plain C ABI).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// NOTE: Usage
+//
+// The caller initializes COM on the calling thread before creating a
+// context. A context is bound to the thread that created it; create one
+// context per worker thread. Each call opens the source, decodes the
+// requested frames and returns the encoded images in memory. Nothing is
+// written to disk.
+//
+//     HVTCONTEXT hContext = NULL;
+//     VT_OPTIONS opts = { 4, NULL, 160, 160, VT_FORMAT_JPEG, 0.0f };
+//     VT_THUMBNAIL results[4];
+//
+//     hr = VtCreateContext(&hContext);
+//     hr = VtGenerateFromFile(hContext, L"clip.mp4", &opts, NULL, results);
+//     ...
+//     VtFreeThumbnails(NULL, results, 4);
+//     VtDestroyContext(hContext);
+
+#include <windows.h>
+#include <objidl.h>
+
+#ifdef VT_EXPORTS
+#define VTAPI __declspec(dllexport)
+#else
+#define VTAPI
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VT_CONTEXT *HVTCONTEXT;
+
+// Allocator used for the encoded image buffers. If the caller passes
+// NULL, the buffers are allocated with CoTaskMemAlloc.
+typedef void* (WINAPI *VT_ALLOC_FN)(void *pContext, SIZE_T cb);
+typedef void  (WINAPI *VT_FREE_FN)(void *pContext, void *pv);
+
+typedef struct VT_ALLOCATOR
+{
+    VT_ALLOC_FN     pfnAlloc;
+    VT_FREE_FN      pfnFree;
+    void            *pContext;
+} VT_ALLOCATOR;
+
+typedef enum VT_FORMAT
+{
+    VT_FORMAT_JPEG = 0,
+    VT_FORMAT_PNG  = 1,
+    VT_FORMAT_BGRA = 2      // Raw 32bpp BGRA pixels, top-down, stride = 4 * cxThumbnail.
+} VT_FORMAT;
+
+typedef struct VT_OPTIONS
+{
+    UINT32          cThumbnails;        // Number of thumbnails.
+    const LONGLONG  *phnsPositions;     // Seek positions (100-ns units), or NULL for evenly spaced positions.
+    UINT32          cxThumbnail;        // Output width, in pixels.
+    UINT32          cyThumbnail;        // Output height, in pixels.
+    VT_FORMAT       format;
+    float           quality;            // JPEG quality [0 ... 1]. Zero selects the encoder default.
+} VT_OPTIONS;
+
+typedef struct VT_THUMBNAIL
+{
+    BYTE            *pData;             // Image data, allocated with the caller's allocator.
+    UINT32          cbData;
+    LONGLONG        hnsTimestamp;       // Time stamp of the frame that was used.
+    HRESULT         hrStatus;           // Result for this thumbnail.
+} VT_THUMBNAIL;
+
+VTAPI HRESULT WINAPI VtCreateContext(HVTCONTEXT *phContext);
+
+VTAPI void    WINAPI VtDestroyContext(HVTCONTEXT hContext);
+
+VTAPI HRESULT WINAPI VtGenerateFromFile(
+    HVTCONTEXT          hContext,
+    const WCHAR         *wszPath,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults       // Array of pOptions->cThumbnails elements.
+    );
+
+// wszTypeHint is either a MIME type ("video/mp4") or a file name with an
+// extension ("upload.mov"). It helps Media Foundation pick the container
+// parser, and may be NULL. pData is read in place, not copied, and is not
+// used after the call returns.
+VTAPI HRESULT WINAPI VtGenerateFromMemory(
+    HVTCONTEXT          hContext,
+    const BYTE          *pData,
+    UINT32              cbData,
+    const WCHAR         *wszTypeHint,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults
+    );
+
+VTAPI HRESULT WINAPI VtGenerateFromStream(
+    HVTCONTEXT          hContext,
+    IStream             *pStream,
+    const WCHAR         *wszTypeHint,
+    const VT_OPTIONS    *pOptions,
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults
+    );
+
+// Frees the buffers in pResults. Pass the same allocator that was used
+// to generate them.
+VTAPI void    WINAPI VtFreeThumbnails(
+    const VT_ALLOCATOR  *pAllocator,
+    VT_THUMBNAIL        *pResults,
+    UINT32              count
+    );
+
+#ifdef __cplusplus
+}
+#endif
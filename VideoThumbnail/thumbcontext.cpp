@@ -0,0 +1,1591 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailContext: In-memory thumbnail generation (C++ library API).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "thumbcontext.h"
+#include "clock.h"
+
+#include <algorithm>
+
+static void* WINAPI DefaultAlloc(void * /*pContext*/, SIZE_T cb)
+{
+    return CoTaskMemAlloc(cb);
+}
+
+static void WINAPI DefaultFree(void * /*pContext*/, void *pv)
+{
+    CoTaskMemFree(pv);
+}
+
+static const VT_ALLOCATOR g_DefaultAllocator = { DefaultAlloc, DefaultFree, NULL };
+
+// The size of a job's thumbnails.
+static WICRect ThumbnailRect(const VT_OPTIONS& opts)
+{
+    WICRect rect = { 0, 0, (INT)opts.cxThumbnail, (INT)opts.cyThumbnail };
+    return rect;
+}
+
+// Clears a job's results, if it has any, so that the caller can free
+// them whatever the job's outcome.
+static void ClearResults(const VT_OPTIONS& opts, VT_THUMBNAIL pResults[])
+{
+    if (opts.cThumbnails > 0 && pResults != NULL)
+    {
+        ZeroMemory(pResults, sizeof(VT_THUMBNAIL) * opts.cThumbnails);
+    }
+}
+
+// The filter that scales a job's thumbnails.
+static WICBitmapInterpolationMode ScaleMode(const ThumbnailJob& job)
+{
+    return (job.degradations & DEGRADE_FAST_SCALE) ? WICBitmapInterpolationModeLinear : WICBitmapInterpolationModeFant;
+}
+
+// A pass in pipelined mode. The decode and process stages run on threads
+// of their own and the encode stage on the caller's. Queue items are
+// indexes into the planned frames; each stage handles every frame once,
+// in order, failed ones included, so the stages always finish together.
+struct ThumbnailContext::Pipeline
+{
+    ThumbnailContext            *pThis;
+    ThumbnailJob                *pJobs;
+    const DWORD                 *pFirstRequest;     // First requested position of each job.
+    const DWORD                 *pJobOf;            // Job of each requested position.
+    LONGLONG                    *pPlanned;
+    HRESULT                     *pFrameStatus;
+    Sprite                      *pSprites;
+    DWORD                       cFrames;
+
+    std::vector<std::vector<DWORD> >    requestsOf;     // Requested positions that each frame serves.
+    std::vector<IWICBitmap*>            thumbnails;     // Scaled image for each requested position.
+    std::vector<HRESULT>                thumbnailStatus;
+    std::vector<std::vector<BYTE> >     copies;         // Encoded images, for the result cache.
+
+    StageQueue                  decoded;            // Decode stage to process stage.
+    StageQueue                  processed;          // Process stage to encode stage.
+    StageCounters               counters[PIPELINE_STAGES];
+    Stopwatch                   watch;              // Started when the stages start.
+    double                      decodeDoneMs;
+    BOOL                        bAbort;             // The stages could not all be started.
+};
+
+// Returns S_OK if every thumbnail of a job succeeded, S_FALSE if only
+// some did, or the first error if none did.
+static HRESULT JobResult(const ThumbnailJob& job)
+{
+    DWORD   cSucceeded = 0;
+    HRESULT hrFirstError = S_OK;
+
+    for (DWORD i = 0; i < job.opts.cThumbnails; i++)
+    {
+        if (SUCCEEDED(job.pResults[i].hrStatus))
+        {
+            ++cSucceeded;
+        }
+        else if (SUCCEEDED(hrFirstError))
+        {
+            hrFirstError = job.pResults[i].hrStatus;
+        }
+    }
+
+    if (cSucceeded == job.opts.cThumbnails)
+    {
+        return S_OK;
+    }
+    return (cSucceeded > 0) ? S_FALSE : hrFirstError;
+}
+
+
+//-------------------------------------------------------------------
+// ThumbnailContext constructor
+//-------------------------------------------------------------------
+
+ThumbnailContext::ThumbnailContext()
+    : m_pD2DFactory(NULL),
+      m_pWICFactory(NULL),
+      m_pTargetBitmap(NULL),
+      m_pRT(NULL),
+      m_bMFStarted(FALSE),
+      m_pReaderCache(NULL),
+      m_pResultCache(NULL),
+      m_pIndexStore(NULL),
+      m_bCachedStreams(FALSE),
+      m_pSourceStream(NULL),
+      m_cPipelineDepth(0),
+      m_pControl(NULL),
+      m_degradations(DEGRADE_NONE),
+      m_bFieldDrop(FALSE),
+      m_cbFrameMemory(DEFAULT_FRAME_MEMORY)
+{
+    ZeroMemory(&m_sourceId, sizeof(m_sourceId));
+    ZeroMemory(&m_streamStart, sizeof(m_streamStart));
+}
+
+
+//-------------------------------------------------------------------
+// ThumbnailContext destructor
+//-------------------------------------------------------------------
+
+ThumbnailContext::~ThumbnailContext()
+{
+    SafeRelease(&m_pSourceStream);
+    SafeRelease(&m_pRT);
+    SafeRelease(&m_pTargetBitmap);
+    SafeRelease(&m_pWICFactory);
+    SafeRelease(&m_pD2DFactory);
+
+    if (m_bMFStarted)
+    {
+        MFShutdown();
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Starts Media Foundation and creates the drawing resources. COM must
+// already be initialized on the calling thread.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::Initialize()
+{
+    HRESULT hr = S_OK;
+
+    if (m_bMFStarted)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    hr = MFStartup(MF_VERSION);
+
+    if (SUCCEEDED(hr))
+    {
+        m_bMFStarted = TRUE;
+
+        // Multithreaded, for the stages of the pipelined mode.
+        hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &m_pD2DFactory);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            NULL,
+            CLSCTX_INPROC_SERVER,
+            IID_IWICImagingFactory,
+            (LPVOID*)&m_pWICFactory
+            );
+    }
+
+    // The render target is only used to create bitmaps, so a 1 x 1
+    // software target is enough. Software targets from the same factory
+    // can share bitmaps with the target that Sprite::Encode creates.
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pWICFactory->CreateBitmap(1, 1, GUID_WICPixelFormat32bppPBGRA,
+            WICBitmapCacheOnLoad, &m_pTargetBitmap);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        D2D1_RENDER_TARGET_PROPERTIES rtProps = D2D1::RenderTargetProperties();
+        rtProps.pixelFormat = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED);
+        rtProps.type = D2D1_RENDER_TARGET_TYPE_SOFTWARE;
+        rtProps.usage = D2D1_RENDER_TARGET_USAGE_GDI_COMPATIBLE;
+
+        hr = m_pD2DFactory->CreateWicBitmapRenderTarget(m_pTargetBitmap, &rtProps, &m_pRT);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// SetByteStreamOptions
+//-------------------------------------------------------------------
+
+void ThumbnailContext::SetByteStreamOptions(const ByteStreamOptions *pOptions)
+{
+    m_bCachedStreams = (pOptions != NULL);
+
+    if (pOptions)
+    {
+        m_streamOptions = *pOptions;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// SetPassControl
+//-------------------------------------------------------------------
+
+void ThumbnailContext::SetPassControl(PassControl *pControl)
+{
+    m_pControl = pControl;
+    m_generator.SetPassControl(pControl);
+}
+
+
+//-------------------------------------------------------------------
+// GenerateFromFile
+//
+// Creates thumbnails from a file or URL.
+//
+// wszPath:    Path or URL of the video.
+// opts:       Number, positions, size and format of the thumbnails.
+// pAllocator: Allocator for the encoded images, or NULL.
+// pResults:   Array of opts.cThumbnails elements that receives the
+//             encoded images.
+// pSink:      Optional. Receives each thumbnail as soon as it is ready.
+//
+// Returns S_OK if every thumbnail was created, S_FALSE if only some
+// were, or the first error if none were.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::GenerateFromFile(
+    const WCHAR *wszPath,
+    const VT_OPTIONS& opts,
+    const VT_ALLOCATOR *pAllocator,
+    VT_THUMBNAIL pResults[],
+    ThumbnailSink *pSink
+    )
+{
+    ThumbnailJob job = { opts, pAllocator, pResults, pSink, FALSE, NULL, 0 };
+    HRESULT hrJob = S_OK;
+
+    HRESULT hr = GenerateBatchFromFile(wszPath, 1, &job, &hrJob);
+
+    return SUCCEEDED(hr) ? hrJob : hr;
+}
+
+
+//-------------------------------------------------------------------
+// GenerateFromStream
+//
+// Creates thumbnails from a COM stream, such as a memory stream.
+//
+// wszTypeHint: MIME type or file name of the content, or NULL.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::GenerateFromStream(
+    IStream *pStream,
+    const WCHAR *wszTypeHint,
+    const VT_OPTIONS& opts,
+    const VT_ALLOCATOR *pAllocator,
+    VT_THUMBNAIL pResults[],
+    ThumbnailSink *pSink
+    )
+{
+    HRESULT hr = S_OK;
+
+    IMFByteStream *pByteStream = NULL;
+    IMFAttributes *pAttributes = NULL;
+
+    hr = MFCreateMFByteStreamOnStream(pStream, &pByteStream);
+
+    // Tell the source resolver what kind of content this is.
+
+    if (SUCCEEDED(hr) && wszTypeHint != NULL)
+    {
+        hr = pByteStream->QueryInterface(IID_PPV_ARGS(&pAttributes));
+
+        if (SUCCEEDED(hr))
+        {
+            if (wcschr(wszTypeHint, L'/') != NULL)
+            {
+                hr = pAttributes->SetString(MF_BYTESTREAM_CONTENT_TYPE, wszTypeHint);
+            }
+            else
+            {
+                hr = pAttributes->SetString(MF_BYTESTREAM_ORIGIN_NAME, wszTypeHint);
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = GenerateFromByteStream(pByteStream, opts, pAllocator, pResults, pSink);
+    }
+
+    SafeRelease(&pAttributes);
+    SafeRelease(&pByteStream);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GenerateFromByteStream
+//
+// Creates thumbnails from a Media Foundation byte stream.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::GenerateFromByteStream(
+    IMFByteStream *pByteStream,
+    const VT_OPTIONS& opts,
+    const VT_ALLOCATOR *pAllocator,
+    VT_THUMBNAIL pResults[],
+    ThumbnailSink *pSink
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (m_pRT == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    m_timings = StageTimings();
+
+    ClearResults(opts, pResults);
+
+    Stopwatch watch;
+
+    UINT32 cxTarget = (opts.cxThumbnail > opts.cyThumbnail) ? opts.cxThumbnail : opts.cyThumbnail;
+
+    m_generator.SetTargetSize(cxTarget, cxTarget);
+
+    hr = m_generator.OpenByteStream(pByteStream);
+
+    m_timings.openMs = watch.ElapsedMs();
+
+    if (SUCCEEDED(hr))
+    {
+        hr = Generate(opts, pAllocator, pResults, pSink);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GenerateBatchFromFile
+//
+// Creates thumbnails for several callers from one file, with a single
+// open and a single decode pass. Positions from all jobs are merged, so
+// a frame that more than one job needs is decoded once and then scaled
+// and encoded separately for each job.
+//
+// phrJobs:    Receives the result of each job (S_OK, S_FALSE or an
+//             error, as for GenerateFromFile).
+//
+// With a result cache, jobs whose results are cached are answered
+// without decoding, and the file is not opened at all if every job is.
+//
+// Returns an error only if the file could not be opened or processed
+// at all; the per-job results are in phrJobs.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::GenerateBatchFromFile(
+    const WCHAR *wszPath,
+    DWORD cJobs,
+    ThumbnailJob jobs[],
+    HRESULT phrJobs[]
+    )
+{
+    HRESULT hr = S_OK;
+
+    std::vector<ThumbnailJob>   missed;         // Jobs that need decoding.
+    std::vector<DWORD>          missedIndex;
+    std::vector<ResultKey>      keys;
+    std::vector<ResultEntry>    entries;
+    std::vector<ResultEntry*>   entryOf;        // NULL for results that are not cached.
+    std::vector<HRESULT>        hrMissed;
+
+    SourceFingerprint fingerprint;
+    BOOL bUseCache = FALSE;
+
+    if (m_pRT == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    m_timings = StageTimings();
+
+    Stopwatch watch;
+
+    if (m_pResultCache)
+    {
+        bUseCache = SUCCEEDED(ResultCache::ComputeFingerprint(wszPath, &fingerprint));
+    }
+
+    keys.resize(cJobs);
+    entries.resize(cJobs);
+
+    for (DWORD j = 0; j < cJobs; j++)
+    {
+        BOOL bCacheable = bUseCache && jobs[j].pResults != NULL &&
+            ResultCache::MakeKey(fingerprint, jobs[j].opts, m_bFieldDrop, m_cbFrameMemory, &keys[j]);
+
+        jobs[j].bFromCache = FALSE;
+        jobs[j].degradations = DEGRADE_NONE;
+
+        ClearResults(jobs[j].opts, jobs[j].pResults);
+
+        if (bCacheable && ReadCachedJob(keys[j], &jobs[j]) == S_OK)
+        {
+            phrJobs[j] = JobResult(jobs[j]);
+            jobs[j].bFromCache = TRUE;
+            ++m_timings.jobsFromCache;
+            continue;
+        }
+
+        missed.push_back(jobs[j]);
+        missedIndex.push_back(j);
+        entryOf.push_back(bCacheable ? &entries[j] : NULL);
+    }
+
+    if (missed.empty())
+    {
+        return S_OK;
+    }
+
+    // Frames can be decoded as small as the largest thumbnail allows.
+    // Thumbnails are cropped to a square, so both sides must be as big
+    // as the longer side of the thumbnail.
+    UINT32 cxTarget = 0;
+
+    for (size_t k = 0; k < missed.size(); k++)
+    {
+        const VT_OPTIONS& opts = missed[k].opts;
+        UINT32 cxLonger = (opts.cxThumbnail > opts.cyThumbnail) ? opts.cxThumbnail : opts.cyThumbnail;
+
+        if (cxLonger > cxTarget)
+        {
+            cxTarget = cxLonger;
+        }
+    }
+
+    m_generator.SetTargetSize(cxTarget, cxTarget);
+
+    hr = OpenSource(wszPath);
+
+    m_timings.openMs = watch.ElapsedMs();
+
+    if (SUCCEEDED(hr))
+    {
+        hrMissed.resize(missed.size());
+
+        hr = GenerateJobs((DWORD)missed.size(), &missed[0], &hrMissed[0], &entryOf[0]);
+
+        CloseSource(hr);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        for (size_t k = 0; k < missed.size(); k++)
+        {
+            phrJobs[missedIndex[k]] = hrMissed[k];
+            jobs[missedIndex[k]].degradations = missed[k].degradations;
+
+            // Only complete, full-quality results are cached. A failure
+            // to store is not an error for the caller.
+            if (hrMissed[k] == S_OK && entryOf[k] != NULL && missed[k].degradations == DEGRADE_NONE)
+            {
+                (void)m_pResultCache->Store(keys[missedIndex[k]], *entryOf[k]);
+            }
+        }
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Probe
+//
+// Opens a file and reads its duration, frame size and seekability
+// without decoding a frame. The target size is set as in
+// GenerateBatchFromFile, so a cached reader can be reused as it is. A
+// source without a duration is probed as zero length.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::Probe(const WCHAR *wszPath, const VT_OPTIONS& opts, BatchProbe *pProbe)
+{
+    HRESULT hr = S_OK;
+
+    LONGLONG hnsDuration = 0;
+    BOOL bCanSeek = FALSE;
+
+    if (pProbe == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pProbe = BatchProbe();
+
+    if (m_pRT == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    m_timings = StageTimings();
+
+    UINT32 cxTarget = (opts.cxThumbnail > opts.cyThumbnail) ? opts.cxThumbnail : opts.cyThumbnail;
+
+    m_generator.SetTargetSize(cxTarget, cxTarget);
+
+    hr = OpenSource(wszPath);
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_generator.CanSeek(&bCanSeek);
+
+    if (SUCCEEDED(hr) && FAILED(m_generator.GetDuration(&hnsDuration)))
+    {
+        hnsDuration = 0;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        const FormatInfo& format = m_generator.Format();
+
+        pProbe->bOk = true;
+        pProbe->hnsDuration = hnsDuration;
+        pProbe->width = format.imageWidthPels;
+        pProbe->height = format.imageHeightPels;
+        pProbe->bCanSeek = (bCanSeek != FALSE);
+    }
+
+    CloseSource(hr);
+
+    return hr;
+}
+
+
+//
+// Frees the encoded images in an array of results.
+//-------------------------------------------------------------------
+
+void ThumbnailContext::FreeThumbnails(const VT_ALLOCATOR *pAllocator, VT_THUMBNAIL pResults[], UINT32 count)
+{
+    if (pAllocator == NULL)
+    {
+        pAllocator = &g_DefaultAllocator;
+    }
+
+    for (UINT32 i = 0; i < count; i++)
+    {
+        if (pResults[i].pData)
+        {
+            pAllocator->pfnFree(pAllocator->pContext, pResults[i].pData);
+            pResults[i].pData = NULL;
+            pResults[i].cbData = 0;
+        }
+    }
+}
+
+
+//
+/// Private methods
+//
+
+//-------------------------------------------------------------------
+// Generate
+//
+// Decodes the requested frames from the open source and encodes them.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::Generate(
+    const VT_OPTIONS& opts,
+    const VT_ALLOCATOR *pAllocator,
+    VT_THUMBNAIL pResults[],
+    ThumbnailSink *pSink
+    )
+{
+    ThumbnailJob job = { opts, pAllocator, pResults, pSink, FALSE, NULL, 0 };
+    HRESULT hrJob = S_OK;
+
+    HRESULT hr = GenerateJobs(1, &job, &hrJob);
+
+    return SUCCEEDED(hr) ? hrJob : hr;
+}
+
+//-------------------------------------------------------------------
+// GenerateJobs
+//
+// Plans one decode pass for a set of jobs on the open source, decodes
+// it, and encodes the results for each job. With a pipeline depth, the
+// decoding, scaling and encoding overlap (see RunPipeline).
+//
+// ppEntries:  Optional. For each job, NULL or an entry that receives a
+//             copy of the encoded images, for the result cache. The
+//             copy is taken before the sink can take ownership.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::GenerateJobs(DWORD cJobs, ThumbnailJob jobs[], HRESULT phrJobs[], ResultEntry *ppEntries[])
+{
+    HRESULT hr = S_OK;
+
+    const DWORD cFramesAtStart = m_generator.FramesDecoded();
+    const DWORD cConvertedAtStart = m_generator.FramesConverted();
+    const DWORD cSnappedAtStart = m_generator.SnappedSeeks();
+    const DWORD cTimeoutsAtStart = m_generator.Timeouts();
+
+    m_generator.ResetMemoryStats();
+    m_generator.SetKeyframeSeek((m_degradations & DEGRADE_KEYFRAME_SEEK) != 0);
+
+    std::vector<LONGLONG>   requested;      // Positions of all jobs, in job order.
+    std::vector<DWORD>      firstRequest(cJobs);
+    std::vector<DWORD>      jobOf;          // Job of each requested position.
+    std::vector<DWORD>      frameOf;        // Index into planned for each requested position.
+    std::vector<DWORD>      order;
+    std::vector<LONGLONG>   planned;        // Decode positions; receive the actual time stamps.
+    std::vector<HRESULT>    frameStatus;
+
+    Sprite *pSprites = NULL;
+    BOOL bPipelined = FALSE;
+
+    Stopwatch watch;
+
+    // Collect the positions of every job.
+
+    for (DWORD j = 0; j < cJobs; j++)
+    {
+        const VT_OPTIONS& opts = jobs[j].opts;
+
+        firstRequest[j] = (DWORD)requested.size();
+
+        // Encoder effort does not apply to raw pixels.
+        jobs[j].degradations = m_degradations &
+            ((opts.format == VT_FORMAT_BGRA) ? ~(DWORD)DEGRADE_FAST_ENCODE : ~(DWORD)0);
+
+        ClearResults(opts, jobs[j].pResults);
+
+        if (opts.cThumbnails == 0 || jobs[j].pResults == NULL || opts.cxThumbnail == 0 || opts.cyThumbnail == 0)
+        {
+            phrJobs[j] = E_INVALIDARG;
+            continue;
+        }
+
+        if (opts.phnsPositions)
+        {
+            phrJobs[j] = S_OK;
+            requested.insert(requested.end(), opts.phnsPositions, opts.phnsPositions + opts.cThumbnails);
+        }
+        else
+        {
+            requested.resize(requested.size() + opts.cThumbnails);
+
+            phrJobs[j] = m_generator.GetThumbnailPositions(opts.cThumbnails, &requested[firstRequest[j]]);
+
+            if (FAILED(phrJobs[j]))
+            {
+                requested.resize(firstRequest[j]);
+            }
+        }
+
+        jobOf.resize(requested.size(), j);
+    }
+
+    if (requested.empty())
+    {
+        return S_OK;    // Every job failed; see phrJobs.
+    }
+
+    // Plan the pass: visit the positions in time order, so that the
+    // reader only seeks forward, and decode one frame for each group of
+    // positions that lie within SEEK_TOLERANCE of the first position in
+    // the group. Decoding at the last position of a group gives a frame
+    // that is within tolerance of every position in it.
+
+    order.resize(requested.size());
+    frameOf.resize(requested.size());
+
+    for (DWORD i = 0; i < (DWORD)order.size(); i++)
+    {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(),
+        [&requested](DWORD a, DWORD b) { return requested[a] < requested[b]; });
+
+    LONGLONG hnsGroupStart = 0;
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        LONGLONG hnsPos = requested[order[i]];
+
+        if (planned.empty() || hnsPos - hnsGroupStart >= SEEK_TOLERANCE)
+        {
+            hnsGroupStart = hnsPos;
+            planned.push_back(hnsPos);
+        }
+        else
+        {
+            planned.back() = hnsPos;
+        }
+
+        frameOf[order[i]] = (DWORD)planned.size() - 1;
+    }
+
+    frameStatus.resize(planned.size());
+
+    pSprites = new (std::nothrow) Sprite[planned.size()];
+
+    if (pSprites == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    if (m_cPipelineDepth > 0 && planned.size() > 1)
+    {
+        Pipeline pipeline;
+
+        pipeline.pThis = this;
+        pipeline.pJobs = jobs;
+        pipeline.pFirstRequest = &firstRequest[0];
+        pipeline.pJobOf = &jobOf[0];
+        pipeline.pPlanned = &planned[0];
+        pipeline.pFrameStatus = &frameStatus[0];
+        pipeline.pSprites = pSprites;
+        pipeline.cFrames = (DWORD)planned.size();
+        pipeline.decodeDoneMs = 0;
+        pipeline.bAbort = FALSE;
+
+        pipeline.requestsOf.resize(planned.size());
+
+        for (DWORD r = 0; r < (DWORD)requested.size(); r++)
+        {
+            pipeline.requestsOf[frameOf[r]].push_back(r);
+        }
+
+        pipeline.thumbnails.resize(requested.size(), NULL);
+        pipeline.thumbnailStatus.resize(requested.size(), S_OK);
+
+        if (ppEntries)
+        {
+            pipeline.copies.resize(requested.size());
+        }
+
+        // S_FALSE: the stage threads could not be started, so run the
+        // stages one after another below.
+        hr = RunPipeline(&pipeline);
+
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        if (hr == S_OK)
+        {
+            bPipelined = TRUE;
+
+            m_timings.pipelined = TRUE;
+            m_timings.pipelineMs = pipeline.watch.ElapsedMs();
+            m_timings.decodeMs = pipeline.decodeDoneMs;
+            m_timings.encodeMs = m_timings.pipelineMs - pipeline.decodeDoneMs;
+
+            for (DWORD s = 0; s < PIPELINE_STAGES; s++)
+            {
+                m_timings.stages[s] = pipeline.counters[s];
+            }
+
+            for (DWORD j = 0; j < cJobs; j++)
+            {
+                ResultEntry *pEntry = ppEntries ? ppEntries[j] : NULL;
+
+                if (FAILED(phrJobs[j]))
+                {
+                    continue;
+                }
+
+                // Fill in the result cache entry in job order, which the
+                // encode stage does not follow.
+                for (DWORD i = 0; i < jobs[j].opts.cThumbnails && pEntry; i++)
+                {
+                    const VT_THUMBNAIL& result = jobs[j].pResults[i];
+                    const std::vector<BYTE>& copy = pipeline.copies[firstRequest[j] + i];
+
+                    if (SUCCEEDED(result.hrStatus) && !copy.empty())
+                    {
+                        pEntry->Add(result.hnsTimestamp, &copy[0], (DWORD)copy.size());
+                    }
+                }
+
+                phrJobs[j] = JobResult(jobs[j]);
+            }
+        }
+
+        hr = S_OK;
+    }
+
+    if (!bPipelined)
+    {
+        // Per-frame results are reported in frameStatus.
+        for (DWORD k = 0; k < (DWORD)planned.size(); k++)
+        {
+            m_generator.CreateBitmapsAt(m_pRT, 1, &planned[k], &pSprites[k], &frameStatus[k]);
+
+            AtFrameBoundary();
+        }
+
+        m_timings.decodeMs = watch.ElapsedMs();
+    }
+
+    m_timings.positionsDecoded = (DWORD)planned.size();
+    m_timings.framesDecoded = m_generator.FramesDecoded() - cFramesAtStart;
+    m_timings.framesConverted = m_generator.FramesConverted() - cConvertedAtStart;
+    m_timings.positionsSnapped = m_generator.SnappedSeeks() - cSnappedAtStart;
+    m_timings.positionsTimedOut = m_generator.Timeouts() - cTimeoutsAtStart;
+    m_timings.cbFramePeak = m_generator.PeakFrameBytes();
+    m_timings.cbBitmaps = m_generator.BitmapBytes();
+
+    if (bPipelined)
+    {
+        goto done;      // The encode stage delivered the results.
+    }
+
+    watch.Restart();
+
+    // Fan out: scale and encode the shared frames for each job.
+
+    for (DWORD j = 0; j < cJobs; j++)
+    {
+        const ThumbnailJob& job = jobs[j];
+        ResultEntry *pEntry = ppEntries ? ppEntries[j] : NULL;
+
+        if (FAILED(phrJobs[j]))
+        {
+            continue;
+        }
+
+        for (DWORD i = 0; i < job.opts.cThumbnails; i++)
+        {
+            VT_THUMBNAIL *pResult = &job.pResults[i];
+            DWORD k = frameOf[firstRequest[j] + i];
+
+            IWICBitmapSource *pThumbnail = NULL;
+
+            pResult->hnsTimestamp = planned[k];
+            pResult->hrStatus = frameStatus[k];
+
+            if (SUCCEEDED(pResult->hrStatus) && IsCancelled(job))
+            {
+                pResult->hrStatus = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+
+            if (SUCCEEDED(pResult->hrStatus))
+            {
+                pResult->hrStatus = pSprites[k].CreateThumbnailSource(m_pWICFactory, m_pD2DFactory,
+                    ThumbnailRect(job.opts), &pThumbnail, ScaleMode(job));
+            }
+
+            DeliverThumbnail(job, i, pThumbnail, pEntry, NULL);
+
+            SafeRelease(&pThumbnail);
+
+            AtFrameBoundary();
+        }
+
+        phrJobs[j] = JobResult(job);
+    }
+
+    m_timings.encodeMs = watch.ElapsedMs();
+
+done:
+    delete [] pSprites;
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// RunPipeline
+//
+// Runs a pass as three stages: decode and process on threads of their
+// own, and encode on the calling thread. Returns S_FALSE, having done
+// nothing, if the stages cannot be started.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::RunPipeline(Pipeline *pPipeline)
+{
+    HRESULT hr = S_OK;
+
+    HANDLE hDecode = NULL;
+    HANDLE hProcess = NULL;
+
+    StageCounters *pCounters = &pPipeline->counters[PIPELINE_ENCODE];
+
+    if (FAILED(pPipeline->decoded.Initialize(m_cPipelineDepth)) ||
+        FAILED(pPipeline->processed.Initialize(m_cPipelineDepth)))
+    {
+        return S_FALSE;
+    }
+
+    // Start both threads suspended, so that neither runs unless both can.
+    hDecode = CreateThread(NULL, 0, DecodeStageProc, pPipeline, CREATE_SUSPENDED, NULL);
+    hProcess = CreateThread(NULL, 0, ProcessStageProc, pPipeline, CREATE_SUSPENDED, NULL);
+
+    if (hDecode == NULL || hProcess == NULL)
+    {
+        pPipeline->bAbort = TRUE;
+        hr = S_FALSE;
+    }
+
+    pPipeline->watch.Restart();
+
+    if (hDecode)
+    {
+        ResumeThread(hDecode);
+    }
+    if (hProcess)
+    {
+        ResumeThread(hProcess);
+    }
+
+    for (DWORD n = 0; n < pPipeline->cFrames && hr == S_OK; n++)
+    {
+        DWORD k = (DWORD)(ULONG_PTR)pPipeline->processed.Pop(pCounters);
+
+        Stopwatch busy;
+
+        const std::vector<DWORD>& requests = pPipeline->requestsOf[k];
+
+        for (size_t m = 0; m < requests.size(); m++)
+        {
+            DWORD r = requests[m];
+            DWORD j = pPipeline->pJobOf[r];
+            DWORD i = r - pPipeline->pFirstRequest[j];
+
+            const ThumbnailJob& job = pPipeline->pJobs[j];
+            VT_THUMBNAIL *pResult = &job.pResults[i];
+
+            pResult->hnsTimestamp = pPipeline->pPlanned[k];
+            pResult->hrStatus = pPipeline->pFrameStatus[k];
+
+            if (SUCCEEDED(pResult->hrStatus))
+            {
+                pResult->hrStatus = pPipeline->thumbnailStatus[r];
+            }
+
+            DeliverThumbnail(job, i, pPipeline->thumbnails[r], NULL,
+                pPipeline->copies.empty() ? NULL : &pPipeline->copies[r]);
+
+            SafeRelease(&pPipeline->thumbnails[r]);
+        }
+
+        pCounters->busyMs += busy.ElapsedMs();
+        pCounters->cItems++;
+
+        // The decode and process stages keep going, until the queues
+        // between them are full.
+        AtFrameBoundary();
+    }
+
+    if (hDecode)
+    {
+        WaitForSingleObject(hDecode, INFINITE);
+        CloseHandle(hDecode);
+    }
+    if (hProcess)
+    {
+        WaitForSingleObject(hProcess, INFINITE);
+        CloseHandle(hProcess);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// DecodeStageProc
+//
+// The decode stage of a pipelined pass: decodes each planned frame
+// into its sprite.
+//-------------------------------------------------------------------
+
+DWORD WINAPI ThumbnailContext::DecodeStageProc(LPVOID lpParameter)
+{
+    Pipeline *pPipeline = (Pipeline*)lpParameter;
+    ThumbnailContext *pThis = pPipeline->pThis;
+    StageCounters *pCounters = &pPipeline->counters[PIPELINE_DECODE];
+
+    if (pPipeline->bAbort)
+    {
+        return 0;
+    }
+
+    HRESULT hrCom = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    for (DWORD k = 0; k < pPipeline->cFrames; k++)
+    {
+        Stopwatch busy;
+
+        if (SUCCEEDED(hrCom))
+        {
+            pThis->m_generator.CreateBitmapsAt(pThis->m_pRT, 1, &pPipeline->pPlanned[k], &pPipeline->pSprites[k],
+                &pPipeline->pFrameStatus[k]);
+        }
+        else
+        {
+            pPipeline->pFrameStatus[k] = hrCom;
+        }
+
+        pCounters->busyMs += busy.ElapsedMs();
+        pCounters->cItems++;
+
+        pPipeline->decoded.Push((void*)(ULONG_PTR)k, pCounters);
+    }
+
+    pPipeline->decodeDoneMs = pPipeline->watch.ElapsedMs();
+
+    if (SUCCEEDED(hrCom))
+    {
+        CoUninitialize();
+    }
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// ProcessStageProc
+//
+// The process stage of a pipelined pass: scales each decoded frame to
+// the size of every thumbnail that uses it, and then releases it.
+//-------------------------------------------------------------------
+
+DWORD WINAPI ThumbnailContext::ProcessStageProc(LPVOID lpParameter)
+{
+    Pipeline *pPipeline = (Pipeline*)lpParameter;
+    ThumbnailContext *pThis = pPipeline->pThis;
+    StageCounters *pCounters = &pPipeline->counters[PIPELINE_PROCESS];
+
+    if (pPipeline->bAbort)
+    {
+        return 0;
+    }
+
+    HRESULT hrCom = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    for (DWORD n = 0; n < pPipeline->cFrames; n++)
+    {
+        DWORD k = (DWORD)(ULONG_PTR)pPipeline->decoded.Pop(pCounters);
+
+        Stopwatch busy;
+
+        const std::vector<DWORD>& requests = pPipeline->requestsOf[k];
+
+        for (size_t m = 0; m < requests.size(); m++)
+        {
+            DWORD r = requests[m];
+            const ThumbnailJob& job = pPipeline->pJobs[pPipeline->pJobOf[r]];
+
+            if (FAILED(hrCom))
+            {
+                pPipeline->thumbnailStatus[r] = hrCom;
+            }
+            else if (pThis->IsCancelled(job))
+            {
+                pPipeline->thumbnailStatus[r] = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+            else if (SUCCEEDED(pPipeline->pFrameStatus[k]))
+            {
+                pPipeline->thumbnailStatus[r] = pPipeline->pSprites[k].CreateThumbnail(pThis->m_pWICFactory,
+                    pThis->m_pD2DFactory, ThumbnailRect(job.opts), &pPipeline->thumbnails[r], ScaleMode(job));
+            }
+        }
+
+        // The full-size bitmap is no longer needed.
+        pPipeline->pSprites[k].Clear();
+
+        pCounters->busyMs += busy.ElapsedMs();
+        pCounters->cItems++;
+
+        pPipeline->processed.Push((void*)(ULONG_PTR)k, pCounters);
+    }
+
+    if (SUCCEEDED(hrCom))
+    {
+        CoUninitialize();
+    }
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// DeliverThumbnail
+//
+// Encodes thumbnail i of a job, unless its status is already a
+// failure, and passes it to the job's sink.
+//
+// pEntry:  Optional. Receives a copy of the encoded image.
+// pCopy:   Optional. Receives a copy of the encoded image, for an entry
+//          that is filled in later.
+//-------------------------------------------------------------------
+
+void ThumbnailContext::DeliverThumbnail(const ThumbnailJob& job, DWORD i, IWICBitmapSource *pThumbnail,
+    ResultEntry *pEntry, std::vector<BYTE> *pCopy)
+{
+    const VT_ALLOCATOR *pAllocator = job.pAllocator ? job.pAllocator : &g_DefaultAllocator;
+
+    VT_THUMBNAIL *pResult = &job.pResults[i];
+
+    if (SUCCEEDED(pResult->hrStatus) && IsCancelled(job))
+    {
+        pResult->hrStatus = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+
+    if (SUCCEEDED(pResult->hrStatus))
+    {
+        pResult->hrStatus = EncodeThumbnail(pThumbnail, job.opts, (job.degradations & DEGRADE_FAST_ENCODE) != 0,
+            pAllocator, pResult);
+    }
+
+    if (SUCCEEDED(pResult->hrStatus) && pEntry)
+    {
+        pEntry->Add(pResult->hnsTimestamp, pResult->pData, pResult->cbData);
+    }
+
+    if (SUCCEEDED(pResult->hrStatus) && pCopy)
+    {
+        pCopy->assign(pResult->pData, pResult->pData + pResult->cbData);
+    }
+
+    if (SUCCEEDED(pResult->hrStatus) && job.pSink)
+    {
+        pResult->hrStatus = job.pSink->OnThumbnail(i, pResult);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// IsCancelled
+//
+// True if a job's token, or the pass control, says to stop. Called from
+// any of the pass's threads.
+//-------------------------------------------------------------------
+
+BOOL ThumbnailContext::IsCancelled(const ThumbnailJob& job) const
+{
+    return (job.pCancel && job.pCancel->IsCancelled()) || (m_pControl && m_pControl->IsCancelled());
+}
+
+
+//-------------------------------------------------------------------
+// AtFrameBoundary
+//
+// Lets the pass control run other work between frames. Called on the
+// thread that started the pass.
+//-------------------------------------------------------------------
+
+void ThumbnailContext::AtFrameBoundary()
+{
+    if (m_pControl)
+    {
+        m_pControl->AtFrameBoundary(m_generator.GetTimeBudget());
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ReadCachedJob
+//
+// Fills in a job's results from the result cache and passes them to
+// its sink. Returns S_FALSE if the results are not cached.
+//
+// As with decoded results, each image is allocated and handed to the
+// sink before the next one is allocated.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::ReadCachedJob(const ResultKey& key, ThumbnailJob *pJob)
+{
+    const VT_ALLOCATOR *pAllocator = pJob->pAllocator ? pJob->pAllocator : &g_DefaultAllocator;
+
+    ResultEntry entry;
+
+    HRESULT hr = m_pResultCache->Lookup(key, pJob->opts.cThumbnails, &entry);
+
+    if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    ZeroMemory(pJob->pResults, sizeof(VT_THUMBNAIL) * pJob->opts.cThumbnails);
+
+    const BYTE *pData = entry.data.empty() ? NULL : &entry.data[0];
+
+    for (DWORD i = 0; i < pJob->opts.cThumbnails; i++)
+    {
+        VT_THUMBNAIL *pResult = &pJob->pResults[i];
+        DWORD cbData = entry.items[i].cbData;
+
+        pResult->hnsTimestamp = entry.items[i].hnsTimestamp;
+        pResult->pData = (BYTE*)pAllocator->pfnAlloc(pAllocator->pContext, cbData);
+        pResult->hrStatus = S_OK;
+
+        if (pResult->pData == NULL)
+        {
+            pResult->hrStatus = E_OUTOFMEMORY;
+        }
+        else
+        {
+            CopyMemory(pResult->pData, pData, cbData);
+            pResult->cbData = cbData;
+        }
+
+        if (SUCCEEDED(pResult->hrStatus) && pJob->pSink)
+        {
+            pResult->hrStatus = pJob->pSink->OnThumbnail(i, pResult);
+        }
+
+        pData += cbData;
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------
+// OpenSource
+//
+// Opens a file or URL, or takes a reader for it from the reader cache,
+// and loads the file's index from the index store.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::OpenSource(const WCHAR *wszPath)
+{
+    HRESULT hr = S_OK;
+
+    BOOL bLocalFile = (m_pReaderCache || m_pIndexStore || m_bCachedStreams) &&
+        ReaderCache::GetFileIdentity(wszPath, &m_sourceId);
+    BOOL bOpened = FALSE;
+
+    m_sourcePath.clear();
+    m_indexPath.clear();
+    SafeRelease(&m_pSourceStream);
+    ZeroMemory(&m_streamStart, sizeof(m_streamStart));
+
+    if (bLocalFile && m_pReaderCache)
+    {
+        ReaderState state;
+
+        if (m_pReaderCache->Checkout(wszPath, m_sourceId, &state))
+        {
+            hr = m_generator.AttachReader(&state);
+
+            if (SUCCEEDED(hr))
+            {
+                m_timings.readerReused = TRUE;
+                bOpened = TRUE;
+
+                // Only count what this request reads.
+                m_pSourceStream = state.pByteStream;
+                state.pByteStream = NULL;
+
+                if (m_pSourceStream)
+                {
+                    m_pSourceStream->GetStats(&m_streamStart);
+                }
+            }
+
+            ReaderCache::ReleaseState(&state);
+
+            // Otherwise fall back to a new reader.
+        }
+
+        // The identity was taken before the file is opened, so a reader
+        // is never cached under the identity of a newer file.
+        if (!bOpened)
+        {
+            hr = OpenReader(wszPath, bLocalFile);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            m_sourcePath = wszPath;
+        }
+    }
+    else
+    {
+        hr = OpenReader(wszPath, bLocalFile);
+    }
+
+    // Use what earlier runs learned about the file. The index is only
+    // an optimization, so failing to load it is not an error.
+
+    if (SUCCEEDED(hr) && bLocalFile && m_pIndexStore)
+    {
+        m_pIndexStore->Load(wszPath, m_sourceId, &m_index);
+
+        // The first time a file is indexed, read all of its keyframes
+        // from the container.
+        if (m_index.sampleTable == INDEX_SAMPLE_TABLE_UNKNOWN)
+        {
+            Stopwatch watch;
+
+            (void)m_index.AddSampleTable(wszPath);
+
+            m_timings.indexMs = watch.ElapsedMs();
+        }
+
+        if (SUCCEEDED(m_generator.SetIndex(&m_index)))
+        {
+            m_indexPath = wszPath;
+        }
+    }
+
+    return hr;
+}
+
+//-------------------------------------------------------------------
+// OpenReader
+//
+// Opens a new reader for a file or URL. If SetByteStreamOptions was
+// called, local files and HTTP(S) URLs are read through a
+// CachedByteStream. URLs on servers without range requests are left to
+// Media Foundation. YUV4MPEG2 files are read by a Y4mFrameSource, and,
+// with VT_ENABLE_LIBJPEG, Motion JPEG streams by an MjpegFrameSource
+// that decodes at the reduced size the thumbnails allow. Their readers
+// cannot be detached, so they are never cached.
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::OpenReader(const WCHAR *wszPath, BOOL bLocalFile)
+{
+    HRESULT hr = S_OK;
+
+    if (Y4mFrameSource::IsY4mPath(wszPath))
+    {
+        m_generator.Close();    // It might be using m_y4mSource.
+
+        m_y4mSource.SetCost(m_frameCost);
+
+        FRAME_STATUS status = m_y4mSource.Open(wszPath);
+
+        if (status != FRAME_OK)
+        {
+            return ThumbnailGenerator::FrameStatusToHResult(status, &m_y4mSource);
+        }
+
+        return m_generator.OpenFrameSource(&m_y4mSource);
+    }
+
+#ifdef VT_ENABLE_LIBJPEG
+    if (MjpegFrameSource::IsMjpegPath(wszPath))
+    {
+        UINT32 cxTarget = 0;
+        UINT32 cyTarget = 0;
+
+        m_generator.Close();    // It might be using m_mjpegSource.
+
+        m_generator.GetTargetSize(&cxTarget, &cyTarget);
+        m_mjpegSource.SetTargetSize(cxTarget, cyTarget);
+
+        FRAME_STATUS status = m_mjpegSource.Open(wszPath);
+
+        if (status != FRAME_OK)
+        {
+            return ThumbnailGenerator::FrameStatusToHResult(status, &m_mjpegSource);
+        }
+
+        return m_generator.OpenFrameSource(&m_mjpegSource);
+    }
+#endif
+
+    if (m_bCachedStreams && bLocalFile)
+    {
+        hr = CachedByteStream::CreateInstance(wszPath, m_streamOptions, &m_pSourceStream);
+    }
+    else if (m_bCachedStreams && HttpRangeSource::IsHttpUrl(wszPath))
+    {
+        hr = CachedByteStream::CreateForUrl(wszPath, m_streamOptions, &m_pSourceStream);
+
+        if (hr == HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED))
+        {
+            return m_generator.OpenFile(wszPath);
+        }
+    }
+    else
+    {
+        return m_generator.OpenFile(wszPath);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_generator.OpenByteStream(m_pSourceStream);
+    }
+
+    if (FAILED(hr))
+    {
+        SafeRelease(&m_pSourceStream);
+    }
+
+    return hr;
+}
+
+//-------------------------------------------------------------------
+// CloseSource
+//
+// Saves the file's index if decoding added to it, and returns the
+// reader to the reader cache, unless generation failed in a way that
+// could have left it in a bad state.
+//-------------------------------------------------------------------
+
+void ThumbnailContext::CloseSource(HRESULT hrGenerate)
+{
+    ReaderState state;
+
+    if (!m_indexPath.empty())
+    {
+        m_generator.SetIndex(NULL);
+
+        if (SUCCEEDED(hrGenerate) && m_index.bDirty)
+        {
+            (void)m_pIndexStore->Save(m_indexPath.c_str(), m_index);
+        }
+
+        m_indexPath.clear();
+    }
+
+    if (m_pSourceStream)
+    {
+        ByteStreamStats stats;
+        m_pSourceStream->GetStats(&stats);
+
+        m_timings.cbSourceFile = stats.cbFile;
+        m_timings.cbSourceRead = stats.cbRead - m_streamStart.cbRead;
+        m_timings.sourceReads = (DWORD)(stats.cReads - m_streamStart.cReads);
+    }
+
+    if (m_sourcePath.empty() || FAILED(hrGenerate))
+    {
+        SafeRelease(&m_pSourceStream);
+        return;
+    }
+
+    if (SUCCEEDED(m_generator.DetachReader(&state)))
+    {
+        state.pByteStream = m_pSourceStream;
+        m_pSourceStream = NULL;
+
+        m_pReaderCache->Checkin(m_sourcePath.c_str(), m_sourceId, &state);
+    }
+
+    SafeRelease(&m_pSourceStream);
+
+    m_sourcePath.clear();
+}
+
+//-------------------------------------------------------------------
+// EncodeThumbnail
+//
+// Encodes one thumbnail (see Sprite::CreateThumbnail) into a buffer
+// from the caller's allocator. For VT_FORMAT_BGRA the scaled pixels are
+// written straight into that buffer.
+//
+// bFastEncode:  Encode with less effort (see EncodeOptions::bFast).
+//-------------------------------------------------------------------
+
+HRESULT ThumbnailContext::EncodeThumbnail(
+    IWICBitmapSource *pThumbnail,
+    const VT_OPTIONS& opts,
+    BOOL bFastEncode,
+    const VT_ALLOCATOR *pAllocator,
+    VT_THUMBNAIL *pResult
+    )
+{
+    HRESULT hr = S_OK;
+
+    IStream *pStream = NULL;
+    HGLOBAL hGlobal = NULL;
+    BYTE    *pData = NULL;
+
+    STATSTG stat;
+    ZeroMemory(&stat, sizeof(stat));
+
+    WICRect destRect = ThumbnailRect(opts);
+
+    if (opts.format == VT_FORMAT_BGRA)
+    {
+        ULONGLONG cbImage = 4ULL * opts.cxThumbnail * opts.cyThumbnail;
+
+        if (cbImage > MAXDWORD)
+        {
+            return E_INVALIDARG;
+        }
+
+        pResult->pData = (BYTE*)pAllocator->pfnAlloc(pAllocator->pContext, (SIZE_T)cbImage);
+        if (pResult->pData == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        hr = pThumbnail->CopyPixels(&destRect, 4 * opts.cxThumbnail, (UINT)cbImage, pResult->pData);
+
+        if (SUCCEEDED(hr))
+        {
+            pResult->cbData = (UINT32)cbImage;
+        }
+        else
+        {
+            pAllocator->pfnFree(pAllocator->pContext, pResult->pData);
+            pResult->pData = NULL;
+        }
+        return hr;
+    }
+
+    EncodeOptions encodeOpts;
+    encodeOpts.containerFormat = (opts.format == VT_FORMAT_PNG) ? GUID_ContainerFormatPng : GUID_ContainerFormatJpeg;
+    encodeOpts.quality = opts.quality;
+    encodeOpts.bFast = bFastEncode;
+
+    hr = CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = Sprite::EncodeSource(pThumbnail, pStream, m_pWICFactory, destRect, encodeOpts);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pStream->Stat(&stat, STATFLAG_NONAME);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = GetHGlobalFromStream(pStream, &hGlobal);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pData = (BYTE*)GlobalLock(hGlobal);
+        if (pData == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pResult->pData = (BYTE*)pAllocator->pfnAlloc(pAllocator->pContext, stat.cbSize.LowPart);
+        if (pResult->pData == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        CopyMemory(pResult->pData, pData, stat.cbSize.LowPart);
+        pResult->cbData = stat.cbSize.LowPart;
+    }
+
+    if (pData)
+    {
+        GlobalUnlock(hGlobal);
+    }
+    SafeRelease(&pStream);
+    return hr;
+}
@@ -0,0 +1,309 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ThumbnailContext: In-memory thumbnail generation (C++ library API).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+#include "Thumbnail.h"
+#include "readercache.h"
+#include "resultcache.h"
+#include "videoindex.h"
+#include "bytestream.h"
+#include "y4msource.h"
+#include "mjpegsource.h"
+#include "thumbapi.h"
+#include "stagequeue.h"
+#include "batchplan.h"
+#include "loadshed.h"
+
+// Stages of the pipelined mode (see SetPipelineDepth).
+enum PIPELINE_STAGE
+{
+    PIPELINE_DECODE = 0,        // Seek, decode and convert to a bitmap.
+    PIPELINE_PROCESS,           // Crop, scale and rotate to each thumbnail size.
+    PIPELINE_ENCODE,            // Encode and hand to the caller.
+    PIPELINE_STAGES
+};
+
+// Time spent in each stage of the last Generate* call, in milliseconds,
+// and the amount of decoding that it took. In pipelined mode the stages
+// overlap: decodeMs is the time until the last frame was decoded,
+// encodeMs the rest, and stages[] says how each stage spent its time.
+struct StageTimings
+{
+    double  openMs;
+    double  decodeMs;
+    double  encodeMs;
+    double  indexMs;            // Reading the container's sample tables for the index.
+    DWORD   framesDecoded;      // Samples read from the decoder.
+    DWORD   framesConverted;    // Of those, samples converted to RGB32.
+    DWORD   positionsDecoded;   // Seek positions after merging requests.
+    DWORD   positionsSnapped;   // Seeks that went straight to a keyframe from the index.
+    DWORD   positionsTimedOut;  // Positions that ran out of time (see SetTimeBudget).
+    BOOL    readerReused;       // The source reader came from the reader cache.
+    DWORD   jobsFromCache;      // Jobs answered from the result cache.
+    ULONGLONG cbSourceFile;     // Size of the source, with SetByteStreamOptions.
+    ULONGLONG cbSourceRead;     // Bytes read from storage.
+    DWORD   sourceReads;        // Reads from storage (round trips).
+    ULONGLONG cbFramePeak;      // Most memory used to turn one frame into a bitmap.
+    ULONGLONG cbBitmaps;        // Bitmaps held until they were encoded.
+    BOOL    pipelined;          // The pass ran in pipelined mode.
+    double  pipelineMs;         // Wall time of the pipelined pass.
+    StageCounters stages[PIPELINE_STAGES];
+
+    StageTimings() : openMs(0), decodeMs(0), encodeMs(0), indexMs(0), framesDecoded(0), framesConverted(0), positionsDecoded(0), positionsSnapped(0), positionsTimedOut(0),
+        readerReused(FALSE), jobsFromCache(0), cbSourceFile(0), cbSourceRead(0), sourceReads(0), cbFramePeak(0), cbBitmaps(0),
+        pipelined(FALSE), pipelineMs(0)
+    {
+    }
+};
+
+// ThumbnailSink: Optional callback that receives each thumbnail as soon
+// as it is ready, before the next one is encoded. The sink can take
+// ownership of pResult->pData by setting it to NULL. If it fails, the
+// error becomes the thumbnail's status.
+
+class ThumbnailSink
+{
+public:
+    virtual HRESULT OnThumbnail(DWORD index, VT_THUMBNAIL *pResult) = 0;
+};
+
+// ThumbnailJob: One caller's thumbnails in a batch that shares a single
+// decode pass. Each job has its own positions, size, format, allocator,
+// sink and cancellation token. Once the token is cancelled, the job's
+// thumbnails that are not yet scaled or encoded fail with
+// HRESULT_FROM_WIN32(ERROR_CANCELLED); the pass goes on for the others.
+
+struct ThumbnailJob
+{
+    VT_OPTIONS          opts;
+    const VT_ALLOCATOR  *pAllocator;
+    VT_THUMBNAIL        *pResults;      // opts.cThumbnails elements.
+    ThumbnailSink       *pSink;         // Optional.
+    BOOL                bFromCache;     // Set if the results came from the result cache.
+    const CancelToken   *pCancel;       // Optional.
+    DWORD               degradations;   // Set to the DEGRADE_* flags applied to the results.
+};
+
+// A ThumbnailContext owns everything that is expensive to create: the
+// Direct2D and WIC factories, an off-screen render target and the
+// thumbnail generator. Keep a context alive across requests and use it
+// from one thread only.
+//
+// NOTE: Pipelined mode
+//
+// By default each pass decodes every frame, and then scales and encodes
+// the thumbnails, on the calling thread. With SetPipelineDepth, a pass
+// of more than one frame runs as three stages instead: decoding on one
+// thread, cropping and scaling (Sprite::CreateThumbnail) on another, and
+// encoding on the calling thread, which also calls the allocators and
+// sinks as before. The stages are joined by StageQueues of the given
+// depth, so the decoder works on the next frame while the last one is
+// scaled and encoded, and a pass takes about as long as its slowest
+// stage rather than the sum of all three. The queues also bound the
+// frames held at once; each frame's bitmap is released once it has been
+// scaled.
+//
+// Thumbnails reach the sinks in time order rather than in job order.
+// The Direct2D factory is created multithreaded, since the decode and
+// process stages both use it.
+//
+// NOTE: Pass control
+//
+// With SetPassControl, a pass calls PassControl::AtFrameBoundary on the
+// calling thread after each frame it decodes and each thumbnail it
+// encodes (see workqueue.h), and stops reading, scaling and encoding
+// once PassControl::IsCancelled returns true. The control can run
+// another pass from AtFrameBoundary, on another context: this context's
+// source stays open until it returns. The control pauses this context's
+// time budget meanwhile, so that time does not count against the file's
+// (see SetTimeBudget).
+//
+// NOTE: Degraded passes
+//
+// SetDegradations makes the passes that follow cheaper and less exact
+// (see loadshed.h): keyframe seeking in the generator, linear scaling
+// and lower encoder effort. Each job's degradations member records the
+// ones that were applied to it; encoder effort does not apply to
+// VT_FORMAT_BGRA, and results from the result cache have none. Degraded
+// results are not stored in the result cache, so that a later request
+// under less load gets full quality.
+
+class ThumbnailContext
+{
+    ID2D1Factory        *m_pD2DFactory;
+    IWICImagingFactory  *m_pWICFactory;
+    IWICBitmap          *m_pTargetBitmap;   // Backing store for m_pRT.
+    ID2D1RenderTarget   *m_pRT;             // Used to create the frame bitmaps.
+    BOOL                m_bMFStarted;
+
+    Y4mFrameSource      m_y4mSource;        // Used for .y4m files; outlives m_generator.
+    FrameSourceCost     m_frameCost;        // Simulated costs for m_y4mSource.
+#ifdef VT_ENABLE_LIBJPEG
+    MjpegFrameSource    m_mjpegSource;      // Used for .mjpeg files; outlives m_generator.
+#endif
+    ThumbnailGenerator  m_generator;
+    StageTimings        m_timings;
+
+    ReaderCache         *m_pReaderCache;    // Optional; shared with other contexts.
+    ResultCache         *m_pResultCache;    // Optional; shared with other contexts.
+    VideoIndexStore     *m_pIndexStore;     // Optional; shared with other contexts.
+    VideoIndex          m_index;            // Index of the open source, if any.
+    std::wstring        m_indexPath;        // Source that m_index belongs to.
+    std::wstring        m_sourcePath;       // Source to return to the cache, if any.
+    FileIdentity        m_sourceId;
+
+    ByteStreamOptions   m_streamOptions;
+    BOOL                m_bCachedStreams;   // Read local files through a CachedByteStream.
+    CachedByteStream    *m_pSourceStream;   // Stream of the open source, if any.
+    ByteStreamStats     m_streamStart;      // Its statistics when the source was opened.
+    DWORD               m_cPipelineDepth;   // 0 when the stages run one after another.
+    PassControl         *m_pControl;        // Optional; see SetPassControl.
+    DWORD               m_degradations;     // DEGRADE_* flags; see SetDegradations.
+    BOOL                m_bFieldDrop;       // See SetFieldDrop; part of the result cache key.
+    ULONGLONG           m_cbFrameMemory;    // See SetFrameMemoryBudget; part of the result cache key.
+
+public:
+
+    ThumbnailContext();
+    ~ThumbnailContext();
+
+    HRESULT     Initialize();
+
+    // Reuses open readers from pCache for local files. The cache must
+    // outlive the context.
+    void        SetReaderCache(ReaderCache *pCache) { m_pReaderCache = pCache; }
+
+    // Answers GenerateFromFile and GenerateBatchFromFile from pCache when
+    // it holds the results, and stores new results in it. The cache must
+    // outlive the context.
+    void        SetResultCache(ResultCache *pCache) { m_pResultCache = pCache; }
+
+    // Loads the index of each local file from pStore before decoding,
+    // and saves what was learned afterwards. The store must outlive the
+    // context.
+    void        SetIndexStore(VideoIndexStore *pStore) { m_pIndexStore = pStore; }
+
+    // Reads local files and HTTP(S) URLs through a CachedByteStream with
+    // these options, instead of letting the source open them. NULL turns
+    // this off.
+    void        SetByteStreamOptions(const ByteStreamOptions *pOptions);
+
+    // Simulated seek and decode costs for .y4m files (see framesource.h),
+    // for benchmarking the pipeline without a codec.
+    void        SetFrameSourceCost(const FrameSourceCost& cost) { m_frameCost = cost; }
+
+    // Deinterlaces by dropping a field as part of the downscale, instead
+    // of with the video processor (see mfsource.h). Set it the same way
+    // for every context that shares a reader cache. Results made with and
+    // without it are cached apart.
+    void        SetFieldDrop(BOOL bFieldDrop) { m_bFieldDrop = bFieldDrop; m_generator.SetFieldDrop(bFieldDrop); }
+
+    // Limits the memory used to turn each frame into a bitmap; larger
+    // frames are reduced in bands as they are converted (see Thumbnail.h).
+    // Results made with different budgets are cached apart.
+    void        SetFrameMemoryBudget(ULONGLONG cbBudget) { m_cbFrameMemory = cbBudget; m_generator.SetFrameMemoryBudget(cbBudget); }
+
+    // Converts each frame on the threads of pPool as well (see
+    // taskpool.h). The pool must outlive the context.
+    void        SetTaskPool(TaskPool *pPool) { m_generator.SetTaskPool(pPool); }
+
+    // Runs decoding, scaling and encoding as a pipeline, with up to
+    // cFrames frames queued between stages. Zero turns it off.
+    void        SetPipelineDepth(DWORD cFrames) { m_cPipelineDepth = cFrames; }
+
+    // Limits the time spent on each file and each position (see
+    // Thumbnail.h). Thumbnails that run out of time fail with
+    // HRESULT_FROM_WIN32(ERROR_TIMEOUT), and the job returns S_FALSE if
+    // others succeeded. The watchdog must outlive the context.
+    void        SetTimeBudget(Watchdog *pWatchdog, const TimeBudget& budget) { m_generator.SetTimeBudget(pWatchdog, budget); }
+
+    // Lets pControl cancel the passes that follow, or run other work at
+    // their frame boundaries (see the note above). NULL turns this off.
+    void        SetPassControl(PassControl *pControl);
+
+    // DEGRADE_* flags for the passes that follow (see the note above).
+    void        SetDegradations(DWORD degradations) { m_degradations = degradations; }
+
+    HRESULT     GenerateFromFile(
+                    const WCHAR *wszPath,
+                    const VT_OPTIONS& opts,
+                    const VT_ALLOCATOR *pAllocator,
+                    VT_THUMBNAIL pResults[],
+                    ThumbnailSink *pSink = NULL
+                    );
+
+    HRESULT     GenerateFromStream(
+                    IStream *pStream,
+                    const WCHAR *wszTypeHint,
+                    const VT_OPTIONS& opts,
+                    const VT_ALLOCATOR *pAllocator,
+                    VT_THUMBNAIL pResults[],
+                    ThumbnailSink *pSink = NULL
+                    );
+
+    HRESULT     GenerateFromByteStream(
+                    IMFByteStream *pByteStream,
+                    const VT_OPTIONS& opts,
+                    const VT_ALLOCATOR *pAllocator,
+                    VT_THUMBNAIL pResults[],
+                    ThumbnailSink *pSink = NULL
+                    );
+
+    HRESULT     GenerateBatchFromFile(
+                    const WCHAR *wszPath,
+                    DWORD cJobs,
+                    ThumbnailJob jobs[],
+                    HRESULT phrJobs[]
+                    );
+
+    // Opens a file the way GenerateFromFile would for opts, and reports
+    // what the batch planner needs to know about it (see batchplan.h).
+    // With a reader cache, the reader is kept for the GenerateFromFile
+    // call that follows.
+    HRESULT     Probe(const WCHAR *wszPath, const VT_OPTIONS& opts, BatchProbe *pProbe);
+
+    const StageTimings& LastTimings() const { return m_timings; }
+
+    static void FreeThumbnails(const VT_ALLOCATOR *pAllocator, VT_THUMBNAIL pResults[], UINT32 count);
+
+private:
+    struct Pipeline;
+
+    HRESULT     Generate(
+                    const VT_OPTIONS& opts,
+                    const VT_ALLOCATOR *pAllocator,
+                    VT_THUMBNAIL pResults[],
+                    ThumbnailSink *pSink
+                    );
+    HRESULT     GenerateJobs(DWORD cJobs, ThumbnailJob jobs[], HRESULT phrJobs[], ResultEntry *ppEntries[] = NULL);
+    HRESULT     ReadCachedJob(const ResultKey& key, ThumbnailJob *pJob);
+    HRESULT     OpenSource(const WCHAR *wszPath);
+    HRESULT     OpenReader(const WCHAR *wszPath, BOOL bLocalFile);
+    void        CloseSource(HRESULT hrGenerate);
+    HRESULT     RunPipeline(Pipeline *pPipeline);
+    BOOL        IsCancelled(const ThumbnailJob& job) const;
+    void        AtFrameBoundary();
+    void        DeliverThumbnail(const ThumbnailJob& job, DWORD i, IWICBitmapSource *pThumbnail, ResultEntry *pEntry,
+                    std::vector<BYTE> *pCopy);
+    HRESULT     EncodeThumbnail(
+                    IWICBitmapSource *pThumbnail,
+                    const VT_OPTIONS& opts,
+                    BOOL bFastEncode,
+                    const VT_ALLOCATOR *pAllocator,
+                    VT_THUMBNAIL *pResult
+                    );
+
+    static DWORD WINAPI DecodeStageProc(LPVOID lpParameter);
+    static DWORD WINAPI ProcessStageProc(LPVOID lpParameter);
+};
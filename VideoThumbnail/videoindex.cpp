@@ -0,0 +1,468 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// VideoIndex: Persistent per-video format and keyframe index.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "videoindex.h"
+#include "mp4index.h"
+#include "hash.h"
+
+#include <algorithm>
+
+const DWORD INDEX_FILE_MAGIC    = 0x58495456;   // 'VTIX'
+const DWORD INDEX_FILE_VERSION  = 2;
+const DWORD MAX_INDEX_KEYFRAMES = 1000000;
+
+const WCHAR INDEX_FILE_EXTENSION[] = L".vti";
+
+// File layout: INDEX_FILE_HEADER, then the path of the video (cchPath
+// WCHARs, no terminator), then cKeyframes LONGLONG time stamps.
+
+struct INDEX_FILE_HEADER
+{
+    DWORD       magic;
+    DWORD       version;
+    ULONGLONG   cbFile;
+    FILETIME    ftLastWrite;
+    LONGLONG    hnsDuration;
+    DWORD       bCanSeek;
+    DWORD       width;
+    DWORD       height;
+    DWORD       bTopDown;
+    RECT        rcPicture;
+    DWORD       rotation;
+    DWORD       sampleTable;        // INDEX_SAMPLE_TABLE
+    DWORD       cchPath;
+    DWORD       cKeyframes;
+};
+
+
+// Mp4FileSource: Reads a file for Mp4SampleIndex.
+
+class Mp4FileSource : public Mp4ByteSource
+{
+    HANDLE      m_hFile;
+    uint64_t    m_cbFile;
+
+public:
+    Mp4FileSource(HANDLE hFile, uint64_t cbFile) : m_hFile(hFile), m_cbFile(cbFile)
+    {
+    }
+
+    bool ReadAt(uint64_t offset, void *pBuffer, size_t cb)
+    {
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+
+        DWORD cbRead = 0;
+
+        return cb <= MAXDWORD && ReadFile(m_hFile, pBuffer, (DWORD)cb, &cbRead, &ov) && cbRead == cb;
+    }
+
+    uint64_t Size()
+    {
+        return m_cbFile;
+    }
+};
+
+
+//-------------------------------------------------------------------
+// VideoIndex constructor
+//-------------------------------------------------------------------
+
+VideoIndex::VideoIndex()
+    : bHaveProperties(FALSE),
+      hnsDuration(0),
+      bCanSeek(FALSE),
+      sampleTable(INDEX_SAMPLE_TABLE_UNKNOWN),
+      bDirty(FALSE)
+{
+    ZeroMemory(&id, sizeof(id));
+}
+
+//-------------------------------------------------------------------
+// Reset: Empties the index and assigns it to a version of a file.
+//-------------------------------------------------------------------
+
+void VideoIndex::Reset(const FileIdentity& fileId)
+{
+    id = fileId;
+    bHaveProperties = FALSE;
+    hnsDuration = 0;
+    bCanSeek = FALSE;
+    format = FormatInfo();
+    keyframes.clear();
+    sampleTable = INDEX_SAMPLE_TABLE_UNKNOWN;
+    bDirty = FALSE;
+}
+
+//-------------------------------------------------------------------
+// SetProperties
+//-------------------------------------------------------------------
+
+void VideoIndex::SetProperties(LONGLONG hnsDurationIn, BOOL bCanSeekIn, const FormatInfo& formatIn)
+{
+    if (bHaveProperties && hnsDuration == hnsDurationIn && bCanSeek == bCanSeekIn &&
+        format.imageWidthPels == formatIn.imageWidthPels &&
+        format.imageHeightPels == formatIn.imageHeightPels &&
+        format.bTopDown == formatIn.bTopDown &&
+        EqualRect(&format.rcPicture, &formatIn.rcPicture) &&
+        format.rotation == formatIn.rotation)
+    {
+        return;
+    }
+
+    hnsDuration = hnsDurationIn;
+    bCanSeek = bCanSeekIn;
+    format = formatIn;
+    bHaveProperties = TRUE;
+    bDirty = TRUE;
+}
+
+//-------------------------------------------------------------------
+// AddKeyframe: Records the time stamp of a sync sample.
+//-------------------------------------------------------------------
+
+void VideoIndex::AddKeyframe(LONGLONG hnsTime)
+{
+    std::vector<LONGLONG>::iterator it = std::lower_bound(keyframes.begin(), keyframes.end(), hnsTime);
+
+    if (it != keyframes.end() && *it == hnsTime)
+    {
+        return;
+    }
+
+    if (keyframes.size() < MAX_INDEX_KEYFRAMES)
+    {
+        keyframes.insert(it, hnsTime);
+        bDirty = TRUE;
+    }
+}
+
+//-------------------------------------------------------------------
+// FindKeyframe
+//
+// Finds the known keyframe closest to a position that a seek to the
+// position could use: no more than SEEK_TOLERANCE before it, and no
+// more than KEYFRAME_SNAP_RANGE after it. Returns FALSE if there is
+// none.
+//-------------------------------------------------------------------
+
+BOOL VideoIndex::FindKeyframe(LONGLONG hnsPos, LONGLONG *phnsKeyframe) const
+{
+    BOOL bFound = FALSE;
+    LONGLONG hnsBestDistance = 0;
+
+    std::vector<LONGLONG>::const_iterator it =
+        std::lower_bound(keyframes.begin(), keyframes.end(), hnsPos - SEEK_TOLERANCE + 1);
+
+    for (; it != keyframes.end() && *it <= hnsPos + KEYFRAME_SNAP_RANGE; ++it)
+    {
+        LONGLONG hnsDistance = (*it > hnsPos) ? (*it - hnsPos) : (hnsPos - *it);
+
+        if (!bFound || hnsDistance < hnsBestDistance)
+        {
+            *phnsKeyframe = *it;
+            hnsBestDistance = hnsDistance;
+            bFound = TRUE;
+        }
+    }
+
+    return bFound;
+}
+
+
+//-------------------------------------------------------------------
+// AddSampleTable
+//
+// Adds the sync samples of an MP4 or MOV file to the index, from the
+// container's sample tables. Returns S_FALSE if the file has none.
+//-------------------------------------------------------------------
+
+HRESULT VideoIndex::AddSampleTable(const WCHAR *wszPath)
+{
+    HRESULT hr = S_OK;
+
+    LARGE_INTEGER cbFile;
+    Mp4SampleIndex sampleIndex;
+
+    HANDLE hFile = CreateFile(wszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileSizeEx(hFile, &cbFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        Mp4FileSource source(hFile, (uint64_t)cbFile.QuadPart);
+
+        switch (sampleIndex.Build(&source))
+        {
+        case MP4_OK:
+            break;
+        case MP4_E_READ:
+            hr = E_FAIL;
+            break;
+        case MP4_E_OUT_OF_MEMORY:
+            hr = E_OUTOFMEMORY;
+            break;
+        default:
+            hr = S_FALSE;   // Not a file we can index.
+            break;
+        }
+    }
+
+    CloseHandle(hFile);
+
+    if (hr == S_OK)
+    {
+        for (size_t i = 0; i < sampleIndex.samples.size(); i++)
+        {
+            if (sampleIndex.samples[i].bSync)
+            {
+                AddKeyframe(sampleIndex.ToHns(sampleIndex.samples[i].pts));
+            }
+        }
+
+        sampleTable = INDEX_SAMPLE_TABLE_LOADED;
+        bDirty = TRUE;
+    }
+    else if (hr == S_FALSE)
+    {
+        sampleTable = INDEX_SAMPLE_TABLE_UNAVAILABLE;
+        bDirty = TRUE;
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Opens (or creates) the directory that holds the indexes.
+//-------------------------------------------------------------------
+
+HRESULT VideoIndexStore::Initialize(const WCHAR *wszDirectory)
+{
+    if (!CreateDirectory(wszDirectory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_directory = wszDirectory;
+
+    if (!m_directory.empty() && m_directory[m_directory.size() - 1] != L'\\')
+    {
+        m_directory += L'\\';
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Load
+//
+// Loads the index of a file. If there is no index for this version of
+// the file, pIndex is reset to an empty index and S_FALSE is returned.
+//-------------------------------------------------------------------
+
+HRESULT VideoIndexStore::Load(const WCHAR *wszPath, const FileIdentity& id, VideoIndex *pIndex)
+{
+    HRESULT hr = S_FALSE;
+
+    std::vector<BYTE> buffer;
+
+    LARGE_INTEGER cbIndex;
+    cbIndex.QuadPart = 0;
+
+    DWORD cbRead = 0;
+
+    pIndex->Reset(id);
+
+    HANDLE hFile = CreateFile(IndexPath(wszPath).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return S_FALSE;
+    }
+
+    if (!GetFileSizeEx(hFile, &cbIndex) || cbIndex.QuadPart < sizeof(INDEX_FILE_HEADER) || cbIndex.QuadPart > MAXDWORD)
+    {
+        goto done;
+    }
+
+    buffer.resize((size_t)cbIndex.QuadPart);
+
+    if (!ReadFile(hFile, &buffer[0], (DWORD)buffer.size(), &cbRead, NULL) || cbRead != buffer.size())
+    {
+        goto done;
+    }
+
+    {
+        const INDEX_FILE_HEADER *pHeader = (const INDEX_FILE_HEADER*)&buffer[0];
+        const WCHAR *pPath = (const WCHAR*)(pHeader + 1);
+
+        size_t cchPath = wcslen(wszPath);
+
+        if (pHeader->magic != INDEX_FILE_MAGIC || pHeader->version != INDEX_FILE_VERSION ||
+            pHeader->cKeyframes > MAX_INDEX_KEYFRAMES || pHeader->cchPath != cchPath ||
+            buffer.size() != sizeof(INDEX_FILE_HEADER) + cchPath * sizeof(WCHAR) + pHeader->cKeyframes * sizeof(LONGLONG))
+        {
+            goto done;
+        }
+
+        // The name of the index is a hash of the path, so check that
+        // the index is really for this file, and for this version of it.
+
+        if (_wcsnicmp(pPath, wszPath, cchPath) != 0 ||
+            pHeader->cbFile != id.cbFile ||
+            CompareFileTime(&pHeader->ftLastWrite, &id.ftLastWrite) != 0)
+        {
+            goto done;
+        }
+
+        const LONGLONG *pKeyframes = (const LONGLONG*)(pPath + cchPath);
+
+        pIndex->hnsDuration = pHeader->hnsDuration;
+        pIndex->bCanSeek = pHeader->bCanSeek;
+        pIndex->format.imageWidthPels = pHeader->width;
+        pIndex->format.imageHeightPels = pHeader->height;
+        pIndex->format.bTopDown = pHeader->bTopDown;
+        pIndex->format.rcPicture = pHeader->rcPicture;
+        pIndex->format.rotation = (MFVideoRotationFormat)pHeader->rotation;
+        pIndex->sampleTable = (INDEX_SAMPLE_TABLE)pHeader->sampleTable;
+        pIndex->bHaveProperties = TRUE;
+
+        pIndex->keyframes.assign(pKeyframes, pKeyframes + pHeader->cKeyframes);
+
+        hr = S_OK;
+    }
+
+done:
+    CloseHandle(hFile);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Save
+//
+// Writes the index of a file. The index is written under a temporary
+// name and then renamed, so that readers never see a partial index.
+//-------------------------------------------------------------------
+
+HRESULT VideoIndexStore::Save(const WCHAR *wszPath, const VideoIndex& index)
+{
+    HRESULT hr = S_OK;
+
+    std::wstring path = IndexPath(wszPath);
+
+    WCHAR wszSuffix[32];
+    StringCchPrintf(wszSuffix, ARRAYSIZE(wszSuffix), L".%u.tmp", GetCurrentThreadId());
+
+    std::wstring tempPath = path + wszSuffix;
+
+    if (!index.bHaveProperties)
+    {
+        return E_INVALIDARG;
+    }
+
+    INDEX_FILE_HEADER header;
+    ZeroMemory(&header, sizeof(header));
+
+    header.magic = INDEX_FILE_MAGIC;
+    header.version = INDEX_FILE_VERSION;
+    header.cbFile = index.id.cbFile;
+    header.ftLastWrite = index.id.ftLastWrite;
+    header.hnsDuration = index.hnsDuration;
+    header.bCanSeek = index.bCanSeek;
+    header.width = index.format.imageWidthPels;
+    header.height = index.format.imageHeightPels;
+    header.bTopDown = index.format.bTopDown;
+    header.rcPicture = index.format.rcPicture;
+    header.rotation = (DWORD)index.format.rotation;
+    header.sampleTable = (DWORD)index.sampleTable;
+    header.cchPath = (DWORD)wcslen(wszPath);
+    header.cKeyframes = (DWORD)index.keyframes.size();
+
+    std::vector<BYTE> buffer;
+
+    buffer.insert(buffer.end(), (const BYTE*)&header, (const BYTE*)(&header + 1));
+    buffer.insert(buffer.end(), (const BYTE*)wszPath, (const BYTE*)(wszPath + header.cchPath));
+
+    if (!index.keyframes.empty())
+    {
+        const BYTE *pKeyframes = (const BYTE*)&index.keyframes[0];
+        buffer.insert(buffer.end(), pKeyframes, pKeyframes + index.keyframes.size() * sizeof(LONGLONG));
+    }
+
+    DWORD cbWritten = 0;
+
+    HANDLE hFile = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!WriteFile(hFile, &buffer[0], (DWORD)buffer.size(), &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        if (!MoveFileEx(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        DeleteFile(tempPath.c_str());
+    }
+
+    return hr;
+}
+
+
+//
+/// Private methods
+//
+
+std::wstring VideoIndexStore::IndexPath(const WCHAR *wszPath) const
+{
+    // Paths are compared without regard to case.
+    std::wstring key(wszPath);
+    CharUpperBuff(&key[0], (DWORD)key.size());
+
+    WCHAR wszName[24];
+
+    StringCchPrintf(wszName, ARRAYSIZE(wszName), L"%016I64x",
+        Fnv1a(FNV_OFFSET_BASIS, key.c_str(), key.size() * sizeof(WCHAR)));
+
+    return m_directory + wszName + INDEX_FILE_EXTENSION;
+}
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// VideoIndex: Persistent per-video format and keyframe index.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "readercache.h"
+
+// NOTE: Keyframes
+//
+// Media Foundation sources seek to the sync sample at or before the
+// requested position, so the first frame after a seek is a keyframe.
+// The generator records the time stamps of those frames (and of any
+// sample flagged as a clean point) in the index.
+//
+// On later runs, a position that has a known keyframe within
+// KEYFRAME_SNAP_RANGE after it, or within SEEK_TOLERANCE before it, is
+// moved to that keyframe. Seeking exactly to a keyframe returns it as
+// the first frame, so the thumbnail costs a single decode instead of
+// decoding forward from an earlier keyframe.
+//
+// For MP4 and MOV files, AddSampleTable reads every sync sample from the
+// container's sample tables (see mp4index.h) the first time a file is
+// indexed, so that snapping works from the second run on, rather than
+// only for positions that were decoded before.
+//
+// Indexes are stored in a central directory, one file per video, and
+// are discarded when the video's size or last-write time changes.
+
+const LONGLONG KEYFRAME_SNAP_RANGE = 10000000;
+
+enum INDEX_SAMPLE_TABLE
+{
+    INDEX_SAMPLE_TABLE_UNKNOWN      = 0,    // Not read yet.
+    INDEX_SAMPLE_TABLE_LOADED       = 1,    // keyframes holds every sync sample.
+    INDEX_SAMPLE_TABLE_UNAVAILABLE  = 2     // Not an MP4/MOV file, or unreadable.
+};
+
+class VideoIndex
+{
+public:
+    FileIdentity            id;
+    BOOL                    bHaveProperties;    // hnsDuration, bCanSeek and format are valid.
+    LONGLONG                hnsDuration;
+    BOOL                    bCanSeek;
+    FormatInfo              format;             // Includes rotation and the aspect-corrected picture rect.
+    std::vector<LONGLONG>   keyframes;          // Sorted time stamps of sync samples.
+    INDEX_SAMPLE_TABLE      sampleTable;
+    BOOL                    bDirty;             // Changed since it was loaded.
+
+    VideoIndex();
+
+    void    Reset(const FileIdentity& fileId);
+    void    SetProperties(LONGLONG hnsDuration, BOOL bCanSeek, const FormatInfo& format);
+    void    AddKeyframe(LONGLONG hnsTime);
+    BOOL    FindKeyframe(LONGLONG hnsPos, LONGLONG *phnsKeyframe) const;
+    HRESULT AddSampleTable(const WCHAR *wszPath);
+};
+
+
+class VideoIndexStore
+{
+    std::wstring    m_directory;
+
+public:
+
+    HRESULT     Initialize(const WCHAR *wszDirectory);
+
+    HRESULT     Load(const WCHAR *wszPath, const FileIdentity& id, VideoIndex *pIndex);
+    HRESULT     Save(const WCHAR *wszPath, const VideoIndex& index);
+
+private:
+    std::wstring    IndexPath(const WCHAR *wszPath) const;
+};
@@ -0,0 +1,392 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Watchdog: Cancels frame reads that run past their deadline.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "watchdog.h"
+
+#include <system_error>
+
+
+//-------------------------------------------------------------------
+// Watchdog constructor
+//-------------------------------------------------------------------
+
+Watchdog::Watchdog() : m_nextTicket(1), m_cFired(0), m_bStopping(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Watchdog destructor
+//-------------------------------------------------------------------
+
+Watchdog::~Watchdog()
+{
+    Stop();
+}
+
+
+//-------------------------------------------------------------------
+// Start
+//-------------------------------------------------------------------
+
+bool Watchdog::Start()
+{
+    if (m_thread.joinable())
+    {
+        return true;
+    }
+
+    m_bStopping = false;
+
+    try
+    {
+        m_thread = std::thread(&Watchdog::WatchThread, this);
+    }
+    catch (std::system_error&)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Stop
+//
+// Stops the thread. Armed deadlines no longer fire.
+//-------------------------------------------------------------------
+
+void Watchdog::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+    }
+
+    m_cv.notify_all();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Arm
+//-------------------------------------------------------------------
+
+uint64_t Watchdog::Arm(FrameSource *pSource, Clock::time_point deadline)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint64_t ticket = m_nextTicket++;
+    Entry entry = { pSource, deadline, false };
+
+    m_entries[ticket] = entry;
+
+    // The new deadline might be the earliest.
+    m_cv.notify_all();
+
+    return ticket;
+}
+
+
+//-------------------------------------------------------------------
+// Disarm
+//-------------------------------------------------------------------
+
+bool Watchdog::Disarm(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(ticket);
+
+    if (it == m_entries.end())
+    {
+        return false;
+    }
+
+    bool bFired = it->second.bFired;
+
+    m_entries.erase(it);
+    return bFired;
+}
+
+
+//-------------------------------------------------------------------
+// Fired
+//
+// Number of reads cancelled so far.
+//-------------------------------------------------------------------
+
+uint64_t Watchdog::Fired()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cFired;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// WatchThread
+//
+// Sleeps until the earliest deadline that has not fired, and cancels
+// the sources whose deadlines have passed.
+//-------------------------------------------------------------------
+
+void Watchdog::WatchThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_bStopping)
+    {
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = Clock::time_point::max();
+
+        for (std::map<uint64_t, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            Entry& entry = it->second;
+
+            if (entry.bFired)
+            {
+                continue;
+            }
+
+            if (entry.deadline <= now)
+            {
+                entry.pSource->Cancel();
+                entry.bFired = true;
+                ++m_cFired;
+            }
+            else if (entry.deadline < next)
+            {
+                next = entry.deadline;
+            }
+        }
+
+        if (next == Clock::time_point::max())
+        {
+            m_cv.wait(lock);
+        }
+        else
+        {
+            m_cv.wait_until(lock, next);
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ReadBudget constructor
+//-------------------------------------------------------------------
+
+ReadBudget::ReadBudget()
+    : m_pWatchdog(NULL),
+      m_pSource(NULL),
+      m_ticket(0),
+      m_cPauses(0),
+      m_bArmed(false),
+      m_bFired(false),
+      m_bExpired(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+// Set
+//-------------------------------------------------------------------
+
+void ReadBudget::Set(Watchdog *pWatchdog, const TimeBudget& budget)
+{
+    m_pWatchdog = pWatchdog;
+    m_budget = budget;
+}
+
+
+//-------------------------------------------------------------------
+// StartFile
+//-------------------------------------------------------------------
+
+void ReadBudget::StartFile()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_fileStart = Now();
+    m_bExpired = false;
+}
+
+
+//-------------------------------------------------------------------
+// Begin
+//-------------------------------------------------------------------
+
+bool ReadBudget::Begin(FrameSource *pSource)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Clock::time_point now = Now();
+    Clock::time_point deadline = Clock::time_point::max();
+
+    if (m_bExpired)
+    {
+        return false;
+    }
+
+    if (m_budget.fileMs > 0)
+    {
+        deadline = m_fileStart + std::chrono::milliseconds(m_budget.fileMs);
+
+        if (deadline <= now)
+        {
+            m_bExpired = true;
+            return false;
+        }
+    }
+
+    if (m_budget.positionMs > 0)
+    {
+        Clock::time_point positionDeadline = now + std::chrono::milliseconds(m_budget.positionMs);
+
+        if (positionDeadline < deadline)
+        {
+            deadline = positionDeadline;
+        }
+    }
+
+    m_pSource = pSource;
+    m_deadline = deadline;
+    m_bFired = false;
+
+    // While paused, Resume arms it.
+    if (m_cPauses == 0)
+    {
+        Arm();
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// End
+//-------------------------------------------------------------------
+
+bool ReadBudget::End()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool bFired = m_bFired;
+
+    if (m_bArmed)
+    {
+        m_bArmed = false;
+        bFired = m_pWatchdog->Disarm(m_ticket);
+    }
+
+    m_pSource = NULL;
+    m_bFired = false;
+
+    if (bFired)
+    {
+        m_bExpired = true;
+    }
+
+    return bFired;
+}
+
+
+//-------------------------------------------------------------------
+// Pause
+//
+// Stops the clocks, and disarms the read in progress.
+//-------------------------------------------------------------------
+
+void ReadBudget::Pause()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_cPauses++ > 0)
+    {
+        return;
+    }
+
+    m_pausedAt = Clock::now();
+
+    if (m_bArmed)
+    {
+        m_bArmed = false;
+        m_bFired = m_pWatchdog->Disarm(m_ticket);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Resume
+//
+// Moves the deadlines on by the time spent paused, and re-arms the read
+// in progress.
+//-------------------------------------------------------------------
+
+void ReadBudget::Resume()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_cPauses == 0 || --m_cPauses > 0)
+    {
+        return;
+    }
+
+    Clock::duration paused = Clock::now() - m_pausedAt;
+
+    m_fileStart += paused;
+
+    if (m_deadline != Clock::time_point::max())
+    {
+        m_deadline += paused;
+    }
+
+    if (m_pSource && !m_bFired)
+    {
+        Arm();
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Expired
+//-------------------------------------------------------------------
+
+bool ReadBudget::Expired()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bExpired;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// Arm
+//
+// Arms the watchdog for the read in progress, if it has a deadline.
+//-------------------------------------------------------------------
+
+void ReadBudget::Arm()
+{
+    if (m_pWatchdog && m_pSource && m_deadline != Clock::time_point::max())
+    {
+        m_ticket = m_pWatchdog->Arm(m_pSource, m_deadline);
+        m_bArmed = true;
+    }
+}
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Watchdog: Cancels frame reads that run past their deadline.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "framesource.h"
+
+// NOTE: Time budgets
+//
+// A corrupt index, a seek that never lands or a decoder that stops
+// returning frames can block a read for as long as the source likes,
+// and the worker with it. A ReadBudget gives each file, and each
+// position in it, a time limit (TimeBudget):
+//
+//   - Before each position, Begin checks the file's limit, which counts
+//     from StartFile, and arms the Watchdog with whichever limit comes
+//     first.
+//   - If the read is still running at that time, the watchdog's thread
+//     calls FrameSource::Cancel, and the read fails with
+//     FRAME_E_CANCELLED.
+//   - End disarms the watchdog and says whether it fired.
+//
+// A cancelled source stays cancelled, so once a read has timed out, or
+// the file's time is up, Begin fails for the positions that are left.
+// The positions read before then keep their frames.
+//
+// Pause and Resume stop the file's clock, and the deadline of a read
+// in progress, while the worker does other work: a bulk pass that runs
+// preempting interactive passes at its frame boundaries (see
+// workqueue.h) is not charged for their time. A read that goes on
+// meanwhile, on a pipelined pass's decode thread, is not watched until
+// Resume, which re-arms it with the time it had left. Pauses nest.
+// Begin and End may run on another thread than Pause and Resume.
+//
+// One Watchdog thread serves any number of budgets. Cancel is called
+// with the watchdog's lock held, and Disarm takes the same lock, so
+// once End has returned the source can be closed.
+//
+// Like framesource.h, this depends only on the C++ standard library.
+
+struct TimeBudget
+{
+    uint32_t    fileMs;         // For all the positions of a file; 0 for no limit.
+    uint32_t    positionMs;     // For each position; 0 for no limit.
+
+    TimeBudget() : fileMs(0), positionMs(0)
+    {
+    }
+};
+
+
+class Watchdog
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        FrameSource         *pSource;
+        Clock::time_point   deadline;
+        bool                bFired;
+    };
+
+    std::thread                 m_thread;
+    std::map<uint64_t, Entry>   m_entries;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cv;
+    uint64_t                    m_nextTicket;
+    uint64_t                    m_cFired;
+    bool                        m_bStopping;
+
+public:
+
+    Watchdog();
+    ~Watchdog();
+
+    bool        Start();
+    void        Stop();
+
+    // Cancels pSource at the deadline unless Disarm is called first.
+    // Returns a ticket for Disarm.
+    uint64_t    Arm(FrameSource *pSource, Clock::time_point deadline);
+
+    // Returns true if the source was cancelled.
+    bool        Disarm(uint64_t ticket);
+
+    uint64_t    Fired();
+
+private:
+    void        WatchThread();
+};
+
+
+class ReadBudget
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Watchdog            *m_pWatchdog;       // Optional; without it, limits are only checked in Begin.
+    TimeBudget          m_budget;
+    std::mutex          m_mutex;            // Guards the members that follow.
+    Clock::time_point   m_fileStart;
+    Clock::time_point   m_deadline;         // Of the read in progress.
+    Clock::time_point   m_pausedAt;
+    FrameSource         *m_pSource;         // Being read; NULL between reads.
+    uint64_t            m_ticket;
+    uint32_t            m_cPauses;
+    bool                m_bArmed;
+    bool                m_bFired;           // The read was cancelled before a pause.
+    bool                m_bExpired;         // A read timed out, or the file's time is up.
+
+public:
+
+    ReadBudget();
+
+    void        Set(Watchdog *pWatchdog, const TimeBudget& budget);
+
+    // Starts the file's clock, when a source is opened.
+    void        StartFile();
+
+    // Before reading a position from pSource. Returns false if the
+    // position must not be read: the time is up.
+    bool        Begin(FrameSource *pSource);
+
+    // After the read. Returns true if it was cancelled for taking too
+    // long.
+    bool        End();
+
+    // Around work that is not the file's. Nothing times out in between.
+    void        Pause();
+    void        Resume();
+
+    bool        Expired();
+
+private:
+    Clock::time_point   Now() const { return (m_cPauses > 0) ? m_pausedAt : Clock::now(); }
+    void                Arm();
+};
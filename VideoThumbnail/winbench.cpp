@@ -0,0 +1,3296 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// winbench: Checks and times the Windows-only parts of the pipeline.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+// NOTE: winbench is the Windows counterpart of framebench. It is a
+// separate command-line program and is not part of VideoThumbnail.vcxproj.
+// It links with every file of the project except winmain.cpp. From a
+// Visual Studio command prompt:
+//
+//   cl /EHsc /W4 /WX /DUNICODE /D_UNICODE winbench.cpp asyncreader.cpp
+//      bandscale.cpp batch.cpp batchplan.cpp bytestream.cpp cpulevel.cpp
+//      daemon.cpp httpsource.cpp jpegdecode.cpp json.cpp loadshed.cpp
+//      mfsource.cpp mjpegsource.cpp mp4index.cpp rangecache.cpp
+//      readercache.cpp resultcache.cpp shmring.cpp sprite.cpp
+//      stagequeue.cpp taskpool.cpp thumbapi.cpp thumbcontext.cpp
+//      Thumbnail.cpp videoindex.cpp watchdog.cpp workqueue.cpp writer.cpp
+//      y4msource.cpp yuvconvert.cpp
+//      mfplat.lib mfreadwrite.lib mfuuid.lib propsys.lib shell32.lib
+//      d2d1.lib winmm.lib winhttp.lib ole32.lib ws2_32.lib
+//
+// Usage:
+//
+//   winbench [--count <n>] [--dir <directory>] --writer <files>
+//   winbench [--dir <directory>] --daemon <clients>
+//   winbench [--dir <directory>] --coalesce <requests>
+//   winbench [--dir <directory>] --preempt <positions>
+//   winbench --ring <frames>
+//   winbench --http <reads>
+//   winbench [--dir <directory>] --pipeline <thumbnails>
+//   winbench [--dir <directory>] --mfasync <positions>
+//
+// Each mode exits with a non-zero code if one of its checks fails.
+// Files are created in <directory>, or in a new folder in %TEMP% that is
+// removed at the end.
+//
+// --writer writes <files> small files (4 KB by default, or <n> KB) in
+// sets of MAX_SPRITES, the way the viewer saves a file's thumbnails. It writes
+// them once synchronously on the calling thread, once through an
+// AsyncFileWriter that is flushed after each set (as the viewer did),
+// and once through one that is flushed only at the end (as it does now).
+// It reports how long the calling thread was blocked in each case, and
+// fails unless every file was written with the right size.
+//
+// --daemon first checks the JSON reader and writer: a surrogate pair
+// becomes one UTF-8 character, a surrogate without its pair is
+// rejected, and NaN and infinity are written as null. It then starts a
+// ThumbnailDaemon with two workers on a private pipe and checks the
+// request protocol against a synthetic .y4m clip:
+//
+//   - "ping" succeeds, and a line that is not JSON, has an unpaired
+//     surrogate or names an unknown format gets an error response.
+//   - A request with "output" writes <output>_<i> files of the sizes
+//     that the response reports.
+//   - <clients> connections at once each queue three requests (JPEG and
+//     PNG, by count and by positions) before reading any response. Every
+//     request gets exactly one response, matched by id, with S_OK, the
+//     right number of thumbnails, inline data of the reported size and
+//     per-stage timings.
+//   - "stats" counts every request that was run.
+//
+// It reports the mean and longest "total_ms" of the concurrent requests.
+//
+// --coalesce starts a daemon with one worker and a simulated decoder
+// cost (20 ms per seek, 2 ms per frame, a keyframe every 30 frames). It
+// sends <requests> identical requests for one clip one at a time, then
+// sends a request for another clip followed by the same requests in a
+// burst, before reading any response. Every burst response must report
+// that its decode pass was shared ("coalesced" of 2 or more), and the
+// burst must decode fewer frames in fewer passes than the requests did
+// one at a time. It reports both, with the mean "total_ms".
+//
+// --preempt checks preemption in the daemon itself: the WorkQueue, the
+// DaemonPassControl of a worker and its time budget (see daemon.h). A
+// daemon with one worker and the --coalesce decoder cost first runs a
+// bulk request of <positions> evenly spaced positions (at least 8) and
+// an interactive one of one position, each alone. A second daemon, with
+// a file budget of one and a quarter times the bulk request's time,
+// then runs the bulk request again, while a second connection sends
+// interactive requests one after another for as long as the bulk
+// request took alone. Every interactive request must take less than
+// half of the bulk request's time alone, so none of them waited for
+// the bulk pass to end. The bulk request must take longer than its
+// budget, and still time out no position, because its budget is paused
+// while it is preempted. It reports the times of both classes.
+//
+// --ring creates a SharedFrameRing with four slots and opens it as a
+// producer through a second view of the mapping:
+//
+//   - After the header is overwritten with a geometry larger than the
+//     mapping, a new Open fails, and the producer that is already open
+//     keeps its own slot count and size: Publish rejects a slot or size
+//     outside them, and FindSlot only matches pointers into real slots.
+//   - A producer thread then publishes <frames> frames of different
+//     sizes and known contents. The consumer starts reading only after
+//     the producer has blocked on the full ring, so at most four frames
+//     are published before the first release. Every frame arrives once,
+//     in order, with its descriptor and data intact.
+//   - With every slot held, AcquireSlot times out.
+//
+// It reports the time per frame of the round trip.
+//
+// --http serves a 1 MB file from a server on a loopback port, which
+// logs the range of every request, and reads it with HttpRangeSource:
+//
+//   - Open finds the size and content type with one request.
+//   - <reads> reads of up to 64 KB at random offsets, and one that ends
+//     at the last byte, each return the right bytes through exactly one
+//     request for exactly their range.
+//   - A 206 response for other bytes, without Content-Range, for a file
+//     of unknown or other size, and a 200 response each fail the read,
+//     and the next read succeeds. The source counts every request that
+//     the server received.
+//   - With the server holding a request without a response, Cancel on
+//     another thread fails the read within two seconds, and later reads
+//     fail without a request. Closing a CachedByteStream for the URL
+//     does the same for a read that is blocked in the stream.
+//
+// It reports the time of the reads and how long each read took to fail
+// after the cancel.
+//
+// --pipeline writes a 30-second 640x360 .y4m clip and makes <thumbnails>
+// thumbnails of it for two jobs, PNG at 160x160 and JPEG at 320x180, in
+// one ThumbnailContext pass with a simulated decoder cost (20 ms per
+// seek, 2 ms per frame, a keyframe every 30 frames). It runs the pass
+// once serially and once with SetPipelineDepth(4). The second pass must
+// report that it was pipelined, with frames through every stage, give
+// the same bytes and time stamps for every thumbnail, and reach each
+// sink in time order. It reports both times and the share of the
+// pipelined pass that each stage was busy.
+//
+// --mfasync encodes a 10-second 640x360 H.264 .mp4 clip with a sink
+// writer. It reads <positions> evenly spaced positions from it, and then
+// the same ones backwards, first with MFFrameSource one at a time and
+// then with every read queued at once on an MFAsyncFrameReader. Each
+// queued read must complete exactly once, in the order it was queued,
+// with the time stamp and converted pixels of the synchronous read. A
+// read queued after Shutdown must be refused. It reports both times and
+// how long the calling thread spent queuing.
+
+#include "videothumbnail.h"
+#include "writer.h"
+#include "daemon.h"
+#include "shmring.h"
+#include "httpsource.h"
+#include "bytestream.h"
+#include "thumbcontext.h"
+#include "mfsource.h"
+#include "asyncreader.h"
+#include "json.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+const DWORD MAX_SPRITES = 6;            // As in winmain.cpp.
+const DWORD WRITER_THREADS = 2;
+const DWORD WRITER_MAX_IN_FLIGHT = 16;
+const DWORD DAEMON_WORKERS = 2;
+const DWORD REQUESTS_PER_CLIENT = 3;
+const char  HR_OK[] = "0x00000000";
+const DWORD COALESCE_MAX_REQUESTS = 16;  // MAX_COALESCED_REQUESTS in daemon.cpp.
+const UINT32 COALESCE_THUMBNAILS = 3;
+const DWORD PREEMPT_MIN_POSITIONS = 8;
+const DWORD PREEMPT_MAX_INTERACTIVE = 200;
+const UINT32 PREEMPT_FRAMES = 300;
+const DWORD RING_SLOTS = 4;
+const DWORD RING_SLOT_SIZE = 4096;   // A multiple of 64, so Create keeps it.
+const DWORD RING_TIMEOUT_MS = 5000;
+const ULONGLONG HTTP_FILE_SIZE = 1024 * 1024;
+const DWORD HTTP_MAX_READ = 64 * 1024;
+const DWORD HTTP_TIMEOUT_MS = 5000;
+const DWORD HTTP_CANCEL_LIMIT_MS = 2000;    // Well under the receive time limit.
+const DWORD PIPELINE_JOBS = 2;
+const DWORD PIPELINE_DEPTH = 4;
+const UINT32 PIPELINE_WIDTH = 640;
+const UINT32 PIPELINE_HEIGHT = 360;
+const UINT32 PIPELINE_FRAMES = 900;
+const UINT32 MFASYNC_WIDTH = 640;
+const UINT32 MFASYNC_HEIGHT = 360;
+const UINT32 MFASYNC_FRAMES = 300;
+
+
+//-------------------------------------------------------------------
+// Stopwatch: Measures elapsed time with QueryPerformanceCounter.
+//-------------------------------------------------------------------
+
+class Stopwatch
+{
+    LARGE_INTEGER   m_start;
+    LARGE_INTEGER   m_frequency;
+
+public:
+    Stopwatch()
+    {
+        QueryPerformanceFrequency(&m_frequency);
+        QueryPerformanceCounter(&m_start);
+    }
+
+    double ElapsedMs() const
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (double)(now.QuadPart - m_start.QuadPart) * 1000.0 / (double)m_frequency.QuadPart;
+    }
+};
+
+
+//-------------------------------------------------------------------
+// MakeFileName
+//
+// Returns <directory>\<prefix>_<i>.
+//-------------------------------------------------------------------
+
+static HRESULT MakeFileName(const WCHAR *wszDir, const WCHAR *wszPrefix, DWORD i, WCHAR *wszName, size_t cchName)
+{
+    return StringCchPrintf(wszName, cchName, L"%s\\%s_%u", wszDir, wszPrefix, (unsigned int)i);
+}
+
+
+//-------------------------------------------------------------------
+// CheckFiles
+//
+// Checks that <files> files with the prefix exist and have cbFile
+// bytes, and deletes them.
+//-------------------------------------------------------------------
+
+static int CheckFiles(const WCHAR *wszDir, const WCHAR *wszPrefix, DWORD cFiles, DWORD cbFile)
+{
+    int result = 0;
+    WCHAR wszName[MAX_PATH];
+
+    for (DWORD i = 0; i < cFiles; i++)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+
+        if (FAILED(MakeFileName(wszDir, wszPrefix, i, wszName, MAX_PATH)))
+        {
+            return 1;
+        }
+
+        if (!GetFileAttributesEx(wszName, GetFileExInfoStandard, &data))
+        {
+            if (result == 0)
+            {
+                fwprintf(stderr, L"--writer: %s is missing\n", wszName);
+            }
+            result = 1;
+            continue;
+        }
+
+        if (data.nFileSizeHigh != 0 || data.nFileSizeLow != cbFile)
+        {
+            if (result == 0)
+            {
+                fwprintf(stderr, L"--writer: %s has %u bytes, expected %u\n", wszName,
+                    (unsigned int)data.nFileSizeLow, (unsigned int)cbFile);
+            }
+            result = 1;
+        }
+
+        DeleteFile(wszName);
+    }
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// WriteSync
+//
+// Writes the files on the calling thread, as Sprite::Save did.
+//-------------------------------------------------------------------
+
+static HRESULT WriteSync(const WCHAR *wszDir, DWORD cFiles, const BYTE *pData, DWORD cbData)
+{
+    WCHAR wszName[MAX_PATH];
+
+    for (DWORD i = 0; i < cFiles; i++)
+    {
+        DWORD cbWritten = 0;
+
+        HRESULT hr = MakeFileName(wszDir, L"sync", i, wszName, MAX_PATH);
+        if (FAILED(hr)) { return hr; }
+
+        HANDLE hFile = CreateFile(wszName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        BOOL bOK = WriteFile(hFile, pData, cbData, &cbWritten, NULL);
+        if (!bOK)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        CloseHandle(hFile);
+
+        if (FAILED(hr)) { return hr; }
+    }
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// WriteAsync
+//
+// Queues the files on an AsyncFileWriter in sets of MAX_SPRITES. If
+// bFlushEachSet is TRUE, the calling thread waits for each set, as
+// OpenVideoFile did. pBlockedMs receives the time the calling thread
+// spent queueing and flushing, without the final flush; pTotalMs the
+// time until every file had been written.
+//-------------------------------------------------------------------
+
+static HRESULT WriteAsync(const WCHAR *wszDir, DWORD cFiles, const BYTE *pData, DWORD cbData,
+    BOOL bFlushEachSet, double *pBlockedMs, double *pTotalMs)
+{
+    HRESULT hr = S_OK;
+    WCHAR wszName[MAX_PATH];
+
+    AsyncFileWriter writer;
+
+    hr = writer.Initialize(WRITER_THREADS, WRITER_MAX_IN_FLIGHT, FALSE);
+    if (FAILED(hr)) { return hr; }
+
+    Stopwatch watch;
+
+    for (DWORD i = 0; i < cFiles && SUCCEEDED(hr); i++)
+    {
+        IStream *pStream = NULL;
+        ULONG cbWritten = 0;
+
+        hr = CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+
+        // Copying into the stream stands in for encoding the image.
+        if (SUCCEEDED(hr))
+        {
+            hr = pStream->Write(pData, cbData, &cbWritten);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = MakeFileName(wszDir, bFlushEachSet ? L"flush" : L"async", i, wszName, MAX_PATH);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = writer.Submit(wszName, pStream);
+        }
+
+        SafeRelease(&pStream);
+
+        if (SUCCEEDED(hr) && bFlushEachSet && ((i + 1) % MAX_SPRITES == 0 || i + 1 == cFiles))
+        {
+            hr = writer.Flush();
+        }
+    }
+
+    *pBlockedMs = watch.ElapsedMs();
+
+    HRESULT hrFlush = writer.Flush();
+    if (SUCCEEDED(hr))
+    {
+        hr = hrFlush;
+    }
+
+    *pTotalMs = watch.ElapsedMs();
+
+    if (SUCCEEDED(hr) && writer.FilesWritten() != (LONG)cFiles)
+    {
+        hr = E_FAIL;
+    }
+
+    writer.Shutdown();
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// RunWriterBenchmark
+//-------------------------------------------------------------------
+
+static int RunWriterBenchmark(const WCHAR *wszDir, DWORD cFiles, DWORD cbFile)
+{
+    int result = 0;
+    double syncMs = 0, flushBlockedMs = 0, flushTotalMs = 0, asyncBlockedMs = 0, asyncTotalMs = 0;
+
+    if (cFiles == 0 || cbFile == 0)
+    {
+        fwprintf(stderr, L"--writer: no files\n");
+        return 1;
+    }
+
+    std::vector<BYTE> data(cbFile);
+    for (DWORD i = 0; i < cbFile; i++)
+    {
+        data[i] = (BYTE)(i * 7);
+    }
+
+    Stopwatch watch;
+
+    HRESULT hr = WriteSync(wszDir, cFiles, &data[0], cbFile);
+    syncMs = watch.ElapsedMs();
+    result |= FAILED(hr) ? 1 : CheckFiles(wszDir, L"sync", cFiles, cbFile);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAsync(wszDir, cFiles, &data[0], cbFile, TRUE, &flushBlockedMs, &flushTotalMs);
+        result |= FAILED(hr) ? 1 : CheckFiles(wszDir, L"flush", cFiles, cbFile);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAsync(wszDir, cFiles, &data[0], cbFile, FALSE, &asyncBlockedMs, &asyncTotalMs);
+        result |= FAILED(hr) ? 1 : CheckFiles(wszDir, L"async", cFiles, cbFile);
+    }
+
+    if (FAILED(hr))
+    {
+        fwprintf(stderr, L"--writer: write failed (hr=0x%X)\n", (unsigned int)hr);
+        return 1;
+    }
+
+    wprintf(L"writer: %u files of %u bytes in %s\n", (unsigned int)cFiles, (unsigned int)cbFile, wszDir);
+    wprintf(L"  synchronous:          %8.1f ms blocked\n", syncMs);
+    wprintf(L"  async, flush per set: %8.1f ms blocked, %8.1f ms total\n", flushBlockedMs, flushTotalMs);
+    wprintf(L"  async, flush at end:  %8.1f ms blocked, %8.1f ms total\n", asyncBlockedMs, asyncTotalMs);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// WriteY4m
+//
+// Writes a synthetic 4:2:0 clip at 30 frames per second, in which no
+// two frames are alike.
+//-------------------------------------------------------------------
+
+static HRESULT WriteY4m(const WCHAR *wszPath, UINT32 width, UINT32 height, UINT32 cFrames)
+{
+    HRESULT hr = S_OK;
+    char header[64];
+    DWORD cbWritten = 0;
+
+    const size_t cbPicture = (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+    std::vector<BYTE> frame(6 + cbPicture);
+
+    HANDLE hFile = CreateFile(wszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    hr = StringCchPrintfA(header, ARRAYSIZE(header), "YUV4MPEG2 W%u H%u F30:1 Ip A1:1\n", width, height);
+
+    if (SUCCEEDED(hr) && !WriteFile(hFile, header, (DWORD)strlen(header), &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CopyMemory(&frame[0], "FRAME\n", 6);
+
+    for (UINT32 f = 0; f < cFrames && SUCCEEDED(hr); f++)
+    {
+        for (size_t i = 6; i < frame.size(); i++)
+        {
+            frame[i] = (BYTE)(i + f * 3);
+        }
+
+        if (!WriteFile(hFile, &frame[0], (DWORD)frame.size(), &cbWritten, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    CloseHandle(hFile);
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// PipeClient: One connection to the daemon's pipe.
+//-------------------------------------------------------------------
+
+class PipeClient
+{
+    HANDLE          m_hPipe;
+    std::string     m_pending;      // Received but not yet returned.
+
+public:
+    PipeClient() : m_hPipe(INVALID_HANDLE_VALUE)
+    {
+    }
+
+    ~PipeClient()
+    {
+        Close();
+    }
+
+    HRESULT Connect(const WCHAR *wszPipeName);
+    HRESULT Send(const std::string& line);
+    HRESULT Receive(JsonValue *pValue);
+    void    Close();
+};
+
+HRESULT PipeClient::Connect(const WCHAR *wszPipeName)
+{
+    // The server creates the next instance of the pipe only after a
+    // client has taken the previous one, so retry for a while.
+    for (int attempt = 0; attempt < 500; attempt++)
+    {
+        m_hPipe = CreateFile(wszPipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+        if (m_hPipe != INVALID_HANDLE_VALUE)
+        {
+            return S_OK;
+        }
+
+        DWORD err = GetLastError();
+
+        if (err == ERROR_PIPE_BUSY)
+        {
+            WaitNamedPipe(wszPipeName, 100);
+        }
+        else if (err == ERROR_FILE_NOT_FOUND)
+        {
+            Sleep(10);
+        }
+        else
+        {
+            return HRESULT_FROM_WIN32(err);
+        }
+    }
+    return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+}
+
+HRESULT PipeClient::Send(const std::string& line)
+{
+    std::string text(line);
+    text.push_back('\n');
+
+    DWORD cbWritten = 0;
+
+    if (!WriteFile(m_hPipe, text.data(), (DWORD)text.size(), &cbWritten, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    return S_OK;
+}
+
+// Waits for the next response line and parses it.
+HRESULT PipeClient::Receive(JsonValue *pValue)
+{
+    char buffer[4096];
+    size_t newline = 0;
+
+    while ((newline = m_pending.find('\n')) == std::string::npos)
+    {
+        DWORD cbRead = 0;
+
+        if (!ReadFile(m_hPipe, buffer, sizeof(buffer), &cbRead, NULL))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (cbRead == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE);
+        }
+        m_pending.append(buffer, cbRead);
+    }
+
+    size_t cch = newline;
+    if (cch > 0 && m_pending[cch - 1] == '\r')
+    {
+        --cch;
+    }
+
+    HRESULT hr = JsonParse(m_pending.data(), cch, pValue);
+
+    m_pending.erase(0, newline + 1);
+    return hr;
+}
+
+void PipeClient::Close()
+{
+    if (m_hPipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hPipe);
+        m_hPipe = INVALID_HANDLE_VALUE;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// DaemonServer: A ThumbnailDaemon serving a private pipe on a thread.
+//
+// The daemon's connection threads are detached and end when their
+// client disconnects, so a stopped server is not deleted under them.
+//-------------------------------------------------------------------
+
+struct DaemonServer
+{
+    ThumbnailDaemon     daemon;
+    WCHAR               wszPipeName[64];
+    HANDLE              hThread;
+
+    DaemonServer() : hThread(NULL)
+    {
+        wszPipeName[0] = 0;
+    }
+};
+
+static DWORD WINAPI PipeServerThreadProc(LPVOID lpParameter)
+{
+    DaemonServer *pServer = (DaemonServer*)lpParameter;
+
+    pServer->daemon.RunPipeServer(pServer->wszPipeName);
+    return 0;
+}
+
+static HRESULT StartServer(DaemonServer *pServer, DWORD cWorkers)
+{
+    static LONG cServers = 0;
+
+    HRESULT hr = StringCchPrintf(pServer->wszPipeName, ARRAYSIZE(pServer->wszPipeName), L"\\\\.\\pipe\\winbench_%u_%d",
+        (unsigned int)GetCurrentProcessId(), (int)InterlockedIncrement(&cServers));
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pServer->daemon.Start(cWorkers);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pServer->hThread = CreateThread(NULL, 0, PipeServerThreadProc, pServer, 0, NULL);
+
+        if (pServer->hThread == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    return hr;
+}
+
+// Call with every client closed.
+static void StopServer(DaemonServer *pServer)
+{
+    pServer->daemon.Stop();
+
+    if (pServer->hThread)
+    {
+        WaitForSingleObject(pServer->hThread, INFINITE);
+        CloseHandle(pServer->hThread);
+        pServer->hThread = NULL;
+    }
+
+    pServer->daemon.Shutdown();
+}
+
+
+//-------------------------------------------------------------------
+// Request and response helpers
+//-------------------------------------------------------------------
+
+// Builds a thumbnail request. With cPositions, the positions are 1, 4,
+// 7 ... seconds; otherwise the daemon picks count evenly spaced ones.
+// szPriority is the work class, or NULL for the default.
+static std::string MakeRequest(const std::string& id, const std::string& input, const char *szFormat,
+    UINT32 cThumbnails, BOOL bPositions, const WCHAR *wszOutput, const char *szPriority = NULL)
+{
+    JsonWriter writer;
+
+    writer.BeginObject();
+    writer.Key("id");
+    writer.String(id);
+    writer.Key("input");
+    writer.String(input);
+    writer.Key("format");
+    writer.String(szFormat);
+    writer.Key("width");
+    writer.Integer(64);
+    writer.Key("height");
+    writer.Integer(48);
+
+    if (bPositions)
+    {
+        writer.Key("positions");
+        writer.BeginArray();
+        for (UINT32 i = 0; i < cThumbnails; i++)
+        {
+            writer.Number(1.0 + 3.0 * i);
+        }
+        writer.EndArray();
+    }
+    else
+    {
+        writer.Key("count");
+        writer.Integer(cThumbnails);
+    }
+
+    if (wszOutput)
+    {
+        writer.Key("output");
+        writer.StringW(wszOutput);
+    }
+
+    if (szPriority)
+    {
+        writer.Key("priority");
+        writer.String(szPriority);
+    }
+
+    writer.EndObject();
+    return writer.Text();
+}
+
+// Checks a response to MakeRequest. Files are checked by the caller.
+static BOOL CheckResponse(const JsonValue& response, const std::string& id, UINT32 cThumbnails, BOOL bFiles)
+{
+    const JsonValue *pThumbnails = response.Find("thumbnails");
+    const JsonValue *pTimings = response.Find("timings");
+
+    if (response.GetString("id", "") != id || response.GetString("hr", "") != HR_OK)
+    {
+        fprintf(stderr, "--daemon: request %s: hr %s\n", id.c_str(), response.GetString("hr", "?").c_str());
+        return FALSE;
+    }
+
+    if (pThumbnails == NULL || pThumbnails->type != JsonValue::JSON_ARRAY || pThumbnails->items.size() != cThumbnails)
+    {
+        fprintf(stderr, "--daemon: request %s: expected %u thumbnails\n", id.c_str(), cThumbnails);
+        return FALSE;
+    }
+
+    if (pTimings == NULL || pTimings->Find("total_ms") == NULL || pTimings->Find("decode_ms") == NULL)
+    {
+        fprintf(stderr, "--daemon: request %s: no timings\n", id.c_str());
+        return FALSE;
+    }
+
+    for (UINT32 i = 0; i < cThumbnails; i++)
+    {
+        const JsonValue& thumb = pThumbnails->items[i];
+
+        size_t cbImage = (size_t)thumb.GetNumber("bytes", 0);
+        std::string data = thumb.GetString("data", "");
+
+        BOOL bOK = thumb.GetString("hr", "") == HR_OK && thumb.GetNumber("index", -1) == i && cbImage > 0;
+
+        if (bOK && !bFiles)
+        {
+            // Base64: four characters for every three bytes, padded.
+            bOK = (data.size() == 4 * ((cbImage + 2) / 3));
+        }
+
+        if (!bOK)
+        {
+            fprintf(stderr, "--daemon: request %s: thumbnail %u is wrong\n", id.c_str(), i);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+//-------------------------------------------------------------------
+// DaemonClientThreadProc
+//
+// Queues REQUESTS_PER_CLIENT requests on one connection, then reads
+// and checks the responses, which can arrive in any order.
+//-------------------------------------------------------------------
+
+struct DaemonClient
+{
+    const WCHAR         *wszPipeName;
+    std::string         input;
+    DWORD               index;
+    int                 result;
+    std::vector<double> totalMs;    // Of each response.
+};
+
+static DWORD WINAPI DaemonClientThreadProc(LPVOID lpParameter)
+{
+    DaemonClient *pClient = (DaemonClient*)lpParameter;
+
+    PipeClient pipe;
+    std::vector<std::string> ids;
+
+    pClient->result = 1;
+
+    if (FAILED(pipe.Connect(pClient->wszPipeName)))
+    {
+        fprintf(stderr, "--daemon: client %u cannot connect\n", (unsigned int)pClient->index);
+        return 0;
+    }
+
+    for (DWORD r = 0; r < REQUESTS_PER_CLIENT; r++)
+    {
+        char szId[32];
+
+        StringCchPrintfA(szId, ARRAYSIZE(szId), "%u-%u", (unsigned int)pClient->index, (unsigned int)r);
+        ids.push_back(szId);
+
+        std::string request = MakeRequest(szId, pClient->input, (r % 2) ? "png" : "jpeg", 2 + r, (r % 2) != 0, NULL);
+
+        if (FAILED(pipe.Send(request)))
+        {
+            return 0;
+        }
+    }
+
+    std::vector<bool> answered(REQUESTS_PER_CLIENT, false);
+
+    for (DWORD k = 0; k < REQUESTS_PER_CLIENT; k++)
+    {
+        JsonValue response;
+
+        if (FAILED(pipe.Receive(&response)))
+        {
+            fprintf(stderr, "--daemon: client %u: no response\n", (unsigned int)pClient->index);
+            return 0;
+        }
+
+        std::string id = response.GetString("id", "");
+        DWORD r = (DWORD)(std::find(ids.begin(), ids.end(), id) - ids.begin());
+
+        if (r == REQUESTS_PER_CLIENT || answered[r])
+        {
+            fprintf(stderr, "--daemon: client %u: unexpected response \"%s\"\n", (unsigned int)pClient->index, id.c_str());
+            return 0;
+        }
+
+        answered[r] = true;
+
+        if (!CheckResponse(response, id, 2 + r, FALSE))
+        {
+            return 0;
+        }
+
+        pClient->totalMs.push_back(response.Find("timings")->GetNumber("total_ms", 0));
+    }
+
+    pClient->result = 0;
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// RunDaemonTest
+//-------------------------------------------------------------------
+
+// Checks the escapes that JsonParse accepts and the numbers that
+// JsonWriter writes.
+static int CheckJson()
+{
+    const char *szPair = "\"\\ud83d\\ude00\"";       // U+1F600
+    const char *szUnpaired[] =
+    {
+        "\"\\ud83d\"",             // High surrogate at the end.
+        "\"\\ud83dx\"",            // Followed by a character.
+        "\"\\ud83d\\u0041\"",      // Followed by another escape.
+        "\"\\ud83d\\ud83d\"",      // Followed by a high surrogate.
+        "\"\\ude00\"",             // Low surrogate alone.
+    };
+    JsonValue value;
+    int result = 0;
+
+    if (FAILED(JsonParse(szPair, strlen(szPair), &value)) || value.str != "\xF0\x9F\x98\x80")
+    {
+        fprintf(stderr, "--daemon: a surrogate pair was not decoded\n");
+        result = 1;
+    }
+
+    for (size_t i = 0; i < ARRAYSIZE(szUnpaired); i++)
+    {
+        if (SUCCEEDED(JsonParse(szUnpaired[i], strlen(szUnpaired[i]), &value)))
+        {
+            fprintf(stderr, "--daemon: %s was accepted\n", szUnpaired[i]);
+            result = 1;
+        }
+    }
+
+    JsonWriter writer;
+
+    writer.BeginArray();
+    writer.Number(1.5);
+    writer.Number(std::numeric_limits<double>::quiet_NaN());
+    writer.Number(std::numeric_limits<double>::infinity());
+    writer.Number(-std::numeric_limits<double>::infinity());
+    writer.EndArray();
+
+    if (writer.Text() != "[1.500,null,null,null]")
+    {
+        fprintf(stderr, "--daemon: numbers written as %s\n", writer.Text().c_str());
+        result = 1;
+    }
+
+    if (FAILED(JsonParse(writer.Text().c_str(), writer.Text().size(), &value)))
+    {
+        fprintf(stderr, "--daemon: the writer's output does not parse\n");
+        result = 1;
+    }
+
+    return result;
+}
+
+static int RunDaemonTest(const WCHAR *wszDir, DWORD cClients)
+{
+    HRESULT hr = S_OK;
+    WCHAR wszClip[MAX_PATH];
+    WCHAR wszOutput[MAX_PATH];
+    JsonValue response;
+    PipeClient control;
+    int result = 0;
+
+    if (cClients == 0 || cClients > MAXIMUM_WAIT_OBJECTS)
+    {
+        fprintf(stderr, "--daemon: bad number of clients\n");
+        return 1;
+    }
+
+    result = CheckJson();
+
+    hr = StringCchPrintf(wszClip, MAX_PATH, L"%s\\clip.y4m", wszDir);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintf(wszOutput, MAX_PATH, L"%s\\out", wszDir);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteY4m(wszClip, 64, 48, 300);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--daemon: cannot write the clip (hr=0x%X)\n", (unsigned int)hr);
+        return 1;
+    }
+
+    std::string input = WideToUtf8(wszClip);
+
+    DaemonServer *pServer = new DaemonServer();
+
+    hr = StartServer(pServer, DAEMON_WORKERS);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = control.Connect(pServer->wszPipeName);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--daemon: cannot start the daemon (hr=0x%X)\n", (unsigned int)hr);
+        StopServer(pServer);
+        DeleteFile(wszClip);
+        return 1;
+    }
+
+    // Control commands and malformed requests are answered at once.
+
+    if (FAILED(control.Send("{ \"id\": \"p\", \"command\": \"ping\" }")) || FAILED(control.Receive(&response)) ||
+        response.GetString("id", "") != "p" || response.GetString("hr", "") != HR_OK)
+    {
+        fprintf(stderr, "--daemon: ping failed\n");
+        result = 1;
+    }
+
+    if (FAILED(control.Send("this is not json")) || FAILED(control.Receive(&response)) ||
+        response.GetString("hr", HR_OK) == HR_OK || response.Find("error") == NULL)
+    {
+        fprintf(stderr, "--daemon: a malformed line was not rejected\n");
+        result = 1;
+    }
+
+    if (FAILED(control.Send("{ \"id\": \"\\ud800\\u0041\", \"command\": \"ping\" }")) ||
+        FAILED(control.Receive(&response)) || response.GetString("hr", HR_OK) == HR_OK)
+    {
+        fprintf(stderr, "--daemon: an unpaired surrogate was not rejected\n");
+        result = 1;
+    }
+
+    if (FAILED(control.Send(MakeRequest("bad", input, "gif", 2, FALSE, NULL))) || FAILED(control.Receive(&response)) ||
+        response.GetString("id", "") != "bad" || response.GetString("hr", HR_OK) == HR_OK)
+    {
+        fprintf(stderr, "--daemon: an unknown format was not rejected\n");
+        result = 1;
+    }
+
+    // Output files.
+
+    if (FAILED(control.Send(MakeRequest("file", input, "jpeg", 3, FALSE, wszOutput))) ||
+        FAILED(control.Receive(&response)) || !CheckResponse(response, "file", 3, TRUE))
+    {
+        result = 1;
+    }
+    else
+    {
+        for (UINT32 i = 0; i < 3; i++)
+        {
+            WCHAR wszFile[MAX_PATH];
+            WIN32_FILE_ATTRIBUTE_DATA data;
+
+            StringCchPrintf(wszFile, MAX_PATH, L"%s_%u", wszOutput, i);
+
+            double cbImage = response.Find("thumbnails")->items[i].GetNumber("bytes", 0);
+
+            if (!GetFileAttributesEx(wszFile, GetFileExInfoStandard, &data) || (double)data.nFileSizeLow != cbImage)
+            {
+                fwprintf(stderr, L"--daemon: %s is missing or has the wrong size\n", wszFile);
+                result = 1;
+            }
+            DeleteFile(wszFile);
+        }
+    }
+
+    // Concurrent clients.
+
+    std::vector<DaemonClient> clients(cClients);
+    std::vector<HANDLE> threads;
+
+    for (DWORD c = 0; c < cClients; c++)
+    {
+        clients[c].wszPipeName = pServer->wszPipeName;
+        clients[c].input = input;
+        clients[c].index = c;
+        clients[c].result = 1;
+
+        HANDLE hThread = CreateThread(NULL, 0, DaemonClientThreadProc, &clients[c], 0, NULL);
+        if (hThread == NULL)
+        {
+            fprintf(stderr, "--daemon: cannot start client %u\n", (unsigned int)c);
+            result = 1;
+            break;
+        }
+        threads.push_back(hThread);
+    }
+
+    if (!threads.empty())
+    {
+        WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+    }
+
+    double sumMs = 0, maxMs = 0;
+    DWORD cResponses = 0;
+
+    for (size_t c = 0; c < threads.size(); c++)
+    {
+        CloseHandle(threads[c]);
+
+        result |= clients[c].result;
+
+        for (size_t k = 0; k < clients[c].totalMs.size(); k++)
+        {
+            sumMs += clients[c].totalMs[k];
+            maxMs = (clients[c].totalMs[k] > maxMs) ? clients[c].totalMs[k] : maxMs;
+            ++cResponses;
+        }
+    }
+
+    // Every request that was run is counted once.
+
+    const double cExpected = 1.0 + cClients * REQUESTS_PER_CLIENT;
+
+    if (FAILED(control.Send("{ \"command\": \"stats\" }")) || FAILED(control.Receive(&response)) ||
+        response.Find("stats") == NULL || response.Find("stats")->GetNumber("requests", 0) != cExpected)
+    {
+        fprintf(stderr, "--daemon: stats do not count %.0f requests\n", cExpected);
+        result = 1;
+    }
+
+    control.Close();
+    StopServer(pServer);
+    DeleteFile(wszClip);
+
+    printf("daemon: %u clients x %u requests on %u workers: %u responses, total_ms mean %.1f, max %.1f\n",
+        (unsigned int)cClients, (unsigned int)REQUESTS_PER_CLIENT, (unsigned int)DAEMON_WORKERS,
+        (unsigned int)cResponses, cResponses ? sumMs / cResponses : 0.0, maxMs);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunCoalesceTest
+//-------------------------------------------------------------------
+
+// Reads the daemon's counters.
+static BOOL GetDaemonStats(PipeClient *pClient, double *pRequests, double *pBatches, double *pFrames)
+{
+    JsonValue response;
+
+    if (FAILED(pClient->Send("{ \"command\": \"stats\" }")) || FAILED(pClient->Receive(&response)) ||
+        response.Find("stats") == NULL)
+    {
+        return FALSE;
+    }
+
+    const JsonValue *pStats = response.Find("stats");
+
+    *pRequests = pStats->GetNumber("requests", 0);
+    *pBatches = pStats->GetNumber("batches", 0);
+    *pFrames = pStats->GetNumber("frames_decoded", 0);
+    return TRUE;
+}
+
+static int RunCoalesceTest(const WCHAR *wszDir, DWORD cRequests)
+{
+    HRESULT hr = S_OK;
+    WCHAR wszClip[MAX_PATH];
+    WCHAR wszBlocker[MAX_PATH];
+    JsonValue response;
+    PipeClient client;
+    int result = 0;
+
+    if (cRequests < 2 || cRequests > COALESCE_MAX_REQUESTS)
+    {
+        fprintf(stderr, "--coalesce: the number of requests must be 2 to %u\n", (unsigned int)COALESCE_MAX_REQUESTS);
+        return 1;
+    }
+
+    hr = StringCchPrintf(wszClip, MAX_PATH, L"%s\\coalesce.y4m", wszDir);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintf(wszBlocker, MAX_PATH, L"%s\\blocker.y4m", wszDir);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteY4m(wszClip, 64, 48, 300);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteY4m(wszBlocker, 64, 48, 300);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--coalesce: cannot write the clips (hr=0x%X)\n", (unsigned int)hr);
+        DeleteFile(wszClip);
+        return 1;
+    }
+
+    std::string input = WideToUtf8(wszClip);
+    std::string blocker = WideToUtf8(wszBlocker);
+
+    // One worker, and a simulated decoder slow enough that the burst is
+    // queued while the worker is busy with the blocker.
+
+    FrameSourceCost cost;
+    cost.seekMicroseconds = 20000;
+    cost.decodeMicroseconds = 2000;
+    cost.gopLength = 30;
+
+    DaemonServer *pServer = new DaemonServer();
+
+    pServer->daemon.SetFrameSourceCost(cost);
+
+    hr = StartServer(pServer, 1);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = client.Connect(pServer->wszPipeName);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--coalesce: cannot start the daemon (hr=0x%X)\n", (unsigned int)hr);
+        StopServer(pServer);
+        DeleteFile(wszClip);
+        DeleteFile(wszBlocker);
+        return 1;
+    }
+
+    double requests0 = 0, batches0 = 0, frames0 = 0;
+    double requests1 = 0, batches1 = 0, frames1 = 0;
+    double requests2 = 0, batches2 = 0, frames2 = 0;
+    double sequentialMs = 0, burstMs = 0, blockerFrames = 0;
+    DWORD cCoalesced = 0;
+
+    // The same requests one at a time: nothing to coalesce with.
+
+    if (!GetDaemonStats(&client, &requests0, &batches0, &frames0))
+    {
+        result = 1;
+    }
+
+    for (DWORD i = 0; i < cRequests && result == 0; i++)
+    {
+        char szId[32];
+
+        StringCchPrintfA(szId, ARRAYSIZE(szId), "s%u", (unsigned int)i);
+        std::string id = szId;
+
+        if (FAILED(client.Send(MakeRequest(id, input, "jpeg", COALESCE_THUMBNAILS, TRUE, NULL))) ||
+            FAILED(client.Receive(&response)) || !CheckResponse(response, id, COALESCE_THUMBNAILS, FALSE))
+        {
+            result = 1;
+        }
+        else
+        {
+            sequentialMs += response.Find("timings")->GetNumber("total_ms", 0);
+        }
+    }
+
+    if (result == 0 && !GetDaemonStats(&client, &requests1, &batches1, &frames1))
+    {
+        result = 1;
+    }
+
+    // A request on another clip occupies the worker, then the burst
+    // arrives for one clip. Every request is sent before any response
+    // is read.
+
+    if (result == 0)
+    {
+        if (FAILED(client.Send(MakeRequest("blocker", blocker, "jpeg", 8, FALSE, NULL))))
+        {
+            result = 1;
+        }
+
+        for (DWORD i = 0; i < cRequests && result == 0; i++)
+        {
+            char szId[32];
+
+            StringCchPrintfA(szId, ARRAYSIZE(szId), "b%u", (unsigned int)i);
+
+            if (FAILED(client.Send(MakeRequest(szId, input, "jpeg", COALESCE_THUMBNAILS, TRUE, NULL))))
+            {
+                result = 1;
+            }
+        }
+    }
+
+    for (DWORD i = 0; i < cRequests + 1 && result == 0; i++)
+    {
+        if (FAILED(client.Receive(&response)))
+        {
+            fprintf(stderr, "--coalesce: no response\n");
+            result = 1;
+            break;
+        }
+
+        std::string id = response.GetString("id", "");
+        const JsonValue *pDecode = response.Find("decode");
+
+        if (id == "blocker")
+        {
+            if (!CheckResponse(response, id, 8, FALSE) || pDecode == NULL)
+            {
+                result = 1;
+            }
+            else
+            {
+                blockerFrames = pDecode->GetNumber("frames", 0);
+            }
+        }
+        else if (!CheckResponse(response, id, COALESCE_THUMBNAILS, FALSE) || pDecode == NULL)
+        {
+            result = 1;
+        }
+        else
+        {
+            DWORD cShared = (DWORD)pDecode->GetNumber("coalesced", 0);
+
+            if (cShared < 2)
+            {
+                fprintf(stderr, "--coalesce: request %s was decoded on its own\n", id.c_str());
+                result = 1;
+            }
+
+            cCoalesced = (cShared > cCoalesced) ? cShared : cCoalesced;
+            burstMs += response.Find("timings")->GetNumber("total_ms", 0);
+        }
+    }
+
+    if (result == 0 && !GetDaemonStats(&client, &requests2, &batches2, &frames2))
+    {
+        result = 1;
+    }
+
+    // The burst decodes fewer frames in fewer passes than the same
+    // requests one at a time.
+
+    double sequentialFrames = frames1 - frames0;
+    double burstFrames = frames2 - frames1 - blockerFrames;
+    double burstBatches = batches2 - batches1 - 1;
+
+    if (result == 0)
+    {
+        if (requests2 - requests1 != cRequests + 1.0)
+        {
+            fprintf(stderr, "--coalesce: stats count %.0f requests, expected %u\n",
+                requests2 - requests1, (unsigned int)(cRequests + 1));
+            result = 1;
+        }
+
+        if (burstFrames >= sequentialFrames || burstBatches >= cRequests)
+        {
+            fprintf(stderr, "--coalesce: the burst decoded %.0f frames in %.0f passes, one at a time %.0f in %.0f\n",
+                burstFrames, burstBatches, sequentialFrames, batches1 - batches0);
+            result = 1;
+        }
+    }
+
+    client.Close();
+    StopServer(pServer);
+    DeleteFile(wszClip);
+    DeleteFile(wszBlocker);
+
+    printf("coalesce: %u requests one at a time: %.0f passes, %.0f frames decoded, total_ms mean %.1f\n",
+        (unsigned int)cRequests, batches1 - batches0, sequentialFrames, sequentialMs / cRequests);
+    printf("coalesce: %u requests in a burst: %.0f passes, %.0f frames decoded, up to %u per pass, total_ms mean %.1f\n",
+        (unsigned int)cRequests, burstBatches, burstFrames, (unsigned int)cCoalesced, burstMs / cRequests);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// Preemption test
+//
+// A daemon with one worker runs a bulk request while interactive
+// requests arrive one after another on a second connection, so the
+// worker's DaemonPassControl takes them from the WorkQueue at the bulk
+// pass's frame boundaries.
+//-------------------------------------------------------------------
+
+// Runs a request alone and returns its "total_ms", or a negative value.
+static double TimeRequest(PipeClient *pClient, const std::string& id, const std::string& input, UINT32 cThumbnails,
+    const char *szPriority)
+{
+    JsonValue response;
+
+    if (FAILED(pClient->Send(MakeRequest(id, input, "jpeg", cThumbnails, FALSE, NULL, szPriority))) ||
+        FAILED(pClient->Receive(&response)) || !CheckResponse(response, id, cThumbnails, FALSE))
+    {
+        return -1;
+    }
+    return response.Find("timings")->GetNumber("total_ms", 0);
+}
+
+static int RunPreemptTest(const WCHAR *wszDir, DWORD cPositions)
+{
+    HRESULT hr = S_OK;
+    WCHAR wszBulk[MAX_PATH];
+    WCHAR wszInteractive[MAX_PATH];
+    int result = 0;
+
+    if (cPositions < PREEMPT_MIN_POSITIONS)
+    {
+        fprintf(stderr, "--preempt: at least %u positions\n", (unsigned int)PREEMPT_MIN_POSITIONS);
+        return 1;
+    }
+
+    hr = StringCchPrintf(wszBulk, MAX_PATH, L"%s\\bulk.y4m", wszDir);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintf(wszInteractive, MAX_PATH, L"%s\\interactive.y4m", wszDir);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteY4m(wszBulk, 64, 48, PREEMPT_FRAMES);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteY4m(wszInteractive, 64, 48, PREEMPT_FRAMES);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--preempt: cannot write the clips (hr=0x%X)\n", (unsigned int)hr);
+        DeleteFile(wszBulk);
+        return 1;
+    }
+
+    std::string bulk = WideToUtf8(wszBulk);
+    std::string interactive = WideToUtf8(wszInteractive);
+
+    FrameSourceCost cost;
+    cost.seekMicroseconds = 20000;
+    cost.decodeMicroseconds = 2000;
+    cost.gopLength = 30;
+
+    // Both requests alone, without a time budget.
+
+    double bulkAloneMs = -1;
+    double interactiveAloneMs = -1;
+
+    DaemonServer *pServer = new DaemonServer();
+    PipeClient client;
+
+    pServer->daemon.SetFrameSourceCost(cost);
+
+    hr = StartServer(pServer, 1);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = client.Connect(pServer->wszPipeName);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        bulkAloneMs = TimeRequest(&client, "bulk", bulk, cPositions, "bulk");
+        interactiveAloneMs = TimeRequest(&client, "interactive", interactive, 1, "interactive");
+    }
+
+    client.Close();
+    StopServer(pServer);
+
+    if (FAILED(hr) || bulkAloneMs < 0 || interactiveAloneMs < 0)
+    {
+        fprintf(stderr, "--preempt: cannot run the requests alone (hr=0x%X)\n", (unsigned int)hr);
+        DeleteFile(wszBulk);
+        DeleteFile(wszInteractive);
+        return 1;
+    }
+
+    // The bulk request again, with a file budget of one and a quarter
+    // times what it took alone, while interactive requests preempt it
+    // for about as long again. It only finishes in time if its budget is
+    // paused while they run.
+
+    TimeBudget budget;
+    budget.fileMs = (uint32_t)(bulkAloneMs * 1.25);
+
+    PipeClient bulkClient;
+    PipeClient interactiveClient;
+    JsonValue response;
+    double interactiveMaxMs = 0;
+    double interactiveTotalMs = 0;
+    double bulkMs = 0;
+    DWORD cTimedOut = 0;
+    DWORD cInteractive = 0;
+
+    pServer = new DaemonServer();
+
+    pServer->daemon.SetFrameSourceCost(cost);
+    pServer->daemon.SetTimeBudget(budget);
+
+    hr = StartServer(pServer, 1);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = bulkClient.Connect(pServer->wszPipeName);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = interactiveClient.Connect(pServer->wszPipeName);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = bulkClient.Send(MakeRequest("bulk", bulk, "jpeg", cPositions, FALSE, NULL, "bulk"));
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--preempt: cannot start the daemon (hr=0x%X)\n", (unsigned int)hr);
+        result = 1;
+    }
+
+    if (result == 0)
+    {
+        // Let the bulk pass start.
+        Sleep((DWORD)(bulkAloneMs / 10));
+
+        Stopwatch watch;
+
+        while (watch.ElapsedMs() < bulkAloneMs && cInteractive < PREEMPT_MAX_INTERACTIVE)
+        {
+            char szId[32];
+
+            StringCchPrintfA(szId, ARRAYSIZE(szId), "i%u", (unsigned int)cInteractive++);
+
+            double ms = TimeRequest(&interactiveClient, szId, interactive, 1, "interactive");
+
+            if (ms < 0)
+            {
+                result = 1;
+                break;
+            }
+
+            interactiveMaxMs = (ms > interactiveMaxMs) ? ms : interactiveMaxMs;
+            interactiveTotalMs += ms;
+        }
+    }
+
+    if (result == 0)
+    {
+        if (FAILED(bulkClient.Receive(&response)) || !CheckResponse(response, "bulk", cPositions, FALSE) ||
+            response.Find("decode") == NULL)
+        {
+            result = 1;
+        }
+        else
+        {
+            bulkMs = response.Find("timings")->GetNumber("total_ms", 0);
+            cTimedOut = (DWORD)response.Find("decode")->GetNumber("timed_out", 0);
+        }
+    }
+
+    bulkClient.Close();
+    interactiveClient.Close();
+    StopServer(pServer);
+    DeleteFile(wszBulk);
+    DeleteFile(wszInteractive);
+
+    if (result == 0)
+    {
+        printf("preempt: alone, bulk %u positions %.1f ms, interactive 1 position %.1f ms\n",
+            (unsigned int)cPositions, bulkAloneMs, interactiveAloneMs);
+        printf("preempt: under load, bulk %.1f ms with a %u ms budget, %u positions timed out; "
+            "%u interactive, mean %.1f ms, longest %.1f ms\n",
+            bulkMs, (unsigned int)budget.fileMs, (unsigned int)cTimedOut, (unsigned int)cInteractive,
+            cInteractive ? interactiveTotalMs / cInteractive : 0, interactiveMaxMs);
+
+        // An interactive request that waited for the bulk pass to end
+        // would take at least half of it.
+        if (interactiveMaxMs >= bulkAloneMs / 2)
+        {
+            fprintf(stderr, "--preempt: an interactive request took %.1f ms; it was not run at a frame boundary\n",
+                interactiveMaxMs);
+            result = 1;
+        }
+
+        if (bulkMs <= budget.fileMs)
+        {
+            fprintf(stderr, "--preempt: the bulk request took %.1f ms, within its budget; it was not preempted\n",
+                bulkMs);
+            result = 1;
+        }
+
+        if (cTimedOut != 0)
+        {
+            fprintf(stderr, "--preempt: %u bulk positions timed out; the budget ran while the pass was preempted\n",
+                (unsigned int)cTimedOut);
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// Ring test
+//
+// A consumer ring and a producer that opens it by name, each with its
+// own view of the mapping, as if they were in different processes.
+//-------------------------------------------------------------------
+
+static BYTE RingByte(DWORD index, DWORD offset)
+{
+    return (BYTE)(index * 31 + offset);
+}
+
+static DWORD RingFrameSize(DWORD index)
+{
+    return 1 + (index * 523) % RING_SLOT_SIZE;
+}
+
+struct RingProducer
+{
+    SharedFrameRing ring;
+    DWORD           cFrames;
+    volatile LONG   cPublished;
+    HRESULT         hr;
+};
+
+static DWORD WINAPI RingProducerThreadProc(LPVOID lpParameter)
+{
+    RingProducer *pProducer = (RingProducer*)lpParameter;
+    HRESULT hr = S_OK;
+
+    for (DWORD i = 0; i < pProducer->cFrames && SUCCEEDED(hr); i++)
+    {
+        DWORD slot = 0;
+        BYTE *pData = NULL;
+
+        hr = pProducer->ring.AcquireSlot(RING_TIMEOUT_MS, &slot, &pData);
+
+        if (SUCCEEDED(hr))
+        {
+            SHM_FRAME_DESCRIPTOR desc;
+            ZeroMemory(&desc, sizeof(desc));
+
+            desc.payload = SHM_PAYLOAD_JPEG;
+            desc.cbData = RingFrameSize(i);
+            desc.index = i;
+            desc.hnsTimestamp = (LONGLONG)i * 333333;
+            StringCchPrintfA(desc.requestId, SHM_MAX_REQUEST_ID, "frame-%u", (unsigned int)i);
+
+            for (DWORD k = 0; k < desc.cbData; k++)
+            {
+                pData[k] = RingByte(i, k);
+            }
+
+            hr = pProducer->ring.Publish(slot, desc);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            InterlockedIncrement(&pProducer->cPublished);
+        }
+    }
+
+    pProducer->hr = hr;
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// TamperRingHeader
+//
+// Overwrites the geometry in the ring's header through a third view,
+// the way a misbehaving process could.
+//-------------------------------------------------------------------
+
+static BOOL TamperRingHeader(const WCHAR *wszName, DWORD cSlots, DWORD cbSlot, SHM_RING_HEADER *pSaved)
+{
+    WCHAR wszObject[MAX_PATH];
+    BOOL bResult = FALSE;
+
+    if (FAILED(StringCchPrintf(wszObject, MAX_PATH, L"Local\\VideoThumbnail.%s", wszName)))
+    {
+        return FALSE;
+    }
+
+    HANDLE hMapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, wszObject);
+
+    if (hMapping != NULL)
+    {
+        SHM_RING_HEADER *pHeader = (SHM_RING_HEADER*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SHM_RING_HEADER));
+
+        if (pHeader != NULL)
+        {
+            if (pSaved)
+            {
+                *pSaved = *pHeader;
+            }
+            pHeader->cSlots = cSlots;
+            pHeader->cbSlot = cbSlot;
+            UnmapViewOfFile(pHeader);
+            bResult = TRUE;
+        }
+        CloseHandle(hMapping);
+    }
+
+    return bResult;
+}
+
+
+//-------------------------------------------------------------------
+// RunRingTest
+//-------------------------------------------------------------------
+
+static int RunRingTest(DWORD cFrames)
+{
+    HRESULT hr = S_OK;
+    WCHAR wszName[64];
+    SharedFrameRing consumer;
+    RingProducer *pProducer = new RingProducer();
+    HANDLE hThread = NULL;
+    SHM_RING_HEADER saved;
+    int result = 0;
+
+    if (cFrames < RING_SLOTS)
+    {
+        fprintf(stderr, "--ring: need at least %u frames\n", (unsigned int)RING_SLOTS);
+        delete pProducer;
+        return 1;
+    }
+
+    pProducer->cFrames = cFrames;
+    pProducer->cPublished = 0;
+    pProducer->hr = S_OK;
+
+    StringCchPrintf(wszName, ARRAYSIZE(wszName), L"winbench_%u", (unsigned int)GetCurrentProcessId());
+
+    hr = consumer.Create(wszName, RING_SLOTS, RING_SLOT_SIZE);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pProducer->ring.Open(wszName);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--ring: cannot create or open the ring (hr=0x%X)\n", (unsigned int)hr);
+        delete pProducer;
+        return 1;
+    }
+
+    if (pProducer->ring.SlotCount() != RING_SLOTS || pProducer->ring.SlotSize() != RING_SLOT_SIZE)
+    {
+        fprintf(stderr, "--ring: the producer sees %u slots of %u bytes\n",
+            (unsigned int)pProducer->ring.SlotCount(), (unsigned int)pProducer->ring.SlotSize());
+        result = 1;
+    }
+
+    // A header that claims more than the mapping holds is rejected by
+    // Open, and does not change what a producer that is already open
+    // uses: its slots and the data pointers it can return stay inside the
+    // mapping.
+
+    if (!TamperRingHeader(wszName, RING_SLOTS * 1000, RING_SLOT_SIZE * 1000, &saved))
+    {
+        fprintf(stderr, "--ring: cannot map the header\n");
+        result = 1;
+    }
+    else
+    {
+        SharedFrameRing late;
+        DWORD slot = 0;
+        BYTE *pData = NULL;
+        SHM_FRAME_DESCRIPTOR desc;
+        ZeroMemory(&desc, sizeof(desc));
+
+        if (late.Open(wszName) != MF_E_INVALIDREQUEST)
+        {
+            fprintf(stderr, "--ring: Open accepted a header larger than the mapping\n");
+            result = 1;
+        }
+
+        if (pProducer->ring.SlotCount() != RING_SLOTS || pProducer->ring.SlotSize() != RING_SLOT_SIZE)
+        {
+            fprintf(stderr, "--ring: the producer read the tampered header\n");
+            result = 1;
+        }
+
+        desc.cbData = RING_SLOT_SIZE + 1;
+
+        if (pProducer->ring.Publish(RING_SLOTS, desc) != E_INVALIDARG ||
+            pProducer->ring.Publish(0, desc) != E_INVALIDARG)
+        {
+            fprintf(stderr, "--ring: Publish accepted a slot or size outside the ring\n");
+            result = 1;
+        }
+
+        hr = pProducer->ring.AcquireSlot(0, &slot, &pData);
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--ring: cannot acquire a slot (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+        else
+        {
+            DWORD found = 0;
+
+            if (slot >= RING_SLOTS || !pProducer->ring.FindSlot(pData + RING_SLOT_SIZE - 1, &found) || found != slot ||
+                pProducer->ring.FindSlot(pData + (RING_SLOTS - slot) * RING_SLOT_SIZE, &found))
+            {
+                fprintf(stderr, "--ring: FindSlot does not match the real slots\n");
+                result = 1;
+            }
+            pProducer->ring.AbandonSlot(slot);
+        }
+
+        TamperRingHeader(wszName, saved.cSlots, saved.cbSlot, NULL);
+    }
+
+    // Round trip. The consumer does not read anything until the producer
+    // has filled every slot, so the producer must block in AcquireSlot
+    // and not publish more than RING_SLOTS frames.
+
+    hThread = CreateThread(NULL, 0, RingProducerThreadProc, pProducer, 0, NULL);
+
+    if (hThread == NULL)
+    {
+        fprintf(stderr, "--ring: cannot start the producer\n");
+        delete pProducer;
+        return 1;
+    }
+
+    for (DWORD wait = 0; pProducer->cPublished < (LONG)RING_SLOTS && wait < RING_TIMEOUT_MS; wait += 10)
+    {
+        Sleep(10);
+    }
+
+    Sleep(100);
+
+    if (pProducer->cPublished != (LONG)RING_SLOTS)
+    {
+        fprintf(stderr, "--ring: %d frames were published into %u slots\n",
+            (int)pProducer->cPublished, (unsigned int)RING_SLOTS);
+        result = 1;
+    }
+
+    Stopwatch watch;
+
+    DWORD cReceived = 0;
+
+    for (DWORD i = 0; i < cFrames; i++)
+    {
+        SHM_FRAME_DESCRIPTOR desc;
+        const BYTE *pData = NULL;
+        char szId[SHM_MAX_REQUEST_ID];
+
+        hr = consumer.WaitFrame(RING_TIMEOUT_MS, &desc, &pData);
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--ring: frame %u did not arrive (hr=0x%X)\n", (unsigned int)i, (unsigned int)hr);
+            result = 1;
+            break;
+        }
+
+        // There is one producer, so frames arrive in order.
+
+        StringCchPrintfA(szId, SHM_MAX_REQUEST_ID, "frame-%u", (unsigned int)i);
+
+        BOOL bMatch = desc.index == i && desc.cbData == RingFrameSize(i) &&
+            desc.payload == SHM_PAYLOAD_JPEG && desc.hnsTimestamp == (LONGLONG)i * 333333 &&
+            strcmp(desc.requestId, szId) == 0;
+
+        for (DWORD k = 0; bMatch && k < desc.cbData; k++)
+        {
+            bMatch = pData[k] == RingByte(i, k);
+        }
+
+        if (!bMatch)
+        {
+            fprintf(stderr, "--ring: frame %u does not match what was published\n", (unsigned int)i);
+            result = 1;
+        }
+
+        consumer.ReleaseFrame(desc.slot);
+        ++cReceived;
+    }
+
+    double ms = watch.ElapsedMs();
+
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+
+    if (FAILED(pProducer->hr))
+    {
+        fprintf(stderr, "--ring: the producer failed (hr=0x%X)\n", (unsigned int)pProducer->hr);
+        result = 1;
+    }
+
+    // With every slot held, a producer times out instead of waiting forever.
+
+    DWORD slots[RING_SLOTS];
+    DWORD cHeld = 0;
+
+    for (; cHeld < RING_SLOTS; cHeld++)
+    {
+        BYTE *pData = NULL;
+
+        if (FAILED(pProducer->ring.AcquireSlot(0, &slots[cHeld], &pData)))
+        {
+            break;
+        }
+    }
+
+    if (cHeld != RING_SLOTS)
+    {
+        fprintf(stderr, "--ring: only %u slots were free after the round trip\n", (unsigned int)cHeld);
+        result = 1;
+    }
+    else
+    {
+        DWORD slot = 0;
+        BYTE *pData = NULL;
+
+        if (pProducer->ring.AcquireSlot(50, &slot, &pData) != HRESULT_FROM_WIN32(ERROR_TIMEOUT))
+        {
+            fprintf(stderr, "--ring: AcquireSlot did not time out on a full ring\n");
+            result = 1;
+        }
+    }
+
+    for (DWORD i = 0; i < cHeld; i++)
+    {
+        pProducer->ring.AbandonSlot(slots[i]);
+    }
+
+    pProducer->ring.Close();
+    consumer.Close();
+    delete pProducer;
+
+    printf("ring: %u frames through %u slots of %u bytes in %.1f ms (%.1f us per frame)\n",
+        (unsigned int)cReceived, (unsigned int)RING_SLOTS, (unsigned int)RING_SLOT_SIZE,
+        ms, cReceived ? ms * 1000.0 / cReceived : 0.0);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// HttpServer: A loopback HTTP server for --http.
+//
+// It answers every GET with the bytes of HttpByte for the Range header,
+// the way the mode in effect says, and logs each range that it was
+// asked for. The Winsock 1.1 calls come with windows.h.
+//-------------------------------------------------------------------
+
+enum HTTP_SERVE_MODE
+{
+    HTTP_SERVE_RANGE,           // 206 with the range that was asked for.
+    HTTP_SHIFT_RANGE,           // 206 with the bytes one further on.
+    HTTP_UNKNOWN_SIZE,          // Content-Range total of "*".
+    HTTP_OTHER_SIZE,            // Content-Range total that is one larger.
+    HTTP_NO_CONTENT_RANGE,      // 206 without Content-Range.
+    HTTP_IGNORE_RANGE,          // 200 with the whole file.
+    HTTP_HANG                   // No response until the server stops.
+};
+
+struct HttpRange
+{
+    ULONGLONG   first;
+    ULONGLONG   last;
+};
+
+struct HttpServer
+{
+    SOCKET                  listener;
+    USHORT                  port;
+    HANDLE                  hAcceptThread;
+    HANDLE                  hHung;          // Set when a request gets no response.
+    HANDLE                  hStop;
+    volatile LONG           mode;
+    CRITICAL_SECTION        lock;           // Guards the members below.
+    std::vector<HttpRange>  ranges;
+    std::vector<SOCKET>     connections;
+    std::vector<HANDLE>     threads;
+};
+
+struct HttpConnection
+{
+    HttpServer  *pServer;
+    SOCKET      s;
+};
+
+static BYTE HttpByte(ULONGLONG offset)
+{
+    return (BYTE)((offset * 7) ^ (offset >> 9));
+}
+
+static BOOL SendAll(SOCKET s, const char *pData, size_t cb)
+{
+    while (cb > 0)
+    {
+        int cbSent = send(s, pData, (int)(cb < 65536 ? cb : 65536), 0);
+
+        if (cbSent <= 0)
+        {
+            return FALSE;
+        }
+
+        pData += cbSent;
+        cb -= (size_t)cbSent;
+    }
+    return TRUE;
+}
+
+// Sends the headers and the body of bytes first to last.
+
+static BOOL SendResponse(SOCKET s, const char *szStatus, const char *szContentRange, ULONGLONG first, ULONGLONG last)
+{
+    char szHeaders[512];
+    std::vector<char> body((size_t)(last - first + 1));
+
+    for (size_t i = 0; i < body.size(); i++)
+    {
+        body[i] = (char)HttpByte(first + i);
+    }
+
+    if (FAILED(StringCchPrintfA(szHeaders, ARRAYSIZE(szHeaders),
+        "HTTP/1.1 %s\r\nContent-Type: video/mp4\r\nContent-Length: %I64u\r\n%s\r\n",
+        szStatus, last - first + 1, szContentRange)))
+    {
+        return FALSE;
+    }
+
+    return SendAll(s, szHeaders, strlen(szHeaders)) && SendAll(s, &body[0], body.size());
+}
+
+// Answers one request. Returns FALSE to close the connection.
+
+static BOOL ServeRequest(HttpServer *pServer, SOCKET s, const char *szRequest)
+{
+    const char RANGE[] = "\r\nRange: bytes=";
+    const char *pRange = NULL;
+    char *pEnd = NULL;
+    char szContentRange[128];
+    HttpRange range;
+
+    for (const char *p = szRequest; *p; p++)
+    {
+        if (_strnicmp(p, RANGE, ARRAYSIZE(RANGE) - 1) == 0)
+        {
+            pRange = p + ARRAYSIZE(RANGE) - 1;
+            break;
+        }
+    }
+
+    if (pRange == NULL)
+    {
+        return FALSE;
+    }
+
+    range.first = _strtoui64(pRange, &pEnd, 10);
+
+    if (*pEnd != '-')
+    {
+        return FALSE;
+    }
+
+    range.last = _strtoui64(pEnd + 1, NULL, 10);
+
+    if (range.last < range.first || range.last >= HTTP_FILE_SIZE)
+    {
+        return FALSE;
+    }
+
+    EnterCriticalSection(&pServer->lock);
+    pServer->ranges.push_back(range);
+    LeaveCriticalSection(&pServer->lock);
+
+    ULONGLONG first = range.first, last = range.last, cbTotal = HTTP_FILE_SIZE;
+
+    switch (pServer->mode)
+    {
+    case HTTP_SHIFT_RANGE:
+        first = (last + 1 < HTTP_FILE_SIZE) ? first + 1 : first - 1;
+        last = (last + 1 < HTTP_FILE_SIZE) ? last + 1 : last - 1;
+        break;
+
+    case HTTP_OTHER_SIZE:
+        cbTotal = HTTP_FILE_SIZE + 1;
+        break;
+
+    case HTTP_NO_CONTENT_RANGE:
+        return SendResponse(s, "206 Partial Content", "", first, last);
+
+    case HTTP_IGNORE_RANGE:
+        return SendResponse(s, "200 OK", "", 0, HTTP_FILE_SIZE - 1);
+
+    case HTTP_HANG:
+        SetEvent(pServer->hHung);
+        WaitForSingleObject(pServer->hStop, INFINITE);
+        return FALSE;
+    }
+
+    if (pServer->mode == HTTP_UNKNOWN_SIZE)
+    {
+        StringCchPrintfA(szContentRange, ARRAYSIZE(szContentRange), "Content-Range: bytes %I64u-%I64u/*\r\n",
+            first, last);
+    }
+    else
+    {
+        StringCchPrintfA(szContentRange, ARRAYSIZE(szContentRange), "Content-Range: bytes %I64u-%I64u/%I64u\r\n",
+            first, last, cbTotal);
+    }
+
+    return SendResponse(s, "206 Partial Content", szContentRange, first, last);
+}
+
+static DWORD WINAPI HttpConnectionThreadProc(LPVOID lpParameter)
+{
+    HttpConnection *pConnection = (HttpConnection*)lpParameter;
+
+    char buffer[4096];
+    int cbBuffer = 0;
+
+    for (;;)
+    {
+        int cbRead = recv(pConnection->s, buffer + cbBuffer, (int)sizeof(buffer) - 1 - cbBuffer, 0);
+
+        if (cbRead <= 0)
+        {
+            break;
+        }
+
+        cbBuffer += cbRead;
+        buffer[cbBuffer] = 0;
+
+        char *pEnd = strstr(buffer, "\r\n\r\n");
+
+        if (pEnd == NULL)
+        {
+            if (cbBuffer == (int)sizeof(buffer) - 1)
+            {
+                break;  // Headers too large.
+            }
+            continue;
+        }
+
+        pEnd[2] = 0;
+
+        if (!ServeRequest(pConnection->pServer, pConnection->s, buffer))
+        {
+            break;
+        }
+
+        // Keep anything after the request.
+        int cbRequest = (int)(pEnd + 4 - buffer);
+        memmove(buffer, buffer + cbRequest, cbBuffer - cbRequest);
+        cbBuffer -= cbRequest;
+    }
+
+    // StopHttpServer closes the socket.
+    shutdown(pConnection->s, SD_BOTH);
+
+    delete pConnection;
+    return 0;
+}
+
+static DWORD WINAPI HttpAcceptThreadProc(LPVOID lpParameter)
+{
+    HttpServer *pServer = (HttpServer*)lpParameter;
+
+    for (;;)
+    {
+        SOCKET s = accept(pServer->listener, NULL, NULL);
+
+        if (s == INVALID_SOCKET)
+        {
+            break;  // StopHttpServer closed the listener.
+        }
+
+        HttpConnection *pConnection = new HttpConnection();
+        pConnection->pServer = pServer;
+        pConnection->s = s;
+
+        EnterCriticalSection(&pServer->lock);
+
+        pServer->connections.push_back(s);
+
+        HANDLE hThread = CreateThread(NULL, 0, HttpConnectionThreadProc, pConnection, 0, NULL);
+
+        if (hThread)
+        {
+            pServer->threads.push_back(hThread);
+        }
+        else
+        {
+            delete pConnection;
+        }
+
+        LeaveCriticalSection(&pServer->lock);
+    }
+
+    return 0;
+}
+
+static BOOL StartHttpServer(HttpServer *pServer)
+{
+    sockaddr_in address;
+    int cbAddress = sizeof(address);
+
+    pServer->listener = INVALID_SOCKET;
+    pServer->port = 0;
+    pServer->hAcceptThread = NULL;
+    pServer->mode = HTTP_SERVE_RANGE;
+    pServer->hHung = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pServer->hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    InitializeCriticalSection(&pServer->lock);
+
+    ZeroMemory(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    if (pServer->hHung == NULL || pServer->hStop == NULL)
+    {
+        return FALSE;
+    }
+
+    pServer->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (pServer->listener == INVALID_SOCKET ||
+        bind(pServer->listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(pServer->listener, SOMAXCONN) != 0 ||
+        getsockname(pServer->listener, (sockaddr*)&address, &cbAddress) != 0)
+    {
+        return FALSE;
+    }
+
+    pServer->port = ntohs(address.sin_port);
+    pServer->hAcceptThread = CreateThread(NULL, 0, HttpAcceptThreadProc, pServer, 0, NULL);
+
+    return pServer->hAcceptThread != NULL;
+}
+
+static void StopHttpServer(HttpServer *pServer)
+{
+    // Release hung requests, then close every socket, which fails the
+    // accept and the recv calls that are waiting on them.
+    if (pServer->hStop)
+    {
+        SetEvent(pServer->hStop);
+    }
+
+    if (pServer->listener != INVALID_SOCKET)
+    {
+        closesocket(pServer->listener);
+    }
+
+    if (pServer->hAcceptThread)
+    {
+        WaitForSingleObject(pServer->hAcceptThread, INFINITE);
+        CloseHandle(pServer->hAcceptThread);
+    }
+
+    for (size_t i = 0; i < pServer->connections.size(); i++)
+    {
+        closesocket(pServer->connections[i]);
+    }
+
+    for (size_t i = 0; i < pServer->threads.size(); i++)
+    {
+        WaitForSingleObject(pServer->threads[i], INFINITE);
+        CloseHandle(pServer->threads[i]);
+    }
+
+    if (pServer->hHung)
+    {
+        CloseHandle(pServer->hHung);
+    }
+
+    if (pServer->hStop)
+    {
+        CloseHandle(pServer->hStop);
+    }
+
+    DeleteCriticalSection(&pServer->lock);
+}
+
+static size_t LoggedRanges(HttpServer *pServer, HttpRange *pLast)
+{
+    EnterCriticalSection(&pServer->lock);
+
+    size_t cRanges = pServer->ranges.size();
+
+    if (pLast && cRanges > 0)
+    {
+        *pLast = pServer->ranges.back();
+    }
+
+    LeaveCriticalSection(&pServer->lock);
+
+    return cRanges;
+}
+
+
+//-------------------------------------------------------------------
+// HttpReader: Reads on another thread, so that the main thread can
+// cancel the read while it waits on the server.
+//-------------------------------------------------------------------
+
+struct HttpReader
+{
+    HttpRangeSource     *pSource;       // Either this,
+    CachedByteStream    *pStream;       // or this.
+    BYTE                buffer[4096];
+    HRESULT             hr;
+};
+
+static DWORD WINAPI HttpReaderThreadProc(LPVOID lpParameter)
+{
+    HttpReader *pReader = (HttpReader*)lpParameter;
+
+    if (pReader->pSource)
+    {
+        pReader->hr = pReader->pSource->ReadAt(0, pReader->buffer, sizeof(pReader->buffer)) ? S_OK : E_FAIL;
+    }
+    else
+    {
+        ULONG cbRead = 0;
+        pReader->hr = pReader->pStream->Read(pReader->buffer, sizeof(pReader->buffer), &cbRead);
+    }
+
+    return 0;
+}
+
+// Starts a read that the server does not answer, and cancels it once
+// the server has the request. Returns how long the read took to fail
+// after the cancel, or -1 if it did not fail in time.
+
+static double CancelHungRead(HttpServer *pServer, HttpReader *pReader, IMFByteStream *pCancel)
+{
+    double ms = -1.0;
+
+    pServer->mode = HTTP_HANG;
+    pReader->hr = S_OK;
+
+    HANDLE hThread = CreateThread(NULL, 0, HttpReaderThreadProc, pReader, 0, NULL);
+
+    if (hThread == NULL)
+    {
+        return -1.0;
+    }
+
+    if (WaitForSingleObject(pServer->hHung, HTTP_TIMEOUT_MS) == WAIT_OBJECT_0)
+    {
+        Stopwatch stopwatch;
+
+        if (pCancel)
+        {
+            (void)pCancel->Close();
+        }
+        else
+        {
+            pReader->pSource->Cancel();
+        }
+
+        if (WaitForSingleObject(hThread, HTTP_CANCEL_LIMIT_MS) == WAIT_OBJECT_0 && FAILED(pReader->hr))
+        {
+            ms = stopwatch.ElapsedMs();
+        }
+    }
+
+    // A read that did not fail is released by StopHttpServer.
+    pServer->mode = HTTP_SERVE_RANGE;
+
+    if (ms < 0)
+    {
+        SetEvent(pServer->hStop);
+        WaitForSingleObject(hThread, INFINITE);
+    }
+
+    CloseHandle(hThread);
+    return ms;
+}
+
+
+//-------------------------------------------------------------------
+// RunHttpTest
+//-------------------------------------------------------------------
+
+static int RunHttpTest(DWORD cReads)
+{
+    WSADATA wsaData;
+    WCHAR wszUrl[64];
+    HttpServer server;
+    HttpRangeSource *pSource = new HttpRangeSource();
+    HttpReader *pReader = new HttpReader();
+    CachedByteStream *pStream = NULL;
+    std::vector<BYTE> buffer(HTTP_MAX_READ);
+    HttpRange logged = { 0, 0 };
+    double msCancel = 0, msClose = 0;
+    ULONGLONG cbRead = 0;
+    int result = 0;
+
+    if (cReads == 0)
+    {
+        fprintf(stderr, "--http: no reads\n");
+        delete pReader;
+        delete pSource;
+        return 1;
+    }
+
+    if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0)
+    {
+        fprintf(stderr, "--http: cannot start Winsock\n");
+        delete pReader;
+        delete pSource;
+        return 1;
+    }
+
+    if (!StartHttpServer(&server))
+    {
+        fprintf(stderr, "--http: cannot start the server\n");
+        result = 1;
+    }
+
+    StringCchPrintf(wszUrl, ARRAYSIZE(wszUrl), L"http://127.0.0.1:%u/clip.mp4", (unsigned int)server.port);
+
+    // Open asks for the first byte, to learn the size.
+
+    if (result == 0)
+    {
+        HRESULT hr = pSource->Open(wszUrl);
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--http: Open failed (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+        else if (pSource->Size() != HTTP_FILE_SIZE || pSource->ContentType() != L"video/mp4" ||
+            LoggedRanges(&server, &logged) != 1 || logged.first != 0 || logged.last != 0)
+        {
+            fprintf(stderr, "--http: Open found %u bytes of \"%S\"\n",
+                (unsigned int)pSource->Size(), pSource->ContentType().c_str());
+            result = 1;
+        }
+    }
+
+    // Every read gets exactly the bytes that were asked for, in one
+    // request for exactly that range.
+
+    Stopwatch stopwatch;
+    UINT32 seed = 1;
+
+    for (DWORD i = 0; i < cReads && result == 0; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        size_t cb = 1 + (seed >> 8) % HTTP_MAX_READ;
+
+        seed = seed * 1664525 + 1013904223;
+        ULONGLONG offset = (i == 0) ? HTTP_FILE_SIZE - cb : (seed >> 4) % (HTTP_FILE_SIZE - cb + 1);
+
+        if (!pSource->ReadAt(offset, &buffer[0], cb))
+        {
+            fprintf(stderr, "--http: read %u failed\n", (unsigned int)i);
+            result = 1;
+            break;
+        }
+
+        for (size_t j = 0; j < cb; j++)
+        {
+            if (buffer[j] != HttpByte(offset + j))
+            {
+                fprintf(stderr, "--http: read %u has the wrong bytes\n", (unsigned int)i);
+                result = 1;
+                break;
+            }
+        }
+
+        if (LoggedRanges(&server, &logged) != i + 2 || logged.first != offset || logged.last != offset + cb - 1)
+        {
+            fprintf(stderr, "--http: read %u was not one request for its range\n", (unsigned int)i);
+            result = 1;
+        }
+
+        cbRead += cb;
+    }
+
+    double msReads = stopwatch.ElapsedMs();
+
+    // Each wrong answer fails the read, and the next read succeeds.
+
+    const HTTP_SERVE_MODE badModes[] =
+    {
+        HTTP_SHIFT_RANGE, HTTP_UNKNOWN_SIZE, HTTP_OTHER_SIZE, HTTP_NO_CONTENT_RANGE, HTTP_IGNORE_RANGE
+    };
+
+    for (size_t i = 0; i < ARRAYSIZE(badModes) && result == 0; i++)
+    {
+        server.mode = badModes[i];
+
+        if (pSource->ReadAt(1000, &buffer[0], 100))
+        {
+            fprintf(stderr, "--http: a wrong answer (mode %u) was accepted\n", (unsigned int)badModes[i]);
+            result = 1;
+        }
+
+        server.mode = HTTP_SERVE_RANGE;
+
+        if (!pSource->ReadAt(1000, &buffer[0], 100) || buffer[0] != HttpByte(1000))
+        {
+            fprintf(stderr, "--http: cannot read after a wrong answer (mode %u)\n", (unsigned int)badModes[i]);
+            result = 1;
+        }
+    }
+
+    if (result == 0 && pSource->Requests() != LoggedRanges(&server, NULL))
+    {
+        fprintf(stderr, "--http: %u requests were counted, %u were received\n",
+            (unsigned int)pSource->Requests(), (unsigned int)LoggedRanges(&server, NULL));
+        result = 1;
+    }
+
+    // Cancel fails a read that is waiting for the response, well before
+    // the receive time limit, and every read after it.
+
+    if (result == 0)
+    {
+        pReader->pSource = pSource;
+        pReader->pStream = NULL;
+
+        msCancel = CancelHungRead(&server, pReader, NULL);
+
+        size_t cRanges = LoggedRanges(&server, NULL);
+
+        if (msCancel < 0)
+        {
+            fprintf(stderr, "--http: Cancel did not fail the read within %u ms\n", (unsigned int)HTTP_CANCEL_LIMIT_MS);
+            result = 1;
+        }
+        else if (pSource->ReadAt(0, &buffer[0], 100) || LoggedRanges(&server, NULL) != cRanges)
+        {
+            fprintf(stderr, "--http: a read after Cancel was sent\n");
+            result = 1;
+        }
+    }
+
+    // Closing a byte stream for the URL does the same for a read that
+    // holds its lock.
+
+    if (result == 0)
+    {
+        HRESULT hr = CachedByteStream::CreateForUrl(wszUrl, ByteStreamOptions(), &pStream);
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--http: cannot create the byte stream (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+        else
+        {
+            pReader->pSource = NULL;
+            pReader->pStream = pStream;
+
+            msClose = CancelHungRead(&server, pReader, pStream);
+
+            if (msClose < 0)
+            {
+                fprintf(stderr, "--http: Close did not fail the read within %u ms\n", (unsigned int)HTTP_CANCEL_LIMIT_MS);
+                result = 1;
+            }
+        }
+    }
+
+    SafeRelease(&pStream);
+    delete pSource;
+    delete pReader;
+
+    StopHttpServer(&server);
+    WSACleanup();
+
+    if (result == 0)
+    {
+        printf("http: %u reads of %.1f KB in %.1f ms; cancel %.1f ms, close %.1f ms\n",
+            (unsigned int)cReads, cbRead / 1024.0, msReads, msCancel, msClose);
+    }
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunPipelineTest
+//
+// Generates the same thumbnails of a .y4m clip with the stages run one
+// after another and as a pipeline, and compares them.
+//-------------------------------------------------------------------
+
+class OrderSink : public ThumbnailSink
+{
+public:
+    std::vector<LONGLONG>   timestamps;
+
+    HRESULT OnThumbnail(DWORD /*index*/, VT_THUMBNAIL *pResult)
+    {
+        timestamps.push_back(pResult->hnsTimestamp);
+        return S_OK;
+    }
+};
+
+struct PipelinePass
+{
+    VT_THUMBNAIL    *pResults[PIPELINE_JOBS];
+    OrderSink       sinks[PIPELINE_JOBS];
+    HRESULT         hrJobs[PIPELINE_JOBS];
+    StageTimings    timings;
+    double          ms;
+};
+
+static HRESULT RunPipelinePass(ThumbnailContext *pContext, const WCHAR *wszClip, UINT32 cThumbnails, DWORD cDepth,
+    PipelinePass *pPass)
+{
+    ThumbnailJob jobs[PIPELINE_JOBS];
+
+    // A PNG and a JPEG size, so the process stage scales each frame twice.
+    const VT_OPTIONS opts[PIPELINE_JOBS] =
+    {
+        { cThumbnails, NULL, 160, 160, VT_FORMAT_PNG, 0 },
+        { cThumbnails, NULL, 320, 180, VT_FORMAT_JPEG, 0.8f }
+    };
+
+    for (DWORD j = 0; j < PIPELINE_JOBS; j++)
+    {
+        pPass->pResults[j] = new VT_THUMBNAIL[cThumbnails];
+        ZeroMemory(pPass->pResults[j], sizeof(VT_THUMBNAIL) * cThumbnails);
+
+        ThumbnailJob job = { opts[j], NULL, pPass->pResults[j], &pPass->sinks[j], FALSE, NULL, 0 };
+        jobs[j] = job;
+    }
+
+    pContext->SetPipelineDepth(cDepth);
+
+    Stopwatch stopwatch;
+
+    HRESULT hr = pContext->GenerateBatchFromFile(wszClip, PIPELINE_JOBS, jobs, pPass->hrJobs);
+
+    pPass->ms = stopwatch.ElapsedMs();
+    pPass->timings = pContext->LastTimings();
+
+    return hr;
+}
+
+static void FreePipelinePass(PipelinePass *pPass, UINT32 cThumbnails)
+{
+    for (DWORD j = 0; j < PIPELINE_JOBS; j++)
+    {
+        if (pPass->pResults[j])
+        {
+            ThumbnailContext::FreeThumbnails(NULL, pPass->pResults[j], cThumbnails);
+            delete [] pPass->pResults[j];
+            pPass->pResults[j] = NULL;
+        }
+    }
+}
+
+static int RunPipelineTest(const WCHAR *wszDir, UINT32 cThumbnails)
+{
+    WCHAR wszClip[MAX_PATH] = { 0 };
+    ThumbnailContext *pContext = new ThumbnailContext();
+    PipelinePass *pSerial = new PipelinePass();
+    PipelinePass *pPipelined = new PipelinePass();
+    FrameSourceCost cost;
+    int result = 0;
+
+    cost.seekMicroseconds = 20000;
+    cost.decodeMicroseconds = 2000;
+    cost.gopLength = 30;
+
+    if (cThumbnails < 2)
+    {
+        fprintf(stderr, "--pipeline: need at least 2 thumbnails\n");
+        result = 1;
+    }
+
+    HRESULT hr = StringCchPrintf(wszClip, MAX_PATH, L"%s\\pipeline.y4m", wszDir);
+
+    if (result == 0)
+    {
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteY4m(wszClip, PIPELINE_WIDTH, PIPELINE_HEIGHT, PIPELINE_FRAMES);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pContext->Initialize();
+        }
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--pipeline: cannot write the clip or initialize (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+    }
+
+    if (result == 0)
+    {
+        pContext->SetFrameSourceCost(cost);
+
+        HRESULT hrSerial = RunPipelinePass(pContext, wszClip, cThumbnails, 0, pSerial);
+        HRESULT hrPipelined = RunPipelinePass(pContext, wszClip, cThumbnails, PIPELINE_DEPTH, pPipelined);
+
+        if (FAILED(hrSerial) || FAILED(hrPipelined))
+        {
+            fprintf(stderr, "--pipeline: a pass failed (hr=0x%X, 0x%X)\n", (unsigned int)hrSerial,
+                (unsigned int)hrPipelined);
+            result = 1;
+        }
+        else if (pSerial->timings.pipelined || !pPipelined->timings.pipelined)
+        {
+            fprintf(stderr, "--pipeline: the passes did not run in the expected modes\n");
+            result = 1;
+        }
+    }
+
+    // Each stage handled every frame, and the sinks got every thumbnail
+    // in time order.
+    for (DWORD s = 0; s < PIPELINE_STAGES && result == 0; s++)
+    {
+        if (pPipelined->timings.stages[s].cItems == 0)
+        {
+            fprintf(stderr, "--pipeline: stage %u handled no frames\n", (unsigned int)s);
+            result = 1;
+        }
+    }
+
+    for (DWORD j = 0; j < PIPELINE_JOBS && result == 0; j++)
+    {
+        const std::vector<LONGLONG>& times = pPipelined->sinks[j].timestamps;
+
+        if (pSerial->hrJobs[j] != S_OK || pPipelined->hrJobs[j] != S_OK || times.size() != cThumbnails)
+        {
+            fprintf(stderr, "--pipeline: job %u failed (hr=0x%X, 0x%X) or its sink got %u thumbnails\n",
+                (unsigned int)j, (unsigned int)pSerial->hrJobs[j], (unsigned int)pPipelined->hrJobs[j],
+                (unsigned int)times.size());
+            result = 1;
+            break;
+        }
+
+        for (size_t i = 1; i < times.size(); i++)
+        {
+            if (times[i] < times[i - 1])
+            {
+                fprintf(stderr, "--pipeline: job %u reached its sink out of time order\n", (unsigned int)j);
+                result = 1;
+                break;
+            }
+        }
+
+        // The pipeline must not change a single byte.
+        for (UINT32 i = 0; i < cThumbnails && result == 0; i++)
+        {
+            const VT_THUMBNAIL& a = pSerial->pResults[j][i];
+            const VT_THUMBNAIL& b = pPipelined->pResults[j][i];
+
+            if (a.hrStatus != S_OK || b.hrStatus != S_OK || a.hnsTimestamp != b.hnsTimestamp ||
+                a.cbData != b.cbData || a.pData == NULL || b.pData == NULL || memcmp(a.pData, b.pData, a.cbData) != 0)
+            {
+                fprintf(stderr, "--pipeline: job %u thumbnail %u differs between the passes\n",
+                    (unsigned int)j, (unsigned int)i);
+                result = 1;
+            }
+        }
+    }
+
+    if (result == 0)
+    {
+        const StageTimings& timings = pPipelined->timings;
+
+        printf("pipeline: %u frames, %u thumbnails in %u sizes\n", (unsigned int)timings.positionsDecoded,
+            (unsigned int)(cThumbnails * PIPELINE_JOBS), (unsigned int)PIPELINE_JOBS);
+        printf("  serial: %.1f ms\n", pSerial->ms);
+        printf("  pipelined (depth %u): %.1f ms, %.2fx; busy decode %.0f%%, process %.0f%%, encode %.0f%%\n",
+            (unsigned int)PIPELINE_DEPTH, pPipelined->ms, pSerial->ms / pPipelined->ms,
+            100.0 * timings.stages[PIPELINE_DECODE].Utilization(timings.pipelineMs),
+            100.0 * timings.stages[PIPELINE_PROCESS].Utilization(timings.pipelineMs),
+            100.0 * timings.stages[PIPELINE_ENCODE].Utilization(timings.pipelineMs));
+    }
+
+    FreePipelinePass(pSerial, cThumbnails);
+    FreePipelinePass(pPipelined, cThumbnails);
+    delete pSerial;
+    delete pPipelined;
+    delete pContext;
+
+    DeleteFile(wszClip);
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// RunMFAsyncTest
+//
+// Encodes an H.264 clip with a sink writer, then reads the same
+// positions from it with MFFrameSource one at a time and with every
+// read queued at once on an MFAsyncFrameReader.
+//-------------------------------------------------------------------
+
+struct MFAsyncRead
+{
+    FRAME_STATUS    status;
+    int64_t         timestamp;
+    ULONGLONG       hash;           // Of the converted pixels.
+    uint32_t        cFramesDecoded;
+    LONG            cCallbacks;
+    LONG            order;          // Of completion, from 1.
+    volatile LONG   *pcCompleted;
+};
+
+static HRESULT WriteH264Clip(const WCHAR *wszPath, UINT32 width, UINT32 height, UINT32 cFrames)
+{
+    IMFSinkWriter *pWriter = NULL;
+    IMFMediaType *pOutputType = NULL;
+    IMFMediaType *pInputType = NULL;
+    DWORD iStream = 0;
+
+    const DWORD cbFrame = width * height * 3 / 2;   // NV12.
+    const LONGLONG hnsFrame = 10000000 / 30;
+
+    HRESULT hr = MFCreateSinkWriterFromURL(wszPath, NULL, NULL, &pWriter);
+
+    for (int i = 0; i < 2 && SUCCEEDED(hr); i++)
+    {
+        IMFMediaType **ppType = (i == 0) ? &pOutputType : &pInputType;
+
+        hr = MFCreateMediaType(ppType);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = (*ppType)->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = (*ppType)->SetGUID(MF_MT_SUBTYPE, (i == 0) ? MFVideoFormat_H264 : MFVideoFormat_NV12);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = (*ppType)->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = MFSetAttributeSize(*ppType, MF_MT_FRAME_SIZE, width, height);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = MFSetAttributeRatio(*ppType, MF_MT_FRAME_RATE, 30, 1);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = MFSetAttributeRatio(*ppType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pOutputType->SetUINT32(MF_MT_AVG_BITRATE, 2000000);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pWriter->AddStream(pOutputType, &iStream);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pWriter->SetInputMediaType(iStream, pInputType, NULL);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pWriter->BeginWriting();
+    }
+
+    // A diagonal gradient that moves a little with every frame.
+    for (UINT32 f = 0; f < cFrames && SUCCEEDED(hr); f++)
+    {
+        IMFMediaBuffer *pBuffer = NULL;
+        IMFSample *pSample = NULL;
+        BYTE *pData = NULL;
+
+        hr = MFCreateMemoryBuffer(cbFrame, &pBuffer);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pBuffer->Lock(&pData, NULL, NULL);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            for (UINT32 y = 0; y < height; y++)
+            {
+                for (UINT32 x = 0; x < width; x++)
+                {
+                    pData[y * width + x] = (BYTE)(x + y + 4 * f);
+                }
+            }
+
+            for (UINT32 i = width * height; i < cbFrame; i += 2)
+            {
+                pData[i] = (BYTE)(64 + f % 128);
+                pData[i + 1] = (BYTE)(192 - f % 128);
+            }
+
+            pBuffer->Unlock();
+            hr = pBuffer->SetCurrentLength(cbFrame);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = MFCreateSample(&pSample);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pSample->AddBuffer(pBuffer);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pSample->SetSampleTime(f * hnsFrame);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pSample->SetSampleDuration(hnsFrame);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pWriter->WriteSample(iStream, pSample);
+        }
+
+        SafeRelease(&pSample);
+        SafeRelease(&pBuffer);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pWriter->Finalize();
+    }
+
+    SafeRelease(&pInputType);
+    SafeRelease(&pOutputType);
+    SafeRelease(&pWriter);
+    return hr;
+}
+
+static void ConvertMFRead(FrameSource *pSource, FrameView *pView, MFAsyncRead *pRead)
+{
+    FrameFormat format;
+    ULONGLONG hash = 14695981039346656037ULL;
+
+    pRead->hash = 0;
+
+    if (pRead->status == FRAME_OK)
+    {
+        pRead->status = pSource->ConvertFrame(pView);
+    }
+
+    if (pRead->status == FRAME_OK)
+    {
+        pRead->status = pSource->GetFormat(&format);
+    }
+
+    if (pRead->status != FRAME_OK)
+    {
+        return;
+    }
+
+    for (uint32_t y = 0; y < format.height; y++)
+    {
+        const uint8_t *pRow = pView->pData + (ptrdiff_t)y * pView->stride;
+
+        for (uint32_t x = 0; x < format.width * 4; x++)
+        {
+            hash = (hash ^ pRow[x]) * 1099511628211ULL;
+        }
+    }
+
+    pRead->timestamp = pView->timestamp;
+    pRead->hash = hash;
+}
+
+static void OnMFAsyncRead(void *pContext, const FrameRead *pRead)
+{
+    MFAsyncRead *pResult = (MFAsyncRead*)pContext;
+    FrameView view = pRead->view;
+
+    pResult->status = pRead->status;
+    pResult->cFramesDecoded = pRead->cFramesDecoded;
+    pResult->order = InterlockedIncrement(pResult->pcCompleted);
+
+    ConvertMFRead(pRead->pSource, &view, pResult);
+
+    InterlockedIncrement(&pResult->cCallbacks);
+}
+
+// Reads the frame for hnsPosition the way MFAsyncFrameReader does.
+
+static void ReadMFFrameAt(MFFrameSource *pSource, int64_t hnsPosition, MFAsyncRead *pRead)
+{
+    FrameView view = { NULL, 0, FRAME_TIME_UNKNOWN, false };
+    bool bFormatChanged = false;
+    bool bHaveFrame = false;
+    uint32_t cSkipped = 0;
+
+    pRead->cFramesDecoded = 0;
+    pRead->status = AsyncFrameReader::StartRead(pSource, hnsPosition);
+
+    while (pRead->status == FRAME_OK)
+    {
+        pRead->status = pSource->ReadFrame(&view, &bFormatChanged);
+
+        if (pRead->status != FRAME_OK)
+        {
+            break;
+        }
+
+        ++pRead->cFramesDecoded;
+        bHaveFrame = true;
+
+        if (AsyncFrameReader::IsFrameForPosition(view, hnsPosition, cSkipped))
+        {
+            break;
+        }
+        ++cSkipped;
+    }
+
+    if (pRead->status == FRAME_END_OF_STREAM && bHaveFrame)
+    {
+        pRead->status = FRAME_OK;
+    }
+
+    ConvertMFRead(pSource, &view, pRead);
+}
+
+static int RunMFAsyncTest(const WCHAR *wszDir, DWORD cPositions)
+{
+    WCHAR wszClip[MAX_PATH] = { 0 };
+    MFFrameSource *pSource = new MFFrameSource();
+    MFAsyncFrameReader *pReader = NULL;
+    std::vector<MFAsyncRead> serial(2 * cPositions);
+    std::vector<MFAsyncRead> async(2 * cPositions);
+    std::vector<int64_t> positions(2 * cPositions);
+    volatile LONG cCompleted = 0;
+    double msSerial = 0, msQueue = 0, msAsync = 0;
+    int result = 0;
+
+    const int64_t hnsDuration = (int64_t)MFASYNC_FRAMES * 10000000 / 30;
+
+    if (cPositions == 0)
+    {
+        fprintf(stderr, "--mfasync: no positions\n");
+        delete pSource;
+        return 1;
+    }
+
+    // Evenly spaced positions, then the same ones backwards, so that
+    // every read after the first half seeks back.
+    for (DWORD i = 0; i < cPositions; i++)
+    {
+        positions[i] = hnsDuration / (cPositions + 1) * (i + 1);
+        positions[2 * cPositions - 1 - i] = positions[i];
+    }
+
+    HRESULT hr = MFStartup(MF_VERSION);
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--mfasync: MFStartup failed (hr=0x%X)\n", (unsigned int)hr);
+        delete pSource;
+        return 1;
+    }
+
+    hr = StringCchPrintf(wszClip, MAX_PATH, L"%s\\mfasync.mp4", wszDir);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteH264Clip(wszClip, MFASYNC_WIDTH, MFASYNC_HEIGHT, MFASYNC_FRAMES);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "--mfasync: cannot encode the clip (hr=0x%X)\n", (unsigned int)hr);
+        result = 1;
+    }
+
+    // One read at a time with the synchronous source.
+
+    if (result == 0)
+    {
+        hr = pSource->OpenURL(wszClip);
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--mfasync: cannot open the clip (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+    }
+
+    if (result == 0)
+    {
+        Stopwatch stopwatch;
+
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            ReadMFFrameAt(pSource, positions[i], &serial[i]);
+        }
+
+        msSerial = stopwatch.ElapsedMs();
+        pSource->Close();
+    }
+
+    // Every read queued at once from this thread.
+
+    if (result == 0)
+    {
+        hr = MFAsyncFrameReader::CreateInstance(&pReader);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pReader->OpenURL(wszClip);
+        }
+
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "--mfasync: cannot open the asynchronous reader (hr=0x%X)\n", (unsigned int)hr);
+            result = 1;
+        }
+    }
+
+    if (result == 0)
+    {
+        Stopwatch stopwatch;
+
+        for (size_t i = 0; i < positions.size() && result == 0; i++)
+        {
+            async[i].status = FRAME_E_READ;
+            async[i].cCallbacks = 0;
+            async[i].order = 0;
+            async[i].pcCompleted = &cCompleted;
+
+            if (pReader->ReadAt(positions[i], OnMFAsyncRead, &async[i]) != FRAME_OK)
+            {
+                fprintf(stderr, "--mfasync: cannot queue read %u\n", (unsigned int)i);
+                result = 1;
+            }
+        }
+
+        msQueue = stopwatch.ElapsedMs();
+
+        pReader->Drain();
+
+        msAsync = stopwatch.ElapsedMs();
+    }
+
+    // Both ways give the same frames, each read completes once and in
+    // the order it was queued.
+
+    for (size_t i = 0; i < positions.size() && result == 0; i++)
+    {
+        if (serial[i].status != FRAME_OK)
+        {
+            fprintf(stderr, "--mfasync: synchronous read %u failed (status %d)\n", (unsigned int)i,
+                (int)serial[i].status);
+            result = 1;
+        }
+        else if (async[i].cCallbacks != 1 || async[i].order != (LONG)i + 1)
+        {
+            fprintf(stderr, "--mfasync: read %u completed %d times, in place %d\n", (unsigned int)i,
+                (int)async[i].cCallbacks, (int)async[i].order);
+            result = 1;
+        }
+        else if (async[i].status != FRAME_OK || async[i].timestamp != serial[i].timestamp ||
+            async[i].hash != serial[i].hash)
+        {
+            fprintf(stderr, "--mfasync: read %u got the frame at %lld (status %d), expected %lld\n",
+                (unsigned int)i, (long long)async[i].timestamp, (int)async[i].status,
+                (long long)serial[i].timestamp);
+            result = 1;
+        }
+    }
+
+    if (pReader)
+    {
+        pReader->Shutdown();
+
+        // A closed reader refuses new reads instead of losing them.
+        if (result == 0 && pReader->ReadAt(0, OnMFAsyncRead, &async[0]) == FRAME_OK)
+        {
+            fprintf(stderr, "--mfasync: a read was queued after Shutdown\n");
+            result = 1;
+        }
+
+        pReader->Release();
+    }
+
+    delete pSource;
+    DeleteFile(wszClip);
+    MFShutdown();
+
+    if (result == 0)
+    {
+        printf("mfasync: %u reads of a %ux%u H.264 clip\n", (unsigned int)positions.size(),
+            (unsigned int)MFASYNC_WIDTH, (unsigned int)MFASYNC_HEIGHT);
+        printf("  synchronous: %.1f ms\n", msSerial);
+        printf("  asynchronous: %.1f ms, of which %.2f ms queuing\n", msAsync, msQueue);
+    }
+
+    return result;
+}
+
+
+//-------------------------------------------------------------------
+// GetWorkDir
+//
+// Returns the --dir directory, or creates a temporary one the first
+// time it is needed.
+//-------------------------------------------------------------------
+
+static BOOL GetWorkDir(WCHAR *wszDir, BOOL *pbTempDir)
+{
+    WCHAR wszTemp[MAX_PATH];
+
+    if (wszDir[0] != 0)
+    {
+        return TRUE;
+    }
+
+    if (GetTempPath(MAX_PATH, wszTemp) == 0 ||
+        FAILED(StringCchPrintf(wszDir, MAX_PATH, L"%swinbench_%u", wszTemp, (unsigned int)GetCurrentProcessId())) ||
+        !CreateDirectory(wszDir, NULL))
+    {
+        fwprintf(stderr, L"cannot create a temporary directory\n");
+        wszDir[0] = 0;
+        return FALSE;
+    }
+
+    *pbTempDir = TRUE;
+    return TRUE;
+}
+
+
+int wmain(int argc, WCHAR *argv[])
+{
+    int result = 0;
+    int count = 0;
+    WCHAR wszDir[MAX_PATH] = { 0 };
+    BOOL bTempDir = FALSE;
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+    {
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (wcscmp(argv[i], L"--count") == 0 && i + 1 < argc)
+        {
+            count = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--dir") == 0 && i + 1 < argc)
+        {
+            StringCchCopy(wszDir, MAX_PATH, argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--writer") == 0 && i + 1 < argc)
+        {
+            DWORD cFiles = (DWORD)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ?
+                RunWriterBenchmark(wszDir, cFiles, (count > 0 ? (DWORD)count : 4) * 1024) : 1;
+        }
+        else if (wcscmp(argv[i], L"--daemon") == 0 && i + 1 < argc)
+        {
+            DWORD cClients = (DWORD)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ? RunDaemonTest(wszDir, cClients) : 1;
+        }
+        else if (wcscmp(argv[i], L"--coalesce") == 0 && i + 1 < argc)
+        {
+            DWORD cRequests = (DWORD)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ? RunCoalesceTest(wszDir, cRequests) : 1;
+        }
+        else if (wcscmp(argv[i], L"--preempt") == 0 && i + 1 < argc)
+        {
+            DWORD cPositions = (DWORD)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ? RunPreemptTest(wszDir, cPositions) : 1;
+        }
+        else if (wcscmp(argv[i], L"--ring") == 0 && i + 1 < argc)
+        {
+            result |= RunRingTest((DWORD)_wtoi(argv[++i]));
+        }
+        else if (wcscmp(argv[i], L"--http") == 0 && i + 1 < argc)
+        {
+            result |= RunHttpTest((DWORD)_wtoi(argv[++i]));
+        }
+        else if (wcscmp(argv[i], L"--pipeline") == 0 && i + 1 < argc)
+        {
+            UINT32 cThumbnails = (UINT32)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ? RunPipelineTest(wszDir, cThumbnails) : 1;
+        }
+        else if (wcscmp(argv[i], L"--mfasync") == 0 && i + 1 < argc)
+        {
+            DWORD cPositions = (DWORD)_wtoi(argv[++i]);
+
+            result |= GetWorkDir(wszDir, &bTempDir) ? RunMFAsyncTest(wszDir, cPositions) : 1;
+        }
+        else
+        {
+            fwprintf(stderr, L"%s: unknown option\n", argv[i]);
+            result = 1;
+        }
+    }
+
+    // Each mode deletes the files it created.
+    if (bTempDir)
+    {
+        RemoveDirectory(wszDir);
+    }
+
+    CoUninitialize();
+    return result;
+}
@@ -0,0 +1,412 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// WorkQueue: Queued requests in priority classes, with cancellation.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "workqueue.h"
+
+#include <string.h>
+#include <algorithm>
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *WORK_CLASS_NAMES[WORK_CLASSES] = { "interactive", "bulk" };
+
+static double MsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+
+//-------------------------------------------------------------------
+// WorkClassName
+//-------------------------------------------------------------------
+
+const char *WorkClassName(WORK_CLASS workClass)
+{
+    return (workClass >= 0 && workClass < WORK_CLASSES) ? WORK_CLASS_NAMES[workClass] : "";
+}
+
+
+//-------------------------------------------------------------------
+// ParseWorkClass
+//-------------------------------------------------------------------
+
+bool ParseWorkClass(const char *szName, WORK_CLASS *pWorkClass)
+{
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        if (strcmp(szName, WORK_CLASS_NAMES[c]) == 0)
+        {
+            *pWorkClass = (WORK_CLASS)c;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//-------------------------------------------------------------------
+// WorkQueue constructor
+//-------------------------------------------------------------------
+
+WorkQueue::WorkQueue()
+    : m_cIdle(0),
+      m_pfnMatch(NULL),
+      m_windowMs(0),
+      m_bPriority(true),
+      m_bStopping(false)
+{
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        m_depth[c] = 0;
+        m_iLatency[c] = 0;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// SetCoalescing
+//-------------------------------------------------------------------
+
+void WorkQueue::SetCoalescing(WorkMatch pfnMatch, uint32_t windowMs)
+{
+    m_pfnMatch = pfnMatch;
+    m_windowMs = windowMs;
+}
+
+
+//-------------------------------------------------------------------
+// Push
+//-------------------------------------------------------------------
+
+void WorkQueue::Push(WorkItem *pItem)
+{
+    int c = (pItem->workClass >= 0 && pItem->workClass < WORK_CLASSES) ? pItem->workClass : WORK_BULK;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        pItem->queuedAt = Clock::now();
+        m_queues[c].push_back(pItem);
+
+        uint32_t depth = ++m_depth[c];
+
+        m_stats[c].cQueued++;
+        if (depth > m_stats[c].depthMax)
+        {
+            m_stats[c].depthMax = depth;
+        }
+    }
+
+    // Wake every worker: one that is collecting a batch may want this
+    // item, and an idle one can take it otherwise.
+    m_cvWork.notify_all();
+}
+
+
+//-------------------------------------------------------------------
+// Pop
+//-------------------------------------------------------------------
+
+size_t WorkQueue::Pop(WorkItem *ppBatch[], size_t cMaxItems)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    int c = NextClass(WORK_BULK);
+
+    while (c < 0 && !m_bStopping)
+    {
+        ++m_cIdle;
+        m_cvWork.wait(lock);
+        --m_cIdle;
+
+        c = NextClass(WORK_BULK);
+    }
+
+    if (c < 0 || cMaxItems == 0)
+    {
+        return 0;
+    }
+
+    ppBatch[0] = TakeFront(c);
+
+    return Collect(lock, ppBatch, cMaxItems);
+}
+
+
+//-------------------------------------------------------------------
+// ShouldPreempt
+//
+// Reads the depths without the lock: a pass asks at every frame, and a
+// stale answer only delays the switch by a frame.
+//-------------------------------------------------------------------
+
+bool WorkQueue::ShouldPreempt(WORK_CLASS running) const
+{
+    return m_bPriority && running > WORK_INTERACTIVE && m_depth[WORK_INTERACTIVE] > 0 && m_cIdle == 0;
+}
+
+
+//-------------------------------------------------------------------
+// Depth
+//-------------------------------------------------------------------
+
+uint32_t WorkQueue::Depth() const
+{
+    uint32_t depth = 0;
+
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        depth += m_depth[c];
+    }
+
+    return depth;
+}
+
+
+//-------------------------------------------------------------------
+// PopPreempting
+//-------------------------------------------------------------------
+
+size_t WorkQueue::PopPreempting(WorkItem *ppBatch[], size_t cMaxItems)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (!m_bPriority || m_queues[WORK_INTERACTIVE].empty() || cMaxItems == 0)
+    {
+        return 0;
+    }
+
+    ppBatch[0] = TakeFront(WORK_INTERACTIVE);
+    m_stats[WORK_INTERACTIVE].cPreempting++;
+
+    return Collect(lock, ppBatch, cMaxItems);
+}
+
+
+//-------------------------------------------------------------------
+// Completed
+//-------------------------------------------------------------------
+
+void WorkQueue::Completed(const WorkItem *pItem, double latencyMs)
+{
+    int c = (pItem->workClass >= 0 && pItem->workClass < WORK_CLASSES) ? pItem->workClass : WORK_BULK;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (pItem->cancel.IsCancelled())
+    {
+        m_stats[c].cCancelled++;
+        return;
+    }
+
+    m_stats[c].cCompleted++;
+
+    if (m_latencies[c].size() < LATENCY_SAMPLES)
+    {
+        m_latencies[c].push_back(latencyMs);
+    }
+    else
+    {
+        m_latencies[c][m_iLatency[c]] = latencyMs;
+        m_iLatency[c] = (m_iLatency[c] + 1) % LATENCY_SAMPLES;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Stop
+//
+// Wakes the workers. Pop still returns what is queued, and then 0.
+//-------------------------------------------------------------------
+
+void WorkQueue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopping = true;
+    }
+
+    m_cvWork.notify_all();
+}
+
+
+//-------------------------------------------------------------------
+// GetStats
+//-------------------------------------------------------------------
+
+void WorkQueue::GetStats(WorkClassStats stats[WORK_CLASSES])
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (int c = 0; c < WORK_CLASSES; c++)
+    {
+        stats[c] = m_stats[c];
+        stats[c].depth = m_depth[c];
+        stats[c].latencyP50Ms = Percentile(m_latencies[c], 0.50);
+        stats[c].latencyP99Ms = Percentile(m_latencies[c], 0.99);
+    }
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// NextClass
+//
+// The class to take from next, among those up to lowest: the most
+// urgent one with work, or, without priorities, the one whose oldest
+// item came first. Returns -1 if there is no work. Called with the lock
+// held.
+//-------------------------------------------------------------------
+
+int WorkQueue::NextClass(WORK_CLASS lowest) const
+{
+    int next = -1;
+
+    for (int c = 0; c <= (int)lowest; c++)
+    {
+        if (m_queues[c].empty())
+        {
+            continue;
+        }
+
+        if (m_bPriority)
+        {
+            return c;
+        }
+
+        if (next < 0 || m_queues[c].front()->queuedAt < m_queues[next].front()->queuedAt)
+        {
+            next = c;
+        }
+    }
+
+    return next;
+}
+
+
+//-------------------------------------------------------------------
+// TakeFront
+//
+// Called with the lock held.
+//-------------------------------------------------------------------
+
+WorkItem *WorkQueue::TakeFront(int iClass)
+{
+    WorkItem *pItem = m_queues[iClass].front();
+
+    m_queues[iClass].pop_front();
+    --m_depth[iClass];
+
+    double waitMs = MsSince(pItem->queuedAt);
+
+    m_stats[iClass].cStarted++;
+    m_stats[iClass].waitMs += waitMs;
+    if (waitMs > m_stats[iClass].waitMsMax)
+    {
+        m_stats[iClass].waitMsMax = waitMs;
+    }
+
+    return pItem;
+}
+
+
+//-------------------------------------------------------------------
+// TakeMatching
+//
+// Moves queued items that match ppBatch[0], of any class, into the
+// batch. Called with the lock held.
+//-------------------------------------------------------------------
+
+size_t WorkQueue::TakeMatching(WorkItem *ppBatch[], size_t cItems, size_t cMaxItems)
+{
+    if (m_pfnMatch == NULL)
+    {
+        return cItems;
+    }
+
+    for (int c = 0; c < WORK_CLASSES && cItems < cMaxItems; c++)
+    {
+        size_t i = 0;
+
+        while (i < m_queues[c].size() && cItems < cMaxItems)
+        {
+            if (m_pfnMatch(ppBatch[0], m_queues[c][i]))
+            {
+                // Bring it to the front, so that TakeFront accounts for it.
+                WorkItem *pItem = m_queues[c][i];
+
+                m_queues[c].erase(m_queues[c].begin() + i);
+                m_queues[c].push_front(pItem);
+
+                ppBatch[cItems++] = TakeFront(c);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    return cItems;
+}
+
+
+//-------------------------------------------------------------------
+// Collect
+//
+// Adds matching items to a batch of one, waiting up to the coalescing
+// window for them. Called with the lock held.
+//-------------------------------------------------------------------
+
+size_t WorkQueue::Collect(std::unique_lock<std::mutex>& lock, WorkItem *ppBatch[], size_t cMaxItems)
+{
+    size_t cItems = TakeMatching(ppBatch, 1, cMaxItems);
+
+    if (m_pfnMatch == NULL)
+    {
+        return cItems;
+    }
+
+    double ageMs = MsSince(ppBatch[0]->queuedAt);
+
+    while (cItems < cMaxItems && !m_bStopping && ageMs < m_windowMs)
+    {
+        m_cvWork.wait_for(lock, std::chrono::duration<double, std::milli>(m_windowMs - ageMs));
+
+        cItems = TakeMatching(ppBatch, cItems, cMaxItems);
+
+        ageMs = MsSince(ppBatch[0]->queuedAt);
+    }
+
+    return cItems;
+}
+
+
+//-------------------------------------------------------------------
+// Percentile
+//
+// Nearest-rank percentile of the samples, or 0 if there are none.
+//-------------------------------------------------------------------
+
+double WorkQueue::Percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    size_t rank = (size_t)(p * (double)samples.size() + 0.999999);
+
+    return samples[(rank > 0) ? rank - 1 : 0];
+}
@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// WorkQueue: Queued requests in priority classes, with cancellation.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// NOTE: Priority classes
+//
+// Requests belong to a class: interactive (someone is waiting for the
+// result) or bulk (a library being re-thumbnailed). WorkQueue hands out
+// interactive requests first, and bulk requests in arrival order when
+// there are none. That alone leaves an interactive request waiting for
+// a worker to finish a whole bulk pass when every worker has one, so
+// passes are also preemptible at frame boundaries:
+//
+//   - A pass calls PassControl::AtFrameBoundary between frames, on the
+//     thread that started it.
+//   - The daemon's control asks ShouldPreempt, which is true when an
+//     interactive request is queued and no worker is idle to take it.
+//   - It then takes the interactive requests with PopPreempting and runs
+//     them to the end on the same thread, with a context of its own,
+//     before the bulk pass goes on. The bulk pass keeps its source open
+//     and its frames in memory meanwhile.
+//
+// An interactive request therefore waits for at most one frame of a
+// bulk pass, and no thread is added. Interactive passes are never
+// preempted. The bulk pass passes its ReadBudget to AtFrameBoundary,
+// and the control pauses it while the interactive passes run, so that
+// their time does not count against the bulk file's (see watchdog.h).
+//
+// Cancellation: each WorkItem has a CancelToken. Cancelling a queued
+// request makes its worker answer it without running it; cancelling a
+// running one makes the pass skip its remaining frames, scaling and
+// encoding at the next check (see PassControl::IsCancelled and
+// ThumbnailJob::pCancel). A read that is in progress is not interrupted;
+// a time budget bounds it (see watchdog.h).
+//
+// GetStats reports, for each class, the requests queued, started
+// (by preemption or not), cancelled and completed, the queue depth now
+// and at most, the time spent queued, and the 50th and 99th percentile
+// of the latencies passed to Completed.
+//
+// SetPriority(false) makes the queue a single FIFO across classes, with
+// no preemption, for comparison.
+//
+// Like framesource.h, this depends only on the C++ standard library.
+
+enum WORK_CLASS
+{
+    WORK_INTERACTIVE = 0,
+    WORK_BULK,
+    WORK_CLASSES
+};
+
+// Name of a class in requests and statistics: "interactive" or "bulk".
+const char *WorkClassName(WORK_CLASS workClass);
+bool        ParseWorkClass(const char *szName, WORK_CLASS *pWorkClass);
+
+class CancelToken
+{
+    std::atomic<bool>   m_bCancelled;
+
+public:
+    CancelToken() : m_bCancelled(false)
+    {
+    }
+
+    void    Cancel() { m_bCancelled = true; }
+    bool    IsCancelled() const { return m_bCancelled; }
+};
+
+class ReadBudget;
+
+// PassControl: Lets the owner of a decode pass stop it or run other
+// work in the middle of it.
+class PassControl
+{
+public:
+    virtual ~PassControl() { }
+
+    // True if the pass should stop. Called from any of the pass's
+    // threads.
+    virtual bool    IsCancelled() = 0;
+
+    // Called between frames, on the thread that started the pass.
+    // pBudget is the pass's time budget, to pause while other work runs,
+    // or NULL.
+    virtual void    AtFrameBoundary(ReadBudget *pBudget) = 0;
+};
+
+struct WorkItem
+{
+    WORK_CLASS      workClass;
+    CancelToken     cancel;
+    std::chrono::steady_clock::time_point queuedAt; // Set by Push.
+
+    WorkItem() : workClass(WORK_INTERACTIVE)
+    {
+    }
+
+    virtual ~WorkItem() { }
+};
+
+struct WorkClassStats
+{
+    uint64_t    cQueued;
+    uint64_t    cStarted;
+    uint64_t    cPreempting;    // Of those, started by preempting a pass.
+    uint64_t    cCancelled;     // Cancelled before they completed.
+    uint64_t    cCompleted;
+    uint32_t    depth;
+    uint32_t    depthMax;
+    double      waitMs;         // In the queue, in all.
+    double      waitMsMax;
+    double      latencyP50Ms;   // Of the latest completed requests.
+    double      latencyP99Ms;
+
+    WorkClassStats() : cQueued(0), cStarted(0), cPreempting(0), cCancelled(0), cCompleted(0), depth(0),
+        depthMax(0), waitMs(0), waitMsMax(0), latencyP50Ms(0), latencyP99Ms(0)
+    {
+    }
+};
+
+// True if pOther can share pFirst's decode pass.
+typedef bool (*WorkMatch)(const WorkItem *pFirst, const WorkItem *pOther);
+
+class WorkQueue
+{
+public:
+    WorkQueue();
+
+    void        SetPriority(bool bPriority) { m_bPriority = bPriority; }
+
+    // Pop takes queued items that match the first one along with it,
+    // waiting until the first has been queued for windowMs for more to
+    // arrive. Call before the workers start.
+    void        SetCoalescing(WorkMatch pfnMatch, uint32_t windowMs);
+
+    void        Push(WorkItem *pItem);
+
+    // Waits for work and takes it: the oldest item of the most urgent
+    // class, and those that match it. Returns the number of items, or 0
+    // when the queue is stopping and empty.
+    size_t      Pop(WorkItem *ppBatch[], size_t cMaxItems);
+
+    // For a pass of class running, at a frame boundary: true if it
+    // should make way for more urgent work.
+    bool        ShouldPreempt(WORK_CLASS running) const;
+
+    // Items queued in all classes. Read without the lock.
+    uint32_t    Depth() const;
+
+    // Takes queued interactive work without waiting for it. Returns 0
+    // if there is none.
+    size_t      PopPreempting(WorkItem *ppBatch[], size_t cMaxItems);
+
+    // Called once for each item that was popped, when it is done.
+    void        Completed(const WorkItem *pItem, double latencyMs);
+
+    void        Stop();
+
+    void        GetStats(WorkClassStats stats[WORK_CLASSES]);
+
+private:
+    static const size_t LATENCY_SAMPLES = 1024;
+
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cvWork;
+    std::deque<WorkItem*>       m_queues[WORK_CLASSES];
+    std::atomic<uint32_t>       m_depth[WORK_CLASSES];      // Read without the lock.
+    std::atomic<uint32_t>       m_cIdle;                    // Workers waiting in Pop.
+    WorkClassStats              m_stats[WORK_CLASSES];
+    std::vector<double>         m_latencies[WORK_CLASSES];  // The latest LATENCY_SAMPLES.
+    size_t                      m_iLatency[WORK_CLASSES];
+    WorkMatch                   m_pfnMatch;
+    uint32_t                    m_windowMs;
+    bool                        m_bPriority;
+    bool                        m_bStopping;
+
+    int         NextClass(WORK_CLASS lowest) const;
+    WorkItem    *TakeFront(int iClass);
+    size_t      TakeMatching(WorkItem *ppBatch[], size_t cItems, size_t cMaxItems);
+    size_t      Collect(std::unique_lock<std::mutex>& lock, WorkItem *ppBatch[], size_t cMaxItems);
+    static double Percentile(std::vector<double> samples, double p);
+};
@@ -0,0 +1,492 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AsyncFileWriter: Writes encoded thumbnails to disk on worker threads.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "videothumbnail.h"
+#include "writer.h"
+
+const DWORD WRITE_CHUNK_SIZE = 64 * 1024;
+
+
+//-------------------------------------------------------------------
+// AsyncFileWriter constructor
+//-------------------------------------------------------------------
+
+AsyncFileWriter::AsyncFileWriter()
+    : m_hPort(NULL),
+      m_hSlots(NULL),
+      m_phThreads(NULL),
+      m_cThreads(0),
+      m_cMaxInFlight(0),
+      m_bFlushToDisk(FALSE),
+      m_hwndNotify(NULL),
+      m_msgNotify(0),
+      m_cPending(0),
+      m_hrFirstError(S_OK),
+      m_cFilesWritten(0),
+      m_cbWritten(0)
+{
+}
+
+
+//-------------------------------------------------------------------
+// AsyncFileWriter destructor
+//-------------------------------------------------------------------
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Shutdown();
+}
+
+
+//-------------------------------------------------------------------
+// Initialize
+//
+// Starts the worker threads.
+//
+// cThreads:     Number of worker threads.
+// cMaxInFlight: Maximum number of requests that can be queued or in
+//               progress. Submit blocks when the limit is reached.
+// bFlushToDisk: If TRUE, each file is flushed before it is closed.
+//-------------------------------------------------------------------
+
+HRESULT AsyncFileWriter::Initialize(DWORD cThreads, DWORD cMaxInFlight, BOOL bFlushToDisk)
+{
+    HRESULT hr = S_OK;
+
+    if (m_hPort != NULL)
+    {
+        return MF_E_ALREADY_INITIALIZED;
+    }
+
+    if (cThreads == 0 || cThreads > MAXIMUM_WAIT_OBJECTS || cMaxInFlight == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_bFlushToDisk = bFlushToDisk;
+    m_cMaxInFlight = cMaxInFlight;
+    m_hrFirstError = S_OK;
+
+    m_hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, cThreads);
+    if (m_hPort == NULL)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    m_hSlots = CreateSemaphore(NULL, cMaxInFlight, cMaxInFlight, NULL);
+    if (m_hSlots == NULL)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    m_phThreads = new (std::nothrow) HANDLE[cThreads];
+    if (m_phThreads == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    for (m_cThreads = 0; m_cThreads < cThreads; m_cThreads++)
+    {
+        m_phThreads[m_cThreads] = CreateThread(NULL, 0, WorkerThreadProc, this, 0, NULL);
+        if (m_phThreads[m_cThreads] == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            goto done;
+        }
+    }
+
+done:
+    if (FAILED(hr))
+    {
+        Shutdown();
+    }
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Submit
+//
+// Queues an encoded image for writing. The writer holds a reference
+// on the stream until the file has been written.
+//
+// If the in-flight queue is full, this method blocks until a worker
+// completes a request.
+//-------------------------------------------------------------------
+
+HRESULT AsyncFileWriter::Submit(const WCHAR *wszFileName, IStream *pStream)
+{
+    HRESULT hr = S_OK;
+    size_t cch = 0;
+
+    WriteRequest *pRequest = NULL;
+
+    if (m_hPort == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    if (wszFileName == NULL || pStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    hr = StringCchLength(wszFileName, STRSAFE_MAX_CCH, &cch);
+    if (FAILED(hr)) { return hr; }
+
+    pRequest = new (std::nothrow) WriteRequest;
+    if (pRequest == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pRequest->pStream = pStream;
+    pRequest->pStream->AddRef();
+
+    pRequest->wszFileName = new (std::nothrow) WCHAR[cch + 1];
+    if (pRequest->wszFileName == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    hr = StringCchCopy(pRequest->wszFileName, cch + 1, wszFileName);
+    if (FAILED(hr)) { goto done; }
+
+    // Apply backpressure: wait for a free slot in the in-flight queue.
+    WaitForSingleObject(m_hSlots, INFINITE);
+
+    InterlockedIncrement(&m_cPending);
+
+    if (!PostQueuedCompletionStatus(m_hPort, 0, (ULONG_PTR)pRequest, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        InterlockedDecrement(&m_cPending);
+        ReleaseSemaphore(m_hSlots, 1, NULL);
+        goto done;
+    }
+
+    pRequest = NULL;   // The worker thread owns the request now.
+
+done:
+    if (pRequest)
+    {
+        SafeRelease(&pRequest->pStream);
+        delete [] pRequest->wszFileName;
+        delete pRequest;
+    }
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Flush
+//
+// Waits until every submitted request has completed. Returns the
+// first error reported by a worker since the previous Flush.
+//
+// Note: Flush must not be called concurrently with Submit.
+//-------------------------------------------------------------------
+
+HRESULT AsyncFileWriter::Flush()
+{
+    if (m_hPort == NULL)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    // When we own every slot, nothing is queued or in progress.
+    for (DWORD i = 0; i < m_cMaxInFlight; i++)
+    {
+        WaitForSingleObject(m_hSlots, INFINITE);
+    }
+
+    ReleaseSemaphore(m_hSlots, m_cMaxInFlight, NULL);
+
+    return (HRESULT)InterlockedExchange(&m_hrFirstError, S_OK);
+}
+
+
+//-------------------------------------------------------------------
+// SetIdleNotify
+//
+// Asks for msg to be posted to hwnd each time the last queued request
+// completes. The handler can then call Flush without blocking. Pass
+// NULL to stop the notifications.
+//
+// Note: Call this while no requests are queued.
+//-------------------------------------------------------------------
+
+void AsyncFileWriter::SetIdleNotify(HWND hwnd, UINT msg)
+{
+    m_hwndNotify = hwnd;
+    m_msgNotify = msg;
+}
+
+
+//-------------------------------------------------------------------
+// Shutdown
+//
+// Completes all pending requests and stops the worker threads.
+//-------------------------------------------------------------------
+
+void AsyncFileWriter::Shutdown()
+{
+    if (m_phThreads)
+    {
+        // A NULL completion key tells a worker to exit. Requests that
+        // were queued earlier are processed first.
+        for (DWORD i = 0; i < m_cThreads; i++)
+        {
+            PostQueuedCompletionStatus(m_hPort, 0, 0, NULL);
+        }
+
+        if (m_cThreads > 0)
+        {
+            WaitForMultipleObjects(m_cThreads, m_phThreads, TRUE, INFINITE);
+        }
+
+        for (DWORD i = 0; i < m_cThreads; i++)
+        {
+            CloseHandle(m_phThreads[i]);
+        }
+
+        delete [] m_phThreads;
+        m_phThreads = NULL;
+        m_cThreads = 0;
+    }
+
+    if (m_hSlots)
+    {
+        CloseHandle(m_hSlots);
+        m_hSlots = NULL;
+    }
+
+    if (m_hPort)
+    {
+        CloseHandle(m_hPort);
+        m_hPort = NULL;
+    }
+}
+
+
+//
+/// Private methods
+//
+
+//-------------------------------------------------------------------
+// WorkerThreadProc
+//
+// Pulls write requests from the completion port until it receives
+// the shutdown packet.
+//-------------------------------------------------------------------
+
+DWORD WINAPI AsyncFileWriter::WorkerThreadProc(LPVOID lpParameter)
+{
+    AsyncFileWriter *pThis = (AsyncFileWriter*)lpParameter;
+
+    while (1)
+    {
+        DWORD cbTransferred = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED pOverlapped = NULL;
+
+        if (!GetQueuedCompletionStatus(pThis->m_hPort, &cbTransferred, &key, &pOverlapped, INFINITE))
+        {
+            break;
+        }
+
+        if (key == 0)
+        {
+            break;  // Shutdown.
+        }
+
+        WriteRequest *pRequest = (WriteRequest*)key;
+
+        HRESULT hr = pThis->WriteFileFromStream(pRequest);
+
+        pThis->CompleteRequest(pRequest, hr);
+    }
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+// WriteFileFromStream
+//
+// Creates the target file and copies the contents of the stream. A
+// stream that ends before its size fails with ERROR_HANDLE_EOF. On
+// failure the file is deleted.
+//-------------------------------------------------------------------
+
+HRESULT AsyncFileWriter::WriteFileFromStream(const WriteRequest *pRequest)
+{
+    HRESULT hr = S_OK;
+
+    HANDLE  hFile = INVALID_HANDLE_VALUE;
+    HGLOBAL hGlobal = NULL;
+    BYTE    *pData = NULL;
+    BYTE    *pChunk = NULL;
+    DWORD   cbData = 0;
+    DWORD   cbWritten = 0;
+
+    STATSTG stat;
+    ZeroMemory(&stat, sizeof(stat));
+
+    hr = pRequest->pStream->Stat(&stat, STATFLAG_NONAME);
+    if (FAILED(hr)) { goto done; }
+
+    if (stat.cbSize.HighPart != 0)
+    {
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    cbData = stat.cbSize.LowPart;
+
+    hFile = CreateFile(
+        pRequest->wszFileName,
+        GENERIC_WRITE,
+        0,
+        NULL,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL
+        );
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    // Memory streams can be written with a single call. Other streams
+    // are copied in chunks.
+
+    if (SUCCEEDED(GetHGlobalFromStream(pRequest->pStream, &hGlobal)))
+    {
+        pData = (BYTE*)GlobalLock(hGlobal);
+        if (pData == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            goto done;
+        }
+
+        if (!WriteFile(hFile, pData, cbData, &cbWritten, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            goto done;
+        }
+    }
+    else
+    {
+        LARGE_INTEGER liZero = { 0 };
+        ULONG cbRead = 0;
+
+        pChunk = new (std::nothrow) BYTE[WRITE_CHUNK_SIZE];
+        if (pChunk == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+            goto done;
+        }
+
+        hr = pRequest->pStream->Seek(liZero, STREAM_SEEK_SET, NULL);
+        if (FAILED(hr)) { goto done; }
+
+        while (cbWritten < cbData)
+        {
+            DWORD cbChunk = 0;
+
+            hr = pRequest->pStream->Read(pChunk, WRITE_CHUNK_SIZE, &cbRead);
+            if (FAILED(hr) || cbRead == 0) { break; }
+
+            if (!WriteFile(hFile, pChunk, cbRead, &cbChunk, NULL))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                goto done;
+            }
+            cbWritten += cbChunk;
+        }
+
+        if (FAILED(hr)) { goto done; }
+
+        // The stream ended before its size.
+        if (cbWritten < cbData)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            goto done;
+        }
+    }
+
+    if (m_bFlushToDisk && !FlushFileBuffers(hFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto done;
+    }
+
+    InterlockedExchangeAdd64(&m_cbWritten, cbWritten);
+
+done:
+    if (pData)
+    {
+        GlobalUnlock(hGlobal);
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        if (!CloseHandle(hFile) && SUCCEEDED(hr))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        // Do not leave a partial thumbnail behind.
+        if (FAILED(hr))
+        {
+            DeleteFile(pRequest->wszFileName);
+        }
+    }
+    delete [] pChunk;
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// CompleteRequest
+//
+// Records the result, frees the request and releases its slot.
+//-------------------------------------------------------------------
+
+void AsyncFileWriter::CompleteRequest(WriteRequest *pRequest, HRESULT hr)
+{
+    if (SUCCEEDED(hr))
+    {
+        InterlockedIncrement(&m_cFilesWritten);
+    }
+    else
+    {
+        InterlockedCompareExchange(&m_hrFirstError, hr, S_OK);
+    }
+
+    SafeRelease(&pRequest->pStream);
+    delete [] pRequest->wszFileName;
+    delete pRequest;
+
+    ReleaseSemaphore(m_hSlots, 1, NULL);
+
+    // The slot is free first, so a Flush from the handler does not wait.
+    if (InterlockedDecrement(&m_cPending) == 0 && m_hwndNotify != NULL)
+    {
+        PostMessage(m_hwndNotify, m_msgNotify, 0, 0);
+    }
+}
@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AsyncFileWriter: Writes encoded thumbnails to disk on worker threads.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// NOTE: Write requests
+//
+// Each request carries a file name and an IStream that holds the encoded
+// image (normally a memory stream from CreateStreamOnHGlobal). Requests
+// are posted to an I/O completion port; the worker threads perform the
+// create / write / (optional) flush / close sequence, so the caller never
+// blocks on the file system unless the in-flight limit has been reached.
+//
+// A UI thread should not call Flush after queueing its writes, because
+// that blocks it until the disk catches up. Instead it can ask for a
+// message (SetIdleNotify) that is posted whenever the last queued
+// request completes, and then call Flush, which returns at once, to
+// collect the result.
+
+class AsyncFileWriter
+{
+    struct WriteRequest
+    {
+        WCHAR       *wszFileName;
+        IStream     *pStream;
+    };
+
+    HANDLE          m_hPort;            // Completion port used as the work queue.
+    HANDLE          m_hSlots;           // Semaphore that bounds the in-flight queue.
+    HANDLE          *m_phThreads;
+    DWORD           m_cThreads;
+    DWORD           m_cMaxInFlight;
+    BOOL            m_bFlushToDisk;     // Call FlushFileBuffers before closing.
+
+    HWND            m_hwndNotify;       // Receives m_msgNotify when idle.
+    UINT            m_msgNotify;
+    volatile LONG   m_cPending;         // Requests queued or in progress.
+
+    volatile LONG   m_hrFirstError;     // First failure reported by a worker.
+
+    // Statistics
+    volatile LONG   m_cFilesWritten;
+    volatile LONGLONG m_cbWritten;
+
+public:
+
+    AsyncFileWriter();
+    ~AsyncFileWriter();
+
+    HRESULT     Initialize(DWORD cThreads, DWORD cMaxInFlight, BOOL bFlushToDisk);
+    HRESULT     Submit(const WCHAR *wszFileName, IStream *pStream);
+    HRESULT     Flush();
+    void        SetIdleNotify(HWND hwnd, UINT msg);
+    void        Shutdown();
+
+    LONG        FilesWritten() const { return m_cFilesWritten; }
+    LONGLONG    BytesWritten() const { return m_cbWritten; }
+    LONG        Pending() const { return m_cPending; }
+
+private:
+    static DWORD WINAPI WorkerThreadProc(LPVOID lpParameter);
+
+    HRESULT     WriteFileFromStream(const WriteRequest *pRequest);
+    void        CompleteRequest(WriteRequest *pRequest, HRESULT hr);
+};
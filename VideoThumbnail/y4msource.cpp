@@ -0,0 +1,719 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Y4mFrameSource: Frame source for YUV4MPEG2 and raw I420 files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "y4msource.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <chrono>
+#include <new>
+
+const int64_t   HNS_PER_SECOND      = 10000000;
+const uint32_t  MAX_DIMENSION       = 16384;
+const size_t    MAX_HEADER_LENGTH   = 1024;
+
+static bool SeekFile(FILE *pFile, uint64_t offset)
+{
+#ifdef _MSC_VER
+    return _fseeki64(pFile, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(pFile, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool GetFileSize(FILE *pFile, uint64_t *pcbFile)
+{
+#ifdef _MSC_VER
+    if (_fseeki64(pFile, 0, SEEK_END) != 0) { return false; }
+    __int64 cb = _ftelli64(pFile);
+#else
+    if (fseeko(pFile, 0, SEEK_END) != 0) { return false; }
+    off_t cb = ftello(pFile);
+#endif
+    if (cb < 0)
+    {
+        return false;
+    }
+    *pcbFile = (uint64_t)cb;
+    return true;
+}
+
+// Reads one line, up to and including the newline. Returns its length,
+// or 0 if there is no newline within cchMax characters.
+static size_t ReadLine(FILE *pFile, char *pszLine, size_t cchMax)
+{
+    size_t cch = 0;
+
+    while (cch + 1 < cchMax)
+    {
+        int ch = fgetc(pFile);
+
+        if (ch == EOF)
+        {
+            return 0;
+        }
+
+        pszLine[cch++] = (char)ch;
+
+        if (ch == '\n')
+        {
+            pszLine[cch] = '\0';
+            return cch;
+        }
+    }
+    return 0;
+}
+
+// Parses "a:b". Returns false unless both are positive.
+static bool ParseRatio(const char *psz, uint32_t *pNum, uint32_t *pDen)
+{
+    char *pEnd = NULL;
+
+    unsigned long num = strtoul(psz, &pEnd, 10);
+
+    if (*pEnd != ':')
+    {
+        return false;
+    }
+
+    unsigned long den = strtoul(pEnd + 1, NULL, 10);
+
+    if (num == 0 || den == 0 || num > 0xFFFFFFFF || den > 0xFFFFFFFF)
+    {
+        return false;
+    }
+
+    *pNum = (uint32_t)num;
+    *pDen = (uint32_t)den;
+    return true;
+}
+
+// Spins for a simulated cost, so that it shows up as CPU time. Returns
+// false if the source was cancelled.
+static bool Spin(uint32_t microseconds, const std::atomic<bool>& bCancelled)
+{
+    if (microseconds == 0)
+    {
+        return !bCancelled;
+    }
+
+    std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+
+    while (std::chrono::steady_clock::now() < end)
+    {
+        if (bCancelled)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------
+// Y4mFrameSource constructor
+//-------------------------------------------------------------------
+
+Y4mFrameSource::Y4mFrameSource()
+    : m_pFile(NULL),
+      m_pPool(NULL)
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// Y4mFrameSource destructor
+//-------------------------------------------------------------------
+
+Y4mFrameSource::~Y4mFrameSource()
+{
+    Close();
+}
+
+
+//-------------------------------------------------------------------
+// Open
+//
+// Opens a YUV4MPEG2 file.
+//-------------------------------------------------------------------
+
+FRAME_STATUS Y4mFrameSource::Open(const char *szPath)
+{
+    Close();
+
+#ifdef _MSC_VER
+    if (fopen_s(&m_pFile, szPath, "rb") != 0)
+    {
+        m_pFile = NULL;
+    }
+#else
+    m_pFile = fopen(szPath, "rb");
+#endif
+
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    FRAME_STATUS status = ParseHeader();
+
+    if (status == FRAME_OK)
+    {
+        status = SetLayout();
+    }
+
+    if (status != FRAME_OK)
+    {
+        Close();
+    }
+
+    return status;
+}
+
+#ifdef _WIN32
+FRAME_STATUS Y4mFrameSource::Open(const wchar_t *wszPath)
+{
+    Close();
+
+    if (_wfopen_s(&m_pFile, wszPath, L"rb") != 0)
+    {
+        m_pFile = NULL;
+        return FRAME_E_READ;
+    }
+
+    FRAME_STATUS status = ParseHeader();
+
+    if (status == FRAME_OK)
+    {
+        status = SetLayout();
+    }
+
+    if (status != FRAME_OK)
+    {
+        Close();
+    }
+
+    return status;
+}
+#endif
+
+
+//-------------------------------------------------------------------
+// OpenRaw
+//
+// Opens a raw I420 file: frames of Y, U and V planes with no headers.
+//-------------------------------------------------------------------
+
+FRAME_STATUS Y4mFrameSource::OpenRaw(const char *szPath, uint32_t width, uint32_t height, uint32_t fpsNum, uint32_t fpsDen)
+{
+    Close();
+
+    if (fpsNum == 0 || fpsDen == 0)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+#ifdef _MSC_VER
+    if (fopen_s(&m_pFile, szPath, "rb") != 0)
+    {
+        m_pFile = NULL;
+    }
+#else
+    m_pFile = fopen(szPath, "rb");
+#endif
+
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_fpsNum = fpsNum;
+    m_fpsDen = fpsDen;
+    m_chromaShiftX = 1;
+    m_chromaShiftY = 1;
+
+    FRAME_STATUS status = SetLayout();
+
+    if (status != FRAME_OK)
+    {
+        Close();
+    }
+
+    return status;
+}
+
+
+//-------------------------------------------------------------------
+// Close
+//-------------------------------------------------------------------
+
+void Y4mFrameSource::Close()
+{
+    if (m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+
+    m_width = 0;
+    m_height = 0;
+    m_fpsNum = 0;
+    m_fpsDen = 1;
+    m_parNum = 1;
+    m_bCancelled = false;
+    m_parDen = 1;
+    m_chromaShiftX = 1;
+    m_chromaShiftY = 1;
+    m_bMono = false;
+    m_cbHeader = 0;
+    m_cbFrameHeader = 0;
+    m_cbFrame = 0;
+    m_cFrames = 0;
+    m_iNextFrame = 0;
+    m_bHaveFrame = false;
+}
+
+
+//-------------------------------------------------------------------
+// IsY4mPath
+//
+// Returns true if the path has a .y4m extension.
+//-------------------------------------------------------------------
+
+bool Y4mFrameSource::IsY4mPath(const wchar_t *wszPath)
+{
+    const wchar_t wszExt[] = L".y4m";
+    const size_t cchExt = 4;
+
+    size_t cch = wcslen(wszPath);
+
+    if (cch < cchExt)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < cchExt; i++)
+    {
+        if ((wchar_t)towlower(wszPath[cch - cchExt + i]) != wszExt[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// FrameSource methods
+
+FRAME_STATUS Y4mFrameSource::GetFormat(FrameFormat *pFormat)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    pFormat->width = m_width;
+    pFormat->height = m_height;
+    pFormat->bTopDown = true;
+    pFormat->pictureLeft = 0;
+    pFormat->pictureTop = 0;
+    pFormat->pictureRight = (int32_t)m_width;
+    pFormat->pictureBottom = (int32_t)m_height;
+    pFormat->rotation = 0;
+
+    // Correct the picture for the pixel aspect ratio, as for Media
+    // Foundation sources: stretch, never shrink.
+    if (m_parNum > m_parDen)
+    {
+        pFormat->pictureRight = (int32_t)((uint64_t)m_width * m_parNum / m_parDen);
+    }
+    else if (m_parNum < m_parDen)
+    {
+        pFormat->pictureBottom = (int32_t)((uint64_t)m_height * m_parDen / m_parNum);
+    }
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::GetDuration(int64_t *phnsDuration)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    *phnsDuration = FrameTime(m_cFrames);
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::CanSeek(bool *pbCanSeek)
+{
+    *pbCanSeek = (m_pFile != NULL);
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::Seek(int64_t hnsPosition)
+{
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    if (hnsPosition < 0)
+    {
+        hnsPosition = 0;
+    }
+
+    int64_t iFrame = hnsPosition * m_fpsNum / (HNS_PER_SECOND * m_fpsDen);
+
+    if (iFrame > m_cFrames)
+    {
+        iFrame = m_cFrames;
+    }
+
+    // Land on the keyframe at or before the position.
+    if (m_cost.gopLength > 1)
+    {
+        iFrame -= iFrame % m_cost.gopLength;
+    }
+
+    m_bHaveFrame = false;
+
+    if (!Spin(m_cost.seekMicroseconds, m_bCancelled))
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    m_iNextFrame = iFrame;
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::ReadFrame(FrameView *pFrame, bool *pbFormatChanged)
+{
+    char szFrameHeader[MAX_HEADER_LENGTH];
+
+    *pbFormatChanged = false;
+
+    if (m_pFile == NULL)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (m_bCancelled)
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    if (m_iNextFrame >= m_cFrames)
+    {
+        return FRAME_END_OF_STREAM;
+    }
+
+    uint64_t offset = m_cbHeader + (uint64_t)m_iNextFrame * (m_cbFrameHeader + m_cbFrame);
+
+    if (!SeekFile(m_pFile, offset))
+    {
+        return FRAME_E_READ;
+    }
+
+    if (m_cbFrameHeader > 0)
+    {
+        size_t cch = ReadLine(m_pFile, szFrameHeader, sizeof(szFrameHeader));
+
+        if (cch != m_cbFrameHeader || strncmp(szFrameHeader, "FRAME", 5) != 0)
+        {
+            return FRAME_E_FORMAT;
+        }
+    }
+
+    m_bHaveFrame = false;
+
+    if (fread(&m_yuv[0], 1, (size_t)m_cbFrame, m_pFile) != m_cbFrame)
+    {
+        return FRAME_E_READ;
+    }
+
+    if (!Spin(m_cost.decodeMicroseconds, m_bCancelled))
+    {
+        return FRAME_E_CANCELLED;
+    }
+
+    m_bHaveFrame = true;
+
+    pFrame->pData = NULL;
+    pFrame->stride = 0;
+    pFrame->timestamp = FrameTime(m_iNextFrame);
+    pFrame->bKeyframe = (m_cost.gopLength <= 1) || (m_iNextFrame % m_cost.gopLength == 0);
+
+    ++m_iNextFrame;
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::ConvertFrame(FrameView *pFrame)
+{
+    if (!m_bHaveFrame)
+    {
+        return FRAME_E_READ;
+    }
+
+    // Allocated on first use: callers that convert in bands never need it.
+    try
+    {
+        m_bgra.resize((size_t)4 * m_width * m_height);
+    }
+    catch (std::bad_alloc&)
+    {
+        return FRAME_E_OUT_OF_MEMORY;
+    }
+
+    YuvImage image;
+
+    GetImage(&image);
+
+    ConvertYuvToBgra(image, YUV_MATRIX_BT601, &m_bgra[0], (int32_t)(4 * m_width), m_pPool);
+
+    pFrame->pData = &m_bgra[0];
+    pFrame->stride = (int32_t)(4 * m_width);
+
+    return FRAME_OK;
+}
+
+FRAME_STATUS Y4mFrameSource::ConvertRows(uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride)
+{
+    if (!m_bHaveFrame)
+    {
+        return FRAME_E_READ;
+    }
+
+    YuvImage image;
+
+    GetImage(&image);
+
+    ConvertYuvRowsToBgra(image, YUV_MATRIX_BT601, 0, firstRow, cRows, pDest, destStride, m_pPool);
+
+    return FRAME_OK;
+}
+
+
+/// Private methods
+
+//-------------------------------------------------------------------
+// GetImage
+//
+// Describes the planes of the current frame.
+//-------------------------------------------------------------------
+
+void Y4mFrameSource::GetImage(YuvImage *pImage) const
+{
+    const uint32_t cxChroma = (m_width + (1u << m_chromaShiftX) - 1) >> m_chromaShiftX;
+    const uint32_t cyChroma = (m_height + (1u << m_chromaShiftY) - 1) >> m_chromaShiftY;
+
+    pImage->width = m_width;
+    pImage->height = m_height;
+    pImage->pY = &m_yuv[0];
+    pImage->strideY = (int32_t)m_width;
+    pImage->pU = m_bMono ? NULL : pImage->pY + (size_t)m_width * m_height;
+    pImage->pV = m_bMono ? NULL : pImage->pU + (size_t)cxChroma * cyChroma;
+    pImage->strideUV = (int32_t)cxChroma;
+    pImage->chromaStep = 1;
+    pImage->chromaShiftX = m_chromaShiftX;
+    pImage->chromaShiftY = m_chromaShiftY;
+    pImage->bTopFieldOnly = false;
+}
+
+
+//-------------------------------------------------------------------
+// ParseHeader
+//
+// Reads the stream header and the header of the first frame.
+//-------------------------------------------------------------------
+
+FRAME_STATUS Y4mFrameSource::ParseHeader()
+{
+    char szLine[MAX_HEADER_LENGTH];
+
+    size_t cch = ReadLine(m_pFile, szLine, sizeof(szLine));
+
+    if (cch == 0 || strncmp(szLine, "YUV4MPEG2 ", 10) != 0)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+    m_cbHeader = cch;
+
+    szLine[cch - 1] = '\0';     // Newline.
+
+    char *pszToken = szLine + 10;
+
+    while (*pszToken)
+    {
+        char *pszEnd = strchr(pszToken, ' ');
+
+        if (pszEnd)
+        {
+            *pszEnd = '\0';
+        }
+
+        switch (pszToken[0])
+        {
+        case 'W':
+            m_width = (uint32_t)strtoul(pszToken + 1, NULL, 10);
+            break;
+
+        case 'H':
+            m_height = (uint32_t)strtoul(pszToken + 1, NULL, 10);
+            break;
+
+        case 'F':
+            if (!ParseRatio(pszToken + 1, &m_fpsNum, &m_fpsDen))
+            {
+                return FRAME_E_FORMAT;
+            }
+            break;
+
+        case 'A':
+            // "A0:0" means unknown; keep square pixels.
+            if (!ParseRatio(pszToken + 1, &m_parNum, &m_parDen))
+            {
+                m_parNum = m_parDen = 1;
+            }
+            break;
+
+        case 'C':
+            if (strncmp(pszToken + 1, "420", 3) == 0 &&
+                (pszToken[4] == '\0' || strcmp(pszToken + 4, "jpeg") == 0 ||
+                 strcmp(pszToken + 4, "paldv") == 0 || strcmp(pszToken + 4, "mpeg2") == 0))
+            {
+                m_chromaShiftX = 1;
+                m_chromaShiftY = 1;
+            }
+            else if (strcmp(pszToken + 1, "422") == 0)
+            {
+                m_chromaShiftX = 1;
+                m_chromaShiftY = 0;
+            }
+            else if (strcmp(pszToken + 1, "444") == 0)
+            {
+                m_chromaShiftX = 0;
+                m_chromaShiftY = 0;
+            }
+            else if (strcmp(pszToken + 1, "mono") == 0)
+            {
+                m_bMono = true;
+            }
+            else
+            {
+                return FRAME_E_FORMAT;  // High bit depth or alpha.
+            }
+            break;
+
+        default:
+            break;  // Interlacing, comments and extensions.
+        }
+
+        if (pszEnd == NULL)
+        {
+            break;
+        }
+        pszToken = pszEnd + 1;
+    }
+
+    if (m_fpsNum == 0)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+    // Every frame header is assumed to be as long as the first one.
+
+    cch = ReadLine(m_pFile, szLine, sizeof(szLine));
+
+    if (cch == 0)
+    {
+        // No frames. Assume the usual header.
+        m_cbFrameHeader = 6;
+    }
+    else if (strncmp(szLine, "FRAME", 5) != 0)
+    {
+        return FRAME_E_FORMAT;
+    }
+    else
+    {
+        m_cbFrameHeader = cch;
+    }
+
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// SetLayout
+//
+// Computes the frame size and count, and allocates the frame buffer.
+//-------------------------------------------------------------------
+
+FRAME_STATUS Y4mFrameSource::SetLayout()
+{
+    uint64_t cbFile = 0;
+
+    if (m_width == 0 || m_height == 0 || m_width > MAX_DIMENSION || m_height > MAX_DIMENSION)
+    {
+        return FRAME_E_FORMAT;
+    }
+
+    uint64_t cbLuma = (uint64_t)m_width * m_height;
+    uint64_t cbChroma = 0;
+
+    if (!m_bMono)
+    {
+        uint64_t cxChroma = (m_width + (1u << m_chromaShiftX) - 1) >> m_chromaShiftX;
+        uint64_t cyChroma = (m_height + (1u << m_chromaShiftY) - 1) >> m_chromaShiftY;
+
+        cbChroma = 2 * cxChroma * cyChroma;
+    }
+
+    m_cbFrame = cbLuma + cbChroma;
+
+    if (!GetFileSize(m_pFile, &cbFile))
+    {
+        return FRAME_E_READ;
+    }
+
+    m_cFrames = (cbFile > m_cbHeader) ? (int64_t)((cbFile - m_cbHeader) / (m_cbFrameHeader + m_cbFrame)) : 0;
+
+    m_yuv.resize((size_t)m_cbFrame);
+    m_bgra.clear();
+
+    return FRAME_OK;
+}
+
+
+//-------------------------------------------------------------------
+// FrameTime
+//
+// Returns the time stamp of a frame.
+//-------------------------------------------------------------------
+
+int64_t Y4mFrameSource::FrameTime(int64_t iFrame) const
+{
+    return iFrame * HNS_PER_SECOND * m_fpsDen / m_fpsNum;
+}
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Y4mFrameSource: Frame source for YUV4MPEG2 and raw I420 files.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+#include "framesource.h"
+#include "yuvconvert.h"
+
+// NOTE: Formats
+//
+// YUV4MPEG2 (.y4m): The stream header gives the size, frame rate, pixel
+// aspect ratio and chroma format (4:2:0, 4:2:2, 4:4:4 or mono). Every
+// frame is "FRAME", optional parameters, a newline and the planes. All
+// frame headers are assumed to have the length of the first one, which
+// holds for files written by common tools.
+//
+// Raw I420: No header; OpenRaw takes the size and frame rate.
+//
+// Frames are converted to BGRA with BT.601 limited-range coefficients.
+// The simulated costs (see FrameSourceCost) make decoding behave like a
+// long-GOP codec without needing one.
+
+class Y4mFrameSource : public FrameSource
+{
+    FILE                    *m_pFile;
+    uint32_t                m_width;
+    uint32_t                m_height;
+    uint32_t                m_fpsNum;
+    uint32_t                m_fpsDen;
+    uint32_t                m_parNum;
+    uint32_t                m_parDen;
+    uint32_t                m_chromaShiftX;     // log2 of the chroma subsampling.
+    uint32_t                m_chromaShiftY;
+    bool                    m_bMono;
+    uint64_t                m_cbHeader;         // Stream header.
+    uint64_t                m_cbFrameHeader;    // "FRAME...\n", or 0 for raw files.
+    uint64_t                m_cbFrame;          // Planes only.
+    int64_t                 m_cFrames;
+    int64_t                 m_iNextFrame;
+    bool                    m_bHaveFrame;       // m_yuv holds a frame.
+    FrameSourceCost         m_cost;
+    TaskPool                *m_pPool;           // Optional; for ConvertFrame.
+    std::atomic<bool>       m_bCancelled;       // Until the next Open.
+    std::vector<uint8_t>    m_yuv;
+    std::vector<uint8_t>    m_bgra;
+
+public:
+
+    Y4mFrameSource();
+    ~Y4mFrameSource();
+
+    FRAME_STATUS    Open(const char *szPath);
+    FRAME_STATUS    OpenRaw(const char *szPath, uint32_t width, uint32_t height, uint32_t fpsNum, uint32_t fpsDen);
+#ifdef _WIN32
+    FRAME_STATUS    Open(const wchar_t *wszPath);
+#endif
+    void            Close();
+
+    void            SetCost(const FrameSourceCost& cost) { m_cost = cost; }
+
+    int64_t         FrameCount() const { return m_cFrames; }
+
+    static bool     IsY4mPath(const wchar_t *wszPath);
+
+    // FrameSource
+    FRAME_STATUS    GetFormat(FrameFormat *pFormat);
+    FRAME_STATUS    GetDuration(int64_t *phnsDuration);
+    FRAME_STATUS    CanSeek(bool *pbCanSeek);
+    FRAME_STATUS    Seek(int64_t hnsPosition);
+    FRAME_STATUS    ReadFrame(FrameView *pFrame, bool *pbFormatChanged);
+    FRAME_STATUS    ConvertFrame(FrameView *pFrame);
+    bool            CanConvertRows() const { return true; }
+    FRAME_STATUS    ConvertRows(uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride);
+    void            SetTaskPool(TaskPool *pPool) { m_pPool = pPool; }
+    void            Cancel() { m_bCancelled = true; }
+
+private:
+    void            GetImage(YuvImage *pImage) const;
+    FRAME_STATUS    ParseHeader();
+    FRAME_STATUS    SetLayout();
+    int64_t         FrameTime(int64_t iFrame) const;
+};
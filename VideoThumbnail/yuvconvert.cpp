@@ -0,0 +1,1034 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// YUV to BGRA conversion for the frame sources.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "yuvconvert.h"
+#include "taskpool.h"
+
+#include <string.h>
+
+#if defined(VT_CPU_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable: 4752)  // AVX in a /arch:SSE2 build: those kernels only run after DetectCpuLevel.
+#endif
+
+// Fewest output pixels for each task when a conversion is split.
+const uint64_t MIN_TASK_PIXELS = 64 * 1024;
+
+// Output pixels that a reduced conversion averages before converting them.
+const uint32_t REDUCED_CHUNK = 256;
+
+// Coefficients scaled by 256: R = Y + rv*V, G = Y - gu*U - gv*V,
+// B = Y + bu*U, with Y scaled to full range by 298/256.
+struct YuvCoefficients
+{
+    int     rv;
+    int     gu;
+    int     gv;
+    int     bu;
+};
+
+static const YuvCoefficients COEFFICIENTS[] =
+{
+    { 409, 100, 208, 516 },     // BT.601
+    { 459,  55, 136, 541 },     // BT.709
+};
+
+// Packs two 16-bit coefficients for a multiply-add: lo * a + hi * b.
+static inline int32_t CoefficientPair(int lo, int hi)
+{
+    return (int32_t)(((uint32_t)(uint16_t)hi << 16) | (uint16_t)lo);
+}
+
+static inline uint8_t Clip(int v)
+{
+    return (uint8_t)((v < 0) ? 0 : (v > 255) ? 255 : v);
+}
+
+// Converts one pixel; d and e are the chroma samples less 128.
+static inline void WritePixel(const YuvCoefficients& k, int luma, int d, int e, uint8_t *pOut)
+{
+    int c = 298 * (luma - 16);
+
+    pOut[0] = Clip((c + k.bu * d + 128) >> 8);
+    pOut[1] = Clip((c - k.gu * d - k.gv * e + 128) >> 8);
+    pOut[2] = Clip((c + k.rv * e + 128) >> 8);
+    pOut[3] = 0xFF;
+}
+
+// The chroma row for a luma row. Chroma lines are interleaved by field
+// too.
+static inline uint32_t ChromaRow(const YuvImage& image, uint32_t yLuma)
+{
+    if (image.bTopFieldOnly && image.chromaShiftY > 0)
+    {
+        return (yLuma >> image.chromaShiftY) & ~1u;
+    }
+    return yLuma >> image.chromaShiftY;
+}
+
+
+// NOTE: Row kernels
+//
+// Full-size rows are converted by a kernel specialized for the chroma
+// layout, so the inner loop has no per-pixel tests of the format, and for
+// the instruction set (see cpulevel.h). Each layout below gives the
+// chroma of one pixel, and loads the chroma of 8, 16 or 32 pixels (less
+// 128, as 16-bit lanes) for the SSE2, AVX2 and AVX-512 kernels.
+//
+// The vector kernels do the same 32-bit arithmetic as WritePixel, so
+// every level gives exactly the same output. Pixels past the last whole
+// vector are converted by the scalar kernel.
+
+typedef void (*RowProc)(const YuvImage& image, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut);
+
+enum ROW_LAYOUT
+{
+    LAYOUT_MONO = 0,
+    LAYOUT_444,             // Planar, chroma at full width.
+    LAYOUT_HALF,            // Planar, chroma at half width (4:2:0, 4:2:2).
+    LAYOUT_NV12,            // Interleaved, chroma at half width.
+    LAYOUT_OTHER,           // Anything else, from the YuvImage at run time.
+    LAYOUT_COUNT
+};
+
+static ROW_LAYOUT LayoutOf(const YuvImage& image)
+{
+    if (image.pU == NULL)
+    {
+        return LAYOUT_MONO;
+    }
+
+    if (image.chromaStep == 1 && image.chromaShiftX == 0)
+    {
+        return LAYOUT_444;
+    }
+
+    if (image.chromaStep == 1 && image.chromaShiftX == 1)
+    {
+        return LAYOUT_HALF;
+    }
+
+    if (image.chromaStep == 2 && image.chromaShiftX == 1 && image.pV == image.pU + 1)
+    {
+        return LAYOUT_NV12;
+    }
+
+    return LAYOUT_OTHER;
+}
+
+#if defined(VT_CPU_X86)
+
+// The chroma of 8 pixels, duplicated from 4 samples.
+VT_TARGET_SSE2 static inline __m128i DoubleSse2(const uint8_t *pSamples)
+{
+    int32_t samples;
+
+    memcpy(&samples, pSamples, sizeof(samples));
+
+    __m128i v = _mm_cvtsi32_si128(samples);
+
+    return _mm_unpacklo_epi8(_mm_unpacklo_epi8(v, v), _mm_setzero_si128());
+}
+
+// Splits 16-bit lanes of interleaved UV into U and V, each duplicated
+// to two lanes.
+VT_TARGET_SSE2 static inline void SplitSse2(__m128i uv, __m128i *pU, __m128i *pV)
+{
+    const __m128i u = _mm_and_si128(uv, _mm_set1_epi32(0xFFFF));
+    const __m128i v = _mm_srli_epi32(uv, 16);
+
+    *pU = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+    *pV = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+}
+
+VT_TARGET_AVX2 static inline void SplitAvx2(__m256i uv, __m256i *pU, __m256i *pV)
+{
+    const __m256i u = _mm256_and_si256(uv, _mm256_set1_epi32(0xFFFF));
+    const __m256i v = _mm256_srli_epi32(uv, 16);
+
+    *pU = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+    *pV = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+}
+
+#if defined(VT_CPU_AVX512)
+VT_TARGET_AVX512 static inline void SplitAvx512(__m512i uv, __m512i *pU, __m512i *pV)
+{
+    const __m512i u = _mm512_and_si512(uv, _mm512_set1_epi32(0xFFFF));
+    const __m512i v = _mm512_srli_epi32(uv, 16);
+
+    *pU = _mm512_or_si512(u, _mm512_slli_epi32(u, 16));
+    *pV = _mm512_or_si512(v, _mm512_slli_epi32(v, 16));
+}
+#endif
+
+#endif // VT_CPU_X86
+
+struct MonoLayout
+{
+    static inline void Chroma(const YuvImage&, const uint8_t*, const uint8_t*, uint32_t, int *pd, int *pe)
+    {
+        *pd = 0;
+        *pe = 0;
+    }
+
+#if defined(VT_CPU_X86)
+    VT_TARGET_SSE2 static inline void Load8(const uint8_t*, const uint8_t*, uint32_t, __m128i *pd, __m128i *pe)
+    {
+        *pd = _mm_setzero_si128();
+        *pe = _mm_setzero_si128();
+    }
+
+    VT_TARGET_AVX2 static inline void Load16(const uint8_t*, const uint8_t*, uint32_t, __m256i *pd, __m256i *pe)
+    {
+        *pd = _mm256_setzero_si256();
+        *pe = _mm256_setzero_si256();
+    }
+
+#if defined(VT_CPU_AVX512)
+    VT_TARGET_AVX512 static inline void Load32(const uint8_t*, const uint8_t*, uint32_t, __m512i *pd, __m512i *pe)
+    {
+        *pd = _mm512_setzero_si512();
+        *pe = _mm512_setzero_si512();
+    }
+#endif
+#endif
+};
+
+struct Layout444
+{
+    static inline void Chroma(const YuvImage&, const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        int *pd, int *pe)
+    {
+        *pd = pRowU[x] - 128;
+        *pe = pRowV[x] - 128;
+    }
+
+#if defined(VT_CPU_X86)
+    VT_TARGET_SSE2 static inline void Load8(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m128i *pd, __m128i *pe)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+
+        *pd = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRowU + x)), zero), bias);
+        *pe = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRowV + x)), zero), bias);
+    }
+
+    VT_TARGET_AVX2 static inline void Load16(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m256i *pd, __m256i *pe)
+    {
+        const __m256i bias = _mm256_set1_epi16(128);
+
+        *pd = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pRowU + x))), bias);
+        *pe = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pRowV + x))), bias);
+    }
+
+#if defined(VT_CPU_AVX512)
+    VT_TARGET_AVX512 static inline void Load32(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m512i *pd, __m512i *pe)
+    {
+        const __m512i bias = _mm512_set1_epi16(128);
+
+        *pd = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(pRowU + x))), bias);
+        *pe = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(pRowV + x))), bias);
+    }
+#endif
+#endif
+};
+
+struct HalfLayout
+{
+    static inline void Chroma(const YuvImage&, const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        int *pd, int *pe)
+    {
+        *pd = pRowU[x >> 1] - 128;
+        *pe = pRowV[x >> 1] - 128;
+    }
+
+#if defined(VT_CPU_X86)
+    VT_TARGET_SSE2 static inline void Load8(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m128i *pd, __m128i *pe)
+    {
+        const __m128i bias = _mm_set1_epi16(128);
+
+        *pd = _mm_sub_epi16(DoubleSse2(pRowU + (x >> 1)), bias);
+        *pe = _mm_sub_epi16(DoubleSse2(pRowV + (x >> 1)), bias);
+    }
+
+    VT_TARGET_AVX2 static inline void Load16(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m256i *pd, __m256i *pe)
+    {
+        const __m256i bias = _mm256_set1_epi16(128);
+        const __m128i u = _mm_loadl_epi64((const __m128i*)(pRowU + (x >> 1)));
+        const __m128i v = _mm_loadl_epi64((const __m128i*)(pRowV + (x >> 1)));
+
+        *pd = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u, u)), bias);
+        *pe = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v, v)), bias);
+    }
+
+#if defined(VT_CPU_AVX512)
+    VT_TARGET_AVX512 static inline __m512i Double32(const uint8_t *pSamples)
+    {
+        const __m128i s = _mm_loadu_si128((const __m128i*)pSamples);
+        const __m256i doubled = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(s, s)),
+            _mm_unpackhi_epi8(s, s), 1);
+
+        return _mm512_sub_epi16(_mm512_cvtepu8_epi16(doubled), _mm512_set1_epi16(128));
+    }
+
+    VT_TARGET_AVX512 static inline void Load32(const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        __m512i *pd, __m512i *pe)
+    {
+        *pd = Double32(pRowU + (x >> 1));
+        *pe = Double32(pRowV + (x >> 1));
+    }
+#endif
+#endif
+};
+
+struct Nv12Layout
+{
+    static inline void Chroma(const YuvImage&, const uint8_t *pRowU, const uint8_t*, uint32_t x,
+        int *pd, int *pe)
+    {
+        const uint8_t *pUV = pRowU + (x & ~1u);
+
+        *pd = pUV[0] - 128;
+        *pe = pUV[1] - 128;
+    }
+
+#if defined(VT_CPU_X86)
+    VT_TARGET_SSE2 static inline void Load8(const uint8_t *pRowU, const uint8_t*, uint32_t x,
+        __m128i *pd, __m128i *pe)
+    {
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRowU + x)), _mm_setzero_si128());
+
+        SplitSse2(uv, pd, pe);
+
+        *pd = _mm_sub_epi16(*pd, bias);
+        *pe = _mm_sub_epi16(*pe, bias);
+    }
+
+    VT_TARGET_AVX2 static inline void Load16(const uint8_t *pRowU, const uint8_t*, uint32_t x,
+        __m256i *pd, __m256i *pe)
+    {
+        const __m256i bias = _mm256_set1_epi16(128);
+
+        SplitAvx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pRowU + x))), pd, pe);
+
+        *pd = _mm256_sub_epi16(*pd, bias);
+        *pe = _mm256_sub_epi16(*pe, bias);
+    }
+
+#if defined(VT_CPU_AVX512)
+    VT_TARGET_AVX512 static inline void Load32(const uint8_t *pRowU, const uint8_t*, uint32_t x,
+        __m512i *pd, __m512i *pe)
+    {
+        const __m512i bias = _mm512_set1_epi16(128);
+
+        SplitAvx512(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(pRowU + x))), pd, pe);
+
+        *pd = _mm512_sub_epi16(*pd, bias);
+        *pe = _mm512_sub_epi16(*pe, bias);
+    }
+#endif
+#endif
+};
+
+// Any other layout, with no vector kernels.
+struct OtherLayout
+{
+    static inline void Chroma(const YuvImage& image, const uint8_t *pRowU, const uint8_t *pRowV, uint32_t x,
+        int *pd, int *pe)
+    {
+        size_t i = (size_t)(x >> image.chromaShiftX) * image.chromaStep;
+
+        *pd = pRowU[i] - 128;
+        *pe = pRowV[i] - 128;
+    }
+};
+
+// Converts pixels [x, width) of a row.
+template <class Layout>
+static inline void ConvertPixels(const YuvImage& image, uint32_t x, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut)
+{
+    for (pOut += 4 * (size_t)x; x < image.width; x++)
+    {
+        int d;
+        int e;
+
+        Layout::Chroma(image, pRowU, pRowV, x, &d, &e);
+
+        WritePixel(k, pRowY[x], d, e, pOut);
+        pOut += 4;
+    }
+}
+
+template <class Layout>
+static void ConvertRowScalar(const YuvImage& image, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut)
+{
+    ConvertPixels<Layout>(image, 0, pRowY, pRowU, pRowV, k, pOut);
+}
+
+#if defined(VT_CPU_X86)
+
+// Converts 8 pixels from luma less 16, and chroma less 128.
+VT_TARGET_SSE2 static inline void WritePixelsSse2(const YuvCoefficients& k, __m128i y, __m128i d, __m128i e,
+    uint8_t *pOut)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i kB = _mm_set1_epi32(CoefficientPair(298, k.bu));
+    const __m128i kG = _mm_set1_epi32(CoefficientPair(298, -k.gu));
+    const __m128i kGV = _mm_set1_epi32(CoefficientPair(-k.gv, 0));
+    const __m128i kR = _mm_set1_epi32(CoefficientPair(298, k.rv));
+
+    const __m128i ydLo = _mm_unpacklo_epi16(y, d);
+    const __m128i ydHi = _mm_unpackhi_epi16(y, d);
+    const __m128i yeLo = _mm_unpacklo_epi16(y, e);
+    const __m128i yeHi = _mm_unpackhi_epi16(y, e);
+    const __m128i eLo = _mm_unpacklo_epi16(e, zero);
+    const __m128i eHi = _mm_unpackhi_epi16(e, zero);
+
+    __m128i b = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydLo, kB), round), 8),
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydHi, kB), round), 8));
+    __m128i g = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(ydLo, kG), _mm_madd_epi16(eLo, kGV)), round), 8),
+        _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(ydHi, kG), _mm_madd_epi16(eHi, kGV)), round), 8));
+    __m128i r = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yeLo, kR), round), 8),
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yeHi, kR), round), 8));
+
+    const __m128i max = _mm_set1_epi16(255);
+
+    b = _mm_min_epi16(_mm_max_epi16(b, zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(g, zero), max);
+    r = _mm_min_epi16(_mm_max_epi16(r, zero), max);
+
+    const __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    const __m128i ra = _mm_or_si128(r, _mm_set1_epi16((short)0xFF00));
+
+    _mm_storeu_si128((__m128i*)pOut, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i*)(pOut + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+template <class Layout>
+VT_TARGET_SSE2 static void ConvertRowSse2(const YuvImage& image, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i black = _mm_set1_epi16(16);
+
+    uint32_t x = 0;
+
+    for (; x + 8 <= image.width; x += 8)
+    {
+        __m128i d;
+        __m128i e;
+
+        Layout::Load8(pRowU, pRowV, x, &d, &e);
+
+        __m128i y = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRowY + x)), zero), black);
+
+        WritePixelsSse2(k, y, d, e, pOut + 4 * (size_t)x);
+    }
+
+    ConvertPixels<Layout>(image, x, pRowY, pRowU, pRowV, k, pOut);
+}
+
+// Converts 16 pixels. The unpacks and packs work within 128-bit lanes,
+// and undo each other, so only the final interleave crosses lanes.
+VT_TARGET_AVX2 static inline void WritePixelsAvx2(const YuvCoefficients& k, __m256i y, __m256i d, __m256i e,
+    uint8_t *pOut)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i kB = _mm256_set1_epi32(CoefficientPair(298, k.bu));
+    const __m256i kG = _mm256_set1_epi32(CoefficientPair(298, -k.gu));
+    const __m256i kGV = _mm256_set1_epi32(CoefficientPair(-k.gv, 0));
+    const __m256i kR = _mm256_set1_epi32(CoefficientPair(298, k.rv));
+
+    const __m256i ydLo = _mm256_unpacklo_epi16(y, d);
+    const __m256i ydHi = _mm256_unpackhi_epi16(y, d);
+    const __m256i yeLo = _mm256_unpacklo_epi16(y, e);
+    const __m256i yeHi = _mm256_unpackhi_epi16(y, e);
+    const __m256i eLo = _mm256_unpacklo_epi16(e, zero);
+    const __m256i eHi = _mm256_unpackhi_epi16(e, zero);
+
+    __m256i b = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydLo, kB), round), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydHi, kB), round), 8));
+    __m256i g = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydLo, kG),
+            _mm256_madd_epi16(eLo, kGV)), round), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydHi, kG),
+            _mm256_madd_epi16(eHi, kGV)), round), 8));
+    __m256i r = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yeLo, kR), round), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yeHi, kR), round), 8));
+
+    const __m256i max = _mm256_set1_epi16(255);
+
+    b = _mm256_min_epi16(_mm256_max_epi16(b, zero), max);
+    g = _mm256_min_epi16(_mm256_max_epi16(g, zero), max);
+    r = _mm256_min_epi16(_mm256_max_epi16(r, zero), max);
+
+    const __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+    const __m256i ra = _mm256_or_si256(r, _mm256_set1_epi16((short)0xFF00));
+    const __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+    const __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+
+    _mm256_storeu_si256((__m256i*)pOut, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(pOut + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+template <class Layout>
+VT_TARGET_AVX2 static void ConvertRowAvx2(const YuvImage& image, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut)
+{
+    const __m256i black = _mm256_set1_epi16(16);
+
+    uint32_t x = 0;
+
+    for (; x + 16 <= image.width; x += 16)
+    {
+        __m256i d;
+        __m256i e;
+
+        Layout::Load16(pRowU, pRowV, x, &d, &e);
+
+        __m256i y = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pRowY + x))), black);
+
+        WritePixelsAvx2(k, y, d, e, pOut + 4 * (size_t)x);
+    }
+
+    ConvertPixels<Layout>(image, x, pRowY, pRowU, pRowV, k, pOut);
+}
+
+#if defined(VT_CPU_AVX512)
+
+// Converts 32 pixels, as WritePixelsAvx2 does.
+VT_TARGET_AVX512 static inline void WritePixelsAvx512(const YuvCoefficients& k, __m512i y, __m512i d, __m512i e,
+    uint8_t *pOut)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i round = _mm512_set1_epi32(128);
+    const __m512i kB = _mm512_set1_epi32(CoefficientPair(298, k.bu));
+    const __m512i kG = _mm512_set1_epi32(CoefficientPair(298, -k.gu));
+    const __m512i kGV = _mm512_set1_epi32(CoefficientPair(-k.gv, 0));
+    const __m512i kR = _mm512_set1_epi32(CoefficientPair(298, k.rv));
+
+    const __m512i ydLo = _mm512_unpacklo_epi16(y, d);
+    const __m512i ydHi = _mm512_unpackhi_epi16(y, d);
+    const __m512i yeLo = _mm512_unpacklo_epi16(y, e);
+    const __m512i yeHi = _mm512_unpackhi_epi16(y, e);
+    const __m512i eLo = _mm512_unpacklo_epi16(e, zero);
+    const __m512i eHi = _mm512_unpackhi_epi16(e, zero);
+
+    __m512i b = _mm512_packs_epi32(
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(ydLo, kB), round), 8),
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(ydHi, kB), round), 8));
+    __m512i g = _mm512_packs_epi32(
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_add_epi32(_mm512_madd_epi16(ydLo, kG),
+            _mm512_madd_epi16(eLo, kGV)), round), 8),
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_add_epi32(_mm512_madd_epi16(ydHi, kG),
+            _mm512_madd_epi16(eHi, kGV)), round), 8));
+    __m512i r = _mm512_packs_epi32(
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(yeLo, kR), round), 8),
+        _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(yeHi, kR), round), 8));
+
+    const __m512i max = _mm512_set1_epi16(255);
+
+    b = _mm512_min_epi16(_mm512_max_epi16(b, zero), max);
+    g = _mm512_min_epi16(_mm512_max_epi16(g, zero), max);
+    r = _mm512_min_epi16(_mm512_max_epi16(r, zero), max);
+
+    const __m512i bg = _mm512_or_si512(b, _mm512_slli_epi16(g, 8));
+    const __m512i ra = _mm512_or_si512(r, _mm512_set1_epi16((short)0xFF00));
+    const __m512i lo = _mm512_unpacklo_epi16(bg, ra);
+    const __m512i hi = _mm512_unpackhi_epi16(bg, ra);
+
+    // 64-bit halves of the 128-bit lanes of lo (0-7) and hi (8-15).
+    const __m512i first = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+    _mm512_storeu_si512((void*)pOut, _mm512_permutex2var_epi64(lo, first, hi));
+    _mm512_storeu_si512((void*)(pOut + 64), _mm512_permutex2var_epi64(lo, second, hi));
+}
+
+template <class Layout>
+VT_TARGET_AVX512 static void ConvertRowAvx512(const YuvImage& image, const uint8_t *pRowY, const uint8_t *pRowU,
+    const uint8_t *pRowV, const YuvCoefficients& k, uint8_t *pOut)
+{
+    const __m512i black = _mm512_set1_epi16(16);
+
+    uint32_t x = 0;
+
+    for (; x + 32 <= image.width; x += 32)
+    {
+        __m512i d;
+        __m512i e;
+
+        Layout::Load32(pRowU, pRowV, x, &d, &e);
+
+        __m512i y = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(pRowY + x))), black);
+
+        WritePixelsAvx512(k, y, d, e, pOut + 4 * (size_t)x);
+    }
+
+    ConvertPixels<Layout>(image, x, pRowY, pRowU, pRowV, k, pOut);
+}
+
+#define ConvertRowWide ConvertRowAvx512
+#else
+#define ConvertRowWide ConvertRowAvx2
+#endif // VT_CPU_AVX512
+
+#else
+#define ConvertRowSse2 ConvertRowScalar
+#define ConvertRowAvx2 ConvertRowScalar
+#define ConvertRowWide ConvertRowScalar
+#endif // VT_CPU_X86
+
+// Kernels by level and layout. Levels that the build or the processor
+// lacks are never selected.
+static const RowProc ROW_PROCS[CPU_LEVEL_COUNT][LAYOUT_COUNT] =
+{
+    {
+        ConvertRowScalar<MonoLayout>, ConvertRowScalar<Layout444>, ConvertRowScalar<HalfLayout>,
+        ConvertRowScalar<Nv12Layout>, ConvertRowScalar<OtherLayout>
+    },
+    {
+        ConvertRowSse2<MonoLayout>, ConvertRowSse2<Layout444>, ConvertRowSse2<HalfLayout>,
+        ConvertRowSse2<Nv12Layout>, ConvertRowScalar<OtherLayout>
+    },
+    {
+        ConvertRowAvx2<MonoLayout>, ConvertRowAvx2<Layout444>, ConvertRowAvx2<HalfLayout>,
+        ConvertRowAvx2<Nv12Layout>, ConvertRowScalar<OtherLayout>
+    },
+    {
+        ConvertRowWide<MonoLayout>, ConvertRowWide<Layout444>, ConvertRowWide<HalfLayout>,
+        ConvertRowWide<Nv12Layout>, ConvertRowScalar<OtherLayout>
+    },
+};
+
+// Chosen at startup; see SetYuvCpuLevel.
+static CPU_LEVEL g_yuvCpuLevel = DetectCpuLevel();
+
+
+// Converts rows of the image at full size.
+static void ConvertRows(const YuvImage& image, const YuvCoefficients& k, RowProc proc, uint32_t firstRow,
+    uint32_t cRows, uint8_t *pDest, int32_t destStride)
+{
+    for (uint32_t y = firstRow; y < firstRow + cRows; y++)
+    {
+        uint32_t ySource = image.bTopFieldOnly ? (y & ~1u) : y;
+        uint32_t yChroma = ChromaRow(image, ySource);
+
+        const uint8_t *pRowY = image.pY + (ptrdiff_t)ySource * image.strideY;
+        const uint8_t *pRowU = NULL;
+        const uint8_t *pRowV = NULL;
+
+        if (image.pU)
+        {
+            pRowU = image.pU + (ptrdiff_t)yChroma * image.strideUV;
+            pRowV = image.pV + (ptrdiff_t)yChroma * image.strideUV;
+        }
+
+        proc(image, pRowY, pRowU, pRowV, k, pDest + (ptrdiff_t)(y - firstRow) * destStride);
+    }
+}
+
+
+// NOTE: Reduced rows
+//
+// A reduced row is converted in chunks of up to REDUCED_CHUNK pixels.
+// The luma of each line of the blocks is added up in pairs of samples;
+// the pair sums are then added up into blocks and averaged, and the
+// chroma of each block's first sample gathered, into rows of a 4:4:4 (or
+// monochrome) image, which the full-size kernel for that layout converts.
+// Every step is exact integer arithmetic, so each level gives the same
+// output as WritePixel on each block.
+
+// Adds the sums of cPairs pairs of samples of a line to pPairs.
+static void AddPairSums(const uint8_t *pLine, uint32_t x, uint32_t cPairs, uint16_t *pPairs)
+{
+    for (; x < cPairs; x++)
+    {
+        pPairs[x] = (uint16_t)(pPairs[x] + pLine[2 * x] + pLine[2 * x + 1]);
+    }
+}
+
+// Averages blocks of 2^(shift - 1) pair sums into luma samples
+// [x, count), with 2^blockShift samples in each block.
+static void AverageBlocks(const uint16_t *pPairs, uint32_t shift, uint32_t blockShift, uint32_t x, uint32_t count,
+    uint8_t *pRowY)
+{
+    const uint32_t cPairs = 1u << (shift - 1);
+    const uint32_t round = (1u << blockShift) >> 1;
+
+    for (; x < count; x++)
+    {
+        uint32_t sum = 0;
+
+        for (uint32_t i = 0; i < cPairs; i++)
+        {
+            sum += pPairs[x * cPairs + i];
+        }
+
+        pRowY[x] = (uint8_t)((sum + round) >> blockShift);
+    }
+}
+
+// Gathers the chroma of the first sample of blocks [x, count), starting
+// from the block at x0.
+static void GatherChroma(const YuvImage& image, const uint8_t *pRowU, const uint8_t *pRowV, uint32_t shift,
+    uint32_t x0, uint32_t x, uint32_t count, uint8_t *pU, uint8_t *pV)
+{
+    for (; x < count; x++)
+    {
+        size_t i = (size_t)(((x0 + x) << shift) >> image.chromaShiftX) * image.chromaStep;
+
+        pU[x] = pRowU[i];
+        pV[x] = pRowV[i];
+    }
+}
+
+#if defined(VT_CPU_X86)
+
+VT_TARGET_SSE2 static void AddPairSumsSse2(const uint8_t *pLine, uint32_t cPairs, uint16_t *pPairs)
+{
+    const __m128i mask = _mm_set1_epi16(0xFF);
+
+    uint32_t x = 0;
+
+    for (; x + 8 <= cPairs; x += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pLine + 2 * (size_t)x));
+        const __m128i sums = _mm_add_epi16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8));
+
+        _mm_storeu_si128((__m128i*)(pPairs + x), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pPairs + x)), sums));
+    }
+
+    AddPairSums(pLine, x, cPairs, pPairs);
+}
+
+// Adds up adjacent 16-bit lanes of a and b: four sums from each.
+VT_TARGET_SSE2 static inline __m128i AddLanePairs(__m128i a, __m128i b)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+
+    return _mm_packs_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+}
+
+VT_TARGET_SSE2 static void AverageBlocksSse2(const uint16_t *pPairs, uint32_t shift, uint32_t blockShift,
+    uint32_t count, uint8_t *pRowY)
+{
+    const __m128i round = _mm_set1_epi16((short)((1u << blockShift) >> 1));
+    const __m128i blockShiftBits = _mm_cvtsi32_si128((int)blockShift);
+    const uint32_t cPairs = 1u << (shift - 1);
+
+    uint32_t x = 0;
+
+    // Block sums are at most 64 * 255, so they fit in signed 16-bit lanes.
+    for (; x + 8 <= count; x += 8)
+    {
+        const __m128i *p = (const __m128i*)(pPairs + (size_t)x * cPairs);
+        __m128i sums;
+
+        if (shift == 1)
+        {
+            sums = _mm_loadu_si128(p);
+        }
+        else if (shift == 2)
+        {
+            sums = AddLanePairs(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+        }
+        else
+        {
+            sums = AddLanePairs(AddLanePairs(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                AddLanePairs(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+        }
+
+        sums = _mm_srl_epi16(_mm_add_epi16(sums, round), blockShiftBits);
+
+        _mm_storel_epi64((__m128i*)(pRowY + x), _mm_packus_epi16(sums, sums));
+    }
+
+    AverageBlocks(pPairs, shift, blockShift, x, count, pRowY);
+}
+
+// Gathers chroma as GatherChroma does. When the samples to gather are
+// adjacent pairs of an NV12 plane, they are split into U and V 8 at a
+// time.
+VT_TARGET_SSE2 static void GatherChromaSse2(const YuvImage& image, const uint8_t *pRowU, const uint8_t *pRowV,
+    uint32_t shift, uint32_t x0, uint32_t count, uint8_t *pU, uint8_t *pV)
+{
+    uint32_t x = 0;
+
+    if (image.chromaStep == 2 && image.pV == image.pU + 1 && shift == image.chromaShiftX)
+    {
+        const __m128i mask = _mm_set1_epi16(0xFF);
+        const uint8_t *pUV = pRowU + 2 * (size_t)x0;
+
+        for (; x + 8 <= count; x += 8)
+        {
+            const __m128i uv = _mm_loadu_si128((const __m128i*)(pUV + 2 * (size_t)x));
+            const __m128i u = _mm_and_si128(uv, mask);
+            const __m128i v = _mm_srli_epi16(uv, 8);
+
+            _mm_storel_epi64((__m128i*)(pU + x), _mm_packus_epi16(u, u));
+            _mm_storel_epi64((__m128i*)(pV + x), _mm_packus_epi16(v, v));
+        }
+    }
+
+    GatherChroma(image, pRowU, pRowV, shift, x0, x, count, pU, pV);
+}
+
+#else
+#define AddPairSumsSse2(pLine, cPairs, pPairs) AddPairSums(pLine, 0, cPairs, pPairs)
+#define AverageBlocksSse2(pPairs, shift, blockShift, count, pRowY) \
+    AverageBlocks(pPairs, shift, blockShift, 0, count, pRowY)
+#define GatherChromaSse2(image, pRowU, pRowV, shift, x0, count, pU, pV) \
+    GatherChroma(image, pRowU, pRowV, shift, x0, 0, count, pU, pV)
+#endif // VT_CPU_X86
+
+
+// Converts rows of the image reduced by shift, which is at least 1; see
+// Reduced rows. proc is the full-size kernel for 4:4:4 images, or for
+// monochrome ones.
+static void ConvertRowsReduced(const YuvImage& image, const YuvCoefficients& k, RowProc proc, uint32_t shift,
+    uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride)
+{
+    const uint32_t cxOut = image.width >> shift;
+
+    // A block of the top field has half as many lines, two lines apart.
+    const uint32_t cyBlock = image.bTopFieldOnly ? (1u << (shift - 1)) : (1u << shift);
+    const uint32_t lineStep = image.bTopFieldOnly ? 2 : 1;
+    const uint32_t blockShift = shift + (image.bTopFieldOnly ? shift - 1 : shift);
+
+    const bool bSimd = (g_yuvCpuLevel >= CPU_LEVEL_SSE2);
+
+    uint16_t pairs[REDUCED_CHUNK * 4];
+    uint8_t rowY[REDUCED_CHUNK];
+    uint8_t rowU[REDUCED_CHUNK];
+    uint8_t rowV[REDUCED_CHUNK];
+
+    YuvImage chunk = image;
+
+    chunk.chromaStep = 1;
+    chunk.chromaShiftX = 0;
+
+    for (uint32_t y = firstRow; y < firstRow + cRows; y++)
+    {
+        const uint32_t yTop = y << shift;
+        const uint8_t *pBlockY = image.pY + (ptrdiff_t)yTop * image.strideY;
+        const uint8_t *pRowU = NULL;
+        const uint8_t *pRowV = NULL;
+
+        if (image.pU)
+        {
+            pRowU = image.pU + (ptrdiff_t)ChromaRow(image, yTop) * image.strideUV;
+            pRowV = image.pV + (ptrdiff_t)ChromaRow(image, yTop) * image.strideUV;
+        }
+
+        uint8_t *pOut = pDest + (ptrdiff_t)(y - firstRow) * destStride;
+
+        for (uint32_t x0 = 0; x0 < cxOut; x0 += REDUCED_CHUNK)
+        {
+            const uint32_t count = (cxOut - x0 < REDUCED_CHUNK) ? cxOut - x0 : REDUCED_CHUNK;
+            const uint32_t cPairs = count << (shift - 1);
+            const uint8_t *pLine = pBlockY + ((size_t)x0 << shift);
+
+            memset(pairs, 0, cPairs * sizeof(pairs[0]));
+
+            for (uint32_t j = 0; j < cyBlock; j++)
+            {
+                if (bSimd)
+                {
+                    AddPairSumsSse2(pLine, cPairs, pairs);
+                }
+                else
+                {
+                    AddPairSums(pLine, 0, cPairs, pairs);
+                }
+                pLine += (ptrdiff_t)lineStep * image.strideY;
+            }
+
+            if (bSimd)
+            {
+                AverageBlocksSse2(pairs, shift, blockShift, count, rowY);
+            }
+            else
+            {
+                AverageBlocks(pairs, shift, blockShift, 0, count, rowY);
+            }
+
+            if (pRowU && bSimd)
+            {
+                GatherChromaSse2(image, pRowU, pRowV, shift, x0, count, rowU, rowV);
+            }
+            else if (pRowU)
+            {
+                GatherChroma(image, pRowU, pRowV, shift, x0, 0, count, rowU, rowV);
+            }
+
+            chunk.width = count;
+
+            proc(chunk, rowY, rowU, rowV, k, pOut + 4 * (size_t)x0);
+        }
+    }
+}
+
+
+// A conversion split into bands of rows, one for each task.
+struct RowTask
+{
+    const YuvImage          *pImage;
+    const YuvCoefficients   *pCoefficients;
+    RowProc                 proc;           // For the image, or for its reduced rows.
+    uint32_t                shift;
+    uint32_t                firstRow;
+    uint32_t                cRows;
+    uint8_t                 *pDest;
+    int32_t                 destStride;
+    uint32_t                cTasks;
+};
+
+static void RunRowTask(void *pContext, uint32_t iTask)
+{
+    const RowTask *pTask = (const RowTask*)pContext;
+
+    uint32_t first = (uint32_t)((uint64_t)pTask->cRows * iTask / pTask->cTasks);
+    uint32_t last = (uint32_t)((uint64_t)pTask->cRows * (iTask + 1) / pTask->cTasks);
+    uint8_t *pDest = pTask->pDest + (ptrdiff_t)first * pTask->destStride;
+
+    if (pTask->shift == 0)
+    {
+        ConvertRows(*pTask->pImage, *pTask->pCoefficients, pTask->proc, pTask->firstRow + first, last - first,
+            pDest, pTask->destStride);
+    }
+    else
+    {
+        ConvertRowsReduced(*pTask->pImage, *pTask->pCoefficients, pTask->proc, pTask->shift,
+            pTask->firstRow + first, last - first, pDest, pTask->destStride);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// ConvertYuvToBgra
+//
+// Converts a limited-range YUV image to BGRA.
+//-------------------------------------------------------------------
+
+void ConvertYuvToBgra(const YuvImage& image, YUV_MATRIX matrix, uint8_t *pDest, int32_t destStride,
+    TaskPool *pPool)
+{
+    ConvertYuvRowsToBgra(image, matrix, 0, 0, image.height, pDest, destStride, pPool);
+}
+
+
+//-------------------------------------------------------------------
+// ConvertYuvToBgraReduced
+//
+// Converts a limited-range YUV image to BGRA at 1/2^shift of its size.
+//-------------------------------------------------------------------
+
+void ConvertYuvToBgraReduced(const YuvImage& image, YUV_MATRIX matrix, uint32_t shift,
+    uint8_t *pDest, int32_t destStride, TaskPool *pPool)
+{
+    ConvertYuvRowsToBgra(image, matrix, shift, 0, image.height >> shift, pDest, destStride, pPool);
+}
+
+
+//-------------------------------------------------------------------
+// ConvertYuvRowsToBgra
+//
+// Converts some rows of a limited-range YUV image to BGRA at 1/2^shift
+// of its size.
+//-------------------------------------------------------------------
+
+void ConvertYuvRowsToBgra(const YuvImage& image, YUV_MATRIX matrix, uint32_t shift,
+    uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride, TaskPool *pPool)
+{
+    const uint32_t cyOut = image.height >> shift;
+
+    if (firstRow >= cyOut)
+    {
+        return;
+    }
+
+    if (cRows > cyOut - firstRow)
+    {
+        cRows = cyOut - firstRow;
+    }
+
+    // Reduced rows are converted from 4:4:4 (or monochrome) rows.
+    ROW_LAYOUT layout = LayoutOf(image);
+
+    if (shift > 0)
+    {
+        layout = (image.pU == NULL) ? LAYOUT_MONO : LAYOUT_444;
+    }
+
+    RowTask task = { &image, &COEFFICIENTS[matrix], ROW_PROCS[g_yuvCpuLevel][layout], shift,
+        firstRow, cRows, pDest, destStride, 1 };
+
+    task.cTasks = TaskPool::TaskCount(pPool, (uint64_t)cRows * (image.width >> shift), MIN_TASK_PIXELS);
+
+    if (task.cTasks > 1)
+    {
+        pPool->Run(task.cTasks, RunRowTask, &task);
+    }
+    else
+    {
+        RunRowTask(&task, 0);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// YuvCpuLevel
+//
+// Returns the instruction set that the conversions use.
+//-------------------------------------------------------------------
+
+CPU_LEVEL YuvCpuLevel()
+{
+    return g_yuvCpuLevel;
+}
+
+
+//-------------------------------------------------------------------
+// SetYuvCpuLevel
+//
+// Limits the conversions to an instruction set, or to the best one that
+// the processor supports if that is lower. Returns the level used.
+//-------------------------------------------------------------------
+
+CPU_LEVEL SetYuvCpuLevel(CPU_LEVEL level)
+{
+    const CPU_LEVEL detected = DetectCpuLevel();
+
+    g_yuvCpuLevel = (level < detected) ? level : detected;
+
+    return g_yuvCpuLevel;
+}
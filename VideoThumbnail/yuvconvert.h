@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// YUV to BGRA conversion for the frame sources.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpulevel.h"
+
+class TaskPool;
+
+// NOTE: Layouts
+//
+// YuvImage describes planar (I420, 4:2:2, 4:4:4) and semi-planar (NV12)
+// images: for NV12, pU points to the interleaved UV plane, pV to pU + 1,
+// and chromaStep is 2. Chroma is subsampled by 2^chromaShiftX across and
+// 2^chromaShiftY down, and sampled from the nearest chroma pixel.
+//
+// The output is 32-bit BGRA with opaque alpha. Input is limited range
+// (16-235 luma), as decoders produce for video.
+//
+// bTopFieldOnly converts an interlaced frame from its top field alone,
+// doubling each line, which avoids combing without a deinterlacer.
+//
+// NOTE: Field drop
+//
+// ConvertYuvToBgraReduced converts at 1/2^shift of the size in both
+// directions, averaging each block of luma samples. With bTopFieldOnly,
+// the blocks take only top-field lines, so dropping the bottom field is
+// the first halving of the vertical downscale: a 1080i frame at shift 1
+// becomes a 960x540 picture of one field, with no deinterlacer, half of
+// the lines read and a quarter of the pixels converted. Chroma is taken
+// from the nearest sample of the block's first line.
+//
+// NOTE: Bands
+//
+// ConvertYuvRowsToBgra converts only some rows of the output, so that a
+// large frame can be converted a band at a time into a small buffer
+// instead of into one full-size copy (see bandscale.h). Rows are counted
+// in the output, after any reduction; the first converted row is written
+// at pDest.
+//
+// The functions take an optional TaskPool (see taskpool.h). With one, the
+// rows are split into bands that are converted in parallel, straight
+// into pDest.
+//
+// NOTE: Instruction sets
+//
+// Conversions of 4:2:0, 4:2:2, 4:4:4, NV12 and monochrome images use
+// SSE2, AVX2 or AVX-512 kernels, whichever is the best that the
+// processor supports (see cpulevel.h). Reduced conversions average the
+// blocks with SSE2 and convert them with the same kernels, so a field
+// drop to half size costs about half of a full conversion. All of them
+// give exactly the same output as the scalar code. SetYuvCpuLevel limits the level, to
+// compare or time the kernels; call it before any conversion starts.
+
+enum YUV_MATRIX
+{
+    YUV_MATRIX_BT601 = 0,
+    YUV_MATRIX_BT709
+};
+
+struct YuvImage
+{
+    uint32_t        width;
+    uint32_t        height;
+    const uint8_t   *pY;
+    int32_t         strideY;
+    const uint8_t   *pU;            // NULL for monochrome images.
+    const uint8_t   *pV;
+    int32_t         strideUV;
+    uint32_t        chromaStep;     // Bytes between chroma samples: 1, or 2 for NV12.
+    uint32_t        chromaShiftX;
+    uint32_t        chromaShiftY;
+    bool            bTopFieldOnly;
+};
+
+void ConvertYuvToBgra(const YuvImage& image, YUV_MATRIX matrix, uint8_t *pDest, int32_t destStride,
+    TaskPool *pPool = NULL);
+
+// Writes (width >> shift) x (height >> shift) pixels. shift is 0 to 3.
+void ConvertYuvToBgraReduced(const YuvImage& image, YUV_MATRIX matrix, uint32_t shift,
+    uint8_t *pDest, int32_t destStride, TaskPool *pPool = NULL);
+
+// Writes rows [firstRow, firstRow + cRows) of the image reduced by shift.
+void ConvertYuvRowsToBgra(const YuvImage& image, YUV_MATRIX matrix, uint32_t shift,
+    uint32_t firstRow, uint32_t cRows, uint8_t *pDest, int32_t destStride, TaskPool *pPool = NULL);
+
+CPU_LEVEL YuvCpuLevel();
+CPU_LEVEL SetYuvCpuLevel(CPU_LEVEL level);
+
+// The matrix to assume when the format does not say: BT.709 for HD.
+inline YUV_MATRIX DefaultYuvMatrix(uint32_t height)
+{
+    return (height > 576) ? YUV_MATRIX_BT709 : YUV_MATRIX_BT601;
+}